@@ -0,0 +1,302 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Capture-side companion to tracebench: drives trace::LocalWriter --
+ * the writer behind the generated wrappers -- at maximum rate with a
+ * synthetic GL-shaped workload, so capture overhead can be measured
+ * without an application or driver underneath.
+ *
+ * The workload follows the same call sequences a generated wrapper
+ * emits: an up-front registered signature table, the scalar-encoder
+ * fast path for glUniform-style calls, the classic beginArg path for
+ * draws, periodic 64 KiB buffer uploads and frame-terminating swaps.
+ * With --threads the same mix runs from several threads at once,
+ * exercising the lock-free capture buffers.
+ *
+ * The writer is configured the same way as in a traced process, via
+ * the TRACE_* environment variables (TRACE_FILE, TRACE_FRAMES,
+ * TRACE_FRAME_STEP, TRACE_FLIGHT, TRACE_SELF_PROFILE), so the cost of
+ * each capture mode can be compared across runs of this harness.
+ *
+ * Results are printed as a single JSON object for tracking over time:
+ *
+ *   capturebench [--calls N] [--threads T] [--keep] > result.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "os_process.hpp"
+#include "os_thread.hpp"
+#include "os_time.hpp"
+#include "trace.hpp"
+#include "trace_writer_local.hpp"
+
+
+static inline double
+now(void)
+{
+    return os::getTime() * (1.0 / os::timeFrequency);
+}
+
+
+static const char *drawArgNames[] = {"mode", "first", "count"};
+static const trace::FunctionSig drawSig = {0, "glDrawArrays", 3, drawArgNames};
+
+static const char *blobArgNames[] = {"target", "size", "data", "usage"};
+static const trace::FunctionSig blobSig = {1, "glBufferData", 4, blobArgNames};
+
+static const trace::FunctionSig swapSig = {2, "glXSwapBuffers", 0, NULL};
+
+static const char *uniformArgNames[] = {"location", "v0", "v1", "v2", "v3"};
+static const trace::FunctionSig uniformSig = {3, "glUniform4f", 5,
+                                              uniformArgNames};
+
+/* Registered up front, as the generated wrappers do, so the per-call
+ * path never hits a first-use definition stall. */
+static const trace::FunctionSig *sigTable[] = {
+    &drawSig,
+    &blobSig,
+    &swapSig,
+    &uniformSig,
+};
+
+
+struct WorkerArgs {
+    unsigned numCalls;
+    bool swaps;         /* only one thread ends frames, like an app */
+};
+
+
+static void
+emitDraw(unsigned i)
+{
+    unsigned call = trace::localWriter.beginEnter(&drawSig);
+    trace::localWriter.beginArg(0);
+    trace::localWriter.writeSInt(4);
+    trace::localWriter.endArg();
+    trace::localWriter.beginArg(1);
+    trace::localWriter.writeSInt(i % 1024);
+    trace::localWriter.endArg();
+    trace::localWriter.beginArg(2);
+    trace::localWriter.writeSInt(36);
+    trace::localWriter.endArg();
+    trace::localWriter.endEnter();
+    trace::localWriter.beginLeave(call);
+    trace::localWriter.endLeave();
+}
+
+
+static void
+emitUniform(unsigned i)
+{
+    unsigned call = trace::localWriter.beginEnter(&uniformSig);
+    trace::ScalarEncoder<64> enc;
+    enc.beginArg(0);
+    enc.writeSInt(i % 64);
+    enc.beginArg(1);
+    enc.writeFloat(1.0f);
+    enc.beginArg(2);
+    enc.writeFloat(0.5f);
+    enc.beginArg(3);
+    enc.writeFloat(0.25f);
+    enc.beginArg(4);
+    enc.writeFloat((float)(i & 0xff) * (1.0f / 255.0f));
+    trace::localWriter.writeEncoded(enc.buffer(), enc.size());
+    trace::localWriter.endEnter();
+    trace::localWriter.beginLeave(call);
+    trace::localWriter.endLeave();
+}
+
+
+static void
+emitBlob(const std::vector<char> &blob)
+{
+    unsigned call = trace::localWriter.beginEnter(&blobSig);
+    trace::localWriter.beginArg(0);
+    trace::localWriter.writeSInt(0x8892);
+    trace::localWriter.endArg();
+    trace::localWriter.beginArg(1);
+    trace::localWriter.writeUInt(blob.size());
+    trace::localWriter.endArg();
+    trace::localWriter.beginArg(2);
+    trace::localWriter.writeBlob(&blob[0], blob.size());
+    trace::localWriter.endArg();
+    trace::localWriter.beginArg(3);
+    trace::localWriter.writeSInt(0x88E4);
+    trace::localWriter.endArg();
+    trace::localWriter.endEnter();
+    trace::localWriter.beginLeave(call);
+    trace::localWriter.endLeave();
+}
+
+
+static void
+emitSwap(void)
+{
+    unsigned call = trace::localWriter.beginEnter(&swapSig);
+    trace::localWriter.endEnter();
+    trace::localWriter.beginLeave(call);
+    trace::localWriter.endLeave();
+}
+
+
+static void *
+worker(void *arg)
+{
+    const WorkerArgs *args = (const WorkerArgs *)arg;
+
+    std::vector<char> blob(64 * 1024);
+    for (size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = (char)(i * 2654435761U >> 13);
+    }
+
+    for (unsigned i = 0; i < args->numCalls; ++i) {
+        if (args->swaps && i % 500 == 499) {
+            emitSwap();
+        } else if (i % 100 == 99) {
+            emitBlob(blob);
+        } else if (i & 1) {
+            emitUniform(i);
+        } else {
+            emitDraw(i);
+        }
+    }
+
+    return NULL;
+}
+
+
+static uint64_t
+fileSize(const char *fileName)
+{
+    FILE *file = fopen(fileName, "rb");
+    if (!file) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (uint64_t)size : 0;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: capturebench [--calls N] [--threads T] [--keep]\n"
+            "\n"
+            "Benchmark the capture-side writer (trace::LocalWriter) with a\n"
+            "synthetic workload of N calls per thread (default 200000) and\n"
+            "print the results as JSON.  The writer is configured through\n"
+            "the usual TRACE_* environment variables; without TRACE_FILE a\n"
+            "temporary trace is written and removed unless --keep is given.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned numCalls = 200000;
+    unsigned numThreads = 1;
+    bool keep = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--calls") && i + 1 < argc) {
+            numCalls = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+            if (numThreads < 1) {
+                numThreads = 1;
+            }
+        } else if (!strcmp(argv[i], "--keep")) {
+            keep = true;
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage();
+            return 0;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    bool temporary = false;
+    if (!getenv("TRACE_FILE")) {
+        os::setEnvironment("TRACE_FILE", "capturebench.tmp.trace");
+        temporary = true;
+    }
+    std::string traceName = getenv("TRACE_FILE");
+
+    trace::registerSignatures(sigTable,
+                              sizeof sigTable / sizeof sigTable[0]);
+
+    WorkerArgs mainArgs = {numCalls, true};
+    WorkerArgs threadArgs = {numCalls, false};
+
+    double start = now();
+
+    /* Extra threads run the same mix without the frame-ending swaps,
+     * which real applications issue from a single thread. */
+    std::vector<os::thread> threads;
+    for (unsigned i = 1; i < numThreads; ++i) {
+        threads.push_back(os::thread(worker, &threadArgs));
+    }
+    worker(&mainArgs);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    trace::localWriter.flush();
+
+    double seconds = now() - start;
+
+    /* On-disk bytes; stays zero in flight mode, where records are only
+     * retained in memory until a dump trigger. */
+    uint64_t traceBytes = fileSize(traceName.c_str());
+
+    uint64_t totalCalls = (uint64_t)numCalls * numThreads;
+
+    printf("{\n");
+    printf("  \"trace\": \"%s\",\n", traceName.c_str());
+    printf("  \"threads\": %u,\n", numThreads);
+    printf("  \"calls\": %llu,\n", (unsigned long long)totalCalls);
+    printf("  \"calls_per_sec\": %.0f,\n", totalCalls / seconds);
+    printf("  \"us_per_call\": %.3f,\n", seconds * 1.0E6 / totalCalls);
+    printf("  \"trace_bytes\": %llu,\n", (unsigned long long)traceBytes);
+    printf("  \"write_mb_per_sec\": %.2f\n",
+           traceBytes / (1024.0 * 1024.0) / seconds);
+    printf("}\n");
+
+    if (temporary && !keep) {
+        remove(traceName.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,333 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Microbenchmarks for the trace container and parser, so that format
+ * and parser changes come with numbers instead of anecdotes.
+ *
+ * Measures, over a real trace or a synthetic one generated on the fly:
+ *
+ *   - Writer throughput (calls/s and MB/s of the synthetic trace)
+ *   - Container sequential read throughput (uncompressed MB/s)
+ *   - Container seek latency (random setCurrentOffset + read)
+ *   - Parser throughput in SCAN mode (calls/s, no Value objects)
+ *   - Parser throughput in FULL mode (calls/s; the delta to SCAN is
+ *     the Value allocation churn)
+ *
+ * Results are printed as a single JSON object for tracking over time:
+ *
+ *   tracebench [--calls N] [TRACE_FILE] > result.json
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "os_time.hpp"
+#include "trace_file.hpp"
+#include "trace_parser.hpp"
+#include "trace_writer.hpp"
+
+
+static inline double
+now(void)
+{
+    return os::getTime() * (1.0 / os::timeFrequency);
+}
+
+
+/**
+ * Deterministic synthetic trace: frames of small draw-like calls plus
+ * the occasional large blob upload, roughly the shape of a real
+ * workload.
+ */
+static bool
+writeSyntheticTrace(const char *fileName, unsigned numCalls,
+                    double &seconds)
+{
+    static const char *drawArgNames[] = {"mode", "first", "count"};
+    static trace::FunctionSig drawSig = {0, "glDrawArrays", 3, drawArgNames};
+    static const char *blobArgNames[] = {"target", "size", "data", "usage"};
+    static trace::FunctionSig blobSig = {1, "glBufferData", 4, blobArgNames};
+    static trace::FunctionSig swapSig = {2, "glXSwapBuffers", 0, NULL};
+
+    trace::Writer writer;
+    if (!writer.open(fileName)) {
+        fprintf(stderr, "error: failed to write %s\n", fileName);
+        return false;
+    }
+
+    std::vector<char> blob(64 * 1024);
+    for (size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = (char)(i * 2654435761U >> 13);
+    }
+
+    double start = now();
+
+    for (unsigned i = 0; i < numCalls; ++i) {
+        unsigned callNo;
+
+        if (i % 500 == 499) {
+            callNo = writer.beginEnter(&swapSig, 0);
+            writer.endEnter();
+            writer.beginLeave(callNo);
+            writer.endLeave();
+        } else if (i % 100 == 99) {
+            callNo = writer.beginEnter(&blobSig, 0);
+            writer.beginArg(0);
+            writer.writeSInt(0x8892);
+            writer.endArg();
+            writer.beginArg(1);
+            writer.writeUInt(blob.size());
+            writer.endArg();
+            writer.beginArg(2);
+            writer.writeBlob(&blob[0], blob.size());
+            writer.endArg();
+            writer.beginArg(3);
+            writer.writeSInt(0x88E4);
+            writer.endArg();
+            writer.endEnter();
+            writer.beginLeave(callNo);
+            writer.endLeave();
+        } else {
+            callNo = writer.beginEnter(&drawSig, 0);
+            writer.beginArg(0);
+            writer.writeSInt(4);
+            writer.endArg();
+            writer.beginArg(1);
+            writer.writeSInt(i % 1024);
+            writer.endArg();
+            writer.beginArg(2);
+            writer.writeSInt(36);
+            writer.endArg();
+            writer.endEnter();
+            writer.beginLeave(callNo);
+            writer.endLeave();
+        }
+    }
+
+    writer.close();
+
+    seconds = now() - start;
+    return true;
+}
+
+
+static bool
+benchSequentialRead(const char *fileName, double &mbPerSec,
+                    uint64_t &uncompressedBytes)
+{
+    trace::File *file = trace::File::createForRead(fileName);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<char> buffer(64 * 1024);
+    double start = now();
+
+    size_t got;
+    uncompressedBytes = 0;
+    while ((got = file->read(&buffer[0], buffer.size())) != 0) {
+        uncompressedBytes += got;
+    }
+
+    double seconds = now() - start;
+    file->close();
+    delete file;
+
+    mbPerSec = uncompressedBytes / (1024.0 * 1024.0) / seconds;
+    return true;
+}
+
+
+static bool
+benchSeekLatency(const char *fileName, double &usPerSeek)
+{
+    trace::Parser parser;
+    if (!parser.open(fileName)) {
+        return false;
+    }
+
+    if (!parser.supportsOffsets()) {
+        parser.close();
+        usPerSeek = -1.0;
+        return true;
+    }
+
+    /* Collect bookmarks spread over the whole trace */
+    std::vector<trace::ParseBookmark> bookmarks;
+    trace::Call *call;
+    unsigned no = 0;
+    for (;;) {
+        if (no++ % 1000 == 0) {
+            trace::ParseBookmark bookmark;
+            parser.getBookmark(bookmark);
+            bookmarks.push_back(bookmark);
+        }
+        if (!(call = parser.scan_call())) {
+            break;
+        }
+        delete call;
+    }
+
+    if (bookmarks.size() < 2) {
+        parser.close();
+        usPerSeek = -1.0;
+        return true;
+    }
+
+    /* Visit them in a scattered order, parsing one call at each stop */
+    unsigned seeks = 0;
+    double start = now();
+    for (size_t stride = 7; stride > 0; --stride) {
+        for (size_t i = stride % bookmarks.size(); i < bookmarks.size();
+             i += 7) {
+            parser.setBookmark(bookmarks[i]);
+            call = parser.scan_call();
+            delete call;
+            ++seeks;
+        }
+    }
+    double seconds = now() - start;
+    parser.close();
+
+    usPerSeek = seconds * 1.0E6 / seeks;
+    return true;
+}
+
+
+static bool
+benchParse(const char *fileName, bool scan, double &callsPerSec,
+           uint64_t &numCalls)
+{
+    trace::Parser parser;
+    if (!parser.open(fileName)) {
+        return false;
+    }
+
+    double start = now();
+
+    trace::Call *call;
+    numCalls = 0;
+    while ((call = scan ? parser.scan_call() : parser.parse_call())) {
+        ++numCalls;
+        delete call;
+    }
+
+    double seconds = now() - start;
+    parser.close();
+
+    callsPerSec = numCalls / seconds;
+    return true;
+}
+
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: tracebench [--calls N] [TRACE_FILE]\n"
+            "\n"
+            "Benchmark the trace container and parser and print the results\n"
+            "as JSON.  Without a trace file a synthetic trace of N calls\n"
+            "(default 200000) is generated, which also benchmarks the writer.\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned numCalls = 200000;
+    const char *traceName = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--calls") && i + 1 < argc) {
+            numCalls = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage();
+            return 0;
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 1;
+        } else {
+            traceName = argv[i];
+        }
+    }
+
+    std::string synthetic;
+    double writeSeconds = 0.0;
+
+    if (!traceName) {
+        synthetic = "tracebench.tmp.trace";
+        if (!writeSyntheticTrace(synthetic.c_str(), numCalls, writeSeconds)) {
+            return 1;
+        }
+        traceName = synthetic.c_str();
+    }
+
+    double readMbPerSec = 0.0;
+    uint64_t uncompressedBytes = 0;
+    if (!benchSequentialRead(traceName, readMbPerSec, uncompressedBytes)) {
+        fprintf(stderr, "error: failed to read %s\n", traceName);
+        return 1;
+    }
+
+    double usPerSeek = 0.0;
+    benchSeekLatency(traceName, usPerSeek);
+
+    double scanCallsPerSec = 0.0, fullCallsPerSec = 0.0;
+    uint64_t scanCalls = 0, fullCalls = 0;
+    benchParse(traceName, true, scanCallsPerSec, scanCalls);
+    benchParse(traceName, false, fullCallsPerSec, fullCalls);
+
+    printf("{\n");
+    printf("  \"trace\": \"%s\",\n", traceName);
+    printf("  \"uncompressed_bytes\": %llu,\n",
+           (unsigned long long)uncompressedBytes);
+    if (!synthetic.empty()) {
+        printf("  \"write_calls_per_sec\": %.0f,\n", numCalls / writeSeconds);
+        printf("  \"write_mb_per_sec\": %.2f,\n",
+               uncompressedBytes / (1024.0 * 1024.0) / writeSeconds);
+    }
+    printf("  \"read_mb_per_sec\": %.2f,\n", readMbPerSec);
+    if (usPerSeek >= 0.0) {
+        printf("  \"seek_us\": %.2f,\n", usPerSeek);
+    }
+    printf("  \"scan_calls_per_sec\": %.0f,\n", scanCallsPerSec);
+    printf("  \"parse_calls_per_sec\": %.0f,\n", fullCallsPerSec);
+    /* FULL pays for everything SCAN does plus the Value objects */
+    printf("  \"value_churn_us_per_call\": %.3f\n",
+           1.0E6 / fullCallsPerSec - 1.0E6 / scanCallsPerSec);
+    printf("}\n");
+
+    if (!synthetic.empty()) {
+        remove(synthetic.c_str());
+    }
+
+    return 0;
+}
@@ -40,14 +40,22 @@ struct Command {
     Function function;
 };
 
+extern const Command archive_command;
+extern const Command benchgen_command;
+extern const Command check_command;
+extern const Command daemon_command;
 extern const Command diff_command;
 extern const Command diff_state_command;
 extern const Command diff_images_command;
 extern const Command dump_command;
 extern const Command dump_images_command;
+extern const Command merge_command;
 extern const Command pickle_command;
 extern const Command repack_command;
+extern const Command repair_command;
 extern const Command retrace_command;
+extern const Command stats_command;
+extern const Command stream_command;
 extern const Command trace_command;
 extern const Command trim_command;
 
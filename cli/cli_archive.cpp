@@ -0,0 +1,474 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <snappy.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+
+#include "md5.hpp"
+#include "os_string.hpp"
+#include "trace_file.hpp"
+
+
+static const char *synopsis = "Deduplicate trace files into a content-addressed store.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace archive [OPTIONS] <trace-file> ...\n"
+        << "       apitrace archive -x [OPTIONS] <manifest> ...\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help           show this help message and exit\n"
+        "    -s, --store=DIR      chunk store directory (default\n"
+        "                         $APITRACE_ARCHIVE_STORE)\n"
+        "    -x, --extract        reconstruct traces from manifests\n"
+        "    -o, --output=FILE    output file name (single input only)\n"
+        "    -v, --verbose        report per-trace dedup statistics\n"
+        "\n"
+        "The decompressed trace stream is cut into content-defined chunks\n"
+        "which are stored once per distinct payload, so traces that share\n"
+        "content (same application, different drivers or trims) mostly\n"
+        "reference chunks already in the store.  Each trace becomes a small\n"
+        "manifest listing its chunk digests; extraction rebuilds a normal\n"
+        "snappy trace from the manifest (equivalent to the original, though\n"
+        "not byte-identical when the original used other compression or\n"
+        "chunk boundaries).\n"
+    ;
+}
+
+const static char *
+shortOptions = "hs:xo:v";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"store", required_argument, 0, 's'},
+    {"extract", no_argument, 0, 'x'},
+    {"output", required_argument, 0, 'o'},
+    {"verbose", no_argument, 0, 'v'},
+    {0, 0, 0, 0}
+};
+
+
+/*
+ * Content-defined chunking.
+ *
+ * Boundaries are declared where a rolling hash of the recent bytes
+ * matches a mask, so an insertion early in a trace only disturbs the
+ * chunks around it rather than shifting every later boundary -- which
+ * is what makes traces of the same application dedup against each
+ * other.  The bounds keep pathological streams (e.g. all zeros, which
+ * never match the mask, or noise that matches constantly) from
+ * producing degenerate chunk sizes.
+ */
+enum {
+    CHUNK_MIN = 128 * 1024,
+    CHUNK_MAX = 4 * 1024 * 1024,
+
+    /* One boundary per 2^20 bytes on average. */
+    CHUNK_MASK = (1 << 20) - 1
+};
+
+static uint32_t chunkGearTable[256];
+static bool chunkGearReady = false;
+
+static void
+initGearTable(void)
+{
+    /* Any fixed, well-mixed table works; derive one from an LCG so
+     * there is no 256-entry constant block to maintain. */
+    uint32_t x = 0x9e3779b9;
+    for (unsigned i = 0; i < 256; ++i) {
+        x = x * 1664525u + 1013904223u;
+        chunkGearTable[i] = x;
+    }
+    chunkGearReady = true;
+}
+
+static inline size_t
+nextChunkLength(const char *data, size_t length)
+{
+    if (length <= CHUNK_MIN) {
+        return length;
+    }
+
+    size_t end = length < CHUNK_MAX ? length : CHUNK_MAX;
+    uint32_t h = 0;
+    for (size_t i = CHUNK_MIN; i < end; ++i) {
+        h = (h << 1) + chunkGearTable[(unsigned char)data[i]];
+        if ((h & CHUNK_MASK) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+
+static bool
+makeDirectory(const os::String &path)
+{
+#ifdef _WIN32
+    return _mkdir(path.str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+static os::String
+objectPath(const char *store, const std::string &digest)
+{
+    os::String path(store);
+    path.join("objects");
+    path.join(digest.substr(0, 2).c_str());
+    path.join(digest.c_str());
+    return path;
+}
+
+/* Store one chunk under its digest, unless it is already present.
+ * The write goes through a per-process temporary name and a rename,
+ * so concurrent archivers sharing a store never observe partial
+ * objects.  Returns false on I/O failure. */
+static bool
+storeChunk(const char *store, const std::string &digest,
+           const char *data, size_t length, bool *stored)
+{
+    os::String path = objectPath(store, digest);
+    *stored = false;
+
+    if (path.exists()) {
+        return true;
+    }
+
+    {
+        os::String subdir(store);
+        subdir.join("objects");
+        makeDirectory(subdir);
+        subdir.join(digest.substr(0, 2).c_str());
+        makeDirectory(subdir);
+    }
+
+    std::string compressed;
+    ::snappy::Compress(data, length, &compressed);
+
+    os::String tmpPath = os::String::format("%s.%u", path.str(),
+                                            (unsigned)getpid());
+    std::ofstream out(tmpPath.str(), std::ofstream::binary);
+    if (!out) {
+        std::cerr << "error: failed to write " << tmpPath.str() << "\n";
+        return false;
+    }
+    out.write(&compressed[0], compressed.size());
+    out.close();
+    if (out.fail()) {
+        os::removeFile(tmpPath);
+        return false;
+    }
+
+    if (rename(tmpPath.str(), path.str()) != 0) {
+        /* Lost the race against another archiver; its copy has the
+         * same content. */
+        os::removeFile(tmpPath);
+    }
+
+    *stored = true;
+    return true;
+}
+
+static bool
+loadChunk(const char *store, const std::string &digest,
+          size_t expectedLength, std::string &chunk)
+{
+    os::String path = objectPath(store, digest);
+    std::ifstream in(path.str(), std::ifstream::binary);
+    if (!in) {
+        std::cerr << "error: missing chunk " << digest << "\n";
+        return false;
+    }
+
+    std::string compressed((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+
+    if (!::snappy::Uncompress(&compressed[0], compressed.size(), &chunk) ||
+        chunk.size() != expectedLength) {
+        std::cerr << "error: corrupt chunk " << digest << "\n";
+        return false;
+    }
+
+    unsigned char digestBytes[md5::DIGEST_SIZE];
+    md5::hash(&chunk[0], chunk.size(), digestBytes);
+    if (md5::hex(digestBytes) != digest) {
+        std::cerr << "error: chunk " << digest << " fails verification\n";
+        return false;
+    }
+
+    return true;
+}
+
+
+static int
+archiveTrace(const char *inFileName, const char *store,
+             const char *outFileName, bool verbose)
+{
+    trace::File *inFile = trace::File::createForRead(inFileName);
+    if (!inFile) {
+        return 1;
+    }
+
+    os::String manifestName;
+    if (outFileName) {
+        manifestName = outFileName;
+    } else {
+        manifestName = os::String::format("%s.manifest", inFileName);
+    }
+
+    std::ofstream manifest(manifestName.str());
+    if (!manifest) {
+        std::cerr << "error: failed to write " << manifestName.str() << "\n";
+        delete inFile;
+        return 1;
+    }
+    manifest << "# apitrace-archive 1\n";
+
+    /* Keep a window large enough that nextChunkLength always sees a
+     * full maximum-size chunk unless the trace has ended. */
+    std::vector<char> window(2 * CHUNK_MAX);
+    size_t pending = 0;
+    bool eof = false;
+
+    unsigned long long totalBytes = 0, storedBytes = 0;
+    unsigned totalChunks = 0, storedChunks = 0;
+    int ret = 0;
+
+    for (;;) {
+        if (!eof && pending < window.size()) {
+            size_t read = inFile->read(&window[pending],
+                                       window.size() - pending);
+            pending += read;
+            eof = read == 0;
+        }
+        if (!pending) {
+            break;
+        }
+
+        size_t length = nextChunkLength(&window[0], pending);
+        if (!eof && length == pending && pending < window.size()) {
+            /* Not a real boundary, just the end of the buffered data;
+             * top the window up first. */
+            continue;
+        }
+
+        unsigned char digestBytes[md5::DIGEST_SIZE];
+        md5::hash(&window[0], length, digestBytes);
+        std::string digest = md5::hex(digestBytes);
+
+        bool stored;
+        if (!storeChunk(store, digest, &window[0], length, &stored)) {
+            ret = 1;
+            break;
+        }
+
+        manifest << digest << " " << length << "\n";
+        ++totalChunks;
+        totalBytes += length;
+        if (stored) {
+            ++storedChunks;
+            storedBytes += length;
+        }
+
+        memmove(&window[0], &window[length], pending - length);
+        pending -= length;
+    }
+
+    manifest.close();
+    delete inFile;
+
+    if (ret == 0 && verbose) {
+        std::cout << inFileName << ": " << totalChunks << " chunks, "
+                  << totalBytes << " bytes; "
+                  << storedChunks << " new chunks, "
+                  << storedBytes << " bytes added to store\n";
+    }
+
+    return ret;
+}
+
+static int
+extractTrace(const char *manifestName, const char *store,
+             const char *outFileName)
+{
+    std::ifstream manifest(manifestName);
+    if (!manifest) {
+        std::cerr << "error: failed to open " << manifestName << "\n";
+        return 1;
+    }
+
+    os::String outName;
+    if (outFileName) {
+        outName = outFileName;
+    } else {
+        /* foo.trace.manifest -> foo.trace */
+        std::string name(manifestName);
+        size_t suffix = name.rfind(".manifest");
+        if (suffix != std::string::npos && suffix == name.size() - 9) {
+            name.erase(suffix);
+        } else {
+            name += ".trace";
+        }
+        outName = name.c_str();
+    }
+
+    trace::File *outFile = trace::File::createForWrite(outName.str());
+    if (!outFile) {
+        return 1;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            std::cerr << "error: malformed manifest line: " << line << "\n";
+            delete outFile;
+            return 1;
+        }
+        std::string digest = line.substr(0, space);
+        size_t length = strtoul(line.c_str() + space + 1, NULL, 10);
+
+        std::string chunk;
+        if (!loadChunk(store, digest, length, chunk)) {
+            delete outFile;
+            return 1;
+        }
+        outFile->write(&chunk[0], chunk.size());
+    }
+
+    outFile->close();
+    delete outFile;
+    std::cout << "Wrote " << outName.str() << "\n";
+    return 0;
+}
+
+
+static int
+command(int argc, char *argv[])
+{
+    const char *store = getenv("APITRACE_ARCHIVE_STORE");
+    const char *output = NULL;
+    bool extract = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 's':
+            store = optarg;
+            break;
+        case 'x':
+            extract = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "error: no input specified\n";
+        usage();
+        return 1;
+    }
+
+    if (!store) {
+        std::cerr << "error: no store specified "
+                     "(--store or APITRACE_ARCHIVE_STORE)\n";
+        return 1;
+    }
+
+    if (output && argc - optind != 1) {
+        std::cerr << "error: --output requires a single input\n";
+        return 1;
+    }
+
+    if (!chunkGearReady) {
+        initGearTable();
+    }
+
+    if (!extract) {
+        makeDirectory(os::String(store));
+    }
+
+    int ret = 0;
+    for (int i = optind; i < argc; ++i) {
+        if (extract) {
+            ret |= extractTrace(argv[i], store, output);
+        } else {
+            ret |= archiveTrace(argv[i], store, output, verbose);
+        }
+    }
+
+    return ret;
+}
+
+const Command archive_command = {
+    "archive",
+    synopsis,
+    usage,
+    command
+};
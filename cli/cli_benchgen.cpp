@@ -0,0 +1,527 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <string.h>
+#include <limits.h> // for UINT_MAX
+#include <getopt.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+
+#include "os_string.hpp"
+
+#include "trace_parser.hpp"
+
+
+static const char *synopsis = "Compile a trace's call mix into a synthetic benchmark source.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace benchgen [OPTIONS] TRACE_FILE\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help            Show this help message and exit\n"
+        "    -o, --output=FILE     Output C++ source file\n"
+        "        --frames=N        Only compile the first N frames\n"
+        "\n"
+        "Scans the trace and emits a standalone GLX micro-benchmark that\n"
+        "reissues the same per-frame mix of draws, texture/buffer/program\n"
+        "binds, uniform updates and other state changes against small\n"
+        "synthetic resources.  No application data is carried over, so the\n"
+        "result reproduces a title's driver overhead profile without\n"
+        "shipping the trace itself.\n"
+    ;
+}
+
+enum {
+    FRAMES_OPT = CHAR_MAX + 1,
+};
+
+const static char *
+shortOptions = "ho:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"output", required_argument, 0, 'o'},
+    {"frames", required_argument, 0, FRAMES_OPT},
+    {0, 0, 0, 0}
+};
+
+/* Per-frame tallies of the call classes the generated benchmark can
+ * reissue. */
+struct FrameMix {
+    unsigned draws;
+    unsigned texBinds;
+    unsigned bufBinds;
+    unsigned progBinds;
+    unsigned uniforms;
+    unsigned otherState;
+
+    FrameMix() :
+        draws(0), texBinds(0), bufBinds(0), progBinds(0),
+        uniforms(0), otherState(0)
+    {}
+};
+
+struct BenchStats {
+    std::vector<FrameMix> frames;
+
+    /* Distinct resource ids seen, to size the synthetic pools */
+    std::set<unsigned long long> textures;
+    std::set<unsigned long long> buffers;
+    std::set<unsigned long long> programs;
+
+    /* For the provenance comment in the generated source */
+    std::map<std::string, unsigned> callCounts;
+    unsigned totalCalls;
+
+    BenchStats() : totalCalls(0) {}
+};
+
+static int
+scanTrace(const char *filename, unsigned maxFrames, BenchStats &stats)
+{
+    trace::Parser p;
+
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        return 1;
+    }
+
+    FrameMix mix;
+    trace::Call *call;
+    while ((call = p.parse_call())) {
+        const char *name = call->name();
+
+        ++stats.callCounts[name];
+        ++stats.totalCalls;
+
+        if (call->flags & trace::CALL_FLAG_END_FRAME) {
+            stats.frames.push_back(mix);
+            mix = FrameMix();
+            delete call;
+            if (stats.frames.size() >= maxFrames) {
+                break;
+            }
+            continue;
+        }
+
+        if (call->flags & trace::CALL_FLAG_RENDER) {
+            ++mix.draws;
+        } else if (strncmp(name, "glBindTexture", 13) == 0) {
+            ++mix.texBinds;
+            if (call->args.size() > 1 && call->args[1].value) {
+                stats.textures.insert(call->arg(1).toUInt());
+            }
+        } else if (strncmp(name, "glBindBuffer", 12) == 0) {
+            ++mix.bufBinds;
+            if (call->args.size() > 1 && call->args[1].value) {
+                stats.buffers.insert(call->arg(1).toUInt());
+            }
+        } else if (strcmp(name, "glUseProgram") == 0) {
+            ++mix.progBinds;
+            if (call->args.size() > 0 && call->args[0].value) {
+                stats.programs.insert(call->arg(0).toUInt());
+            }
+        } else if (strncmp(name, "glUniform", 9) == 0) {
+            ++mix.uniforms;
+        } else if (!(call->flags & trace::CALL_FLAG_NO_SIDE_EFFECTS)) {
+            ++mix.otherState;
+        }
+
+        delete call;
+    }
+
+    /* A trailing partial frame is a benchmarkable frame too */
+    if (mix.draws || mix.texBinds || mix.bufBinds ||
+        mix.progBinds || mix.uniforms || mix.otherState) {
+        stats.frames.push_back(mix);
+    }
+
+    return 0;
+}
+
+static bool
+countGreater(const std::pair<unsigned, std::string> &a,
+             const std::pair<unsigned, std::string> &b)
+{
+    return a.first > b.first;
+}
+
+static int
+writeBenchmark(const char *traceName, const char *outName,
+               const BenchStats &stats)
+{
+    std::ofstream out(outName);
+    if (!out.is_open()) {
+        std::cerr << "error: failed to create " << outName << "\n";
+        return 1;
+    }
+
+    /* Keep the synthetic pools within reason; cycling through a few
+     * hundred objects already defeats driver caching the same way the
+     * full set does. */
+    size_t numTextures = std::min<size_t>(std::max<size_t>(stats.textures.size(), 1), 256);
+    size_t numBuffers = std::min<size_t>(std::max<size_t>(stats.buffers.size(), 1), 256);
+    size_t numPrograms = std::min<size_t>(std::max<size_t>(stats.programs.size(), 1), 64);
+
+    out <<
+        "/*\n"
+        " * Synthetic driver-overhead benchmark generated by apitrace benchgen\n"
+        " * from " << traceName << ".\n"
+        " *\n"
+        " * " << stats.frames.size() << " frames, " << stats.totalCalls << " calls; "
+        << stats.textures.size() << " textures, "
+        << stats.buffers.size() << " buffers, "
+        << stats.programs.size() << " programs in the original.\n"
+        " *\n"
+        " * Most frequent calls in the source trace:\n";
+
+    std::vector<std::pair<unsigned, std::string> > ranked;
+    for (std::map<std::string, unsigned>::const_iterator it = stats.callCounts.begin();
+         it != stats.callCounts.end(); ++it) {
+        ranked.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(ranked.begin(), ranked.end(), countGreater);
+    for (size_t i = 0; i < ranked.size() && i < 10; ++i) {
+        out << " *   " << ranked[i].second << ": " << ranked[i].first << "\n";
+    }
+
+    out <<
+        " *\n"
+        " * Build with:  g++ -O2 -o bench <this file> -lGL -lX11\n"
+        " */\n"
+        "\n"
+        "#include <stdio.h>\n"
+        "#include <stdlib.h>\n"
+        "#include <time.h>\n"
+        "\n"
+        "#include <X11/Xlib.h>\n"
+        "#include <GL/gl.h>\n"
+        "#include <GL/glext.h>\n"
+        "#include <GL/glx.h>\n"
+        "\n"
+        "/* Canonical declaration; some glx.h versions hide it */\n"
+        "extern \"C\" void (*glXGetProcAddressARB(const GLubyte *))(void);\n"
+        "\n"
+        "#define NUM_TEXTURES " << numTextures << "\n"
+        "#define NUM_BUFFERS " << numBuffers << "\n"
+        "#define NUM_PROGRAMS " << numPrograms << "\n"
+        "\n"
+        "struct FrameMix {\n"
+        "    unsigned draws;\n"
+        "    unsigned texBinds;\n"
+        "    unsigned bufBinds;\n"
+        "    unsigned progBinds;\n"
+        "    unsigned uniforms;\n"
+        "    unsigned otherState;\n"
+        "};\n"
+        "\n"
+        "static const FrameMix frames[] = {\n";
+
+    for (size_t i = 0; i < stats.frames.size(); ++i) {
+        const FrameMix &mix = stats.frames[i];
+        out << "    {" << mix.draws << ", " << mix.texBinds << ", "
+            << mix.bufBinds << ", " << mix.progBinds << ", "
+            << mix.uniforms << ", " << mix.otherState << "},\n";
+    }
+
+    out <<
+        "};\n"
+        "\n"
+        "#define NUM_FRAMES (sizeof frames / sizeof frames[0])\n"
+        "\n"
+        "/* GL 2.0 entry points, resolved at runtime so the benchmark only\n"
+        " * links against libGL */\n"
+        "static PFNGLGENBUFFERSPROC p_glGenBuffers;\n"
+        "static PFNGLBINDBUFFERPROC p_glBindBuffer;\n"
+        "static PFNGLBUFFERDATAPROC p_glBufferData;\n"
+        "static PFNGLCREATESHADERPROC p_glCreateShader;\n"
+        "static PFNGLSHADERSOURCEPROC p_glShaderSource;\n"
+        "static PFNGLCOMPILESHADERPROC p_glCompileShader;\n"
+        "static PFNGLCREATEPROGRAMPROC p_glCreateProgram;\n"
+        "static PFNGLATTACHSHADERPROC p_glAttachShader;\n"
+        "static PFNGLLINKPROGRAMPROC p_glLinkProgram;\n"
+        "static PFNGLUSEPROGRAMPROC p_glUseProgram;\n"
+        "static PFNGLGETUNIFORMLOCATIONPROC p_glGetUniformLocation;\n"
+        "static PFNGLUNIFORM4FPROC p_glUniform4f;\n"
+        "\n"
+        "static void *\n"
+        "resolve(const char *name)\n"
+        "{\n"
+        "    void *ptr = (void *)glXGetProcAddressARB((const GLubyte *)name);\n"
+        "    if (!ptr) {\n"
+        "        fprintf(stderr, \"error: %s not available\\n\", name);\n"
+        "        exit(1);\n"
+        "    }\n"
+        "    return ptr;\n"
+        "}\n"
+        "\n"
+        "static const char *vertSrc =\n"
+        "    \"uniform vec4 offset;\\n\"\n"
+        "    \"void main() { gl_Position = gl_Vertex + offset; }\\n\";\n"
+        "static const char *fragSrc =\n"
+        "    \"void main() { gl_FragColor = vec4(0.5); }\\n\";\n"
+        "\n"
+        "static GLuint textures[NUM_TEXTURES];\n"
+        "static GLuint buffers[NUM_BUFFERS];\n"
+        "static GLuint programs[NUM_PROGRAMS];\n"
+        "static GLint uniformLocs[NUM_PROGRAMS];\n"
+        "\n"
+        "static double\n"
+        "now(void)\n"
+        "{\n"
+        "    struct timespec ts;\n"
+        "    clock_gettime(CLOCK_MONOTONIC, &ts);\n"
+        "    return ts.tv_sec + ts.tv_nsec * 1e-9;\n"
+        "}\n"
+        "\n"
+        "int\n"
+        "main(void)\n"
+        "{\n"
+        "    Display *dpy = XOpenDisplay(NULL);\n"
+        "    if (!dpy) {\n"
+        "        fprintf(stderr, \"error: cannot open display\\n\");\n"
+        "        return 1;\n"
+        "    }\n"
+        "\n"
+        "    int attribs[] = {GLX_RGBA, GLX_DOUBLEBUFFER, GLX_DEPTH_SIZE, 16, None};\n"
+        "    XVisualInfo *visual = glXChooseVisual(dpy, DefaultScreen(dpy), attribs);\n"
+        "    if (!visual) {\n"
+        "        fprintf(stderr, \"error: no suitable visual\\n\");\n"
+        "        return 1;\n"
+        "    }\n"
+        "\n"
+        "    XSetWindowAttributes wa;\n"
+        "    wa.colormap = XCreateColormap(dpy, RootWindow(dpy, visual->screen),\n"
+        "                                  visual->visual, AllocNone);\n"
+        "    wa.border_pixel = 0;\n"
+        "    Window win = XCreateWindow(dpy, RootWindow(dpy, visual->screen),\n"
+        "                               0, 0, 512, 512, 0, visual->depth,\n"
+        "                               InputOutput, visual->visual,\n"
+        "                               CWColormap | CWBorderPixel, &wa);\n"
+        "    XMapWindow(dpy, win);\n"
+        "\n"
+        "    GLXContext ctx = glXCreateContext(dpy, visual, NULL, True);\n"
+        "    glXMakeCurrent(dpy, win, ctx);\n"
+        "\n"
+        "    p_glGenBuffers = (PFNGLGENBUFFERSPROC)resolve(\"glGenBuffers\");\n"
+        "    p_glBindBuffer = (PFNGLBINDBUFFERPROC)resolve(\"glBindBuffer\");\n"
+        "    p_glBufferData = (PFNGLBUFFERDATAPROC)resolve(\"glBufferData\");\n"
+        "    p_glCreateShader = (PFNGLCREATESHADERPROC)resolve(\"glCreateShader\");\n"
+        "    p_glShaderSource = (PFNGLSHADERSOURCEPROC)resolve(\"glShaderSource\");\n"
+        "    p_glCompileShader = (PFNGLCOMPILESHADERPROC)resolve(\"glCompileShader\");\n"
+        "    p_glCreateProgram = (PFNGLCREATEPROGRAMPROC)resolve(\"glCreateProgram\");\n"
+        "    p_glAttachShader = (PFNGLATTACHSHADERPROC)resolve(\"glAttachShader\");\n"
+        "    p_glLinkProgram = (PFNGLLINKPROGRAMPROC)resolve(\"glLinkProgram\");\n"
+        "    p_glUseProgram = (PFNGLUSEPROGRAMPROC)resolve(\"glUseProgram\");\n"
+        "    p_glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)resolve(\"glGetUniformLocation\");\n"
+        "    p_glUniform4f = (PFNGLUNIFORM4FPROC)resolve(\"glUniform4f\");\n"
+        "\n"
+        "    /* Synthetic resources: small enough to stay cheap, numerous\n"
+        "     * enough to defeat driver caching of a single object */\n"
+        "    static unsigned char texels[64 * 64 * 4];\n"
+        "    glGenTextures(NUM_TEXTURES, textures);\n"
+        "    for (unsigned i = 0; i < NUM_TEXTURES; ++i) {\n"
+        "        glBindTexture(GL_TEXTURE_2D, textures[i]);\n"
+        "        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);\n"
+        "        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 64, 64, 0,\n"
+        "                     GL_RGBA, GL_UNSIGNED_BYTE, texels);\n"
+        "    }\n"
+        "\n"
+        "    static const float verts[] = {\n"
+        "        -0.01f, -0.01f, 0.01f, -0.01f, 0.0f, 0.01f,\n"
+        "    };\n"
+        "    p_glGenBuffers(NUM_BUFFERS, buffers);\n"
+        "    for (unsigned i = 0; i < NUM_BUFFERS; ++i) {\n"
+        "        p_glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);\n"
+        "        p_glBufferData(GL_ARRAY_BUFFER, sizeof verts, verts, GL_STATIC_DRAW);\n"
+        "    }\n"
+        "\n"
+        "    GLuint vs = p_glCreateShader(GL_VERTEX_SHADER);\n"
+        "    p_glShaderSource(vs, 1, &vertSrc, NULL);\n"
+        "    p_glCompileShader(vs);\n"
+        "    GLuint fs = p_glCreateShader(GL_FRAGMENT_SHADER);\n"
+        "    p_glShaderSource(fs, 1, &fragSrc, NULL);\n"
+        "    p_glCompileShader(fs);\n"
+        "    for (unsigned i = 0; i < NUM_PROGRAMS; ++i) {\n"
+        "        programs[i] = p_glCreateProgram();\n"
+        "        p_glAttachShader(programs[i], vs);\n"
+        "        p_glAttachShader(programs[i], fs);\n"
+        "        p_glLinkProgram(programs[i]);\n"
+        "        uniformLocs[i] = p_glGetUniformLocation(programs[i], \"offset\");\n"
+        "    }\n"
+        "\n"
+        "    glEnableClientState(GL_VERTEX_ARRAY);\n"
+        "    p_glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);\n"
+        "    glVertexPointer(2, GL_FLOAT, 0, 0);\n"
+        "    p_glUseProgram(programs[0]);\n"
+        "\n"
+        "    unsigned texCursor = 0, bufCursor = 0, progCursor = 0;\n"
+        "    unsigned prog = 0;\n"
+        "\n"
+        "    double start = now();\n"
+        "    unsigned long long issued = 0;\n"
+        "\n"
+        "    for (unsigned f = 0; f < NUM_FRAMES; ++f) {\n"
+        "        const FrameMix &mix = frames[f];\n"
+        "        unsigned n = mix.draws;\n"
+        "        unsigned tex = mix.texBinds, buf = mix.bufBinds;\n"
+        "        unsigned pr = mix.progBinds, uni = mix.uniforms;\n"
+        "        unsigned other = mix.otherState;\n"
+        "\n"
+        "        /* Spread the state changes across the draws roughly the\n"
+        "         * way the original frame did */\n"
+        "        for (unsigned d = 0; d < n || tex || buf || pr || uni || other; ++d) {\n"
+        "            if (tex) {\n"
+        "                glBindTexture(GL_TEXTURE_2D,\n"
+        "                              textures[texCursor++ % NUM_TEXTURES]);\n"
+        "                --tex; ++issued;\n"
+        "            }\n"
+        "            if (buf) {\n"
+        "                p_glBindBuffer(GL_ARRAY_BUFFER,\n"
+        "                               buffers[bufCursor++ % NUM_BUFFERS]);\n"
+        "                glVertexPointer(2, GL_FLOAT, 0, 0);\n"
+        "                --buf; ++issued;\n"
+        "            }\n"
+        "            if (pr) {\n"
+        "                prog = progCursor++ % NUM_PROGRAMS;\n"
+        "                p_glUseProgram(programs[prog]);\n"
+        "                --pr; ++issued;\n"
+        "            }\n"
+        "            if (uni) {\n"
+        "                p_glUniform4f(uniformLocs[prog],\n"
+        "                              d * 0.001f, f * 0.001f, 0.0f, 0.0f);\n"
+        "                --uni; ++issued;\n"
+        "            }\n"
+        "            if (other) {\n"
+        "                ((d & 1) ? glEnable : glDisable)(GL_SCISSOR_TEST);\n"
+        "                --other; ++issued;\n"
+        "            }\n"
+        "            if (d < n) {\n"
+        "                glDrawArrays(GL_TRIANGLES, 0, 3);\n"
+        "                ++issued;\n"
+        "            }\n"
+        "        }\n"
+        "\n"
+        "        glXSwapBuffers(dpy, win);\n"
+        "        ++issued;\n"
+        "    }\n"
+        "\n"
+        "    glFinish();\n"
+        "    double elapsed = now() - start;\n"
+        "\n"
+        "    printf(\"%u frames, %llu calls in %.3f s: %.2f fps, %.0f calls/s\\n\",\n"
+        "           (unsigned)NUM_FRAMES, issued, elapsed,\n"
+        "           NUM_FRAMES / elapsed, issued / elapsed);\n"
+        "\n"
+        "    glXMakeCurrent(dpy, None, NULL);\n"
+        "    glXDestroyContext(dpy, ctx);\n"
+        "    XDestroyWindow(dpy, win);\n"
+        "    XCloseDisplay(dpy);\n"
+        "    return 0;\n"
+        "}\n";
+
+    if (!out.good()) {
+        std::cerr << "error: failed writing " << outName << "\n";
+        return 1;
+    }
+
+    std::cerr << "Benchmark source is available as " << outName << "\n";
+
+    return 0;
+}
+
+static int
+command(int argc, char *argv[])
+{
+    std::string output;
+    unsigned maxFrames = UINT_MAX;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'o':
+            output = optarg;
+            break;
+        case FRAMES_OPT:
+            maxFrames = atoi(optarg);
+            if (!maxFrames) {
+                std::cerr << "error: invalid frame count " << optarg << "\n";
+                return 1;
+            }
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "error: apitrace benchgen requires a trace file as an argument.\n";
+        usage();
+        return 1;
+    }
+
+    if (output.empty()) {
+        os::String base(argv[optind]);
+        base.trimExtension();
+
+        output = std::string(base.str()) + std::string("-bench.cpp");
+    }
+
+    BenchStats stats;
+    if (scanTrace(argv[optind], maxFrames, stats)) {
+        return 1;
+    }
+
+    if (stats.frames.empty()) {
+        std::cerr << "error: no frames found in " << argv[optind] << "\n";
+        return 1;
+    }
+
+    return writeBenchmark(argv[optind], output.c_str(), stats);
+}
+
+const Command benchgen_command = {
+    "benchgen",
+    synopsis,
+    usage,
+    command
+};
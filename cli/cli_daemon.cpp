@@ -0,0 +1,680 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Persistent analysis daemon with a parsed-trace cache.
+ *
+ * Interactive analysis runs one cli command after another against the
+ * same trace, and each pays the full open cost: decompressing from the
+ * start, re-interning every signature, rebuilding seek state.  The
+ * daemon keeps recently queried traces open -- parser, interned
+ * signatures and a grid of seek checkpoints -- and serves queries over
+ * a unix socket, so only the first query of a session pays for the
+ * scan.
+ *
+ * One request per connection, three text lines:
+ *
+ *     dump <dumpFlags> <threadIds> <verbose>    (or: stats | quit)
+ *     <absolute trace path>                     (empty for quit)
+ *     <callset>                                 (empty for default)
+ *
+ * The response is a status line ("OK" or "error: ...") followed by the
+ * query's raw output until the connection closes.  `apitrace dump`
+ * forwards its queries automatically when APITRACE_DAEMON names the
+ * socket (see daemonDump below); other tools can speak the protocol
+ * directly.
+ *
+ * Unix sockets only, so the command is not available on Windows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+
+#include <iostream>
+#include <string>
+
+#include "cli.hpp"
+#include "cli_daemon.hpp"
+
+#include "trace_callset.hpp"
+#include "trace_dump.hpp"
+#include "trace_parser.hpp"
+
+
+static const char *synopsis =
+    "Serve dump/stats queries from a cache of open traces.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace daemon [OPTIONS]\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help           show this help message and exit\n"
+        "    --socket=PATH        listen on PATH (default:\n"
+        "                         /tmp/apitrace-daemon-<uid>.sock)\n"
+        "    --max-traces=N       keep at most N traces open (default 8)\n"
+        "\n"
+        "Point APITRACE_DAEMON at the socket and `apitrace dump` will\n"
+        "send its queries here, paying the trace open and scan cost only\n"
+        "once per session.\n"
+    ;
+}
+
+#ifdef _WIN32
+
+static int
+command(int argc, char *argv[])
+{
+    std::cerr << "error: apitrace daemon is not supported on Windows\n";
+    return 1;
+}
+
+int
+daemonDump(const char *, const char *, trace::DumpFlags, bool, bool)
+{
+    return -1;
+}
+
+#else /* !_WIN32 */
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "os.hpp"
+#include "os_string.hpp"
+
+
+/**
+ * Buffered std::streambuf over a socket descriptor, so the dump path
+ * can write to a client exactly as it writes to std::cout.
+ */
+class FdStreamBuf : public std::streambuf
+{
+public:
+    FdStreamBuf(int fd) :
+        m_fd(fd)
+    {
+        setp(m_buffer, m_buffer + sizeof m_buffer);
+    }
+
+    ~FdStreamBuf() {
+        sync();
+    }
+
+protected:
+    int_type overflow(int_type c) {
+        if (sync() != 0) {
+            return traits_type::eof();
+        }
+        if (c != traits_type::eof()) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return c;
+    }
+
+    int sync(void) {
+        const char *p = pbase();
+        while (p != pptr()) {
+            ssize_t written = write(m_fd, p, pptr() - p);
+            if (written <= 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            p += written;
+        }
+        setp(m_buffer, m_buffer + sizeof m_buffer);
+        return 0;
+    }
+
+private:
+    int m_fd;
+    char m_buffer[64 * 1024];
+};
+
+
+/* Calls between seek checkpoints; a numeric-range query parses at most
+ * this many calls before its range starts. */
+#define CALLS_PER_CHECKPOINT 8192
+
+
+/**
+ * A trace held open between queries: the parser (with its interned
+ * signatures), seek checkpoints, and the per-function tallies gathered
+ * by the opening scan.
+ */
+struct CachedTrace {
+    std::string path;
+    trace::Parser parser;
+    bool canSeek;
+
+    /* Bookmark before call checkpoints[i] * CALLS_PER_CHECKPOINT. */
+    std::vector<trace::ParseBookmark> checkpoints;
+
+    unsigned numCalls;
+    unsigned numFrames;
+
+    struct FunctionCount {
+        std::string name;
+        uint64_t count;
+
+        FunctionCount() : count(0) {}
+    };
+    std::map<unsigned, FunctionCount> functions;
+
+    uint64_t lastUsed;
+
+    CachedTrace() :
+        canSeek(false),
+        numCalls(0),
+        numFrames(0),
+        lastUsed(0)
+    {}
+
+    bool
+    open(void) {
+        if (!parser.open(path.c_str())) {
+            return false;
+        }
+        canSeek = parser.supportsOffsets();
+
+        /* One signature-only scan builds everything a session needs:
+         * interned signatures, checkpoints, and the stats tallies. */
+        if (canSeek) {
+            trace::ParseBookmark begin;
+            parser.getBookmark(begin);
+            checkpoints.push_back(begin);
+        }
+
+        trace::Call *call;
+        while ((call = parser.scan_call())) {
+            ++numCalls;
+            if (call->flags & trace::CALL_FLAG_END_FRAME) {
+                ++numFrames;
+            }
+            FunctionCount &fn = functions[call->sig->id];
+            if (!fn.count) {
+                fn.name = call->name();
+            }
+            ++fn.count;
+            if (canSeek && numCalls % CALLS_PER_CHECKPOINT == 0) {
+                trace::ParseBookmark checkpoint;
+                parser.getBookmark(checkpoint);
+                checkpoints.push_back(checkpoint);
+            }
+            delete call;
+        }
+        return true;
+    }
+
+    /* Position the parser so that the next parsed call is the first
+     * checkpointed call at or before callNo.  Returns false when the
+     * container cannot seek (the caller must reopen instead). */
+    bool
+    seekTo(trace::CallNo callNo) {
+        if (!canSeek) {
+            return false;
+        }
+        size_t idx = callNo / CALLS_PER_CHECKPOINT;
+        if (idx >= checkpoints.size()) {
+            idx = checkpoints.size() - 1;
+        }
+        parser.setBookmark(checkpoints[idx]);
+        return true;
+    }
+};
+
+
+static std::map<std::string, CachedTrace *> traceCache;
+static size_t maxTraces = 8;
+static uint64_t useCounter = 0;
+
+
+static CachedTrace *
+lookupTrace(const std::string &path, std::string &error)
+{
+    std::map<std::string, CachedTrace *>::iterator found =
+        traceCache.find(path);
+    if (found != traceCache.end()) {
+        found->second->lastUsed = ++useCounter;
+        return found->second;
+    }
+
+    while (traceCache.size() >= maxTraces) {
+        std::map<std::string, CachedTrace *>::iterator victim =
+            traceCache.begin();
+        for (std::map<std::string, CachedTrace *>::iterator it =
+             traceCache.begin(); it != traceCache.end(); ++it) {
+            if (it->second->lastUsed < victim->second->lastUsed) {
+                victim = it;
+            }
+        }
+        std::cerr << "apitrace: daemon: closing " << victim->first << "\n";
+        delete victim->second;
+        traceCache.erase(victim);
+    }
+
+    CachedTrace *cached = new CachedTrace;
+    cached->path = path;
+    std::cerr << "apitrace: daemon: opening " << path << "\n";
+    if (!cached->open()) {
+        delete cached;
+        error = "failed to open " + path;
+        return NULL;
+    }
+    cached->lastUsed = ++useCounter;
+    traceCache[path] = cached;
+    return cached;
+}
+
+
+static void
+serveDump(CachedTrace *cached, const std::string &callSetStr,
+          trace::DumpFlags dumpFlags, bool dumpThreadIds, bool verbose,
+          std::ostream &os)
+{
+    trace::CallSet callSet(trace::FREQUENCY_ALL);
+    if (!callSetStr.empty()) {
+        callSet = trace::CallSet(callSetStr.c_str());
+    }
+
+    trace::Parser &p = cached->parser;
+
+    /* Numeric sets start at the nearest checkpoint before their first
+     * call; everything else replays from the top. */
+    bool bounded = callSet.namePatterns.empty() &&
+                   callSet.getLast() != std::numeric_limits<trace::CallNo>::max();
+    if (!cached->seekTo(bounded ? callSet.getFirst() : 0)) {
+        p.close();
+        if (!p.open(cached->path.c_str())) {
+            os << "error: failed to reopen " << cached->path << "\n";
+            return;
+        }
+    }
+
+    p.setLazyBlobs(true);
+
+    // Name patterns let the parser skip non-matching calls without
+    // ever materializing them
+    p.focus(&callSet);
+
+    trace::Call *call;
+    while ((call = p.parse_call())) {
+        if (bounded && call->no > callSet.getLast()) {
+            delete call;
+            break;
+        }
+        if (callSet.contains(*call)) {
+            if (verbose ||
+                !(call->flags & trace::CALL_FLAG_VERBOSE)) {
+                if (dumpThreadIds) {
+                    os << std::hex << call->thread_id << std::dec << " ";
+                }
+                trace::dump(*call, os, dumpFlags);
+            }
+        }
+        delete call;
+    }
+
+    p.focus(NULL);
+}
+
+
+static bool
+moreCalls(const CachedTrace::FunctionCount *a,
+          const CachedTrace::FunctionCount *b)
+{
+    return a->count > b->count;
+}
+
+static void
+serveStats(CachedTrace *cached, std::ostream &os)
+{
+    os << cached->path << ":\n";
+    os << "  calls:  " << cached->numCalls << "\n";
+    os << "  frames: " << cached->numFrames << "\n";
+    os << "  functions:\n";
+
+    std::vector<const CachedTrace::FunctionCount *> functions;
+    std::map<unsigned, CachedTrace::FunctionCount>::const_iterator it;
+    for (it = cached->functions.begin(); it != cached->functions.end();
+         ++it) {
+        functions.push_back(&it->second);
+    }
+    std::sort(functions.begin(), functions.end(), moreCalls);
+
+    for (size_t i = 0; i < functions.size(); ++i) {
+        os << "    " << functions[i]->count
+           << " " << functions[i]->name << "\n";
+    }
+}
+
+
+/* Read a '\n'-terminated line from fd; false on EOF or error. */
+static bool
+readLine(int fd, std::string &line)
+{
+    line.clear();
+    char c;
+    for (;;) {
+        ssize_t got = read(fd, &c, 1);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        if (c == '\n') {
+            return true;
+        }
+        line.push_back(c);
+    }
+}
+
+
+/* Returns false when the daemon should exit. */
+static bool
+serveConnection(int fd)
+{
+    std::string request, path, callSet;
+    if (!readLine(fd, request) ||
+        !readLine(fd, path) ||
+        !readLine(fd, callSet)) {
+        return true;
+    }
+
+    FdStreamBuf streamBuf(fd);
+    std::ostream os(&streamBuf);
+
+    if (request == "quit") {
+        os << "OK\n";
+        return false;
+    }
+
+    unsigned dumpFlags = 0, threadIds = 0, verbose = 0;
+    bool isDump =
+        sscanf(request.c_str(), "dump %u %u %u",
+               &dumpFlags, &threadIds, &verbose) == 3;
+    if (!isDump && request != "stats") {
+        os << "error: malformed request\n";
+        return true;
+    }
+
+    std::string error;
+    CachedTrace *cached = lookupTrace(path, error);
+    if (!cached) {
+        os << "error: " << error << "\n";
+        return true;
+    }
+
+    std::cerr << "apitrace: daemon: " << (isDump ? "dump" : "stats")
+              << " " << path;
+    if (!callSet.empty()) {
+        std::cerr << " (" << callSet << ")";
+    }
+    std::cerr << "\n";
+
+    os << "OK\n";
+    if (isDump) {
+        serveDump(cached, callSet, dumpFlags, threadIds != 0, verbose != 0,
+                  os);
+    } else {
+        serveStats(cached, os);
+    }
+    return true;
+}
+
+
+static std::string
+defaultSocketPath(void)
+{
+    char path[256];
+    snprintf(path, sizeof path, "/tmp/apitrace-daemon-%u.sock",
+             (unsigned)getuid());
+    return path;
+}
+
+
+enum {
+    SOCKET_OPT = CHAR_MAX + 1,
+    MAX_TRACES_OPT,
+};
+
+const static char *
+shortOptions = "h";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"socket", required_argument, 0, SOCKET_OPT},
+    {"max-traces", required_argument, 0, MAX_TRACES_OPT},
+    {0, 0, 0, 0}
+};
+
+static int
+command(int argc, char *argv[])
+{
+    std::string socketPath = defaultSocketPath();
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case SOCKET_OPT:
+            socketPath = optarg;
+            break;
+        case MAX_TRACES_OPT:
+            maxTraces = atoi(optarg);
+            if (!maxTraces) {
+                std::cerr << "error: invalid trace cache size\n";
+                return 1;
+            }
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    // A write to a client that hung up must not kill the daemon.
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "error: failed to create socket\n";
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof addr.sun_path) {
+        std::cerr << "error: socket path too long\n";
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        if (errno == EADDRINUSE &&
+            connect(listenFd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+            // stale socket from a dead daemon
+            unlink(socketPath.c_str());
+            if (bind(listenFd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+                std::cerr << "error: failed to bind " << socketPath << "\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "error: " << socketPath
+                      << " is in use; is a daemon already running?\n";
+            return 1;
+        }
+    }
+
+    if (listen(listenFd, 4) != 0) {
+        std::cerr << "error: failed to listen on " << socketPath << "\n";
+        unlink(socketPath.c_str());
+        return 1;
+    }
+
+    std::cerr << "apitrace: daemon: listening on " << socketPath << "\n"
+              << "apitrace: daemon: export APITRACE_DAEMON=" << socketPath
+              << " to use it\n";
+
+    bool running = true;
+    while (running) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        running = serveConnection(fd);
+        close(fd);
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+
+    std::map<std::string, CachedTrace *>::iterator it;
+    for (it = traceCache.begin(); it != traceCache.end(); ++it) {
+        delete it->second;
+    }
+    traceCache.clear();
+
+    return 0;
+}
+
+
+int
+daemonDump(const char *fileName, const char *callSet,
+           trace::DumpFlags dumpFlags, bool dumpThreadIds, bool verbose)
+{
+    const char *socketPath = getenv("APITRACE_DAEMON");
+    if (!socketPath) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof addr.sun_path) {
+        close(fd);
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* The daemon's working directory is not ours. */
+    std::string path;
+    if (fileName[0] != '/') {
+        path = std::string(os::getCurrentDir().str()) + "/" + fileName;
+    } else {
+        path = fileName;
+    }
+
+    char header[64];
+    snprintf(header, sizeof header, "dump %u %u %u\n",
+             (unsigned)dumpFlags, dumpThreadIds ? 1 : 0, verbose ? 1 : 0);
+    std::string request = std::string(header) + path + "\n" +
+                          (callSet ? callSet : "") + "\n";
+
+    const char *p = request.data();
+    size_t remaining = request.size();
+    while (remaining) {
+        ssize_t written = write(fd, p, remaining);
+        if (written <= 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        p += written;
+        remaining -= written;
+    }
+
+    std::string status;
+    if (!readLine(fd, status)) {
+        close(fd);
+        return -1;
+    }
+    if (status != "OK") {
+        std::cerr << "apitrace: daemon: " << status << "\n";
+        close(fd);
+        return 1;
+    }
+
+    char buffer[64 * 1024];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof buffer)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            return 1;
+        }
+        fwrite(buffer, 1, got, stdout);
+    }
+    fflush(stdout);
+    close(fd);
+    return 0;
+}
+
+#endif /* !_WIN32 */
+
+const Command daemon_command = {
+    "daemon",
+    synopsis,
+    usage,
+    command
+};
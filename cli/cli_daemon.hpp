@@ -0,0 +1,44 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef _CLI_DAEMON_HPP_
+#define _CLI_DAEMON_HPP_
+
+#include "trace_dump.hpp"
+
+/**
+ * Forward a dump query to a running `apitrace daemon` (located via the
+ * APITRACE_DAEMON environment variable) and splice its response to
+ * standard output.
+ *
+ * Returns the query's exit status, or -1 when no daemon is configured
+ * or reachable, in which case the caller should fall back to doing the
+ * work itself.
+ */
+int
+daemonDump(const char *fileName, const char *callSet,
+           trace::DumpFlags dumpFlags, bool dumpThreadIds, bool verbose);
+
+#endif /* _CLI_DAEMON_HPP_ */
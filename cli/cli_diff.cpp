@@ -26,40 +26,644 @@
  *********************************************************************/
 
 #include <string.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+#ifndef _WIN32
+#include <unistd.h> // for isatty
+#endif
+
+#include <deque>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
+#include "cli_pager.hpp"
 #include "os_string.hpp"
 #include "os_process.hpp"
+#include "os_thread.hpp"
 #include "cli_resources.hpp"
 
+#include "trace_parser.hpp"
+#include "trace_model.hpp"
+#include "trace_dump.hpp"
+
 static const char *synopsis = "Identify differences between two traces.";
 
-static os::String
-find_command(void)
+static void
+usage(void)
 {
-    return findScript("tracediff.py");
+    std::cout
+        << "usage: apitrace diff [OPTIONS] TRACE_FILE TRACE_FILE\n"
+        "       apitrace diff --batch [OPTIONS] GOLDEN_TRACE TRACE_FILE...\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help           show this help message and exit\n"
+        "    -w, --window=N       call alignment window (default 256)\n"
+        "        --batch          diff one golden trace against many candidates\n"
+        "    -t, --threads=N      batch comparison threads (default 4)\n"
+        "        --script         use the legacy tracediff.py textual diff\n"
+        "\n"
+        "Calls are aligned with a windowed longest-common-subsequence over\n"
+        "the two function call sequences and compared structurally; only\n"
+        "the calls that differ are formatted.  Pointer values are compared\n"
+        "by nullness only, since addresses vary from run to run.\n"
+        "\n"
+        "In batch mode the golden trace is parsed once and held in memory,\n"
+        "and every candidate streams against it in parallel workers, so the\n"
+        "golden parse is amortized across the whole comparison matrix.\n"
+    ;
+}
+
+
+/*
+ * Structural comparison of call argument/return values.  This is the
+ * whole point of diffing natively: equal values — the vast majority —
+ * are never serialized to text.
+ */
+static bool
+compareValues(trace::Value *a, trace::Value *b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (!a || !b) {
+        return false;
+    }
+
+    {
+        trace::Repr *ra = dynamic_cast<trace::Repr *>(a);
+        trace::Repr *rb = dynamic_cast<trace::Repr *>(b);
+        if (ra || rb) {
+            return compareValues(ra ? ra->machineValue : a,
+                                 rb ? rb->machineValue : b);
+        }
+    }
+
+    if (dynamic_cast<trace::Null *>(a)) {
+        return dynamic_cast<trace::Null *>(b) != NULL;
+    }
+
+    {
+        trace::Bool *ba = dynamic_cast<trace::Bool *>(a);
+        if (ba) {
+            trace::Bool *bb = dynamic_cast<trace::Bool *>(b);
+            return bb && ba->value == bb->value;
+        }
+    }
+
+    {
+        trace::SInt *sa = dynamic_cast<trace::SInt *>(a);
+        if (sa) {
+            trace::SInt *sb = dynamic_cast<trace::SInt *>(b);
+            return sb && sa->value == sb->value;
+        }
+    }
+
+    {
+        /* Pointer derives from UInt, so check it first: addresses
+         * vary from run to run and only nullness is meaningful. */
+        trace::Pointer *pa = dynamic_cast<trace::Pointer *>(a);
+        if (pa) {
+            trace::Pointer *pb = dynamic_cast<trace::Pointer *>(b);
+            return pb && (pa->value != 0) == (pb->value != 0);
+        }
+    }
+
+    {
+        trace::UInt *ua = dynamic_cast<trace::UInt *>(a);
+        if (ua) {
+            trace::UInt *ub = dynamic_cast<trace::UInt *>(b);
+            return ub && ua->value == ub->value;
+        }
+    }
+
+    {
+        trace::Float *fa = dynamic_cast<trace::Float *>(a);
+        if (fa) {
+            trace::Float *fb = dynamic_cast<trace::Float *>(b);
+            return fb && fa->value == fb->value;
+        }
+    }
+
+    {
+        trace::Double *da = dynamic_cast<trace::Double *>(a);
+        if (da) {
+            trace::Double *db = dynamic_cast<trace::Double *>(b);
+            return db && da->value == db->value;
+        }
+    }
+
+    {
+        trace::String *sa = dynamic_cast<trace::String *>(a);
+        if (sa) {
+            trace::String *sb = dynamic_cast<trace::String *>(b);
+            return sb && strcmp(sa->value, sb->value) == 0;
+        }
+    }
+
+    {
+        trace::Enum *ea = dynamic_cast<trace::Enum *>(a);
+        if (ea) {
+            trace::Enum *eb = dynamic_cast<trace::Enum *>(b);
+            return eb && ea->value == eb->value;
+        }
+    }
+
+    {
+        trace::Bitmask *ma = dynamic_cast<trace::Bitmask *>(a);
+        if (ma) {
+            trace::Bitmask *mb = dynamic_cast<trace::Bitmask *>(b);
+            return mb && ma->value == mb->value;
+        }
+    }
+
+    {
+        trace::Struct *sa = dynamic_cast<trace::Struct *>(a);
+        if (sa) {
+            trace::Struct *sb = dynamic_cast<trace::Struct *>(b);
+            if (!sb || sa->members.size() != sb->members.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < sa->members.size(); ++i) {
+                if (!compareValues(sa->members[i], sb->members[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    {
+        trace::Array *aa = dynamic_cast<trace::Array *>(a);
+        if (aa) {
+            trace::Array *ab = dynamic_cast<trace::Array *>(b);
+            if (!ab || aa->values.size() != ab->values.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < aa->values.size(); ++i) {
+                if (!compareValues(aa->values[i], ab->values[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    {
+        trace::Blob *ba = dynamic_cast<trace::Blob *>(a);
+        if (ba) {
+            trace::Blob *bb = dynamic_cast<trace::Blob *>(b);
+            return bb &&
+                   ba->size == bb->size &&
+                   memcmp(ba->buf, bb->buf, ba->size) == 0;
+        }
+    }
+
+    return false;
+}
+
+static bool
+compareCalls(trace::Call *a, trace::Call *b)
+{
+    if (strcmp(a->name(), b->name()) != 0) {
+        return false;
+    }
+
+    if (a->args.size() != b->args.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a->args.size(); ++i) {
+        if (!compareValues(a->args[i].value, b->args[i].value)) {
+            return false;
+        }
+    }
+
+    return compareValues(a->ret, b->ret);
+}
+
+
+/*
+ * One side of the diff: a parser and a window of pending calls, with
+ * the function names interned into a shared id space so the
+ * alignment works on cheap integer comparisons.
+ */
+struct DiffSide {
+    trace::Parser parser;
+    std::deque<trace::Call *> calls;
+    std::deque<unsigned> ids;
+    bool eof;
+
+    DiffSide() : eof(false) {}
+};
+
+typedef std::map<std::string, unsigned> NameTable;
+
+static NameTable internedNames;
+
+static unsigned
+internName(NameTable &names, const char *name)
+{
+    NameTable::iterator it = names.find(name);
+    if (it != names.end()) {
+        return it->second;
+    }
+    unsigned id = names.size();
+    names[name] = id;
+    return id;
 }
 
 static void
-usage(void)
+fillWindow(DiffSide &side, size_t window, NameTable &names)
 {
-    os::String command = find_command();
-    if (!command.length()) {
-        exit(1);
+    while (!side.eof && side.calls.size() < window) {
+        trace::Call *call = side.parser.parse_call();
+        if (!call) {
+            side.eof = true;
+            break;
+        }
+        side.calls.push_back(call);
+        side.ids.push_back(internName(names, call->name()));
+    }
+}
+
+static void
+popCall(DiffSide &side)
+{
+    delete side.calls.front();
+    side.calls.pop_front();
+    side.ids.pop_front();
+}
+
+enum DiffOp {
+    DIFF_MATCH,
+    DIFF_LEFT,
+    DIFF_RIGHT
+};
+
+/* Align two windows with a longest-common-subsequence over the
+ * interned function ids.  Any containers indexable with operator[]
+ * will do: the streaming sides keep deques, the batch golden side a
+ * view into its retained id vector. */
+template< class LeftIds, class RightIds >
+static void
+alignWindows(const LeftIds &leftIds, const RightIds &rightIds,
+             std::vector<DiffOp> &ops)
+{
+    size_t m = leftIds.size();
+    size_t n = rightIds.size();
+
+    std::vector<unsigned> lcs((m + 1) * (n + 1), 0);
+#define LCS(i, j) lcs[(i) * (n + 1) + (j)]
+
+    for (size_t i = m; i-- > 0; ) {
+        for (size_t j = n; j-- > 0; ) {
+            if (leftIds[i] == rightIds[j]) {
+                LCS(i, j) = LCS(i + 1, j + 1) + 1;
+            } else {
+                LCS(i, j) = std::max(LCS(i + 1, j), LCS(i, j + 1));
+            }
+        }
     }
 
-    char *args[4];
-    args[0] = (char *) "python";
-    args[1] = (char *) command.str();
-    args[2] = (char *) "--help";
-    args[3] = NULL;
+    size_t i = 0, j = 0;
+    while (i < m && j < n) {
+        if (leftIds[i] == rightIds[j]) {
+            ops.push_back(DIFF_MATCH);
+            ++i;
+            ++j;
+        } else if (LCS(i + 1, j) >= LCS(i, j + 1)) {
+            ops.push_back(DIFF_LEFT);
+            ++i;
+        } else {
+            ops.push_back(DIFF_RIGHT);
+            ++j;
+        }
+    }
+    while (i++ < m) {
+        ops.push_back(DIFF_LEFT);
+    }
+    while (j++ < n) {
+        ops.push_back(DIFF_RIGHT);
+    }
 
-    os::execute(args);
+#undef LCS
 }
 
 static int
-command(int argc, char *argv[])
+diffTraces(const char *leftName, const char *rightName,
+           size_t window, trace::DumpFlags dumpFlags)
+{
+    DiffSide left, right;
+    unsigned long long differences = 0;
+
+    if (!left.parser.open(leftName)) {
+        std::cerr << "error: failed to open " << leftName << "\n";
+        return 1;
+    }
+    if (!right.parser.open(rightName)) {
+        std::cerr << "error: failed to open " << rightName << "\n";
+        return 1;
+    }
+
+    for (;;) {
+        fillWindow(left, window, internedNames);
+        fillWindow(right, window, internedNames);
+
+        if (left.calls.empty() && right.calls.empty()) {
+            break;
+        }
+
+        std::vector<DiffOp> ops;
+        alignWindows(left.ids, right.ids, ops);
+
+        /* When neither side has hit the end of its trace, only
+         * consume the front half of the alignment: matches that
+         * would pair up with calls beyond the window get a second
+         * chance after the refill. */
+        size_t maxLeft = left.calls.size();
+        size_t maxRight = right.calls.size();
+        if (!left.eof && !right.eof) {
+            maxLeft = (maxLeft + 1) / 2;
+            maxRight = (maxRight + 1) / 2;
+        }
+
+        size_t usedLeft = 0, usedRight = 0;
+        for (size_t k = 0; k < ops.size(); ++k) {
+            /* Guard per side: when one side is exhausted the ops are
+             * all insertions for the other, and must still drain. */
+            if ((ops[k] != DIFF_RIGHT && usedLeft >= maxLeft) ||
+                (ops[k] != DIFF_LEFT && usedRight >= maxRight)) {
+                break;
+            }
+            switch (ops[k]) {
+            case DIFF_MATCH:
+                if (!compareCalls(left.calls.front(),
+                                  right.calls.front())) {
+                    std::cout << "- ";
+                    trace::dump(*left.calls.front(), std::cout, dumpFlags);
+                    std::cout << "+ ";
+                    trace::dump(*right.calls.front(), std::cout, dumpFlags);
+                    ++differences;
+                }
+                popCall(left);
+                popCall(right);
+                ++usedLeft;
+                ++usedRight;
+                break;
+            case DIFF_LEFT:
+                std::cout << "- ";
+                trace::dump(*left.calls.front(), std::cout, dumpFlags);
+                popCall(left);
+                ++usedLeft;
+                ++differences;
+                break;
+            case DIFF_RIGHT:
+                std::cout << "+ ";
+                trace::dump(*right.calls.front(), std::cout, dumpFlags);
+                popCall(right);
+                ++usedRight;
+                ++differences;
+                break;
+            }
+        }
+    }
+
+    return differences ? 1 : 0;
+}
+
+
+/*
+ * Batch mode: the golden trace parsed once and retained -- the call
+ * shells plus the interned id sequence the alignment runs on.  The
+ * parser stays open for the lifetime of the batch, since the calls
+ * point into its signature arena.  The whole golden trace lives in
+ * memory; that is the price of amortizing its parse across every
+ * candidate.
+ */
+struct GoldenTrace {
+    trace::Parser parser;
+    std::vector<trace::Call *> calls;
+    std::vector<unsigned> ids;
+    NameTable names;
+
+    ~GoldenTrace() {
+        for (size_t i = 0; i < calls.size(); ++i) {
+            delete calls[i];
+        }
+    }
+
+    bool load(const char *fileName) {
+        if (!parser.open(fileName)) {
+            std::cerr << "error: failed to open " << fileName << "\n";
+            return false;
+        }
+        trace::Call *call;
+        while ((call = parser.parse_call())) {
+            calls.push_back(call);
+            ids.push_back(internName(names, call->name()));
+        }
+        return true;
+    }
+};
+
+/* A window into the golden id sequence, shaped for alignWindows. */
+struct GoldenView {
+    const std::vector<unsigned> &ids;
+    size_t begin;
+    size_t count;
+
+    GoldenView(const std::vector<unsigned> &_ids, size_t _begin, size_t _count) :
+        ids(_ids), begin(_begin), count(_count)
+    {}
+
+    unsigned operator[](size_t i) const { return ids[begin + i]; }
+    size_t size(void) const { return count; }
+};
+
+/*
+ * Stream one candidate against the retained golden trace.  Same
+ * windowed alignment as diffTraces, with the golden side advancing an
+ * index instead of a parser.  Returns the number of differences, or
+ * -1 when the candidate cannot be opened.
+ */
+static long long
+diffAgainstGolden(const GoldenTrace &golden, const char *candName,
+                  size_t window, trace::DumpFlags dumpFlags,
+                  std::ostream &os)
+{
+    DiffSide cand;
+    unsigned long long differences = 0;
+    size_t pos = 0;
+
+    /* Each worker interns into its private copy of the golden's
+     * table, so candidate-only names never race between threads. */
+    NameTable names(golden.names);
+
+    if (!cand.parser.open(candName)) {
+        return -1;
+    }
+
+    for (;;) {
+        fillWindow(cand, window, names);
+
+        size_t goldenLeft = golden.calls.size() - pos;
+        size_t goldenWindow = goldenLeft < window ? goldenLeft : window;
+        bool goldenEof = goldenWindow == goldenLeft;
+
+        if (!goldenWindow && cand.calls.empty()) {
+            break;
+        }
+
+        std::vector<DiffOp> ops;
+        alignWindows(GoldenView(golden.ids, pos, goldenWindow), cand.ids, ops);
+
+        size_t maxLeft = goldenWindow;
+        size_t maxRight = cand.calls.size();
+        if (!goldenEof && !cand.eof) {
+            maxLeft = (maxLeft + 1) / 2;
+            maxRight = (maxRight + 1) / 2;
+        }
+
+        size_t usedLeft = 0, usedRight = 0;
+        for (size_t k = 0; k < ops.size(); ++k) {
+            /* Guard per side: when one side is exhausted the ops are
+             * all insertions for the other, and must still drain. */
+            if ((ops[k] != DIFF_RIGHT && usedLeft >= maxLeft) ||
+                (ops[k] != DIFF_LEFT && usedRight >= maxRight)) {
+                break;
+            }
+            switch (ops[k]) {
+            case DIFF_MATCH:
+                if (!compareCalls(golden.calls[pos], cand.calls.front())) {
+                    os << "- ";
+                    trace::dump(*golden.calls[pos], os, dumpFlags);
+                    os << "+ ";
+                    trace::dump(*cand.calls.front(), os, dumpFlags);
+                    ++differences;
+                }
+                ++pos;
+                popCall(cand);
+                ++usedLeft;
+                ++usedRight;
+                break;
+            case DIFF_LEFT:
+                os << "- ";
+                trace::dump(*golden.calls[pos], os, dumpFlags);
+                ++pos;
+                ++usedLeft;
+                ++differences;
+                break;
+            case DIFF_RIGHT:
+                os << "+ ";
+                trace::dump(*cand.calls.front(), os, dumpFlags);
+                popCall(cand);
+                ++usedRight;
+                ++differences;
+                break;
+            }
+        }
+    }
+
+    return differences;
+}
+
+
+struct BatchTask {
+    const char *fileName;
+    long long differences;
+    std::string output;
+};
+
+struct BatchQueue {
+    const GoldenTrace *golden;
+    size_t window;
+    trace::DumpFlags dumpFlags;
+    std::vector<BatchTask> tasks;
+    size_t next;
+    os::mutex mutex;
+};
+
+static void
+batchWorker(BatchQueue *queue)
+{
+    os::unique_lock<os::mutex> lock(queue->mutex);
+
+    while (queue->next < queue->tasks.size()) {
+        BatchTask &task = queue->tasks[queue->next++];
+
+        lock.unlock();
+        std::ostringstream ss;
+        task.differences = diffAgainstGolden(*queue->golden, task.fileName,
+                                             queue->window, queue->dumpFlags,
+                                             ss);
+        task.output = ss.str();
+        lock.lock();
+    }
+}
+
+static int
+diffBatch(const char *goldenName, char **candNames, int numCands,
+          size_t window, unsigned threads, trace::DumpFlags dumpFlags)
+{
+    GoldenTrace golden;
+    if (!golden.load(goldenName)) {
+        return 1;
+    }
+
+    BatchQueue queue;
+    queue.golden = &golden;
+    queue.window = window;
+    queue.dumpFlags = dumpFlags;
+    queue.next = 0;
+    queue.tasks.resize(numCands);
+    for (int i = 0; i < numCands; ++i) {
+        queue.tasks[i].fileName = candNames[i];
+        queue.tasks[i].differences = 0;
+    }
+
+    unsigned numWorkers = threads;
+    if (numWorkers > queue.tasks.size()) {
+        numWorkers = queue.tasks.size();
+    }
+    std::vector<os::thread> workers;
+    for (unsigned i = 0; i < numWorkers; ++i) {
+        workers.push_back(os::thread(batchWorker, &queue));
+    }
+    for (unsigned i = 0; i < numWorkers; ++i) {
+        workers[i].join();
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < queue.tasks.size(); ++i) {
+        const BatchTask &task = queue.tasks[i];
+        if (task.differences < 0) {
+            std::cout << "=== " << task.fileName << ": error: failed to open\n";
+            failed = true;
+            continue;
+        }
+        std::cout << "=== " << task.fileName << ": "
+                  << task.differences << " differences\n";
+        std::cout << task.output;
+        if (task.differences) {
+            failed = true;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+
+static os::String
+find_command(void)
+{
+    return findScript("tracediff.py");
+}
+
+static int
+scriptCommand(int argc, char *argv[])
 {
     int i;
 
@@ -75,7 +679,7 @@ command(int argc, char *argv[])
     args.push_back(command.str());
     args.push_back("--apitrace");
     args.push_back(apitracePath.str());
-    for (i = 1; i < argc; i++) {
+    for (i = optind; i < argc; i++) {
         args.push_back(argv[i]);
     }
     args.push_back(NULL);
@@ -83,6 +687,97 @@ command(int argc, char *argv[])
     return os::execute((char * const *)&args[0]);
 }
 
+enum {
+    SCRIPT_OPT = CHAR_MAX + 1,
+    BATCH_OPT,
+};
+
+const static char *
+shortOptions = "hw:t:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"window", required_argument, 0, 'w'},
+    {"batch", no_argument, 0, BATCH_OPT},
+    {"threads", required_argument, 0, 't'},
+    {"script", no_argument, 0, SCRIPT_OPT},
+    {0, 0, 0, 0}
+};
+
+static int
+command(int argc, char *argv[])
+{
+    size_t window = 256;
+    unsigned threads = 4;
+    bool batch = false;
+    bool script = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'w':
+            window = atoi(optarg);
+            if (window < 2) {
+                window = 2;
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                threads = 1;
+            }
+            break;
+        case BATCH_OPT:
+            batch = true;
+            break;
+        case SCRIPT_OPT:
+            script = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (script) {
+        return scriptCommand(argc, argv);
+    }
+
+    if (batch) {
+        if (argc - optind < 2) {
+            std::cerr << "error: a golden trace and at least one candidate must be specified\n";
+            usage();
+            return 1;
+        }
+    } else if (argc - optind != 2) {
+        std::cerr << "error: exactly two traces must be specified\n";
+        usage();
+        return 1;
+    }
+
+    trace::DumpFlags dumpFlags = 0;
+#ifdef _WIN32
+#else
+    if (!isatty(1)) {
+        dumpFlags |= trace::DUMP_FLAG_NO_COLOR;
+    } else {
+        pipepager();
+    }
+#endif
+
+    if (batch) {
+        return diffBatch(argv[optind], &argv[optind + 1], argc - optind - 1,
+                         window, threads, dumpFlags);
+    }
+
+    return diffTraces(argv[optind], argv[optind + 1], window, dumpFlags);
+}
+
 const Command diff_command = {
     "diff",
     synopsis,
@@ -25,41 +25,458 @@
  *
  *********************************************************************/
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
 #include "os_string.hpp"
 #include "os_process.hpp"
+#include "os_thread.hpp"
 #include "cli_resources.hpp"
 
+#include "image.hpp"
+
 static const char *synopsis = "Identify differences between two image dumps.";
 
-static os::String
-find_command(void)
+static void
+usage(void)
 {
-    return findScript("snapdiff.py");
+    std::cout
+        << "usage: apitrace diff-images [OPTIONS] DIR1 DIR2\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help               show this help message and exit\n"
+        "    -t, --threads=N          comparison threads (default 4)\n"
+        "        --threshold=BITS     precision threshold in bits (default 8)\n"
+        "    -v, --verbose            also list the images that match\n"
+        "        --script             use the legacy snapdiff.py comparator\n"
+        "\n"
+        "Images with the same name in both directories are compared in\n"
+        "parallel.  Byte-identical files are matched without decoding, and\n"
+        "the comparison of decoded images stops early once the accumulated\n"
+        "error already rules the threshold out.  Delta snapshots (glretrace\n"
+        "--snapshot-delta, .dpng/.draw) are reconstructed transparently and\n"
+        "pair up with plain dumps of the same trace.\n"
+        "\n"
+        "When the two arguments are files rather than directories they are\n"
+        "taken as fingerprint manifests (glretrace --fingerprint) and the\n"
+        "digests are compared per call number instead.\n"
+    ;
+}
+
+
+/* Whether a file holds a delta snapshot (XOR against its predecessor)
+ * rather than a whole image. */
+static bool
+isDeltaName(const std::string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string ext = name.substr(dot);
+    return ext == ".dpng" || ext == ".draw";
+}
+
+/* Collect the image files (by extension) in a directory, keyed by
+ * their logical name -- the name the snapshot would have in a plain
+ * dump -- so delta and plain dumps of the same trace pair up. */
+static bool
+listImages(const char *dirName, std::map<std::string, std::string> &files)
+{
+    std::set<std::string> names;
+#ifdef _WIN32
+    os::String pattern(dirName);
+    pattern.join("*");
+
+    WIN32_FIND_DATAA findData;
+    HANDLE hFind = FindFirstFileA(pattern.str(), &findData);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        names.insert(findData.cFileName);
+    } while (FindNextFileA(hFind, &findData));
+    FindClose(hFind);
+#else
+    DIR *dir = opendir(dirName);
+    if (!dir) {
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        names.insert(entry->d_name);
+    }
+    closedir(dir);
+#endif
+
+    for (std::set<std::string>::iterator it = names.begin();
+         it != names.end(); ++it) {
+        size_t dot = it->rfind('.');
+        std::string ext = dot == std::string::npos ? "" : it->substr(dot);
+        if (ext == ".png" || ext == ".raw") {
+            files[*it] = *it;
+        } else if (ext == ".dpng" || ext == ".draw") {
+            /* strip the delta marker: 0000000042.dpng -> 0000000042.png */
+            std::string logical = it->substr(0, dot + 1) + it->substr(dot + 2);
+            files[logical] = *it;
+        }
+    }
+
+    return true;
+}
+
+static image::Image *
+decodeImage(const char *dirName, const std::string &name)
+{
+    os::String path(dirName);
+    path.join(name.c_str());
+    size_t dot = name.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+    if (ext == ".raw" || ext == ".draw") {
+        return image::readRAW(path.str());
+    }
+    return image::readPNG(path.str());
+}
+
+/**
+ * Reads logical snapshots out of a dump directory, reconstructing
+ * delta frames by walking back to their keyframe and reapplying the
+ * XORs.  The last reconstructed frame is kept, so a scan in name
+ * order pays roughly one decode per file instead of one chain per
+ * file.  Not thread-safe; each worker holds its own pair.
+ */
+class SnapshotReader
+{
+private:
+    const char *dirName;
+    const std::map<std::string, std::string> &files;
+    std::string cachedName;
+    image::Image *cached;
+
+public:
+    SnapshotReader(const char *_dirName,
+                   const std::map<std::string, std::string> &_files) :
+        dirName(_dirName),
+        files(_files),
+        cached(NULL)
+    {}
+
+    ~SnapshotReader()
+    {
+        delete cached;
+    }
+
+    bool
+    isDelta(const std::string &logical) const
+    {
+        std::map<std::string, std::string>::const_iterator it =
+            files.find(logical);
+        return it != files.end() && isDeltaName(it->second);
+    }
+
+    /* Returns the image for the given logical name, owned by the
+     * reader and valid until the next call, or NULL on error. */
+    image::Image *
+    read(const std::string &logical)
+    {
+        if (cached && cachedName == logical) {
+            return cached;
+        }
+
+        typedef std::map<std::string, std::string>::const_iterator Iter;
+        Iter it = files.find(logical);
+        if (it == files.end()) {
+            return NULL;
+        }
+
+        /* Walk back to the keyframe, or to the cached frame if it
+         * comes first; map order is dump order thanks to the
+         * zero-padded numbering. */
+        std::vector<Iter> chain;
+        chain.push_back(it);
+        while (isDeltaName(chain.back()->second)) {
+            Iter prev = chain.back();
+            if (prev == files.begin()) {
+                /* delta with no keyframe before it */
+                return NULL;
+            }
+            --prev;
+            if (cached && prev->first == cachedName) {
+                break;
+            }
+            chain.push_back(prev);
+        }
+
+        image::Image *img;
+        if (isDeltaName(chain.back()->second)) {
+            /* resuming from the cached frame */
+            img = cached;
+            cached = NULL;
+        } else {
+            img = decodeImage(dirName, chain.back()->second);
+            chain.pop_back();
+            if (!img) {
+                return NULL;
+            }
+        }
+
+        while (!chain.empty()) {
+            image::Image *delta = decodeImage(dirName, chain.back()->second);
+            chain.pop_back();
+            bool ok = delta && img->xorImage(*delta);
+            delete delta;
+            if (!ok) {
+                delete img;
+                delete cached;
+                cached = NULL;
+                return NULL;
+            }
+        }
+
+        delete cached;
+        cached = img;
+        cachedName = logical;
+        return img;
+    }
+};
+
+/* Whether the two files have identical contents.  Identical encoded
+ * files mean identical images, so the match is decided without
+ * decoding anything -- unchanged frames are the common case in
+ * snapshot sets. */
+static bool
+compareFileBytes(const char *filename1, const char *filename2)
+{
+    FILE *file1, *file2;
+    char buffer1[64 * 1024], buffer2[64 * 1024];
+    bool equal = true;
+
+    file1 = fopen(filename1, "rb");
+    if (!file1) {
+        return false;
+    }
+    file2 = fopen(filename2, "rb");
+    if (!file2) {
+        fclose(file1);
+        return false;
+    }
+
+    for (;;) {
+        size_t read1 = fread(buffer1, 1, sizeof buffer1, file1);
+        size_t read2 = fread(buffer2, 1, sizeof buffer2, file2);
+        if (read1 != read2 || memcmp(buffer1, buffer2, read1) != 0) {
+            equal = false;
+            break;
+        }
+        if (read1 < sizeof buffer1) {
+            break;
+        }
+    }
+
+    fclose(file1);
+    fclose(file2);
+    return equal;
+}
+
+
+static bool
+isDirectory(const char *path)
+{
+#ifdef _WIN32
+    DWORD attrs = GetFileAttributesA(path);
+    return attrs != INVALID_FILE_ATTRIBUTES &&
+           (attrs & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+}
+
+
+/* Read a fingerprint manifest (glretrace --fingerprint): one
+ * `<call> <digest> <WxH>` line per snapshot, keyed by call number so
+ * the line order does not matter. */
+static bool
+readManifest(const char *filename, std::map<std::string, std::string> &entries)
+{
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        size_t space = line.find(' ');
+        if (space == std::string::npos || space == 0) {
+            continue;
+        }
+        entries[line.substr(0, space)] = line.substr(space + 1);
+    }
+
+    return true;
+}
+
+
+static int
+compareManifests(const char *filename1, const char *filename2, bool verbose)
+{
+    std::map<std::string, std::string> entries1, entries2;
+    if (!readManifest(filename1, entries1)) {
+        std::cerr << "error: failed to read " << filename1 << "\n";
+        return 1;
+    }
+    if (!readManifest(filename2, entries2)) {
+        std::cerr << "error: failed to read " << filename2 << "\n";
+        return 1;
+    }
+
+    unsigned compared = 0, mismatches = 0, unpaired = 0;
+
+    std::map<std::string, std::string>::iterator it;
+    for (it = entries1.begin(); it != entries1.end(); ++it) {
+        std::map<std::string, std::string>::iterator other =
+            entries2.find(it->first);
+        if (other == entries2.end()) {
+            std::cout << "only in " << filename1 << ": call "
+                      << it->first << "\n";
+            ++unpaired;
+            continue;
+        }
+        ++compared;
+        if (it->second != other->second) {
+            std::cout << "call " << it->first << ": differs ("
+                      << it->second << " vs " << other->second << ")\n";
+            ++mismatches;
+        } else if (verbose) {
+            std::cout << "call " << it->first << ": match\n";
+        }
+    }
+    for (it = entries2.begin(); it != entries2.end(); ++it) {
+        if (!entries1.count(it->first)) {
+            std::cout << "only in " << filename2 << ": call "
+                      << it->first << "\n";
+            ++unpaired;
+        }
+    }
+
+    std::cout << compared << " fingerprints compared, "
+              << mismatches << " differ";
+    if (unpaired) {
+        std::cout << ", " << unpaired << " unpaired";
+    }
+    std::cout << "\n";
+
+    return mismatches || unpaired ? 1 : 0;
 }
 
+
+enum CompareStatus {
+    COMPARE_MATCH,
+    COMPARE_MISMATCH,
+    COMPARE_ERROR
+};
+
+struct CompareTask {
+    std::string name;
+    CompareStatus status;
+    double bits;
+};
+
+struct CompareQueue {
+    const char *dir1;
+    const char *dir2;
+    std::map<std::string, std::string> files1;
+    std::map<std::string, std::string> files2;
+    double threshold;
+    std::vector<CompareTask> tasks;
+    size_t next;
+    os::mutex mutex;
+};
+
 static void
-usage(void)
+compareTask(CompareQueue *queue, CompareTask &task,
+            SnapshotReader &reader1, SnapshotReader &reader2)
 {
-    os::String command = find_command();
-    if (!command.length()) {
-        exit(1);
+    /* The byte-for-byte shortcut only holds for whole images; two
+     * identical delta files still depend on their predecessors. */
+    if (!reader1.isDelta(task.name) && !reader2.isDelta(task.name)) {
+        os::String path1(queue->dir1);
+        path1.join(task.name.c_str());
+        os::String path2(queue->dir2);
+        path2.join(task.name.c_str());
+
+        if (compareFileBytes(path1.str(), path2.str())) {
+            task.status = COMPARE_MATCH;
+            task.bits = 8.0;
+            return;
+        }
     }
 
-    char *args[4];
-    args[0] = (char *) "python";
-    args[1] = (char *) command.str();
-    args[2] = (char *) "--help";
-    args[3] = NULL;
+    image::Image *img1 = reader1.read(task.name);
+    image::Image *img2 = reader2.read(task.name);
+    if (!img1 || !img2) {
+        task.status = COMPARE_ERROR;
+        task.bits = 0.0;
+        return;
+    }
 
-    os::execute(args);
+    if (img1->compareThreshold(*img2, queue->threshold)) {
+        task.status = COMPARE_MATCH;
+        task.bits = queue->threshold;
+    } else {
+        task.status = COMPARE_MISMATCH;
+        task.bits = img1->compare(*img2);
+    }
+}
+
+static void
+compareWorker(CompareQueue *queue)
+{
+    SnapshotReader reader1(queue->dir1, queue->files1);
+    SnapshotReader reader2(queue->dir2, queue->files2);
+
+    os::unique_lock<os::mutex> lock(queue->mutex);
+
+    while (queue->next < queue->tasks.size()) {
+        CompareTask &task = queue->tasks[queue->next++];
+
+        lock.unlock();
+        compareTask(queue, task, reader1, reader2);
+        lock.lock();
+    }
+}
+
+
+static os::String
+find_command(void)
+{
+    return findScript("snapdiff.py");
 }
 
 static int
-command(int argc, char *argv[])
+scriptCommand(int argc, char *argv[])
 {
     int i;
 
@@ -71,7 +488,7 @@ command(int argc, char *argv[])
     std::vector<const char *> args;
     args.push_back("python");
     args.push_back(command.str());
-    for (i = 1; i < argc; i++) {
+    for (i = optind; i < argc; i++) {
         args.push_back(argv[i]);
     }
     args.push_back(NULL);
@@ -79,6 +496,160 @@ command(int argc, char *argv[])
     return os::execute((char * const *)&args[0]);
 }
 
+enum {
+    THRESHOLD_OPT = CHAR_MAX + 1,
+    SCRIPT_OPT,
+};
+
+const static char *
+shortOptions = "ht:v";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"threads", required_argument, 0, 't'},
+    {"threshold", required_argument, 0, THRESHOLD_OPT},
+    {"verbose", no_argument, 0, 'v'},
+    {"script", no_argument, 0, SCRIPT_OPT},
+    {0, 0, 0, 0}
+};
+
+static int
+command(int argc, char *argv[])
+{
+    unsigned threads = 4;
+    double threshold = 8.0;
+    bool verbose = false;
+    bool script = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 't':
+            threads = atoi(optarg);
+            if (threads < 1) {
+                threads = 1;
+            }
+            break;
+        case THRESHOLD_OPT:
+            threshold = atof(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case SCRIPT_OPT:
+            script = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (script) {
+        return scriptCommand(argc, argv);
+    }
+
+    if (argc - optind != 2) {
+        std::cerr << "error: exactly two directories must be specified\n";
+        usage();
+        return 1;
+    }
+
+    const char *dir1 = argv[optind];
+    const char *dir2 = argv[optind + 1];
+
+    if (!isDirectory(dir1) && !isDirectory(dir2)) {
+        return compareManifests(dir1, dir2, verbose);
+    }
+
+    CompareQueue queue;
+    queue.dir1 = dir1;
+    queue.dir2 = dir2;
+    queue.threshold = threshold;
+    queue.next = 0;
+
+    if (!listImages(dir1, queue.files1)) {
+        std::cerr << "error: failed to read " << dir1 << "\n";
+        return 1;
+    }
+    if (!listImages(dir2, queue.files2)) {
+        std::cerr << "error: failed to read " << dir2 << "\n";
+        return 1;
+    }
+
+    unsigned unpaired = 0;
+    for (std::map<std::string, std::string>::iterator it = queue.files1.begin();
+         it != queue.files1.end(); ++it) {
+        if (queue.files2.count(it->first)) {
+            CompareTask task;
+            task.name = it->first;
+            task.status = COMPARE_ERROR;
+            task.bits = 0.0;
+            queue.tasks.push_back(task);
+        } else {
+            std::cout << "only in " << dir1 << ": " << it->first << "\n";
+            ++unpaired;
+        }
+    }
+    for (std::map<std::string, std::string>::iterator it = queue.files2.begin();
+         it != queue.files2.end(); ++it) {
+        if (!queue.files1.count(it->first)) {
+            std::cout << "only in " << dir2 << ": " << it->first << "\n";
+            ++unpaired;
+        }
+    }
+
+    unsigned numWorkers = threads;
+    if (numWorkers > queue.tasks.size()) {
+        numWorkers = queue.tasks.size();
+    }
+    std::vector<os::thread> workers;
+    for (unsigned i = 0; i < numWorkers; ++i) {
+        workers.push_back(os::thread(compareWorker, &queue));
+    }
+    for (unsigned i = 0; i < numWorkers; ++i) {
+        workers[i].join();
+    }
+
+    unsigned mismatches = 0, errors = 0;
+    for (size_t i = 0; i < queue.tasks.size(); ++i) {
+        const CompareTask &task = queue.tasks[i];
+        switch (task.status) {
+        case COMPARE_MATCH:
+            if (verbose) {
+                std::cout << task.name << ": match\n";
+            }
+            break;
+        case COMPARE_MISMATCH:
+            std::cout << task.name << ": differs ("
+                      << task.bits << " bits < " << threshold << ")\n";
+            ++mismatches;
+            break;
+        case COMPARE_ERROR:
+            std::cout << task.name << ": error reading images\n";
+            ++errors;
+            break;
+        }
+    }
+
+    std::cout << queue.tasks.size() << " images compared, "
+              << mismatches << " differ";
+    if (errors) {
+        std::cout << ", " << errors << " errors";
+    }
+    if (unpaired) {
+        std::cout << ", " << unpaired << " unpaired";
+    }
+    std::cout << "\n";
+
+    return mismatches || errors || unpaired ? 1 : 0;
+}
+
 const Command diff_images_command = {
     "diff-images",
     synopsis,
@@ -25,6 +25,7 @@
  **************************************************************************/
 
 
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h> // for CHAR_MAX
 #include <getopt.h>
@@ -32,10 +33,18 @@
 #include <unistd.h> // for isatty()
 #endif
 
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <vector>
+
 #include "cli.hpp"
+#include "cli_daemon.hpp"
 #include "cli_pager.hpp"
 
+#include "trace_analysis.hpp"
 #include "trace_parser.hpp"
+#include "trace_parser_parallel.hpp"
 #include "trace_dump.hpp"
 #include "trace_callset.hpp"
 #include "trace_option.hpp"
@@ -53,6 +62,9 @@ static bool verbose = false;
 
 static trace::CallSet calls(trace::FREQUENCY_ALL);
 
+/* The --calls argument verbatim, for forwarding to a daemon. */
+static const char *callsOption = NULL;
+
 static const char *synopsis = "Dump given trace(s) to standard output.";
 
 static void
@@ -71,16 +83,247 @@ usage(void)
         "    --thread-ids=[=BOOL] dump thread ids [default: no]\n"
         "    --call-nos[=BOOL]    dump call numbers[default: yes]\n"
         "    --arg-names[=BOOL]   dump argument names [default: yes]\n"
+        "    --threads=N          decode the trace with N parallel threads\n"
+        "    --summary[=N]        print per-trace statistics (top N entries per\n"
+        "                         table, default 10) instead of the calls\n"
         "\n"
     ;
 }
 
+
+/**
+ * Whole-trace statistics, accumulated over a shared analysis pass.
+ *
+ * No call is ever materialized, let alone formatted, which makes this
+ * orders of magnitude faster than dumping the text and post-processing
+ * it.
+ */
+class SummaryAnalyzer : public trace::Analyzer
+{
+public:
+    struct FunctionStats {
+        std::string name;
+        uint64_t count;
+        uint64_t bytes;
+
+        FunctionStats() : count(0), bytes(0) {}
+    };
+
+    struct FrameStats {
+        uint64_t calls;
+        uint64_t bytes;
+
+        FrameStats() : calls(0), bytes(0) {}
+    };
+
+    struct HeavyCall {
+        unsigned no;
+        const char *name;
+        uint64_t bytes;
+    };
+
+    uint64_t totalCalls;
+    uint64_t totalBytes;
+    uint64_t totalBlobBytes;
+
+    std::map<unsigned, FunctionStats> functions;
+    std::vector<FrameStats> frames;
+    std::vector<HeavyCall> heaviest;
+
+    SummaryAnalyzer(size_t topCount) :
+        totalCalls(0),
+        totalBytes(0),
+        totalBlobBytes(0),
+        m_topCount(topCount)
+    {
+        frames.push_back(FrameStats());
+    }
+
+    void analyze(const trace::CallBatch &batch)
+    {
+        for (unsigned i = 0; i < batch.count; ++i) {
+            const trace::FunctionSig *sig = batch.sigs[i];
+            uint64_t bytes = batch.bytes[i];
+
+            ++totalCalls;
+            totalBytes += bytes;
+            totalBlobBytes += batch.blob_bytes[i];
+
+            FunctionStats &fn = functions[sig->id];
+            if (!fn.count) {
+                fn.name = sig->name;
+            }
+            ++fn.count;
+            fn.bytes += bytes;
+
+            FrameStats &frame = frames.back();
+            ++frame.calls;
+            frame.bytes += bytes;
+            if (batch.flags[i] & trace::CALL_FLAG_END_FRAME) {
+                frames.push_back(FrameStats());
+            }
+
+            // Min-heap of the heaviest calls seen so far; the lightest
+            // of them sits at the root and is evicted first.
+            if (heaviest.size() < m_topCount ||
+                bytes > heaviest.front().bytes) {
+                HeavyCall heavy;
+                heavy.no = batch.call_nos[i];
+                heavy.name = fn.name.c_str();
+                heavy.bytes = bytes;
+                if (heaviest.size() >= m_topCount) {
+                    std::pop_heap(heaviest.begin(), heaviest.end(), heavier);
+                    heaviest.back() = heavy;
+                } else {
+                    heaviest.push_back(heavy);
+                }
+                std::push_heap(heaviest.begin(), heaviest.end(), heavier);
+            }
+        }
+    }
+
+    static bool heavier(const HeavyCall &a, const HeavyCall &b) {
+        return a.bytes > b.bytes;
+    }
+
+private:
+    size_t m_topCount;
+};
+
+
+/**
+ * Renders calls on the parallel parser's worker threads, so that the
+ * consumer thread only splices ready-made text to stdout.  Formatting
+ * dominates the cost of a full text dump, and it parallelizes just as
+ * well as decoding does.  Only reads the shared options, as required
+ * by CallFormatter.
+ */
+class DumpFormatter : public trace::ParallelParser::CallFormatter
+{
+public:
+    DumpFormatter(trace::DumpFlags dumpFlags, bool dumpThreadIds) :
+        m_dumpFlags(dumpFlags),
+        m_dumpThreadIds(dumpThreadIds)
+    {}
+
+    void format(trace::Call &call, std::ostream &os)
+    {
+        if (!calls.contains(call.no, call.flags)) {
+            return;
+        }
+        if (!verbose &&
+            (call.flags & trace::CALL_FLAG_VERBOSE)) {
+            return;
+        }
+        if (m_dumpThreadIds) {
+            os << std::hex << call.thread_id << std::dec << " ";
+        }
+        trace::dump(call, os, m_dumpFlags);
+    }
+
+private:
+    trace::DumpFlags m_dumpFlags;
+    bool m_dumpThreadIds;
+};
+
+
+static bool
+moreFrequent(const SummaryAnalyzer::FunctionStats *a,
+             const SummaryAnalyzer::FunctionStats *b)
+{
+    return a->count > b->count;
+}
+
+static int
+dumpSummary(const char *filename, size_t topCount)
+{
+    trace::Parser p;
+
+    if (!p.open(filename)) {
+        return 1;
+    }
+
+    SummaryAnalyzer summary(topCount);
+    trace::AnalysisPass pass;
+    pass.add(&summary);
+    pass.run(p);
+    p.close();
+
+    // A trailing incomplete frame still holds calls worth counting,
+    // but an empty one is just the slot opened by the last swap.
+    if (!summary.frames.empty() && !summary.frames.back().calls) {
+        summary.frames.pop_back();
+    }
+
+    std::cout << filename << ":\n";
+    std::cout << "  calls:       " << summary.totalCalls << "\n";
+    std::cout << "  frames:      " << summary.frames.size() << "\n";
+    std::cout << "  call bytes:  " << summary.totalBytes << "\n";
+    std::cout << "  blob bytes:  " << summary.totalBlobBytes << "\n";
+
+    if (!summary.frames.empty()) {
+        uint64_t minCalls = summary.frames[0].calls;
+        uint64_t maxCalls = minCalls;
+        for (size_t i = 1; i < summary.frames.size(); ++i) {
+            minCalls = std::min(minCalls, summary.frames[i].calls);
+            maxCalls = std::max(maxCalls, summary.frames[i].calls);
+        }
+        std::cout << "  calls/frame: "
+                  << summary.totalCalls / summary.frames.size()
+                  << " avg, " << minCalls << " min, " << maxCalls << " max\n";
+    }
+
+    std::vector<std::pair<uint64_t, size_t> > frameOrder;
+    for (size_t i = 0; i < summary.frames.size(); ++i) {
+        frameOrder.push_back(std::make_pair(summary.frames[i].bytes, i));
+    }
+    std::sort(frameOrder.rbegin(), frameOrder.rend());
+
+    std::cout << "\n  heaviest frames:\n";
+    for (size_t i = 0; i < frameOrder.size() && i < topCount; ++i) {
+        const SummaryAnalyzer::FrameStats &frame =
+            summary.frames[frameOrder[i].second];
+        std::cout << "    " << std::setw(10) << frameOrder[i].second
+                  << "  " << std::setw(12) << frame.bytes
+                  << "  " << frame.calls << " calls\n";
+    }
+
+    std::vector<const SummaryAnalyzer::FunctionStats *> functions;
+    std::map<unsigned, SummaryAnalyzer::FunctionStats>::const_iterator it;
+    for (it = summary.functions.begin(); it != summary.functions.end(); ++it) {
+        functions.push_back(&it->second);
+    }
+    std::sort(functions.begin(), functions.end(), moreFrequent);
+
+    std::cout << "\n  most frequent functions (of "
+              << functions.size() << "):\n";
+    for (size_t i = 0; i < functions.size() && i < topCount; ++i) {
+        std::cout << "    " << std::setw(10) << functions[i]->count
+                  << "  " << std::setw(12) << functions[i]->bytes
+                  << "  " << functions[i]->name << "\n";
+    }
+
+    std::sort(summary.heaviest.begin(), summary.heaviest.end(),
+              SummaryAnalyzer::heavier);
+
+    std::cout << "\n  heaviest calls:\n";
+    for (size_t i = 0; i < summary.heaviest.size(); ++i) {
+        std::cout << "    " << std::setw(10) << summary.heaviest[i].no
+                  << "  " << std::setw(12) << summary.heaviest[i].bytes
+                  << "  " << summary.heaviest[i].name << "\n";
+    }
+
+    return 0;
+}
+
 enum {
 	CALLS_OPT = CHAR_MAX + 1,
 	COLOR_OPT,
     THREAD_IDS_OPT,
     CALL_NOS_OPT,
     ARG_NAMES_OPT,
+    THREADS_OPT,
+    SUMMARY_OPT,
 };
 
 const static char *
@@ -96,6 +339,8 @@ longOptions[] = {
     {"thread-ids", optional_argument, 0, THREAD_IDS_OPT},
     {"call-nos", optional_argument, 0, CALL_NOS_OPT},
     {"arg-names", optional_argument, 0, ARG_NAMES_OPT},
+    {"threads", required_argument, 0, THREADS_OPT},
+    {"summary", optional_argument, 0, SUMMARY_OPT},
     {0, 0, 0, 0}
 };
 
@@ -104,7 +349,10 @@ command(int argc, char *argv[])
 {
     trace::DumpFlags dumpFlags = 0;
     bool dumpThreadIds = false;
-    
+    unsigned threadCount = 1;
+    bool summary = false;
+    size_t topCount = 10;
+
     int opt;
     while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
         switch (opt) {
@@ -116,6 +364,7 @@ command(int argc, char *argv[])
             break;
         case CALLS_OPT:
             calls = trace::CallSet(optarg);
+            callsOption = optarg;
             break;
         case COLOR_OPT:
             if (!optarg ||
@@ -147,6 +396,19 @@ command(int argc, char *argv[])
                 dumpFlags |= trace::DUMP_FLAG_NO_ARG_NAMES;
             }
             break;
+        case THREADS_OPT:
+            threadCount = atoi(optarg);
+            break;
+        case SUMMARY_OPT:
+            summary = true;
+            if (optarg) {
+                topCount = atoi(optarg);
+                if (!topCount) {
+                    std::cerr << "error: invalid summary size " << optarg << "\n";
+                    return 1;
+                }
+            }
+            break;
         default:
             std::cerr << "error: unexpected option `" << opt << "`\n";
             usage();
@@ -154,6 +416,14 @@ command(int argc, char *argv[])
         }
     }
 
+    if (summary) {
+        int ret = 0;
+        for (int i = optind; i < argc; ++i) {
+            ret |= dumpSummary(argv[i], topCount);
+        }
+        return ret;
+    }
+
     if (color == COLOR_OPTION_AUTO) {
 #ifdef _WIN32
         color = COLOR_OPTION_ALWAYS;
@@ -168,12 +438,50 @@ command(int argc, char *argv[])
     }
 
     for (int i = optind; i < argc; ++i) {
-        trace::Parser p;
+        // A running daemon (APITRACE_DAEMON) already has hot traces
+        // open and scanned; let it serve the query when reachable
+        if (threadCount == 1) {
+            int ret = daemonDump(argv[i], callsOption, dumpFlags,
+                                 dumpThreadIds, verbose);
+            if (ret >= 0) {
+                if (ret) {
+                    return ret;
+                }
+                continue;
+            }
+        }
+
+        if (threadCount > 1) {
+            // format on the workers too; the consumer merely splices
+            // the per-frame buffers in order
+            trace::ParallelParser pp(threadCount);
+            if (!pp.open(argv[i])) {
+                return 1;
+            }
+
+            DumpFormatter formatter(dumpFlags, dumpThreadIds);
+            pp.setFormatter(&formatter);
 
+            std::string text;
+            while (pp.read_text(text)) {
+                std::cout << text;
+            }
+            continue;
+        }
+
+        trace::Parser p;
         if (!p.open(argv[i])) {
             return 1;
         }
 
+        // blobs are only ever printed as their size; lazy blobs
+        // are not thread-safe, so only the sequential path uses them
+        p.setLazyBlobs(true);
+
+        // Name patterns (e.g. --calls 'glDraw*') let the parser skip
+        // non-matching calls without ever materializing them
+        p.focus(&calls);
+
         trace::Call *call;
         while ((call = p.parse_call())) {
             if (calls.contains(*call)) {
@@ -66,14 +66,22 @@ const Command help_command = {
 };
 
 static const Command * commands[] = {
+    &archive_command,
+    &benchgen_command,
+    &check_command,
+    &daemon_command,
     &diff_command,
     &diff_state_command,
     &diff_images_command,
     &dump_command,
     &dump_images_command,
+    &merge_command,
     &pickle_command,
     &repack_command,
+    &repair_command,
     &retrace_command,
+    &stats_command,
+    &stream_command,
     &trace_command,
     &trim_command,
     &help_command
@@ -0,0 +1,210 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <string.h>
+#include <getopt.h>
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+
+#include "os_string.hpp"
+
+#include "trace_parser.hpp"
+#include "trace_writer.hpp"
+
+
+static const char *synopsis = "Merge several trace files into a single timeline.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace merge [OPTIONS] TRACE_FILE...\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help               Show this help message and exit\n"
+        "    -o, --output=TRACE_FILE  Output trace file\n"
+        "\n"
+        "Interleaves the calls of the given traces, one frame per source in\n"
+        "turn, into a single trace.  The format records no per-call\n"
+        "timestamps, so frame boundaries (the swap calls) are the unit of\n"
+        "interleaving.  Thread ids are remapped so that each source's\n"
+        "threads remain distinct in the merged trace.\n"
+        "\n"
+        "Useful when a launcher, game and overlay were each traced into\n"
+        "their own file and the whole system is to be analyzed in one pass.\n"
+    ;
+}
+
+enum {
+    OUTPUT_OPT = 'o',
+};
+
+const static char *
+shortOptions = "ho:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"output", required_argument, 0, OUTPUT_OPT},
+    {0, 0, 0, 0}
+};
+
+struct MergeSource {
+    trace::Parser parser;
+    const char *filename;
+    bool exhausted;
+
+    /* Source thread id -> merged thread id. */
+    std::map<unsigned, unsigned> threadMap;
+
+    MergeSource() : filename(NULL), exhausted(false) {}
+};
+
+static int
+merge_traces(std::vector<MergeSource *> &sources, const char *output)
+{
+    trace::Writer writer;
+    unsigned nextThreadId = 0;
+
+    if (!writer.open(output)) {
+        std::cerr << "error: failed to create " << output << "\n";
+        return 1;
+    }
+
+    /* Round-robin over the sources, copying one frame from each per
+     * turn, until all of them are exhausted.  A trailing partial frame
+     * (calls after the last swap) is copied like any other. */
+    bool progressing = true;
+    while (progressing) {
+        progressing = false;
+
+        for (unsigned i = 0; i < sources.size(); ++i) {
+            MergeSource *source = sources[i];
+            if (source->exhausted) {
+                continue;
+            }
+
+            bool more = false;
+            trace::Call *call;
+            while ((call = source->parser.parse_call())) {
+                std::map<unsigned, unsigned>::iterator it =
+                    source->threadMap.find(call->thread_id);
+                if (it == source->threadMap.end()) {
+                    it = source->threadMap.insert(
+                        std::make_pair(call->thread_id, nextThreadId++)).first;
+                }
+                call->thread_id = it->second;
+
+                writer.writeCall(call);
+
+                bool endOfFrame = call->flags & trace::CALL_FLAG_END_FRAME;
+                delete call;
+                if (endOfFrame) {
+                    more = true;
+                    break;
+                }
+            }
+
+            if (more) {
+                progressing = true;
+            } else {
+                source->exhausted = true;
+            }
+        }
+    }
+
+    std::cerr << "Merged trace is available as " << output << "\n";
+
+    return 0;
+}
+
+static int
+command(int argc, char *argv[])
+{
+    std::string output;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case OUTPUT_OPT:
+            output = optarg;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        std::cerr << "error: apitrace merge requires at least two trace files as arguments.\n";
+        usage();
+        return 1;
+    }
+
+    if (output.empty()) {
+        os::String base(argv[optind]);
+        base.trimExtension();
+
+        output = std::string(base.str()) + std::string("-merged.trace");
+    }
+
+    std::vector<MergeSource *> sources;
+    int ret = 1;
+    for (int i = optind; i < argc; ++i) {
+        MergeSource *source = new MergeSource;
+        source->filename = argv[i];
+        if (!source->parser.open(argv[i])) {
+            std::cerr << "error: failed to open " << argv[i] << "\n";
+            delete source;
+            goto CLEANUP;
+        }
+        sources.push_back(source);
+    }
+
+    ret = merge_traces(sources, output.c_str());
+
+CLEANUP:
+    for (unsigned i = 0; i < sources.size(); ++i) {
+        delete sources[i];
+    }
+
+    return ret;
+}
+
+const Command merge_command = {
+    "merge",
+    synopsis,
+    usage,
+    command
+};
@@ -26,6 +26,12 @@
 
 /*
  * Pager abstraction.
+ *
+ * Standard output is not piped straight into the pager: a pump thread
+ * sits in between, draining our output into a memory buffer and
+ * feeding the pager with poll()-driven non-blocking writes.  Producing
+ * output therefore never stalls on pager backpressure -- `apitrace
+ * dump` keeps parsing ahead while the pager sits at a prompt.
  */
 
 
@@ -45,18 +51,131 @@ pipepager(void) {
 
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 
+#include <deque>
+#include <string>
+
+#include "os_thread.hpp"
+
 
 static pid_t pid = -1;
 
+static int pumpInFd = -1;   // read end of the pipe our stdout goes into
+static int pumpOutFd = -1;  // write end of the pipe the pager reads
+static os::thread pumpThread;
+
+enum {
+    PUMP_CHUNK = 64 * 1024
+};
+
+/* Stop buffering beyond this and let the producer block instead, so an
+ * unread dump cannot grow without bound. */
+#define PUMP_MAX_BUFFER (256u << 20)
+
+
+/*
+ * Shuttle bytes from the producer pipe to the pager, buffering in
+ * between.  Runs until the producer closes its end and the buffer has
+ * drained, or until the pager goes away; in the latter case the
+ * producer pipe is closed too, so the next write raises SIGPIPE there,
+ * just as writing straight into a dead pager used to.
+ */
+static void
+pumpLoop(void *)
+{
+    // A dead pager must surface as EPIPE here, not kill us
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    fcntl(pumpOutFd, F_SETFL, fcntl(pumpOutFd, F_GETFL) | O_NONBLOCK);
+
+    std::deque<std::string> queue;
+    size_t queued = 0;
+    size_t offset = 0;  // consumed bytes of the front chunk
+    bool inOpen = true;
+
+    for (;;) {
+        struct pollfd fds[2];
+        int nfds = 0;
+        int inIdx = -1;
+        int outIdx = -1;
+
+        if (inOpen && queued < PUMP_MAX_BUFFER) {
+            inIdx = nfds;
+            fds[nfds].fd = pumpInFd;
+            fds[nfds].events = POLLIN;
+            ++nfds;
+        }
+        if (!queue.empty()) {
+            outIdx = nfds;
+            fds[nfds].fd = pumpOutFd;
+            fds[nfds].events = POLLOUT;
+            ++nfds;
+        }
+        if (!nfds) {
+            break;
+        }
+
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (inIdx >= 0 && (fds[inIdx].revents & (POLLIN | POLLHUP))) {
+            char chunk[PUMP_CHUNK];
+            ssize_t got = read(pumpInFd, chunk, sizeof chunk);
+            if (got > 0) {
+                queue.push_back(std::string(chunk, got));
+                queued += got;
+            } else if (got == 0 || errno != EINTR) {
+                close(pumpInFd);
+                pumpInFd = -1;
+                inOpen = false;
+            }
+        }
+
+        if (outIdx >= 0 && (fds[outIdx].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            std::string &front = queue.front();
+            ssize_t put = write(pumpOutFd,
+                                front.data() + offset, front.size() - offset);
+            if (put > 0) {
+                offset += put;
+                queued -= put;
+                if (offset == front.size()) {
+                    queue.pop_front();
+                    offset = 0;
+                }
+            } else if (put < 0 && errno != EINTR && errno != EAGAIN) {
+                // pager went away; unblock and break the producer too
+                if (inOpen) {
+                    close(pumpInFd);
+                    pumpInFd = -1;
+                }
+                break;
+            }
+        }
+    }
+
+    close(pumpOutFd);
+    pumpOutFd = -1;
+}
+
 
 /*
  * Wait for pager process on exit.
@@ -68,6 +187,10 @@ on_exit(void)
 	fflush(stderr);
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
+    if (pumpThread.joinable()) {
+        // drains the remaining buffer into the pager, then EOF
+        pumpThread.join();
+    }
     waitpid(pid, NULL, 0);
 }
 
@@ -135,10 +258,20 @@ pipepager(void) {
         ret = close(parentToChild[READ_FD]);
         assert(ret == 0);
 
-        dup2(parentToChild[WRITE_FD], STDOUT_FILENO);
+        // Interpose the pump between our stdout and the pager
+        int appToPump[2];
+        ret = pipe(appToPump);
+        assert(ret == 0);
+
+        pumpInFd = appToPump[READ_FD];
+        pumpOutFd = parentToChild[WRITE_FD];
+
+        dup2(appToPump[WRITE_FD], STDOUT_FILENO);
         if (isatty(STDERR_FILENO))
-            dup2(parentToChild[WRITE_FD], STDERR_FILENO);
-        close(parentToChild[WRITE_FD]);
+            dup2(appToPump[WRITE_FD], STDERR_FILENO);
+        close(appToPump[WRITE_FD]);
+
+        pumpThread = os::thread(pumpLoop, (void *)NULL);
 
         // Ensure we wait for the pager before terminating
         signal(SIGINT, on_signal);
@@ -137,6 +137,13 @@ public:
     }
 
     void visit(Array *node) {
+        /* Homogeneous arrays of scalars (vertex data, matrices, etc.) are
+         * common and can be huge; emit them through the writer's bulk
+         * paths instead of a virtual visit per element. */
+        if (visitScalarArray(node)) {
+            return;
+        }
+
         writer.beginList();
         for (std::vector<Value *>::iterator it = node->values.begin(); it != node->values.end(); ++it) {
             _visit(*it);
@@ -144,7 +151,87 @@ public:
         writer.endList();
     }
 
+    bool visitScalarArray(Array *node) {
+        size_t count = node->values.size();
+        if (!count) {
+            return false;
+        }
+
+        Value *first = node->values[0];
+
+        if (dynamic_cast<Float *>(first) ||
+            dynamic_cast<Double *>(first)) {
+            std::vector<double> values(count);
+            size_t i;
+            for (i = 0; i < count; ++i) {
+                Value *value = node->values[i];
+                if (!dynamic_cast<Float *>(value) &&
+                    !dynamic_cast<Double *>(value)) {
+                    break;
+                }
+                values[i] = value->toDouble();
+            }
+            if (i == count) {
+                writer.writeFloatArray(&values[0], count);
+                return true;
+            }
+        } else if (dynamic_cast<SInt *>(first) ||
+                   dynamic_cast<UInt *>(first)) {
+            std::vector<long long> values(count);
+            size_t i;
+            for (i = 0; i < count; ++i) {
+                Value *value = node->values[i];
+                if (dynamic_cast<SInt *>(value)) {
+                    values[i] = value->toSInt();
+                } else if (dynamic_cast<UInt *>(value)) {
+                    unsigned long long u = value->toUInt();
+                    if (u > (unsigned long long)std::numeric_limits<long long>::max()) {
+                        break;
+                    }
+                    values[i] = u;
+                } else {
+                    break;
+                }
+            }
+            if (i == count) {
+                writer.writeIntArray(&values[0], count);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     void visit(Blob *node) {
+        if (!node->buf && node->size && node->file) {
+            /* Lazy blob: stream the bytes straight from the trace in
+             * bounded chunks, so pickling a call that carries a huge
+             * buffer never needs the whole buffer resident. */
+            writer.beginByteArray(node->size);
+
+            trace::File *file = node->file;
+            trace::File::Offset save = file->currentOffset();
+            file->setCurrentOffset(node->offset);
+
+            char chunk[64 * 1024];
+            size_t remaining = node->size;
+            while (remaining) {
+                size_t batch = remaining < sizeof chunk ? remaining : sizeof chunk;
+                size_t got = file->read(chunk, batch);
+                if (got < batch) {
+                    /* Truncated trace; pad so the pickle stays
+                     * well-formed. */
+                    memset(chunk + got, 0, batch - got);
+                }
+                writer.writeByteArrayChunk(chunk, batch);
+                remaining -= batch;
+            }
+
+            file->setCurrentOffset(save);
+            writer.endByteArray();
+            return;
+        }
+
         writer.writeByteArray(node->buf, node->size);
     }
 
@@ -258,6 +345,11 @@ command(int argc, char *argv[])
             return 1;
         }
 
+        // On seekable files blob contents are streamed straight from
+        // the trace at pickling time (see visit(Blob)), keeping the
+        // memory footprint bounded however large a single call is.
+        parser.setLazyBlobs(true);
+
         trace::Call *call;
         while ((call = parser.parse_call())) {
             if (calls.contains(*call)) {
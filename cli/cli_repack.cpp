@@ -24,7 +24,9 @@
  **************************************************************************/
 
 
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h> // for CHAR_MAX
 #include <getopt.h>
 
 #include <iostream>
@@ -32,6 +34,7 @@
 #include "cli.hpp"
 
 #include "trace_file.hpp"
+#include "trace_parser.hpp"
 
 
 static const char *synopsis = "Repack a trace file with Snappy compression.";
@@ -40,23 +43,58 @@ static void
 usage(void)
 {
     std::cout
-        << "usage: apitrace repack <in-trace-file> <out-trace-file>\n"
+        << "usage: apitrace repack [OPTIONS] <in-trace-file> <out-trace-file>\n"
         << synopsis << "\n"
         << "\n"
+        << "    --calls=[0-]LAST     only keep the leading calls, through call LAST\n"
+        << "    --frames=[0-]LAST    only keep the leading frames, through frame LAST\n"
+        << "\n"
         << "Snappy compression allows for faster replay and smaller memory footprint,\n"
         << "at the expense of a slightly smaller compression ratio than zlib\n"
+        << "\n"
+        << "With --calls or --frames the output is cut at the given boundary;\n"
+        << "compressed chunks before the boundary are copied verbatim, so the\n"
+        << "extraction is I/O-bound instead of recompressing everything.  The\n"
+        << "trace format inlines signature definitions at first use and numbers\n"
+        << "calls sequentially, so only leading ranges can be extracted this\n"
+        << "way; use apitrace trim for ranges that do not start at 0.\n"
         << "\n";
 }
 
+enum {
+    CALLS_OPT = CHAR_MAX + 1,
+    FRAMES_OPT,
+};
+
 const static char *
 shortOptions = "h";
 
 const static struct option
 longOptions[] = {
     {"help", no_argument, 0, 'h'},
+    {"calls", required_argument, 0, CALLS_OPT},
+    {"frames", required_argument, 0, FRAMES_OPT},
     {0, 0, 0, 0}
 };
 
+/* Accept "LAST" or "0-LAST"; extraction can only keep leading
+ * ranges. */
+static bool
+parsePrefixRange(const char *arg, unsigned long *last)
+{
+    char *end;
+    unsigned long first = strtoul(arg, &end, 10);
+    if (*end == '-') {
+        if (first != 0) {
+            return false;
+        }
+        *last = strtoul(end + 1, &end, 10);
+    } else {
+        *last = first;
+    }
+    return *end == 0 && end != arg;
+}
+
 static int
 repack(const char *inFileName, const char *outFileName)
 {
@@ -86,15 +124,106 @@ repack(const char *inFileName, const char *outFileName)
     return 0;
 }
 
+static int
+repackPrefix(const char *inFileName, const char *outFileName,
+             bool byFrames, unsigned long last)
+{
+    trace::Parser p;
+    if (!p.open(inFileName)) {
+        return 1;
+    }
+    if (!p.supportsOffsets()) {
+        std::cerr << "error: " << inFileName
+                  << " does not support range extraction; "
+                  << "repack it to snappy format first\n";
+        return 1;
+    }
+
+    /* Locate the cut: where the first call beyond the range begins. */
+    trace::ParseBookmark cut;
+    bool found = false;
+
+    if (byFrames) {
+        /* A frame index pinpoints the boundary without any
+         * scanning. */
+        trace::File::FrameIndex index;
+        if (p.getFrameIndex(index) && last + 1 < index.size()) {
+            cut.offset = index[last + 1].start;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        unsigned long frame = 0;
+        for (;;) {
+            p.getBookmark(cut);
+            trace::Call *call = p.scan_call();
+            if (!call) {
+                break;
+            }
+            bool beyond = byFrames ? frame > last : call->no > last;
+            if (beyond) {
+                delete call;
+                found = true;
+                break;
+            }
+            if (call->flags & trace::CALL_FLAG_END_FRAME) {
+                ++frame;
+            }
+            delete call;
+        }
+    }
+
+    p.close();
+
+    if (!found) {
+        /* The range covers the whole trace. */
+        return repack(inFileName, outFileName);
+    }
+
+    trace::File *inFile = trace::File::createForRead(inFileName);
+    if (!inFile) {
+        return 1;
+    }
+
+    bool ok = inFile->extractPrefix(outFileName, cut.offset);
+    delete inFile;
+
+    if (!ok) {
+        std::cerr << "error: failed to extract " << outFileName << "\n";
+        return 1;
+    }
+
+    return 0;
+}
+
 static int
 command(int argc, char *argv[])
 {
+    bool byFrames = false;
+    bool prefix = false;
+    unsigned long last = 0;
+
     int opt;
     while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
         switch (opt) {
         case 'h':
             usage();
             return 0;
+        case CALLS_OPT:
+        case FRAMES_OPT:
+            if (prefix) {
+                std::cerr << "error: at most one of --calls and --frames may be given\n";
+                return 1;
+            }
+            if (!parsePrefixRange(optarg, &last)) {
+                std::cerr << "error: invalid range `" << optarg
+                          << "`; only leading ranges can be extracted\n";
+                return 1;
+            }
+            byFrames = opt == FRAMES_OPT;
+            prefix = true;
+            break;
         default:
             std::cerr << "error: unexpected option `" << opt << "`\n";
             usage();
@@ -108,6 +237,10 @@ command(int argc, char *argv[])
         return 1;
     }
 
+    if (prefix) {
+        return repackPrefix(argv[optind], argv[optind + 1], byFrames, last);
+    }
+
     return repack(argv[optind], argv[optind + 1]);
 }
 
@@ -0,0 +1,128 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+
+#include <iostream>
+
+#include "cli.hpp"
+
+#include "trace_file.hpp"
+
+
+static const char *synopsis = "Verify a trace's checksums and repair damage.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace repair [OPTIONS] <trace-file>...\n"
+        << synopsis << "\n"
+        << "\n"
+        << "    --all        checksum every chunk, not just those past the\n"
+        << "                 last recovery marker\n"
+        << "    --dry-run    report what would be done without modifying\n"
+        << "                 the trace\n"
+        << "\n"
+        << "Crashed captures leave traces without an index footer and usually\n"
+        << "with a partial final chunk; such traces stop short when parsed and\n"
+        << "cannot be seeked.  repair cuts the trace after the last intact\n"
+        << "chunk -- decided from the per-chunk checksums -- splices in any\n"
+        << "leftover write-ahead journal, and appends a fresh index footer,\n"
+        << "leaving a trace that reads like one that was closed cleanly.\n"
+        << "Chunks covered by a recovery marker are known to have been written\n"
+        << "out whole, so by default only the tail of the trace is checksummed\n"
+        << "and repair takes seconds regardless of trace size.\n"
+        << "\n";
+}
+
+enum {
+    ALL_OPT = CHAR_MAX + 1,
+    DRY_RUN_OPT,
+};
+
+const static char *
+shortOptions = "h";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"all", no_argument, 0, ALL_OPT},
+    {"dry-run", no_argument, 0, DRY_RUN_OPT},
+    {0, 0, 0, 0}
+};
+
+static int
+command(int argc, char *argv[])
+{
+    bool verifyAll = false;
+    bool dryRun = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case ALL_OPT:
+            verifyAll = true;
+            break;
+        case DRY_RUN_OPT:
+            dryRun = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "error: apitrace repair requires a trace file as an argument.\n";
+        usage();
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = optind; i < argc; ++i) {
+        if (trace::File::repairSnappy(argv[i], verifyAll, dryRun,
+                                      std::cout) ==
+            trace::File::REPAIR_FAILED) {
+            ++failures;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+const Command repair_command = {
+    "repair",
+    synopsis,
+    usage,
+    command
+};
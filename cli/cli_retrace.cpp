@@ -26,15 +26,22 @@
  *
  *********************************************************************/
 
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h> // for CHAR_MAX
 #include <getopt.h>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "os_string.hpp"
 #include "os_process.hpp"
+#include "os_thread.hpp"
 
 #include "trace_parser.hpp"
+#include "trace_callset.hpp"
+#include "trace_option.hpp"
 #include "cli_resources.hpp"
 
 #include "cli.hpp"
@@ -113,11 +120,152 @@ executeRetrace(const std::vector<const char *> & opts,
 }
 
 
+/*
+ * Multi-process replay orchestration.
+ *
+ * A single replayer process leaves all but one GPU idle on multi-GPU
+ * replay hosts.  With --jobs=N the wrapper shards the work across up
+ * to N concurrent replayer processes:
+ *
+ *  - several traces on the command line are farmed out, one process
+ *    per trace;
+ *
+ *  - a single trace with --snapshot-prefix or --dump-state is sharded
+ *    by call range: every process replays the whole trace, but each
+ *    one only produces the snapshots (or state dumps) of its own
+ *    range, so the expensive readback, compression and serialization
+ *    work runs in parallel, and --fast-forward lets the state dump
+ *    shards skip rendering while seeking their ranges.
+ *
+ * Snapshot and state dump filenames embed call numbers, so the
+ * outputs of the shards merge on disk without further work.  Output
+ * bound to stdout (`-s -`, profiling) cannot be interleaved and falls
+ * back to a single process.
+ */
+
+struct RetraceJob {
+    std::vector<std::string> args;
+    std::string traceName;
+    int status;
+};
+
+struct RetraceQueue {
+    std::vector<RetraceJob> jobs;
+    size_t next;
+    trace::API api;
+    os::mutex mutex;
+};
+
+static void
+retraceWorker(RetraceQueue *queue)
+{
+    os::unique_lock<os::mutex> lock(queue->mutex);
+
+    while (queue->next < queue->jobs.size()) {
+        RetraceJob &job = queue->jobs[queue->next++];
+
+        lock.unlock();
+
+        std::vector<const char *> opts;
+        for (size_t i = 0; i < job.args.size(); ++i) {
+            opts.push_back(job.args[i].c_str());
+        }
+        job.status = executeRetrace(opts, job.traceName.c_str(), queue->api);
+
+        lock.lock();
+    }
+}
+
+static int
+runRetraceJobs(RetraceQueue &queue, long jobs)
+{
+    queue.next = 0;
+
+    size_t numWorkers = queue.jobs.size();
+    if ((long) numWorkers > jobs) {
+        numWorkers = jobs;
+    }
+
+    std::vector<os::thread> workers;
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers.push_back(os::thread(retraceWorker, &queue));
+    }
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers[i].join();
+    }
+
+    for (size_t i = 0; i < queue.jobs.size(); ++i) {
+        if (queue.jobs[i].status != 0) {
+            return queue.jobs[i].status;
+        }
+    }
+    return 0;
+}
+
+/* Whether the argument names an apitrace file, as opposed to an
+ * option or an option's value. */
+static bool
+isTraceFile(const char *arg)
+{
+    if (arg[0] == '-') {
+        return false;
+    }
+
+    os::String path(arg);
+    if (!path.exists()) {
+        return false;
+    }
+
+    trace::Parser p;
+    if (!p.open(arg)) {
+        return false;
+    }
+    p.close();
+    return true;
+}
+
+/* Collect the call numbers a shardable output option targets: the
+ * calls matched by targetSet, or every end-of-frame call when
+ * everyFrame is set. */
+static bool
+scanTargetCalls(const char *filename,
+                trace::CallSet &targetSet,
+                bool everyFrame,
+                std::vector<unsigned> &targetCalls)
+{
+    trace::Parser p;
+    if (!p.open(filename)) {
+        return false;
+    }
+
+    trace::Call *call;
+    while ((call = p.scan_call())) {
+        if (everyFrame
+            ? (call->flags & trace::CALL_FLAG_END_FRAME) != 0
+            : targetSet.contains(*call)) {
+            targetCalls.push_back(call->no);
+        }
+        delete call;
+    }
+
+    p.close();
+    return true;
+}
+
+
 static const char *synopsis = "Replay a trace.";
 
 static void
 usage(void)
 {
+    std::cout
+        << "Options handled by the wrapper itself:\n"
+        "  -j, --jobs=N            shard the replay across up to N concurrent\n"
+        "                          replayer processes; one process per trace,\n"
+        "                          or by call range for a single trace with\n"
+        "                          --snapshot-prefix or --dump-state\n"
+        "\n";
+
     std::vector<const char *>opts;
     opts.push_back("--help");
     trace::API api = trace::API_GL;
@@ -125,24 +273,244 @@ usage(void)
 }
 
 static int
-command(int argc, char *argv[])
+executeRetraceSequential(const std::vector<std::string> &args)
 {
     std::vector<const char *> opts;
-    for (int i = 1; i < argc; ++i) {
-        opts.push_back(argv[i]);
+    for (size_t i = 0; i < args.size(); ++i) {
+        opts.push_back(args[i].c_str());
     }
 
     trace::API api = trace::API_GL;
-    if (argc >= 1) {
-        const char *lastArg = argv[argc -1];
-        if (lastArg[0] != '-') {
-            api = guessApi(lastArg);
-        }
+    if (!args.empty() && args.back()[0] != '-') {
+        api = guessApi(args.back().c_str());
     }
 
     return executeRetrace(opts, NULL, api);
 }
 
+static int
+command(int argc, char *argv[])
+{
+    std::vector<std::string> args;
+    long jobs = 1;
+
+    /* Peel off the wrapper's own --jobs option; everything else is
+     * forwarded to the replayer. */
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+            if (i + 1 < argc) {
+                jobs = atol(argv[++i]);
+            }
+            continue;
+        }
+        if (!strncmp(arg, "--jobs=", 7)) {
+            jobs = atol(arg + 7);
+            continue;
+        }
+        if (arg[0] == '-' && arg[1] == 'j' && arg[2] >= '0' && arg[2] <= '9') {
+            jobs = atol(arg + 2);
+            continue;
+        }
+        args.push_back(arg);
+    }
+
+    if (jobs < 2) {
+        return executeRetraceSequential(args);
+    }
+
+    /* Recognize the forwarded options that decide how (and whether)
+     * the replay can be sharded.  The explicit snapshot and
+     * dump-state call sets are peeled off here and reissued per
+     * shard. */
+    std::vector<std::string> baseArgs;
+    const char *snapshotPrefix = NULL;
+    std::string snapshotSet, dumpStateSet;
+    bool haveSnapshotSet = false;
+    bool haveDumpStateSet = false;
+    bool stdoutBound = false;
+    bool callNos = true;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const char *arg = args[i].c_str();
+
+        if (!strcmp(arg, "-S") || !strcmp(arg, "--snapshot")) {
+            if (i + 1 < args.size()) {
+                snapshotSet = args[++i];
+                haveSnapshotSet = true;
+            }
+            continue;
+        }
+        if (!strncmp(arg, "--snapshot=", 11)) {
+            snapshotSet = arg + 11;
+            haveSnapshotSet = true;
+            continue;
+        }
+        if (arg[0] == '-' && arg[1] == 'S' && arg[2]) {
+            snapshotSet = arg + 2;
+            haveSnapshotSet = true;
+            continue;
+        }
+
+        if (!strcmp(arg, "-D") || !strcmp(arg, "--dump-state")) {
+            if (i + 1 < args.size()) {
+                dumpStateSet = args[++i];
+                haveDumpStateSet = true;
+            }
+            continue;
+        }
+        if (!strncmp(arg, "--dump-state=", 13)) {
+            dumpStateSet = arg + 13;
+            haveDumpStateSet = true;
+            continue;
+        }
+        if (arg[0] == '-' && arg[1] == 'D' && arg[2]) {
+            dumpStateSet = arg + 2;
+            haveDumpStateSet = true;
+            continue;
+        }
+
+        if (!strcmp(arg, "-s") || !strcmp(arg, "--snapshot-prefix")) {
+            if (i + 1 < args.size()) {
+                snapshotPrefix = args[i + 1].c_str();
+            }
+        } else if (!strncmp(arg, "--snapshot-prefix=", 18)) {
+            snapshotPrefix = arg + 18;
+        } else if (arg[0] == '-' && arg[1] == 's' && arg[2]) {
+            snapshotPrefix = arg + 2;
+        } else if (!strcmp(arg, "--pgpu") ||
+                   !strcmp(arg, "--pcpu") ||
+                   !strcmp(arg, "--ppd")) {
+            stdoutBound = true;
+        } else if (!strcmp(arg, "--call-nos")) {
+            callNos = true;
+        } else if (!strncmp(arg, "--call-nos=", 11)) {
+            callNos = trace::boolOption(arg + 11);
+        }
+
+        baseArgs.push_back(args[i]);
+    }
+
+    if (snapshotPrefix && snapshotPrefix[0] == '-' && snapshotPrefix[1] == 0) {
+        stdoutBound = true;
+    }
+
+    /* The traces are the trailing arguments; anything this fails to
+     * recognize (say, an option value) simply ends the run. */
+    std::vector<std::string> traces;
+    while (!baseArgs.empty() && isTraceFile(baseArgs.back().c_str())) {
+        traces.insert(traces.begin(), baseArgs.back());
+        baseArgs.pop_back();
+    }
+
+    RetraceQueue queue;
+
+    if (traces.size() > 1) {
+        /* One process per trace.  The peeled-off call sets go back
+         * unchanged. */
+        if (haveSnapshotSet) {
+            baseArgs.push_back("-S");
+            baseArgs.push_back(snapshotSet);
+        }
+        if (haveDumpStateSet) {
+            baseArgs.push_back("-D");
+            baseArgs.push_back(dumpStateSet);
+        }
+
+        queue.api = guessApi(traces[0].c_str());
+        for (size_t i = 0; i < traces.size(); ++i) {
+            RetraceJob job;
+            job.args = baseArgs;
+            job.traceName = traces[i];
+            job.status = 0;
+            queue.jobs.push_back(job);
+        }
+
+        return runRetraceJobs(queue, jobs);
+    }
+
+    if (traces.empty()) {
+        std::cerr << "warning: no trace found on the command line; ignoring --jobs\n";
+        return executeRetraceSequential(args);
+    }
+
+    /* A single trace.  Without per-process checkpointing every shard
+     * replays the whole trace, so sharding only pays off when there
+     * is per-call output work to split. */
+    const char *sharded = NULL;
+    if (stdoutBound) {
+        std::cerr << "warning: output bound to stdout cannot be sharded; ignoring --jobs\n";
+    } else if (!callNos) {
+        std::cerr << "warning: --call-nos=no snapshot names would collide across shards; ignoring --jobs\n";
+    } else if (haveDumpStateSet && snapshotPrefix) {
+        std::cerr << "warning: cannot shard --dump-state and --snapshot-prefix together; ignoring --jobs\n";
+    } else if (haveDumpStateSet) {
+        sharded = "-D";
+    } else if (snapshotPrefix) {
+        sharded = "-S";
+    } else {
+        std::cerr << "warning: nothing to shard without --snapshot-prefix or --dump-state; ignoring --jobs\n";
+    }
+    if (!sharded) {
+        return executeRetraceSequential(args);
+    }
+
+    const std::string &targetSetString = haveDumpStateSet ? dumpStateSet : snapshotSet;
+    bool everyFrame = !haveDumpStateSet && !haveSnapshotSet;
+    trace::CallSet targetSet;
+    if (!everyFrame) {
+        targetSet = trace::CallSet(targetSetString.c_str());
+    }
+
+    std::vector<unsigned> targetCalls;
+    if (!scanTargetCalls(traces[0].c_str(), targetSet, everyFrame, targetCalls)) {
+        return 1;
+    }
+
+    size_t shards = jobs;
+    if (shards > targetCalls.size()) {
+        shards = targetCalls.size();
+    }
+    if (shards < 2) {
+        return executeRetraceSequential(args);
+    }
+
+    queue.api = guessApi(traces[0].c_str());
+    size_t first = 0;
+    for (size_t i = 0; i < shards; ++i) {
+        size_t count = targetCalls.size() / shards
+                     + (i < targetCalls.size() % shards ? 1 : 0);
+        std::ostringstream shardSet;
+
+        if (everyFrame) {
+            /* The default set is every frame; a compact call range
+             * with frame frequency covers the shard. */
+            unsigned startCall = first ? targetCalls[first - 1] + 1 : 0;
+            shardSet << startCall << "-"
+                     << targetCalls[first + count - 1] << "/frame";
+        } else {
+            for (size_t j = 0; j < count; ++j) {
+                if (j) {
+                    shardSet << ",";
+                }
+                shardSet << targetCalls[first + j];
+            }
+        }
+
+        RetraceJob job;
+        job.args = baseArgs;
+        job.args.push_back(sharded);
+        job.args.push_back(shardSet.str());
+        job.traceName = traces[0];
+        job.status = 0;
+        queue.jobs.push_back(job);
+
+        first += count;
+    }
+
+    return runRetraceJobs(queue, jobs);
+}
+
 const Command retrace_command = {
     "retrace",
     synopsis,
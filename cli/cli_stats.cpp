@@ -0,0 +1,327 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Intel corporation
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Columnar per-call statistics export, for consumption by data
+ * pipelines without pickling the whole trace through Python.
+ *
+ * The records are gathered in a single scan() pass -- no Call or
+ * Value objects are ever materialized -- and written column by
+ * column:
+ *
+ *   byte[4]  'a' 't' 'c' 's'
+ *   u32      format version (currently 2)
+ *   u64      number of rows
+ *   for each of the columns, in this fixed order:
+ *     call_no u32, function_id u32, thread u8, frame u32,
+ *     num_args u32, bytes u64, blob_bytes u64
+ *   {
+ *     u8     column name length, followed by the name
+ *     u8     element size
+ *     data   rows * element size
+ *   }
+ *   function name dictionary {
+ *     u32    number of entries
+ *     per entry: u32 function id, u16 name length, name bytes
+ *   }
+ *   thread table {
+ *     u32    number of entries
+ *     per entry: u32 recorded thread id, indexed by the thread column
+ *   }
+ *
+ * Everything is little-endian.  bytes is the size of the call's
+ * records as stored in the trace stream; blob_bytes is the logical
+ * blob payload size, which exceeds its stored footprint for blobs
+ * written individually compressed.
+ */
+
+#include <string.h>
+#include <getopt.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cli.hpp"
+
+#include "os_binary.hpp"
+
+#include "trace_analysis.hpp"
+#include "trace_parser.hpp"
+
+
+static const char *synopsis = "Export per-call statistics in a columnar binary format.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace stats [OPTIONS] TRACE_FILE...\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help           show this help message and exit\n"
+        "    -o, --output=FILE    write to FILE instead of standard output\n"
+        "    -v, --verbose        report the parse-side memory footprint\n"
+    ;
+}
+
+
+static void
+putU16(std::ostream &os, uint16_t value)
+{
+    unsigned char buf[2];
+    buf[0] = value & 0xff;
+    buf[1] = (value >> 8) & 0xff;
+    os.write((const char *)buf, sizeof buf);
+}
+
+static void
+putU32(std::ostream &os, uint32_t value)
+{
+    unsigned char buf[4];
+    buf[0] = value & 0xff;
+    buf[1] = (value >> 8) & 0xff;
+    buf[2] = (value >> 16) & 0xff;
+    buf[3] = (value >> 24) & 0xff;
+    os.write((const char *)buf, sizeof buf);
+}
+
+static void
+putU64(std::ostream &os, uint64_t value)
+{
+    putU32(os, value & 0xffffffffU);
+    putU32(os, value >> 32);
+}
+
+
+class StatsCollector : public trace::Analyzer
+{
+public:
+    std::vector<uint32_t> callNos;
+    std::vector<uint32_t> functionIds;
+    std::vector<uint8_t> threadIndices;
+    std::vector<uint32_t> threadIds;
+    std::vector<uint32_t> frames;
+    std::vector<uint32_t> numArgs;
+    std::vector<uint64_t> bytes;
+    std::vector<uint64_t> blobBytes;
+
+    std::map<uint32_t, std::string> functionNames;
+
+    StatsCollector() :
+        frameNo(0)
+    {}
+
+    void analyze(const trace::CallBatch &batch)
+    {
+        for (unsigned i = 0; i < batch.count; ++i) {
+            const trace::FunctionSig *sig = batch.sigs[i];
+
+            callNos.push_back(batch.call_nos[i]);
+            functionIds.push_back(sig->id);
+            threadIndices.push_back(threadIndex(batch.thread_ids[i]));
+            frames.push_back(frameNo);
+            numArgs.push_back(batch.num_args[i]);
+            bytes.push_back(batch.bytes[i]);
+            blobBytes.push_back(batch.blob_bytes[i]);
+
+            if (!functionNames.count(sig->id)) {
+                functionNames[sig->id] = sig->name;
+            }
+
+            /* Derived from the flags rather than taken from
+             * batch.frame_nos, which restart at zero for every input
+             * trace; this column keeps counting across them. */
+            if (batch.flags[i] & trace::CALL_FLAG_END_FRAME) {
+                ++frameNo;
+            }
+        }
+    }
+
+private:
+    /* Map a recorded thread id to a dense index into threadIds, in
+     * first-seen order, so the per-call column is a single byte.
+     * Traces carry a handful of threads; a linear scan suffices, and
+     * a pathological producer with more than 255 is clamped rather
+     * than widening every row. */
+    uint8_t threadIndex(unsigned thread_id) {
+        for (size_t i = 0; i < threadIds.size(); ++i) {
+            if (threadIds[i] == thread_id) {
+                return (uint8_t)i;
+            }
+        }
+        if (threadIds.size() > 255) {
+            return 255;
+        }
+        threadIds.push_back(thread_id);
+        return (uint8_t)(threadIds.size() - 1);
+    }
+
+    uint32_t frameNo;
+};
+
+
+template< class T >
+static void
+writeColumn(std::ostream &os, const char *name,
+            const std::vector<T> &values)
+{
+    size_t nameLength = strlen(name);
+    os.put((char)nameLength);
+    os.write(name, nameLength);
+    os.put((char)sizeof(T));
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (sizeof(T) == 8) {
+            putU64(os, values[i]);
+        } else if (sizeof(T) == 1) {
+            os.put((char)values[i]);
+        } else {
+            putU32(os, values[i]);
+        }
+    }
+}
+
+static void
+writeStats(std::ostream &os, const StatsCollector &stats)
+{
+    os.write("atcs", 4);
+    putU32(os, 2);
+    putU64(os, stats.callNos.size());
+
+    writeColumn(os, "call_no", stats.callNos);
+    writeColumn(os, "function_id", stats.functionIds);
+    writeColumn(os, "thread", stats.threadIndices);
+    writeColumn(os, "frame", stats.frames);
+    writeColumn(os, "num_args", stats.numArgs);
+    writeColumn(os, "bytes", stats.bytes);
+    writeColumn(os, "blob_bytes", stats.blobBytes);
+
+    putU32(os, stats.functionNames.size());
+    for (std::map<uint32_t, std::string>::const_iterator it =
+             stats.functionNames.begin();
+         it != stats.functionNames.end(); ++it) {
+        putU32(os, it->first);
+        putU16(os, it->second.size());
+        os.write(it->second.data(), it->second.size());
+    }
+
+    /* Thread table: the recorded thread id for each dense index in
+     * the thread column. */
+    putU32(os, stats.threadIds.size());
+    for (size_t i = 0; i < stats.threadIds.size(); ++i) {
+        putU32(os, stats.threadIds[i]);
+    }
+}
+
+
+const static char *
+shortOptions = "ho:v";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"output", required_argument, 0, 'o'},
+    {"verbose", no_argument, 0, 'v'},
+    {0, 0, 0, 0}
+};
+
+static int
+command(int argc, char *argv[])
+{
+    const char *output = NULL;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'o':
+            output = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "error: apitrace stats requires a trace file as an argument.\n";
+        usage();
+        return 1;
+    }
+
+    StatsCollector stats;
+
+    trace::AnalysisPass pass;
+    pass.add(&stats);
+
+    for (int i = optind; i < argc; ++i) {
+        trace::Parser parser;
+
+        if (!parser.open(argv[i])) {
+            return 1;
+        }
+
+        pass.run(parser);
+
+        if (verbose) {
+            std::cerr << argv[i] << ": "
+                      << (parser.memoryUsage() + 1023) / 1024
+                      << " KiB parse-side footprint\n";
+        }
+    }
+
+    if (output) {
+        std::ofstream os(output, std::ofstream::binary | std::ofstream::trunc);
+        if (!os) {
+            std::cerr << "error: failed to open " << output << "\n";
+            return 1;
+        }
+        writeStats(os, stats);
+        return os.good() ? 0 : 1;
+    }
+
+    os::setBinaryMode(stdout);
+    std::cout.sync_with_stdio(false);
+    writeStats(std::cout, stats);
+
+    return 0;
+}
+
+const Command stats_command = {
+    "stats",
+    synopsis,
+    usage,
+    command
+};
@@ -0,0 +1,284 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include <snappy.h>
+
+#include <iostream>
+#include <string>
+
+#include "cli.hpp"
+
+#include "trace_file.hpp"
+
+
+static const char *synopsis = "Serve a trace to remote replay hosts over TCP.";
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace stream [OPTIONS] <trace-file>\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help           show this help message and exit\n"
+        "    -p, --port=PORT      TCP port to listen on (default 27183)\n"
+        "    -l, --loop           keep serving after the first connection\n"
+        "    -o, --output=-       write the stream to stdout instead of TCP\n"
+        "\n"
+        "The trace is sent as a stream of snappy-compressed chunks which\n"
+        "glretrace and the other tools consume directly -- pass `tcp://HOST:PORT`\n"
+        "(or `-` when piping through stdin, e.g. over ssh) in place of the\n"
+        "trace file name on the replay host.  The replay host parses as the\n"
+        "bytes arrive and never stores the trace; a replay that falls\n"
+        "behind simply backs the connection up, so no explicit flow control\n"
+        "is needed.  The input may be zlib or snappy compressed; it is\n"
+        "re-chunked for the wire.\n"
+    ;
+}
+
+const static char *
+shortOptions = "hp:lo:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"port", required_argument, 0, 'p'},
+    {"loop", no_argument, 0, 'l'},
+    {"output", required_argument, 0, 'o'},
+    {0, 0, 0, 0}
+};
+
+enum {
+    DEFAULT_PORT = 27183,
+    STREAM_CHUNK_SIZE = 1 * 1024 * 1024
+};
+
+
+#ifdef _WIN32
+typedef SOCKET Connection;
+static const Connection NO_CONNECTION = INVALID_SOCKET;
+#else
+typedef int Connection;
+static const Connection NO_CONNECTION = -1;
+#endif
+
+
+static bool
+sendBytes(Connection conn, bool useStdout, const char *data, size_t length)
+{
+    size_t total = 0;
+    while (total < length) {
+#ifdef _WIN32
+        int sent = useStdout
+            ? _write(1, data + total, (unsigned)(length - total))
+            : send(conn, data + total, (int)(length - total), 0);
+#else
+        ssize_t sent = useStdout
+            ? write(1, data + total, length - total)
+            : send(conn, data + total, length - total, 0);
+#endif
+        if (sent <= 0) {
+            return false;
+        }
+        total += sent;
+    }
+    return true;
+}
+
+/* Send one trace as the chunk stream trace_file_stream.cpp consumes:
+ * the two-byte identifier, then length-prefixed snappy chunks until
+ * the trace (and with it the connection) ends. */
+static bool
+serveTrace(const char *fileName, Connection conn, bool useStdout)
+{
+    trace::File *file = trace::File::createForRead(fileName);
+    if (!file) {
+        return false;
+    }
+
+    char id[2] = { SNAPPY_BYTE1, SNAPPY_BYTE2 };
+    bool ok = sendBytes(conn, useStdout, id, 2);
+
+    char *buf = new char[STREAM_CHUNK_SIZE];
+    std::string compressed;
+
+    while (ok) {
+        size_t read = file->read(buf, STREAM_CHUNK_SIZE);
+        if (!read) {
+            break;
+        }
+
+        ::snappy::Compress(buf, read, &compressed);
+
+        unsigned char lengthBuf[4];
+        lengthBuf[0] = compressed.size() & 0xff;
+        lengthBuf[1] = (compressed.size() >> 8) & 0xff;
+        lengthBuf[2] = (compressed.size() >> 16) & 0xff;
+        lengthBuf[3] = (compressed.size() >> 24) & 0xff;
+
+        ok = sendBytes(conn, useStdout, (const char *)lengthBuf, 4) &&
+             sendBytes(conn, useStdout, &compressed[0], compressed.size());
+    }
+
+    delete [] buf;
+    delete file;
+    return ok;
+}
+
+static int
+serve(const char *fileName, int port, bool loop)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    Connection listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener == NO_CONNECTION) {
+        std::cerr << "error: failed to create socket\n";
+        return 1;
+    }
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+               (const char *)&reuse, sizeof reuse);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+        listen(listener, 1) != 0) {
+        std::cerr << "error: failed to listen on port " << port << "\n";
+        return 1;
+    }
+
+    std::cerr << "Serving " << fileName << " on port " << port << "\n";
+
+    int ret = 0;
+    do {
+        Connection conn = accept(listener, NULL, NULL);
+        if (conn == NO_CONNECTION) {
+            std::cerr << "error: accept failed\n";
+            ret = 1;
+            break;
+        }
+
+        if (!serveTrace(fileName, conn, false)) {
+            /* A dropped connection only fails this replay; keep
+             * serving in loop mode. */
+            std::cerr << "warning: connection dropped\n";
+            ret = loop ? ret : 1;
+        }
+
+#ifdef _WIN32
+        closesocket(conn);
+#else
+        close(conn);
+#endif
+    } while (loop);
+
+#ifdef _WIN32
+    closesocket(listener);
+#else
+    close(listener);
+#endif
+    return ret;
+}
+
+static int
+command(int argc, char *argv[])
+{
+    int port = DEFAULT_PORT;
+    bool loop = false;
+    bool useStdout = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'l':
+            loop = true;
+            break;
+        case 'o':
+            if (strcmp(optarg, "-") != 0) {
+                std::cerr << "error: only `-` (stdout) is supported for --output\n";
+                return 1;
+            }
+            useStdout = true;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        std::cerr << "error: expected a single trace file\n";
+        usage();
+        return 1;
+    }
+
+    if (useStdout) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        return serveTrace(argv[optind], NO_CONNECTION, true) ? 0 : 1;
+    }
+
+    return serve(argv[optind], port, loop);
+}
+
+const Command stream_command = {
+    "stream",
+    synopsis,
+    usage,
+    command
+};
@@ -29,14 +29,19 @@
 #include <limits.h> // for CHAR_MAX
 #include <getopt.h>
 
+#include <map>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
 
 #include "os_string.hpp"
+#include "os_thread.hpp"
 
 #include "trace_analyzer.hpp"
 #include "trace_callset.hpp"
+#include "trace_dump.hpp"
 #include "trace_parser.hpp"
 #include "trace_writer.hpp"
 
@@ -54,10 +59,13 @@ usage(void)
         "        --frames=FRAMESET    Include specified frames in the trimmed output.\n"
         "        --deps               Include additional calls to satisfy dependencies\n"
         "        --prune              Omit uninteresting calls from the trace output\n"
+        "        --prune-state        Drop state calls overwritten before anything\n"
+        "                             could observe them\n"
         "    -a, --auto               Trim automatically to calls specified in --calls/--frames\n"
         "                             Equivalent to both --deps and --prune\n"
         "        --print-callset      Print the final set of calls included in output\n"
         "        --thread=THREAD_ID   Only retain calls from specified thread\n"
+        "        --threads=N          Trim with N parallel threads\n"
         "    -o, --output=TRACE_FILE  Output trace file\n"
     ;
 }
@@ -81,6 +89,13 @@ help()
         "        --prune              Omit calls with no side effects, even if the call\n"
         "                             is within the range specified by --calls/--frames.\n"
         "\n"
+        "        --prune-state        Drop state-setting calls whose effect is provably\n"
+        "                             unobservable: rebinds of the object already bound\n"
+        "                             and uniforms or scalar state set again before any\n"
+        "                             other call could read them.  Conservative: only a\n"
+        "                             fixed table of well-understood setters is touched,\n"
+        "                             and any other call in between keeps the store.\n"
+        "\n"
         "    -a, --auto               Use dependency analysis and pruning\n"
         "                             of uninteresting calls the resulting trace may\n"
         "                             include more and less calls than specified.\n"
@@ -95,6 +110,11 @@ help()
         "\n"
         "        --thread=THREAD_ID   Only retain calls from specified thread\n"
         "\n"
+        "        --threads=N          Trim with N parallel threads.  Only effective\n"
+        "                             without --deps, --prune-state and\n"
+        "                             --print-callset, which inherently process the\n"
+        "                             trace sequentially.\n"
+        "\n"
         "    -o, --output=TRACE_FILE  Output trace file\n"
         "\n"
     ;
@@ -105,7 +125,9 @@ enum {
     FRAMES_OPT,
     DEPS_OPT,
     PRUNE_OPT,
+    PRUNE_STATE_OPT,
     THREAD_OPT,
+    THREADS_OPT,
     PRINT_CALLSET_OPT,
 };
 
@@ -119,8 +141,10 @@ longOptions[] = {
     {"frames", required_argument, 0, FRAMES_OPT},
     {"deps", no_argument, 0, DEPS_OPT},
     {"prune", no_argument, 0, PRUNE_OPT},
+    {"prune-state", no_argument, 0, PRUNE_STATE_OPT},
     {"auto", no_argument, 0, 'a'},
     {"thread", required_argument, 0, THREAD_OPT},
+    {"threads", required_argument, 0, THREADS_OPT},
     {"output", required_argument, 0, 'o'},
     {"print-callset", no_argument, 0, PRINT_CALLSET_OPT},
     {0, 0, 0, 0}
@@ -132,6 +156,344 @@ struct stringCompare {
     }
 };
 
+/**
+ * Dead-state elimination (--prune-state).
+ *
+ * Even the kept range of a trim carries redundant state churn:
+ * rebinds of the object that is already bound, glUseProgram of the
+ * active program, uniforms and scalar state set and then set again
+ * before anything could observe them.  This pass walks the kept calls
+ * in order and collects the stores that are provably unobservable, so
+ * pass 2 can drop them.
+ *
+ * The model is deliberately conservative.  Only a fixed table of
+ * well-understood scalar state setters participates; every other call
+ * is treated as a barrier that may read any state, so a store only
+ * counts as overwritten when nothing but recognized setters ran in
+ * between.  Calls compiled rather than executed (inside glBegin/glEnd
+ * or glNewList/glEndList) are left alone, and attrib-stack or
+ * window-system calls additionally forget the remembered values, so
+ * redundancy checks restart from unknown state.
+ */
+class StateEliminator {
+private:
+    struct PendingStore {
+        unsigned call_no;
+        std::string value;
+    };
+
+    /* Contexts are bound per thread, so state is tracked per thread. */
+    struct ThreadState {
+        /* last value known to have been observed, per slot */
+        std::map<std::string, std::string> committed;
+        /* stores not yet observed by anything, per slot */
+        std::map<std::string, PendingStore> pending;
+        bool inside_begin_end;
+        bool inside_list;
+        std::string active_program;
+        std::string active_texture;
+        ThreadState() : inside_begin_end(false), inside_list(false) {}
+    };
+
+    std::map<unsigned, ThreadState> threads;
+    std::set<unsigned> dead;
+
+    /* Canonical text of the call's arguments from first on, for
+     * comparing stores by value. */
+    static std::string
+    argsValue(trace::Call *call, unsigned first = 0)
+    {
+        std::ostringstream ss;
+        for (unsigned i = first; i < call->args.size(); ++i) {
+            if (call->args[i].value) {
+                trace::dump(call->args[i].value, ss,
+                            trace::DUMP_FLAG_NO_COLOR);
+            }
+            ss << ',';
+        }
+        return ss.str();
+    }
+
+    /* The pending store on one slot has been observed; remember its
+     * value for redundancy checks. */
+    static void
+    commitSlot(ThreadState &ts, const std::string &slot)
+    {
+        std::map<std::string, PendingStore>::iterator it =
+            ts.pending.find(slot);
+        if (it != ts.pending.end()) {
+            ts.committed[it->first] = it->second.value;
+            ts.pending.erase(it);
+        }
+    }
+
+    /* A call that may read arbitrary state commits every pending
+     * store. */
+    static void
+    barrier(ThreadState &ts)
+    {
+        std::map<std::string, PendingStore>::iterator it;
+        for (it = ts.pending.begin(); it != ts.pending.end(); ++it) {
+            ts.committed[it->first] = it->second.value;
+        }
+        ts.pending.clear();
+    }
+
+    /* Whether the slot lives in the bound vertex array object rather
+     * than in the context. */
+    static bool
+    isVaoSlot(const std::string &slot)
+    {
+        return strncmp(slot.c_str(), "glEnableVertexAttribArray:",
+                       strlen("glEnableVertexAttribArray:")) == 0 ||
+               slot == "glBindBuffer:GL_ELEMENT_ARRAY_BUFFER" ||
+               slot == "glBindBufferARB:GL_ELEMENT_ARRAY_BUFFER";
+    }
+
+    /* A vertex array object bind swaps every per-VAO slot at once.
+     * Pending stores wrote the previously bound object's state, which
+     * becomes observable again whenever that object is rebound, so
+     * they are kept rather than killed; the remembered values are
+     * forgotten, since they no longer describe the bound object. */
+    static void
+    forgetVaoState(ThreadState &ts)
+    {
+        std::map<std::string, PendingStore>::iterator p = ts.pending.begin();
+        while (p != ts.pending.end()) {
+            if (isVaoSlot(p->first)) {
+                ts.pending.erase(p++);
+            } else {
+                ++p;
+            }
+        }
+        std::map<std::string, std::string>::iterator c = ts.committed.begin();
+        while (c != ts.committed.end()) {
+            if (isVaoSlot(c->first)) {
+                ts.committed.erase(c++);
+            } else {
+                ++c;
+            }
+        }
+    }
+
+    /* Whether the call is a recognized scalar state setter; if so,
+     * which slot it writes, the value written, and which slot it
+     * implicitly reads while doing so (e.g. glBindTexture binds to
+     * the active texture unit). */
+    static bool
+    deriveSlot(ThreadState &ts, trace::Call *call,
+               std::string &slot, std::string &value,
+               std::string &consumes)
+    {
+        const char *name = call->name();
+
+        if (strcmp(name, "glUseProgram") == 0 ||
+            strcmp(name, "glUseProgramObjectARB") == 0) {
+            slot = "program";
+            value = argsValue(call);
+            ts.active_program = value;
+            return true;
+        }
+
+        if (strcmp(name, "glActiveTexture") == 0 ||
+            strcmp(name, "glActiveTextureARB") == 0) {
+            slot = "unit";
+            value = argsValue(call);
+            ts.active_texture = value;
+            return true;
+        }
+
+        /* binds to the given target of the active texture unit */
+        if (strcmp(name, "glBindTexture") == 0 && call->args.size() >= 2) {
+            std::string args = argsValue(call);
+            std::string target = args.substr(0, args.find(','));
+            slot = "glBindTexture:" + ts.active_texture + ":" + target;
+            value = argsValue(call, 1);
+            consumes = "unit";
+            return true;
+        }
+
+        /* uniforms write (program, location) slots; without a known
+         * program the slot would collide across programs */
+        if (strncmp(name, "glUniform", 9) == 0 &&
+            strstr(name, "Block") == NULL &&
+            call->args.size() >= 1) {
+            if (ts.active_program.empty()) {
+                return false;
+            }
+            std::string location = argsValue(call);
+            location.erase(location.find(','));
+            slot = "glUniform:" + ts.active_program + ":" + location;
+            value = argsValue(call, 1);
+            consumes = "program";
+            return true;
+        }
+
+        /* glEnable/glDisable pairs write the same capability slot */
+        static const char * const toggles[][2] = {
+            {"glEnable", "glDisable"},
+            {"glEnableClientState", "glDisableClientState"},
+            {"glEnableVertexAttribArray", "glDisableVertexAttribArray"},
+        };
+        for (unsigned i = 0; i < sizeof toggles / sizeof toggles[0]; ++i) {
+            bool on = strcmp(name, toggles[i][0]) == 0;
+            if ((on || strcmp(name, toggles[i][1]) == 0) &&
+                call->args.size() >= 1) {
+                slot = std::string(toggles[i][0]) + ":" + argsValue(call);
+                value = on ? "1" : "0";
+                if (strcmp(toggles[i][0], "glEnableVertexAttribArray") == 0) {
+                    /* writes the bound vertex array object's state */
+                    consumes = "glBindVertexArray";
+                }
+                return true;
+            }
+        }
+
+        /* setters whose first argument selects the slot */
+        static const char * const targeted[] = {
+            "glBindBuffer", "glBindBufferARB",
+            "glBindFramebuffer", "glBindFramebufferEXT",
+            "glBindRenderbuffer", "glBindRenderbufferEXT",
+            "glBindSampler",
+            "glPixelStorei", "glPixelStoref",
+            "glPolygonMode",
+        };
+        for (unsigned i = 0; i < sizeof targeted / sizeof targeted[0]; ++i) {
+            if (strcmp(name, targeted[i]) == 0 && call->args.size() >= 2) {
+                std::string args = argsValue(call);
+                size_t comma = args.find(',');
+                slot = std::string(name) + ":" + args.substr(0, comma);
+                value = args.substr(comma + 1);
+                if (isVaoSlot(slot)) {
+                    /* writes the bound vertex array object's state */
+                    consumes = "glBindVertexArray";
+                }
+                return true;
+            }
+        }
+
+        /* setters writing one slot named after the function */
+        static const char * const whole[] = {
+            "glBindVertexArray", "glBindProgramPipeline",
+            "glBlendColor", "glBlendEquation", "glBlendEquationSeparate",
+            "glBlendFunc", "glBlendFuncSeparate",
+            "glClearColor", "glClearDepth", "glClearDepthf",
+            "glClearStencil", "glColorMask", "glCullFace",
+            "glDepthFunc", "glDepthMask", "glDepthRange", "glDepthRangef",
+            "glFrontFace", "glLineWidth", "glLogicOp", "glMatrixMode",
+            "glPointSize", "glPolygonOffset", "glPrimitiveRestartIndex",
+            "glProvokingVertex", "glSampleCoverage", "glScissor",
+            "glShadeModel", "glStencilFunc", "glStencilMask",
+            "glStencilOp", "glViewport",
+        };
+        for (unsigned i = 0; i < sizeof whole / sizeof whole[0]; ++i) {
+            if (strcmp(name, whole[i]) == 0) {
+                slot = name;
+                value = argsValue(call);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+public:
+    void
+    visit(trace::Call *call)
+    {
+        ThreadState &ts = threads[call->thread_id];
+        const char *name = call->name();
+
+        /* Calls in here are compiled, not executed; keep them all. */
+        if (ts.inside_list || ts.inside_begin_end) {
+            if (strcmp(name, "glEndList") == 0) {
+                ts.inside_list = false;
+            } else if (strcmp(name, "glEnd") == 0) {
+                ts.inside_begin_end = false;
+            }
+            barrier(ts);
+            return;
+        }
+        if (strcmp(name, "glNewList") == 0) {
+            ts.inside_list = true;
+            barrier(ts);
+            return;
+        }
+        if (strcmp(name, "glBegin") == 0) {
+            ts.inside_begin_end = true;
+            barrier(ts);
+            return;
+        }
+
+        /* The attrib stack and window-system calls leave state with
+         * values this pass cannot know; commit and start over. */
+        if (strcmp(name, "glPushAttrib") == 0 ||
+            strcmp(name, "glPopAttrib") == 0 ||
+            strcmp(name, "glPushClientAttrib") == 0 ||
+            strcmp(name, "glPopClientAttrib") == 0 ||
+            strncmp(name, "glX", 3) == 0 ||
+            strncmp(name, "wgl", 3) == 0 ||
+            strncmp(name, "egl", 3) == 0 ||
+            strncmp(name, "CGL", 3) == 0) {
+            barrier(ts);
+            ts.committed.clear();
+            ts.active_program.clear();
+            ts.active_texture.clear();
+            return;
+        }
+
+        std::string slot, value, consumes;
+        if (!deriveSlot(ts, call, slot, value, consumes)) {
+            barrier(ts);
+            return;
+        }
+
+        if (!consumes.empty()) {
+            commitSlot(ts, consumes);
+        }
+
+        /* Binding a vertex array object is no independent scalar: the
+         * object carries the vertex-attrib enables and the element
+         * array binding with it.  Unless the object is provably bound
+         * already, every per-VAO slot changes value here. */
+        if (slot == "glBindVertexArray") {
+            std::map<std::string, std::string>::iterator c =
+                ts.committed.find(slot);
+            if (c == ts.committed.end() || c->second != value) {
+                forgetVaoState(ts);
+            }
+        }
+
+        /* An earlier store to the same slot that nothing observed is
+         * dead. */
+        std::map<std::string, PendingStore>::iterator p =
+            ts.pending.find(slot);
+        if (p != ts.pending.end()) {
+            dead.insert(p->second.call_no);
+            ts.pending.erase(p);
+        }
+
+        /* A store of the value the slot already holds is redundant. */
+        std::map<std::string, std::string>::iterator c =
+            ts.committed.find(slot);
+        if (c != ts.committed.end() && c->second == value) {
+            dead.insert(call->no);
+            return;
+        }
+
+        PendingStore store;
+        store.call_no = call->no;
+        store.value = value;
+        ts.pending[slot] = store;
+    }
+
+    const std::set<unsigned> &
+    getDead() const
+    {
+        return dead;
+    }
+};
+
 struct trim_options {
     /* Calls to be included in trace. */
     trace::CallSet calls;
@@ -145,6 +507,9 @@ struct trim_options {
     /* Whether uninteresting calls should be pruned.. */
     bool prune_uninteresting;
 
+    /* Whether overwritten/redundant state stores should be dropped. */
+    bool prune_state;
+
     /* Output filename */
     std::string output;
 
@@ -153,6 +518,9 @@ struct trim_options {
 
     /* Print resulting callset */
     int print_callset;
+
+    /* Number of worker threads to trim with */
+    unsigned threads;
 };
 
 static int
@@ -221,12 +589,40 @@ trim_trace(const char *filename, struct trim_options *options)
         delete call;
     }
 
-    /* Prepare output file and writer for output. */
-    if (options->output.empty()) {
-        os::String base(filename);
-        base.trimExtension();
+    required = analyzer.get_required();
+
+    /* In between, when requested, find the state stores among the
+     * kept calls that are overwritten or redundant.  Only kept calls
+     * are fed to the eliminator, so its view matches the trace that
+     * pass 2 will actually write. */
+    std::set<unsigned> dead;
+    if (options->prune_state) {
+        p.setBookmark(beginning);
+
+        StateEliminator eliminator;
+        frame = 0;
+        while ((call = p.parse_call())) {
+            if (call->no > options->calls.getLast() ||
+                frame > options->frames.getLast()) {
+                delete call;
+                break;
+            }
+
+            if (required->find(call->no) != required->end()) {
+                eliminator.visit(call);
+            }
 
-        options->output = std::string(base.str()) + std::string("-trim.trace");
+            if (call->flags & trace::CALL_FLAG_END_FRAME)
+                frame++;
+
+            delete call;
+        }
+
+        dead = eliminator.getDead();
+        if (!dead.empty()) {
+            std::cerr << "Pruned " << dead.size()
+                      << " dead state calls\n";
+        }
     }
 
     trace::Writer writer;
@@ -238,9 +634,6 @@ trim_trace(const char *filename, struct trim_options *options)
     /* Reset bookmark for pass 2. */
     p.setBookmark(beginning);
 
-    /* In pass 2, emit the calls that are required. */
-    required = analyzer.get_required();
-
     frame = 0;
     call_range_first = -1;
     call_range_last = -1;
@@ -254,7 +647,8 @@ trim_trace(const char *filename, struct trim_options *options)
             break;
         }
 
-        if (required->find(call->no) != required->end()) {
+        if (required->find(call->no) != required->end() &&
+            dead.find(call->no) == dead.end()) {
             writer.writeCall(call);
 
             if (options->print_callset) {
@@ -288,6 +682,278 @@ trim_trace(const char *filename, struct trim_options *options)
     return 0;
 }
 
+/* Whether this call survives the trim filter.  Mirrors the filtering
+ * of trim_trace() for the no-dependency-analysis case, where the
+ * required set is simply the set of calls matching the filter. */
+static bool
+keep_call(trace::Call *call, unsigned frame, struct trim_options *options)
+{
+    if (options->thread != -1 && call->thread_id != (unsigned) options->thread) {
+        return false;
+    }
+
+    if (options->prune_uninteresting && call->flags & trace::CALL_FLAG_VERBOSE) {
+        return false;
+    }
+
+    return options->calls.contains(*call) ||
+           options->frames.contains(frame, call->flags);
+}
+
+/* A contiguous range of frames, trimmed by one worker into its own
+ * temporary trace segment. */
+struct trim_segment {
+    trace::ParseBookmark start;
+    unsigned first_frame;
+    unsigned num_calls;
+    std::string filename;
+    bool ok;
+};
+
+/* State shared between the trim workers. */
+struct trim_engine {
+    const char *filename;
+    struct trim_options *options;
+    trace::Parser *master;
+    std::vector<trim_segment> segments;
+    size_t next_segment;
+    os::mutex mutex;
+};
+
+/* Parse one segment's calls, writing those that survive the filter to
+ * the segment's own trace file.  Call numbers restart from zero in
+ * each segment; the concatenation pass renumbers. */
+static bool
+trim_segment_calls(trace::Parser &p, trim_segment &segment,
+                   struct trim_options *options)
+{
+    trace::Writer writer;
+    if (!writer.open(segment.filename.c_str())) {
+        return false;
+    }
+
+    p.setBookmark(segment.start);
+
+    unsigned frame = segment.first_frame;
+    trace::Call *call;
+    for (unsigned i = 0; i < segment.num_calls && (call = p.parse_call()); ++i) {
+        if (keep_call(call, frame, options)) {
+            writer.writeCall(call);
+        }
+
+        if (call->flags & trace::CALL_FLAG_END_FRAME) {
+            frame++;
+        }
+
+        delete call;
+    }
+
+    writer.close();
+    return true;
+}
+
+static void
+trim_worker(trim_engine *engine)
+{
+    trace::Parser parser;
+    if (!parser.open(engine->filename)) {
+        return;
+    }
+    parser.shareSigsFrom(*engine->master);
+
+    os::unique_lock<os::mutex> lock(engine->mutex);
+    while (engine->next_segment < engine->segments.size()) {
+        trim_segment &segment = engine->segments[engine->next_segment++];
+
+        lock.unlock();
+        segment.ok = trim_segment_calls(parser, segment, engine->options);
+        lock.lock();
+    }
+}
+
+/**
+ * Parallel trim engine.
+ *
+ * A sequential SCAN pass first records per-frame bookmarks and
+ * registers every signature definition in the master parser.  The
+ * frame ranges are then trimmed by worker threads, each parsing with
+ * a private parser that shares the master's signature maps and
+ * serializing the kept calls to a per-worker compressed segment.  A
+ * final pass concatenates the segments into the output trace,
+ * renumbering calls and deduplicating inline signature definitions by
+ * re-serializing them, which only costs in proportion to the trimmed
+ * output rather than the input.
+ *
+ * Only usable without dependency analysis (which needs to see every
+ * call, in order, in one pass) and without --print-callset (original
+ * call numbers do not survive the segment round trip).
+ */
+static int
+trim_trace_parallel(const char *filename, struct trim_options *options)
+{
+    trim_engine engine;
+    engine.filename = filename;
+    engine.options = options;
+    engine.next_segment = 0;
+
+    trace::Parser p;
+    if (!p.open(filename)) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        return 1;
+    }
+
+    if (!p.supportsOffsets()) {
+        /* The container cannot seek, so the workers could not reach
+         * their frame ranges. */
+        p.close();
+        return trim_trace(filename, options);
+    }
+
+    engine.master = &p;
+
+    /* Scan the trace, recording frame boundaries.  The scan stops
+     * where the sequential passes would, so work past the last
+     * requested call or frame is never assigned to a worker. */
+    std::vector<trace::ParseBookmark> frame_starts;
+    std::vector<unsigned> frame_num_calls;
+    {
+        trace::ParseBookmark start;
+        unsigned num_calls = 0;
+        unsigned frame = 0;
+
+        p.getBookmark(start);
+
+        trace::Call *call;
+        while ((call = p.scan_call())) {
+            if (call->no > options->calls.getLast() ||
+                frame > options->frames.getLast()) {
+                delete call;
+                break;
+            }
+
+            ++num_calls;
+            bool end_frame = (call->flags & trace::CALL_FLAG_END_FRAME) != 0;
+            delete call;
+
+            if (end_frame) {
+                frame_starts.push_back(start);
+                frame_num_calls.push_back(num_calls);
+
+                p.getBookmark(start);
+                num_calls = 0;
+                frame++;
+            }
+        }
+
+        if (num_calls) {
+            /* trailing calls without a frame marker */
+            frame_starts.push_back(start);
+            frame_num_calls.push_back(num_calls);
+        }
+    }
+
+    size_t num_frames = frame_starts.size();
+    unsigned long long total_calls = 0;
+    for (size_t i = 0; i < num_frames; ++i) {
+        total_calls += frame_num_calls[i];
+    }
+
+    if (num_frames < 2) {
+        /* not worth threading; rewind and trim sequentially */
+        p.close();
+        return trim_trace(filename, options);
+    }
+
+    /* Group the frames into segments of roughly equal call counts,
+     * several per worker so a single expensive range cannot leave the
+     * other workers idle. */
+    size_t num_segments = (size_t) options->threads * 4;
+    if (num_segments > num_frames) {
+        num_segments = num_frames;
+    }
+    unsigned long long calls_per_segment = total_calls / num_segments;
+    if (!calls_per_segment) {
+        calls_per_segment = 1;
+    }
+
+    for (size_t i = 0; i < num_frames; ) {
+        trim_segment segment;
+        segment.start = frame_starts[i];
+        segment.first_frame = i;
+        segment.num_calls = 0;
+        segment.ok = false;
+
+        while (i < num_frames &&
+               (segment.num_calls == 0 ||
+                segment.num_calls + frame_num_calls[i] <= calls_per_segment)) {
+            segment.num_calls += frame_num_calls[i];
+            ++i;
+        }
+
+        std::stringstream ss;
+        ss << options->output << ".part" << engine.segments.size();
+        segment.filename = ss.str();
+
+        engine.segments.push_back(segment);
+    }
+
+    /* Trim the segments on worker threads. */
+    std::vector<os::thread> threads;
+    for (unsigned i = 0; i < options->threads && i < engine.segments.size(); ++i) {
+        threads.push_back(os::thread(trim_worker, &engine));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    p.close();
+
+    /* Concatenate the segments into the output. */
+    int ret = 0;
+    trace::Writer writer;
+    if (!writer.open(options->output.c_str())) {
+        std::cerr << "error: failed to create " << options->output << "\n";
+        ret = 1;
+    }
+
+    for (size_t i = 0; i < engine.segments.size(); ++i) {
+        trim_segment &segment = engine.segments[i];
+
+        if (ret == 0 && !segment.ok) {
+            std::cerr << "error: failed to trim calls "
+                      << "(around frame " << segment.first_frame << ")\n";
+            ret = 1;
+        }
+
+        if (ret == 0) {
+            trace::Parser sp;
+            if (sp.open(segment.filename.c_str())) {
+                trace::Call *call;
+                while ((call = sp.parse_call())) {
+                    writer.writeCall(call);
+                    delete call;
+                }
+                sp.close();
+            } else {
+                std::cerr << "error: failed to open " << segment.filename << "\n";
+                ret = 1;
+            }
+        }
+
+        os::removeFile(segment.filename.c_str());
+    }
+
+    writer.close();
+
+    if (ret == 0) {
+        std::cerr << "Trimmed trace is available as " << options->output << "\n";
+    } else {
+        os::removeFile(options->output.c_str());
+    }
+
+    return ret;
+}
+
 static int
 command(int argc, char *argv[])
 {
@@ -297,9 +963,11 @@ command(int argc, char *argv[])
     options.frames = trace::CallSet(trace::FREQUENCY_NONE);
     options.dependency_analysis = false;
     options.prune_uninteresting = false;
+    options.prune_state = false;
     options.output = "";
     options.thread = -1;
     options.print_callset = 0;
+    options.threads = 1;
 
     int opt;
     while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
@@ -319,6 +987,9 @@ command(int argc, char *argv[])
         case PRUNE_OPT:
             options.prune_uninteresting = true;
             break;
+        case PRUNE_STATE_OPT:
+            options.prune_state = true;
+            break;
         case 'a':
             options.dependency_analysis = true;
             options.prune_uninteresting = true;
@@ -326,6 +997,12 @@ command(int argc, char *argv[])
         case THREAD_OPT:
             options.thread = atoi(optarg);
             break;
+        case THREADS_OPT:
+            options.threads = atoi(optarg);
+            if (options.threads < 1) {
+                options.threads = 1;
+            }
+            break;
         case 'o':
             options.output = optarg;
             break;
@@ -369,6 +1046,26 @@ command(int argc, char *argv[])
             "      by sending email to apitrace@lists.freedesktop.org, cworth@cworth.org\n";
     }
 
+    /* Prepare the output file name; the parallel engine also derives
+     * its temporary segment names from it. */
+    if (options.output.empty()) {
+        os::String base(argv[optind]);
+        base.trimExtension();
+
+        options.output = std::string(base.str()) + std::string("-trim.trace");
+    }
+
+    if (options.threads > 1) {
+        if (options.dependency_analysis || options.print_callset ||
+            options.prune_state) {
+            std::cerr <<
+                "Note: --deps, --prune-state and --print-callset process the trace\n"
+                "      sequentially; ignoring --threads.\n";
+        } else {
+            return trim_trace_parallel(argv[optind], &options);
+        }
+    }
+
     return trim_trace(argv[optind], &options);
 }
 
@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <ostream>
 #include <string>
@@ -44,6 +45,15 @@ class PickleWriter
 private:
     std::ostream &os;
 
+    /*
+     * Staging buffer.  Pushing every byte through std::ostream::put
+     * dominates the cost of pickling large traces; stage everything
+     * here and hand it to the stream in big writes instead.
+     */
+    enum { BUFFER_SIZE = 64 * 1024 };
+    char buffer[BUFFER_SIZE];
+    size_t buffered;
+
     /*
      * Python pickle opcodes.  See pickle.py and pickletools.py from Python
      * standard library for details.
@@ -107,22 +117,34 @@ private:
 
 public:
     PickleWriter(std::ostream &_os) :
-        os(_os) {
+        os(_os),
+        buffered(0) {
+    }
+
+    ~PickleWriter() {
+        flush();
+    }
+
+    inline void flush(void) {
+        if (buffered) {
+            os.write(buffer, buffered);
+            buffered = 0;
+        }
     }
 
     inline void begin() {
-        os.put(PROTO);
-        os.put(2);
+        putByte(PROTO);
+        putByte(2);
     }
 
     inline void end() {
-        os.put(STOP);
+        putByte(STOP);
     }
 
     inline void beginDict() {
-        os.put(EMPTY_DICT);
-        os.put(BINPUT);
-        os.put(1);
+        putByte(EMPTY_DICT);
+        putByte(BINPUT);
+        putByte(1);
     }
 
     inline void endDict() {
@@ -140,26 +162,26 @@ public:
     }
 
     inline void endItem(void) {
-        os.put(SETITEM);
+        putByte(SETITEM);
     }
 
     inline void beginList() {
-        os.put(EMPTY_LIST);
-        os.put(BINPUT);
-        os.put(1);
-        os.put(MARK);
+        putByte(EMPTY_LIST);
+        putByte(BINPUT);
+        putByte(1);
+        putByte(MARK);
     }
 
     inline void endList(void) {
-        os.put(APPENDS);
+        putByte(APPENDS);
     }
 
     inline void beginTuple() {
-        os.put(MARK);
+        putByte(MARK);
     }
 
     inline void endTuple(void) {
-        os.put(TUPLE);
+        putByte(TUPLE);
     }
 
     inline void writeString(const char *s, size_t length) {
@@ -169,16 +191,16 @@ public:
         }
 
         if (length < 256) {
-            os.put(SHORT_BINSTRING);
-            os.put(length);
+            putByte(SHORT_BINSTRING);
+            putByte(length);
         } else {
-            os.put(BINSTRING);
+            putByte(BINSTRING);
             putInt32(length);
         }
-        os.write(s, length);
+        putBytes(s, length);
 
-        os.put(BINPUT);
-        os.put(1);
+        putByte(BINPUT);
+        putByte(1);
     }
 
     inline void writeString(const char *s) {
@@ -195,23 +217,23 @@ public:
     }
 
     inline void writeNone(void) {
-        os.put(NONE);
+        putByte(NONE);
     }
 
     inline void writeBool(bool b) {
-        os.put(b ? NEWTRUE : NEWFALSE);
+        putByte(b ? NEWTRUE : NEWFALSE);
     }
 
     inline void writeInt(uint8_t i) {
-        os.put(BININT1);
-        os.put(i);
+        putByte(BININT1);
+        putByte(i);
     }
 
     inline void writeInt(uint16_t i) {
         if (i < 0x100) {
             writeInt((uint8_t)i);
         } else {
-            os.put(BININT2);
+            putByte(BININT2);
             putInt16(i);
         }
     }
@@ -220,7 +242,7 @@ public:
         if (0 <= i && i < 0x10000) {
             writeInt((uint16_t)i);
         } else {
-            os.put(BININT);
+            putByte(BININT);
             putInt32(i);
         }
     }
@@ -258,46 +280,179 @@ public:
         assert(sizeof u.f == sizeof u.c);
         u.f = f;
 
-        os.put(BINFLOAT);
-        os.put(u.c[7]);
-        os.put(u.c[6]);
-        os.put(u.c[5]);
-        os.put(u.c[4]);
-        os.put(u.c[3]);
-        os.put(u.c[2]);
-        os.put(u.c[1]);
-        os.put(u.c[0]);
+        putByte(BINFLOAT);
+        putByte(u.c[7]);
+        putByte(u.c[6]);
+        putByte(u.c[5]);
+        putByte(u.c[4]);
+        putByte(u.c[3]);
+        putByte(u.c[2]);
+        putByte(u.c[1]);
+        putByte(u.c[0]);
     }
 
     inline void writeByteArray(const void *buf, size_t length) {
-        os.put(GLOBAL);
-        os << "__builtin__\nbytearray\n";
-        os.put(BINPUT);
-        os.put(1);
+        putByte(GLOBAL);
+        putBytes("__builtin__\nbytearray\n", sizeof "__builtin__\nbytearray\n" - 1);
+        putByte(BINPUT);
+        putByte(1);
         writeString(static_cast<const char *>(buf), length);
-        os.put(TUPLE1);
-        os.put(REDUCE);
+        putByte(TUPLE1);
+        putByte(REDUCE);
+    }
+
+    /*
+     * Chunked variant of writeByteArray(), for blobs too large to
+     * materialize: declare the total length up front, then feed the
+     * bytes in as many pieces as convenient.  The caller must supply
+     * exactly length bytes of chunks for the pickle to stay
+     * well-formed.
+     */
+    inline void beginByteArray(size_t length) {
+        putByte(GLOBAL);
+        putBytes("__builtin__\nbytearray\n", sizeof "__builtin__\nbytearray\n" - 1);
+        putByte(BINPUT);
+        putByte(1);
+        if (length < 256) {
+            putByte(SHORT_BINSTRING);
+            putByte(length);
+        } else {
+            putByte(BINSTRING);
+            putInt32(length);
+        }
+    }
+
+    inline void writeByteArrayChunk(const void *buf, size_t length) {
+        putBytes(static_cast<const char *>(buf), length);
+    }
+
+    inline void endByteArray(void) {
+        putByte(BINPUT);
+        putByte(1);
+        putByte(TUPLE1);
+        putByte(REDUCE);
+    }
+
+    /*
+     * Bulk paths for homogeneous lists of scalars, equivalent to
+     * beginList()/write*()/endList() but with a single buffer
+     * reservation per batch instead of a bounds check per byte.
+     */
+
+    inline void writeFloatArray(const double *values, size_t count) {
+        beginList();
+        while (count) {
+            // BINFLOAT is a fixed 9 bytes
+            size_t batch = (BUFFER_SIZE - buffered) / 9;
+            if (!batch) {
+                flush();
+                continue;
+            }
+            if (batch > count) {
+                batch = count;
+            }
+            char *p = buffer + buffered;
+            for (size_t i = 0; i < batch; ++i) {
+                union {
+                    double f;
+                    char c[8];
+                } u;
+                u.f = values[i];
+                *p++ = BINFLOAT;
+                *p++ = u.c[7];
+                *p++ = u.c[6];
+                *p++ = u.c[5];
+                *p++ = u.c[4];
+                *p++ = u.c[3];
+                *p++ = u.c[2];
+                *p++ = u.c[1];
+                *p++ = u.c[0];
+            }
+            buffered = p - buffer;
+            values += batch;
+            count -= batch;
+        }
+        endList();
+    }
+
+    inline void writeIntArray(const long long *values, size_t count) {
+        beginList();
+        for (size_t i = 0; i < count; ++i) {
+            long long l = values[i];
+            if (-0x8000000 <= l && l < 0x8000000) {
+                // worst case: BININT opcode plus 4 bytes
+                char *p = reserve(5);
+                if (0 <= l && l < 0x100) {
+                    *p++ = BININT1;
+                    *p++ = l;
+                } else if (0 <= l && l < 0x10000) {
+                    *p++ = BININT2;
+                    *p++ =  l       & 0xff;
+                    *p++ =  l >> 8;
+                } else {
+                    *p++ = BININT;
+                    *p++ =  l        & 0xff;
+                    *p++ = (l >>  8) & 0xff;
+                    *p++ = (l >> 16) & 0xff;
+                    *p++ =  l >> 24;
+                }
+                buffered = p - buffer;
+            } else {
+                writeLong(l);
+            }
+        }
+        endList();
     }
 
 protected:
+    inline void putByte(char c) {
+        if (buffered == BUFFER_SIZE) {
+            flush();
+        }
+        buffer[buffered++] = c;
+    }
+
+    inline void putBytes(const char *p, size_t length) {
+        if (length >= BUFFER_SIZE) {
+            flush();
+            os.write(p, length);
+            return;
+        }
+        if (buffered + length > BUFFER_SIZE) {
+            flush();
+        }
+        memcpy(buffer + buffered, p, length);
+        buffered += length;
+    }
+
+    /* Make room for at least size bytes and return the write position;
+     * the caller advances buffered itself. */
+    inline char *reserve(size_t size) {
+        assert(size <= BUFFER_SIZE);
+        if (buffered + size > BUFFER_SIZE) {
+            flush();
+        }
+        return buffer + buffered;
+    }
+
     inline void putInt16(uint16_t i) {
-        os.put( i        & 0xff);
-        os.put( i >>  8        );
+        putByte( i        & 0xff);
+        putByte( i >>  8        );
     }
 
     inline void putInt32(uint32_t i) {
-        os.put( i        & 0xff);
-        os.put((i >>  8) & 0xff);
-        os.put((i >> 16) & 0xff);
-        os.put( i >> 24        );
+        putByte( i        & 0xff);
+        putByte((i >>  8) & 0xff);
+        putByte((i >> 16) & 0xff);
+        putByte( i >> 24        );
     }
 
     template< class T >
     inline void writeLong(T l) {
-        os.put(LONG1);
+        putByte(LONG1);
 
         if (l == 0) {
-            os.put(0);
+            putByte(0);
             return;
         }
 
@@ -319,10 +474,10 @@ protected:
         if (((l >> (8 * c - 1)) & 1) != ((l >> (8 * sizeof l - 1)) & 1)) {
             ++c;
         }
-        os.put(c);
+        putByte(c);
 
         for (unsigned i = 0; i < c; ++ i) {
-            os.put(l & 0xff);
+            putByte(l & 0xff);
             l >>= 8;
         }
     }
@@ -207,6 +207,29 @@ TraceAnalyzer::stateTrackPreCall(trace::Call *call)
         activeProgram = call->arg(0).toUInt();
     }
 
+    if (strcmp(name, "glBindBuffer") == 0 ||
+        strcmp(name, "glBindBufferARB") == 0) {
+        GLenum target;
+        GLuint buffer;
+
+        target = static_cast<GLenum>(call->arg(0).toSInt());
+        buffer = call->arg(1).toUInt();
+
+        if (buffer == 0) {
+            buffer_map.erase(target);
+        } else {
+            buffer_map[target] = buffer;
+        }
+
+        return;
+    }
+
+    if (strcmp(name, "glBindRenderbuffer") == 0 ||
+        strcmp(name, "glBindRenderbufferEXT") == 0) {
+        boundRenderbuffer = call->arg(1).toUInt();
+        return;
+    }
+
     if (strcmp(name, "glBindFramebuffer") == 0) {
         GLenum target;
         GLuint framebuffer;
@@ -398,6 +421,245 @@ TraceAnalyzer::recordSideEffects(trace::Call *call)
             }
         }
 
+        /* If a pixel unpack buffer is bound, the texture data comes
+         * from it, so the texture also depends on the calls that
+         * built that buffer. */
+        if (buffer_map.count(GL_PIXEL_UNPACK_BUFFER)) {
+            std::stringstream ss_buffer;
+            std::set<unsigned> buffer_calls;
+
+            ss_buffer << "buffer-" << buffer_map[GL_PIXEL_UNPACK_BUFFER];
+
+            buffer_calls = resolve(ss_buffer.str());
+            for (c = buffer_calls.begin(); c != buffer_calls.end(); c++) {
+                provide(ss_texture.str(), *c);
+            }
+        }
+
+        return;
+    }
+
+    if (strcmp(name, "glDeleteTextures") == 0) {
+        const trace::Array *textures = dynamic_cast<const trace::Array *>(&call->arg(1));
+        size_t i;
+        GLuint texture;
+
+        if (textures) {
+            for (i = 0; i < textures->size(); i++) {
+                std::stringstream ss;
+
+                texture = textures->values[i]->toUInt();
+                ss << "texture-" << texture;
+
+                resources.erase(ss.str());
+                unlinkAll(ss.str());
+            }
+        }
+        return;
+    }
+
+    if (strcmp(name, "glGenBuffers") == 0 ||
+        strcmp(name, "glGenBuffersARB") == 0) {
+        const trace::Array *buffers = dynamic_cast<const trace::Array *>(&call->arg(1));
+        size_t i;
+        GLuint buffer;
+
+        if (buffers) {
+            for (i = 0; i < buffers->size(); i++) {
+                std::stringstream ss_buffer, ss_name;
+
+                buffer = buffers->values[i]->toUInt();
+                ss_buffer << "buffer-" << buffer;
+                ss_name << "buffer-name-" << buffer;
+
+                /* The name allocation is kept as a separate resource
+                 * linked from the buffer, so that a full
+                 * respecification of the buffer's contents does not
+                 * discard it. */
+                provide(ss_name.str(), call->no);
+                link(ss_buffer.str(), ss_name.str());
+            }
+        }
+        return;
+    }
+
+    if (strcmp(name, "glBindBuffer") == 0 ||
+        strcmp(name, "glBindBufferARB") == 0) {
+        GLenum target;
+        GLuint buffer;
+
+        std::stringstream ss_target, ss_buffer;
+
+        target = static_cast<GLenum>(call->arg(0).toSInt());
+        buffer = call->arg(1).toUInt();
+
+        ss_target << "buffer-target-" << target;
+        ss_buffer << "buffer-" << buffer;
+
+        resources.erase(ss_target.str());
+        provide(ss_target.str(), call->no);
+
+        unlinkAll(ss_target.str());
+
+        if (buffer == 0) {
+            unlink("render-state", ss_target.str());
+        } else {
+            link(ss_target.str(), ss_buffer.str());
+            link("render-state", ss_target.str());
+        }
+
+        /* Like glBindTexture above: be conservative and never trim
+         * the bind itself, (the bind also affects subsequent data
+         * uploads and draws that we may not track precisely). */
+        provide("state", call->no);
+
+        return;
+    }
+
+    if (STRNCMP_LITERAL(name, "glBufferData") == 0) {
+        GLenum target = static_cast<GLenum>(call->arg(0).toSInt());
+
+        if (buffer_map.count(target)) {
+            std::stringstream ss;
+            ss << "buffer-" << buffer_map[target];
+
+            /* A full respecification; anything the buffer held
+             * before is irrelevant now. */
+            resources.erase(ss.str());
+            provide(ss.str(), call->no);
+            return;
+        }
+    }
+
+    if (STRNCMP_LITERAL(name, "glBufferSubData") == 0 ||
+        strcmp(name, "glCopyBufferSubData") == 0) {
+        GLenum target = static_cast<GLenum>(call->arg(0).toSInt());
+
+        if (buffer_map.count(target)) {
+            providef("buffer-", buffer_map[target], call->no);
+            return;
+        }
+    }
+
+    if (strcmp(name, "glDeleteBuffers") == 0 ||
+        strcmp(name, "glDeleteBuffersARB") == 0) {
+        const trace::Array *buffers = dynamic_cast<const trace::Array *>(&call->arg(1));
+        size_t i;
+        GLuint buffer;
+
+        if (buffers) {
+            for (i = 0; i < buffers->size(); i++) {
+                std::stringstream ss, ss_name;
+
+                buffer = buffers->values[i]->toUInt();
+                ss << "buffer-" << buffer;
+                ss_name << "buffer-name-" << buffer;
+
+                resources.erase(ss.str());
+                resources.erase(ss_name.str());
+                unlinkAll(ss.str());
+            }
+        }
+        return;
+    }
+
+    /* Vertex array and attribute pointers: each specification
+     * supersedes the previous one for the same array, and pulls in
+     * the buffer currently bound to GL_ARRAY_BUFFER, (when sourcing
+     * from client memory the data is embedded in the call itself). */
+    if (STRNCMP_LITERAL(name, "glVertexAttribPointer") == 0 ||
+        strcmp(name, "glVertexPointer") == 0 ||
+        strcmp(name, "glNormalPointer") == 0 ||
+        strcmp(name, "glColorPointer") == 0 ||
+        strcmp(name, "glSecondaryColorPointer") == 0 ||
+        strcmp(name, "glTexCoordPointer") == 0 ||
+        strcmp(name, "glFogCoordPointer") == 0 ||
+        strcmp(name, "glEdgeFlagPointer") == 0 ||
+        strcmp(name, "glIndexPointer") == 0 ||
+        strcmp(name, "glInterleavedArrays") == 0) {
+
+        std::stringstream ss;
+
+        if (STRNCMP_LITERAL(name, "glVertexAttribPointer") == 0) {
+            ss << "vertex-attrib-" << call->arg(0).toUInt();
+        } else {
+            ss << "vertex-pointer-" << name;
+        }
+
+        resources.erase(ss.str());
+        provide(ss.str(), call->no);
+
+        unlinkAll(ss.str());
+
+        if (buffer_map.count(GL_ARRAY_BUFFER)) {
+            linkf(ss.str(), "buffer-", buffer_map[GL_ARRAY_BUFFER]);
+        }
+
+        /* We don't track which arrays are enabled at draw time, so
+         * conservatively make every draw depend on the latest
+         * specification of each array. */
+        link("render-state", ss.str());
+
+        return;
+    }
+
+    if (strcmp(name, "glGenRenderbuffers") == 0 ||
+        strcmp(name, "glGenRenderbuffersEXT") == 0) {
+        const trace::Array *renderbuffers = dynamic_cast<const trace::Array *>(&call->arg(1));
+        size_t i;
+        GLuint renderbuffer;
+
+        if (renderbuffers) {
+            for (i = 0; i < renderbuffers->size(); i++) {
+                renderbuffer = renderbuffers->values[i]->toUInt();
+                providef("renderbuffer-", renderbuffer, call->no);
+            }
+        }
+        return;
+    }
+
+    if (strcmp(name, "glBindRenderbuffer") == 0 ||
+        strcmp(name, "glBindRenderbufferEXT") == 0 ||
+        STRNCMP_LITERAL(name, "glRenderbufferStorage") == 0) {
+
+        /* The bind is part of the renderbuffer's build recipe, as
+         * the storage calls only operate on the bound renderbuffer. */
+        if (boundRenderbuffer) {
+            providef("renderbuffer-", boundRenderbuffer, call->no);
+        }
+        return;
+    }
+
+    /* FIXME: As with glFramebufferTexture2D above, link the FBO
+     * itself once framebuffer objects are tracked as resources. */
+    if (strcmp(name, "glFramebufferRenderbuffer") == 0 ||
+        strcmp(name, "glFramebufferRenderbufferEXT") == 0) {
+        GLuint renderbuffer;
+
+        renderbuffer = call->arg(3).toUInt();
+
+        linkf("render-state", "renderbuffer-", renderbuffer);
+
+        required.insert(call->no);
+    }
+
+    if (strcmp(name, "glDeleteRenderbuffers") == 0 ||
+        strcmp(name, "glDeleteRenderbuffersEXT") == 0) {
+        const trace::Array *renderbuffers = dynamic_cast<const trace::Array *>(&call->arg(1));
+        size_t i;
+        GLuint renderbuffer;
+
+        if (renderbuffers) {
+            for (i = 0; i < renderbuffers->size(); i++) {
+                std::stringstream ss;
+
+                renderbuffer = renderbuffers->values[i]->toUInt();
+                ss << "renderbuffer-" << renderbuffer;
+
+                resources.erase(ss.str());
+                unlinkAll(ss.str());
+            }
+        }
         return;
     }
 
@@ -664,7 +926,9 @@ TraceAnalyzer::TraceAnalyzer(): transformFeedbackActive(false),
                                framebufferObjectActive(false),
                                insideBeginEnd(false),
                                insideNewEndList(0),
-                               activeTextureUnit(GL_TEXTURE0)
+                               activeTextureUnit(GL_TEXTURE0),
+                               activeProgram(0),
+                               boundRenderbuffer(0)
 {
     /* Nothing needed. */
 }
@@ -37,6 +37,7 @@ private:
     std::map<std::string, std::set<std::string> > dependencies;
 
     std::map<GLenum, unsigned> texture_map;
+    std::map<GLenum, unsigned> buffer_map;
 
     std::set<unsigned> required;
 
@@ -46,6 +47,7 @@ private:
     GLuint insideNewEndList;
     GLenum activeTextureUnit;
     GLuint activeProgram;
+    GLuint boundRenderbuffer;
 
     void provide(std::string resource, trace::CallNo call_no);
     void providef(std::string resource, int resource_no, trace::CallNo call_no);
@@ -0,0 +1,213 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <math.h>
+#include <string.h>
+
+#include "md5.hpp"
+
+
+namespace md5 {
+
+
+/* Per-step left-rotation amounts (RFC 1321 section 3.4). */
+static const unsigned char S[64] = {
+    7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
+    5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
+    4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
+    6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21
+};
+
+/* Sine-derived additive constants, computed on first use instead of
+ * transcribing the 64-entry table.  Concurrent first uses recompute
+ * the same values, so the lazy init is benign without locking. */
+static uint32_t K[64];
+static bool K_ready = false;
+
+static void
+computeK(void)
+{
+    for (unsigned i = 0; i < 64; ++i) {
+        K[i] = (uint32_t)(fabs(sin((double)(i + 1))) * 4294967296.0);
+    }
+    K_ready = true;
+}
+
+static inline uint32_t
+rotl(uint32_t x, unsigned n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t
+getU32le(const unsigned char *p)
+{
+    return (uint32_t)p[0] |
+           ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static inline void
+putU32le(unsigned char *p, uint32_t x)
+{
+    p[0] = x & 0xff;
+    p[1] = (x >> 8) & 0xff;
+    p[2] = (x >> 16) & 0xff;
+    p[3] = (x >> 24) & 0xff;
+}
+
+static void
+transform(uint32_t state[4], const unsigned char block[64])
+{
+    uint32_t x[16];
+    for (unsigned i = 0; i < 16; ++i) {
+        x[i] = getU32le(block + i*4);
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    for (unsigned i = 0; i < 64; ++i) {
+        uint32_t f;
+        unsigned g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5*i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3*i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7*i) & 15;
+        }
+
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        b += rotl(a + f + K[i] + x[g], S[i]);
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void
+init(Context &ctx)
+{
+    if (!K_ready) {
+        computeK();
+    }
+
+    ctx.state[0] = 0x67452301;
+    ctx.state[1] = 0xefcdab89;
+    ctx.state[2] = 0x98badcfe;
+    ctx.state[3] = 0x10325476;
+    ctx.count = 0;
+}
+
+void
+update(Context &ctx, const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t buffered = (size_t)(ctx.count & 63);
+    ctx.count += length;
+
+    if (buffered) {
+        size_t fill = 64 - buffered;
+        if (length < fill) {
+            memcpy(ctx.buffer + buffered, p, length);
+            return;
+        }
+        memcpy(ctx.buffer + buffered, p, fill);
+        transform(ctx.state, ctx.buffer);
+        p += fill;
+        length -= fill;
+    }
+
+    while (length >= 64) {
+        transform(ctx.state, p);
+        p += 64;
+        length -= 64;
+    }
+
+    if (length) {
+        memcpy(ctx.buffer, p, length);
+    }
+}
+
+void
+final(Context &ctx, unsigned char digest[DIGEST_SIZE])
+{
+    static const unsigned char padding[64] = { 0x80 };
+
+    unsigned char lengthBits[8];
+    uint64_t bits = ctx.count << 3;
+    putU32le(lengthBits, (uint32_t)bits);
+    putU32le(lengthBits + 4, (uint32_t)(bits >> 32));
+
+    size_t buffered = (size_t)(ctx.count & 63);
+    size_t padLength = (buffered < 56) ? 56 - buffered : 120 - buffered;
+    update(ctx, padding, padLength);
+    update(ctx, lengthBits, 8);
+
+    for (unsigned i = 0; i < 4; ++i) {
+        putU32le(digest + i*4, ctx.state[i]);
+    }
+}
+
+void
+hash(const void *data, size_t length, unsigned char digest[DIGEST_SIZE])
+{
+    Context ctx;
+    init(ctx);
+    update(ctx, data, length);
+    final(ctx, digest);
+}
+
+std::string
+hex(const unsigned char digest[DIGEST_SIZE])
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(2*DIGEST_SIZE);
+    for (unsigned i = 0; i < DIGEST_SIZE; ++i) {
+        result += digits[digest[i] >> 4];
+        result += digits[digest[i] & 15];
+    }
+    return result;
+}
+
+
+} /* namespace md5 */
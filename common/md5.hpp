@@ -0,0 +1,72 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * MD5 message digest (RFC 1321).
+ *
+ * Used for content addressing, where a digest wide enough to make
+ * accidental collisions negligible is needed; not for anything
+ * adversarial.
+ */
+
+#ifndef _MD5_HPP_
+#define _MD5_HPP_
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+
+namespace md5 {
+
+
+enum {
+    DIGEST_SIZE = 16
+};
+
+struct Context {
+    uint32_t state[4];
+    uint64_t count;             /* bytes processed so far */
+    unsigned char buffer[64];
+};
+
+void init(Context &ctx);
+
+void update(Context &ctx, const void *data, size_t length);
+
+void final(Context &ctx, unsigned char digest[DIGEST_SIZE]);
+
+/* One-shot convenience wrapper. */
+void hash(const void *data, size_t length, unsigned char digest[DIGEST_SIZE]);
+
+std::string hex(const unsigned char digest[DIGEST_SIZE]);
+
+
+} /* namespace md5 */
+
+
+#endif /* _MD5_HPP_ */
@@ -78,6 +78,31 @@ void abort(void);
 void setExceptionCallback(void (*callback)(void));
 void resetExceptionCallback(void);
 
+/**
+ * Anonymous memory for large long-lived buffers (chunk caches, value
+ * arenas), backed by 2 MiB huge pages when the system can provide
+ * them and by normal pages otherwise.  Huge-page backing cuts the TLB
+ * pressure of walking multi-gigabyte traces; the fallback is
+ * transparent, so callers need not care which backing they got.
+ *
+ * Returns NULL only when out of memory.  freeHugePages must be passed
+ * the same size that was requested from allocHugePages.
+ */
+void *allocHugePages(size_t size);
+void freeHugePages(void *ptr, size_t size);
+
+/**
+ * Page-cache advice, in both directions.  adviseWillNeed asks the
+ * kernel to start reading the given mapped range in the background,
+ * ahead of the first access; adviseDropBehind flushes a just-written
+ * file and tells the kernel its pages will not be read back, so bulk
+ * output (snapshot images, repacked traces) does not evict the trace
+ * being replayed from the cache.  Both are best-effort hints and
+ * no-ops on platforms without an equivalent.
+ */
+void adviseWillNeed(const void *ptr, size_t length);
+void adviseDropBehind(FILE *fp);
+
 } /* namespace os */
 
 #endif /* _OS_HPP_ */
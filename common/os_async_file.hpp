@@ -0,0 +1,189 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Asynchronous whole-file writes.
+ *
+ * A small pool of I/O threads performs the open/write/close of
+ * fire-and-forget output files, so producers (e.g. the snapshot encoder
+ * pool) are not stalled by per-file filesystem latency -- on network
+ * filesystems the open and close round-trips easily dominate the data
+ * transfer itself.  The queue is bounded by payload bytes, since every
+ * queued file is held in memory until it has been written.
+ */
+
+#ifndef _OS_ASYNC_FILE_HPP_
+#define _OS_ASYNC_FILE_HPP_
+
+
+#include <stdio.h>
+
+#include <deque>
+#include <string>
+
+#include "os.hpp"
+#include "os_thread.hpp"
+
+
+namespace os {
+
+
+class async_file_writer
+{
+public:
+    /* Runs on an I/O thread once the file has been closed (or failed). */
+    typedef void (*completion)(const char *filename, bool ok, void *arg);
+
+private:
+    enum {
+        NUM_THREADS = 2,
+        MAX_PENDING_BYTES = 64 * 1024 * 1024
+    };
+
+    struct Job {
+        std::string filename;
+        std::string data;
+        completion done;
+        void *arg;
+    };
+
+    mutex m;
+    condition_variable notEmpty;
+    condition_variable notFull;
+
+    /* These are protected by the mutex. */
+    std::deque<Job *> queue;
+    size_t pendingBytes;
+    bool finishing;
+
+    thread threads[NUM_THREADS];
+
+    static void *
+    ioThread(async_file_writer *_this) {
+        _this->work();
+        return 0;
+    }
+
+    void
+    work(void) {
+        while (1) {
+            Job *job;
+            {
+                unique_lock<mutex> lock(m);
+                while (queue.empty() && !finishing) {
+                    notEmpty.wait(lock);
+                }
+                if (queue.empty()) {
+                    /* The condition variable has no broadcast, so pass
+                     * the wake-up on to the next idle thread. */
+                    notEmpty.signal();
+                    return;
+                }
+                job = queue.front();
+                queue.pop_front();
+                pendingBytes -= job->data.size();
+            }
+            notFull.signal();
+
+            bool ok = writeFile(job->filename.c_str(),
+                                job->data.data(), job->data.size());
+            if (job->done) {
+                job->done(job->filename.c_str(), ok, job->arg);
+            }
+            delete job;
+        }
+    }
+
+    static bool
+    writeFile(const char *filename, const char *data, size_t size) {
+        FILE *fp = fopen(filename, "wb");
+        if (!fp) {
+            return false;
+        }
+        bool ok = fwrite(data, 1, size, fp) == size;
+        /* Fire-and-forget output; keep it from evicting the trace
+         * being read from the page cache. */
+        adviseDropBehind(fp);
+        if (fclose(fp) != 0) {
+            ok = false;
+        }
+        return ok;
+    }
+
+public:
+    async_file_writer() :
+        pendingBytes(0),
+        finishing(false)
+    {
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i] = thread(ioThread, this);
+        }
+    }
+
+    /**
+     * Waits for every queued file to be written out.
+     */
+    ~async_file_writer() {
+        m.lock();
+        finishing = true;
+        m.unlock();
+        notEmpty.signal();
+
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i].join();
+        }
+    }
+
+    /**
+     * Queue the contents for writing.  The data is swapped out of the
+     * caller's string rather than copied; the completion callback, if
+     * any, runs on an I/O thread.  Blocks while the queue is over its
+     * byte budget.
+     */
+    void
+    push(const char *filename, std::string &data,
+         completion done = NULL, void *arg = NULL) {
+        Job *job = new Job;
+        job->filename = filename;
+        job->data.swap(data);
+        job->done = done;
+        job->arg = arg;
+        {
+            unique_lock<mutex> lock(m);
+            while (pendingBytes >= MAX_PENDING_BYTES && !queue.empty()) {
+                notFull.wait(lock);
+            }
+            queue.push_back(job);
+            pendingBytes += job->data.size();
+        }
+        notEmpty.signal();
+    }
+};
+
+
+} /* namespace os */
+
+
+#endif /* _OS_ASYNC_FILE_HPP_ */
@@ -0,0 +1,166 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Fixed-footprint latency histogram.
+ */
+
+#ifndef _OS_HISTOGRAM_HPP_
+#define _OS_HISTOGRAM_HPP_
+
+
+#include <string.h>
+#include <stdint.h>
+
+
+namespace os {
+
+
+/**
+ * Latency histogram with power-of-two buckets subdivided eightfold,
+ * covering the full 64-bit range in a fixed 4 KiB footprint.
+ *
+ * Averages hide tail stalls: one 10 ms hiccup per second vanishes in a
+ * mean over a hundred thousand samples but is exactly what makes a
+ * traced application unplayable.  This keeps enough shape to read off
+ * high percentiles, while recording stays a couple of shifts and one
+ * increment -- cheap enough for per-thread instances on hot paths,
+ * merged when they are reported.
+ *
+ * Values are unitless; callers record ticks and scale on output.  The
+ * bucket value returned for a percentile is the bucket's upper edge,
+ * so percentiles are overestimated by at most 1/8th.
+ */
+class LatencyHistogram {
+private:
+    enum {
+        SUB_BITS = 3,
+        SUB = 1 << SUB_BITS,
+        NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB
+    };
+
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+
+    static inline unsigned
+    bucketIndex(uint64_t value) {
+        if (value < SUB) {
+            return (unsigned)value;
+        }
+        unsigned msb = SUB_BITS;
+        while (msb < 63 && (value >> (msb + 1))) {
+            ++msb;
+        }
+        unsigned shift = msb - SUB_BITS;
+        return ((msb - SUB_BITS + 1) << SUB_BITS) |
+               (unsigned)((value >> shift) & (SUB - 1));
+    }
+
+    /* Upper edge of the bucket's value range. */
+    static inline uint64_t
+    bucketValue(unsigned index) {
+        if (index < SUB) {
+            return index;
+        }
+        unsigned shift = (index >> SUB_BITS) - 1;
+        uint64_t sub = index & (SUB - 1);
+        return ((SUB + sub + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    void
+    reset(void) {
+        memset(counts, 0, sizeof counts);
+        total = 0;
+        max = 0;
+    }
+
+    inline void
+    record(uint64_t value) {
+        ++counts[bucketIndex(value)];
+        ++total;
+        if (value > max) {
+            max = value;
+        }
+    }
+
+    void
+    merge(const LatencyHistogram &other) {
+        for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        if (other.max > max) {
+            max = other.max;
+        }
+    }
+
+    uint64_t
+    count(void) const {
+        return total;
+    }
+
+    uint64_t
+    maximum(void) const {
+        return max;
+    }
+
+    /**
+     * Value at or below which the given fraction (0..1) of recorded
+     * samples lie.  The true maximum is returned for the topmost
+     * sample, so percentile(1.0) is exact.
+     */
+    uint64_t
+    percentile(double fraction) const {
+        if (!total) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(fraction * total + 0.5);
+        if (target < 1) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < NUM_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= target) {
+                if (seen >= total) {
+                    return max;
+                }
+                return bucketValue(i);
+            }
+        }
+        return max;
+    }
+};
+
+
+} /* namespace os */
+
+#endif /* _OS_HISTOGRAM_HPP_ */
@@ -24,6 +24,10 @@
  **************************************************************************/
 
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1 // for pthread_setaffinity_np
+#endif
+
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -32,9 +36,15 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <signal.h>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #if defined(__linux__)
 #include <linux/limits.h> // PATH_MAX
 #endif
@@ -55,6 +65,8 @@
 
 #include "os.hpp"
 #include "os_string.hpp"
+#include "os_thread.hpp"
+#include "os_time.hpp"
 
 
 namespace os {
@@ -128,6 +140,12 @@ String::exists(void) const
     return true;
 }
 
+bool
+removeFile(const String &fileName)
+{
+    return unlink(fileName.str()) == 0;
+}
+
 int execute(char * const * args)
 {
     pid_t pid = fork();
@@ -161,6 +179,153 @@ int execute(char * const * args)
     }
 }
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+enum {
+    HUGE_PAGE_SIZE = 2 * 1024 * 1024
+};
+
+void *
+allocHugePages(size_t size)
+{
+    size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    /* Explicitly backed huge pages, when the administrator reserved a
+     * pool (vm.nr_hugepages). */
+    void *ptr = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        return ptr;
+    }
+#endif
+
+    void *ptr2 = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr2 == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    /* Best effort; the region still works on normal pages. */
+    madvise(ptr2, rounded, MADV_HUGEPAGE);
+#endif
+    return ptr2;
+}
+
+void
+freeHugePages(void *ptr, size_t size)
+{
+    if (ptr) {
+        size_t rounded = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        munmap(ptr, rounded);
+    }
+}
+
+void
+adviseWillNeed(const void *ptr, size_t length)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t misalign = (size_t)ptr & (pageSize - 1);
+    /* Best effort; a rejected hint costs nothing. */
+    madvise((char *)ptr - misalign, length + misalign, MADV_WILLNEED);
+}
+
+void
+adviseDropBehind(FILE *fp)
+{
+    fflush(fp);
+    int fd = fileno(fp);
+    if (fd < 0) {
+        return;
+    }
+#ifdef __linux__
+    /* DONTNEED skips dirty pages, so push them to disk first.  This
+     * blocks, but callers run it on I/O threads whose whole point is
+     * absorbing such stalls. */
+    sync_file_range(fd, 0, 0,
+                    SYNC_FILE_RANGE_WAIT_BEFORE |
+                    SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+unsigned
+numaNodeCount(void)
+{
+#if defined(__linux__)
+    unsigned count = 0;
+    for (;;) {
+        char path[64];
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%u", count);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        ++count;
+    }
+    if (count > 1) {
+        return count;
+    }
+#endif
+    return 1;
+}
+
+bool
+pinThreadToNumaNode(unsigned node)
+{
+#if defined(__linux__)
+    char path[64];
+    snprintf(path, sizeof path, "/sys/devices/system/node/node%u/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+
+    char buf[1024];
+    size_t got = fread(buf, 1, sizeof buf - 1, fp);
+    fclose(fp);
+    buf[got] = 0;
+
+    /* The cpulist is a comma-separated list of ranges, e.g. "0-5,12-17". */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    char *p = buf;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, &cpus);
+        }
+        if (*p != ',') {
+            break;
+        }
+        ++p;
+    }
+
+    if (!CPU_COUNT(&cpus)) {
+        return false;
+    }
+
+    return pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
 static volatile bool logging = false;
 
 void
@@ -183,6 +348,30 @@ log(const char *format, ...)
 long long timeFrequency = 0LL;
 #endif
 
+long long fastTimeFrequency = 0LL;
+
+long long
+calibrateFastTime(void)
+{
+    if (!fastTimeFrequency) {
+        /* A short interval is enough; the TSC is constant-rate on any
+         * hardware recent enough to matter. */
+        long long t0 = getTime();
+        long long f0 = getTimeFast();
+        sleep(10 * 1000);
+        long long t1 = getTime();
+        long long f1 = getTimeFast();
+
+        if (t1 > t0) {
+            fastTimeFrequency = (f1 - f0) * timeFrequency / (t1 - t0);
+        } else {
+            fastTimeFrequency = timeFrequency;
+        }
+    }
+
+    return fastTimeFrequency;
+}
+
 void
 abort(void)
 {
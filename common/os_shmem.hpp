@@ -0,0 +1,218 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * OS native named shared memory abstraction.
+ *
+ * A region is created by one process and opened by name from another;
+ * both map the same physical pages.  The creator owns the name and
+ * removes it again on close().  Any synchronization between the two
+ * sides is up to the caller.
+ */
+
+#ifndef _OS_SHMEM_HPP_
+#define _OS_SHMEM_HPP_
+
+
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+namespace os {
+
+
+class shared_memory
+{
+private:
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    char name[256];
+#endif
+    void *ptr;
+    size_t length;
+    bool owner;
+
+    // Not copyable: the mapping is released on destruction.
+    shared_memory(const shared_memory &);
+    shared_memory &operator=(const shared_memory &);
+
+public:
+    shared_memory(void) :
+        ptr(NULL),
+        length(0),
+        owner(false)
+    {
+#ifdef _WIN32
+        handle = NULL;
+#else
+        name[0] = 0;
+#endif
+    }
+
+    ~shared_memory() {
+        close();
+    }
+
+    inline void *
+    map(void) const {
+        return ptr;
+    }
+
+    inline size_t
+    size(void) const {
+        return length;
+    }
+
+    /**
+     * Create and map a new region.  Fails if the name already exists.
+     */
+    bool
+    create(const char *_name, size_t _size) {
+        close();
+#ifdef _WIN32
+        handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+                                    PAGE_READWRITE,
+                                    (DWORD)((unsigned long long)_size >> 32),
+                                    (DWORD)_size, _name);
+        if (!handle || GetLastError() == ERROR_ALREADY_EXISTS) {
+            close();
+            return false;
+        }
+        ptr = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, _size);
+        if (!ptr) {
+            close();
+            return false;
+        }
+#else
+        snprintf(name, sizeof name, "/%s", _name);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            name[0] = 0;
+            return false;
+        }
+        if (ftruncate(fd, _size) != 0 ||
+            (ptr = mmap(NULL, _size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            ptr = NULL;
+            ::close(fd);
+            shm_unlink(name);
+            name[0] = 0;
+            return false;
+        }
+        ::close(fd);
+#endif
+        length = _size;
+        owner = true;
+        return true;
+    }
+
+    /**
+     * Map a region created by another process.
+     */
+    bool
+    open(const char *_name) {
+        close();
+#ifdef _WIN32
+        handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, _name);
+        if (!handle) {
+            return false;
+        }
+        ptr = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!ptr) {
+            close();
+            return false;
+        }
+        MEMORY_BASIC_INFORMATION info;
+        if (!VirtualQuery(ptr, &info, sizeof info)) {
+            close();
+            return false;
+        }
+        length = info.RegionSize;
+#else
+        snprintf(name, sizeof name, "/%s", _name);
+        int fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) {
+            name[0] = 0;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 ||
+            (ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            ptr = NULL;
+            ::close(fd);
+            name[0] = 0;
+            return false;
+        }
+        ::close(fd);
+        length = st.st_size;
+#endif
+        owner = false;
+        return true;
+    }
+
+    /**
+     * Unmap, and remove the name if this side created it.
+     */
+    void
+    close(void) {
+#ifdef _WIN32
+        if (ptr) {
+            UnmapViewOfFile(ptr);
+        }
+        if (handle) {
+            CloseHandle(handle);
+            handle = NULL;
+        }
+#else
+        if (ptr) {
+            munmap(ptr, length);
+        }
+        if (owner && name[0]) {
+            shm_unlink(name);
+        }
+        name[0] = 0;
+#endif
+        ptr = NULL;
+        length = 0;
+        owner = false;
+    }
+};
+
+
+} /* namespace os */
+
+#endif /* _OS_SHMEM_HPP_ */
@@ -344,6 +344,23 @@ namespace os {
 #endif
     };
 
+
+    /**
+     * Number of NUMA memory nodes; 1 when the topology is unknown or
+     * the machine is not NUMA.
+     */
+    unsigned numaNodeCount(void);
+
+    /**
+     * Restrict the calling thread to the processors of the given node.
+     *
+     * Memory pages land on the node of the thread that first touches
+     * them, so threads that fill large buffers (chunk decompression,
+     * call arenas) should be pinned before they allocate.  Threads
+     * they spawn inherit the affinity.
+     */
+    bool pinThreadToNumaNode(unsigned node);
+
 } /* namespace os */
 
 #endif /* _OS_THREAD_HPP_ */
@@ -33,6 +33,8 @@
 
 #include "os.hpp"
 #include "os_string.hpp"
+#include "os_thread.hpp"
+#include "os_time.hpp"
 
 
 namespace os {
@@ -198,6 +200,79 @@ int execute(char * const * args)
     return (int)exitCode;
 }
 
+void *
+allocHugePages(size_t size)
+{
+    /* Large pages need SeLockMemoryPrivilege, which processes rarely
+     * hold; fall back to normal pages quietly. */
+    SIZE_T largePageSize = GetLargePageMinimum();
+    if (largePageSize) {
+        SIZE_T rounded = (size + largePageSize - 1) & ~(largePageSize - 1);
+        void *ptr = VirtualAlloc(NULL, rounded,
+                                 MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES,
+                                 PAGE_READWRITE);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void
+freeHugePages(void *ptr, size_t size)
+{
+    (void)size;
+    if (ptr) {
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    }
+}
+
+void
+adviseWillNeed(const void *ptr, size_t length)
+{
+    /* PrefetchVirtualMemory only exists on Windows 8 and later; look
+     * it up at runtime so the hint degrades to a no-op elsewhere. */
+    typedef struct { PVOID VirtualAddress; SIZE_T NumberOfBytes; } ENTRY;
+    typedef BOOL (WINAPI *PFN)(HANDLE, ULONG_PTR, ENTRY *, ULONG);
+    static PFN pPrefetchVirtualMemory =
+        (PFN)GetProcAddress(GetModuleHandleA("kernel32.dll"),
+                            "PrefetchVirtualMemory");
+    if (pPrefetchVirtualMemory) {
+        ENTRY entry;
+        entry.VirtualAddress = (PVOID)ptr;
+        entry.NumberOfBytes = length;
+        pPrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+    }
+}
+
+void
+adviseDropBehind(FILE *fp)
+{
+    /* No per-handle DONTNEED equivalent; unbuffered I/O would have to
+     * be requested at open time.  Just push the data out. */
+    fflush(fp);
+}
+
+unsigned
+numaNodeCount(void)
+{
+    ULONG highestNode = 0;
+    if (!GetNumaHighestNodeNumber(&highestNode)) {
+        return 1;
+    }
+    return (unsigned)highestNode + 1;
+}
+
+bool
+pinThreadToNumaNode(unsigned node)
+{
+    ULONGLONG mask = 0;
+    if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || !mask) {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+}
+
 void
 log(const char *format, ...)
 {
@@ -226,6 +301,30 @@ log(const char *format, ...)
 
 long long timeFrequency = 0LL;
 
+long long fastTimeFrequency = 0LL;
+
+long long
+calibrateFastTime(void)
+{
+    if (!fastTimeFrequency) {
+        /* A short interval is enough; the TSC is constant-rate on any
+         * hardware recent enough to matter. */
+        long long t0 = getTime();
+        long long f0 = getTimeFast();
+        sleep(10 * 1000);
+        long long t1 = getTime();
+        long long f1 = getTimeFast();
+
+        if (t1 > t0) {
+            fastTimeFrequency = (f1 - f0) * timeFrequency / (t1 - t0);
+        } else {
+            fastTimeFrequency = timeFrequency;
+        }
+    }
+
+    return fastTimeFrequency;
+}
+
 void
 abort(void)
 {
@@ -0,0 +1,79 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Layout of the shared-memory snapshot ring between glretrace and its
+ * driving process (qapitrace).
+ *
+ * The consumer passes a region name via --snapshot-shm=NAME; the
+ * producer creates the region on the first snapshot, sized for the
+ * frames it is seeing, and announces every frame with a
+ *
+ *     "### shm-frame <slot> <no> <width> <height> <channels>"
+ *
+ * line on its regular stdout channel, which thus stays the control
+ * stream while the pixels never pass through the pipe.  The consumer
+ * opens the region on the first such line.
+ *
+ * Flow control is a pair of free-running counters in the ring header:
+ * the producer bumps head after filling a slot (slot = head % slots)
+ * and stalls while head - tail == slots; the consumer bumps tail once
+ * it has copied a frame out.  Each side only writes its own counter,
+ * so plain aligned stores suffice.
+ *
+ * Frames are tightly packed rows of `channels` bytes per pixel, top
+ * row first, one frame per slot.  A frame too large for a slot (or any
+ * frame once region creation failed) is written into the pipe as plain
+ * PNM instead, so the consumer must keep recognising the in-band form:
+ * the two are distinguished by the first byte ('#' versus 'P').
+ */
+
+#ifndef _SNAPSHOT_RING_HPP_
+#define _SNAPSHOT_RING_HPP_
+
+
+#define SNAPSHOT_RING_MAGIC   0x50414e53U  /* 'SNAP' */
+#define SNAPSHOT_RING_VERSION 1
+
+
+struct SnapshotRingHeader {
+    unsigned magic;
+    unsigned version;
+    unsigned slots;
+    unsigned slotSize;          /* bytes per slot */
+    volatile unsigned head;     /* frames produced */
+    volatile unsigned tail;     /* frames consumed */
+};
+
+/* Slot n starts at this offset within the region. */
+inline size_t
+snapshotRingSlotOffset(const SnapshotRingHeader *header, unsigned n) {
+    /* Keep slots cache-line aligned. */
+    size_t base = (sizeof(SnapshotRingHeader) + 63) & ~(size_t)63;
+    return base + (size_t)n * header->slotSize;
+}
+
+
+#endif /* _SNAPSHOT_RING_HPP_ */
@@ -0,0 +1,128 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "trace_analysis.hpp"
+
+#include "trace_parser.hpp"
+
+
+namespace trace {
+
+
+/**
+ * CallStatsVisitor front of the pass: gathers the per-call
+ * notifications into the batch and fans full batches out.  The frame
+ * counter advances after the call carrying CALL_FLAG_END_FRAME, so a
+ * swap is bucketed with the frame it ends.
+ */
+class AnalysisPass::Adapter : public CallStatsVisitor
+{
+public:
+    Adapter(AnalysisPass &_pass) :
+        pass(_pass),
+        frame_no(0)
+    {
+        pass.batch->count = 0;
+    }
+
+    virtual void visit(const FunctionSig *sig,
+                       unsigned call_no,
+                       unsigned thread_id,
+                       CallFlags call_flags,
+                       size_t bytes,
+                       unsigned num_args,
+                       size_t blob_bytes)
+    {
+        CallBatch &batch = *pass.batch;
+        unsigned i = batch.count;
+
+        batch.sigs[i] = sig;
+        batch.call_nos[i] = call_no;
+        batch.thread_ids[i] = thread_id;
+        batch.frame_nos[i] = frame_no;
+        batch.flags[i] = call_flags;
+        batch.bytes[i] = bytes;
+        batch.num_args[i] = num_args;
+        batch.blob_bytes[i] = blob_bytes;
+        batch.count = i + 1;
+
+        if (call_flags & CALL_FLAG_END_FRAME) {
+            ++frame_no;
+        }
+
+        if (batch.count == CallBatch::CAPACITY) {
+            pass.deliver();
+        }
+    }
+
+private:
+    AnalysisPass &pass;
+    unsigned frame_no;
+};
+
+
+AnalysisPass::AnalysisPass(void) :
+    batch(new CallBatch)
+{
+    batch->count = 0;
+}
+
+AnalysisPass::~AnalysisPass() {
+    delete batch;
+}
+
+void
+AnalysisPass::add(Analyzer *analyzer) {
+    analyzers.push_back(analyzer);
+}
+
+void
+AnalysisPass::deliver(void) {
+    for (size_t i = 0; i < analyzers.size(); ++i) {
+        analyzers[i]->analyze(*batch);
+    }
+    batch->count = 0;
+}
+
+bool
+AnalysisPass::run(Parser &parser) {
+    Adapter adapter(*this);
+
+    bool complete = parser.scan(adapter);
+
+    if (batch->count) {
+        deliver();
+    }
+
+    for (size_t i = 0; i < analyzers.size(); ++i) {
+        analyzers[i]->finish();
+    }
+
+    return complete;
+}
+
+
+} /* namespace trace */
@@ -0,0 +1,138 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Shared single-pass analysis over a SCAN parse.
+ *
+ * Every streaming statistic (dump --summary, stats export, nightly
+ * analytics) wants the same thing: one cheap pass over the call
+ * headers.  Running them as separate scans re-reads and re-decodes
+ * the trace once per consumer; this pipeline runs one scan and hands
+ * the decoded headers to every registered analyzer.
+ */
+
+#ifndef _TRACE_ANALYSIS_HPP_
+#define _TRACE_ANALYSIS_HPP_
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "trace_model.hpp"
+
+
+namespace trace {
+
+
+class Parser;
+
+
+/**
+ * A batch of decoded call headers, in trace order.
+ *
+ * Stored as parallel arrays rather than an array of records:
+ * analyzers typically fold one or two columns (count flags, sum
+ * bytes), and a contiguous column is both cache-dense and something
+ * the compiler can vectorize.
+ *
+ * frame_no counts CALL_FLAG_END_FRAME boundaries from the start of
+ * the pass, so per-frame bucketing doesn't have to be re-derived by
+ * every analyzer.  The sigs entries point into the parser's signature
+ * maps and are only valid while it remains open.
+ */
+struct CallBatch
+{
+    enum {
+        CAPACITY = 1024
+    };
+
+    unsigned count;
+
+    const FunctionSig *sigs[CAPACITY];
+    unsigned call_nos[CAPACITY];
+    unsigned thread_ids[CAPACITY];
+    unsigned frame_nos[CAPACITY];
+    CallFlags flags[CAPACITY];
+    uint64_t bytes[CAPACITY];
+    uint32_t num_args[CAPACITY];
+    uint64_t blob_bytes[CAPACITY];
+};
+
+
+/**
+ * One consumer of the shared pass.  analyze() is called once per
+ * batch, in trace order; finish() once after the last batch.
+ */
+class Analyzer
+{
+public:
+    virtual ~Analyzer() {}
+
+    virtual void analyze(const CallBatch &batch) = 0;
+
+    virtual void finish(void) {}
+};
+
+
+/**
+ * Runs one SCAN pass and fans the batches out to every registered
+ * analyzer.  Analyzers are not owned; run() may be called for several
+ * traces in a row to accumulate across them.
+ */
+class AnalysisPass
+{
+public:
+    AnalysisPass(void);
+
+    ~AnalysisPass();
+
+    void add(Analyzer *analyzer);
+
+    /**
+     * Scan the remaining calls of the parser, delivering each batch
+     * to the analyzers in registration order, and call their
+     * finish() methods.  Returns false if the trace ends mid-call.
+     */
+    bool run(Parser &parser);
+
+private:
+    void deliver(void);
+
+    std::vector<Analyzer *> analyzers;
+
+    // Batches are ~40 KiB; keep the pass object cheap to place on the
+    // stack and the batch storage out of it.
+    CallBatch *batch;
+
+    class Adapter;
+    friend class Adapter;
+};
+
+
+} /* namespace trace */
+
+#endif /* _TRACE_ANALYSIS_HPP_ */
@@ -38,6 +38,45 @@
 using namespace trace;
 
 
+bool
+trace::matchFunctionPattern(const char *pattern, const char *name)
+{
+    while (*pattern) {
+        if (*pattern == '*') {
+            ++pattern;
+            if (!*pattern) {
+                return true;
+            }
+            for (; *name; ++name) {
+                if (matchFunctionPattern(pattern, name)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (!*name || (*pattern != '?' && *pattern != *name)) {
+            return false;
+        }
+        ++pattern;
+        ++name;
+    }
+    return !*name;
+}
+
+
+bool
+CallSet::matchesName(const char *name) const
+{
+    for (std::vector<std::string>::const_iterator it = namePatterns.begin();
+         it != namePatterns.end(); ++it) {
+        if (matchFunctionPattern(it->c_str(), name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
 // Parser class for call sets
 class CallSetParser
 {
@@ -68,8 +107,20 @@ private:
         CallNo stop = std::numeric_limits<CallNo>::max();
         CallNo step = 1;
         CallFlags freq = FREQUENCY_ALL;
-        if (isAlpha()) {
-            freq = parseFrequency();
+        if (isNameStart()) {
+            /* Either a frequency keyword covering the whole trace, or
+             * a function-name pattern. */
+            std::string token = parseToken();
+            if (token == "frame") {
+                freq = FREQUENCY_FRAME;
+            } else if (token == "rendertarget" || token == "fbo") {
+                freq = FREQUENCY_RENDERTARGET;
+            } else if (token == "render" || token == "draw") {
+                freq = FREQUENCY_RENDER;
+            } else {
+                set.addPattern(token);
+                return;
+            }
         } else {
             if (isOperator('*')) {
                 // no-change
@@ -146,6 +197,16 @@ private:
         }
     }
 
+    // A frequency keyword or function-name pattern token
+    std::string parseToken() {
+        std::string token;
+        do {
+            token.push_back(consume());
+        } while (isTokenChar());
+        skipWhiteSpace();
+        return token;
+    }
+
     // match lookahead with a digit (does not consume)
     bool isDigit() const {
         return lookahead >= '0' && lookahead <= '9';
@@ -155,6 +216,19 @@ private:
         return lookahead >= 'a' && lookahead <= 'z';
     }
 
+    bool isNameStart() const {
+        return isAlpha() ||
+               (lookahead >= 'A' && lookahead <= 'Z') ||
+               lookahead == '_';
+    }
+
+    bool isTokenChar() const {
+        return isNameStart() ||
+               isDigit() ||
+               lookahead == '*' ||
+               lookahead == '?';
+    }
+
     void skipWhiteSpace() {
         while (isSpace()) {
             consume();
@@ -224,7 +298,11 @@ public:
 };
 
 
-CallSet::CallSet(const char *string): limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max())
+CallSet::CallSet(const char *string) :
+    limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max()),
+    cursor(0),
+    cursorCallNo(0),
+    freqMask(FREQUENCY_NONE)
 {
     if (*string == '@') {
         FileCallSetParser parser(*this, &string[1]);
@@ -236,7 +314,12 @@ CallSet::CallSet(const char *string): limits(std::numeric_limits<CallNo>::min(),
 }
 
 
-CallSet::CallSet(CallFlags freq): limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max()) {
+CallSet::CallSet(CallFlags freq) :
+    limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max()),
+    cursor(0),
+    cursorCallNo(0),
+    freqMask(FREQUENCY_NONE)
+{
     if (freq != FREQUENCY_NONE) {
         CallNo start = std::numeric_limits<CallNo>::min();
         CallNo stop = std::numeric_limits<CallNo>::max();
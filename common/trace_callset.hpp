@@ -32,6 +32,7 @@
  *         | range ( ',' ? range ) *
  *
  *     range = interval ( '/' frequency )
+ *           | pattern
  *
  *     interval = '*'
  *              | number
@@ -42,14 +43,19 @@
  *               | "rendertarget" | "fbo"
  *               | "render | "draw"
  *
+ *     pattern = function name with '*' and '?' wildcards, e.g. "glDraw*"
+ *
+ * A pattern selects every call whose function name matches, regardless
+ * of call number; patterns and numeric ranges in one set are unioned.
  */
 
 #ifndef _TRACE_CALLSET_HPP_
 #define _TRACE_CALLSET_HPP_
 
 
+#include <algorithm>
 #include <limits>
-#include <list>
+#include <vector>
 
 #include "trace_model.hpp"
 
@@ -110,12 +116,47 @@ namespace trace {
     private:
         CallRange limits;
 
-    public:
-        // TODO: use binary tree to speed up lookups
-        typedef std::list< CallRange > RangeList;
-        RangeList ranges;
+        /* Index of the first range that can still match the current
+         * query.  The replay loop looks up monotonically increasing
+         * call numbers, so ranges it has gone past stay dead and the
+         * scan resumes here instead of at the front -- amortized O(1)
+         * per call even for the thousands of ranges bisection scripts
+         * produce.  Queries are expected from a single thread. */
+        mutable size_t cursor;
+        mutable CallNo cursorCallNo;
+
+        /* When the whole set is one unbounded step-1 range -- the
+         * canonical frequency sets like `frame`, `draw` or `*` --
+         * its frequency mask is folded in here and contains() is a
+         * single AND against the call flags.  Zero (FREQUENCY_NONE,
+         * which addRange rejects) means no such shortcut. */
+        CallFlags freqMask;
+
+        static bool
+        rangeStartLess(const CallRange &a, const CallRange &b) {
+            return a.start < b.start;
+        }
 
-        CallSet(): limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max()) {}
+        /* Per-function-id memoization of the pattern matches: 0 no,
+         * 1 yes, -1 not yet resolved.  Each function signature is
+         * matched against the patterns once; after that the per-call
+         * cost is one indexed load. */
+        mutable std::vector<signed char> sigMatchCache;
+
+    public:
+        // Sorted by start call number.
+        typedef std::vector< CallRange > RangeVector;
+        RangeVector ranges;
+
+        // Function-name patterns (with '*'/'?' wildcards)
+        std::vector<std::string> namePatterns;
+
+        CallSet() :
+            limits(std::numeric_limits<CallNo>::min(), std::numeric_limits<CallNo>::max()),
+            cursor(0),
+            cursorCallNo(0),
+            freqMask(FREQUENCY_NONE)
+        {}
 
         CallSet(CallFlags freq);
 
@@ -124,7 +165,34 @@ namespace trace {
         // Not empty set
         inline bool
         empty() const {
-            return ranges.empty();
+            return ranges.empty() && namePatterns.empty();
+        }
+
+        void
+        addPattern(const std::string &pattern) {
+            namePatterns.push_back(pattern);
+            sigMatchCache.clear();
+        }
+
+        /**
+         * Whether any pattern matches the name; unmemoized, for
+         * one-off queries like marking parsed signatures.
+         */
+        bool matchesName(const char *name) const;
+
+        /**
+         * Memoized by function id, for the per-call path.
+         */
+        inline bool
+        matchesSig(unsigned id, const char *name) const {
+            if (id >= sigMatchCache.size()) {
+                sigMatchCache.resize(id + 1, -1);
+            }
+            signed char &entry = sigMatchCache[id];
+            if (entry < 0) {
+                entry = matchesName(name) ? 1 : 0;
+            }
+            return entry != 0;
         }
 
         void
@@ -142,23 +210,45 @@ namespace trace {
                         limits.stop = range.stop;
                 }
 
-                RangeList::iterator it = ranges.begin();
-                while (it != ranges.end() && it->start < range.start) {
-                    ++it;
-                }
+                ranges.insert(std::lower_bound(ranges.begin(), ranges.end(),
+                                               range, rangeStartLess),
+                              range);
+                cursor = 0;
 
-                ranges.insert(it, range);
+                if (ranges.size() == 1 &&
+                    range.start == std::numeric_limits<CallNo>::min() &&
+                    range.stop == std::numeric_limits<CallNo>::max() &&
+                    range.step == 1) {
+                    freqMask = range.freq;
+                } else {
+                    freqMask = FREQUENCY_NONE;
+                }
             }
         }
 
         inline bool
         contains(CallNo callNo, CallFlags callFlags = FREQUENCY_ALL) const {
+            if (freqMask) {
+                return freqMask == FREQUENCY_ALL ||
+                       (callFlags & freqMask) != 0;
+            }
             if (empty()) {
                 return false;
             }
-            RangeList::const_iterator it;
-            for (it = ranges.begin(); it != ranges.end() && it->start <= callNo; ++it) {
-                if (it->contains(callNo, callFlags)) {
+
+            /* Rewind the cursor for queries that go backwards (e.g.
+             * interactive lookups), then advance it past the ranges
+             * this and every later call number have outgrown. */
+            if (callNo < cursorCallNo) {
+                cursor = 0;
+            }
+            cursorCallNo = callNo;
+            while (cursor < ranges.size() && ranges[cursor].stop < callNo) {
+                ++cursor;
+            }
+
+            for (size_t i = cursor; i < ranges.size() && ranges[i].start <= callNo; ++i) {
+                if (ranges[i].contains(callNo, callFlags)) {
                     return true;
                 }
             }
@@ -167,7 +257,11 @@ namespace trace {
 
         inline bool
         contains(const trace::Call &call) {
-            return contains(call.no, call.flags);
+            if (!namePatterns.empty() &&
+                matchesSig(call.sig->id, call.sig->name)) {
+                return true;
+            }
+            return !ranges.empty() && contains(call.no, call.flags);
         }
 
         CallNo getFirst() {
@@ -182,6 +276,11 @@ namespace trace {
 
     CallSet parse(const char *string);
 
+    /**
+     * Shell-style wildcard match ('*' and '?') of a function name.
+     */
+    bool matchFunctionPattern(const char *pattern, const char *name);
+
 
 } /* namespace trace */
 
@@ -24,7 +24,13 @@
  **************************************************************************/
 
 
+#include <stdio.h>
+#include <string.h>
+
 #include <limits>
+#include <map>
+#include <sstream>
+#include <vector>
 
 #include "formatter.hpp"
 #include "trace_dump.hpp"
@@ -33,11 +39,95 @@
 namespace trace {
 
 
-class Dumper : public Visitor
+/*
+ * Lazily built lookup tables, shared across Dumper instances (one is
+ * constructed for every dumped call, so they cannot live in the
+ * visitor).  Enum values get a value -> name map instead of a linear
+ * search per dump; bitmask values get their flag decomposition
+ * memoized, since the same handful of masks repeats throughout a
+ * trace; floats and pointers get their formatted text memoized, since
+ * the same uniform values and object addresses likewise recur millions
+ * of times.  Dumping is serialized by all callers (the cli tools are
+ * single-threaded and retrace hands the output stream to one thread at
+ * a time), so there is no locking.
+ */
+
+typedef std::map<signed long long, const char *> EnumTable;
+
+static std::map<const EnumSig *, EnumTable> enumTables;
+
+struct BitmaskDecomposition {
+    std::vector<const char *> flagNames;
+    unsigned long long remainder;
+};
+
+typedef std::map<unsigned long long, BitmaskDecomposition> BitmaskTable;
+
+static std::map<const BitmaskSig *, BitmaskTable> bitmaskTables;
+
+/* Formatted representations keyed by the value's bits (so NaNs and
+ * negative zero cache cleanly too).  Bounded so a pathological trace
+ * cannot grow them without limit; past the cap values are formatted
+ * directly, which is what every value cost before. */
+enum { REPR_CACHE_CAP = 1 << 16 };
+
+typedef std::map<std::pair<int, unsigned long long>, std::string> FloatTable;
+
+static FloatTable floatReprs;
+
+static std::map<unsigned long long, std::string> pointerReprs;
+
+
+static const EnumTable &
+getEnumTable(const EnumSig *sig)
 {
-protected:
-    std::ostream &os;
-    DumpFlags dumpFlags;
+    EnumTable &table = enumTables[sig];
+    if (table.empty()) {
+        for (const EnumValue *it = sig->values;
+             it != sig->values + sig->num_values; ++it) {
+            // insert() keeps the first name of a duplicated value,
+            // matching what the linear search used to return
+            table.insert(std::make_pair(it->value, it->name));
+        }
+    }
+    return table;
+}
+
+
+static const BitmaskDecomposition &
+getBitmaskDecomposition(const BitmaskSig *sig, unsigned long long value)
+{
+    BitmaskTable &table = bitmaskTables[sig];
+    BitmaskTable::iterator found = table.find(value);
+    if (found == table.end()) {
+        BitmaskDecomposition &decomposition = table[value];
+        for (const BitmaskFlag *it = sig->flags;
+             it != sig->flags + sig->num_flags; ++it) {
+            assert(it->value || decomposition.flagNames.empty());
+            if ((it->value && (value & it->value) == it->value) ||
+                (!it->value && value == 0)) {
+                decomposition.flagNames.push_back(it->name);
+                value &= ~it->value;
+            }
+            if (value == 0) {
+                break;
+            }
+        }
+        decomposition.remainder = value;
+        return decomposition;
+    }
+    return found->second;
+}
+
+
+/*
+ * Style shared by every Dumper of the same color setting: the
+ * formatter, its attributes, and each attribute's byte sequence
+ * captured once.  Attributes used to be allocated and freed per dumped
+ * call; they are plain escape strings (or nothing), so eight heap
+ * round-trips per call bought nothing.
+ */
+struct DumpStyle {
     formatter::Formatter *formatter;
     formatter::Attribute *normal;
     formatter::Attribute *bold;
@@ -47,126 +137,301 @@ protected:
     formatter::Attribute *pointer;
     formatter::Attribute *literal;
 
+    std::string normalBytes;
+    std::string boldBytes;
+    std::string italicBytes;
+    std::string strikeBytes;
+    std::string redBytes;
+    std::string pointerBytes;
+    std::string literalBytes;
+
+    /* Whether the byte captures are faithful.  The Windows console
+     * formatter colors via side effects on the console handle, not
+     * bytes in the stream; those attributes must still be applied
+     * directly, with buffered output flushed first. */
+    bool attrsAreBytes;
+};
+
+static DumpStyle *dumpStyles[2];
+
+static std::string
+captureAttrBytes(const formatter::Attribute *attr)
+{
+    std::ostringstream ss;
+    attr->apply(ss);
+    return ss.str();
+}
+
+static const DumpStyle *
+getDumpStyle(bool color)
+{
+    DumpStyle *&style = dumpStyles[color];
+    if (!style) {
+        style = new DumpStyle;
+        style->formatter = formatter::defaultFormatter(color);
+        style->normal = style->formatter->normal();
+        style->bold = style->formatter->bold();
+        style->italic = style->formatter->italic();
+        style->strike = style->formatter->strike();
+        style->red = style->formatter->color(formatter::RED);
+        style->pointer = style->formatter->color(formatter::GREEN);
+        style->literal = style->formatter->color(formatter::BLUE);
+
+        style->normalBytes = captureAttrBytes(style->normal);
+        style->boldBytes = captureAttrBytes(style->bold);
+        style->italicBytes = captureAttrBytes(style->italic);
+        style->strikeBytes = captureAttrBytes(style->strike);
+        style->redBytes = captureAttrBytes(style->red);
+        style->pointerBytes = captureAttrBytes(style->pointer);
+        style->literalBytes = captureAttrBytes(style->literal);
+
+        style->attrsAreBytes = true;
+#ifdef _WIN32
+        if (dynamic_cast<formatter::WindowsAttribute *>(style->normal)) {
+            style->attrsAreBytes = false;
+        }
+#endif
+    }
+    return style;
+}
+
+
+/* Grow-once output buffer: a whole call's text is composed here with
+ * plain stores and handed to the stream in a single write, instead of
+ * one virtual ostream insertion per fragment. */
+static std::vector<char> dumpBuffer;
+
+
+class Dumper : public Visitor
+{
+protected:
+    std::ostream &os;
+    DumpFlags dumpFlags;
+    const DumpStyle *style;
+
+    void flushBuffer(void) {
+        if (!dumpBuffer.empty()) {
+            os.write(&dumpBuffer[0], dumpBuffer.size());
+            dumpBuffer.clear();
+        }
+    }
+
+    void put(char c) {
+        dumpBuffer.push_back(c);
+    }
+
+    void put(const char *str) {
+        dumpBuffer.insert(dumpBuffer.end(), str, str + strlen(str));
+    }
+
+    void put(const std::string &str) {
+        dumpBuffer.insert(dumpBuffer.end(), str.begin(), str.end());
+    }
+
+    void putAttr(const formatter::Attribute *attr,
+                 const std::string &bytes) {
+        if (!style->attrsAreBytes) {
+            flushBuffer();
+            attr->apply(os);
+            return;
+        }
+        put(bytes);
+    }
+
+    void normal(void)   { putAttr(style->normal, style->normalBytes); }
+    void bold(void)     { putAttr(style->bold, style->boldBytes); }
+    void italic(void)   { putAttr(style->italic, style->italicBytes); }
+    void strike(void)   { putAttr(style->strike, style->strikeBytes); }
+    void red(void)      { putAttr(style->red, style->redBytes); }
+    void green(void)    { putAttr(style->pointer, style->pointerBytes); }
+    void blue(void)     { putAttr(style->literal, style->literalBytes); }
+
+    void putDec(unsigned long long value) {
+        char tmp[24];
+        char *p = tmp + sizeof tmp;
+        do {
+            *--p = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        dumpBuffer.insert(dumpBuffer.end(), p, tmp + sizeof tmp);
+    }
+
+    void putDec(signed long long value) {
+        if (value < 0) {
+            put('-');
+            putDec(0ULL - (unsigned long long)value);
+        } else {
+            putDec((unsigned long long)value);
+        }
+    }
+
+    void putHex(unsigned long long value) {
+        char tmp[18];
+        char *p = tmp + sizeof tmp;
+        do {
+            *--p = "0123456789abcdef"[value & 0xf];
+            value >>= 4;
+        } while (value);
+        put('0');
+        put('x');
+        dumpBuffer.insert(dumpBuffer.end(), p, tmp + sizeof tmp);
+    }
+
+    void putFloat(double value, int digits) {
+        unsigned long long bits = 0;
+        memcpy(&bits, &value, sizeof value);
+        std::pair<int, unsigned long long> key(digits, bits);
+
+        FloatTable::const_iterator found = floatReprs.find(key);
+        if (found != floatReprs.end()) {
+            put(found->second);
+            return;
+        }
+
+        char tmp[48];
+        int len = snprintf(tmp, sizeof tmp, "%.*g", digits, value);
+        if (len < 0 || len >= (int)sizeof tmp) {
+            return;
+        }
+        if (floatReprs.size() < REPR_CACHE_CAP) {
+            floatReprs[key] = tmp;
+        }
+        put(tmp);
+    }
+
+    void putPointer(unsigned long long value) {
+        std::map<unsigned long long, std::string>::const_iterator found =
+            pointerReprs.find(value);
+        if (found != pointerReprs.end()) {
+            put(found->second);
+            return;
+        }
+
+        size_t mark = dumpBuffer.size();
+        putHex(value);
+        if (pointerReprs.size() < REPR_CACHE_CAP) {
+            pointerReprs[value].assign(dumpBuffer.begin() + mark,
+                                       dumpBuffer.end());
+        }
+    }
+
 public:
-    Dumper(std::ostream &_os, DumpFlags _flags) : 
+    Dumper(std::ostream &_os, DumpFlags _flags) :
         os(_os),
         dumpFlags(_flags)
     {
-        bool color = !(dumpFlags & DUMP_FLAG_NO_COLOR);
-        formatter = formatter::defaultFormatter(color);
-        normal = formatter->normal();
-        bold = formatter->bold();
-        italic = formatter->italic();
-        strike = formatter->strike();
-        red = formatter->color(formatter::RED);
-        pointer = formatter->color(formatter::GREEN);
-        literal = formatter->color(formatter::BLUE);
+        style = getDumpStyle(!(dumpFlags & DUMP_FLAG_NO_COLOR));
+        if (dumpBuffer.capacity() < 64 * 1024) {
+            dumpBuffer.reserve(64 * 1024);
+        }
     }
 
     ~Dumper() {
-        delete normal;
-        delete bold;
-        delete italic;
-        delete strike;
-        delete red;
-        delete pointer;
-        delete literal;
-        delete formatter;
+        flushBuffer();
     }
 
     void visit(Null *) {
-        os << literal << "NULL" << normal;
+        blue();
+        put("NULL");
+        normal();
     }
 
     void visit(Bool *node) {
-        os << literal << (node->value ? "true" : "false") << normal;
+        blue();
+        put(node->value ? "true" : "false");
+        normal();
     }
 
     void visit(SInt *node) {
-        os << literal << node->value << normal;
+        blue();
+        putDec(node->value);
+        normal();
     }
 
     void visit(UInt *node) {
-        os << literal << node->value << normal;
+        blue();
+        putDec(node->value);
+        normal();
     }
 
     void visit(Float *node) {
-        std::streamsize oldPrecision = os.precision(std::numeric_limits<float>::digits10 + 1);
-        os << literal << node->value << normal;
-        os.precision(oldPrecision);
+        blue();
+        putFloat(node->value, std::numeric_limits<float>::digits10 + 1);
+        normal();
     }
 
     void visit(Double *node) {
-        std::streamsize oldPrecision = os.precision(std::numeric_limits<double>::digits10 + 1);
-        os << literal << node->value << normal;
-        os.precision(oldPrecision);
+        blue();
+        putFloat(node->value, std::numeric_limits<double>::digits10 + 1);
+        normal();
     }
 
     void visit(String *node) {
-        os << literal << "\"";
+        blue();
+        put('\"');
         for (const char *it = node->value; *it; ++it) {
             unsigned char c = (unsigned char) *it;
             if (c == '\"')
-                os << "\\\"";
+                put("\\\"");
             else if (c == '\\')
-                os << "\\\\";
+                put("\\\\");
             else if (c >= 0x20 && c <= 0x7e)
-                os << c;
+                put((char)c);
             else if (c == '\t') {
-                os << "\t";
+                put('\t');
             } else if (c == '\r') {
                 // Ignore carriage-return
             } else if (c == '\n') {
                 // Reset formatting so that it looks correct with 'less -R'
-                os << normal << '\n' << literal;
+                normal();
+                put('\n');
+                blue();
             } else {
                 unsigned octal0 = c & 0x7;
                 unsigned octal1 = (c >> 3) & 0x7;
                 unsigned octal2 = (c >> 3) & 0x7;
-                os << "\\";
+                put('\\');
                 if (octal2)
-                    os << octal2;
+                    put((char)('0' + octal2));
                 if (octal1)
-                    os << octal1;
-                os << octal0;
+                    put((char)('0' + octal1));
+                put((char)('0' + octal0));
             }
         }
-        os << "\"" << normal;
+        put('\"');
+        normal();
     }
 
     void visit(Enum *node) {
-        const EnumValue *it = node->lookup();
-        if (it) {
-            os << literal << it->name << normal;
-            return;
+        const EnumTable &table = getEnumTable(node->sig);
+        EnumTable::const_iterator found = table.find(node->value);
+        blue();
+        if (found != table.end()) {
+            put(found->second);
+        } else {
+            putDec(node->value);
         }
-        os << literal << node->value << normal;
+        normal();
     }
 
     void visit(Bitmask *bitmask) {
-        unsigned long long value = bitmask->value;
-        const BitmaskSig *sig = bitmask->sig;
-        bool first = true;
-        for (const BitmaskFlag *it = sig->flags; it != sig->flags + sig->num_flags; ++it) {
-            assert(it->value || first);
-            if ((it->value && (value & it->value) == it->value) ||
-                (!it->value && value == 0)) {
-                if (!first) {
-                    os << " | ";
-                }
-                os << literal << it->name << normal;
-                value &= ~it->value;
-                first = false;
-            }
-            if (value == 0) {
-                break;
-            }
+        const BitmaskDecomposition &decomposition =
+            getBitmaskDecomposition(bitmask->sig, bitmask->value);
+        const char *sep = "";
+        for (std::vector<const char *>::const_iterator
+             it = decomposition.flagNames.begin();
+             it != decomposition.flagNames.end(); ++it) {
+            put(sep);
+            blue();
+            put(*it);
+            normal();
+            sep = " | ";
         }
-        if (value || first) {
-            if (!first) {
-                os << " | ";
-            }
-            os << literal << "0x" << std::hex << value << std::dec << normal;
+        if (decomposition.remainder || decomposition.flagNames.empty()) {
+            put(sep);
+            blue();
+            putHex(decomposition.remainder);
+            normal();
         }
     }
 
@@ -186,7 +451,11 @@ public:
                 }
             }
 
-            os << sep << italic << memberName << normal << " = ",
+            put(sep);
+            italic();
+            put(memberName);
+            normal();
+            put(" = ");
             _visit(memberValue);
             sep = ", ";
         }
@@ -194,34 +463,40 @@ public:
     }
 
     void visit(Struct *s) {
-        os << "{";
+        put('{');
         visitMembers(s);
-        os << "}";
+        put('}');
     }
 
     void visit(Array *array) {
         if (array->values.size() == 1) {
-            os << "&";
+            put('&');
             _visit(array->values[0]);
         }
         else {
             const char *sep = "";
-            os << "{";
+            put('{');
             for (std::vector<Value *>::iterator it = array->values.begin(); it != array->values.end(); ++it) {
-                os << sep;
+                put(sep);
                 _visit(*it);
                 sep = ", ";
             }
-            os << "}";
+            put('}');
         }
     }
 
     void visit(Blob *blob) {
-        os << pointer << "blob(" << blob->size << ")" << normal;
+        green();
+        put("blob(");
+        putDec((unsigned long long)blob->size);
+        put(')');
+        normal();
     }
 
     void visit(Pointer *p) {
-        os << pointer << "0x" << std::hex << p->value << std::dec << normal;
+        green();
+        putPointer(p->value);
+        normal();
     }
 
     void visit(Repr *r) {
@@ -230,49 +505,57 @@ public:
 
     void visit(Call *call) {
         CallFlags callFlags = call->flags;
-        
+
         if (!(dumpFlags & DUMP_FLAG_NO_CALL_NO)) {
-            os << call->no << " ";
+            putDec((unsigned long long)call->no);
+            put(' ');
         }
 
         if (callFlags & CALL_FLAG_NON_REPRODUCIBLE) {
-            os << strike;
+            strike();
         } else if (callFlags & (CALL_FLAG_FAKE | CALL_FLAG_NO_SIDE_EFFECTS)) {
-            os << normal;
+            normal();
         } else {
-            os << bold;
+            bold();
         }
-        os << call->sig->name << normal;
+        put(call->sig->name);
+        normal();
 
-        os << "(";
+        put('(');
         const char *sep = "";
         for (unsigned i = 0; i < call->args.size(); ++i) {
-            os << sep;
+            put(sep);
             if (!(dumpFlags & DUMP_FLAG_NO_ARG_NAMES)) {
-                os << italic << call->sig->arg_names[i] << normal << " = ";
+                italic();
+                put(call->sig->arg_names[i]);
+                normal();
+                put(" = ");
             }
             if (call->args[i].value) {
                 _visit(call->args[i].value);
             } else {
-               os << "?";
+                put('?');
             }
             sep = ", ";
         }
-        os << ")";
+        put(')');
 
         if (call->ret) {
-            os << " = ";
+            put(" = ");
             _visit(call->ret);
         }
-        
+
         if (callFlags & CALL_FLAG_INCOMPLETE) {
-            os << " // " << red << "incomplete" << normal;
+            put(" // ");
+            red();
+            put("incomplete");
+            normal();
         }
-        
-        os << "\n";
+
+        put('\n');
 
         if (callFlags & CALL_FLAG_END_FRAME) {
-            os << "\n";
+            put('\n');
         }
     }
 };
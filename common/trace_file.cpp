@@ -35,7 +35,8 @@ using namespace trace;
 File::File(const std::string &filename,
            File::Mode mode)
     : m_mode(mode),
-      m_isOpened(false)
+      m_isOpened(false),
+      m_bytesConsumed(0)
 {
     if (!filename.empty()) {
         open(filename, m_mode);
@@ -54,3 +55,44 @@ void File::setCurrentOffset(const File::Offset &offset)
     assert(0);
 }
 
+void File::setReadAhead(bool enable)
+{
+}
+
+void File::setJournal(bool enable)
+{
+}
+
+void File::journalCommit(void)
+{
+}
+
+void File::setAsyncWrite(bool enable)
+{
+}
+
+size_t File::rawPeek(const char **ptr)
+{
+    return 0;
+}
+
+void File::rawAdvance(size_t length)
+{
+    // only reachable after a non-zero rawPeek
+    assert(0);
+}
+
+void File::markFrameStart(uint64_t callNo)
+{
+}
+
+bool File::getFrameIndex(FrameIndex &index)
+{
+    return false;
+}
+
+bool File::extractPrefix(const char *fileName, const File::Offset &end)
+{
+    return false;
+}
+
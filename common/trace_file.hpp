@@ -29,6 +29,7 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
 #include <stdint.h>
 
 
@@ -53,11 +54,50 @@ public:
         uint32_t offsetInChunk;
     };
 
+    /**
+     * One frame boundary, as recorded in a container's frame index.
+     *
+     * Entries mark where frames begin; the entry following a frame
+     * marks where it ends, so a trailing incomplete frame never forms
+     * a complete pair and is ignored, matching what a sequential scan
+     * would conclude.
+     */
+    struct FrameIndexEntry {
+        FrameIndexEntry(void)
+            : firstCallNo(0)
+        {}
+        Offset start;
+        uint64_t firstCallNo;
+    };
+    typedef std::vector<FrameIndexEntry> FrameIndex;
+
 public:
     static File *createZLib(void);
     static File *createSnappy(void);
+    static File *createStream(void);
     static File *createForRead(const char *filename);
     static File *createForWrite(const char *filename);
+
+    enum RepairResult {
+        REPAIR_INTACT,
+        REPAIR_REPAIRED,
+        REPAIR_FAILED
+    };
+
+    /**
+     * Verify a snappy trace chunk by chunk and make a damaged one --
+     * typically a capture whose process died, leaving a partial final
+     * chunk and no index footer -- readable again: the trace is cut
+     * after the last intact chunk, any leftover write-ahead journal
+     * is spliced in as a final chunk, and a fresh index footer is
+     * appended.  Intactness is decided from the per-chunk checksums.
+     * By default only chunks behind the last recovery marker are
+     * checksummed, so repair costs seconds even on huge traces; with
+     * verifyAll every chunk is read and checked.  With dryRun the
+     * damage is reported but the file is left untouched.
+     */
+    static RepairResult repairSnappy(const char *fileName, bool verifyAll,
+                                     bool dryRun, std::ostream &report);
 public:
     File(const std::string &filename = std::string(),
          File::Mode mode = File::Read);
@@ -75,9 +115,84 @@ public:
     bool skip(size_t length);
     int percentRead();
 
+    /**
+     * Zero-copy look at the decompressed bytes at the current read
+     * position.  Returns how many contiguous bytes are available and
+     * points ptr at them; returns 0 when the container cannot expose
+     * its buffer, in which case callers must fall back to
+     * read()/getc().  Peeked bytes are only consumed once reported
+     * through advance().
+     */
+    size_t peek(const char **ptr);
+    void advance(size_t length);
+
     virtual bool supportsOffsets() const = 0;
     virtual File::Offset currentOffset() = 0;
     virtual void setCurrentOffset(const File::Offset &offset);
+
+    /**
+     * Hint that the file will be read sequentially, allowing the
+     * implementation to decompress upcoming data on a worker thread.
+     * No-op by default.
+     */
+    virtual void setReadAhead(bool enable);
+
+    /**
+     * Hint that writes should not stall the caller, allowing the
+     * implementation to compress and write chunks on a worker thread.
+     * No-op by default.
+     */
+    virtual void setAsyncWrite(bool enable);
+
+    /**
+     * Keep a small write-ahead journal of not-yet-compressed data in
+     * a sidecar file, so that records survive even terminations the
+     * exception handler cannot catch.  Containers that support it
+     * discard the journal on clean close and splice any leftover
+     * journal back in when reading; no-op by default.
+     */
+    virtual void setJournal(bool enable);
+
+    /**
+     * Append everything written since the last commit to the journal,
+     * if one is active.  Callers should invoke this at record
+     * boundaries so the journal never ends mid-record.
+     */
+    virtual void journalCommit(void);
+
+    /**
+     * Hint that the next byte written begins the frame whose first
+     * call will be callNo.  Containers that can persist a frame index
+     * record it; no-op by default.
+     */
+    virtual void markFrameStart(uint64_t callNo);
+
+    /**
+     * Retrieve the frame index of the underlying container, if it has
+     * one.  Returns false when the container predates the index or
+     * does not support one, in which case callers must fall back to a
+     * sequential scan.
+     */
+    virtual bool getFrameIndex(FrameIndex &index);
+
+    /**
+     * Extract the leading portion of the container into a new file of
+     * the same format, ending at the given offset (as obtained from
+     * currentOffset() while reading).  Compressed chunks that lie
+     * entirely within the range are copied verbatim and only the
+     * boundary chunk is re-encoded, so the cost is dominated by disk
+     * I/O rather than recompression.  Returns false when the
+     * container does not support it, in which case callers must fall
+     * back to re-encoding through a parser/writer pair.
+     */
+    virtual bool extractPrefix(const char *fileName, const File::Offset &end);
+
+    /**
+     * Total uncompressed bytes consumed by read/getc/skip since the
+     * file was opened.  Monotonic only while reading sequentially;
+     * seeking does not reset it.
+     */
+    uint64_t bytesConsumed() const;
 protected:
     virtual bool rawOpen(const std::string &filename, File::Mode mode) = 0;
     virtual bool rawWrite(const void *buffer, size_t length) = 0;
@@ -87,10 +202,13 @@ protected:
     virtual void rawFlush() = 0;
     virtual bool rawSkip(size_t length) = 0;
     virtual int rawPercentRead() = 0;
+    virtual size_t rawPeek(const char **ptr);
+    virtual void rawAdvance(size_t length);
 
 protected:
     File::Mode m_mode;
     bool m_isOpened;
+    uint64_t m_bytesConsumed;
 };
 
 inline bool File::isOpened() const
@@ -110,6 +228,7 @@ inline bool File::open(const std::string &filename, File::Mode mode)
     }
     m_isOpened = rawOpen(filename, mode);
     m_mode = mode;
+    m_bytesConsumed = 0;
 
     return m_isOpened;
 }
@@ -127,7 +246,9 @@ inline size_t File::read(void *buffer, size_t length)
     if (!m_isOpened || m_mode != File::Read) {
         return 0;
     }
-    return rawRead(buffer, length);
+    size_t got = rawRead(buffer, length);
+    m_bytesConsumed += got;
+    return got;
 }
 
 inline int File::percentRead()
@@ -158,7 +279,11 @@ inline int File::getc()
     if (!m_isOpened || m_mode != File::Read) {
         return -1;
     }
-    return rawGetc();
+    int c = rawGetc();
+    if (c != -1) {
+        ++m_bytesConsumed;
+    }
+    return c;
 }
 
 inline bool File::skip(size_t length)
@@ -166,7 +291,30 @@ inline bool File::skip(size_t length)
     if (!m_isOpened || m_mode != File::Read) {
         return false;
     }
-    return rawSkip(length);
+    if (!rawSkip(length)) {
+        return false;
+    }
+    m_bytesConsumed += length;
+    return true;
+}
+
+inline size_t File::peek(const char **ptr)
+{
+    if (!m_isOpened || m_mode != File::Read) {
+        return 0;
+    }
+    return rawPeek(ptr);
+}
+
+inline void File::advance(size_t length)
+{
+    rawAdvance(length);
+    m_bytesConsumed += length;
+}
+
+inline uint64_t File::bytesConsumed() const
+{
+    return m_bytesConsumed;
 }
 
 
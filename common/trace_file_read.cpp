@@ -24,6 +24,8 @@
  **************************************************************************/
 
 
+#include <string.h>
+
 #include <fstream>
 
 #include "os.hpp"
@@ -36,6 +38,19 @@ using namespace trace;
 File *
 File::createForRead(const char *filename)
 {
+    /* Sequential sources (stdin, or a connection to `apitrace stream`
+     * on another host) cannot be sniffed by reopening, and carry the
+     * chunk-stream framing rather than a container format. */
+    if ((filename[0] == '-' && filename[1] == 0) ||
+        strncmp(filename, "tcp://", 6) == 0) {
+        File *file = File::createStream();
+        if (!file->open(filename, File::Read)) {
+            delete file;
+            return NULL;
+        }
+        return file;
+    }
+
     std::ifstream stream(filename, std::ifstream::binary | std::ifstream::in);
     if (!stream.is_open()) {
         os::log("error: failed to open %s\n", filename);
@@ -38,6 +38,31 @@
  *     compressed data, in little endian
  * }
  * File can contain any number of such chunks.
+ *
+ * The top bit of the length word selects the chunk's codec: clear
+ * means snappy (the only codec before the bit existed, so all old
+ * traces read unchanged), set means the chunk is stored verbatim.
+ * Chunks that snappy cannot shrink -- already-compressed textures,
+ * random-looking vertex data -- are stored raw, making their read
+ * path a plain memcpy.
+ *
+ * Bit 30 of the length word marks checksummed chunks: a crc32 of the
+ * compressed payload sits between the length word and the payload, so
+ * that corruption and truncation are reported instead of parsed as
+ * garbage.  Bit 29 marks recovery markers, pseudo-chunks that carry
+ * no trace bytes and are skipped by readers:
+ * marker {
+ *     uint32  - length word: SNAPPY_CHUNK_MARKER_FLAG | payload size
+ *     byte[4] - 'a' 't' 'r' 'm'
+ *     uint64  - number of chunks preceding the marker
+ *     uint64  - file offset of the marker's own length word
+ *     uint32  - crc32 of the 20 payload bytes above
+ * }
+ * The embedded offset makes a raw-byte magic match self-validating,
+ * which lets File::repairSnappy find the last marker of a truncated
+ * trace (which has no index footer) and checksum only the tail behind
+ * it rather than the whole file.  Old traces have neither bit set:
+ * their chunks are far smaller than 2^29 bytes, so both read as zero.
  * The default size of an uncompressed chunk is specified in
  * SNAPPY_CHUNK_SIZE.
  *
@@ -48,21 +73,118 @@
  * to offer a pretty good compression/disk io speed ratio
  * but that might change.
  *
+ * Optionally the file ends with an index footer, so that readers can
+ * locate any chunk without sequentially walking all the preceding
+ * ones:
+ * footer {
+ *     for each chunk {
+ *         uint64 - file offset of the chunk
+ *         uint32 - uncompressed length of the chunk
+ *     }
+ *     uint64 - number of chunks
+ *     byte[4] - 'a' 't' 'i' 'x'
+ * }
+ * Old readers never see the footer because they stop at the last call
+ * in the trace; new readers probe the tail of the file for the magic
+ * before reading any chunks.
+ *
+ * Writers that know where frames begin (see File::markFrameStart) may
+ * additionally emit a frame index immediately before the chunk index:
+ * frame index {
+ *     for each frame boundary {
+ *         uint64 - file offset of the chunk the frame starts in
+ *         uint32 - offset of the frame within the uncompressed chunk
+ *         uint64 - call number of the frame's first call
+ *     }
+ *     uint64 - number of boundaries
+ *     byte[4] - 'a' 't' 'f' 'x'
+ * }
+ * Like the chunk index, it is detected by probing for the magic and
+ * is entirely optional.
+ *
+ * When journaling is enabled (see File::setJournal) a sidecar file
+ * named <trace>.journal shadows the uncompressed bytes of the chunk
+ * currently being filled:
+ * journal {
+ *     byte[4] - 'a' 't' 'j' 'l'
+ *     uint64  - number of chunks already emitted to the trace
+ *     raw uncompressed record bytes since the last chunk boundary
+ * }
+ * The journal is truncated at every chunk boundary and deleted on
+ * clean close, so its presence next to a trace means the writer died;
+ * the reader then splices the journaled bytes in after the last chunk
+ * (provided the chunk counts agree), recovering the calls that never
+ * made it through the compressor.
  */
 
 
 #include <snappy.h>
+#include <zlib.h>  // for crc32
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include "trace_file.hpp"
+#include "os.hpp"
+#include "os_histogram.hpp"
+#include "os_thread.hpp"
+#include "os_time.hpp"
 
 
 #define SNAPPY_CHUNK_SIZE (1 * 1024 * 1024)
 
+/* Codec flag in the top bit of a chunk's length word: set when the
+ * chunk is stored verbatim instead of snappy-compressed. */
+#define SNAPPY_CHUNK_STORED_FLAG 0x80000000u
+
+/* Set when a crc32 of the compressed payload follows the length
+ * word. */
+#define SNAPPY_CHUNK_CRC_FLAG 0x40000000u
+
+/* Set on recovery markers, which carry no trace bytes. */
+#define SNAPPY_CHUNK_MARKER_FLAG 0x20000000u
+
+#define SNAPPY_CHUNK_FLAGS \
+    (SNAPPY_CHUNK_STORED_FLAG | SNAPPY_CHUNK_CRC_FLAG | \
+     SNAPPY_CHUNK_MARKER_FLAG)
+
+#define SNAPPY_MARKER_BYTE1 'r'
+#define SNAPPY_MARKER_BYTE2 'm'
+#define SNAPPY_MARKER_PAYLOAD_SIZE (4 + 8 + 8 + 4)
+
+/* One marker per this many chunks; at the default chunk size that is
+ * a 28 byte breadcrumb every 64 MB of uncompressed data. */
+#define SNAPPY_MARKER_INTERVAL 64
+
+#define SNAPPY_INDEX_BYTE1 'i'
+#define SNAPPY_INDEX_BYTE2 'x'
+#define SNAPPY_INDEX_ENTRY_SIZE (8 + 4)
+#define SNAPPY_INDEX_TAIL_SIZE (8 + 4)
+
+#define SNAPPY_FRAME_BYTE1 'f'
+#define SNAPPY_FRAME_BYTE2 'x'
+#define SNAPPY_FRAME_ENTRY_SIZE (8 + 4 + 8)
+#define SNAPPY_FRAME_TAIL_SIZE (8 + 4)
+
+#define SNAPPY_JOURNAL_HEADER_SIZE (4 + 8)
+
 
 
 using namespace trace;
@@ -77,6 +199,13 @@ public:
     virtual bool supportsOffsets() const;
     virtual File::Offset currentOffset();
     virtual void setCurrentOffset(const File::Offset &offset);
+    virtual void setReadAhead(bool enable);
+    virtual void setAsyncWrite(bool enable);
+    virtual void setJournal(bool enable);
+    virtual void journalCommit(void);
+    virtual void markFrameStart(uint64_t callNo);
+    virtual bool getFrameIndex(File::FrameIndex &index);
+    virtual bool extractPrefix(const char *fileName, const File::Offset &end);
 protected:
     virtual bool rawOpen(const std::string &filename, File::Mode mode);
     virtual bool rawWrite(const void *buffer, size_t length);
@@ -86,6 +215,8 @@ protected:
     virtual void rawFlush();
     virtual bool rawSkip(size_t length);
     virtual int rawPercentRead();
+    virtual size_t rawPeek(const char **ptr);
+    virtual void rawAdvance(size_t length);
 
 private:
     inline size_t usedCacheSize() const
@@ -102,8 +233,19 @@ private:
             return 0;
         }
     }
+    inline bool journalPending() const
+    {
+        return !m_journalSpliced && !m_journalTail.empty() &&
+               m_readChunkCount <= m_journalBaseChunks;
+    }
     inline bool endOfData() const
     {
+        if (journalPending()) {
+            return false;
+        }
+        if (m_map) {
+            return m_mapPos >= m_dataEnd && freeCacheSize() == 0;
+        }
         return m_stream.eof() && freeCacheSize() == 0;
     }
     void flushWriteCache();
@@ -111,7 +253,45 @@ private:
     void createCache(size_t size);
     void writeCompressedLength(size_t length);
     size_t readCompressedLength();
+    bool mapOpen(const std::string &filename);
+    void mapClose();
+    void adviseLookahead();
+    void writeIndexFooter();
+    bool readIndexFooter();
+    void readAt(uint64_t pos, void *buffer, size_t length);
+    size_t chunkAt(uint64_t fileOffset) const;
+    static void readAheadThreadEntry(SnappyFile *file);
+    void readAheadLoop();
+    bool prefetchChunk(uint64_t pos);
+    bool consumePrefetchedChunk();
+    void requestPrefetchLocked();
+    void stopReadAhead();
+    void writeChunk(const char *data, size_t length, bool forceStore = false);
+    void writeRecoveryMarker();
+    static void asyncWriteThreadEntry(SnappyFile *file);
+    void asyncWriteLoop();
+    void drainAsyncWrite();
+    void stopAsyncWrite();
+    void journalWriteHeader();
+    void journalReset();
+    void journalDiscard();
+    void loadJournal(const std::string &filename);
+    bool spliceJournalTail();
 private:
+    struct ChunkInfo {
+        uint64_t offset;
+        uint32_t uncompressedLength;
+    };
+
+    /* A frame boundary as recorded while writing.  The chunk is
+     * identified by ordinal since its file offset is only known once
+     * it has been compressed. */
+    struct FrameInfo {
+        uint64_t chunkOrdinal;
+        uint32_t offsetInChunk;
+        uint64_t firstCallNo;
+    };
+
     std::fstream m_stream;
     size_t m_cacheMaxSize;
     size_t m_cacheSize;
@@ -120,6 +300,122 @@ private:
 
     char *m_compressedCache;
 
+    /* Memory mapping of the whole file, when reading.  Chunks are
+     * decompressed straight out of the mapping, saving one copy and
+     * letting the OS page cache persist across replays.  NULL when
+     * unavailable (e.g. on Windows, or pipes), in which case we fall
+     * back to reading through m_stream. */
+    char *m_map;
+    size_t m_mapSize;
+    size_t m_mapPos;
+
+    /* End of the mapped range already hinted to the kernel with
+     * os::adviseWillNeed; see adviseLookahead. */
+    size_t m_adviseUpTo;
+
+    /* Per-chunk index.  Filled as chunks are flushed when writing, or
+     * loaded from the index footer when reading (empty for traces
+     * written before the footer existed). */
+    std::vector<ChunkInfo> m_chunkIndex;
+
+    /* Frame boundaries recorded via markFrameStart while writing. */
+    std::vector<FrameInfo> m_frameMarks;
+
+    /* Frame index loaded from the footer when reading. */
+    File::FrameIndex m_frameIndex;
+
+    /* Ordinal of the chunk currently being filled when writing. */
+    uint64_t m_writeChunkOrdinal;
+
+    /* Chunks emitted since the last recovery marker. */
+    unsigned m_chunksSinceMarker;
+
+    /* File offset where the chunk data ends (i.e. where the index
+     * footer begins, or the file size when there is no footer). */
+    uint64_t m_dataEnd;
+
+    /* Double-buffered read-ahead.  While the consumer works through
+     * m_cache, a worker thread decompresses the next chunk into
+     * m_prefetchBuffer; when the consumer catches up the two buffers
+     * are swapped.  Only used on mapped files, and only when enabled
+     * via setReadAhead(). */
+    bool m_readAheadRunning;
+    bool m_readAheadExit;
+    bool m_prefetchBusy;
+    bool m_prefetchValid;
+    uint64_t m_prefetchPos;
+    uint64_t m_prefetchEnd;
+    size_t m_prefetchSize;
+    size_t m_prefetchBufferMaxSize;
+    char *m_prefetchBuffer;
+    os::thread m_readAheadThread;
+    os::mutex m_readAheadMutex;
+    os::condition_variable m_readAheadRequest;
+    os::condition_variable m_readAheadReady;
+
+    /* Pipelined write mode: flushWriteCache queues the filled cache
+     * for a compressor thread and keeps filling a recycled buffer, so
+     * the traced application only waits for snappy or disk I/O when
+     * the in-memory backlog exceeds its byte budget.  Past the
+     * half-budget high-water mark queued chunks are stored without
+     * compression, trading file size for drain speed; time actually
+     * spent stalled is accounted and reported on close.  Only active
+     * when enabled via setAsyncWrite(). */
+    struct PendingWrite {
+        char *data;
+        size_t length;
+        size_t cap;
+        bool store;    /* bypass compression (backpressure fallback) */
+    };
+    bool m_asyncWriteRunning;
+    bool m_asyncWriteExit;
+    bool m_writeBusy;
+    std::vector<PendingWrite> m_writeQueue;
+    std::vector<PendingWrite> m_writeSpares;
+    size_t m_writeQueuedBytes;
+    size_t m_writeBudget;
+    uint64_t m_writeStallTicks;
+    uint64_t m_writeStoredChunks;
+    size_t m_writeBacklogPeak;
+    os::thread m_writeThread;
+    os::mutex m_writeMutex;
+    os::condition_variable m_writeRequest;
+    os::condition_variable m_writeDone;
+
+    /* Latency shape of flushWriteCache, the point where capture can
+     * stall on compression or disk.  The stall-tick sum above says how
+     * much time was lost overall; the histogram says whether it was
+     * spread thin or concentrated in frame-ruining spikes.  Collected
+     * when TRACE_SELF_PROFILE is set, reported on close. */
+    bool m_flushProfiling;
+    os::LatencyHistogram m_flushHist;
+
+    /* Whether chunk checksums are verified while reading.  Only set
+     * for traces without an index footer -- i.e. captures that never
+     * closed cleanly, the one case where trailing garbage is likely.
+     * Cleanly closed traces skip the verification (crc32 costs a
+     * sizeable fraction of raw read throughput); their checksums are
+     * still there for `apitrace repair --all`. */
+    bool m_verifyChecksums;
+
+    /* Write-ahead journal of the uncompressed bytes of the chunk
+     * being filled.  Unbuffered, so committed records reach the OS
+     * page cache and survive the process dying, even by SIGKILL;
+     * truncated at every chunk boundary and deleted on clean close.
+     * Only active when enabled via setJournal(). */
+    FILE *m_journal;
+    std::string m_journalPath;
+    char *m_journalMark;
+
+    /* Journal leftovers found next to a trace opened for reading, to
+     * be spliced in after the last complete chunk. */
+    std::vector<char> m_journalTail;
+    uint64_t m_journalBaseChunks;
+    bool m_journalSpliced;
+    uint64_t m_readChunkCount;
+
+    std::string m_fileName;
+
     File::Offset m_currentOffset;
     std::streampos m_endPos;
 };
@@ -129,23 +425,69 @@ SnappyFile::SnappyFile(const std::string &filename,
     : File(),
       m_cacheMaxSize(SNAPPY_CHUNK_SIZE),
       m_cacheSize(m_cacheMaxSize),
-      m_cache(new char [m_cacheMaxSize]),
-      m_cachePtr(m_cache)
+      // Chunk buffers are large and long-lived, so they get 2 MiB
+      // huge-page backing where available (see os::allocHugePages).
+      m_cache((char *)os::allocHugePages(m_cacheMaxSize)),
+      m_cachePtr(m_cache),
+      m_map(NULL),
+      m_mapSize(0),
+      m_mapPos(0),
+      m_adviseUpTo(0),
+      m_writeChunkOrdinal(0),
+      m_chunksSinceMarker(0),
+      m_dataEnd(0),
+      m_readAheadRunning(false),
+      m_readAheadExit(false),
+      m_prefetchBusy(false),
+      m_prefetchValid(false),
+      m_prefetchBufferMaxSize(0),
+      m_prefetchBuffer(NULL),
+      m_asyncWriteRunning(false),
+      m_asyncWriteExit(false),
+      m_writeBusy(false),
+      m_writeQueuedBytes(0),
+      m_writeBudget(0),
+      m_writeStallTicks(0),
+      m_writeStoredChunks(0),
+      m_writeBacklogPeak(0),
+      m_flushProfiling(false),
+      m_verifyChecksums(false),
+      m_journal(NULL),
+      m_journalMark(NULL),
+      m_journalBaseChunks(0),
+      m_journalSpliced(false),
+      m_readChunkCount(0)
 {
     size_t maxCompressedLength =
         snappy::MaxCompressedLength(SNAPPY_CHUNK_SIZE);
-    m_compressedCache = new char[maxCompressedLength];
+    m_compressedCache = (char *)os::allocHugePages(maxCompressedLength);
 }
 
 SnappyFile::~SnappyFile()
 {
     close();
-    delete [] m_compressedCache;
-    delete [] m_cache;
+    os::freeHugePages(m_prefetchBuffer, m_prefetchBufferMaxSize);
+    os::freeHugePages(m_compressedCache,
+                      snappy::MaxCompressedLength(SNAPPY_CHUNK_SIZE));
+    os::freeHugePages(m_cache, m_cacheMaxSize);
 }
 
 bool SnappyFile::rawOpen(const std::string &filename, File::Mode mode)
 {
+    m_fileName = filename;
+
+    if (mode == File::Read && mapOpen(filename)) {
+        // read the snappy file identifier straight from the mapping
+        assert(m_mapSize >= 2 &&
+               m_map[0] == SNAPPY_BYTE1 && m_map[1] == SNAPPY_BYTE2);
+        readIndexFooter();
+        m_verifyChecksums = m_chunkIndex.empty();
+        loadJournal(filename);
+        m_mapPos = 2;
+        flushReadCache();
+        return true;
+    }
+
     std::ios_base::openmode fmode = std::fstream::binary;
     if (mode == File::Write) {
         fmode |= (std::fstream::out | std::fstream::trunc);
@@ -168,11 +510,23 @@ bool SnappyFile::rawOpen(const std::string &filename, File::Mode mode)
         m_stream >> byte2;
         assert(byte1 == SNAPPY_BYTE1 && byte2 == SNAPPY_BYTE2);
 
+        m_dataEnd = m_endPos;
+        readIndexFooter();
+        m_verifyChecksums = m_chunkIndex.empty();
+        loadJournal(filename);
+        m_stream.seekg(2, std::ios::beg);
+
         flushReadCache();
     } else if (m_stream.is_open() && mode == File::Write) {
         // write the snappy file identifier
         m_stream << SNAPPY_BYTE1;
         m_stream << SNAPPY_BYTE2;
+
+        if (getenv("TRACE_SELF_PROFILE")) {
+            os::calibrateFastTime();
+            m_flushProfiling = true;
+            m_flushHist.reset();
+        }
     }
     return m_stream.is_open();
 }
@@ -189,7 +543,20 @@ bool SnappyFile::rawWrite(const void *buffer, size_t length)
     } else {
         size_t sizeToWrite = length;
 
+        /* Whole chunks of a large write can be compressed straight
+         * from the caller's buffer, sparing the cache copy.  Not when
+         * the bytes must outlive this call (async compressor thread)
+         * or be shadowed first (journal). */
+        bool direct = !m_asyncWriteRunning && !m_journal;
+
         while (sizeToWrite >= freeCacheSize()) {
+            if (direct && m_cachePtr == m_cache && sizeToWrite >= m_cacheSize) {
+                writeChunk((const char*)buffer + (length - sizeToWrite),
+                           m_cacheSize);
+                sizeToWrite -= m_cacheSize;
+                ++m_writeChunkOrdinal;
+                continue;
+            }
             size_t endSize = freeCacheSize();
             size_t offset = length - sizeToWrite;
             memcpy(m_cachePtr, (const char*)buffer + offset, endSize);
@@ -245,13 +612,505 @@ int SnappyFile::rawGetc()
     return c;
 }
 
+size_t SnappyFile::rawPeek(const char **ptr)
+{
+    if (freeCacheSize() == 0) {
+        if (endOfData()) {
+            return 0;
+        }
+        flushReadCache();
+    }
+    *ptr = m_cachePtr;
+    return freeCacheSize();
+}
+
+void SnappyFile::rawAdvance(size_t length)
+{
+    assert(length <= freeCacheSize());
+    m_cachePtr += length;
+}
+
+bool SnappyFile::mapOpen(const std::string &filename)
+{
+#ifndef _WIN32
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping outlives the file descriptor
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    m_map = (char *)map;
+    m_mapSize = st.st_size;
+    m_mapPos = 0;
+    m_adviseUpTo = 0;
+    m_dataEnd = m_mapSize;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SnappyFile::mapClose()
+{
+#ifndef _WIN32
+    if (m_map) {
+        ::munmap(m_map, m_mapSize);
+        m_map = NULL;
+        m_mapSize = 0;
+        m_mapPos = 0;
+    }
+#endif
+}
+
+/* Ask the kernel to start paging in the next stretch of the mapping.
+ * MADV_SEQUENTIAL (set in mapOpen) only scales up the kernel's own
+ * readahead, which on cold caches still falls behind the
+ * decompressor; an explicit WILLNEED window keeps the disk busy well
+ * ahead of the reader.  Re-issued once half the window has been
+ * consumed, so each call covers fresh pages only. */
+void SnappyFile::adviseLookahead()
+{
+    const size_t window = 16 * SNAPPY_CHUNK_SIZE;
+    if (m_mapPos + window / 2 < m_adviseUpTo) {
+        return;
+    }
+    size_t begin = m_mapPos > m_adviseUpTo ? m_mapPos : m_adviseUpTo;
+    size_t end = m_mapPos + window < m_dataEnd ? m_mapPos + window
+                                               : (size_t)m_dataEnd;
+    if (begin >= end) {
+        return;
+    }
+    os::adviseWillNeed(m_map + begin, end - begin);
+    m_adviseUpTo = end;
+}
+
+static inline void
+putU32(unsigned char *buf, uint32_t value)
+{
+    buf[0] = value & 0xff; value >>= 8;
+    buf[1] = value & 0xff; value >>= 8;
+    buf[2] = value & 0xff; value >>= 8;
+    buf[3] = value & 0xff;
+}
+
+static inline void
+putU64(unsigned char *buf, uint64_t value)
+{
+    putU32(buf, value & 0xffffffffU);
+    putU32(buf + 4, value >> 32);
+}
+
+static inline uint32_t
+getU32(const unsigned char *buf)
+{
+    return  (uint32_t)buf[0]        |
+           ((uint32_t)buf[1] <<  8) |
+           ((uint32_t)buf[2] << 16) |
+           ((uint32_t)buf[3] << 24);
+}
+
+static inline uint64_t
+getU64(const unsigned char *buf)
+{
+    return (uint64_t)getU32(buf) | ((uint64_t)getU32(buf + 4) << 32);
+}
+
+/* Split a chunk length word into the payload length, its codec, and
+ * whether a crc32 of the payload precedes it. */
+static inline size_t
+chunkPayloadLength(size_t lengthWord, bool &stored, bool &checksummed)
+{
+    stored = (lengthWord & SNAPPY_CHUNK_STORED_FLAG) != 0;
+    checksummed = (lengthWord & SNAPPY_CHUNK_CRC_FLAG) != 0;
+    return lengthWord & ~(size_t)SNAPPY_CHUNK_FLAGS;
+}
+
+static inline bool
+chunkIsMarker(size_t lengthWord)
+{
+    return (lengthWord & SNAPPY_CHUNK_MARKER_FLAG) != 0;
+}
+
+void SnappyFile::writeIndexFooter()
+{
+    if (m_chunkIndex.empty()) {
+        return;
+    }
+
+    if (!m_frameMarks.empty()) {
+        uint64_t footerPos = m_stream.tellp();
+        unsigned char fbuf[SNAPPY_FRAME_ENTRY_SIZE];
+        for (size_t i = 0; i < m_frameMarks.size(); ++i) {
+            const FrameInfo &info = m_frameMarks[i];
+            // boundaries at the very end of the data have no chunk of
+            // their own and resolve to where the footers begin
+            uint64_t chunkOffset = info.chunkOrdinal < m_chunkIndex.size()
+                                 ? m_chunkIndex[info.chunkOrdinal].offset
+                                 : footerPos;
+            putU64(fbuf, chunkOffset);
+            putU32(fbuf + 8, info.offsetInChunk);
+            putU64(fbuf + 12, info.firstCallNo);
+            m_stream.write((const char *)fbuf, sizeof fbuf);
+        }
+
+        unsigned char ftail[SNAPPY_FRAME_TAIL_SIZE];
+        putU64(ftail, m_frameMarks.size());
+        ftail[8] = SNAPPY_BYTE1;
+        ftail[9] = SNAPPY_BYTE2;
+        ftail[10] = SNAPPY_FRAME_BYTE1;
+        ftail[11] = SNAPPY_FRAME_BYTE2;
+        m_stream.write((const char *)ftail, sizeof ftail);
+    }
+
+    unsigned char buf[SNAPPY_INDEX_ENTRY_SIZE];
+    for (size_t i = 0; i < m_chunkIndex.size(); ++i) {
+        putU64(buf, m_chunkIndex[i].offset);
+        putU32(buf + 8, m_chunkIndex[i].uncompressedLength);
+        m_stream.write((const char *)buf, sizeof buf);
+    }
+
+    unsigned char tail[SNAPPY_INDEX_TAIL_SIZE];
+    putU64(tail, m_chunkIndex.size());
+    tail[8] = SNAPPY_BYTE1;
+    tail[9] = SNAPPY_BYTE2;
+    tail[10] = SNAPPY_INDEX_BYTE1;
+    tail[11] = SNAPPY_INDEX_BYTE2;
+    m_stream.write((const char *)tail, sizeof tail);
+}
+
+void SnappyFile::readAt(uint64_t pos, void *buffer, size_t length)
+{
+    if (m_map) {
+        memcpy(buffer, m_map + pos, length);
+    } else {
+        m_stream.clear();
+        m_stream.seekg(pos, std::ios::beg);
+        m_stream.read((char *)buffer, length);
+    }
+}
+
+bool SnappyFile::readIndexFooter()
+{
+    m_chunkIndex.clear();
+
+    uint64_t fileSize = m_map ? m_mapSize : (uint64_t)m_endPos;
+    if (fileSize < 2 + SNAPPY_INDEX_TAIL_SIZE) {
+        return false;
+    }
+
+    unsigned char tail[SNAPPY_INDEX_TAIL_SIZE];
+    readAt(fileSize - sizeof tail, tail, sizeof tail);
+    if (tail[8] != SNAPPY_BYTE1 ||
+        tail[9] != SNAPPY_BYTE2 ||
+        tail[10] != SNAPPY_INDEX_BYTE1 ||
+        tail[11] != SNAPPY_INDEX_BYTE2) {
+        // trace written before the index footer existed
+        return false;
+    }
+
+    uint64_t count = getU64(tail);
+    uint64_t footerSize = count * SNAPPY_INDEX_ENTRY_SIZE + sizeof tail;
+    if (count == 0 || footerSize > fileSize - 2) {
+        return false;
+    }
+
+    uint64_t footerStart = fileSize - footerSize;
+    m_chunkIndex.reserve(count);
+    uint64_t pos = footerStart;
+    for (uint64_t i = 0; i < count; ++i) {
+        unsigned char buf[SNAPPY_INDEX_ENTRY_SIZE];
+        readAt(pos, buf, sizeof buf);
+        pos += sizeof buf;
+
+        ChunkInfo info;
+        info.offset = getU64(buf);
+        info.uncompressedLength = getU32(buf + 8);
+        if (info.offset >= footerStart ||
+            (i && info.offset <= m_chunkIndex[i - 1].offset)) {
+            // corrupt index, fall back to sequential reading
+            m_chunkIndex.clear();
+            return false;
+        }
+        m_chunkIndex.push_back(info);
+    }
+
+    m_dataEnd = footerStart;
+
+    // optional frame index immediately before the chunk index
+    m_frameIndex.clear();
+    if (footerStart >= 2 + SNAPPY_FRAME_TAIL_SIZE) {
+        unsigned char ftail[SNAPPY_FRAME_TAIL_SIZE];
+        readAt(footerStart - sizeof ftail, ftail, sizeof ftail);
+        if (ftail[8] == SNAPPY_BYTE1 &&
+            ftail[9] == SNAPPY_BYTE2 &&
+            ftail[10] == SNAPPY_FRAME_BYTE1 &&
+            ftail[11] == SNAPPY_FRAME_BYTE2) {
+            uint64_t frameCount = getU64(ftail);
+            uint64_t frameFooterSize =
+                frameCount * SNAPPY_FRAME_ENTRY_SIZE + sizeof ftail;
+            if (frameCount && frameFooterSize <= footerStart - 2) {
+                uint64_t frameStart = footerStart - frameFooterSize;
+                m_frameIndex.reserve(frameCount);
+                pos = frameStart;
+                for (uint64_t i = 0; i < frameCount; ++i) {
+                    unsigned char fbuf[SNAPPY_FRAME_ENTRY_SIZE];
+                    readAt(pos, fbuf, sizeof fbuf);
+                    pos += sizeof fbuf;
+
+                    FrameIndexEntry entry;
+                    entry.start.chunk = getU64(fbuf);
+                    entry.start.offsetInChunk = getU32(fbuf + 8);
+                    entry.firstCallNo = getU64(fbuf + 12);
+                    if (entry.start.chunk > frameStart) {
+                        // corrupt frame index; the chunk index is
+                        // still usable
+                        m_frameIndex.clear();
+                        return true;
+                    }
+                    m_frameIndex.push_back(entry);
+                }
+                m_dataEnd = frameStart;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Index of the chunk starting at the given file offset. */
+size_t SnappyFile::chunkAt(uint64_t fileOffset) const
+{
+    assert(!m_chunkIndex.empty());
+    size_t lo = 0, hi = m_chunkIndex.size();
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (m_chunkIndex[mid].offset <= fileOffset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void SnappyFile::setReadAhead(bool enable)
+{
+    if (enable) {
+        if (!m_readAheadRunning && m_map && m_mode == File::Read) {
+            m_readAheadExit = false;
+            m_prefetchBusy = false;
+            m_prefetchValid = false;
+            m_readAheadThread = os::thread(readAheadThreadEntry, this);
+            m_readAheadRunning = true;
+
+            os::unique_lock<os::mutex> lock(m_readAheadMutex);
+            requestPrefetchLocked();
+        }
+    } else {
+        stopReadAhead();
+    }
+}
+
+void SnappyFile::stopReadAhead()
+{
+    if (m_readAheadRunning) {
+        {
+            os::unique_lock<os::mutex> lock(m_readAheadMutex);
+            m_readAheadExit = true;
+            m_readAheadRequest.signal();
+        }
+        m_readAheadThread.join();
+        m_readAheadRunning = false;
+        m_prefetchBusy = false;
+        m_prefetchValid = false;
+    }
+}
+
+void SnappyFile::readAheadThreadEntry(SnappyFile *file)
+{
+    file->readAheadLoop();
+}
+
+void SnappyFile::readAheadLoop()
+{
+    os::unique_lock<os::mutex> lock(m_readAheadMutex);
+    for (;;) {
+        while (!m_readAheadExit && !m_prefetchBusy) {
+            m_readAheadRequest.wait(lock);
+        }
+        if (m_readAheadExit) {
+            break;
+        }
+
+        uint64_t pos = m_prefetchPos;
+        /* The mapping is immutable, so the actual decompression can
+         * happen without the lock held. */
+        lock.unlock();
+        bool valid = prefetchChunk(pos);
+        lock.lock();
+
+        m_prefetchValid = valid;
+        m_prefetchBusy = false;
+        m_readAheadReady.signal();
+    }
+}
+
+/* Decompress the chunk at the given file offset into the prefetch
+ * buffer.  Runs on the read-ahead thread. */
+bool SnappyFile::prefetchChunk(uint64_t pos)
+{
+    bool stored, checksummed;
+    size_t compressedLength;
+    for (;;) {
+        if (pos >= m_dataEnd || m_dataEnd - pos < 4) {
+            return false;
+        }
+        size_t lengthWord = getU32((const unsigned char *)m_map + pos);
+        pos += 4;
+        compressedLength = chunkPayloadLength(lengthWord, stored, checksummed);
+        if (!chunkIsMarker(lengthWord)) {
+            break;
+        }
+        // recovery markers carry no trace bytes
+        pos += compressedLength;
+    }
+    uint32_t expectedCrc = 0;
+    if (checksummed) {
+        if (m_dataEnd - pos < 4) {
+            return false;
+        }
+        expectedCrc = getU32((const unsigned char *)m_map + pos);
+        pos += 4;
+    }
+    if (!compressedLength || compressedLength > m_dataEnd - pos) {
+        return false;
+    }
+
+    const char *compressed = m_map + pos;
+    if (checksummed && m_verifyChecksums &&
+        ::crc32(0L, (const Bytef *)compressed,
+                compressedLength) != expectedCrc) {
+        // fail the prefetch; the synchronous path re-reads and reports
+        return false;
+    }
+    size_t uncompressedLength;
+    if (stored) {
+        uncompressedLength = compressedLength;
+    } else if (!::snappy::GetUncompressedLength(compressed, compressedLength,
+                                                &uncompressedLength)) {
+        return false;
+    }
+
+    if (uncompressedLength > m_prefetchBufferMaxSize) {
+        os::freeHugePages(m_prefetchBuffer, m_prefetchBufferMaxSize);
+        m_prefetchBuffer = (char *)os::allocHugePages(uncompressedLength);
+        m_prefetchBufferMaxSize = uncompressedLength;
+    }
+
+    if (stored) {
+        memcpy(m_prefetchBuffer, compressed, compressedLength);
+    } else if (!::snappy::RawUncompress(compressed, compressedLength,
+                                        m_prefetchBuffer)) {
+        return false;
+    }
+
+    m_prefetchSize = uncompressedLength;
+    m_prefetchEnd = pos + compressedLength;
+    return true;
+}
+
+/* Adopt the prefetched chunk if it is the one we need next, handing
+ * our old buffer over for the following prefetch.  Returns false if
+ * the worker had nothing useful (e.g. after a seek). */
+bool SnappyFile::consumePrefetchedChunk()
+{
+    os::unique_lock<os::mutex> lock(m_readAheadMutex);
+    while (m_prefetchBusy) {
+        m_readAheadReady.wait(lock);
+    }
+
+    if (!m_prefetchValid || m_prefetchPos != m_mapPos) {
+        m_prefetchValid = false;
+        return false;
+    }
+
+    std::swap(m_cache, m_prefetchBuffer);
+    std::swap(m_cacheMaxSize, m_prefetchBufferMaxSize);
+    m_cacheSize = m_prefetchSize;
+    m_cachePtr = m_cache;
+    m_currentOffset.chunk = m_mapPos;
+    m_mapPos = m_prefetchEnd;
+    m_prefetchValid = false;
+    ++m_readChunkCount;
+
+    requestPrefetchLocked();
+    return true;
+}
+
+/* Ask the worker to decompress the chunk at the current file
+ * position.  Caller must hold m_readAheadMutex. */
+void SnappyFile::requestPrefetchLocked()
+{
+    if (m_prefetchBusy || m_mapPos >= m_dataEnd) {
+        return;
+    }
+    m_prefetchPos = m_mapPos;
+    m_prefetchValid = false;
+    m_prefetchBusy = true;
+    m_readAheadRequest.signal();
+}
+
 void SnappyFile::rawClose()
 {
+    stopReadAhead();
     if (m_mode == File::Write) {
         flushWriteCache();
+        stopAsyncWrite();
+        writeIndexFooter();
+        // everything made it into the trace; the journal has served
+        // its purpose
+        journalDiscard();
+
+        if (m_flushProfiling && m_flushHist.count()) {
+            double usScale = 1.0E6 / os::calibrateFastTime();
+            os::log("apitrace: self-profile: chunk flush: %llu flushes, "
+                    "p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, "
+                    "max %.1fus\n",
+                    (unsigned long long)m_flushHist.count(),
+                    m_flushHist.percentile(0.50) * usScale,
+                    m_flushHist.percentile(0.90) * usScale,
+                    m_flushHist.percentile(0.99) * usScale,
+                    m_flushHist.percentile(0.999) * usScale,
+                    m_flushHist.maximum() * usScale);
+            m_flushProfiling = false;
+        }
     }
+    mapClose();
+    m_chunkIndex.clear();
+    m_frameMarks.clear();
+    m_frameIndex.clear();
+    m_writeChunkOrdinal = 0;
+    m_chunksSinceMarker = 0;
+    m_journalTail.clear();
+    m_journalBaseChunks = 0;
+    m_journalSpliced = false;
+    m_readChunkCount = 0;
     m_stream.close();
-    delete [] m_cache;
+    os::freeHugePages(m_cache, m_cacheMaxSize);
     m_cache = NULL;
     m_cachePtr = NULL;
 }
@@ -260,6 +1119,7 @@ void SnappyFile::rawFlush()
 {
     assert(m_mode == File::Write);
     flushWriteCache();
+    drainAsyncWrite();
     m_stream.flush();
 }
 
@@ -268,34 +1128,669 @@ void SnappyFile::flushWriteCache()
     size_t inputLength = usedCacheSize();
 
     if (inputLength) {
-        size_t compressedLength;
+        long long flushStart = m_flushProfiling ? os::getTimeFast() : 0;
+        // make sure the journal covers everything the chunk will;
+        // from here until the compressor writes it out the bytes are
+        // only reachable through the exception flush
+        journalCommit();
 
-        ::snappy::RawCompress(m_cache, inputLength,
-                              m_compressedCache, &compressedLength);
+        if (m_asyncWriteRunning) {
+            os::unique_lock<os::mutex> lock(m_writeMutex);
+
+            // over budget: this is the only place capture stalls on
+            // the compressor, so it is worth accounting
+            if (m_writeQueuedBytes &&
+                m_writeQueuedBytes + inputLength > m_writeBudget) {
+                long long start = os::getTimeFast();
+                do {
+                    m_writeDone.wait(lock);
+                } while (m_writeQueuedBytes &&
+                         m_writeQueuedBytes + inputLength > m_writeBudget);
+                m_writeStallTicks += os::getTimeFast() - start;
+            }
 
-        writeCompressedLength(compressedLength);
-        m_stream.write(m_compressedCache, compressedLength);
+            PendingWrite pending;
+            pending.data = m_cache;
+            pending.length = inputLength;
+            pending.cap = m_cacheMaxSize;
+            // past the high-water mark, drop to the fastest codec
+            // (verbatim storage) so the backlog drains before the
+            // budget is hit
+            pending.store = m_writeQueuedBytes + inputLength >
+                            m_writeBudget / 2;
+            if (pending.store) {
+                ++m_writeStoredChunks;
+            }
+            m_writeQueue.push_back(pending);
+            m_writeQueuedBytes += inputLength;
+            if (m_writeQueuedBytes > m_writeBacklogPeak) {
+                m_writeBacklogPeak = m_writeQueuedBytes;
+            }
+
+            // keep filling a buffer the compressor is done with
+            if (!m_writeSpares.empty()) {
+                PendingWrite spare = m_writeSpares.back();
+                m_writeSpares.pop_back();
+                m_cache = spare.data;
+                m_cacheMaxSize = spare.cap;
+            } else {
+                m_cache = (char *)os::allocHugePages(m_cacheMaxSize);
+            }
+
+            m_writeRequest.signal();
+        } else {
+            writeChunk(m_cache, inputLength);
+        }
         m_cachePtr = m_cache;
+        ++m_writeChunkOrdinal;
+        journalReset();
+
+        if (m_flushProfiling) {
+            m_flushHist.record(os::getTimeFast() - flushStart);
+        }
     }
     assert(m_cachePtr == m_cache);
 }
 
+void SnappyFile::markFrameStart(uint64_t callNo)
+{
+    if (m_mode != File::Write || !m_isOpened) {
+        return;
+    }
+
+    FrameInfo info;
+    info.chunkOrdinal = m_writeChunkOrdinal;
+    info.offsetInChunk = usedCacheSize();
+    info.firstCallNo = callNo;
+    m_frameMarks.push_back(info);
+}
+
+bool SnappyFile::getFrameIndex(File::FrameIndex &index)
+{
+    if (m_mode != File::Read || m_frameIndex.empty()) {
+        return false;
+    }
+    index = m_frameIndex;
+    return true;
+}
+
+bool SnappyFile::extractPrefix(const char *fileName, const File::Offset &end)
+{
+    if (m_mode != File::Read) {
+        return false;
+    }
+
+    std::ofstream out(fileName, std::ofstream::binary | std::ofstream::trunc);
+    if (!out) {
+        return false;
+    }
+
+    /* The header and every chunk before the boundary are bit-exact in
+     * the output; copy the raw compressed bytes. */
+    {
+        std::vector<char> buffer(SNAPPY_CHUNK_SIZE);
+        uint64_t pos = 0;
+        while (pos < end.chunk) {
+            size_t length = buffer.size();
+            if (end.chunk - pos < (uint64_t)length) {
+                length = end.chunk - pos;
+            }
+            readAt(pos, &buffer[0], length);
+            out.write(&buffer[0], length);
+            pos += length;
+        }
+    }
+
+    /* Only the boundary chunk is re-encoded, cut at the requested
+     * uncompressed offset. */
+    uint32_t boundaryLength = end.offsetInChunk;
+    if (boundaryLength) {
+        unsigned char lenbuf[4];
+        readAt(end.chunk, lenbuf, sizeof lenbuf);
+        bool stored, checksummed;
+        size_t compressedLength = chunkPayloadLength(getU32(lenbuf), stored,
+                                                     checksummed);
+        if (!compressedLength) {
+            return false;
+        }
+
+        uint64_t payloadPos = end.chunk + sizeof lenbuf;
+        if (checksummed) {
+            payloadPos += 4;
+        }
+        std::vector<char> compressed(compressedLength);
+        readAt(payloadPos, &compressed[0], compressedLength);
+
+        size_t uncompressedLength = 0;
+        if (stored) {
+            uncompressedLength = compressedLength;
+        } else if (!::snappy::GetUncompressedLength(&compressed[0],
+                                                    compressedLength,
+                                                    &uncompressedLength)) {
+            return false;
+        }
+        if (boundaryLength > uncompressedLength) {
+            return false;
+        }
+
+        std::vector<char> uncompressed(uncompressedLength);
+        if (stored) {
+            memcpy(&uncompressed[0], &compressed[0], compressedLength);
+        } else if (!::snappy::RawUncompress(&compressed[0], compressedLength,
+                                            &uncompressed[0])) {
+            return false;
+        }
+
+        std::string recompressed;
+        ::snappy::Compress(&uncompressed[0], boundaryLength, &recompressed);
+
+        putU32(lenbuf, recompressed.size() | SNAPPY_CHUNK_CRC_FLAG);
+        out.write((const char *)lenbuf, sizeof lenbuf);
+        unsigned char crcbuf[4];
+        putU32(crcbuf, ::crc32(0L, (const Bytef *)recompressed.data(),
+                               recompressed.size()));
+        out.write((const char *)crcbuf, sizeof crcbuf);
+        out.write(recompressed.data(), recompressed.size());
+    }
+
+    /* Rebuild the footers for the prefix.  Call numbers and chunk
+     * offsets are unchanged by prefix extraction, so the entries can
+     * be reused as they are. */
+    if (!m_chunkIndex.empty()) {
+        size_t numFrames = 0;
+        while (numFrames < m_frameIndex.size() &&
+               m_frameIndex[numFrames].start < end) {
+            ++numFrames;
+        }
+        if (numFrames) {
+            unsigned char fbuf[SNAPPY_FRAME_ENTRY_SIZE];
+            for (size_t i = 0; i < numFrames; ++i) {
+                const FrameIndexEntry &entry = m_frameIndex[i];
+                putU64(fbuf, entry.start.chunk);
+                putU32(fbuf + 8, entry.start.offsetInChunk);
+                putU64(fbuf + 12, entry.firstCallNo);
+                out.write((const char *)fbuf, sizeof fbuf);
+            }
+
+            unsigned char ftail[SNAPPY_FRAME_TAIL_SIZE];
+            putU64(ftail, numFrames);
+            ftail[8] = SNAPPY_BYTE1;
+            ftail[9] = SNAPPY_BYTE2;
+            ftail[10] = SNAPPY_FRAME_BYTE1;
+            ftail[11] = SNAPPY_FRAME_BYTE2;
+            out.write((const char *)ftail, sizeof ftail);
+        }
+
+        uint64_t numChunks = 0;
+        unsigned char buf[SNAPPY_INDEX_ENTRY_SIZE];
+        for (size_t i = 0; i < m_chunkIndex.size() &&
+                           m_chunkIndex[i].offset < end.chunk; ++i) {
+            putU64(buf, m_chunkIndex[i].offset);
+            putU32(buf + 8, m_chunkIndex[i].uncompressedLength);
+            out.write((const char *)buf, sizeof buf);
+            ++numChunks;
+        }
+        if (boundaryLength) {
+            putU64(buf, end.chunk);
+            putU32(buf + 8, boundaryLength);
+            out.write((const char *)buf, sizeof buf);
+            ++numChunks;
+        }
+
+        unsigned char tail[SNAPPY_INDEX_TAIL_SIZE];
+        putU64(tail, numChunks);
+        tail[8] = SNAPPY_BYTE1;
+        tail[9] = SNAPPY_BYTE2;
+        tail[10] = SNAPPY_INDEX_BYTE1;
+        tail[11] = SNAPPY_INDEX_BYTE2;
+        out.write((const char *)tail, sizeof tail);
+    }
+
+    return out.good();
+}
+
+/* Compress a chunk and append it to the stream.  In async mode this
+ * runs on the compressor thread. */
+void SnappyFile::writeChunk(const char *data, size_t length, bool forceStore)
+{
+    /* Leave a self-describing breadcrumb every so many chunks, so
+     * that repairing a truncated trace only has to checksum the bytes
+     * behind the last one (see File::repairSnappy). */
+    if (++m_chunksSinceMarker >= SNAPPY_MARKER_INTERVAL) {
+        writeRecoveryMarker();
+        m_chunksSinceMarker = 0;
+    }
+
+    /* When snappy achieves next to nothing (~1:1) the compression was
+     * wasted work on the write side and buys decompression work on
+     * every future read; store such chunks verbatim instead.  The
+     * same stored representation doubles as the backpressure fallback
+     * (forceStore), which skips the compression attempt altogether. */
+    const char *payload = m_compressedCache;
+    size_t compressedLength = 0;
+    size_t lengthWord = 0;
+    if (!forceStore) {
+        ::snappy::RawCompress(data, length,
+                              m_compressedCache, &compressedLength);
+        lengthWord = compressedLength;
+    }
+    if (forceStore || compressedLength >= length - length / 64) {
+        payload = data;
+        compressedLength = length;
+        lengthWord = length | SNAPPY_CHUNK_STORED_FLAG;
+    }
+
+    ChunkInfo info;
+    info.offset = m_stream.tellp();
+    info.uncompressedLength = length;
+    m_chunkIndex.push_back(info);
+
+    /* The checksum covers the compressed payload, so verification and
+     * repair never need to decompress anything. */
+    unsigned char crcbuf[4];
+    putU32(crcbuf, ::crc32(0L, (const Bytef *)payload, compressedLength));
+
+    writeCompressedLength(lengthWord | SNAPPY_CHUNK_CRC_FLAG);
+    m_stream.write((const char *)crcbuf, sizeof crcbuf);
+    m_stream.write(payload, compressedLength);
+}
+
+void SnappyFile::writeRecoveryMarker()
+{
+    unsigned char buf[4 + SNAPPY_MARKER_PAYLOAD_SIZE];
+    putU32(buf, SNAPPY_CHUNK_MARKER_FLAG | SNAPPY_MARKER_PAYLOAD_SIZE);
+    buf[4] = SNAPPY_BYTE1;
+    buf[5] = SNAPPY_BYTE2;
+    buf[6] = SNAPPY_MARKER_BYTE1;
+    buf[7] = SNAPPY_MARKER_BYTE2;
+    putU64(buf + 8, m_chunkIndex.size());
+    putU64(buf + 16, (uint64_t)m_stream.tellp());
+    putU32(buf + 24,
+           ::crc32(0L, (const Bytef *)buf + 4, SNAPPY_MARKER_PAYLOAD_SIZE - 4));
+    m_stream.write((const char *)buf, sizeof buf);
+}
+
+void SnappyFile::setAsyncWrite(bool enable)
+{
+    if (enable) {
+        if (!m_asyncWriteRunning && m_mode == File::Write && m_isOpened) {
+            // in-memory backlog budget; the traced application only
+            // stalls once this much data is queued for compression
+            m_writeBudget = 16 * 1024 * 1024;
+            const char *budget = getenv("TRACE_WRITE_BUDGET_MB");
+            if (budget && atoi(budget) > 0) {
+                m_writeBudget = (size_t)atoi(budget) * 1024 * 1024;
+            }
+            m_writeQueuedBytes = 0;
+            m_writeStallTicks = 0;
+            m_writeStoredChunks = 0;
+            m_writeBacklogPeak = 0;
+            m_asyncWriteExit = false;
+            m_writeBusy = false;
+            m_writeThread = os::thread(asyncWriteThreadEntry, this);
+            m_asyncWriteRunning = true;
+        }
+    } else {
+        if (m_asyncWriteRunning) {
+            flushWriteCache();
+            stopAsyncWrite();
+        }
+    }
+}
+
+void SnappyFile::asyncWriteThreadEntry(SnappyFile *file)
+{
+    file->asyncWriteLoop();
+}
+
+void SnappyFile::asyncWriteLoop()
+{
+    os::unique_lock<os::mutex> lock(m_writeMutex);
+    for (;;) {
+        while (!m_asyncWriteExit && m_writeQueue.empty()) {
+            m_writeRequest.wait(lock);
+        }
+        if (m_writeQueue.empty()) {
+            // exit requested and nothing pending
+            break;
+        }
+
+        PendingWrite pending = m_writeQueue.front();
+        m_writeQueue.erase(m_writeQueue.begin());
+        m_writeBusy = true;
+
+        /* The buffer is ours until it goes on the spare list, so the
+         * compression and write need not hold the lock. */
+        lock.unlock();
+        writeChunk(pending.data, pending.length, pending.store);
+        lock.lock();
+
+        m_writeBusy = false;
+        m_writeQueuedBytes -= pending.length;
+        m_writeSpares.push_back(pending);
+        m_writeDone.signal();
+    }
+}
+
+/* Wait until the compressor thread has no chunk in flight. */
+void SnappyFile::drainAsyncWrite()
+{
+    if (m_asyncWriteRunning) {
+        os::unique_lock<os::mutex> lock(m_writeMutex);
+        while (!m_writeQueue.empty() || m_writeBusy) {
+            m_writeDone.wait(lock);
+        }
+    }
+}
+
+void SnappyFile::stopAsyncWrite()
+{
+    if (m_asyncWriteRunning) {
+        {
+            os::unique_lock<os::mutex> lock(m_writeMutex);
+            m_asyncWriteExit = true;
+            m_writeRequest.signal();
+        }
+        m_writeThread.join();
+        m_asyncWriteRunning = false;
+        m_asyncWriteExit = false;
+
+        for (size_t i = 0; i < m_writeSpares.size(); ++i) {
+            os::freeHugePages(m_writeSpares[i].data, m_writeSpares[i].cap);
+        }
+        m_writeSpares.clear();
+        assert(m_writeQueue.empty());
+        assert(m_writeQueuedBytes == 0);
+
+        if (m_writeStallTicks) {
+            double scale = 1.0 / os::calibrateFastTime();
+            os::log("apitrace: warning: capture stalled %.3fs on trace "
+                    "compression (peak backlog %.1f MB, %llu chunks stored "
+                    "uncompressed); raise TRACE_WRITE_BUDGET_MB to trade "
+                    "memory for latency\n",
+                    m_writeStallTicks * scale,
+                    m_writeBacklogPeak / (1024.0 * 1024.0),
+                    (unsigned long long)m_writeStoredChunks);
+        }
+    }
+}
+
+void SnappyFile::setJournal(bool enable)
+{
+    if (m_mode != File::Write || !m_isOpened) {
+        return;
+    }
+
+    if (enable && !m_journal) {
+        m_journalPath = m_fileName + ".journal";
+        m_journal = fopen(m_journalPath.c_str(), "wb");
+        if (m_journal) {
+            // unbuffered, so commits go straight to the OS and
+            // survive the process dying
+            setvbuf(m_journal, NULL, _IONBF, 0);
+            journalWriteHeader();
+            m_journalMark = m_cachePtr;
+        }
+    } else if (!enable && m_journal) {
+        journalDiscard();
+    }
+}
+
+void SnappyFile::journalWriteHeader()
+{
+    unsigned char header[SNAPPY_JOURNAL_HEADER_SIZE];
+    header[0] = SNAPPY_BYTE1;
+    header[1] = SNAPPY_BYTE2;
+    header[2] = 'j';
+    header[3] = 'l';
+    putU64(header + 4, m_writeChunkOrdinal);
+    fwrite(header, 1, sizeof header, m_journal);
+}
+
+void SnappyFile::journalCommit(void)
+{
+    if (!m_journal) {
+        return;
+    }
+    size_t length = m_cachePtr - m_journalMark;
+    if (length) {
+        fwrite(m_journalMark, 1, length, m_journal);
+        m_journalMark = m_cachePtr;
+    }
+}
+
+/* The bytes just handed to the compressor are covered by the chunk
+ * from now on; restart the journal for the next chunk. */
+void SnappyFile::journalReset()
+{
+    if (!m_journal) {
+        return;
+    }
+    m_journal = freopen(m_journalPath.c_str(), "wb", m_journal);
+    if (m_journal) {
+        setvbuf(m_journal, NULL, _IONBF, 0);
+        journalWriteHeader();
+    }
+    m_journalMark = m_cache;
+}
+
+void SnappyFile::journalDiscard()
+{
+    if (m_journal) {
+        fclose(m_journal);
+        m_journal = NULL;
+        remove(m_journalPath.c_str());
+    }
+    m_journalMark = NULL;
+}
+
+void SnappyFile::loadJournal(const std::string &filename)
+{
+    std::string path = filename + ".journal";
+    FILE *journal = fopen(path.c_str(), "rb");
+    if (!journal) {
+        return;
+    }
+
+    unsigned char header[SNAPPY_JOURNAL_HEADER_SIZE];
+    if (fread(header, 1, sizeof header, journal) == sizeof header &&
+        header[0] == SNAPPY_BYTE1 && header[1] == SNAPPY_BYTE2 &&
+        header[2] == 'j' && header[3] == 'l') {
+        m_journalBaseChunks = getU64(header + 4);
+        for (;;) {
+            char buf[4096];
+            size_t got = fread(buf, 1, sizeof buf, journal);
+            if (!got) {
+                break;
+            }
+            m_journalTail.insert(m_journalTail.end(), buf, buf + got);
+        }
+        if (!m_journalTail.empty()) {
+            os::log("apitrace: warning: %s: recovering %lu journaled bytes "
+                    "from an unclean capture\n",
+                    filename.c_str(), (unsigned long)m_journalTail.size());
+        }
+    }
+
+    fclose(journal);
+}
+
+/* Serve the journaled tail as one final, uncompressed chunk once all
+ * real chunks have been consumed. */
+bool SnappyFile::spliceJournalTail()
+{
+    if (m_journalSpliced || m_journalTail.empty() ||
+        m_readChunkCount != m_journalBaseChunks) {
+        return false;
+    }
+
+    m_currentOffset.chunk = m_dataEnd;
+    createCache(m_journalTail.size());
+    memcpy(m_cache, &m_journalTail[0], m_journalTail.size());
+    m_journalSpliced = true;
+    return true;
+}
+
 void SnappyFile::flushReadCache(size_t skipLength)
 {
     //assert(m_cachePtr == m_cache + m_cacheSize);
-    m_currentOffset.chunk = m_stream.tellg();
-    size_t compressedLength;
-    compressedLength = readCompressedLength();
+    if (m_map) {
+        adviseLookahead();
+
+        if (m_readAheadRunning && skipLength == 0 &&
+            consumePrefetchedChunk()) {
+            return;
+        }
+
+        bool stored, checksummed;
+        size_t lengthWord;
+        for (;;) {
+            m_currentOffset.chunk = m_mapPos;
+            lengthWord = readCompressedLength();
+            if (!chunkIsMarker(lengthWord)) {
+                break;
+            }
+            // recovery markers carry no trace bytes
+            size_t skip = chunkPayloadLength(lengthWord, stored, checksummed);
+            m_mapPos = skip < m_dataEnd - m_mapPos ? m_mapPos + skip
+                                                   : m_dataEnd;
+        }
+        size_t compressedLength = chunkPayloadLength(lengthWord, stored,
+                                                     checksummed);
+        uint32_t expectedCrc = 0;
+        if (compressedLength && checksummed) {
+            if (m_dataEnd - m_mapPos < 4) {
+                compressedLength = 0;
+            } else {
+                expectedCrc = getU32((const unsigned char *)m_map + m_mapPos);
+                m_mapPos += 4;
+            }
+        }
+        if (compressedLength > m_dataEnd - m_mapPos) {
+            // truncated chunk
+            compressedLength = 0;
+            m_mapPos = m_dataEnd;
+        }
+        if (compressedLength && checksummed && m_verifyChecksums &&
+            ::crc32(0L, (const Bytef *)(m_map + m_mapPos),
+                    compressedLength) != expectedCrc) {
+            os::log("apitrace: warning: %s: bad chunk checksum at offset "
+                    "%llu; treating as end of trace (see apitrace repair)\n",
+                    m_fileName.c_str(),
+                    (unsigned long long)m_currentOffset.chunk);
+            compressedLength = 0;
+            m_mapPos = m_dataEnd;
+        }
+
+        if (compressedLength) {
+            // decompress straight out of the mapping, no intermediate copy
+            const char *compressed = m_map + m_mapPos;
+            m_mapPos += compressedLength;
+            if (stored) {
+                m_cacheSize = compressedLength;
+            } else {
+                ::snappy::GetUncompressedLength(compressed, compressedLength,
+                                                &m_cacheSize);
+            }
+            createCache(m_cacheSize);
+            if (skipLength < m_cacheSize) {
+                if (stored) {
+                    memcpy(m_cache, compressed, compressedLength);
+                } else if (!::snappy::RawUncompress(compressed,
+                                                    compressedLength,
+                                                    m_cache)) {
+                    os::log("apitrace: warning: %s: corrupt chunk at "
+                            "offset %llu; treating as end of trace (see "
+                            "apitrace repair)\n",
+                            m_fileName.c_str(),
+                            (unsigned long long)m_currentOffset.chunk);
+                    m_mapPos = m_dataEnd;
+                    createCache(0);
+                    return;
+                }
+            }
+            ++m_readChunkCount;
+        } else if (spliceJournalTail()) {
+            return;
+        } else {
+            createCache(0);
+        }
+
+        if (m_readAheadRunning) {
+            // start decompressing the chunk after this one
+            os::unique_lock<os::mutex> lock(m_readAheadMutex);
+            requestPrefetchLocked();
+        }
+        return;
+    }
+
+    bool stored, checksummed;
+    size_t lengthWord;
+    for (;;) {
+        m_currentOffset.chunk = m_stream.tellg();
+        lengthWord = readCompressedLength();
+        if (!chunkIsMarker(lengthWord)) {
+            break;
+        }
+        // recovery markers carry no trace bytes
+        m_stream.seekg(chunkPayloadLength(lengthWord, stored, checksummed),
+                       std::ios::cur);
+    }
+    size_t compressedLength = chunkPayloadLength(lengthWord, stored,
+                                                 checksummed);
+    uint32_t expectedCrc = 0;
+    if (compressedLength && checksummed) {
+        unsigned char crcbuf[4];
+        m_stream.read((char *)crcbuf, sizeof crcbuf);
+        if (m_stream.fail()) {
+            compressedLength = 0;
+        } else {
+            expectedCrc = getU32(crcbuf);
+        }
+    }
 
     if (compressedLength) {
-        m_stream.read((char*)m_compressedCache, compressedLength);
-        ::snappy::GetUncompressedLength(m_compressedCache, compressedLength,
-                                        &m_cacheSize);
-        createCache(m_cacheSize);
-        if (skipLength < m_cacheSize) {
-            ::snappy::RawUncompress(m_compressedCache, compressedLength,
-                                    m_cache);
+        const char *payload;
+        if (stored) {
+            m_cacheSize = compressedLength;
+            createCache(m_cacheSize);
+            m_stream.read(m_cache, compressedLength);
+            payload = m_cache;
+        } else {
+            m_stream.read((char*)m_compressedCache, compressedLength);
+            payload = m_compressedCache;
+        }
+        if (checksummed && m_verifyChecksums &&
+            ::crc32(0L, (const Bytef *)payload,
+                    compressedLength) != expectedCrc) {
+            os::log("apitrace: warning: %s: bad chunk checksum at offset "
+                    "%llu; treating as end of trace (see apitrace repair)\n",
+                    m_fileName.c_str(),
+                    (unsigned long long)m_currentOffset.chunk);
+            if (!spliceJournalTail()) {
+                createCache(0);
+            }
+            return;
+        }
+        if (!stored) {
+            ::snappy::GetUncompressedLength(m_compressedCache, compressedLength,
+                                            &m_cacheSize);
+            createCache(m_cacheSize);
+            if (skipLength < m_cacheSize &&
+                !::snappy::RawUncompress(m_compressedCache, compressedLength,
+                                         m_cache)) {
+                os::log("apitrace: warning: %s: corrupt chunk at offset "
+                        "%llu; treating as end of trace (see apitrace "
+                        "repair)\n",
+                        m_fileName.c_str(),
+                        (unsigned long long)m_currentOffset.chunk);
+                createCache(0);
+                return;
+            }
         }
+        ++m_readChunkCount;
+    } else if (spliceJournalTail()) {
+        return;
     } else {
         createCache(0);
     }
@@ -304,12 +1799,8 @@ void SnappyFile::flushReadCache(size_t skipLength)
 void SnappyFile::createCache(size_t size)
 {
     if (size > m_cacheMaxSize) {
-        do {
-            m_cacheMaxSize <<= 1;
-        } while (size > m_cacheMaxSize);
-
-        delete [] m_cache;
-        m_cache = new char[size];
+        os::freeHugePages(m_cache, m_cacheMaxSize);
+        m_cache = (char *)os::allocHugePages(size);
         m_cacheMaxSize = size;
     }
 
@@ -332,6 +1823,23 @@ size_t SnappyFile::readCompressedLength()
 {
     unsigned char buf[4];
     size_t length;
+    if (m_map) {
+        if (m_mapPos >= m_dataEnd || sizeof buf > m_dataEnd - m_mapPos) {
+            m_mapPos = m_dataEnd;
+            return 0;
+        }
+        memcpy(buf, m_map + m_mapPos, sizeof buf);
+        m_mapPos += sizeof buf;
+        length  =  (size_t)buf[0];
+        length |= ((size_t)buf[1] <<  8);
+        length |= ((size_t)buf[2] << 16);
+        length |= ((size_t)buf[3] << 24);
+        return length;
+    }
+    if (m_dataEnd && (uint64_t)m_stream.tellg() >= m_dataEnd) {
+        // don't interpret the index footer as a chunk
+        return 0;
+    }
     m_stream.read((char *)buf, sizeof buf);
     if (m_stream.fail()) {
         length = 0;
@@ -357,16 +1865,32 @@ File::Offset SnappyFile::currentOffset()
 
 void SnappyFile::setCurrentOffset(const File::Offset &offset)
 {
-    // to remove eof bit
-    m_stream.clear();
-    // seek to the start of a chunk
-    m_stream.seekg(offset.chunk, std::ios::beg);
-    // load the chunk
-    flushReadCache();
-    assert(m_cacheSize >= offset.offsetInChunk);
+    if (!m_chunkIndex.empty()) {
+        // the index knows every chunk boundary
+        assert(m_chunkIndex[chunkAt(offset.chunk)].offset == offset.chunk);
+    }
+
+    if (m_map) {
+        // seek to the start of a chunk
+        m_mapPos = offset.chunk;
+        // load the chunk
+        flushReadCache();
+    } else {
+        // to remove eof bit
+        m_stream.clear();
+        // seek to the start of a chunk
+        m_stream.seekg(offset.chunk, std::ios::beg);
+        // load the chunk
+        flushReadCache();
+    }
+    if (m_cacheSize < offset.offsetInChunk) {
+        // the chunk failed its checksum (already reported); surface
+        // end of data rather than bytes that were never there
+        createCache(0);
+        return;
+    }
     // seek within our cache to the correct location within the chunk
     m_cachePtr = m_cache + offset.offsetInChunk;
-
 }
 
 bool SnappyFile::rawSkip(size_t length)
@@ -377,6 +1901,30 @@ bool SnappyFile::rawSkip(size_t length)
 
     if (freeCacheSize() >= length) {
         m_cachePtr += length;
+    } else if (!m_chunkIndex.empty()) {
+        // use the chunk index to step over whole chunks without
+        // reading or decompressing them
+        uint64_t sizeToSkip = length - freeCacheSize();
+        size_t i = chunkAt(m_currentOffset.chunk) + 1;
+        while (i < m_chunkIndex.size() &&
+               sizeToSkip >= m_chunkIndex[i].uncompressedLength) {
+            sizeToSkip -= m_chunkIndex[i].uncompressedLength;
+            ++i;
+        }
+        if (i >= m_chunkIndex.size()) {
+            // skipped past the end of the trace
+            if (m_map) {
+                m_mapPos = m_dataEnd;
+            } else {
+                m_stream.clear();
+                m_stream.seekg(m_dataEnd, std::ios::beg);
+            }
+            m_currentOffset.chunk = m_dataEnd;
+            createCache(0);
+        } else {
+            setCurrentOffset(File::Offset(m_chunkIndex[i].offset,
+                                          sizeToSkip));
+        }
     } else {
         size_t sizeToRead = length;
         while (sizeToRead) {
@@ -397,6 +1945,9 @@ bool SnappyFile::rawSkip(size_t length)
 
 int SnappyFile::rawPercentRead()
 {
+    if (m_map) {
+        return 100 * (double(m_mapPos) / double(m_mapSize));
+    }
     return 100 * (double(m_stream.tellg()) / double(m_endPos));
 }
 
@@ -404,3 +1955,358 @@ int SnappyFile::rawPercentRead()
 File* File::createSnappy(void) {
     return new SnappyFile;
 }
+
+
+/* Format-level helpers for File::repairSnappy, which works on the raw
+ * bytes rather than through a SnappyFile: the damaged file may
+ * violate the invariants the reader asserts. */
+
+struct RepairChunkInfo {
+    uint64_t offset;             /* of the chunk's length word */
+    uint64_t payload;            /* of the compressed bytes */
+    size_t compressedLength;
+    uint32_t uncompressedLength;
+    uint32_t crc;
+    bool checksummed;
+};
+
+static bool
+repairReadAt(std::ifstream &stream, uint64_t pos, void *buffer, size_t length)
+{
+    stream.clear();
+    stream.seekg(pos, std::ios::beg);
+    stream.read((char *)buffer, length);
+    return !stream.fail();
+}
+
+static bool
+repairTruncate(const char *fileName, uint64_t length)
+{
+#ifdef _WIN32
+    int fd = _open(fileName, _O_RDWR | _O_BINARY);
+    if (fd < 0) {
+        return false;
+    }
+    int err = _chsize_s(fd, length);
+    _close(fd);
+    return err == 0;
+#else
+    return ::truncate(fileName, (off_t)length) == 0;
+#endif
+}
+
+File::RepairResult
+File::repairSnappy(const char *fileName, bool verifyAll, bool dryRun,
+                   std::ostream &report)
+{
+    std::ifstream stream(fileName, std::ifstream::binary);
+    if (!stream) {
+        report << fileName << ": error: failed to open\n";
+        return REPAIR_FAILED;
+    }
+    stream.seekg(0, std::ios::end);
+    uint64_t fileSize = stream.tellg();
+
+    unsigned char id[2];
+    if (fileSize < 2 || !repairReadAt(stream, 0, id, sizeof id) ||
+        id[0] != SNAPPY_BYTE1 || id[1] != SNAPPY_BYTE2) {
+        report << fileName << ": error: not a snappy trace\n";
+        return REPAIR_FAILED;
+    }
+
+    /* An existing index footer bounds the data region, but the walk
+     * below is what decides which chunks are actually intact. */
+    uint64_t dataEnd = fileSize;
+    uint64_t footerChunks = 0;
+    bool haveFooter = false;
+    if (fileSize >= 2 + SNAPPY_INDEX_TAIL_SIZE) {
+        unsigned char tail[SNAPPY_INDEX_TAIL_SIZE];
+        repairReadAt(stream, fileSize - sizeof tail, tail, sizeof tail);
+        if (tail[8] == SNAPPY_BYTE1 &&
+            tail[9] == SNAPPY_BYTE2 &&
+            tail[10] == SNAPPY_INDEX_BYTE1 &&
+            tail[11] == SNAPPY_INDEX_BYTE2) {
+            uint64_t count = getU64(tail);
+            uint64_t footerSize =
+                count * SNAPPY_INDEX_ENTRY_SIZE + sizeof tail;
+            if (count && footerSize <= fileSize - 2) {
+                haveFooter = true;
+                footerChunks = count;
+                dataEnd = fileSize - footerSize;
+
+                // optional frame index immediately before the chunk index
+                if (dataEnd >= 2 + SNAPPY_FRAME_TAIL_SIZE) {
+                    unsigned char ftail[SNAPPY_FRAME_TAIL_SIZE];
+                    repairReadAt(stream, dataEnd - sizeof ftail, ftail,
+                                 sizeof ftail);
+                    if (ftail[8] == SNAPPY_BYTE1 &&
+                        ftail[9] == SNAPPY_BYTE2 &&
+                        ftail[10] == SNAPPY_FRAME_BYTE1 &&
+                        ftail[11] == SNAPPY_FRAME_BYTE2) {
+                        uint64_t frameCount = getU64(ftail);
+                        uint64_t frameFooterSize =
+                            frameCount * SNAPPY_FRAME_ENTRY_SIZE +
+                            sizeof ftail;
+                        if (frameCount && frameFooterSize <= dataEnd - 2) {
+                            dataEnd -= frameFooterSize;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* Walk the chunk headers.  This only seeks and reads a few bytes
+     * per chunk, so it is I/O-latency-bound, not bandwidth-bound. */
+    size_t maxPayload = ::snappy::MaxCompressedLength(SNAPPY_CHUNK_SIZE);
+    std::vector<RepairChunkInfo> chunks;
+    uint64_t pos = 2;
+    uint64_t validEnd = 2;
+    uint64_t verifyFrom = 2;
+    bool damaged = false;
+
+    while (pos < dataEnd) {
+        if (dataEnd - pos < 4) {
+            damaged = true;
+            break;
+        }
+        unsigned char lenbuf[4];
+        repairReadAt(stream, pos, lenbuf, sizeof lenbuf);
+        size_t lengthWord = getU32(lenbuf);
+        bool stored, checksummed;
+        size_t payloadLength = chunkPayloadLength(lengthWord, stored,
+                                                  checksummed);
+
+        if (chunkIsMarker(lengthWord)) {
+            unsigned char mbuf[SNAPPY_MARKER_PAYLOAD_SIZE];
+            if (payloadLength != SNAPPY_MARKER_PAYLOAD_SIZE ||
+                payloadLength > dataEnd - pos - 4 ||
+                !repairReadAt(stream, pos + 4, mbuf, sizeof mbuf) ||
+                mbuf[0] != SNAPPY_BYTE1 ||
+                mbuf[1] != SNAPPY_BYTE2 ||
+                mbuf[2] != SNAPPY_MARKER_BYTE1 ||
+                mbuf[3] != SNAPPY_MARKER_BYTE2 ||
+                getU64(mbuf + 4) != chunks.size() ||
+                getU64(mbuf + 12) != pos ||
+                getU32(mbuf + 20) != ::crc32(0L, (const Bytef *)mbuf,
+                                             SNAPPY_MARKER_PAYLOAD_SIZE - 4)) {
+                damaged = true;
+                break;
+            }
+            pos += 4 + payloadLength;
+            validEnd = pos;
+            /* Everything before a valid marker was written out whole;
+             * only the tail behind the last one needs its checksums
+             * confirmed (unless verifyAll). */
+            verifyFrom = pos;
+            continue;
+        }
+
+        RepairChunkInfo info;
+        info.offset = pos;
+        info.checksummed = checksummed;
+        info.crc = 0;
+        pos += 4;
+        if (checksummed) {
+            unsigned char crcbuf[4];
+            if (dataEnd - pos < 4 ||
+                !repairReadAt(stream, pos, crcbuf, sizeof crcbuf)) {
+                damaged = true;
+                break;
+            }
+            info.crc = getU32(crcbuf);
+            pos += 4;
+        }
+        if (!payloadLength || payloadLength > dataEnd - pos ||
+            payloadLength > maxPayload) {
+            damaged = true;
+            break;
+        }
+        info.payload = pos;
+        info.compressedLength = payloadLength;
+        if (stored) {
+            info.uncompressedLength = payloadLength;
+        } else {
+            // the uncompressed length varint leads the payload
+            char head[16];
+            size_t headLength = payloadLength < sizeof head ? payloadLength
+                                                            : sizeof head;
+            size_t uncompressedLength;
+            if (!repairReadAt(stream, pos, head, headLength) ||
+                !::snappy::GetUncompressedLength(head, headLength,
+                                                 &uncompressedLength)) {
+                damaged = true;
+                break;
+            }
+            info.uncompressedLength = uncompressedLength;
+        }
+        chunks.push_back(info);
+        pos += payloadLength;
+        validEnd = pos;
+    }
+
+    /* Confirm the checksums of the chunks past the last marker (or
+     * all of them); the first failure cuts the trace there, since the
+     * record stream cannot be decoded across a lost chunk. */
+    if (verifyAll) {
+        verifyFrom = 2;
+    }
+    uint64_t verified = 0;
+    std::vector<char> buffer;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const RepairChunkInfo &info = chunks[i];
+        if (info.offset < verifyFrom || !info.checksummed) {
+            continue;
+        }
+        buffer.resize(info.compressedLength);
+        if (!repairReadAt(stream, info.payload, &buffer[0],
+                          info.compressedLength) ||
+            ::crc32(0L, (const Bytef *)&buffer[0],
+                    info.compressedLength) != info.crc) {
+            report << fileName << ": bad chunk checksum at offset "
+                   << info.offset << "\n";
+            damaged = true;
+            validEnd = info.offset;
+            chunks.resize(i);
+            break;
+        }
+        ++verified;
+    }
+
+    /* A leftover journal whose chunk count matches the intact chunks
+     * holds the records that never made it through the compressor. */
+    std::string journalPath = std::string(fileName) + ".journal";
+    std::vector<char> journalTail;
+    bool haveJournal = false;
+    bool spliceJournal = false;
+    {
+        std::ifstream journal(journalPath.c_str(), std::ifstream::binary);
+        if (journal) {
+            haveJournal = true;
+            unsigned char header[SNAPPY_JOURNAL_HEADER_SIZE];
+            journal.read((char *)header, sizeof header);
+            if (!journal.fail() &&
+                header[0] == SNAPPY_BYTE1 && header[1] == SNAPPY_BYTE2 &&
+                header[2] == 'j' && header[3] == 'l' &&
+                getU64(header + 4) == chunks.size()) {
+                char buf[4096];
+                for (;;) {
+                    journal.read(buf, sizeof buf);
+                    size_t got = journal.gcount();
+                    if (!got) {
+                        break;
+                    }
+                    journalTail.insert(journalTail.end(), buf, buf + got);
+                }
+                spliceJournal = !journalTail.empty();
+            }
+        }
+    }
+
+    if (!damaged && haveFooter && footerChunks == chunks.size()) {
+        if (!haveJournal) {
+            report << fileName << ": intact (" << chunks.size()
+                   << " chunks, " << verified << " checksummed)\n";
+            return REPAIR_INTACT;
+        }
+        if (!spliceJournal) {
+            // the trace itself is fine; only a stale journal lingers
+            if (!dryRun) {
+                remove(journalPath.c_str());
+            }
+            report << fileName << ": intact; "
+                   << (dryRun ? "would remove" : "removed")
+                   << " stale journal\n";
+            return REPAIR_REPAIRED;
+        }
+    }
+
+    if (damaged) {
+        report << fileName << ": " << (fileSize - validEnd)
+               << " bytes of damaged or truncated data after chunk "
+               << chunks.size() << "\n";
+    } else if (!haveFooter) {
+        report << fileName << ": missing index footer\n";
+    } else if (footerChunks != chunks.size()) {
+        report << fileName << ": index footer disagrees with the data ("
+               << footerChunks << " chunks indexed, " << chunks.size()
+               << " found)\n";
+    }
+    if (spliceJournal) {
+        report << fileName << ": " << journalTail.size()
+               << " journaled bytes to splice in\n";
+    }
+
+    if (dryRun) {
+        report << fileName << ": would keep " << chunks.size()
+               << " chunks (" << validEnd << " bytes)"
+               << (spliceJournal ? " and splice the journal" : "")
+               << "\n";
+        return REPAIR_REPAIRED;
+    }
+
+    stream.close();
+
+    if (validEnd < fileSize && !repairTruncate(fileName, validEnd)) {
+        report << fileName << ": error: failed to truncate\n";
+        return REPAIR_FAILED;
+    }
+
+    std::ofstream out(fileName, std::ofstream::binary |
+                                std::ofstream::in | std::ofstream::out);
+    if (!out) {
+        report << fileName << ": error: failed to reopen for writing\n";
+        return REPAIR_FAILED;
+    }
+    out.seekp(validEnd, std::ios::beg);
+
+    if (spliceJournal) {
+        RepairChunkInfo info;
+        info.offset = validEnd;
+        info.compressedLength = journalTail.size();
+        info.uncompressedLength = journalTail.size();
+
+        unsigned char lenbuf[4];
+        putU32(lenbuf, (uint32_t)journalTail.size() |
+                       SNAPPY_CHUNK_STORED_FLAG | SNAPPY_CHUNK_CRC_FLAG);
+        out.write((const char *)lenbuf, sizeof lenbuf);
+        unsigned char crcbuf[4];
+        putU32(crcbuf, ::crc32(0L, (const Bytef *)&journalTail[0],
+                               journalTail.size()));
+        out.write((const char *)crcbuf, sizeof crcbuf);
+        out.write(&journalTail[0], journalTail.size());
+        chunks.push_back(info);
+    }
+
+    /* The frame index, if there was one, cannot be rebuilt without
+     * parsing; only the chunk index footer is written back. */
+    if (!chunks.empty()) {
+        unsigned char buf[SNAPPY_INDEX_ENTRY_SIZE];
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            putU64(buf, chunks[i].offset);
+            putU32(buf + 8, chunks[i].uncompressedLength);
+            out.write((const char *)buf, sizeof buf);
+        }
+
+        unsigned char tail[SNAPPY_INDEX_TAIL_SIZE];
+        putU64(tail, chunks.size());
+        tail[8] = SNAPPY_BYTE1;
+        tail[9] = SNAPPY_BYTE2;
+        tail[10] = SNAPPY_INDEX_BYTE1;
+        tail[11] = SNAPPY_INDEX_BYTE2;
+        out.write((const char *)tail, sizeof tail);
+    }
+    out.close();
+    if (out.fail()) {
+        report << fileName << ": error: failed to write the repaired tail\n";
+        return REPAIR_FAILED;
+    }
+
+    if (haveJournal) {
+        remove(journalPath.c_str());
+    }
+
+    report << fileName << ": repaired; " << chunks.size()
+           << " chunks indexed\n";
+    return REPAIR_REPAIRED;
+}
@@ -0,0 +1,367 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Sequential trace input from a pipe or TCP connection.
+ *
+ * `apitrace stream` on the storage host sends the trace as a stream of
+ * snappy-compressed chunks, each prefixed with a 4-byte little-endian
+ * compressed length, after a two-byte `at` identifier; the stream ends
+ * when the sender closes the connection.  This reader accepts that
+ * stream either on stdin (trace name `-`) or over a TCP connection it
+ * opens itself (trace name `tcp://host:port`), so replay hosts never
+ * need a local copy of the trace.  Flow control is the transport's:
+ * a replay that falls behind simply backs the socket up.
+ */
+
+
+#include "trace_file.hpp"
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+#include <snappy.h>
+
+#include <iostream>
+#include <string>
+
+#include "os.hpp"
+#include "trace_format.hpp"
+
+
+using namespace trace;
+
+
+class StreamFile : public File {
+public:
+    StreamFile(void);
+    virtual ~StreamFile();
+
+    virtual bool supportsOffsets() const;
+    virtual File::Offset currentOffset();
+protected:
+    virtual bool rawOpen(const std::string &filename, File::Mode mode);
+    virtual bool rawWrite(const void *buffer, size_t length);
+    virtual size_t rawRead(void *buffer, size_t length);
+    virtual int rawGetc();
+    virtual void rawClose();
+    virtual void rawFlush();
+    virtual bool rawSkip(size_t length);
+    virtual int  rawPercentRead();
+private:
+    bool openSocket(const char *hostPort);
+    size_t readBytes(void *buffer, size_t length);
+    bool refillCache(void);
+
+#ifdef _WIN32
+    SOCKET m_socket;
+#else
+    int m_socket;
+#endif
+    bool m_stdin;
+    bool m_eof;
+
+    std::string m_cache;
+    size_t m_cachePos;
+    uint64_t m_consumedOffset;
+};
+
+StreamFile::StreamFile(void)
+    : File(),
+#ifdef _WIN32
+      m_socket(INVALID_SOCKET),
+#else
+      m_socket(-1),
+#endif
+      m_stdin(false),
+      m_eof(false),
+      m_cachePos(0),
+      m_consumedOffset(0)
+{
+}
+
+StreamFile::~StreamFile()
+{
+    close();
+}
+
+bool StreamFile::openSocket(const char *hostPort)
+{
+    std::string spec(hostPort);
+    size_t colon = spec.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        os::log("error: expected tcp://HOST:PORT, got tcp://%s\n", hostPort);
+        return false;
+    }
+    std::string host = spec.substr(0, colon);
+    std::string port = spec.substr(colon + 1);
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 ||
+        !result) {
+        os::log("error: failed to resolve %s\n", host.c_str());
+        return false;
+    }
+
+    struct addrinfo *ai;
+    for (ai = result; ai; ai = ai->ai_next) {
+        m_socket = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+#ifdef _WIN32
+        if (m_socket == INVALID_SOCKET) {
+            continue;
+        }
+#else
+        if (m_socket < 0) {
+            continue;
+        }
+#endif
+        if (connect(m_socket, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+#ifdef _WIN32
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+#else
+        ::close(m_socket);
+        m_socket = -1;
+#endif
+    }
+    freeaddrinfo(result);
+
+    if (!ai) {
+        os::log("error: failed to connect to %s:%s\n",
+                host.c_str(), port.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool StreamFile::rawOpen(const std::string &filename, File::Mode mode)
+{
+    if (mode != File::Read) {
+        return false;
+    }
+
+    if (filename == "-") {
+        m_stdin = true;
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    } else if (filename.compare(0, 6, "tcp://") == 0) {
+        if (!openSocket(filename.c_str() + 6)) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    m_eof = false;
+    m_cache.clear();
+    m_cachePos = 0;
+    m_consumedOffset = 0;
+
+    unsigned char id[2];
+    if (readBytes(id, 2) != 2 ||
+        id[0] != SNAPPY_BYTE1 || id[1] != SNAPPY_BYTE2) {
+        os::log("error: %s is not an apitrace chunk stream\n",
+                filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/* Read exactly length bytes unless the stream ends first. */
+size_t StreamFile::readBytes(void *buffer, size_t length)
+{
+    char *p = (char *)buffer;
+    size_t total = 0;
+    while (total < length) {
+#ifdef _WIN32
+        int got = m_stdin
+            ? _read(0, p + total, (unsigned)(length - total))
+            : recv(m_socket, p + total, (int)(length - total), 0);
+#else
+        ssize_t got = m_stdin
+            ? ::read(0, p + total, length - total)
+            : recv(m_socket, p + total, length - total, 0);
+#endif
+        if (got <= 0) {
+            m_eof = true;
+            break;
+        }
+        total += got;
+    }
+    return total;
+}
+
+/* Pull in and decompress the next chunk of the stream. */
+bool StreamFile::refillCache(void)
+{
+    if (m_eof) {
+        return false;
+    }
+
+    unsigned char lengthBuf[4];
+    if (readBytes(lengthBuf, 4) != 4) {
+        return false;
+    }
+    size_t compressedLength = (uint32_t)lengthBuf[0] |
+                              ((uint32_t)lengthBuf[1] << 8) |
+                              ((uint32_t)lengthBuf[2] << 16) |
+                              ((uint32_t)lengthBuf[3] << 24);
+    if (!compressedLength) {
+        m_eof = true;
+        return false;
+    }
+
+    std::string compressed;
+    compressed.resize(compressedLength);
+    if (readBytes(&compressed[0], compressedLength) != compressedLength) {
+        os::log("error: truncated trace stream chunk\n");
+        return false;
+    }
+
+    if (!::snappy::Uncompress(&compressed[0], compressedLength, &m_cache)) {
+        os::log("error: corrupt trace stream chunk\n");
+        m_eof = true;
+        return false;
+    }
+    m_cachePos = 0;
+    return !m_cache.empty();
+}
+
+size_t StreamFile::rawRead(void *buffer, size_t length)
+{
+    size_t total = 0;
+    while (total < length) {
+        if (m_cachePos >= m_cache.size()) {
+            if (!refillCache()) {
+                break;
+            }
+        }
+        size_t chunk = m_cache.size() - m_cachePos;
+        if (chunk > length - total) {
+            chunk = length - total;
+        }
+        memcpy((char *)buffer + total, &m_cache[m_cachePos], chunk);
+        m_cachePos += chunk;
+        total += chunk;
+    }
+    m_consumedOffset += total;
+    return total;
+}
+
+int StreamFile::rawGetc()
+{
+    unsigned char c;
+    if (rawRead(&c, 1) != 1) {
+        return -1;
+    }
+    return c;
+}
+
+bool StreamFile::rawWrite(const void *buffer, size_t length)
+{
+    return false;
+}
+
+void StreamFile::rawClose()
+{
+#ifdef _WIN32
+    if (m_socket != INVALID_SOCKET) {
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+    }
+#else
+    if (m_socket >= 0) {
+        ::close(m_socket);
+        m_socket = -1;
+    }
+#endif
+    m_stdin = false;
+}
+
+void StreamFile::rawFlush()
+{
+}
+
+bool StreamFile::rawSkip(size_t length)
+{
+    char buf[64 * 1024];
+    while (length) {
+        size_t chunk = length < sizeof buf ? length : sizeof buf;
+        if (rawRead(buf, chunk) != chunk) {
+            return false;
+        }
+        length -= chunk;
+    }
+    return true;
+}
+
+File::Offset StreamFile::currentOffset()
+{
+    return File::Offset(m_consumedOffset);
+}
+
+bool StreamFile::supportsOffsets() const
+{
+    return false;
+}
+
+int StreamFile::rawPercentRead()
+{
+    /* The stream length is unknown to the receiver. */
+    return 0;
+}
+
+
+File * File::createStream(void) {
+    return new StreamFile;
+}
@@ -30,6 +30,8 @@
 #include <assert.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <zlib.h>
 #include <gzguts.h>
 
@@ -42,6 +44,7 @@
 #endif
 
 #include "os.hpp"
+#include "os_thread.hpp"
 
 #include <iostream>
 
@@ -49,6 +52,16 @@
 using namespace trace;
 
 
+enum {
+    /* Uncompressed bytes per read-ahead buffer. */
+    ZLIB_READAHEAD_BUFFER_SIZE = 1 * 1024 * 1024,
+
+    /* zlib's default gzip I/O buffer is a mere 8kB; a bigger one means
+     * fewer read syscalls and longer uninterrupted inflate runs. */
+    ZLIB_GZBUFFER_SIZE = 256 * 1024
+};
+
+
 class ZLibFile : public File {
 public:
     ZLibFile(const std::string &filename = std::string(),
@@ -68,20 +81,58 @@ protected:
     virtual bool rawSkip(size_t length);
     virtual int  rawPercentRead();
 private:
+    static void readAheadThreadEntry(ZLibFile *file);
+    void readAheadLoop();
+    void stopReadAhead();
+
     gzFile m_gzFile;
     double m_endOffset;
+
+    /* Double-buffered background inflate, mirroring the snappy
+     * read-ahead: a worker thread keeps gzread()ing into whichever
+     * buffer the consumer is not draining, so inflate overlaps with
+     * parsing instead of serializing with it.  Only active when
+     * reading. */
+    struct Buffer {
+        char *data;
+        size_t size;
+        size_t pos;
+    };
+    Buffer m_buffers[2];
+    unsigned m_readBuffer;
+    unsigned m_fillBuffer;
+    unsigned m_filledCount;
+    bool m_readAheadRunning;
+    bool m_readAheadExit;
+    bool m_readAheadEOF;
+    uint64_t m_consumedOffset;
+    os::thread m_readAheadThread;
+    os::mutex m_readAheadMutex;
+    os::condition_variable m_bufferFilled;
+    os::condition_variable m_bufferDrained;
 };
 
 ZLibFile::ZLibFile(const std::string &filename,
                    File::Mode mode)
     : File(filename, mode),
-      m_gzFile(NULL)
+      m_gzFile(NULL),
+      m_readBuffer(0),
+      m_fillBuffer(0),
+      m_filledCount(0),
+      m_readAheadRunning(false),
+      m_readAheadExit(false),
+      m_readAheadEOF(false),
+      m_consumedOffset(0)
 {
+    m_buffers[0].data = NULL;
+    m_buffers[1].data = NULL;
 }
 
 ZLibFile::~ZLibFile()
 {
     close();
+    delete [] m_buffers[0].data;
+    delete [] m_buffers[1].data;
 }
 
 bool ZLibFile::rawOpen(const std::string &filename, File::Mode mode)
@@ -98,11 +149,79 @@ bool ZLibFile::rawOpen(const std::string &filename, File::Mode mode)
         off_t loc = lseek(state->fd, 0, SEEK_CUR);
         m_endOffset = lseek(state->fd, 0, SEEK_END);
         lseek(state->fd, loc, SEEK_SET);
+
+        gzbuffer(m_gzFile, ZLIB_GZBUFFER_SIZE);
+
+        if (!m_buffers[0].data) {
+            m_buffers[0].data = new char[ZLIB_READAHEAD_BUFFER_SIZE];
+            m_buffers[1].data = new char[ZLIB_READAHEAD_BUFFER_SIZE];
+        }
+        m_readBuffer = 0;
+        m_fillBuffer = 0;
+        m_filledCount = 0;
+        m_readAheadExit = false;
+        m_readAheadEOF = false;
+        m_consumedOffset = 0;
+        m_readAheadRunning = true;
+        m_readAheadThread = os::thread(readAheadThreadEntry, this);
     }
 
     return m_gzFile != NULL;
 }
 
+void ZLibFile::readAheadThreadEntry(ZLibFile *file)
+{
+    file->readAheadLoop();
+}
+
+void ZLibFile::readAheadLoop()
+{
+    os::unique_lock<os::mutex> lock(m_readAheadMutex);
+    while (!m_readAheadExit) {
+        while (m_filledCount == 2 && !m_readAheadExit) {
+            m_bufferDrained.wait(lock);
+        }
+        if (m_readAheadExit) {
+            break;
+        }
+
+        Buffer &buf = m_buffers[m_fillBuffer];
+
+        /* Inflate without the lock held -- this is the whole point. */
+        lock.unlock();
+        int ret = gzread(m_gzFile, buf.data, ZLIB_READAHEAD_BUFFER_SIZE);
+        lock.lock();
+
+        if (ret <= 0) {
+            m_readAheadEOF = true;
+            m_bufferFilled.signal();
+            break;
+        }
+
+        buf.size = ret;
+        buf.pos = 0;
+        m_fillBuffer ^= 1;
+        ++m_filledCount;
+        m_bufferFilled.signal();
+    }
+}
+
+void ZLibFile::stopReadAhead()
+{
+    if (!m_readAheadRunning) {
+        return;
+    }
+
+    {
+        os::unique_lock<os::mutex> lock(m_readAheadMutex);
+        m_readAheadExit = true;
+        m_bufferDrained.signal();
+    }
+
+    m_readAheadThread.join();
+    m_readAheadRunning = false;
+}
+
 bool ZLibFile::rawWrite(const void *buffer, size_t length)
 {
     return gzwrite(m_gzFile, buffer, length) != -1;
@@ -110,17 +229,52 @@ bool ZLibFile::rawWrite(const void *buffer, size_t length)
 
 size_t ZLibFile::rawRead(void *buffer, size_t length)
 {
-    int ret = gzread(m_gzFile, buffer, length);
-    return ret < 0 ? 0 : ret;
+    if (!m_readAheadRunning) {
+        int ret = gzread(m_gzFile, buffer, length);
+        return ret < 0 ? 0 : ret;
+    }
+
+    size_t total = 0;
+
+    os::unique_lock<os::mutex> lock(m_readAheadMutex);
+    while (total < length) {
+        while (m_filledCount == 0 && !m_readAheadEOF) {
+            m_bufferFilled.wait(lock);
+        }
+        if (m_filledCount == 0) {
+            /* EOF (or error) with nothing left buffered. */
+            break;
+        }
+
+        Buffer &buf = m_buffers[m_readBuffer];
+        size_t chunk = std::min(length - total, buf.size - buf.pos);
+        memcpy((char *)buffer + total, buf.data + buf.pos, chunk);
+        buf.pos += chunk;
+        total += chunk;
+
+        if (buf.pos == buf.size) {
+            m_readBuffer ^= 1;
+            --m_filledCount;
+            m_bufferDrained.signal();
+        }
+    }
+    m_consumedOffset += total;
+
+    return total;
 }
 
 int ZLibFile::rawGetc()
 {
-    return gzgetc(m_gzFile);
+    unsigned char c;
+    if (rawRead(&c, 1) != 1) {
+        return -1;
+    }
+    return c;
 }
 
 void ZLibFile::rawClose()
 {
+    stopReadAhead();
     if (m_gzFile) {
         gzclose(m_gzFile);
         m_gzFile = NULL;
@@ -134,6 +288,11 @@ void ZLibFile::rawFlush()
 
 File::Offset ZLibFile::currentOffset()
 {
+    if (m_readAheadRunning) {
+        /* gztell() reflects how far the read-ahead thread has
+         * inflated, not how much the consumer has seen. */
+        return File::Offset(m_consumedOffset);
+    }
     return File::Offset(gztell(m_gzFile));
 }
 
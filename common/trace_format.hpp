@@ -69,8 +69,23 @@ namespace trace {
  *
  * - version 4:
  *   - call enter events include thread ID
+ *
+ * - version 5:
+ *   - deduplicated blobs -- repeated blob contents (shader sources, static
+ *   vertex data) are written once as a BLOB_DEF record and subsequently
+ *   back-referenced by index with BLOB_REF records
+ *
+ * - version 6:
+ *   - standalone function signature records (FUNCTION_SIG) -- the writer may
+ *   emit every function signature up front after the header, instead of
+ *   inlining each definition into the first call that uses it
+ *
+ * - version 7:
+ *   - individually compressed blobs (BLOB_COMPRESSED, BLOB_DEF_COMPRESSED) --
+ *   large blob payloads may be snappy-compressed in place, so a lazy parse
+ *   can skip them without paying for their decompression
  */
-#define TRACE_VERSION 4
+#define TRACE_VERSION 7
 
 
 /*
@@ -80,6 +95,7 @@ namespace trace {
  *
  *   event = EVENT_ENTER thread_id call_sig call_detail+
  *         | EVENT_LEAVE call_no call_detail+
+ *         | EVENT_FUNCTION_SIG id name arg_name*
  *
  *   call_sig = sig_id ( name arg_names )?
  *
@@ -96,6 +112,10 @@ namespace trace {
  *         | DOUBLE double
  *         | STRING string
  *         | BLOB string
+ *         | BLOB_DEF index string
+ *         | BLOB_REF index
+ *         | BLOB_COMPRESSED raw_size string
+ *         | BLOB_DEF_COMPRESSED index raw_size string
  *         | ENUM enum_sig value
  *         | BITMASK bitmask_sig value
  *         | ARRAY length value+
@@ -120,6 +140,7 @@ namespace trace {
 enum Event {
     EVENT_ENTER = 0,
     EVENT_LEAVE,
+    EVENT_FUNCTION_SIG,     // version 6+
 };
 
 enum CallDetail {
@@ -145,6 +166,10 @@ enum Type {
     TYPE_STRUCT,
     TYPE_OPAQUE,
     TYPE_REPR,
+    TYPE_BLOB_DEF, // Blob registered for back-referencing
+    TYPE_BLOB_REF, // Back-reference to a previous TYPE_BLOB_DEF
+    TYPE_BLOB_COMPRESSED, // Blob with a snappy-compressed payload
+    TYPE_BLOB_DEF_COMPRESSED, // Registered blob with a snappy-compressed payload
 };
 
 
@@ -0,0 +1,232 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "trace_index.hpp"
+
+
+namespace trace {
+
+
+/*
+ * Layout (all integers little-endian):
+ *
+ *   char     magic[4]        'a' 't' 'i' 'd'
+ *   u32      version
+ *   u64      trace size      } validation stamp of the trace the
+ *   u64      trace mtime     } index was built from
+ *   u32      frame marker
+ *   u32      frame count
+ *   then per frame:
+ *   u64      bookmark chunk offset
+ *   u32      bookmark offset in chunk
+ *   u32      first call no
+ *   u32      number of calls
+ *   u32      last call no
+ *   u32      flags           bit 0: closed by a frame marker
+ */
+
+static const char indexMagic[4] = { 'a', 't', 'i', 'd' };
+
+enum {
+    INDEX_VERSION = 1,
+
+    INDEX_FRAME_COMPLETE = 1 << 0
+};
+
+
+static std::string
+indexFilename(const char *traceFilename)
+{
+    return std::string(traceFilename) + ".idx";
+}
+
+static bool
+getTraceStamp(const char *traceFilename, uint64_t &size, uint64_t &mtime)
+{
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(traceFilename, &st) != 0) {
+        return false;
+    }
+#else
+    struct stat st;
+    if (stat(traceFilename, &st) != 0) {
+        return false;
+    }
+#endif
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+
+static void
+putU32(FILE *fp, uint32_t value)
+{
+    unsigned char buf[4];
+    buf[0] = value;
+    buf[1] = value >> 8;
+    buf[2] = value >> 16;
+    buf[3] = value >> 24;
+    fwrite(buf, 1, sizeof buf, fp);
+}
+
+static void
+putU64(FILE *fp, uint64_t value)
+{
+    putU32(fp, value);
+    putU32(fp, value >> 32);
+}
+
+static bool
+getU32(FILE *fp, uint32_t &value)
+{
+    unsigned char buf[4];
+    if (fread(buf, 1, sizeof buf, fp) != sizeof buf) {
+        return false;
+    }
+    value = (uint32_t)buf[0] |
+            (uint32_t)buf[1] << 8 |
+            (uint32_t)buf[2] << 16 |
+            (uint32_t)buf[3] << 24;
+    return true;
+}
+
+static bool
+getU64(FILE *fp, uint64_t &value)
+{
+    uint32_t lo, hi;
+    if (!getU32(fp, lo) || !getU32(fp, hi)) {
+        return false;
+    }
+    value = (uint64_t)hi << 32 | lo;
+    return true;
+}
+
+
+bool
+readFrameIndex(const char *traceFilename, unsigned frameMarker,
+               std::vector<IndexedFrame> &frames)
+{
+    uint64_t traceSize, traceMtime;
+    if (!getTraceStamp(traceFilename, traceSize, traceMtime)) {
+        return false;
+    }
+
+    FILE *fp = fopen(indexFilename(traceFilename).c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    char magic[4];
+    uint32_t version, marker, count;
+    uint64_t size, mtime;
+    if (fread(magic, 1, sizeof magic, fp) != sizeof magic ||
+        memcmp(magic, indexMagic, sizeof magic) != 0 ||
+        !getU32(fp, version) ||
+        version != INDEX_VERSION ||
+        !getU64(fp, size) ||
+        !getU64(fp, mtime) ||
+        !getU32(fp, marker) ||
+        !getU32(fp, count) ||
+        size != traceSize ||
+        mtime != traceMtime ||
+        marker != frameMarker) {
+        fclose(fp);
+        return false;
+    }
+
+    frames.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        IndexedFrame &frame = frames[i];
+        uint32_t offsetInChunk, firstCallNo, flags;
+        if (!getU64(fp, frame.start.offset.chunk) ||
+            !getU32(fp, offsetInChunk) ||
+            !getU32(fp, firstCallNo) ||
+            !getU32(fp, frame.numberOfCalls) ||
+            !getU32(fp, frame.lastCallNo) ||
+            !getU32(fp, flags)) {
+            fclose(fp);
+            frames.clear();
+            return false;
+        }
+        frame.start.offset.offsetInChunk = offsetInChunk;
+        frame.start.next_call_no = firstCallNo;
+        frame.complete = (flags & INDEX_FRAME_COMPLETE) != 0;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+
+bool
+writeFrameIndex(const char *traceFilename, unsigned frameMarker,
+                const std::vector<IndexedFrame> &frames)
+{
+    uint64_t traceSize, traceMtime;
+    if (!getTraceStamp(traceFilename, traceSize, traceMtime)) {
+        return false;
+    }
+
+    FILE *fp = fopen(indexFilename(traceFilename).c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    fwrite(indexMagic, 1, sizeof indexMagic, fp);
+    putU32(fp, INDEX_VERSION);
+    putU64(fp, traceSize);
+    putU64(fp, traceMtime);
+    putU32(fp, frameMarker);
+    putU32(fp, frames.size());
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        const IndexedFrame &frame = frames[i];
+        putU64(fp, frame.start.offset.chunk);
+        putU32(fp, frame.start.offset.offsetInChunk);
+        putU32(fp, frame.start.next_call_no);
+        putU32(fp, frame.numberOfCalls);
+        putU32(fp, frame.lastCallNo);
+        putU32(fp, frame.complete ? INDEX_FRAME_COMPLETE : 0);
+    }
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+
+} /* namespace trace */
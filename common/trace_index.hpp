@@ -0,0 +1,79 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef _TRACE_INDEX_HPP_
+#define _TRACE_INDEX_HPP_
+
+
+#include <vector>
+
+#include "trace_parser.hpp"
+
+
+namespace trace {
+
+
+/**
+ * Persistent sidecar cache of a trace's frame boundaries (<trace>.idx).
+ *
+ * Building the frame bookmarks requires scanning the entire trace, which
+ * for big traces takes minutes.  The scan result is saved next to the
+ * trace after the first session and reused by later ones, validated
+ * against the trace's size and modification time so a rewritten trace
+ * simply triggers a fresh scan.
+ */
+struct IndexedFrame {
+    ParseBookmark start;
+    unsigned numberOfCalls;
+    unsigned lastCallNo;
+
+    /* Whether the frame was closed by a frame marker; trailing calls
+     * after the last marker form an incomplete frame, which some
+     * consumers show and others ignore. */
+    bool complete;
+};
+
+
+/**
+ * Load the sidecar index of the given trace, if present, valid, and
+ * recorded for the same frame marker (a Loader::FrameMarker value).
+ */
+bool
+readFrameIndex(const char *traceFilename, unsigned frameMarker,
+               std::vector<IndexedFrame> &frames);
+
+/**
+ * Save the sidecar index of the given trace.  Best effort: failure only
+ * costs the next session a rescan.
+ */
+bool
+writeFrameIndex(const char *traceFilename, unsigned frameMarker,
+                const std::vector<IndexedFrame> &frames);
+
+
+} /* namespace trace */
+
+
+#endif /* _TRACE_INDEX_HPP_ */
@@ -1,10 +1,12 @@
+#include "trace_index.hpp"
 #include "trace_loader.hpp"
 
 
 using namespace trace;
 
 Loader::Loader()
-    : m_frameMarker(FrameMarker_SwapBuffers)
+    : m_frameMarker(FrameMarker_SwapBuffers),
+      m_scannedFrames(0)
 {
 }
 
@@ -50,16 +52,61 @@ bool Loader::open(const char *filename)
         return false;
     }
 
+    // If the container carries a frame index (and only the default
+    // frame marker is wanted, since the index reflects END_FRAME
+    // calls), the boundaries and call counts are known without
+    // scanning the whole trace.
+    File::FrameIndex frameIndex;
+    if (m_frameMarker == FrameMarker_SwapBuffers &&
+        m_parser.getFrameIndex(frameIndex) &&
+        frameIndex.size() >= 2) {
+        for (size_t i = 0; i + 1 < frameIndex.size(); ++i) {
+            ParseBookmark start;
+            start.offset = frameIndex[i].start;
+            start.next_call_no = frameIndex[i].firstCallNo;
+
+            FrameBookmark frameBookmark(start);
+            frameBookmark.numberOfCalls = frameIndex[i + 1].firstCallNo -
+                                          frameIndex[i].firstCallNo;
+            m_frameBookmarks[i] = frameBookmark;
+        }
+        m_scannedFrames = 0;
+        m_parser.getBookmark(m_scanPos);
+        return true;
+    }
+
+    // Otherwise a sidecar index left by a previous scan gives the same
+    // head start.  Incomplete trailing frames are dropped, matching what
+    // the scan below exposes.
+    std::vector<IndexedFrame> indexedFrames;
+    if (readFrameIndex(filename, m_frameMarker, indexedFrames)) {
+        unsigned numOfFrames = 0;
+        for (size_t i = 0; i < indexedFrames.size(); ++i) {
+            if (!indexedFrames[i].complete) {
+                continue;
+            }
+            FrameBookmark frameBookmark(indexedFrames[i].start);
+            frameBookmark.numberOfCalls = indexedFrames[i].numberOfCalls;
+            m_frameBookmarks[numOfFrames] = frameBookmark;
+            ++numOfFrames;
+        }
+        m_scannedFrames = 0;
+        m_parser.getBookmark(m_scanPos);
+        return true;
+    }
+
     trace::Call *call;
     ParseBookmark startBookmark;
     unsigned numOfFrames = 0;
     unsigned numOfCalls = 0;
+    unsigned lastCallNo = 0;
     int lastPercentReport = 0;
 
     m_parser.getBookmark(startBookmark);
 
     while ((call = m_parser.scan_call())) {
         ++numOfCalls;
+        lastCallNo = call->no;
 
         if (isCallAFrameMarker(call)) {
             FrameBookmark frameBookmark(startBookmark);
@@ -68,22 +115,72 @@ bool Loader::open(const char *filename)
             m_frameBookmarks[numOfFrames] = frameBookmark;
             ++numOfFrames;
 
+            IndexedFrame indexedFrame;
+            indexedFrame.start = startBookmark;
+            indexedFrame.numberOfCalls = numOfCalls;
+            indexedFrame.lastCallNo = call->no;
+            indexedFrame.complete = true;
+            indexedFrames.push_back(indexedFrame);
+
             if (m_parser.percentRead() - lastPercentReport >= 5) {
                 std::cerr << "\tPercent scanned = "
                           << m_parser.percentRead()
                           << "..."<<std::endl;
                 lastPercentReport = m_parser.percentRead();
             }
-            
+
             m_parser.getBookmark(startBookmark);
             numOfCalls = 0;
         }
         //call->dump(std::cout, color);
         delete call;
     }
+
+    // Record the incomplete trailing frame too; the loader itself does
+    // not expose it, but other index consumers do.
+    if (numOfCalls) {
+        IndexedFrame indexedFrame;
+        indexedFrame.start = startBookmark;
+        indexedFrame.numberOfCalls = numOfCalls;
+        indexedFrame.lastCallNo = lastCallNo;
+        indexedFrame.complete = false;
+        indexedFrames.push_back(indexedFrame);
+    }
+
+    writeFrameIndex(filename, m_frameMarker, indexedFrames);
+
+    // the full scan has registered every signature definition
+    m_scannedFrames = numOfFrames;
     return true;
 }
 
+/**
+ * Scan (without materializing calls) up to the start of the given
+ * frame, so that every signature definition preceding it is known to
+ * the parser before we seek there.  Scanning resumes where it last
+ * stopped, so repeated seeks only ever pay for new territory.
+ */
+void Loader::scanUpTo(unsigned frameIdx)
+{
+    if (m_scannedFrames >= frameIdx) {
+        return;
+    }
+
+    unsigned target = m_frameBookmarks[frameIdx].start.next_call_no;
+
+    m_parser.setBookmark(m_scanPos);
+    trace::Call *call;
+    while ((call = m_parser.scan_call())) {
+        unsigned no = call->no;
+        delete call;
+        if (no + 1 >= target) {
+            break;
+        }
+    }
+    m_parser.getBookmark(m_scanPos);
+    m_scannedFrames = frameIdx;
+}
+
 void Loader::close()
 {
     m_parser.close();
@@ -114,6 +211,7 @@ std::vector<trace::Call *> Loader::frame(unsigned idx)
 {
     unsigned numOfCalls = numberOfCallsInFrame(idx);
     if (numOfCalls) {
+        scanUpTo(idx);
         const FrameBookmark &frameBookmark = m_frameBookmarks[idx];
         std::vector<trace::Call*> calls(numOfCalls);
         m_parser.setBookmark(frameBookmark.start);
@@ -51,6 +51,7 @@ private:
         unsigned numberOfCalls;
     };
     bool isCallAFrameMarker(const trace::Call *call) const;
+    void scanUpTo(unsigned frameIdx);
 
 private:
     trace::Parser m_parser;
@@ -58,6 +59,14 @@ private:
 
     typedef std::map<int, FrameBookmark> FrameBookmarks;
     FrameBookmarks m_frameBookmarks;
+
+    // Number of frames whose region has been scanned, and where the
+    // scan stopped.  When the frame bookmarks come from a container's
+    // frame index rather than a full scan, signature definitions in
+    // not-yet-visited regions are still unknown to the parser, and
+    // must be scanned in before seeking past them.
+    unsigned m_scannedFrames;
+    ParseBookmark m_scanPos;
 };
 
 }
@@ -24,25 +24,119 @@
  **************************************************************************/
 
 
+#include <string.h>
+
+#include <snappy.h>
+
+#include "os.hpp"
 #include "trace_model.hpp"
 
 
 namespace trace {
 
 
+Arena::~Arena() {
+    Block *block = m_blocks;
+    while (block) {
+        Block *next = block->next;
+        if (block->hugeSize) {
+            os::freeHugePages(block, block->hugeSize);
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+}
+
+
+void Arena::reset(void) {
+    Block *block = m_blocks;
+    while (block) {
+        Block *next = block->next;
+        if (block->hugeSize) {
+            os::freeHugePages(block, block->hugeSize);
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    m_blocks = NULL;
+    m_ptr = m_inline.data;
+    m_free = sizeof m_inline.data;
+    m_allocated = sizeof m_inline.data;
+}
+
+
+void Arena::grow(size_t size) {
+    size_t blockSize = 4096 - sizeof(Block);
+    if (size > blockSize) {
+        blockSize = size;
+    }
+
+    /* Blocks this big -- large blobs, mostly -- are worth huge-page
+     * backing: walking them is where the TLB misses pile up. */
+    Block *block = NULL;
+    if (sizeof(Block) + blockSize >= 2 * 1024 * 1024) {
+        size_t hugeSize = sizeof(Block) + blockSize;
+        block = (Block *)os::allocHugePages(hugeSize);
+        if (block) {
+            block->hugeSize = hugeSize;
+        }
+    }
+    if (!block) {
+        block = (Block *)malloc(sizeof(Block) + blockSize);
+        block->hugeSize = 0;
+    }
+    block->next = m_blocks;
+    m_blocks = block;
+    m_allocated += sizeof(Block) + blockSize;
+
+    m_ptr = (char *)(block + 1);
+    m_free = blockSize;
+}
+
+
 Call::~Call() {
+    reset();
+
+    delete arena;
+}
+
+
+void Call::reset(void) {
     for (unsigned i = 0; i < args.size(); ++i) {
         delete args[i].value;
     }
+    args.clear();
 
     if (ret) {
         delete ret;
+        ret = NULL;
+    }
+
+    if (arena) {
+        arena->reset();
     }
 }
 
 
+void Call::reuse(const FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id) {
+    thread_index = 0;
+    assert(args.empty() && !ret);
+
+    thread_id = _thread_id;
+    sig = _sig;
+    flags = _flags;
+
+    Arg no_arg = { NULL };
+    args.assign(_sig->num_args, no_arg);
+}
+
+
 String::~String() {
-    delete [] value;
+    if (owns) {
+        delete [] value;
+    }
 }
 
 
@@ -72,6 +166,31 @@ Blob::~Blob() {
     }
 }
 
+void Blob::load(void) const {
+    if (buf || !size || !file) {
+        return;
+    }
+
+    buf = new char[size];
+
+    // materialize the data without disturbing the reader's position
+    File::Offset save = file->currentOffset();
+    file->setCurrentOffset(offset);
+    if (stored_size != size) {
+        // snappy-compressed payload; inflate it
+        char *compressed = new char[stored_size];
+        file->read(compressed, stored_size);
+        if (!snappy::RawUncompress(compressed, stored_size, buf)) {
+            os::log("apitrace: error: corrupt compressed blob\n");
+            memset(buf, 0, size);
+        }
+        delete [] compressed;
+    } else {
+        file->read(buf, size);
+    }
+    file->setCurrentOffset(save);
+}
+
 
 // bool cast
 bool Null   ::toBool(void) const { return false; }
@@ -135,13 +254,13 @@ double Repr   ::toDouble(void) const { return machineValue->toDouble(); }
 // pointer cast
 void * Value  ::toPointer(void) const { assert(0); return NULL; }
 void * Null   ::toPointer(void) const { return NULL; }
-void * Blob   ::toPointer(void) const { return buf; }
+void * Blob   ::toPointer(void) const { load(); return buf; }
 void * Pointer::toPointer(void) const { return (void *)value; }
 void * Repr   ::toPointer(void) const { return machineValue->toPointer(); }
 
 void * Value  ::toPointer(bool bind) { assert(0); return NULL; }
 void * Null   ::toPointer(bool bind) { return NULL; }
-void * Blob   ::toPointer(bool bind) { if (bind) bound = true; return buf; }
+void * Blob   ::toPointer(bool bind) { load(); if (bind) bound = true; return buf; }
 void * Pointer::toPointer(bool bind) { return (void *)value; }
 void * Repr   ::toPointer(bool bind) { return machineValue->toPointer(bind); }
 
@@ -160,6 +279,12 @@ const char * String::toString(void) const { return value; }
 const char * Repr  ::toString(void) const { return machineValue->toString(); }
 
 
+// array cast
+const Array * Value::toArray(void) const { return NULL; }
+const Array * Array::toArray(void) const { return this; }
+const Array * Repr ::toArray(void) const { return machineValue->toArray(); }
+
+
 // virtual Value::visit()
 void Null   ::visit(Visitor &visitor) { visitor.visit(this); }
 void Bool   ::visit(Visitor &visitor) { visitor.visit(this); }
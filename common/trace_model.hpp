@@ -37,6 +37,8 @@
 #include <map>
 #include <vector>
 
+#include "trace_file.hpp"
+
 
 namespace trace {
 
@@ -87,6 +89,78 @@ struct BitmaskSig {
 
 
 class Visitor;
+class Array;
+
+
+/**
+ * Bump allocator backing the Value objects of a single call.
+ *
+ * Values are allocated front-to-back out of fixed-size blocks and the
+ * whole arena is freed at once when the call is destroyed, so parsing
+ * a call costs one allocation for the arena (plus overflow blocks for
+ * unusually large calls) instead of one per value.  Object
+ * destructors still run through the regular delete path -- only the
+ * memory reclamation is deferred (see Value::operator delete).
+ */
+class Arena
+{
+public:
+    Arena(void) :
+        m_blocks(NULL),
+        m_ptr(m_inline.data),
+        m_free(sizeof m_inline.data),
+        m_allocated(sizeof m_inline.data)
+    {}
+
+    ~Arena();
+
+    inline void *
+    alloc(size_t size) {
+        size = (size + 7) & ~(size_t)7;
+        if (size > m_free) {
+            grow(size);
+        }
+        void *ptr = m_ptr;
+        m_ptr += size;
+        m_free -= size;
+        return ptr;
+    }
+
+    /**
+     * Free the overflow blocks and rewind to the inline block, so the
+     * arena can back another call without going through the
+     * allocator.
+     */
+    void reset(void);
+
+    /** Bytes of memory this arena holds, inline block included. */
+    size_t allocated(void) const {
+        return m_allocated;
+    }
+
+private:
+    struct Block {
+        Block *next;
+        /* Rounded-up region size when the block is huge-page backed,
+         * 0 when it came from malloc; doubles as header padding so the
+         * payload stays 16-byte aligned. */
+        size_t hugeSize;
+    };
+
+    void grow(size_t size);
+
+    Block *m_blocks;
+    char *m_ptr;
+    size_t m_free;
+    size_t m_allocated;
+
+    /* Enough for the typical call without any further allocation. */
+    union {
+        char data[512];
+        double _align;
+        long long _align2;
+    } m_inline;
+};
 
 
 class Value
@@ -95,6 +169,32 @@ public:
     virtual ~Value() {}
     virtual void visit(Visitor &visitor) = 0;
 
+    /* Values are either individually heap-allocated or bump-allocated
+     * from a call's Arena; a tag word in front of the object lets
+     * operator delete tell them apart, so `delete value` is always
+     * safe and arena-backed memory is simply left for the arena to
+     * reclaim. */
+    static void *operator new(size_t size) {
+        size_t *ptr = (size_t *)malloc(sizeof(size_t) + size);
+        *ptr = 0;
+        return ptr + 1;
+    }
+    static void *operator new(size_t size, Arena &arena) {
+        size_t *ptr = (size_t *)arena.alloc(sizeof(size_t) + size);
+        *ptr = 1;
+        return ptr + 1;
+    }
+    static void operator delete(void *ptr) {
+        if (ptr) {
+            size_t *mem = (size_t *)ptr - 1;
+            if (!*mem) {
+                free(mem);
+            }
+        }
+    }
+    static void operator delete(void *ptr, Arena &arena) {
+    }
+
     virtual bool toBool(void) const = 0;
     virtual signed long long toSInt(void) const;
     virtual unsigned long long toUInt(void) const;
@@ -106,6 +206,14 @@ public:
     virtual unsigned long long toUIntPtr(void) const;
     virtual const char *toString(void) const;
 
+    /**
+     * Downcast to Array without RTTI, or NULL for any other kind of
+     * value.  A virtual call is substantially cheaper than the
+     * dynamic_cast the hot retrace paths used to do per array
+     * argument.
+     */
+    virtual const Array *toArray(void) const;
+
     const Value & operator[](size_t index) const;
 };
 
@@ -209,7 +317,7 @@ public:
 class String : public Value
 {
 public:
-    String(const char * _value) : value(_value) {}
+    String(const char * _value, bool _owns = true) : value(_value), owns(_owns) {}
     ~String();
 
     bool toBool(void) const;
@@ -217,6 +325,10 @@ public:
     void visit(Visitor &visitor);
 
     const char * value;
+
+    /* false when the characters live in the call's Arena or in the
+     * parser's string pool, and are reclaimed with them */
+    bool owns;
 };
 
 
@@ -270,14 +382,83 @@ public:
 class Array : public Value
 {
 public:
-    Array(size_t len) : values(len) {}
+    /**
+     * Typed bulk representations of arrays of scalars (see
+     * Parser::parse_array).
+     */
+    enum PackedType {
+        PACKED_NONE = 0,
+        PACKED_UINT8,
+        PACKED_UINT16,
+        PACKED_UINT32,
+        PACKED_FLOAT
+    };
+
+    Array(size_t len) : values(len), packedType(PACKED_NONE), packedData(NULL) {}
     ~Array();
 
     bool toBool(void) const;
+    const Array *toArray(void) const;
     void visit(Visitor &visitor);
 
     std::vector<Value *> values;
 
+    /**
+     * When every element is a scalar of the same kind the parser also
+     * stores the element values contiguously here, in the call's
+     * arena, narrowed to the smallest type above that holds them all.
+     * A 64k-element index buffer can then be handed to consumers as a
+     * flat buffer, instead of being reconstructed element-wise with a
+     * virtual call per element.  Elements remain individually
+     * accessible through the values vector as before.
+     */
+    unsigned char packedType;
+    const void *packedData;
+
+    /**
+     * Copy the packed elements into a typed destination array, with
+     * the conversions of plain assignment.  Returns false when there
+     * is no packed representation, in which case the caller must fall
+     * back to element-wise extraction through values.
+     */
+    template<class T>
+    inline bool
+    toScalarArray(T *dst) const {
+        size_t n = values.size();
+        switch (packedType) {
+        case PACKED_UINT8: {
+            const unsigned char *src = (const unsigned char *)packedData;
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = T(src[i]);
+            }
+            return true;
+        }
+        case PACKED_UINT16: {
+            const unsigned short *src = (const unsigned short *)packedData;
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = T(src[i]);
+            }
+            return true;
+        }
+        case PACKED_UINT32: {
+            const unsigned int *src = (const unsigned int *)packedData;
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = T(src[i]);
+            }
+            return true;
+        }
+        case PACKED_FLOAT: {
+            const float *src = (const float *)packedData;
+            for (size_t i = 0; i < n; ++i) {
+                dst[i] = T(src[i]);
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
     inline size_t
     size(void) const {
         return values.size();
@@ -292,6 +473,28 @@ public:
         size = _size;
         buf = new char[_size];
         bound = false;
+        file = NULL;
+        stored_size = _size;
+    }
+
+    /**
+     * Lazy blob: only the file location of the data is recorded, and
+     * the bytes are read in on the first toPointer() call.  Only
+     * valid while the file is open (i.e. while the originating parser
+     * is).
+     *
+     * _stored_size is the payload's size in the file; when it differs
+     * from _size the payload is snappy-compressed and load() inflates
+     * it.
+     */
+    Blob(File *_file, const File::Offset &_offset, size_t _size,
+         size_t _stored_size) {
+        size = _size;
+        buf = NULL;
+        bound = false;
+        file = _file;
+        offset = _offset;
+        stored_size = _stored_size;
     }
 
     ~Blob();
@@ -301,9 +504,16 @@ public:
     void *toPointer(bool bind);
     void visit(Visitor &visitor);
 
+    /** Read in the contents of a lazy blob. */
+    void load(void) const;
+
     size_t size;
-    char *buf;
+    mutable char *buf;
     bool bound;
+
+    File *file;
+    File::Offset offset;
+    size_t stored_size;
 };
 
 
@@ -344,6 +554,7 @@ public:
     virtual void *toPointer(bool bind);
     virtual unsigned long long toUIntPtr(void) const;
     virtual const char *toString(void) const;
+    virtual const Array *toArray(void) const;
 
     void visit(Visitor &visitor);
 };
@@ -449,9 +660,27 @@ enum {
      * Whether this call is verbose (i.e., not usually interesting).
      */
     CALL_FLAG_VERBOSE                  = (1 << 7),
+
+    /**
+     * Whether this call blocks until the API has finished prior work
+     * (glFinish, sync-object waits), so synchronization points can be
+     * classified with a bit test instead of a name comparison.
+     */
+    CALL_FLAG_SYNC                     = (1 << 8),
 };
 
 
+/**
+ * Lookup the flags of a call by function name.
+ *
+ * The same name-keyed table the parser uses to label parsed calls,
+ * exposed as a free function so the capture side can classify calls
+ * it is about to record (see trace_writer_local.cpp).
+ */
+CallFlags
+lookupCallFlags(const char *name);
+
+
 struct Arg
 {
     Value *value;
@@ -462,6 +691,12 @@ class Call
 {
 public:
     unsigned thread_id;
+
+    /* Dense index of the call's thread, assigned by the parser in
+     * first-seen order (see Parser::threadIds()); thread_id is the id
+     * recorded at capture, which need not be small or contiguous. */
+    unsigned short thread_index;
+
     unsigned no;
     const FunctionSig *sig;
     std::vector<Arg> args;
@@ -469,16 +704,32 @@ public:
 
     CallFlags flags;
 
+    /* Arena backing this call's values, if they were arena-allocated
+     * (see Parser); destroyed after the values. */
+    Arena *arena;
+
     Call(FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id) :
-        thread_id(_thread_id), 
-        sig(_sig), 
-        args(_sig->num_args), 
+        thread_id(_thread_id),
+        thread_index(0),
+        sig(_sig),
+        args(_sig->num_args),
         ret(0),
-        flags(_flags) {
+        flags(_flags),
+        arena(0) {
     }
 
     ~Call();
 
+    /**
+     * Dispose of the call's values, keeping the shell -- argument
+     * vector capacity and arena blocks -- ready for reuse (see
+     * Parser::recycle).
+     */
+    void reset(void);
+
+    /** Reinitialize a recycled call for another function invocation. */
+    void reuse(const FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id);
+
     inline const char * name(void) const {
         return sig->name;
     }
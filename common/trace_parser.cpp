@@ -29,6 +29,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <list>
+#include <new>
+
+#include <snappy.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "trace_callset.hpp"
 #include "trace_file.hpp"
 #include "trace_parser.hpp"
 
@@ -39,6 +49,9 @@
 namespace trace {
 
 
+static inline size_t varint_length(const unsigned char *p);
+
+
 Parser::Parser() {
     file = NULL;
     next_call_no = 0;
@@ -46,6 +59,18 @@ Parser::Parser() {
     api = API_UNKNOWN;
 
     glGetErrorSig = NULL;
+
+    cur_arena = NULL;
+    sig_arena = NULL;
+    lazy_blobs = false;
+    memory_budget = 0;
+    owns_sigs = true;
+    sig_registry = NULL;
+    suppressed_leave = false;
+    focus_set = NULL;
+
+    m_scanArgCount = 0;
+    m_scanBlobBytes = 0;
 }
 
 
@@ -61,6 +86,10 @@ bool Parser::open(const char *filename) {
         return false;
     }
 
+    if (!sig_arena) {
+        sig_arena = new Arena;
+    }
+
     version = read_uint();
     if (version > TRACE_VERSION) {
         std::cerr << "error: unsupported trace format version " << version << "\n";
@@ -68,6 +97,14 @@ bool Parser::open(const char *filename) {
     }
     api = API_UNKNOWN;
 
+    // Parsing is mostly sequential, so overlap chunk decompression
+    // with it where the file implementation can.
+    file->setReadAhead(true);
+
+    if (file->supportsOffsets()) {
+        getBookmark(high_water);
+    }
+
     return true;
 }
 
@@ -97,61 +134,191 @@ void Parser::close(void) {
     }
 
     deleteAll(calls);
-
-    // Delete all signature data.  Signatures are mere structures which don't
-    // own their own memory, so we need to destroy all data we created here.
-
-    for (FunctionMap::iterator it = functions.begin(); it != functions.end(); ++it) {
-        FunctionSigState *sig = *it;
-        if (sig) {
-            delete [] sig->name;
-            for (unsigned arg = 0; arg < sig->num_args; ++arg) {
-                delete [] sig->arg_names[arg];
-            }
-            delete [] sig->arg_names;
-            delete sig;
+    deleteAll(free_calls);
+
+    suppressed_calls.clear();
+    suppressed_leave = false;
+
+    if (!owns_sigs) {
+        // the maps belong to the shared registry; our own arena only
+        // holds our pooled strings
+        functions.clear();
+        structs.clear();
+        enums.clear();
+        bitmasks.clear();
+        blob_defs.clear();
+        string_pool.clear();
+        thread_ids.clear();
+        delete sig_arena;
+        sig_arena = NULL;
+        if (sig_registry) {
+            sig_registry->release();
+            sig_registry = NULL;
         }
+        owns_sigs = true;
+        next_call_no = 0;
+        high_water = ParseBookmark();
+        return;
     }
+
+    // All signature objects, strings and tables, as well as the
+    // pooled string values, live in the signature arena, so dropping
+    // the maps and the arena frees everything.
+
     functions.clear();
+    structs.clear();
+    enums.clear();
+    bitmasks.clear();
+    blob_defs.clear();
+    string_pool.clear();
+    thread_ids.clear();
 
-    for (StructMap::iterator it = structs.begin(); it != structs.end(); ++it) {
-        StructSigState *sig = *it;
-        if (sig) {
-            delete [] sig->name;
-            for (unsigned member = 0; member < sig->num_members; ++member) {
-                delete [] sig->member_names[member];
-            }
-            delete [] sig->member_names;
-            delete sig;
+    delete sig_arena;
+    sig_arena = NULL;
+
+    next_call_no = 0;
+    high_water = ParseBookmark();
+}
+
+
+void Parser::recycle(Call *call) {
+    call->reset();
+    free_calls.push_back(call);
+}
+
+
+unsigned short Parser::remapThread(unsigned thread_id) {
+    for (size_t i = 0; i < thread_ids.size(); ++i) {
+        if (thread_ids[i] == thread_id) {
+            return (unsigned short)i;
         }
     }
-    structs.clear();
+    thread_ids.push_back(thread_id);
+    return (unsigned short)(thread_ids.size() - 1);
+}
 
-    for (EnumMap::iterator it = enums.begin(); it != enums.end(); ++it) {
-        EnumSigState *sig = *it;
-        if (sig) {
-            for (unsigned value = 0; value < sig->num_values; ++value) {
-                delete [] sig->values[value].name;
-            }
-            delete [] sig->values;
-            delete sig;
+
+uint64_t Parser::memoryUsage(void) const {
+    uint64_t usage = blob_defs.capacity() * sizeof(BlobDef);
+    if (sig_arena) {
+        usage += sig_arena->allocated();
+    }
+    return usage;
+}
+
+
+SigRegistry::SigRegistry() :
+    refcount(1),
+    arena(NULL),
+    glGetErrorSig(NULL)
+{
+}
+
+
+SigRegistry::~SigRegistry() {
+    delete arena;
+}
+
+
+void SigRegistry::acquire(void) {
+    mutex.lock();
+    ++refcount;
+    mutex.unlock();
+}
+
+
+void SigRegistry::release(void) {
+    mutex.lock();
+    bool last = --refcount == 0;
+    mutex.unlock();
+    if (last) {
+        delete this;
+    }
+}
+
+
+SigRegistry *Parser::exportSigs(void) {
+    if (sig_registry) {
+        sig_registry->acquire();
+        return sig_registry;
+    }
+
+    assert(owns_sigs);
+
+    SigRegistry *registry = new SigRegistry;
+    registry->arena = sig_arena;
+    registry->functions = functions;
+    registry->structs = structs;
+    registry->enums = enums;
+    registry->bitmasks = bitmasks;
+    registry->blob_defs = blob_defs;
+    registry->thread_ids = thread_ids;
+    registry->glGetErrorSig = glGetErrorSig;
+
+    // The registry now owns the arena.  Strings and cached blobs we
+    // have already handed out live there and stay valid through our
+    // reference; further pooling goes to a fresh private arena, like
+    // any other attached parser's.
+    sig_arena = new Arena;
+    owns_sigs = false;
+
+    // The constructor's reference is ours; take one for the caller.
+    sig_registry = registry;
+    registry->acquire();
+    return registry;
+}
+
+
+void Parser::attachSigs(SigRegistry *registry) {
+    assert(owns_sigs && functions.empty() && !sig_registry);
+    registry->acquire();
+    sig_registry = registry;
+    functions = registry->functions;
+    structs = registry->structs;
+    enums = registry->enums;
+    bitmasks = registry->bitmasks;
+    blob_defs = registry->blob_defs;
+    thread_ids = registry->thread_ids;
+    glGetErrorSig = registry->glGetErrorSig;
+    owns_sigs = false;
+}
+
+
+void Parser::shareSigsFrom(Parser &other) {
+    SigRegistry *registry = other.exportSigs();
+    attachSigs(registry);
+    registry->release();
+}
+
+
+void Parser::suppress(const char *function) {
+    suppressed_names.insert(function);
+
+    // Mark signatures that have already been parsed.
+    for (FunctionMap::iterator it = functions.begin(); it != functions.end(); ++it) {
+        FunctionSigState *sig = *it;
+        if (sig && strcmp(sig->name, function) == 0) {
+            sig->suppressed = true;
         }
     }
-    enums.clear();
-    
-    for (BitmaskMap::iterator it = bitmasks.begin(); it != bitmasks.end(); ++it) {
-        BitmaskSigState *sig = *it;
+}
+
+
+void Parser::focus(const CallSet *set) {
+    // Only pure-pattern sets can be decided per signature; a set that
+    // also has numeric ranges may select any call by number.
+    focus_set = set && !set->namePatterns.empty() && set->ranges.empty()
+                ? set : NULL;
+
+    // Update signatures that have already been parsed.
+    for (FunctionMap::iterator it = functions.begin(); it != functions.end(); ++it) {
+        FunctionSigState *sig = *it;
         if (sig) {
-            for (unsigned flag = 0; flag < sig->num_flags; ++flag) {
-                delete [] sig->flags[flag].name;
-            }
-            delete [] sig->flags;
-            delete sig;
+            sig->suppressed = (!suppressed_names.empty() &&
+                               suppressed_names.count(sig->name) != 0) ||
+                              (focus_set && !focus_set->matchesName(sig->name));
         }
     }
-    bitmasks.clear();
-
-    next_call_no = 0;
 }
 
 
@@ -162,11 +329,81 @@ void Parser::getBookmark(ParseBookmark &bookmark) {
 
 
 void Parser::setBookmark(const ParseBookmark &bookmark) {
+    // The signature maps retain everything ingested up to here even
+    // across a rewind; remember how far that is (see parseCallAt).
+    if (high_water.offset < file->currentOffset()) {
+        getBookmark(high_water);
+    }
+
     file->setCurrentOffset(bookmark.offset);
     next_call_no = bookmark.next_call_no;
-    
+
     // Simply ignore all pending calls
     deleteAll(calls);
+    suppressed_calls.clear();
+    suppressed_leave = false;
+}
+
+
+Call *Parser::parseCallAt(const ParseBookmark &bookmark) {
+    if (!file->supportsOffsets()) {
+        return NULL;
+    }
+
+    ParseBookmark save;
+    getBookmark(save);
+    if (high_water.offset < save.offset) {
+        high_water = save;
+    }
+
+    // Signature definitions are inlined at first use, so the region
+    // up to the bookmark must have been read at least once before the
+    // call there can be decoded.  Catch up in SCAN mode if the lookup
+    // is beyond everything seen so far; the maps persist, so this is
+    // paid at most once per region.
+    if (high_water.offset < bookmark.offset) {
+        setBookmark(high_water);
+        while (file->currentOffset() < bookmark.offset) {
+            Call *skipped = parse_call(SCAN);
+            if (!skipped) {
+                break;
+            }
+            recycle(skipped);
+        }
+        getBookmark(high_water);
+    }
+
+    setBookmark(bookmark);
+    unsigned target = bookmark.next_call_no;
+
+    Call *call;
+    while ((call = parse_call())) {
+        if (call->no == target) {
+            break;
+        }
+        // A call from another thread completed first; the target is
+        // gone altogether if it is no longer pending (suppressed, or
+        // dropped by focus()).
+        recycle(call);
+        bool pending = false;
+        for (CallList::iterator it = calls.begin(); it != calls.end(); ++it) {
+            if ((*it)->no == target) {
+                pending = true;
+                break;
+            }
+        }
+        if (!pending) {
+            call = NULL;
+            break;
+        }
+    }
+
+    if (high_water.offset < file->currentOffset()) {
+        getBookmark(high_water);
+    }
+
+    setBookmark(save);
+    return call;
 }
 
 
@@ -180,8 +417,18 @@ Call *Parser::parse_call(Mode mode) {
             break;
         case trace::EVENT_LEAVE:
             call = parse_leave(mode);
-            adjust_call_flags(call);
+            if (!call && suppressed_leave) {
+                suppressed_leave = false;
+                break;
+            }
+            if (call) {
+                adjust_call_flags(call);
+            }
             return call;
+        case trace::EVENT_FUNCTION_SIG:
+            // standalone signature definition (version 6+)
+            parse_function_sig();
+            break;
         default:
             std::cerr << "error: unknown event " << c << "\n";
             exit(1);
@@ -189,7 +436,7 @@ Call *Parser::parse_call(Mode mode) {
             if (!calls.empty()) {
                 call = calls.front();
                 call->flags |= CALL_FLAG_INCOMPLETE;
-                calls.pop_front();
+                calls.erase(calls.begin());
                 adjust_call_flags(call);
                 return call;
             }
@@ -199,6 +446,122 @@ Call *Parser::parse_call(Mode mode) {
 }
 
 
+/**
+ * Like parse_call_details(SCAN), but without a Call to attach details
+ * to: everything is consumed and discarded.
+ */
+bool Parser::skip_call_details(void) {
+    do {
+        int c = read_byte();
+        switch (c) {
+        case trace::CALL_END:
+            return true;
+        case trace::CALL_ARG:
+            skip_uint();
+            ++m_scanArgCount;
+            scan_value();
+            break;
+        case trace::CALL_RET:
+            scan_value();
+            break;
+        default:
+            std::cerr << "error: unknown call detail " << c << "\n";
+            exit(1);
+        case -1:
+            return false;
+        }
+    } while(true);
+}
+
+
+bool Parser::scan(CallStatsVisitor &visitor) {
+    // Minimal stand-in for the pending-call list of parse_call().
+    struct PendingStat {
+        unsigned no;
+        FunctionSigFlags *sig;
+        unsigned thread_id;
+        uint64_t bytes;
+        unsigned num_args;
+        uint64_t blob_bytes;
+    };
+    std::list<PendingStat> pending;
+
+    for (;;) {
+        int c = read_byte();
+        switch (c) {
+        case trace::EVENT_ENTER: {
+            uint64_t begin = file->bytesConsumed();
+
+            PendingStat stat;
+            if (version >= 4) {
+                stat.thread_id = read_uint();
+            } else {
+                stat.thread_id = 0;
+            }
+            remapThread(stat.thread_id);
+            stat.sig = parse_function_sig();
+            stat.no = next_call_no++;
+
+            m_scanArgCount = 0;
+            m_scanBlobBytes = 0;
+            bool complete = skip_call_details();
+            stat.bytes = file->bytesConsumed() - begin + 1;
+            stat.num_args = m_scanArgCount;
+            stat.blob_bytes = m_scanBlobBytes;
+            if (complete) {
+                pending.push_back(stat);
+            }
+            break;
+        }
+        case trace::EVENT_LEAVE: {
+            uint64_t begin = file->bytesConsumed();
+            unsigned call_no = read_uint();
+
+            std::list<PendingStat>::iterator it;
+            for (it = pending.begin(); it != pending.end(); ++it) {
+                if (it->no == call_no) {
+                    break;
+                }
+            }
+            if (it == pending.end()) {
+                skip_call_details();
+                break;
+            }
+
+            m_scanArgCount = 0;
+            m_scanBlobBytes = 0;
+            bool complete = skip_call_details();
+            it->bytes += file->bytesConsumed() - begin + 1;
+            it->num_args += m_scanArgCount;
+            it->blob_bytes += m_scanBlobBytes;
+            if (complete) {
+                visitor.visit(it->sig, it->no, it->thread_id,
+                              it->sig->flags, it->bytes,
+                              it->num_args, it->blob_bytes);
+            }
+            pending.erase(it);
+            break;
+        }
+        case trace::EVENT_FUNCTION_SIG:
+            parse_function_sig();
+            break;
+        default:
+            std::cerr << "error: unknown event " << c << "\n";
+            exit(1);
+        case -1:
+            // report calls whose leave never arrived
+            for (std::list<PendingStat>::iterator it = pending.begin();
+                 it != pending.end(); ++it) {
+                visitor.visit(it->sig, it->no, it->thread_id,
+                              it->sig->flags, it->bytes,
+                              it->num_args, it->blob_bytes);
+            }
+            return pending.empty();
+        }
+    }
+}
+
+
 /**
  * Helper function to lookup an ID in a vector, resizing the vector if it doesn't fit.
  */
@@ -221,16 +584,19 @@ Parser::parse_function_sig(void) {
 
     if (!sig) {
         /* parse the signature */
-        sig = new FunctionSigState;
+        sig = new (sig_arena->alloc(sizeof *sig)) FunctionSigState;
         sig->id = id;
-        sig->name = read_string();
+        sig->name = intern_string();
         sig->num_args = read_uint();
-        const char **arg_names = new const char *[sig->num_args];
+        const char **arg_names = (const char **)sig_arena->alloc(sig->num_args * sizeof *arg_names);
         for (unsigned i = 0; i < sig->num_args; ++i) {
-            arg_names[i] = read_string();
+            arg_names[i] = intern_string();
         }
         sig->arg_names = arg_names;
         sig->flags = lookupCallFlags(sig->name);
+        sig->suppressed = (!suppressed_names.empty() &&
+                           suppressed_names.count(sig->name) != 0) ||
+                          (focus_set && !focus_set->matchesName(sig->name));
         sig->offset = file->currentOffset();
         functions[id] = sig;
 
@@ -290,13 +656,13 @@ StructSig *Parser::parse_struct_sig() {
 
     if (!sig) {
         /* parse the signature */
-        sig = new StructSigState;
+        sig = new (sig_arena->alloc(sizeof *sig)) StructSigState;
         sig->id = id;
-        sig->name = read_string();
+        sig->name = intern_string();
         sig->num_members = read_uint();
-        const char **member_names = new const char *[sig->num_members];
+        const char **member_names = (const char **)sig_arena->alloc(sig->num_members * sizeof *member_names);
         for (unsigned i = 0; i < sig->num_members; ++i) {
-            member_names[i] = read_string();
+            member_names[i] = intern_string();
         }
         sig->member_names = member_names;
         sig->offset = file->currentOffset();
@@ -328,11 +694,11 @@ EnumSig *Parser::parse_old_enum_sig() {
 
     if (!sig) {
         /* parse the signature */
-        sig = new EnumSigState;
+        sig = new (sig_arena->alloc(sizeof *sig)) EnumSigState;
         sig->id = id;
         sig->num_values = 1;
-        EnumValue *values = new EnumValue[sig->num_values];
-        values->name = read_string();
+        EnumValue *values = (EnumValue *)sig_arena->alloc(sig->num_values * sizeof *values);
+        values->name = intern_string();
         values->value = read_sint();
         sig->values = values;
         sig->offset = file->currentOffset();
@@ -355,12 +721,12 @@ EnumSig *Parser::parse_enum_sig() {
 
     if (!sig) {
         /* parse the signature */
-        sig = new EnumSigState;
+        sig = new (sig_arena->alloc(sizeof *sig)) EnumSigState;
         sig->id = id;
         sig->num_values = read_uint();
-        EnumValue *values = new EnumValue[sig->num_values];
+        EnumValue *values = (EnumValue *)sig_arena->alloc(sig->num_values * sizeof *values);
         for (EnumValue *it = values; it != values + sig->num_values; ++it) {
-            it->name = read_string();
+            it->name = intern_string();
             it->value = read_sint();
         }
         sig->values = values;
@@ -387,12 +753,12 @@ BitmaskSig *Parser::parse_bitmask_sig() {
 
     if (!sig) {
         /* parse the signature */
-        sig = new BitmaskSigState;
+        sig = new (sig_arena->alloc(sizeof *sig)) BitmaskSigState;
         sig->id = id;
         sig->num_flags = read_uint();
-        BitmaskFlag *flags = new BitmaskFlag[sig->num_flags];
+        BitmaskFlag *flags = (BitmaskFlag *)sig_arena->alloc(sig->num_flags * sizeof *flags);
         for (BitmaskFlag *it = flags; it != flags + sig->num_flags; ++it) {
-            it->name = read_string();
+            it->name = intern_string();
             it->value = read_uint();
             if (it->value == 0 && it != flags) {
                 std::cerr << "warning: bitmask " << it->name << " is zero but is not first flag\n";
@@ -426,14 +792,30 @@ void Parser::parse_enter(Mode mode) {
 
     FunctionSigFlags *sig = parse_function_sig();
 
-    Call *call = new Call(sig, sig->flags, thread_id);
+    if (sig->suppressed) {
+        unsigned no = next_call_no++;
+        if (skip_call_details()) {
+            suppressed_calls.push_back(no);
+        }
+        return;
+    }
+
+    Call *call;
+    if (free_calls.empty()) {
+        call = new Call(sig, sig->flags, thread_id);
+    } else {
+        call = free_calls.back();
+        free_calls.pop_back();
+        call->reuse(sig, sig->flags, thread_id);
+    }
 
     call->no = next_call_no++;
+    call->thread_index = remapThread(thread_id);
 
     if (parse_call_details(call, mode)) {
         calls.push_back(call);
     } else {
-        delete call;
+        recycle(call);
     }
 }
 
@@ -449,19 +831,36 @@ Call *Parser::parse_leave(Mode mode) {
         }
     }
     if (!call) {
+        // The leave of a call suppressed at its enter; consume its
+        // details likewise.
+        for (std::vector<unsigned>::iterator it = suppressed_calls.begin();
+             it != suppressed_calls.end(); ++it) {
+            if (*it == call_no) {
+                suppressed_calls.erase(it);
+                skip_call_details();
+                suppressed_leave = true;
+                break;
+            }
+        }
         return NULL;
     }
 
     if (parse_call_details(call, mode)) {
         return call;
     } else {
-        delete call;
+        recycle(call);
         return NULL;
     }
 }
 
 
 bool Parser::parse_call_details(Call *call, Mode mode) {
+    if (mode == FULL) {
+        if (!call->arena) {
+            call->arena = new Arena;
+        }
+        cur_arena = call->arena;
+    }
     do {
         int c = read_byte();
         switch (c) {
@@ -512,9 +911,12 @@ void Parser::parse_arg(Call *call, Mode mode) {
 
 
 Value *Parser::parse_value(void) {
-    int c;
+    return parse_value(read_byte());
+}
+
+
+Value *Parser::parse_value(int c) {
     Value *value;
-    c = read_byte();
     switch (c) {
     case trace::TYPE_NULL:
         value = new Null;
@@ -553,7 +955,19 @@ Value *Parser::parse_value(void) {
         value = parse_struct();
         break;
     case trace::TYPE_BLOB:
-        value = parse_blob();
+        value = parse_blob(false);
+        break;
+    case trace::TYPE_BLOB_COMPRESSED:
+        value = parse_blob(true);
+        break;
+    case trace::TYPE_BLOB_DEF:
+        value = parse_blob_def(false);
+        break;
+    case trace::TYPE_BLOB_DEF_COMPRESSED:
+        value = parse_blob_def(true);
+        break;
+    case trace::TYPE_BLOB_REF:
+        value = parse_blob_ref();
         break;
     case trace::TYPE_OPAQUE:
         value = parse_opaque();
@@ -612,7 +1026,19 @@ void Parser::scan_value(void) {
         scan_struct();
         break;
     case trace::TYPE_BLOB:
-        scan_blob();
+        scan_blob(false);
+        break;
+    case trace::TYPE_BLOB_COMPRESSED:
+        scan_blob(true);
+        break;
+    case trace::TYPE_BLOB_DEF:
+        scan_blob_def(false);
+        break;
+    case trace::TYPE_BLOB_DEF_COMPRESSED:
+        scan_blob_def(true);
+        break;
+    case trace::TYPE_BLOB_REF:
+        scan_blob_ref();
         break;
     case trace::TYPE_OPAQUE:
         scan_opaque();
@@ -630,7 +1056,7 @@ void Parser::scan_value(void) {
 
 
 Value *Parser::parse_sint() {
-    return new SInt(-(signed long long)read_uint());
+    return new (*cur_arena) SInt(-(signed long long)read_uint());
 }
 
 
@@ -640,7 +1066,7 @@ void Parser::scan_sint() {
 
 
 Value *Parser::parse_uint() {
-    return new UInt(read_uint());
+    return new (*cur_arena) UInt(read_uint());
 }
 
 
@@ -652,7 +1078,7 @@ void Parser::scan_uint() {
 Value *Parser::parse_float() {
     float value;
     file->read(&value, sizeof value);
-    return new Float(value);
+    return new (*cur_arena) Float(value);
 }
 
 
@@ -664,7 +1090,7 @@ void Parser::scan_float() {
 Value *Parser::parse_double() {
     double value;
     file->read(&value, sizeof value);
-    return new Double(value);
+    return new (*cur_arena) Double(value);
 }
 
 
@@ -674,7 +1100,28 @@ void Parser::scan_double() {
 
 
 Value *Parser::parse_string() {
-    return new String(read_string());
+    size_t len = read_uint();
+
+    // Short strings go through the intern pool, so that the millions
+    // of repeats of the same uniform/attribute names in shader-heavy
+    // traces all share a single copy.
+    if (len <= STRING_POOL_MAX_LEN) {
+        char buf[STRING_POOL_MAX_LEN + 1];
+        if (len) {
+            file->read(buf, len);
+        }
+        buf[len] = 0;
+        return new (*cur_arena) String(pool_string(buf, len), false);
+    }
+
+    // Pack longer strings into the call's arena, right next to the
+    // value nodes, instead of a separate heap allocation.
+    char *str = (char *)cur_arena->alloc(len + 1);
+    if (len) {
+        file->read(str, len);
+    }
+    str[len] = 0;
+    return new (*cur_arena) String(str, false);
 }
 
 
@@ -694,7 +1141,7 @@ Value *Parser::parse_enum() {
         assert(sig->num_values == 1);
         value = sig->values->value;
     }
-    return new Enum(sig, value);
+    return new (*cur_arena) Enum(sig, value);
 }
 
 
@@ -713,7 +1160,7 @@ Value *Parser::parse_bitmask() {
 
     unsigned long long value = read_uint();
 
-    return new Bitmask(sig, value);
+    return new (*cur_arena) Bitmask(sig, value);
 }
 
 
@@ -725,43 +1172,273 @@ void Parser::scan_bitmask() {
 
 Value *Parser::parse_array(void) {
     size_t len = read_uint();
-    Array *array = new Array(len);
+    Array *array = new (*cur_arena) Array(len);
+
+    // Classify the elements as they are parsed, so that arrays of
+    // uniform scalars (index and vertex data, above all) can also be
+    // stored in bulk, as a contiguous typed buffer.
+    bool allUInt = len != 0;
+    bool allFloat = len != 0;
+    unsigned long long maxUInt = 0;
+
     for (size_t i = 0; i < len; ++i) {
-        array->values[i] = parse_value();
+        int c = read_byte();
+        Value *value = parse_value(c);
+        array->values[i] = value;
+        if (c == trace::TYPE_UINT) {
+            allFloat = false;
+            unsigned long long v = static_cast<UInt *>(value)->value;
+            if (v > maxUInt) {
+                maxUInt = v;
+            }
+        } else if (c == trace::TYPE_FLOAT) {
+            allUInt = false;
+        } else {
+            allUInt = false;
+            allFloat = false;
+        }
     }
+
+    if (allUInt) {
+        // Narrow to the smallest packed type that holds every element.
+        if (maxUInt <= 0xff) {
+            unsigned char *data = (unsigned char *)cur_arena->alloc(len * sizeof *data);
+            for (size_t i = 0; i < len; ++i) {
+                data[i] = (unsigned char)static_cast<UInt *>(array->values[i])->value;
+            }
+            array->packedType = Array::PACKED_UINT8;
+            array->packedData = data;
+        } else if (maxUInt <= 0xffff) {
+            unsigned short *data = (unsigned short *)cur_arena->alloc(len * sizeof *data);
+            for (size_t i = 0; i < len; ++i) {
+                data[i] = (unsigned short)static_cast<UInt *>(array->values[i])->value;
+            }
+            array->packedType = Array::PACKED_UINT16;
+            array->packedData = data;
+        } else if (maxUInt <= 0xffffffffULL) {
+            unsigned int *data = (unsigned int *)cur_arena->alloc(len * sizeof *data);
+            for (size_t i = 0; i < len; ++i) {
+                data[i] = (unsigned int)static_cast<UInt *>(array->values[i])->value;
+            }
+            array->packedType = Array::PACKED_UINT32;
+            array->packedData = data;
+        }
+    } else if (allFloat) {
+        float *data = (float *)cur_arena->alloc(len * sizeof *data);
+        for (size_t i = 0; i < len; ++i) {
+            data[i] = static_cast<Float *>(array->values[i])->value;
+        }
+        array->packedType = Array::PACKED_FLOAT;
+        array->packedData = data;
+    }
+
     return array;
 }
 
 
 void Parser::scan_array(void) {
     size_t len = read_uint();
-    for (size_t i = 0; i < len; ++i) {
+    size_t i = 0;
+
+    /*
+     * Arrays are overwhelmingly homogeneous runs of scalar elements
+     * (index arrays, parameter lists), and dispatching each one
+     * through scan_value() pays a virtual byte fetch per element.
+     * Walk the container's buffer directly instead, keeping enough
+     * slack that varint_length() can always load 16 bytes; the inner
+     * loop only leaves for elements that actually need the generic
+     * path.
+     */
+    const char *ptr;
+    size_t avail;
+    while (i < len && (avail = file->peek(&ptr)) >= 32) {
+        const unsigned char *p = (const unsigned char *)ptr;
+        const unsigned char *end = p + avail - 32;
+        const unsigned char *q = p;
+        while (i < len && q <= end) {
+            if (*q == TYPE_SINT || *q == TYPE_UINT) {
+                q += 1 + varint_length(q + 1);
+            } else if (*q == TYPE_FLOAT) {
+                q += 1 + sizeof(float);
+            } else if (*q == TYPE_DOUBLE) {
+                q += 1 + sizeof(double);
+            } else {
+                break;
+            }
+            ++i;
+        }
+        file->advance(q - p);
+        if (i < len && q <= end) {
+            // a non-scalar element; scan it generically and resume
+            scan_value();
+            ++i;
+        }
+    }
+
+    for (; i < len; ++i) {
         scan_value();
     }
 }
 
 
-Value *Parser::parse_blob(void) {
+/*
+ * Read a blob payload into buf, inflating it when it was stored
+ * snappy-compressed (stored_size != size, version 7+).
+ */
+void Parser::read_blob_data(char *buf, size_t size, size_t stored_size) {
+    if (!size) {
+        return;
+    }
+    if (stored_size != size) {
+        char *compressed = new char[stored_size];
+        file->read(compressed, stored_size);
+        if (!snappy::RawUncompress(compressed, stored_size, buf)) {
+            std::cerr << "error: corrupt compressed blob\n";
+            exit(1);
+        }
+        delete [] compressed;
+    } else {
+        file->read(buf, size);
+    }
+}
+
+
+Value *Parser::parse_blob(bool compressed) {
     size_t size = read_uint();
-    Blob *blob = new Blob(size);
-    if (size) {
-        file->read(blob->buf, size);
+    size_t stored_size = compressed ? read_uint() : size;
+    if (lazy_blobs && file->supportsOffsets()) {
+        Blob *blob = new (*cur_arena) Blob(file, file->currentOffset(), size, stored_size);
+        if (stored_size) {
+            file->skip(stored_size);
+        }
+        return blob;
     }
+    Blob *blob = new (*cur_arena) Blob(size);
+    read_blob_data(blob->buf, size, stored_size);
     return blob;
 }
 
 
-void Parser::scan_blob(void) {
+void Parser::scan_blob(bool compressed) {
     size_t size = read_uint();
-    if (size) {
-        file->skip(size);
+    size_t stored_size = compressed ? read_uint() : size;
+    m_scanBlobBytes += size;
+    if (stored_size) {
+        file->skip(stored_size);
     }
 }
 
 
+Value *Parser::parse_blob_def(bool compressed) {
+    size_t index = read_uint();
+    size_t size = read_uint();
+    size_t stored_size = compressed ? read_uint() : size;
+
+    if (index >= blob_defs.size()) {
+        blob_defs.resize(index + 1);
+    }
+    BlobDef &def = blob_defs[index];
+    bool first = !def.defined;
+    if (first) {
+        def.defined = true;
+        def.offset = file->currentOffset();
+        def.size = size;
+        def.stored_size = stored_size;
+    }
+
+    if (lazy_blobs && file->supportsOffsets()) {
+        Blob *blob = new (*cur_arena) Blob(file, file->currentOffset(), size, stored_size);
+        if (stored_size) {
+            file->skip(stored_size);
+        }
+        return blob;
+    }
+
+    Blob *blob = new (*cur_arena) Blob(size);
+    read_blob_data(blob->buf, size, stored_size);
+
+    if (first) {
+        if (memory_budget &&
+            memoryUsage() + size > memory_budget &&
+            file->supportsOffsets()) {
+            // Over budget: leave this copy uncached (back-references
+            // materialize from def.offset instead) and spill further
+            // blobs to their file locations eagerly.
+            lazy_blobs = true;
+        } else {
+            // keep a copy for back-references, so resolving them
+            // doesn't seek the file around; the writer only registers
+            // blobs up to a fixed memory budget, which bounds these
+            // copies too
+            char *copy = (char *)sig_arena->alloc(size);
+            memcpy(copy, blob->buf, size);
+            def.cached = copy;
+        }
+    }
+
+    return blob;
+}
+
+
+void Parser::scan_blob_def(bool compressed) {
+    size_t index = read_uint();
+    size_t size = read_uint();
+    size_t stored_size = compressed ? read_uint() : size;
+    m_scanBlobBytes += size;
+
+    if (index >= blob_defs.size()) {
+        blob_defs.resize(index + 1);
+    }
+    BlobDef &def = blob_defs[index];
+    if (!def.defined) {
+        def.defined = true;
+        def.offset = file->currentOffset();
+        def.size = size;
+        def.stored_size = stored_size;
+    }
+
+    if (stored_size) {
+        file->skip(stored_size);
+    }
+}
+
+
+Value *Parser::parse_blob_ref(void) {
+    size_t index = read_uint();
+    if (index >= blob_defs.size() || !blob_defs[index].defined) {
+        std::cerr << "error: blob back-reference " << index << " without definition\n";
+        exit(1);
+    }
+    const BlobDef &def = blob_defs[index];
+
+    if (lazy_blobs && file->supportsOffsets()) {
+        return new (*cur_arena) Blob(file, def.offset, def.size, def.stored_size);
+    }
+
+    Blob *blob = new (*cur_arena) Blob(def.size);
+    if (def.cached) {
+        memcpy(blob->buf, def.cached, def.size);
+    } else if (def.size) {
+        // no cached copy (the definition was seen by a SCAN pass, or
+        // with lazy blobs enabled); materialize from its location in
+        // the file without disturbing the read position
+        File::Offset save = file->currentOffset();
+        file->setCurrentOffset(def.offset);
+        read_blob_data(blob->buf, def.size, def.stored_size);
+        file->setCurrentOffset(save);
+    }
+    return blob;
+}
+
+
+void Parser::scan_blob_ref(void) {
+    skip_uint();
+}
+
+
 Value *Parser::parse_struct() {
     StructSig *sig = parse_struct_sig();
-    Struct *value = new Struct(sig);
+    Struct *value = new (*cur_arena) Struct(sig);
 
     for (size_t i = 0; i < sig->num_members; ++i) {
         value->members[i] = parse_value();
@@ -782,7 +1459,7 @@ void Parser::scan_struct() {
 Value *Parser::parse_opaque() {
     unsigned long long addr;
     addr = read_uint();
-    return new Pointer(addr);
+    return new (*cur_arena) Pointer(addr);
 }
 
 
@@ -794,7 +1471,7 @@ void Parser::scan_opaque() {
 Value *Parser::parse_repr() {
     Value *humanValue = parse_value();
     Value *machineValue = parse_value();
-    return new Repr(humanValue, machineValue);
+    return new (*cur_arena) Repr(humanValue, machineValue);
 }
 
 
@@ -804,9 +1481,31 @@ void Parser::scan_repr() {
 }
 
 
-const char * Parser::read_string(void) {
+/**
+ * Return the pooled copy of a string value, interning it first if it
+ * has not been seen before.  Pooled characters live in the signature
+ * arena and remain valid while this parser is open.
+ */
+const char * Parser::pool_string(const char *str, size_t len) {
+    StringPool::iterator it = string_pool.find(str);
+    if (it != string_pool.end()) {
+        return *it;
+    }
+
+    char *copy = (char *)sig_arena->alloc(len + 1);
+    memcpy(copy, str, len + 1);
+    string_pool.insert(copy);
+    return copy;
+}
+
+
+/**
+ * Read a string into the signature arena, where it lives as long as
+ * the parser instead of needing an individual delete.
+ */
+const char * Parser::intern_string(void) {
     size_t len = read_uint();
-    char * value = new char[len + 1];
+    char * value = (char *)sig_arena->alloc(len + 1);
     if (len) {
         file->read(value, len);
     }
@@ -851,7 +1550,55 @@ Parser::skip_sint(void) {
     skip_uint();
 }
 
+/**
+ * Length in bytes of the varint starting at p, which must have at
+ * least 16 readable bytes behind it.  The terminator is the first byte
+ * with the high bit clear; with SSE2 all 16 continuation bits are
+ * gathered with a single movemask instead of a byte-at-a-time loop.
+ * Returns 16 when no terminator was found (corrupt data -- a 64-bit
+ * varint is at most 10 bytes).
+ */
+static inline size_t
+varint_length(const unsigned char *p) {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    int mask = ~_mm_movemask_epi8(bytes) & 0xffff;
+    if (!mask) {
+        return 16;
+    }
+    return __builtin_ctz(mask) + 1;
+#else
+    size_t length = 0;
+    while (length < 16 && (p[length] & 0x80)) {
+        ++length;
+    }
+    return length < 16 ? length + 1 : 16;
+#endif
+}
+
+
 unsigned long long Parser::read_uint(void) {
+    const char *ptr;
+    if (file->peek(&ptr) >= 16) {
+        // Decode straight out of the container's buffer, saving one
+        // virtual byte fetch per continuation byte.
+        const unsigned char *p = (const unsigned char *)ptr;
+        size_t length = varint_length(p);
+        unsigned long long value = 0;
+        unsigned shift = 0;
+        for (size_t i = 0; i < length && shift < 64; ++i) {
+            value |= (unsigned long long)(p[i] & 0x7f) << shift;
+            shift += 7;
+        }
+        file->advance(length);
+#if TRACE_VERBOSE
+        std::cerr << "\tUINT " << value << "\n";
+#endif
+        return value;
+    }
+
+    // Too close to the end of the decompressed chunk (or the container
+    // cannot expose its buffer): fall back to byte-at-a-time reads.
     unsigned long long value = 0;
     int c;
     unsigned shift = 0;
@@ -871,6 +1618,12 @@ unsigned long long Parser::read_uint(void) {
 
 
 void Parser::skip_uint(void) {
+    const char *ptr;
+    if (file->peek(&ptr) >= 16) {
+        file->advance(varint_length((const unsigned char *)ptr));
+        return;
+    }
+
     int c;
     do {
         c = file->getc();
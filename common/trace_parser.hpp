@@ -27,9 +27,13 @@
 #define _TRACE_PARSER_HPP_
 
 
+#include <string.h>
+
 #include <iostream>
-#include <list>
+#include <set>
+#include <string>
 
+#include "os_thread.hpp"
 #include "trace_file.hpp"
 #include "trace_format.hpp"
 #include "trace_model.hpp"
@@ -39,15 +43,54 @@
 namespace trace {
 
 
+class CallSet;
+class SigRegistry;
+
+
 struct ParseBookmark
 {
+    ParseBookmark() : next_call_no(0) {}
+
     File::Offset offset;
     unsigned next_call_no;
 };
 
 
+/**
+ * Callback interface for Parser::scan().
+ *
+ * Receives one notification per completed call, without any Call or
+ * Value objects ever being materialized, which makes whole-trace
+ * statistics an order of magnitude cheaper than parse_call() loops.
+ */
+class CallStatsVisitor
+{
+public:
+    virtual ~CallStatsVisitor() {}
+
+    /**
+     * sig points into the parser's signature maps and is only valid
+     * while the parser remains open.  bytes is the size of the call's
+     * records in the uncompressed trace stream; the call that first
+     * references a signature also pays for its inline definition.
+     * num_args counts the argument records present in the stream, and
+     * blob_bytes the raw bytes of the call's blob values, both of
+     * which are already included in bytes.
+     */
+    virtual void visit(const FunctionSig *sig,
+                       unsigned call_no,
+                       unsigned thread_id,
+                       CallFlags flags,
+                       size_t bytes,
+                       unsigned num_args,
+                       size_t blob_bytes) = 0;
+};
+
+
 class Parser
 {
+    friend class SigRegistry;
+
 protected:
     File *file;
 
@@ -57,11 +100,38 @@ protected:
         SKIP
     };
 
-    typedef std::list<Call *> CallList;
+    // Calls whose leave event is still pending.  A vector rather than
+    // a list: it is almost always one entry deep, and reusing its
+    // storage beats a list node allocation per call.
+    typedef std::vector<Call *> CallList;
     CallList calls;
 
+    // Recycled call shells awaiting reuse (see recycle()).
+    std::vector<Call *> free_calls;
+
+    // Names registered with suppress(), matched against each
+    // function signature once, when its definition is parsed.
+    std::set<std::string> suppressed_names;
+
+    // Callset whose name patterns restrict which calls are
+    // materialized (see focus()), or NULL.
+    const CallSet *focus_set;
+
+    // Call numbers of suppressed calls whose leave event is still
+    // pending, so it can be skipped too when it arrives.
+    std::vector<unsigned> suppressed_calls;
+
+    // Set by parse_leave when it consumed the leave event of a
+    // suppressed call, telling parse_call to keep going rather than
+    // treat the NULL call as the end of the trace.
+    bool suppressed_leave;
+
     struct FunctionSigFlags : public FunctionSig {
         CallFlags flags;
+
+        // Whether calls to this function are skipped over without
+        // being materialized (see suppress()).
+        bool suppressed;
     };
 
     // Helper template that extends a base signature structure, with additional
@@ -93,6 +163,85 @@ protected:
 
     unsigned next_call_no;
 
+    // Arena of the call currently being parsed; values are
+    // bump-allocated from it (see trace::Arena).
+    Arena *cur_arena;
+
+    // Arena holding every signature object, together with its strings
+    // and member/value tables.  Interning them into one contiguous
+    // pool, instead of thousands of small heap blocks, keeps the
+    // signature lookups in the hot parse loop cache-resident.  Always
+    // owned by this parser, even when the maps above are shared.
+    Arena *sig_arena;
+
+    // Pool of interned string values.  Traces repeat the same few
+    // hundred short strings (uniform/attribute names, extension
+    // strings) millions of times; pooling them makes every repeat
+    // share one copy instead of a per-call allocation.  The
+    // characters live in sig_arena; the set only holds pointers.
+    struct CStrLess {
+        bool operator()(const char *a, const char *b) const {
+            return strcmp(a, b) < 0;
+        }
+    };
+    typedef std::set<const char *, CStrLess> StringPool;
+    StringPool string_pool;
+
+    // Strings longer than this are not pooled: long strings (shader
+    // sources, info logs) are rarely repeated, and pooled storage is
+    // only reclaimed on close().
+    enum {
+        STRING_POOL_MAX_LEN = 256
+    };
+
+    // Blob definitions seen so far (TYPE_BLOB_DEF, version 5+),
+    // indexed by definition index, for resolving back-references
+    // (TYPE_BLOB_REF).  When the file supports offsets a reference
+    // materializes straight from the definition's location in the
+    // file; otherwise the bytes are cached in sig_arena when the
+    // definition is first parsed.
+    struct BlobDef {
+        File::Offset offset;
+        size_t size;
+        // payload size in the file; smaller than size when the
+        // payload is stored snappy-compressed (version 7+)
+        size_t stored_size;
+        const char *cached;
+        bool defined;
+    };
+    std::vector<BlobDef> blob_defs;
+
+    // OS thread ids seen so far, indexed by the dense thread index
+    // the parser assigns in first-seen order (see Call::thread_index).
+    // Traces rarely carry more than a handful of threads, so a linear
+    // scan beats any map.
+    std::vector<unsigned> thread_ids;
+
+    // Furthest stream position whose inline signature definitions
+    // have been ingested; positions only move backwards through
+    // setBookmark(), which keeps this up to date (see parseCallAt).
+    ParseBookmark high_water;
+
+    // Whether to parse blobs lazily (see setLazyBlobs).
+    bool lazy_blobs;
+
+    // Budget for parser-owned memory, in bytes; 0 means unlimited
+    // (see setMemoryBudget).
+    uint64_t memory_budget;
+
+    // Whether close() must free the signature maps; false when they
+    // are shared through a registry (see attachSigs, exportSigs).
+    bool owns_sigs;
+
+    // Registry this parser's signature maps are shared through, or
+    // NULL.  Holds one reference; released by close().
+    SigRegistry *sig_registry;
+
+    // Argument records and blob bytes consumed by the call details
+    // being skipped, for scan() statistics.
+    unsigned m_scanArgCount;
+    uint64_t m_scanBlobBytes;
+
 public:
     unsigned long long version;
     API api;
@@ -109,6 +258,47 @@ public:
         return parse_call(FULL);
     }
 
+    /**
+     * Return a no-longer-needed call for reuse by a future
+     * parse_call(), sparing the per-call delete/new round-trip
+     * through the allocator.  Otherwise equivalent to deleting the
+     * call.  Only valid for calls produced by this parser, and must
+     * be serialized with parsing (don't use it while another thread
+     * is inside parse_call).
+     */
+    void recycle(Call *call);
+
+    /**
+     * Skip all calls to the named function: their details are
+     * consumed with the SKIP machinery, no Call is ever materialized,
+     * and they are never returned from parse_call().  Call numbering
+     * is unaffected.  The name is resolved to a function id once,
+     * when the signature definition is parsed, so the per-call cost
+     * is a single flag test.  Meant for calls that carry no
+     * information for the consumer, like the glGetError checks that
+     * debug builds interleave after every call.
+     */
+    void suppress(const char *function);
+
+    /**
+     * Skip, without materializing, every call whose function name
+     * does not match the given set's name patterns (e.g. --calls
+     * 'glDraw*').  The decision is made once per signature, so the
+     * per-call cost is the same flag test suppress() pays.  Ignored
+     * unless the set consists purely of name patterns (a set with
+     * numeric ranges may select any call by number); pass NULL to
+     * clear.  The set must outlive the parser.
+     */
+    void focus(const CallSet *set);
+
+    /**
+     * Drop all names registered with suppress().  Only affects files
+     * opened afterwards.
+     */
+    void unsuppress(void) {
+        suppressed_names.clear();
+    }
+
     bool supportsOffsets() const
     {
         return file->supportsOffsets();
@@ -118,6 +308,28 @@ public:
 
     void setBookmark(const ParseBookmark &bookmark);
 
+    /**
+     * Fetch the single call whose enter event begins at the given
+     * bookmark, leaving the current stream position untouched.
+     *
+     * Unlike setBookmark() + parse_call() this is a point lookup: the
+     * parser's signature maps are kept across rewinds, so any call in
+     * a region that has been read once before is decoded without
+     * reparsing from a frame boundary.  A lookup beyond the furthest
+     * position read so far catches up in SCAN mode first, which is
+     * paid at most once per region.
+     *
+     * The caller owns the returned call, as with parse_call().
+     * Returns NULL for suppressed or focused-out calls, and on files
+     * that do not support offsets.
+     */
+    Call *parseCallAt(const ParseBookmark &bookmark);
+
+    bool getFrameIndex(File::FrameIndex &index)
+    {
+        return file->getFrameIndex(index);
+    }
+
     int percentRead()
     {
         return file->percentRead();
@@ -127,9 +339,93 @@ public:
         return parse_call(SCAN);
     }
 
+    /**
+     * Walk the remaining calls in streaming fashion, reporting each
+     * one to the visitor.  Uses the SKIP machinery throughout, so no
+     * Call or Value objects are created.  Returns false if the trace
+     * ends mid-call.
+     */
+    bool scan(CallStatsVisitor &visitor);
+
+    /**
+     * When enabled, blobs record their file location instead of being
+     * read in, and are materialized on first use (see Blob::load).
+     * Tools that never touch most blob contents (non-verbose dumps,
+     * analysis passes) skip the copy entirely.  Lazy blobs are only
+     * valid while this parser remains open.
+     */
+    void setLazyBlobs(bool lazy) {
+        lazy_blobs = lazy;
+    }
+
+    /**
+     * Bytes of parser-owned memory currently committed: the
+     * signature/string/blob-cache arena plus the blob definition
+     * table.  Calls returned from parse_call() carry their own
+     * arenas and belong to the consumer, so they are not counted.
+     */
+    uint64_t memoryUsage(void) const;
+
+    /**
+     * Table of thread ids seen so far, indexed by the dense
+     * Call::thread_index the parser assigns in first-seen order.
+     * Complete after a full pass (parse or scan); the dense index
+     * fits byte-wide columns and indexes plain vectors where the raw
+     * id would need a map.
+     */
+    const std::vector<unsigned> & threadIds(void) const {
+        return thread_ids;
+    }
+
+    /**
+     * Bound the footprint reported by memoryUsage().  Once the
+     * budget would be exceeded no further blob bytes are cached,
+     * and on files that support offsets blob parsing switches to
+     * lazy (see setLazyBlobs) so new blobs spill to their file
+     * location instead of being read in.  Zero, the default, means
+     * unlimited.  Lets hosts that schedule many parse jobs bound
+     * each job's commit instead of overcommitting blindly.
+     */
+    void setMemoryBudget(uint64_t bytes) {
+        memory_budget = bytes;
+    }
+
+    /**
+     * Detach this parser's signature state -- the signature maps, the
+     * blob definition table and the arena owning their storage --
+     * into a reference-counted registry that other parsers for the
+     * same trace can attach to.  This parser must already have seen
+     * every signature and blob definition (e.g. by a full SCAN pass);
+     * the registry is immutable from then on.  The returned reference
+     * belongs to the caller (release it when done); the parser keeps
+     * its own reference until close(), so the registry may be handed
+     * to parsers that outlive this one.  Repeated calls return the
+     * same registry.
+     */
+    SigRegistry *exportSigs(void);
+
+    /**
+     * Attach to a registry built by another parser's exportSigs() for
+     * the same trace, instead of building our own signature maps.
+     * Takes its own reference, so the caller's may be released at any
+     * time.  Must be called before parsing starts.
+     */
+    void attachSigs(SigRegistry *registry);
+
+    /**
+     * Convenience wrapper over exportSigs()/attachSigs(): share the
+     * signature maps and blob definition table of another parser for
+     * the same trace.  The registry reference keeps the shared state
+     * alive, so the other parser may be closed before this one.  Used
+     * by ParallelParser's worker parsers.
+     */
+    void shareSigsFrom(Parser &other);
+
 protected:
     Call *parse_call(Mode mode);
 
+    unsigned short remapThread(unsigned thread_id);
+
     FunctionSigFlags *parse_function_sig(void);
     StructSig *parse_struct_sig();
     EnumSig *parse_old_enum_sig();
@@ -147,11 +443,14 @@ protected:
 
     bool parse_call_details(Call *call, Mode mode);
 
+    bool skip_call_details(void);
+
     void adjust_call_flags(Call *call);
 
     void parse_arg(Call *call, Mode mode);
 
     Value *parse_value(void);
+    Value *parse_value(int c);
     void scan_value(void);
     inline Value *parse_value(Mode mode) {
         if (mode == FULL) {
@@ -186,8 +485,16 @@ protected:
     Value *parse_array(void);
     void scan_array(void);
 
-    Value *parse_blob(void);
-    void scan_blob(void);
+    Value *parse_blob(bool compressed);
+    void scan_blob(bool compressed);
+
+    Value *parse_blob_def(bool compressed);
+    void scan_blob_def(bool compressed);
+
+    Value *parse_blob_ref(void);
+    void scan_blob_ref(void);
+
+    void read_blob_data(char *buf, size_t size, size_t stored_size);
 
     Value *parse_struct();
     void scan_struct();
@@ -198,7 +505,8 @@ protected:
     Value *parse_repr();
     void scan_repr();
 
-    const char * read_string(void);
+    const char * intern_string(void);
+    const char * pool_string(const char *str, size_t len);
     void skip_string(void);
 
     signed long long read_sint(void);
@@ -212,6 +520,52 @@ protected:
 };
 
 
+/**
+ * Reference-counted, immutable bundle of one trace's signature state:
+ * the function/struct/enum/bitmask signature maps, the blob definition
+ * table and the arena that owns all their storage.  Built once per
+ * trace by Parser::exportSigs(); any number of parsers for the same
+ * trace then attach to it (see Parser::attachSigs) without reparsing
+ * the signatures or duplicating their memory, and without any
+ * lifetime coupling to the parser that built it -- the state lives
+ * until the last reference is dropped.
+ */
+class SigRegistry
+{
+public:
+    void acquire(void);
+
+    /**
+     * Drop a reference; the registry deletes itself when the last one
+     * goes.
+     */
+    void release(void);
+
+private:
+    friend class Parser;
+
+    SigRegistry();
+    ~SigRegistry();
+
+    // Guards refcount: references are taken and dropped from parse
+    // worker threads.
+    os::mutex mutex;
+    int refcount;
+
+    // Owns every signature object, string and cached blob payload the
+    // tables below point into.
+    Arena *arena;
+
+    Parser::FunctionMap functions;
+    Parser::StructMap structs;
+    Parser::EnumMap enums;
+    Parser::BitmaskMap bitmasks;
+    std::vector<Parser::BlobDef> blob_defs;
+    std::vector<unsigned> thread_ids;
+    FunctionSig *glGetErrorSig;
+};
+
+
 } /* namespace trace */
 
 #endif /* _TRACE_PARSER_HPP_ */
@@ -118,6 +118,9 @@ callFlagTable[] = {
     { "eglGetProcAddress",                             CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "eglQueryString",                                CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "eglSwapBuffers",                                CALL_FLAG_SWAPBUFFERS },
+    { "eglWaitClient",                                 CALL_FLAG_SYNC },
+    { "eglWaitGL",                                     CALL_FLAG_SYNC },
+    { "eglWaitNative",                                 CALL_FLAG_SYNC },
     { "glBindFramebuffer",                             CALL_FLAG_SWAP_RENDERTARGET },
     { "glBindFramebufferEXT",                          CALL_FLAG_SWAP_RENDERTARGET },
     { "glBindFramebufferOES",                          CALL_FLAG_SWAP_RENDERTARGET },
@@ -126,6 +129,7 @@ callFlagTable[] = {
     { "glCallList",                                    CALL_FLAG_RENDER },
     { "glCallLists",                                   CALL_FLAG_RENDER },
     { "glClear",                                       CALL_FLAG_RENDER },
+    { "glClientWaitSync",                              CALL_FLAG_SYNC },
     { "glDrawArrays",                                  CALL_FLAG_RENDER },
     { "glDrawArraysEXT",                               CALL_FLAG_RENDER },
     { "glDrawArraysIndirect",                          CALL_FLAG_RENDER },
@@ -148,6 +152,10 @@ callFlagTable[] = {
     { "glDrawRangeElementsBaseVertex",                 CALL_FLAG_RENDER },
     { "glDrawRangeElementsEXT",                        CALL_FLAG_RENDER },
     { "glEnd",                                         CALL_FLAG_RENDER },
+    { "glFinish",                                      CALL_FLAG_SYNC },
+    { "glFinishFenceAPPLE",                            CALL_FLAG_SYNC },
+    { "glFinishFenceNV",                               CALL_FLAG_SYNC },
+    { "glFinishObjectAPPLE",                           CALL_FLAG_SYNC },
     { "glFrameTerminatorGREMEDY",                      CALL_FLAG_END_FRAME },
     { "glGetError",                                    CALL_FLAG_NO_SIDE_EFFECTS }, // verbose will be set later for GL_NO_ERROR 
     { "glGetString",                                   CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
@@ -195,6 +203,7 @@ callFlagTable[] = {
     { "glMultiDrawElementsEXT",                        CALL_FLAG_RENDER },
     { "glMultiModeDrawArraysIBM",                      CALL_FLAG_RENDER },
     { "glMultiModeDrawElementsIBM",                    CALL_FLAG_RENDER },
+    { "glWaitSync",                                    CALL_FLAG_SYNC },
     { "glXGetClientString",                            CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "glXGetCurrentContext",                          CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "glXGetCurrentDisplay",                          CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
@@ -208,6 +217,8 @@ callFlagTable[] = {
     { "glXQueryExtensionsString",                      CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "glXQueryVersion",                               CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "glXSwapBuffers",                                CALL_FLAG_SWAPBUFFERS },
+    { "glXWaitGL",                                     CALL_FLAG_SYNC },
+    { "glXWaitX",                                      CALL_FLAG_SYNC },
     { "wglGetCurrentContext",                          CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "wglGetCurrentDC",                               CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
     { "wglGetDefaultProcAddress",                      CALL_FLAG_NO_SIDE_EFFECTS | CALL_FLAG_VERBOSE },
@@ -223,6 +234,12 @@ callFlagTable[] = {
  * Lookup call flags by name.
  */
 CallFlags
-Parser::lookupCallFlags(const char *name) {
+trace::lookupCallFlags(const char *name) {
     return entryLookup(name, callFlagTable, defaultCallFlags);
 }
+
+
+CallFlags
+Parser::lookupCallFlags(const char *name) {
+    return trace::lookupCallFlags(name);
+}
@@ -0,0 +1,367 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+
+#include <sstream>
+
+#include "trace_parser_parallel.hpp"
+
+
+using namespace trace;
+
+
+ParallelParser::ParallelParser(unsigned threadCount) :
+    m_threadCount(threadCount),
+    m_sequential(true),
+    m_exit(false),
+    m_formatter(NULL),
+    m_nextFrame(0),
+    m_deliverFrame(0),
+    m_deliverCall(0),
+    m_activeWorkers(0),
+    m_nextWorkerNode(0)
+{
+}
+
+ParallelParser::~ParallelParser()
+{
+    close();
+}
+
+/* How many frames workers may run ahead of delivery. */
+static inline size_t
+windowSize(unsigned threadCount)
+{
+    return (size_t)threadCount * 4;
+}
+
+bool ParallelParser::open(const char *filename)
+{
+    m_fileName = filename;
+
+    if (!m_parser.open(filename)) {
+        return false;
+    }
+
+    if (m_threadCount < 2 || !m_parser.supportsOffsets()) {
+        m_sequential = true;
+        return true;
+    }
+
+    ParseBookmark begin;
+    m_parser.getBookmark(begin);
+
+    scanFrames();
+
+    if (m_frames.size() < 2) {
+        // not worth threading; rewind and parse sequentially
+        m_parser.setBookmark(begin);
+        m_frames.clear();
+        m_sequential = true;
+        return true;
+    }
+
+    m_sequential = false;
+    m_exit = false;
+    m_nextFrame = 0;
+    m_deliverFrame = 0;
+    m_deliverCall = 0;
+    m_nextWorkerNode = 0;
+
+    // Workers open their own parsers (see workerLoop), so that the
+    // decompression caches are allocated on the worker's own NUMA
+    // node; here they only get the shared signature maps.
+    for (unsigned i = 0; i < m_threadCount; ++i) {
+        Parser *parser = new Parser;
+        parser->shareSigsFrom(m_parser);
+        m_idleParsers.push_back(parser);
+    }
+    m_activeWorkers = m_threadCount;
+    for (unsigned i = 0; i < m_threadCount; ++i) {
+        m_threads.push_back(os::thread(workerThreadEntry, this));
+    }
+
+    return true;
+}
+
+/**
+ * Sequentially scan the whole trace once, recording frame boundaries
+ * and, as a side effect, registering every signature definition in
+ * the master parser so that the worker parsers can share them.
+ */
+void ParallelParser::scanFrames(void)
+{
+    ParseBookmark start;
+    unsigned numCalls = 0;
+
+    m_parser.getBookmark(start);
+
+    Call *call;
+    while ((call = m_parser.scan_call())) {
+        ++numCalls;
+        bool endFrame = (call->flags & CALL_FLAG_END_FRAME) != 0;
+        delete call;
+
+        if (endFrame) {
+            FrameWork frame;
+            frame.start = start;
+            frame.numCalls = numCalls;
+            frame.ready = false;
+            m_frames.push_back(frame);
+
+            m_parser.getBookmark(start);
+            numCalls = 0;
+        }
+    }
+
+    if (numCalls) {
+        // trailing calls without a frame marker
+        FrameWork frame;
+        frame.start = start;
+        frame.numCalls = numCalls;
+        frame.ready = false;
+        m_frames.push_back(frame);
+    }
+}
+
+void ParallelParser::workerThreadEntry(ParallelParser *parser)
+{
+    parser->workerLoop();
+}
+
+void ParallelParser::workerLoop(void)
+{
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    assert(!m_idleParsers.empty());
+    Parser *parser = m_idleParsers.back();
+    m_idleParsers.pop_back();
+
+    /* Pin workers round-robin across NUMA nodes before the parser
+     * opens its file: chunk decompression buffers and call arenas are
+     * then first-touched -- and therefore placed -- on the worker's
+     * own node, and the file's readahead thread inherits the
+     * affinity. */
+    unsigned numNodes = os::numaNodeCount();
+    if (numNodes > 1) {
+        os::pinThreadToNumaNode(m_nextWorkerNode++ % numNodes);
+    }
+
+    lock.unlock();
+    bool opened = parser->open(m_fileName.c_str());
+    lock.lock();
+
+    if (!opened) {
+        m_idleParsers.push_back(parser);
+        --m_activeWorkers;
+        m_frameReady.signal();
+        return;
+    }
+
+    for (;;) {
+        while (!m_exit &&
+               m_nextFrame < m_frames.size() &&
+               m_nextFrame >= m_deliverFrame + windowSize(m_threadCount)) {
+            m_windowOpen.wait(lock);
+        }
+        if (m_exit || m_nextFrame >= m_frames.size()) {
+            break;
+        }
+
+        size_t i = m_nextFrame++;
+        lock.unlock();
+        parseFrame(*parser, m_frames[i]);
+        lock.lock();
+
+        m_frames[i].ready = true;
+        m_frameReady.signal();
+    }
+
+    m_doneParsers.push_back(parser);
+    --m_activeWorkers;
+    m_frameReady.signal();
+}
+
+/**
+ * Wait until a worker has produced the frame.  Should every worker
+ * have bailed out (e.g. the trace could not be reopened), fall back to
+ * parsing the frame with the master parser, which is idle in parallel
+ * mode; workers never exit with a claimed frame unfinished, so an
+ * unready frame with no active workers is always unclaimed.
+ */
+void ParallelParser::waitFrameReady(FrameWork &frame, os::unique_lock<os::mutex> &lock)
+{
+    while (!frame.ready) {
+        if (!m_activeWorkers) {
+            lock.unlock();
+            parseFrame(m_parser, frame);
+            lock.lock();
+            frame.ready = true;
+            return;
+        }
+        m_frameReady.wait(lock);
+    }
+}
+
+void ParallelParser::parseFrame(Parser &parser, FrameWork &frame)
+{
+    parser.setBookmark(frame.start);
+
+    if (m_formatter) {
+        std::ostringstream os;
+        for (unsigned i = 0; i < frame.numCalls; ++i) {
+            Call *call = parser.parse_call();
+            if (!call) {
+                break;
+            }
+            m_formatter->format(*call, os);
+            delete call;
+        }
+        frame.text = os.str();
+        return;
+    }
+
+    frame.calls.reserve(frame.numCalls);
+    for (unsigned i = 0; i < frame.numCalls; ++i) {
+        Call *call = parser.parse_call();
+        if (!call) {
+            break;
+        }
+        frame.calls.push_back(call);
+    }
+}
+
+void ParallelParser::setFormatter(CallFormatter *formatter)
+{
+    m_formatter = formatter;
+}
+
+bool ParallelParser::read_text(std::string &text)
+{
+    assert(m_formatter);
+
+    if (m_sequential) {
+        Call *call = m_parser.parse_call();
+        if (!call) {
+            return false;
+        }
+        std::ostringstream os;
+        m_formatter->format(*call, os);
+        delete call;
+        text = os.str();
+        return true;
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    if (m_deliverFrame >= m_frames.size()) {
+        return false;
+    }
+
+    FrameWork &frame = m_frames[m_deliverFrame];
+    waitFrameReady(frame, lock);
+
+    text.swap(frame.text);
+    std::string().swap(frame.text);
+    ++m_deliverFrame;
+    m_windowOpen.signal();
+    return true;
+}
+
+Call *ParallelParser::parse_call(void)
+{
+    if (m_sequential) {
+        return m_parser.parse_call();
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+    for (;;) {
+        if (m_deliverFrame >= m_frames.size()) {
+            return NULL;
+        }
+
+        FrameWork &frame = m_frames[m_deliverFrame];
+        waitFrameReady(frame, lock);
+
+        if (m_deliverCall < frame.calls.size()) {
+            return frame.calls[m_deliverCall++];
+        }
+
+        // frame exhausted; open the window for another one
+        std::vector<Call *>().swap(frame.calls);
+        ++m_deliverFrame;
+        m_deliverCall = 0;
+        m_windowOpen.signal();
+    }
+}
+
+void ParallelParser::close(void)
+{
+    if (!m_threads.empty()) {
+        {
+            os::unique_lock<os::mutex> lock(m_mutex);
+            m_exit = true;
+            for (size_t i = 0; i < m_threads.size(); ++i) {
+                m_windowOpen.signal();
+            }
+        }
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            m_threads[i].join();
+        }
+        m_threads.clear();
+    }
+
+    for (size_t i = 0; i < m_idleParsers.size(); ++i) {
+        m_idleParsers[i]->close();
+        delete m_idleParsers[i];
+    }
+    m_idleParsers.clear();
+    for (size_t i = 0; i < m_doneParsers.size(); ++i) {
+        m_doneParsers[i]->close();
+        delete m_doneParsers[i];
+    }
+    m_doneParsers.clear();
+
+    for (size_t i = m_deliverFrame; i < m_frames.size(); ++i) {
+        FrameWork &frame = m_frames[i];
+        for (size_t j = (i == m_deliverFrame ? m_deliverCall : 0);
+             j < frame.calls.size(); ++j) {
+            delete frame.calls[j];
+        }
+    }
+    m_frames.clear();
+
+    m_parser.close();
+
+    m_sequential = true;
+    m_exit = false;
+    m_nextFrame = 0;
+    m_deliverFrame = 0;
+    m_deliverCall = 0;
+    m_activeWorkers = 0;
+    m_nextWorkerNode = 0;
+}
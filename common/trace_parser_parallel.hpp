@@ -0,0 +1,139 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef _TRACE_PARSER_PARALLEL_HPP_
+#define _TRACE_PARSER_PARALLEL_HPP_
+
+
+#include <string>
+#include <vector>
+
+#include "trace_parser.hpp"
+#include "os_thread.hpp"
+
+
+namespace trace {
+
+
+/**
+ * Parallel parse engine on top of trace::Parser.
+ *
+ * A sequential SCAN pass (cheap: no Value materialization) first
+ * establishes frame boundaries and registers every signature
+ * definition.  The frames are then fully parsed by worker threads,
+ * each owning a private Parser that shares the master's signature
+ * maps, and calls are delivered through parse_call() in call-number
+ * order, just like a plain Parser would.
+ *
+ * Memory is bounded by only letting workers run a fixed window of
+ * frames ahead of delivery.  Traces whose container cannot seek fall
+ * back to plain sequential parsing.
+ */
+class ParallelParser
+{
+public:
+    ParallelParser(unsigned threadCount);
+    ~ParallelParser();
+
+    bool open(const char *filename);
+    void close(void);
+
+    /** Next call, in call-number order.  Caller deletes it. */
+    Call *parse_call(void);
+
+    /**
+     * Worker-side rendering hook for read_text().
+     *
+     * format() is invoked concurrently from several worker threads, so
+     * implementations must only read shared state.  Whatever it writes
+     * to the stream is delivered by read_text() in call-number order;
+     * writing nothing drops the call from the output.
+     */
+    class CallFormatter {
+    public:
+        virtual ~CallFormatter() {}
+        virtual void format(Call &call, std::ostream &os) = 0;
+    };
+
+    /**
+     * Render calls through the formatter instead of delivering them.
+     * Must be set before the first read, and must not be mixed with
+     * parse_call() on the same parser.
+     */
+    void setFormatter(CallFormatter *formatter);
+
+    /**
+     * Next chunk of formatted text, in call-number order.  Workers
+     * render whole frames into private buffers, so the consumer's only
+     * work is splicing them out; returns false at end of trace.
+     */
+    bool read_text(std::string &text);
+
+private:
+    struct FrameWork {
+        ParseBookmark start;
+        unsigned numCalls;
+        bool ready;
+        std::vector<Call *> calls;
+        std::string text;
+    };
+
+    static void workerThreadEntry(ParallelParser *parser);
+    void workerLoop(void);
+    void scanFrames(void);
+    void parseFrame(Parser &parser, FrameWork &frame);
+    void waitFrameReady(FrameWork &frame, os::unique_lock<os::mutex> &lock);
+
+    std::string m_fileName;
+    unsigned m_threadCount;
+    bool m_sequential;
+    bool m_exit;
+
+    CallFormatter *m_formatter;
+
+    Parser m_parser;
+
+    std::vector<FrameWork> m_frames;
+    size_t m_nextFrame;
+    size_t m_deliverFrame;
+    size_t m_deliverCall;
+
+    // Unopened parsers awaiting a worker.  Workers that finish hand
+    // their parser -- by then open -- to m_doneParsers instead, so a
+    // late-starting worker can never pick up an already-open one.
+    std::vector<Parser *> m_idleParsers;
+    std::vector<Parser *> m_doneParsers;
+    std::vector<os::thread> m_threads;
+    unsigned m_activeWorkers;
+    unsigned m_nextWorkerNode;
+    os::mutex m_mutex;
+    os::condition_variable m_frameReady;
+    os::condition_variable m_windowOpen;
+};
+
+
+} /* namespace trace */
+
+#endif /* _TRACE_PARSER_PARALLEL_HPP_ */
@@ -24,16 +24,24 @@
  **************************************************************************/
 
 #include "trace_profiler.hpp"
+#include "os_binary.hpp"
 #include "os_time.hpp"
 #include <iostream>
 #include <string.h>
-#include <sstream>
 
 namespace trace {
+
+static void
+writeRecord(const ProfileRecord &record)
+{
+    std::cout.write((const char *)&record, sizeof record);
+}
+
 Profiler::Profiler()
     : baseGpuTime(0),
       baseCpuTime(0),
       minCpuTime(1000),
+      cpuTimeFrequency(0),
       cpuTimes(false),
       gpuTimes(true),
       pixelsDrawn(false)
@@ -44,13 +52,24 @@ Profiler::~Profiler()
 {
 }
 
-void Profiler::setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_)
+void Profiler::setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_,
+                     bool frameTimings_)
 {
     cpuTimes = cpuTimes_;
     gpuTimes = gpuTimes_;
     pixelsDrawn = pixelsDrawn_;
 
-    std::cout << "# call no gpu_start gpu_dura cpu_start cpu_dura pixels program name" << std::endl;
+    os::setBinaryMode(stdout);
+
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_HEADER;
+    record.no = 3;              // format version (3: buffer metrics)
+    record.u.flags = (cpuTimes ? PROFILE_FLAG_CPU_TIMES : 0) |
+                     (gpuTimes ? PROFILE_FLAG_GPU_TIMES : 0) |
+                     (pixelsDrawn ? PROFILE_FLAG_PIXELS_DRAWN : 0) |
+                     (frameTimings_ ? PROFILE_FLAG_FRAME_TIMINGS : 0);
+    writeRecord(record);
 }
 
 int64_t Profiler::getBaseCpuTime()
@@ -78,6 +97,11 @@ bool Profiler::hasBaseTimes()
     return baseCpuTime != 0 || baseGpuTime != 0;
 }
 
+void Profiler::setCpuTimeFrequency(int64_t frequency)
+{
+    cpuTimeFrequency = frequency;
+}
+
 void Profiler::addCall(unsigned no,
                        const char *name,
                        unsigned program,
@@ -93,7 +117,12 @@ void Profiler::addCall(unsigned no,
     }
 
     if (cpuTimes && cpuStart) {
-        double cpuTimeScale = 1.0E9 / os::timeFrequency;
+        if (!cpuTimeFrequency) {
+            // os::timeFrequency itself is only known after the first
+            // os::getTime() on some platforms
+            cpuTimeFrequency = os::timeFrequency;
+        }
+        double cpuTimeScale = 1.0E9 / cpuTimeFrequency;
         cpuStart = (cpuStart - baseCpuTime) * cpuTimeScale;
         cpuDuration = cpuDuration * cpuTimeScale;
 
@@ -109,51 +138,125 @@ void Profiler::addCall(unsigned no,
         pixels = 0;
     }
 
-    std::cout << "call"
-              << " " << no
-              << " " << gpuStart
-              << " " << gpuDuration
-              << " " << cpuStart
-              << " " << cpuDuration
-              << " " << pixels
-              << " " << program
-              << " " << name
-              << std::endl;
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_CALL;
+    record.no = no;
+    record.u.call.gpuStart = gpuStart;
+    record.u.call.gpuDuration = gpuDuration;
+    record.u.call.cpuStart = cpuStart;
+    record.u.call.cpuDuration = cpuDuration;
+    record.u.call.pixels = pixels;
+    record.u.call.program = program;
+    record.u.call.nameId = getNameId(name);
+    writeRecord(record);
 }
 
-void Profiler::addFrameEnd()
+void Profiler::addFrameEnd(int64_t vramFreeKb)
 {
-    std::cout << "frame_end" << std::endl;
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_FRAME_END;
+    record.u.frameEnd.vramFreeKb = vramFreeKb;
+    writeRecord(record);
+
+    /* Keep consumers reading the stream live roughly a frame behind */
+    std::cout.flush();
 }
 
-void Profiler::parseLine(const char* in, Profile* profile)
+void Profiler::addBufferMetrics(uint32_t orphans, uint32_t respecifications,
+                                uint32_t subUploads, uint32_t maps,
+                                uint32_t invalidateMaps, uint32_t unsyncMaps,
+                                uint32_t flushes)
 {
-    std::stringstream line(in, std::ios_base::in);
-    std::string type;
-    static int64_t lastGpuTime;
-    static int64_t lastCpuTime;
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_BUFFER_METRICS;
+    record.u.bufferMetrics.orphans = orphans;
+    record.u.bufferMetrics.respecifications = respecifications;
+    record.u.bufferMetrics.subUploads = subUploads;
+    record.u.bufferMetrics.maps = maps;
+    record.u.bufferMetrics.invalidateMaps = invalidateMaps;
+    record.u.bufferMetrics.unsyncMaps = unsyncMaps;
+    record.u.bufferMetrics.flushes = flushes;
+    writeRecord(record);
+}
+
+void Profiler::addFrameTiming(unsigned no,
+                              int64_t wallStart, int64_t wallDuration,
+                              int64_t parseDuration, int64_t dispatchDuration,
+                              int64_t swapInterval,
+                              unsigned firstCall, unsigned lastCall)
+{
+    if (!cpuTimeFrequency) {
+        cpuTimeFrequency = os::timeFrequency;
+    }
+    double scale = 1.0E9 / cpuTimeFrequency;
+
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_FRAME_TIMING;
+    record.no = no;
+    record.u.frameTiming.wallStart = wallStart * scale;
+    record.u.frameTiming.wallDuration = wallDuration * scale;
+    record.u.frameTiming.parseDuration = parseDuration * scale;
+    record.u.frameTiming.dispatchDuration = dispatchDuration * scale;
+    record.u.frameTiming.swapInterval = swapInterval * scale;
+    record.u.frameTiming.firstCall = firstCall;
+    record.u.frameTiming.lastCall = lastCall;
+    writeRecord(record);
 
-    if (in[0] == '#' || strlen(in) < 4)
-        return;
+    std::cout.flush();
+}
 
-    if (profile->programs.size() == 0 && profile->calls.size() == 0 && profile->frames.size() == 0) {
-        lastGpuTime = 0;
-        lastCpuTime = 0;
+unsigned Profiler::getNameId(const char* name)
+{
+    std::map<std::string, unsigned>::iterator it = nameIds.find(name);
+    if (it != nameIds.end()) {
+        return it->second;
     }
 
-    line >> type;
+    unsigned id = nameIds.size();
+    nameIds[name] = id;
+
+    ProfileRecord record;
+    memset(&record, 0, sizeof record);
+    record.type = RECORD_NAME;
+    record.no = id;
+    strncpy(record.u.name, name, sizeof record.u.name - 1);
+    writeRecord(record);
+
+    return id;
+}
+
+ProfileParser::ProfileParser()
+    : lastGpuTime(0),
+      lastCpuTime(0),
+      version(1)
+{
+}
 
-    if (type.compare("call") == 0) {
+void ProfileParser::parseRecord(const char* data, Profile* profile)
+{
+    ProfileRecord record;
+    memcpy(&record, data, sizeof record);
+
+    switch (record.type) {
+    case RECORD_CALL: {
         Profile::Call call;
 
-        line >> call.no
-             >> call.gpuStart
-             >> call.gpuDuration
-             >> call.cpuStart
-             >> call.cpuDuration
-             >> call.pixels
-             >> call.program
-             >> call.name;
+        call.no = record.no;
+        call.gpuStart = record.u.call.gpuStart;
+        call.gpuDuration = record.u.call.gpuDuration;
+        call.cpuStart = record.u.call.cpuStart;
+        call.cpuDuration = record.u.call.cpuDuration;
+        call.pixels = record.u.call.pixels;
+        call.program = record.u.call.program;
+        call.nameId = record.u.call.nameId;
+        if (profile->names.size() <= call.nameId) {
+            // name record missing from the stream; keep the id valid
+            profile->names.resize(call.nameId + 1);
+        }
 
         if (lastGpuTime < call.gpuStart + call.gpuDuration) {
             lastGpuTime = call.gpuStart + call.gpuDuration;
@@ -163,7 +266,7 @@ void Profiler::parseLine(const char* in, Profile* profile)
             lastCpuTime = call.cpuStart + call.cpuDuration;
         }
 
-        profile->calls.push_back(call);
+        profile->appendCall(call);
 
         if (call.pixels >= 0) {
             if (profile->programs.size() <= call.program) {
@@ -176,7 +279,9 @@ void Profiler::parseLine(const char* in, Profile* profile)
             program.pixelTotal += call.pixels;
             program.calls.push_back(profile->calls.size() - 1);
         }
-    } else if (type.compare("frame_end") == 0) {
+        break;
+    }
+    case RECORD_FRAME_END: {
         Profile::Frame frame;
         frame.no = profile->frames.size();
 
@@ -192,9 +297,34 @@ void Profiler::parseLine(const char* in, Profile* profile)
 
         frame.gpuDuration = lastGpuTime - frame.gpuStart;
         frame.cpuDuration = lastCpuTime - frame.cpuStart;
+        // version 1 streams leave the union zeroed, which would read
+        // as a 0 KB watermark rather than "not measured"
+        frame.vramFreeKb = version >= 2 ? record.u.frameEnd.vramFreeKb : -1;
         frame.calls.end = profile->calls.size() - 1;
 
         profile->frames.push_back(frame);
+        break;
+    }
+    case RECORD_NAME: {
+        if (profile->names.size() <= record.no) {
+            profile->names.resize(record.no + 1);
+        }
+        // the writer NUL-pads, but don't trust the stream
+        record.u.name[sizeof record.u.name - 1] = '\0';
+        profile->names[record.no] = record.u.name;
+        break;
+    }
+    case RECORD_FRAME_TIMING:
+    case RECORD_BUFFER_METRICS:
+        // replay timing and buffer metrics records are for offline
+        // consumers; the assembled Profile only covers per-call
+        // measurements
+        break;
+    case RECORD_HEADER:
+        version = record.no;
+        break;
+    default:
+        break;
     }
 }
 }
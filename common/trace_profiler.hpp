@@ -26,6 +26,7 @@
 #ifndef TRACE_PROFILER_H
 #define TRACE_PROFILER_H
 
+#include <map>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -47,7 +48,8 @@ struct Profile {
 
         int64_t pixels;
 
-        std::string name;
+        /* Index into Profile::names */
+        unsigned nameId;
     };
 
     struct Frame {
@@ -59,6 +61,14 @@ struct Profile {
         int64_t cpuStart;
         int64_t cpuDuration;
 
+        /**
+         * Free video memory in KB sampled at the end of the frame via
+         * GL_NVX_gpu_memory_info or GL_ATI_meminfo, or -1 when
+         * neither extension is available.  The minimum over frames is
+         * the replay's VRAM watermark.
+         */
+        int64_t vramFreeKb;
+
         /* Indices to profile->calls array */
         struct {
             unsigned begin;
@@ -80,15 +90,136 @@ struct Profile {
     std::vector<Call> calls;
     std::vector<Frame> frames;
     std::vector<Program> programs;
+
+    /**
+     * Interned call names, indexed by Call::nameId.  A 5M-call profile
+     * repeats a few dozen distinct names; storing a std::string per
+     * call used to cost more memory than the measurements themselves.
+     */
+    std::vector<std::string> names;
+
+    /**
+     * Column mirrors of the per-call fields the profile views filter
+     * and sort on, parallel to the calls vector.  The selection
+     * queries the GUI runs per click ("slowest draws in this time
+     * range") scan every call; walking one flat array of the field
+     * being tested is far faster than chasing Call rows through
+     * per-program index lists, and leaves the loop open to
+     * vectorization.  Kept in sync by appendCall.
+     */
+    std::vector<int64_t> callCpuStarts;
+    std::vector<int64_t> callCpuDurations;
+    std::vector<int64_t> callGpuDurations;
+    std::vector<int64_t> callPixels;
+    std::vector<unsigned> callPrograms;
+
+    void appendCall(const Call &call) {
+        calls.push_back(call);
+        callCpuStarts.push_back(call.cpuStart);
+        callCpuDurations.push_back(call.cpuDuration);
+        callGpuDurations.push_back(call.gpuDuration);
+        callPixels.push_back(call.pixels);
+        callPrograms.push_back(call.program);
+    }
+};
+
+
+/**
+ * One record of the binary profile stream.
+ *
+ * The profiler used to emit one formatted text line per call;
+ * printf'ing and re-parsing millions of lines dwarfed the time spent
+ * measuring.  Records are now fixed-size -- so consumers can read or
+ * mmap them with no scanning -- and in native byte order, since they
+ * never leave the machine that produced them.
+ *
+ * Function names are interned: a RECORD_NAME record defines a name id
+ * before the first call record that uses it.
+ */
+struct ProfileRecord {
+    uint32_t type;
+    uint32_t no;            // call no; name id; format version for the header
+    union {
+        struct {
+            int64_t gpuStart;
+            int64_t gpuDuration;
+            int64_t cpuStart;
+            int64_t cpuDuration;
+            int64_t pixels;
+            uint32_t program;
+            uint32_t nameId;
+        } call;
+        /**
+         * Replay timing of one frame, all times in nanoseconds.
+         *
+         * parseDuration and dispatchDuration break the frame's wall
+         * time down into decoding the trace and replaying the calls;
+         * swapInterval is the time since the previous end-of-frame
+         * call completed, i.e. the effective frame pacing.
+         */
+        struct {
+            int64_t wallStart;
+            int64_t wallDuration;
+            int64_t parseDuration;
+            int64_t dispatchDuration;
+            int64_t swapInterval;
+            uint32_t firstCall;
+            uint32_t lastCall;
+        } frameTiming;
+        /**
+         * End-of-frame marker; vramFreeKb as in Profile::Frame.
+         */
+        struct {
+            int64_t vramFreeKb;
+        } frameEnd;
+        /**
+         * Buffer-update pattern counters for one frame, emitted just
+         * before its RECORD_FRAME_END and only when at least one
+         * counter is non-zero.  Orphaning (glBufferData with a NULL
+         * data pointer) and the map flag mix replay very differently
+         * across drivers; these counters let replay-vs-application
+         * performance gaps be correlated with the frame's buffer
+         * update behavior.
+         */
+        struct {
+            uint32_t orphans;           // glBufferData, NULL data
+            uint32_t respecifications;  // glBufferData, with data
+            uint32_t subUploads;        // glBufferSubData
+            uint32_t maps;
+            uint32_t invalidateMaps;    // GL_MAP_INVALIDATE_*_BIT
+            uint32_t unsyncMaps;        // GL_MAP_UNSYNCHRONIZED_BIT
+            uint32_t flushes;           // glFlushMappedBufferRange
+        } bufferMetrics;
+        char name[56];      // NUL-padded
+        uint32_t flags;     // PROFILE_FLAG_*
+    } u;
+};
+
+enum ProfileRecordType {
+    RECORD_HEADER = 0x72707461,     // 'atpr', also doubles as magic
+    RECORD_CALL = 1,
+    RECORD_FRAME_END = 2,
+    RECORD_NAME = 3,
+    RECORD_FRAME_TIMING = 4,
+    RECORD_BUFFER_METRICS = 5
 };
 
+enum ProfileFlags {
+    PROFILE_FLAG_CPU_TIMES = 1,
+    PROFILE_FLAG_GPU_TIMES = 2,
+    PROFILE_FLAG_PIXELS_DRAWN = 4,
+    PROFILE_FLAG_FRAME_TIMINGS = 8
+};
+
+
 class Profiler
 {
 public:
     Profiler();
     ~Profiler();
 
-    void setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_);
+    void setup(bool cpuTimes_, bool gpuTimes_, bool pixelsDrawn_,
+               bool frameTimings_ = false);
 
     void addCall(unsigned no,
                  const char* name,
@@ -97,7 +228,30 @@ public:
                  int64_t gpuStart, int64_t gpuDuration,
                  int64_t cpuStart, int64_t cpuDuration);
 
-    void addFrameEnd();
+    /**
+     * Emit a RECORD_FRAME_END record; vramFreeKb is the free video
+     * memory in KB at the frame boundary, or -1 when unknown.
+     */
+    void addFrameEnd(int64_t vramFreeKb = -1);
+
+    /**
+     * Emit a RECORD_BUFFER_METRICS record for the frame whose
+     * RECORD_FRAME_END follows.
+     */
+    void addBufferMetrics(uint32_t orphans, uint32_t respecifications,
+                          uint32_t subUploads, uint32_t maps,
+                          uint32_t invalidateMaps, uint32_t unsyncMaps,
+                          uint32_t flushes);
+
+    /**
+     * Emit a RECORD_FRAME_TIMING record.  The time arguments are in
+     * ticks of the frequency set with setCpuTimeFrequency.
+     */
+    void addFrameTiming(unsigned no,
+                        int64_t wallStart, int64_t wallDuration,
+                        int64_t parseDuration, int64_t dispatchDuration,
+                        int64_t swapInterval,
+                        unsigned firstCall, unsigned lastCall);
 
     bool hasBaseTimes();
 
@@ -107,16 +261,45 @@ public:
     int64_t getBaseCpuTime();
     int64_t getBaseGpuTime();
 
-    static void parseLine(const char* line, Profile* profile);
+    /**
+     * Tick rate of the clock behind the cpuStart/cpuDuration values
+     * fed to addCall.  Defaults to os::timeFrequency.
+     */
+    void setCpuTimeFrequency(int64_t frequency);
 
 private:
+    unsigned getNameId(const char* name);
+
     int64_t baseGpuTime;
     int64_t baseCpuTime;
     int64_t minCpuTime;
+    int64_t cpuTimeFrequency;
 
     bool cpuTimes;
     bool gpuTimes;
     bool pixelsDrawn;
+
+    std::map<std::string, unsigned> nameIds;
+};
+
+
+/**
+ * Reassembles a Profile from the profiler's record stream; feed it one
+ * record at a time, in stream order.
+ */
+class ProfileParser
+{
+public:
+    ProfileParser();
+
+    void parseRecord(const char* data, Profile* profile);
+
+private:
+    int64_t lastGpuTime;
+    int64_t lastCpuTime;
+
+    /* Stream format version from the header record */
+    unsigned version;
 };
 }
 
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <snappy.h>
+
 #include "os.hpp"
 #include "trace_file.hpp"
 #include "trace_writer.hpp"
@@ -40,7 +42,12 @@ namespace trace {
 
 
 Writer::Writer() :
-    call_no(0)
+    call_no(0),
+    m_pendingFrameMark(false),
+    m_frameMarked(false),
+    m_nextBlobIndex(0),
+    m_blobBytes(0),
+    m_blobDedup(true)
 {
     m_file = File::createSnappy();
     close();
@@ -55,7 +62,27 @@ Writer::~Writer()
 
 void
 Writer::close(void) {
+    if (m_frameMarked && m_pendingFrameMark && call_no) {
+        // the last written call completed a frame; terminate it so
+        // readers can tell it apart from a truncated one
+        m_file->markFrameStart(call_no);
+        m_pendingFrameMark = false;
+    }
     m_file->close();
+    _freeBlobs();
+}
+
+void
+Writer::_freeBlobs(void) {
+    for (BlobMap::iterator it = m_blobs.begin(); it != m_blobs.end(); ++it) {
+        std::vector<BlobEntry> &bucket = it->second;
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            free(bucket[i].copy);
+        }
+    }
+    m_blobs.clear();
+    m_nextBlobIndex = 0;
+    m_blobBytes = 0;
 }
 
 bool
@@ -74,20 +101,28 @@ Writer::open(const char *filename) {
 
     _writeUInt(TRACE_VERSION);
 
+    m_pendingFrameMark = true;
+    m_frameMarked = false;
+
     return true;
 }
 
-void inline
+void
+Writer::setAsyncWrite(bool enable) {
+    m_file->setAsyncWrite(enable);
+}
+
+void
 Writer::_write(const void *sBuffer, size_t dwBytesToWrite) {
     m_file->write(sBuffer, dwBytesToWrite);
 }
 
-void inline
+void
 Writer::_writeByte(char c) {
     _write(&c, 1);
 }
 
-void inline
+void
 Writer::_writeUInt(unsigned long long value) {
     char buf[2 * sizeof value];
     unsigned len;
@@ -106,19 +141,19 @@ Writer::_writeUInt(unsigned long long value) {
     _write(buf, len);
 }
 
-void inline
+void
 Writer::_writeFloat(float value) {
     assert(sizeof value == 4);
     _write((const char *)&value, sizeof value);
 }
 
-void inline
+void
 Writer::_writeDouble(double value) {
     assert(sizeof value == 8);
     _write((const char *)&value, sizeof value);
 }
 
-void inline
+void
 Writer::_writeString(const char *str) {
     size_t len = strlen(str);
     _writeUInt(len);
@@ -251,11 +286,129 @@ void Writer::writeWString(const wchar_t *str) {
     _writeString("<wide-string>");
 }
 
+/*
+ * Blobs below the threshold are not worth the bookkeeping of a
+ * back-reference; above the memory cap new contents are no longer
+ * retained for comparison and get written in full again.
+ */
+#define BLOB_DEDUP_THRESHOLD 64
+#define BLOB_DEDUP_MAX_BYTES (64*1024*1024)
+
+/* FNV-1a */
+static inline unsigned long long
+hashBlob(const unsigned char *data, size_t size) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Blobs at least this large get their payload snappy-compressed in
+ * place.  Unlike the container's chunk compression this keeps every
+ * payload independently skippable, so a lazy parse only pays for
+ * decompressing the blobs it actually materializes.
+ */
+#define BLOB_COMPRESS_THRESHOLD 4096
+
+/*
+ * Returns a malloc'ed compressed copy of the payload, or NULL when
+ * compression isn't worthwhile: small blobs, or incompressible data
+ * (e.g. already-compressed textures) that would be stored larger.
+ */
+static char *
+compressBlob(const void *data, size_t size, size_t *stored_size) {
+    if (size < BLOB_COMPRESS_THRESHOLD) {
+        return NULL;
+    }
+    char *compressed = (char *)malloc(snappy::MaxCompressedLength(size));
+    if (!compressed) {
+        return NULL;
+    }
+    size_t compressed_size;
+    snappy::RawCompress((const char *)data, size, compressed, &compressed_size);
+    if (compressed_size >= size) {
+        free(compressed);
+        return NULL;
+    }
+    *stored_size = compressed_size;
+    return compressed;
+}
+
+bool Writer::dedupsBlob(size_t size) const {
+    return m_blobDedup && size >= BLOB_DEDUP_THRESHOLD;
+}
+
 void Writer::writeBlob(const void *data, size_t size) {
     if (!data) {
         Writer::writeNull();
         return;
     }
+
+    /*
+     * Applications resubmit the same shader sources and static vertex
+     * data over and over (e.g. across context recreation); writing
+     * every copy in full bloats the trace and the time to parse it.
+     * Repeats of a previously registered blob are therefore written
+     * as a mere back-reference to its definition.
+     */
+    if (m_blobDedup && size >= BLOB_DEDUP_THRESHOLD) {
+        unsigned long long hash = hashBlob((const unsigned char *)data, size);
+        BlobMap::iterator it = m_blobs.find(hash);
+        if (it != m_blobs.end()) {
+            const std::vector<BlobEntry> &bucket = it->second;
+            for (size_t i = 0; i < bucket.size(); ++i) {
+                const BlobEntry &entry = bucket[i];
+                if (entry.size == size && memcmp(entry.copy, data, size) == 0) {
+                    _writeByte(trace::TYPE_BLOB_REF);
+                    _writeUInt(entry.index);
+                    return;
+                }
+            }
+        }
+        if (m_blobBytes + size <= BLOB_DEDUP_MAX_BYTES) {
+            BlobEntry entry;
+            entry.copy = (char *)malloc(size);
+            if (entry.copy) {
+                entry.index = m_nextBlobIndex++;
+                entry.size = size;
+                memcpy(entry.copy, data, size);
+                m_blobs[hash].push_back(entry);
+                m_blobBytes += size;
+
+                size_t stored_size;
+                char *compressed = compressBlob(data, size, &stored_size);
+                if (compressed) {
+                    _writeByte(trace::TYPE_BLOB_DEF_COMPRESSED);
+                    _writeUInt(entry.index);
+                    _writeUInt(size);
+                    _writeUInt(stored_size);
+                    _write(compressed, stored_size);
+                    free(compressed);
+                } else {
+                    _writeByte(trace::TYPE_BLOB_DEF);
+                    _writeUInt(entry.index);
+                    _writeUInt(size);
+                    _write(data, size);
+                }
+                return;
+            }
+        }
+    }
+
+    size_t stored_size;
+    char *compressed = compressBlob(data, size, &stored_size);
+    if (compressed) {
+        _writeByte(trace::TYPE_BLOB_COMPRESSED);
+        _writeUInt(size);
+        _writeUInt(stored_size);
+        _write(compressed, stored_size);
+        free(compressed);
+        return;
+    }
+
     _writeByte(trace::TYPE_BLOB);
     _writeUInt(size);
     if (size) {
@@ -33,6 +33,7 @@
 
 #include <stddef.h>
 
+#include <map>
 #include <vector>
 
 #include "trace_model.hpp"
@@ -46,18 +47,51 @@ namespace trace {
         File *m_file;
         unsigned call_no;
 
+        /* Frame index bookkeeping: the next written call begins a new
+         * frame, and whether any frame boundary was recorded at all. */
+        bool m_pendingFrameMark;
+        bool m_frameMarked;
+
         std::vector<bool> functions;
         std::vector<bool> structs;
         std::vector<bool> enums;
         std::vector<bool> bitmasks;
 
+        /* Blob deduplication table (see writeBlob).  Keyed by content
+         * hash; each entry retains a copy of the bytes so that hash
+         * collisions can be told apart from genuine repeats. */
+        struct BlobEntry {
+            unsigned index;
+            size_t size;
+            char *copy;
+        };
+        typedef std::map<unsigned long long, std::vector<BlobEntry> > BlobMap;
+        BlobMap m_blobs;
+        unsigned m_nextBlobIndex;
+        size_t m_blobBytes;
+
+        /* Whether writeBlob may emit back-references to earlier blob
+         * definitions.  Disabled when records can be dropped after the
+         * fact (see the flight recorder in trace_writer_local.cpp), as
+         * a reference must never outlive its definition. */
+        bool m_blobDedup;
+
+        /* Whether writeBlob would consult and mutate the dedup
+         * registry for a blob of this size. */
+        bool dedupsBlob(size_t size) const;
+
     public:
         Writer();
-        ~Writer();
+        virtual ~Writer();
 
         bool open(const char *filename);
         void close(void);
 
+        /* Compress and write chunks on a worker thread instead of
+         * stalling the serialization loop (see File::setAsyncWrite).
+         * Call after open(). */
+        void setAsyncWrite(bool enable);
+
         unsigned beginEnter(const FunctionSig *sig, unsigned thread_id);
         void endEnter(void);
 
@@ -76,7 +110,7 @@ namespace trace {
         inline void beginElement(void) {}
         inline void endElement(void) {}
 
-        void beginStruct(const StructSig *sig);
+        virtual void beginStruct(const StructSig *sig);
         inline void endStruct(void) {}
 
         void beginRepr(void);
@@ -91,20 +125,23 @@ namespace trace {
         void writeString(const char *str, size_t size);
         void writeWString(const wchar_t *str);
         void writeBlob(const void *data, size_t size);
-        void writeEnum(const EnumSig *sig, signed long long value);
-        void writeBitmask(const BitmaskSig *sig, unsigned long long value);
+        virtual void writeEnum(const EnumSig *sig, signed long long value);
+        virtual void writeBitmask(const BitmaskSig *sig, unsigned long long value);
         void writeNull(void);
         void writePointer(unsigned long long addr);
 
         void writeCall(Call *call);
 
     protected:
-        void inline _write(const void *sBuffer, size_t dwBytesToWrite);
-        void inline _writeByte(char c);
-        void inline _writeUInt(unsigned long long value);
-        void inline _writeFloat(float value);
-        void inline _writeDouble(double value);
-        void inline _writeString(const char *str);
+        /* All serialization funnels through here; subclasses may
+         * redirect it (e.g. to a per-thread buffer). */
+        virtual void _write(const void *sBuffer, size_t dwBytesToWrite);
+        void _writeByte(char c);
+        void _writeUInt(unsigned long long value);
+        void _writeFloat(float value);
+        void _writeDouble(double value);
+        void _writeString(const char *str);
+        void _freeBlobs(void);
 
     };
 
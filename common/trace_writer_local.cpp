@@ -30,9 +30,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
 #include "os.hpp"
+#include "os_histogram.hpp"
 #include "os_thread.hpp"
 #include "os_string.hpp"
+#include "os_time.hpp"
 #include "trace_file.hpp"
 #include "trace_writer_local.hpp"
 #include "trace_format.hpp"
@@ -60,19 +72,522 @@ static void exceptionCallback(void)
 }
 
 
+/**
+ * Marks a call number returned by beginEnter as a per-thread token
+ * rather than a real number: the real number is only known once the
+ * enter record has been appended to the file, and is looked up when
+ * the token comes back through beginLeave.
+ */
+#define CALL_NO_TOKEN 0x80000000U
+
+/**
+ * Token returned by beginEnter for calls that are being discarded
+ * rather than recorded (see the frame gating below); it routes the
+ * rest of the call's serialization into a no-op path.
+ */
+#define MUTED_CALL 0xffffffffU
+
+
+/**
+ * Capture-side frame gating, configured with
+ * TRACE_FRAMES=<first>[-[<last>]] and/or TRACE_FRAME_STEP=<k>.
+ *
+ * Hour-long soak runs produce traces of which only a small window is
+ * ever replayed; recording just that window (or one frame in every k)
+ * removes the serialization, compression and storage cost at the
+ * source.  Outside the selected frames only calls that merely render
+ * or have no side effects are dropped -- state-establishing calls
+ * (uploads, binds, object creation) are still recorded, so the
+ * selected frames replay against the state the skipped spans built
+ * up.  Frame-terminating calls are always recorded, keeping the
+ * trace's frame numbering aligned with the application's.
+ */
+static bool frameGating = false;
+static unsigned frameGateFirst = 0;
+static unsigned frameGateLast = ~0U;
+static unsigned frameGateStep = 0;
+
+/* Current frame at capture; bumped on frame-terminating calls without
+ * synchronization, as applications swap from a single thread. */
+static volatile unsigned frameGateNo = 0;
+
+static inline bool
+recordedFrame(unsigned no) {
+    if (no < frameGateFirst || no > frameGateLast) {
+        return false;
+    }
+    if (frameGateStep > 1 && (no - frameGateFirst) % frameGateStep) {
+        return false;
+    }
+    return true;
+}
+
+
+/* Call flags per function signature id, cached from the parser's
+ * name-keyed table; the flag is only flipped after the flags have been
+ * stored, so lock-free readers never see a half-filled entry. */
+enum { FLAG_CACHE_CAP = 16384 };
+static CallFlags callFlagsCache[FLAG_CACHE_CAP];
+static volatile int callFlagsKnown[FLAG_CACHE_CAP];
+
+static inline CallFlags
+sigCallFlags(const FunctionSig *sig) {
+    if (sig->id >= FLAG_CACHE_CAP) {
+        return lookupCallFlags(sig->name);
+    }
+    if (!callFlagsKnown[sig->id]) {
+        callFlagsCache[sig->id] = lookupCallFlags(sig->name);
+        callFlagsKnown[sig->id] = 1;
+    }
+    return callFlagsCache[sig->id];
+}
+
+
+/**
+ * Flight-recorder capture, enabled with TRACE_FLIGHT=<frames>
+ * (bounded further by TRACE_FLIGHT_MB per thread, default 512).
+ *
+ * Instead of streaming every record to disk, each thread retains its
+ * completed records in a bounded in-memory ring, and only on a
+ * trigger -- a fatal signal, SIGUSR1, or process exit -- is the
+ * retained window written out as a normal trace file.  That makes
+ * capturing around a failure that appears hours into a soak run
+ * affordable: full capture at those durations is infeasible, but the
+ * last few hundred frames are enough to debug from.
+ *
+ * Records that carry a first-use signature definition are retained in
+ * a separate, never-trimmed preamble list, so every dump remains
+ * self-describing no matter how much of the ring has been recycled.
+ */
+static bool flightMode = false;
+static unsigned flightFrames = 300;
+static size_t flightByteCap = 512 * 1024 * 1024;
+static char *flightFileName = NULL;
+static unsigned flightDumpNo = 0;
+
+/* Current frame at capture; bumped on frame-terminating calls without
+ * synchronization, as applications swap from a single thread. */
+static volatile unsigned flightFrameNo = 0;
+
+/* Global record ordering, assigned under the writer mutex. */
+static uint64_t flightSeq = 0;
+
+/**
+ * One complete enter or leave record, retained in memory.
+ */
+struct FlightEntry {
+    char *data;
+    size_t size;
+    unsigned char kind;     // EVENT_ENTER or EVENT_LEAVE
+    unsigned callNo;
+    uint64_t seq;
+    unsigned frame;
+};
+
+/* Records carrying first-use signature definitions, retained for the
+ * lifetime of the process (see above). */
+static std::deque<FlightEntry> flightPreambleEntries;
+
+/* Calls whose enter went to the preamble but whose leave has not been
+ * seen yet: the leave must be retained alongside, or the call would
+ * read as incomplete in every dump. */
+static std::set<unsigned> flightPreambleCalls;
+
+static inline size_t
+encodeUInt(char *buf, unsigned long long value) {
+    size_t len = 0;
+    do {
+        buf[len++] = 0x80 | (value & 0x7f);
+        value >>= 7;
+    } while (value);
+    buf[len - 1] &= 0x7f;
+    return len;
+}
+
+static inline size_t
+skipUInt(const char *data) {
+    size_t len = 0;
+    while (data[len] & 0x80) {
+        ++len;
+    }
+    return len + 1;
+}
+
+static inline bool
+flightEntryBefore(const FlightEntry *a, const FlightEntry *b) {
+    return a->seq < b->seq;
+}
+
+#ifndef _WIN32
+static void
+flightSignalHandler(int sig) {
+    (void)sig;
+    localWriter.flush();
+}
+#endif
+
+
+/**
+ * Signature tables registered by the generated wrappers (see
+ * registerSignatures in trace_writer_local.hpp).  Plain
+ * zero-initialized statics, so registration from static initializers
+ * is safe regardless of construction order.
+ */
+enum { MAX_SIG_TABLES = 8 };
+static const FunctionSig * const *sigTables[MAX_SIG_TABLES];
+static size_t sigTableCounts[MAX_SIG_TABLES];
+static unsigned numSigTables;
+
+void
+registerSignatures(const FunctionSig * const *sigs, size_t count) {
+    if (numSigTables < MAX_SIG_TABLES) {
+        sigTables[numSigTables] = sigs;
+        sigTableCounts[numSigTables] = count;
+        ++numSigTables;
+    }
+}
+
+/**
+ * Serialize the registered tables as standalone FUNCTION_SIG records
+ * (version 6+), ready to be written right after the trace header.
+ */
+static void
+encodeSigTable(std::vector<char> &out) {
+    char buf[16];
+    for (unsigned t = 0; t < numSigTables; ++t) {
+        for (size_t i = 0; i < sigTableCounts[t]; ++i) {
+            const FunctionSig *sig = sigTables[t][i];
+            out.push_back((char)trace::EVENT_FUNCTION_SIG);
+            out.insert(out.end(), buf, buf + encodeUInt(buf, sig->id));
+            size_t len = strlen(sig->name);
+            out.insert(out.end(), buf, buf + encodeUInt(buf, len));
+            out.insert(out.end(), sig->name, sig->name + len);
+            out.insert(out.end(), buf, buf + encodeUInt(buf, sig->num_args));
+            for (unsigned j = 0; j < sig->num_args; ++j) {
+                len = strlen(sig->arg_names[j]);
+                out.insert(out.end(), buf, buf + encodeUInt(buf, len));
+                out.insert(out.end(), sig->arg_names[j],
+                           sig->arg_names[j] + len);
+            }
+        }
+    }
+}
+
+
+/**
+ * Capture-overhead self measurement, enabled with TRACE_SELF_PROFILE.
+ *
+ * When an application slows down under tracing there is no way to
+ * tell, from the outside, whether the time goes into serializing,
+ * waiting on the writer mutex, or compression and disk stalls.  These
+ * counters split it up: they are per thread (so updates stay off the
+ * shared cache lines), sampled with os::getTimeFast(), and summarized
+ * once at exit.
+ */
+struct SelfProfile {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t totalTicks;    // inside beginEnter..endEnter/beginLeave..endLeave
+    uint64_t lockTicks;     // waiting for the writer mutex
+    uint64_t fileTicks;     // appending to the container, incl. compression stalls
+
+    SelfProfile() :
+        calls(0),
+        bytes(0),
+        totalTicks(0),
+        lockTicks(0),
+        fileTicks(0)
+    {}
+};
+
+static bool selfProfiling = false;
+
+
+/**
+ * Per-thread composition state.
+ *
+ * A thread serializes the call record it is currently writing into
+ * this private buffer, without taking any lock, and appends the
+ * complete record to the file in one short critical section.  The
+ * buffer never holds more than one record.
+ */
+struct CaptureBuffer {
+    enum { MAX_PENDING = 16 };
+    enum { MAX_EXTERNAL = 8 };
+
+    /* _write payloads at least this large are not copied into the
+     * buffer; a segment below just remembers where the caller's bytes
+     * live.  Arguments are serialized while the traced call is still
+     * executing, so the application's pointers remain valid until the
+     * record is appended to the file. */
+    enum { EXTERNAL_THRESHOLD = 4096 };
+
+    char *buf;
+    size_t size;
+    size_t cap;
+
+    /* Whether _write currently goes to the buffer. */
+    bool buffering;
+
+    /* Whether the current call is being discarded instead of recorded
+     * (see frame gating): all writer entry points are no-ops until the
+     * matching endEnter/endLeave. */
+    bool muting;
+
+    /* Scatter-gather segments: large payloads (texture uploads, shader
+     * sources) referenced in place instead of being copied, ordered by
+     * the amount of buffered bytes preceding them. */
+    struct ExternalSegment {
+        size_t bufOffset;
+        const void *data;
+        size_t length;
+    };
+    ExternalSegment external[MAX_EXTERNAL];
+    int numExternal;
+
+    /* Pending slot of the enter record being composed, or -1. */
+    int curSlot;
+
+    /* Flight-recorder ring of this thread's retained records;
+     * appended and trimmed by the owner, under the writer mutex so a
+     * dump can walk every ring. */
+    std::deque<FlightEntry> flightRing;
+    size_t flightBytes;
+
+    /* Whether the mutex has been held since a first-use definition
+     * was composed into the current record (see flightDirect), and
+     * whether that record is bound for the preamble list. */
+    bool flightLocked;
+    bool flightPreamble;
+
+    /* Call number of the record being composed, for the entry header. */
+    unsigned flightCallNo;
+
+    /* Call numbers of enter records whose matching leave has not been
+     * written yet, indexed by token slot. */
+    unsigned pendingCallNo[MAX_PENDING];
+    bool pendingUsed[MAX_PENDING];
+
+    /* Self-measurement (see SelfProfile); buffers are never freed, so
+     * the registry can be walked safely at exit.  The histogram keeps
+     * the shape of the mutex waits, not just their sum: it is the
+     * occasional 10 ms wait, invisible in the average, that shows up
+     * as a dropped frame. */
+    SelfProfile profile;
+    os::LatencyHistogram lockHist;
+    long long profileStartTick;
+    unsigned threadId;
+    CaptureBuffer *nextRegistered;
+
+    CaptureBuffer() :
+        buf(NULL),
+        size(0),
+        cap(0),
+        buffering(false),
+        muting(false),
+        numExternal(0),
+        curSlot(-1),
+        flightBytes(0),
+        flightLocked(false),
+        flightPreamble(false),
+        flightCallNo(0),
+        profileStartTick(0),
+        threadId(0),
+        nextRegistered(NULL)
+    {
+        memset(pendingUsed, 0, sizeof pendingUsed);
+    }
+
+    void append(const void *data, size_t len) {
+        if (size + len > cap) {
+            size_t newCap = cap ? 2 * cap : 4096;
+            while (newCap < size + len) {
+                newCap *= 2;
+            }
+            buf = (char *)realloc(buf, newCap);
+            cap = newCap;
+        }
+        memcpy(buf + size, data, len);
+        size += len;
+    }
+
+    void appendExternal(const void *data, size_t len) {
+        ExternalSegment &seg = external[numExternal++];
+        seg.bufOffset = size;
+        seg.data = data;
+        seg.length = len;
+    }
+
+    int allocSlot(void) {
+        for (int i = 0; i < MAX_PENDING; ++i) {
+            if (!pendingUsed[i]) {
+                pendingUsed[i] = true;
+                return i;
+            }
+        }
+        return -1;
+    }
+};
+
+static thread_specific CaptureBuffer *capture_buffer = NULL;
+static CaptureBuffer *captureBufferRegistry = NULL;
+
+CaptureBuffer *
+LocalWriter::captureBuffer(void) {
+    CaptureBuffer *cb = capture_buffer;
+    if (!cb) {
+        // Never freed -- threads are not tracked, and the state must
+        // survive until the very last traced call of the thread.
+        cb = capture_buffer = new CaptureBuffer;
+
+        mutex.lock();
+        cb->nextRegistered = captureBufferRegistry;
+        captureBufferRegistry = cb;
+        mutex.unlock();
+    }
+    return cb;
+}
+
+
+/**
+ * mutex.lock(), attributing the wait to the thread's lock counter
+ * when self profiling.
+ */
+static inline void
+profiledLock(os::recursive_mutex &mutex) {
+    if (selfProfiling) {
+        CaptureBuffer *cb = capture_buffer;
+        if (cb) {
+            long long start = os::getTimeFast();
+            mutex.lock();
+            long long wait = os::getTimeFast() - start;
+            cb->profile.lockTicks += wait;
+            cb->lockHist.record(wait);
+            return;
+        }
+    }
+    mutex.lock();
+}
+
+
 LocalWriter::LocalWriter() :
     acquired(0)
 {
+    memset((void *)functionDefined, 0, sizeof functionDefined);
+    memset((void *)structDefined, 0, sizeof structDefined);
+    memset((void *)enumDefined, 0, sizeof enumDefined);
+    memset((void *)bitmaskDefined, 0, sizeof bitmaskDefined);
+
     // Install the signal handlers as early as possible, to prevent
     // interfering with the application's signal handling.
     os::setExceptionCallback(exceptionCallback);
 }
 
+static void
+dumpSelfProfile(void)
+{
+    double scale = 1.0 / os::fastTimeFrequency;
+    SelfProfile total;
+    os::LatencyHistogram lockHist;
+
+    for (CaptureBuffer *cb = captureBufferRegistry; cb;
+         cb = cb->nextRegistered) {
+        const SelfProfile &p = cb->profile;
+        if (!p.calls && !p.bytes) {
+            continue;
+        }
+
+        os::log("apitrace: self-profile: thread %u: %llu calls, %.1f MB, "
+                "%.3fs in writer (%.3fs lock wait, %.3fs file/compression)\n",
+                cb->threadId,
+                (unsigned long long)p.calls,
+                p.bytes / (1024.0 * 1024.0),
+                p.totalTicks * scale,
+                p.lockTicks * scale,
+                p.fileTicks * scale);
+
+        total.calls += p.calls;
+        total.bytes += p.bytes;
+        total.totalTicks += p.totalTicks;
+        total.lockTicks += p.lockTicks;
+        total.fileTicks += p.fileTicks;
+        lockHist.merge(cb->lockHist);
+    }
+
+    os::log("apitrace: self-profile: total: %llu calls, %.1f MB, "
+            "%.3fs in writer (%.3fs lock wait, %.3fs file/compression)\n",
+            (unsigned long long)total.calls,
+            total.bytes / (1024.0 * 1024.0),
+            total.totalTicks * scale,
+            total.lockTicks * scale,
+            total.fileTicks * scale);
+
+    if (lockHist.count()) {
+        double usScale = scale * 1.0E6;
+        os::log("apitrace: self-profile: lock wait: %llu waits, "
+                "p50 %.1fus, p90 %.1fus, p99 %.1fus, p99.9 %.1fus, "
+                "max %.1fus\n",
+                (unsigned long long)lockHist.count(),
+                lockHist.percentile(0.50) * usScale,
+                lockHist.percentile(0.90) * usScale,
+                lockHist.percentile(0.99) * usScale,
+                lockHist.percentile(0.999) * usScale,
+                lockHist.maximum() * usScale);
+    }
+}
+
 LocalWriter::~LocalWriter()
 {
     os::resetExceptionCallback();
+
+    if (flightMode) {
+        mutex.lock();
+        flightDump();
+        mutex.unlock();
+    }
+
+    if (selfProfiling) {
+        dumpSelfProfile();
+    }
+}
+
+/**
+ * Emit the registered signature tables and mark every listed
+ * signature as defined, so the per-call path never hits the locked
+ * first-use branch.  writeRecords is false in flight mode, where the
+ * records are instead written at the head of every dump (see
+ * flightDump).
+ */
+void LocalWriter::emitSigTable(bool writeRecords) {
+    if (!numSigTables) {
+        return;
+    }
+
+    if (writeRecords) {
+        std::vector<char> table;
+        encodeSigTable(table);
+        m_file->write(&table[0], table.size());
+    }
+
+    for (unsigned t = 0; t < numSigTables; ++t) {
+        for (size_t i = 0; i < sigTableCounts[t]; ++i) {
+            const FunctionSig *sig = sigTables[t][i];
+            if (functions.size() <= sig->id) {
+                functions.resize(sig->id + 1);
+            }
+            functions[sig->id] = true;
+            if (sig->id < SIG_CAP) {
+                functionDefined[sig->id] = 1;
+            }
+        }
+    }
 }
 
+
+/* Whether open() has run; the file itself stays closed until a dump
+ * in flight mode, so this is what beginEnter must check. */
+static bool writerReady = false;
+
 void
 LocalWriter::open(void) {
     os::String szFileName;
@@ -117,11 +632,98 @@ LocalWriter::open(void) {
 
     os::log("apitrace: tracing to %s\n", lpFileName);
 
-    if (!Writer::open(lpFileName)) {
+    /* Flight recorder (see above): records are retained in memory and
+     * only written to the file above on a trigger. */
+    const char *flight = getenv("TRACE_FLIGHT");
+    if (flight) {
+        flightMode = true;
+        if (atoi(flight) > 0) {
+            flightFrames = atoi(flight);
+        }
+        const char *flightCap = getenv("TRACE_FLIGHT_MB");
+        if (flightCap && atoi(flightCap) > 0) {
+            flightByteCap = (size_t)atoi(flightCap) * 1024 * 1024;
+        }
+        flightFileName = strdup(lpFileName);
+
+        /* A blob back-reference must never outlive the record that
+         * defined it, and ring entries are dropped after the fact. */
+        m_blobDedup = false;
+
+#ifndef _WIN32
+        signal(SIGUSR1, flightSignalHandler);
+#endif
+
+        os::log("apitrace: flight recorder keeping the last %u frames; "
+                "dumping on crash, exit or SIGUSR1\n", flightFrames);
+    } else if (!Writer::open(lpFileName)) {
         os::log("apitrace: error: failed to open %s\n", lpFileName);
         os::abort();
     }
 
+    if (getenv("TRACE_SELF_PROFILE")) {
+        // calibrate before tracing starts; the first call blocks ~10ms
+        os::calibrateFastTime();
+        selfProfiling = true;
+    }
+
+    /* Capture-side frame gating (see above). */
+    const char *frames = getenv("TRACE_FRAMES");
+    if (frames) {
+        unsigned first, last;
+        if (sscanf(frames, "%u-%u", &first, &last) == 2) {
+            frameGateFirst = first;
+            frameGateLast = last;
+        } else if (sscanf(frames, "%u", &first) == 1) {
+            frameGateFirst = first;
+            // "N" selects one frame, "N-" everything from N on
+            frameGateLast = strchr(frames, '-') ? ~0U : first;
+        } else {
+            os::log("apitrace: warning: ignoring malformed TRACE_FRAMES=%s\n",
+                    frames);
+            frames = NULL;
+        }
+    }
+    const char *frameStep = getenv("TRACE_FRAME_STEP");
+    if (frameStep) {
+        frameGateStep = atoi(frameStep);
+    }
+    if (frames || frameGateStep > 1) {
+        frameGating = true;
+        if (frameGateLast != ~0U) {
+            os::log("apitrace: recording frames %u-%u, 1 in %u\n",
+                    frameGateFirst, frameGateLast,
+                    frameGateStep > 1 ? frameGateStep : 1);
+        } else {
+            os::log("apitrace: recording frames %u on, 1 in %u\n",
+                    frameGateFirst,
+                    frameGateStep > 1 ? frameGateStep : 1);
+        }
+    }
+
+    if (!flightMode) {
+        // Keep compression and disk I/O off the traced application's
+        // threads.
+        m_file->setAsyncWrite(true);
+
+        // Shadow uncompressed records in a sidecar journal, so crash
+        // captures survive even terminations the exception callback
+        // cannot intercept.
+        m_file->setJournal(true);
+    }
+
+    // No signature definition has hit the new file yet.
+    memset((void *)functionDefined, 0, sizeof functionDefined);
+    memset((void *)structDefined, 0, sizeof structDefined);
+    memset((void *)enumDefined, 0, sizeof enumDefined);
+    memset((void *)bitmaskDefined, 0, sizeof bitmaskDefined);
+
+    // Registered signatures are defined up front (version 6+), so the
+    // per-call path is a pure id write from the very first call.
+    emitSigTable(!flightMode);
+
+    writerReady = true;
+
 #if 0
     // For debugging the exception handler
     *((int *)0) = 0;
@@ -131,40 +733,584 @@ LocalWriter::open(void) {
 static unsigned next_thread_num = 1;
 static thread_specific unsigned thread_num = 0;
 
-unsigned LocalWriter::beginEnter(const FunctionSig *sig) {
-    mutex.lock();
+void LocalWriter::_write(const void *sBuffer, size_t dwBytesToWrite) {
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        return;
+    }
+    if (selfProfiling && cb) {
+        cb->profile.bytes += dwBytesToWrite;
+    }
+    if (cb && cb->buffering) {
+        if (dwBytesToWrite >= CaptureBuffer::EXTERNAL_THRESHOLD &&
+            cb->numExternal < CaptureBuffer::MAX_EXTERNAL) {
+            cb->appendExternal(sBuffer, dwBytesToWrite);
+        } else {
+            cb->append(sBuffer, dwBytesToWrite);
+        }
+    } else {
+        Writer::_write(sBuffer, dwBytesToWrite);
+    }
+}
+
+/**
+ * Append the composed record to the file, splicing the in-place
+ * segments in between the buffered spans, so large payloads reach the
+ * container with one copy less.  Caller holds the mutex.
+ */
+void LocalWriter::flushCaptureBuffer(CaptureBuffer *cb) {
+    size_t pos = 0;
+    for (int i = 0; i < cb->numExternal; ++i) {
+        const CaptureBuffer::ExternalSegment &seg = cb->external[i];
+        if (seg.bufOffset > pos) {
+            Writer::_write(cb->buf + pos, seg.bufOffset - pos);
+            pos = seg.bufOffset;
+        }
+        Writer::_write(seg.data, seg.length);
+    }
+    if (cb->size > pos) {
+        Writer::_write(cb->buf + pos, cb->size - pos);
+    }
+    cb->size = 0;
+    cb->numExternal = 0;
+}
+
+/**
+ * Abandon lock-free composition of the current record: take the
+ * mutex, flush what has been buffered so far, and write the rest of
+ * the record straight to the file.  Needed whenever a signature
+ * definition must be emitted, since definitions have to land in the
+ * file before any lock-free reference to them.
+ *
+ * The mutex remains held until the matching endEnter/endLeave.
+ */
+void LocalWriter::beginDirect(void) {
+    CaptureBuffer *cb = capture_buffer;
+
+    profiledLock(mutex);
     ++acquired;
 
-    if (!m_file->isOpened()) {
-        open();
+    if (cb->curSlot >= 0) {
+        // the enter record's position in the file fixes its number
+        cb->pendingCallNo[cb->curSlot] = call_no++;
+        cb->curSlot = -1;
+    }
+    if (cb->size || cb->numExternal) {
+        flushCaptureBuffer(cb);
+    }
+    cb->buffering = false;
+}
+
+/**
+ * Flight-mode counterpart of beginDirect: the record keeps composing
+ * into the private buffer -- nothing goes straight to a file -- but
+ * the mutex is taken, and held until the record's entry is appended,
+ * so the definition about to be written is sequenced before any
+ * lock-free reference to it.  The record is bound for the preamble
+ * list, as later records may depend on the definition it carries.
+ */
+void LocalWriter::flightDirect(void) {
+    CaptureBuffer *cb = capture_buffer;
+
+    if (!cb->flightLocked) {
+        profiledLock(mutex);
+        ++acquired;
+        cb->flightLocked = true;
+    }
+    cb->flightPreamble = true;
+}
+
+/**
+ * Materialize the record composed in cb into a retained entry, and
+ * trim the thread's ring back to the configured window.  Caller holds
+ * the mutex, which also orders the entry's sequence number after that
+ * of any definition it references.
+ */
+void LocalWriter::flightAppend(CaptureBuffer *cb, char kind, unsigned callNo) {
+    size_t total = cb->size;
+    for (int i = 0; i < cb->numExternal; ++i) {
+        total += cb->external[i].length;
+    }
+
+    FlightEntry entry;
+    entry.data = (char *)malloc(total);
+    entry.size = total;
+    entry.kind = kind;
+    entry.callNo = callNo;
+    entry.seq = ++flightSeq;
+    entry.frame = flightFrameNo;
+
+    char *dst = entry.data;
+    size_t pos = 0;
+    for (int i = 0; i < cb->numExternal; ++i) {
+        const CaptureBuffer::ExternalSegment &seg = cb->external[i];
+        if (seg.bufOffset > pos) {
+            memcpy(dst, cb->buf + pos, seg.bufOffset - pos);
+            dst += seg.bufOffset - pos;
+            pos = seg.bufOffset;
+        }
+        memcpy(dst, seg.data, seg.length);
+        dst += seg.length;
+    }
+    if (cb->size > pos) {
+        memcpy(dst, cb->buf + pos, cb->size - pos);
+    }
+    cb->size = 0;
+    cb->numExternal = 0;
+
+    if (cb->flightPreamble ||
+        (kind == trace::EVENT_LEAVE && flightPreambleCalls.erase(callNo))) {
+        if (kind == trace::EVENT_ENTER) {
+            flightPreambleCalls.insert(callNo);
+        }
+        if (kind == trace::EVENT_LEAVE && cb->flightPreamble) {
+            /* A definition carried in a leave record is only usable if
+             * the matching enter survives too; pull it out of the ring
+             * (it may also be in the preamble already, carrying the
+             * function's own definition). */
+            std::deque<FlightEntry>::iterator it = cb->flightRing.end();
+            while (it != cb->flightRing.begin()) {
+                --it;
+                if (it->kind == trace::EVENT_ENTER && it->callNo == callNo) {
+                    flightPreambleEntries.push_back(*it);
+                    cb->flightBytes -= it->size;
+                    cb->flightRing.erase(it);
+                    break;
+                }
+            }
+        }
+        flightPreambleEntries.push_back(entry);
+        return;
+    }
+
+    cb->flightRing.push_back(entry);
+    cb->flightBytes += total;
+
+    /* Drop records that fell out of the frame window, and enforce the
+     * per-thread byte bound.  The window is inclusive of the frame a
+     * terminating swap opens, so "last N frames" always covers the N
+     * most recently completed frames. */
+    while (!cb->flightRing.empty()) {
+        const FlightEntry &front = cb->flightRing.front();
+        if (front.frame + flightFrames >= flightFrameNo &&
+            cb->flightBytes <= flightByteCap) {
+            break;
+        }
+        cb->flightBytes -= front.size;
+        free(front.data);
+        cb->flightRing.pop_front();
+    }
+}
+
+/**
+ * Write everything retained -- the definition-carrying preamble and
+ * each thread's ring -- out as a normal trace file, in capture order.
+ *
+ * The parser numbers enter records by their position in the file, so
+ * the retained enters are renumbered densely, leave records are
+ * rewritten to match, and a leave whose enter was trimmed from the
+ * ring is dropped (the parser cannot resynchronize past it).  Caller
+ * holds the mutex.
+ */
+void LocalWriter::flightDump(void) {
+    std::vector<const FlightEntry *> entries;
+
+    for (std::deque<FlightEntry>::const_iterator it = flightPreambleEntries.begin();
+         it != flightPreambleEntries.end(); ++it) {
+        entries.push_back(&*it);
+    }
+    for (CaptureBuffer *cb = captureBufferRegistry; cb;
+         cb = cb->nextRegistered) {
+        for (std::deque<FlightEntry>::const_iterator it = cb->flightRing.begin();
+             it != cb->flightRing.end(); ++it) {
+            entries.push_back(&*it);
+        }
+    }
+    if (entries.empty()) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), flightEntryBefore);
+
+    os::String dumpName = flightDumpNo
+        ? os::String::format("%s.%u", flightFileName, flightDumpNo)
+        : os::String(flightFileName);
+    ++flightDumpNo;
+
+    if (!m_file->open(dumpName.str(), File::Write)) {
+        os::log("apitrace: error: failed to open %s\n", dumpName.str());
+        return;
+    }
+
+    char buf[16];
+    size_t len = encodeUInt(buf, TRACE_VERSION);
+    m_file->write(buf, len);
+
+    std::vector<char> table;
+    encodeSigTable(table);
+    if (!table.empty()) {
+        m_file->write(&table[0], table.size());
+    }
+
+    std::map<unsigned, unsigned> renumber;
+    unsigned nextNo = 0;
+    unsigned written = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const FlightEntry *entry = entries[i];
+        if (entry->kind == trace::EVENT_ENTER) {
+            renumber[entry->callNo] = nextNo++;
+            m_file->write(entry->data, entry->size);
+        } else {
+            std::map<unsigned, unsigned>::const_iterator it =
+                renumber.find(entry->callNo);
+            if (it == renumber.end()) {
+                continue;
+            }
+            /* EVENT_LEAVE byte, rewritten call number, rest as-is. */
+            size_t skip = 1 + skipUInt(entry->data + 1);
+            m_file->write(entry->data, 1);
+            len = encodeUInt(buf, it->second);
+            m_file->write(buf, len);
+            m_file->write(entry->data + skip, entry->size - skip);
+        }
+        ++written;
+    }
+
+    m_file->close();
+
+    os::log("apitrace: flight recorder dumped %u records to %s\n",
+            written, dumpName.str());
+}
+
+unsigned LocalWriter::beginEnter(const FunctionSig *sig) {
+    if (!writerReady) {
+        mutex.lock();
+        ++acquired;
+        if (!writerReady) {
+            open();
+        }
+        --acquired;
+        mutex.unlock();
     }
 
     unsigned this_thread_num = thread_num;
     if (!this_thread_num) {
+        mutex.lock();
         this_thread_num = thread_num = next_thread_num++;
+        mutex.unlock();
+    }
+
+    assert(this_thread_num > 0);
+    unsigned thread_id = this_thread_num - 1;
+
+    CaptureBuffer *cb = captureBuffer();
+    if (selfProfiling) {
+        cb->profileStartTick = os::getTimeFast();
+        cb->threadId = thread_id;
+    }
+    if (frameGating || flightMode) {
+        CallFlags flags = sigCallFlags(sig);
+        if (flags & CALL_FLAG_END_FRAME) {
+            /* The frame-terminating call belongs to the frame it
+             * ends, and is always recorded. */
+            if (frameGating) {
+                frameGateNo = frameGateNo + 1;
+            }
+            if (flightMode) {
+                flightFrameNo = flightFrameNo + 1;
+            }
+        } else if (frameGating && !recordedFrame(frameGateNo) &&
+                   (flags & (CALL_FLAG_RENDER | CALL_FLAG_NO_SIDE_EFFECTS))) {
+            cb->muting = true;
+            return MUTED_CALL;
+        }
+    }
+
+    if (sig->id < SIG_CAP && functionDefined[sig->id]) {
+        int slot = cb->allocSlot();
+        if (slot >= 0) {
+            cb->curSlot = slot;
+            cb->size = 0;
+            cb->numExternal = 0;
+            cb->buffering = true;
+            _writeByte(trace::EVENT_ENTER);
+            _writeUInt(thread_id);
+            _writeUInt(sig->id);
+            return CALL_NO_TOKEN | (unsigned)slot;
+        }
     }
 
-    assert(thread_num > 0);
-    unsigned thread_id = thread_num - 1;
-    return Writer::beginEnter(sig, thread_id);
+    /* First use of this signature (or out of token slots): compose
+     * straight into the file with the mutex held, so the inline
+     * definition lands before any lock-free reference to it. */
+    profiledLock(mutex);
+    ++acquired;
+    if (flightMode) {
+        /* Nothing goes straight to a file in flight mode: keep
+         * composing into the private buffer, but hold the mutex until
+         * the record's entry is appended, so a definition it carries
+         * is sequenced before any lock-free reference to it. */
+        cb->flightLocked = true;
+        if (sig->id >= functions.size() || !functions[sig->id]) {
+            cb->flightPreamble = true;
+        }
+        cb->size = 0;
+        cb->numExternal = 0;
+        cb->buffering = true;
+    }
+    unsigned no = Writer::beginEnter(sig, thread_id);
+    if (sig->id < SIG_CAP) {
+        functionDefined[sig->id] = 1;
+    }
+    if (flightMode) {
+        cb->flightCallNo = no;
+    }
+    return no;
 }
 
 void LocalWriter::endEnter(void) {
-    Writer::endEnter();
-    --acquired;
-    mutex.unlock();
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        cb->muting = false;
+        return;
+    }
+    if (flightMode && cb) {
+        Writer::endEnter();
+        cb->buffering = false;
+
+        if (!cb->flightLocked) {
+            profiledLock(mutex);
+            ++acquired;
+        }
+        unsigned no;
+        if (cb->curSlot >= 0) {
+            no = cb->pendingCallNo[cb->curSlot] = call_no++;
+            cb->curSlot = -1;
+        } else {
+            no = cb->flightCallNo;
+        }
+        flightAppend(cb, trace::EVENT_ENTER, no);
+        cb->flightLocked = false;
+        cb->flightPreamble = false;
+        --acquired;
+        mutex.unlock();
+
+        if (selfProfiling) {
+            cb->profile.totalTicks += os::getTimeFast() - cb->profileStartTick;
+        }
+        return;
+    }
+    if (cb && cb->buffering) {
+        Writer::endEnter();
+        cb->buffering = false;
+
+        profiledLock(mutex);
+        ++acquired;
+        cb->pendingCallNo[cb->curSlot] = call_no++;
+        if (selfProfiling) {
+            long long start = os::getTimeFast();
+            flushCaptureBuffer(cb);
+            m_file->journalCommit();
+            cb->profile.fileTicks += os::getTimeFast() - start;
+        } else {
+            flushCaptureBuffer(cb);
+            m_file->journalCommit();
+        }
+        --acquired;
+        mutex.unlock();
+
+        cb->curSlot = -1;
+    } else {
+        Writer::endEnter();
+        m_file->journalCommit();
+        --acquired;
+        mutex.unlock();
+    }
+
+    if (selfProfiling && cb) {
+        cb->profile.totalTicks += os::getTimeFast() - cb->profileStartTick;
+    }
 }
 
 void LocalWriter::beginLeave(unsigned call) {
-    mutex.lock();
-    ++acquired;
+    CaptureBuffer *cb = captureBuffer();
+
+    if (call == MUTED_CALL) {
+        cb->muting = true;
+        return;
+    }
+
+    if (selfProfiling) {
+        cb->profileStartTick = os::getTimeFast();
+    }
+
+    if (call & CALL_NO_TOKEN) {
+        unsigned slot = call & ~CALL_NO_TOKEN;
+        assert(slot < CaptureBuffer::MAX_PENDING);
+        call = cb->pendingCallNo[slot];
+        cb->pendingUsed[slot] = false;
+    }
+
+    cb->size = 0;
+    cb->numExternal = 0;
+    cb->buffering = true;
+    if (flightMode) {
+        cb->flightCallNo = call;
+    }
     Writer::beginLeave(call);
 }
 
 void LocalWriter::endLeave(void) {
-    Writer::endLeave();
-    --acquired;
-    mutex.unlock();
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        cb->muting = false;
+        return;
+    }
+    if (flightMode && cb) {
+        Writer::endLeave();
+        cb->buffering = false;
+
+        if (!cb->flightLocked) {
+            profiledLock(mutex);
+            ++acquired;
+        }
+        flightAppend(cb, trace::EVENT_LEAVE, cb->flightCallNo);
+        cb->flightLocked = false;
+        cb->flightPreamble = false;
+        --acquired;
+        mutex.unlock();
+
+        if (selfProfiling) {
+            ++cb->profile.calls;
+            cb->profile.totalTicks += os::getTimeFast() - cb->profileStartTick;
+        }
+        return;
+    }
+    if (cb && cb->buffering) {
+        Writer::endLeave();
+        cb->buffering = false;
+
+        profiledLock(mutex);
+        ++acquired;
+        if (selfProfiling) {
+            long long start = os::getTimeFast();
+            flushCaptureBuffer(cb);
+            m_file->journalCommit();
+            cb->profile.fileTicks += os::getTimeFast() - start;
+        } else {
+            flushCaptureBuffer(cb);
+            m_file->journalCommit();
+        }
+        --acquired;
+        mutex.unlock();
+    } else {
+        Writer::endLeave();
+        m_file->journalCommit();
+        --acquired;
+        mutex.unlock();
+    }
+
+    if (selfProfiling && cb) {
+        ++cb->profile.calls;
+        cb->profile.totalTicks += os::getTimeFast() - cb->profileStartTick;
+    }
+}
+
+void LocalWriter::beginStruct(const StructSig *sig) {
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        return;
+    }
+    if (cb && cb->buffering) {
+        if (sig->id < SIG_CAP && structDefined[sig->id]) {
+            _writeByte(trace::TYPE_STRUCT);
+            _writeUInt(sig->id);
+            return;
+        }
+        if (flightMode) {
+            flightDirect();
+        } else {
+            beginDirect();
+        }
+    }
+
+    Writer::beginStruct(sig);
+    if (sig->id < SIG_CAP) {
+        structDefined[sig->id] = 1;
+    }
+}
+
+void LocalWriter::writeEnum(const EnumSig *sig, signed long long value) {
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        return;
+    }
+    if (cb && cb->buffering) {
+        if (sig->id < SIG_CAP && enumDefined[sig->id]) {
+            _writeByte(trace::TYPE_ENUM);
+            _writeUInt(sig->id);
+            writeSInt(value);
+            return;
+        }
+        if (flightMode) {
+            flightDirect();
+        } else {
+            beginDirect();
+        }
+    }
+
+    Writer::writeEnum(sig, value);
+    if (sig->id < SIG_CAP) {
+        enumDefined[sig->id] = 1;
+    }
+}
+
+void LocalWriter::writeBitmask(const BitmaskSig *sig, unsigned long long value) {
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        return;
+    }
+    if (cb && cb->buffering) {
+        if (sig->id < SIG_CAP && bitmaskDefined[sig->id]) {
+            _writeByte(trace::TYPE_BITMASK);
+            _writeUInt(sig->id);
+            _writeUInt(value);
+            return;
+        }
+        if (flightMode) {
+            flightDirect();
+        } else {
+            beginDirect();
+        }
+    }
+
+    Writer::writeBitmask(sig, value);
+    if (sig->id < SIG_CAP) {
+        bitmaskDefined[sig->id] = 1;
+    }
+}
+
+void LocalWriter::writeEncoded(const void *buffer, size_t size) {
+    _write(buffer, size);
+}
+
+void LocalWriter::writeBlob(const void *data, size_t size) {
+    /* Writer::writeBlob registers large blobs for back-reference
+     * deduplication; a discarded call must not register blobs whose
+     * definition never reaches the file. */
+    CaptureBuffer *cb = capture_buffer;
+    if (cb && cb->muting) {
+        return;
+    }
+    if (cb && cb->buffering && data && dedupsBlob(size)) {
+        /* The dedup registry is shared writer state, and a definition
+         * emitted here must land in the file before any back-reference
+         * to it from another thread: compose the rest of the record
+         * under the mutex, like first-use signature definitions.
+         * (Flight mode never dedups, see open().) */
+        beginDirect();
+    }
+    Writer::writeBlob(data, size);
 }
 
 void LocalWriter::flush(void) {
@@ -179,7 +1325,9 @@ void LocalWriter::flush(void) {
         os::log("apitrace: ignoring exception while tracing\n");
     } else {
         ++acquired;
-        if (m_file->isOpened()) {
+        if (flightMode) {
+            flightDump();
+        } else if (m_file->isOpened()) {
             os::log("apitrace: flushing trace due to an exception\n");
             m_file->flush();
         }
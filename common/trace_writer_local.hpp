@@ -44,12 +44,16 @@ namespace trace {
     extern const FunctionSig free_sig;
     extern const FunctionSig realloc_sig;
 
+    struct CaptureBuffer;
+
     /**
      * A specialized Writer class, mean to trace the current process.
      *
      * In particular:
      * - it creates a trace file based on the current process name
-     * - uses mutexes to allow tracing from multiple threades
+     * - records from multiple threads without contention: each thread
+     *   composes its call records in a private buffer and only takes
+     *   the mutex for the brief append to the file
      * - flushes the output to ensure the last call is traced in event of
      *   abnormal termination
      */
@@ -61,6 +65,34 @@ namespace trace {
         os::recursive_mutex mutex;
         int acquired;
 
+        /**
+         * Which signatures already have their definition in the file.
+         *
+         * Unlike the inherited vector<bool> maps (which are only
+         * touched with the mutex held), these fixed-size arrays are
+         * safe to read from threads composing records lock-free: a
+         * slot is only flipped to non-zero, with the mutex held, after
+         * the definition bytes have reached the file.  Signatures with
+         * ids beyond the capacity simply always take the locked path.
+         */
+        enum { SIG_CAP = 16384 };
+        volatile int functionDefined[SIG_CAP];
+        volatile int structDefined[SIG_CAP];
+        volatile int enumDefined[SIG_CAP];
+        volatile int bitmaskDefined[SIG_CAP];
+
+        CaptureBuffer *captureBuffer(void);
+        void flushCaptureBuffer(CaptureBuffer *cb);
+        void beginDirect(void);
+
+        /* Flight-recorder mode (see trace_writer_local.cpp). */
+        void flightDirect(void);
+        void flightAppend(CaptureBuffer *cb, char kind, unsigned callNo);
+        void flightDump(void);
+
+        /* Up-front signature table (see registerSignatures below). */
+        void emitSigTable(bool writeRecords);
+
     public:
         /**
          * Should never called directly -- use localWriter singleton below instead.
@@ -76,7 +108,28 @@ namespace trace {
         void beginLeave(unsigned call);
         void endLeave(void);
 
+        void beginStruct(const StructSig *sig);
+        void writeEnum(const EnumSig *sig, signed long long value);
+        void writeBitmask(const BitmaskSig *sig, unsigned long long value);
+
+        /**
+         * Append a run of call-detail bytes already composed by a
+         * ScalarEncoder (see wrappers/trace.hpp).  Must only be called
+         * between beginEnter/endEnter or beginLeave/endLeave.
+         */
+        void writeEncoded(const void *buffer, size_t size);
+
+        /**
+         * Hides (not overrides) Writer::writeBlob, so that discarded
+         * calls (see the frame gating in trace_writer_local.cpp) don't
+         * register blobs for deduplication.
+         */
+        void writeBlob(const void *data, size_t size);
+
         void flush(void);
+
+    protected:
+        void _write(const void *sBuffer, size_t dwBytesToWrite);
     };
 
     /**
@@ -84,6 +137,28 @@ namespace trace {
      */
     extern LocalWriter localWriter;
 
+    /**
+     * Register a table of the generated wrapper's function signatures
+     * (compile-time constants with build-time ids), so the writer can
+     * emit every definition at once right after the trace header
+     * (version 6+), instead of inlining each definition into the first
+     * call that uses it.  That keeps the per-call path a pure id write
+     * and free of first-use stalls.  Must be called before tracing
+     * starts; only writes to zero-initialized statics, so it is safe
+     * from static initializers.
+     */
+    void registerSignatures(const FunctionSig * const *sigs, size_t count);
+
+    /**
+     * Helper to invoke registerSignatures from a static initializer in
+     * generated code.
+     */
+    struct SignatureRegistrar {
+        SignatureRegistrar(const FunctionSig * const *sigs, size_t count) {
+            registerSignatures(sigs, count);
+        }
+    };
+
 } /* namespace trace */
 
 #endif /* _TRACE_WRITER_LOCAL_HPP_ */
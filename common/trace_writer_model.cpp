@@ -24,6 +24,7 @@
  **************************************************************************/
 
 
+#include "trace_file.hpp"
 #include "trace_writer.hpp"
 
 
@@ -129,8 +130,16 @@ public:
 
 
 void Writer::writeCall(Call *call) {
+    if (m_pendingFrameMark) {
+        m_file->markFrameStart(call_no);
+        m_pendingFrameMark = false;
+        m_frameMarked = true;
+    }
     ModelWriter visitor(*this);
     visitor.visit(call);
+    if (call->flags & CALL_FLAG_END_FRAME) {
+        m_pendingFrameMark = true;
+    }
 }
 
 
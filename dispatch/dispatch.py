@@ -59,9 +59,14 @@ class Dispatcher:
         raise NotImplementedError
 
     def dispatchModule(self, module):
+        self.emitProcTableType()
+        self.declareResolvers(module)
+
         for function in module.functions:
             self.dispatchFunction(module, function)
-        
+
+        self.emitResolvers(module)
+
         # define standard name aliases for convenience, but only when not
         # tracing, as that would cause symbol clashing with the tracing
         # functions
@@ -71,6 +76,65 @@ class Dispatcher:
         print '#endif /* RETRACE */'
         print
 
+    def emitProcTableType(self):
+        print '#ifndef _PROC_TABLE_ENTRY_DEFINED_'
+        print '#define _PROC_TABLE_ENTRY_DEFINED_'
+        print 'struct _ProcTableEntry {'
+        print '    const char *name;'
+        print '    void **slot;'
+        print '};'
+        print '#endif /* _PROC_TABLE_ENTRY_DEFINED_ */'
+        print
+
+    def resolverName(self, module, public):
+        if public:
+            return '_resolve%sPublicProcs' % module.name.upper()
+        else:
+            return '_resolve%sPrivateProcs' % module.name.upper()
+
+    def resolverGroups(self, module):
+        # (public, functions, table name) for each non-empty resolution class
+        groups = []
+        for public in (True, False):
+            functions = [function for function in module.functions
+                         if self.isFunctionPublic(module, function) == public]
+            if functions:
+                tag = public and 'Public' or 'Private'
+                groups.append((public, functions,
+                               '_%s%sProcTable' % (module.name.upper(), tag)))
+        return groups
+
+    def declareResolvers(self, module):
+        for public, functions, table in self.resolverGroups(module):
+            print 'static inline void %s(void);' % self.resolverName(module, public)
+        print
+
+    def emitResolvers(self, module):
+        # Resolve whole families of entry points in one pass over a
+        # contiguous name table, instead of letting first-use resolution
+        # dot the initial frames with one symbol lookup per call.
+        for public, functions, table in self.resolverGroups(module):
+            getProcAddressName = self.getProcAddressName(module, functions[0])
+            print 'static const _ProcTableEntry %s[] = {' % table
+            for function in functions:
+                print '    {"%s", (void **)&%s},' % (function.name, function_pointer_value(function))
+            print '};'
+            print
+            print 'static inline void'
+            print '%s(void) {' % self.resolverName(module, public)
+            print '    static bool _resolved = false;'
+            print '    if (_resolved) {'
+            print '        return;'
+            print '    }'
+            print '    _resolved = true;'
+            print '    for (unsigned _i = 0; _i < sizeof %s / sizeof %s[0]; ++_i) {' % (table, table)
+            print '        if (!*%s[_i].slot) {' % table
+            print '            *%s[_i].slot = (void *)%s(%s[_i].name);' % (table, getProcAddressName, table)
+            print '        }'
+            print '    }'
+            print '}'
+            print
+
     def dispatchFunction(self, module, function):
         ptype = function_pointer_type(function)
         pvalue = function_pointer_value(function)
@@ -98,11 +162,10 @@ class Dispatcher:
             return '_getPrivateProcAddress'
 
     def invokeGetProcAddress(self, module, function):
-        ptype = function_pointer_type(function)
         pvalue = function_pointer_value(function)
-        getProcAddressName = self.getProcAddressName(module, function)
+        resolverName = self.resolverName(module, self.isFunctionPublic(module, function))
         print '    if (!%s) {' % (pvalue,)
-        print '        %s = (%s)%s(_name);' % (pvalue, ptype, getProcAddressName)
+        print '        %s();' % (resolverName,)
         print '        if (!%s) {' % (pvalue,)
         self.failFunction(function)
         print '        }'
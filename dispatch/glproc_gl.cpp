@@ -43,12 +43,30 @@ void *_libGlHandle = NULL;
 #endif
 
 
+/*
+ * Resolve the whole core-profile table on the first lookup, so the
+ * first replayed (or traced) frame isn't dotted with one symbol
+ * lookup per entry point.  The flag is set before resolving since
+ * _resolveGLPublicProcs comes right back through here.
+ */
+static inline void
+_primeCoreProfile(void)
+{
+    static bool primed = false;
+    if (!primed) {
+        primed = true;
+        _resolveGLPublicProcs();
+    }
+}
+
 
 #if defined(_WIN32)
 
 void *
 _getPublicProcAddress(const char *procName)
 {
+    _primeCoreProfile();
+
     if (!_libGlHandle) {
         char szDll[MAX_PATH] = {0};
         
@@ -132,6 +150,8 @@ void * _libgl_sym(const char *symbol)
 void *
 _getPublicProcAddress(const char *procName)
 {
+    _primeCoreProfile();
+
     return _libgl_sym(procName);
 }
 
@@ -216,6 +236,8 @@ void * _libgl_sym(const char *symbol)
 void *
 _getPublicProcAddress(const char *procName)
 {
+    _primeCoreProfile();
+
     return _libgl_sym(procName);
 }
 
@@ -1,8 +1,11 @@
+#include <string.h>
+
 #include "apisurface.h"
 #include "thumbnail.h"
 
 #include <QDebug>
 #include <QSysInfo>
+#include <QVector>
 
 ApiSurface::ApiSurface()
 {
@@ -20,8 +23,84 @@ void ApiSurface::setSize(const QSize &size)
 
 void ApiSurface::contentsFromBase64(const QByteArray &base64)
 {
-    QByteArray dataArray = QByteArray::fromBase64(base64);
-    m_image.loadFromData(dataArray, "png");
+    contentsFromRaw(QByteArray::fromBase64(base64));
+}
+
+void ApiSurface::contentsFromRaw(const QByteArray &data)
+{
+    /* Raw sidecar images ("RAW1" header, see
+     * JSONWriter::writeBinaryRawImage) are adopted in place where the
+     * pixel layout allows, instead of round-tripping through the PNG
+     * codec; everything else (base64 state dumps, cached sidecars
+     * from older builds) still decodes as PNG. */
+    const uchar *p = (const uchar *)data.constData();
+    if (data.size() >= 16 && memcmp(p, "RAW1", 4) == 0) {
+        uint width    = p[ 4] | (p[ 5] << 8) | (p[ 6] << 16) | ((uint)p[ 7] << 24);
+        uint height   = p[ 8] | (p[ 9] << 8) | (p[10] << 16) | ((uint)p[11] << 24);
+        uint channels = p[12] | (p[13] << 8) | (p[14] << 16) | ((uint)p[15] << 24);
+
+        if (width && height &&
+            (qint64)width * height * channels + 16 <= data.size()) {
+            m_rawData = data;
+            const uchar *pixels = (const uchar *)m_rawData.constData() + 16;
+
+            switch (channels) {
+            case 3:
+                if ((width * 3) % 4 == 0) {
+                    /* Scanlines are already 32-bit aligned: wrap the
+                     * buffer without copying a single pixel. */
+                    m_image = QImage(pixels, width, height,
+                                     width * 3, QImage::Format_RGB888);
+                } else {
+                    m_image = QImage(width, height, QImage::Format_RGB888);
+                    for (uint y = 0; y < height; ++y) {
+                        memcpy(m_image.scanLine(y), pixels + y * width * 3,
+                               width * 3);
+                    }
+                    m_rawData = QByteArray();
+                }
+                break;
+            case 4: {
+                /* RGBA bytes; QImage has no matching byte order, so a
+                 * single swizzle pass stands in for the codec. */
+                m_image = QImage(width, height, QImage::Format_ARGB32);
+                for (uint y = 0; y < height; ++y) {
+                    const uchar *src = pixels + y * width * 4;
+                    QRgb *dst = (QRgb *)m_image.scanLine(y);
+                    for (uint x = 0; x < width; ++x) {
+                        dst[x] = qRgba(src[0], src[1], src[2], src[3]);
+                        src += 4;
+                    }
+                }
+                m_rawData = QByteArray();
+                break;
+            }
+            case 1: {
+                m_image = QImage(width, height, QImage::Format_Indexed8);
+                QVector<QRgb> grays(256);
+                for (int i = 0; i < 256; ++i) {
+                    grays[i] = qRgb(i, i, i);
+                }
+                m_image.setColorTable(grays);
+                for (uint y = 0; y < height; ++y) {
+                    memcpy(m_image.scanLine(y), pixels + y * width, width);
+                }
+                m_rawData = QByteArray();
+                break;
+            }
+            default:
+                m_image = QImage();
+                m_rawData = QByteArray();
+                break;
+            }
+
+            m_thumb = thumbnail(m_image);
+            return;
+        }
+    }
+
+    m_rawData = QByteArray();
+    m_image.loadFromData(data, "png");
     m_thumb = thumbnail(m_image);
 }
 
@@ -1,6 +1,7 @@
 #ifndef APISURFACE_H
 #define APISURFACE_H
 
+#include <QByteArray>
 #include <QImage>
 #include <QSize>
 #include <QString>
@@ -20,6 +21,7 @@ public:
     void setFormatName(const QString &str);
 
     void contentsFromBase64(const QByteArray &base64);
+    void contentsFromRaw(const QByteArray &data);
 
     QImage image() const;
     QImage thumb() const;
@@ -29,6 +31,9 @@ private:
     int m_numChannels;
     QImage m_image;
     QImage m_thumb;
+    /* Keeps raw sidecar pixels alive while m_image wraps them in
+     * place (see contentsFromRaw). */
+    QByteArray m_rawData;
     int m_depth;
     QString m_formatName;
 };
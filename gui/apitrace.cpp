@@ -7,9 +7,28 @@
 #include <QDir>
 #include <QThread>
 
+/* Default budget for parsed frame contents; the least recently viewed
+ * frames are dropped beyond it.  Override with APITRACE_FRAME_CACHE_MB. */
+enum { DEFAULT_FRAME_CACHE_SIZE = 1024 * 1024 * 1024 };
+
 ApiTrace::ApiTrace()
-    : m_needsSaving(false)
-{
+    : m_needsSaving(false),
+      m_loadedSize(0),
+      m_memoryBudget(DEFAULT_FRAME_CACHE_SIZE),
+      m_warmSize(0)
+{
+    bool ok = false;
+    quint64 budgetMB = qgetenv("APITRACE_FRAME_CACHE_MB").toULongLong(&ok);
+    if (ok && budgetMB) {
+        m_memoryBudget = budgetMB * 1024 * 1024;
+    }
+
+    m_warmBudget = m_memoryBudget / 2;
+    budgetMB = qgetenv("APITRACE_WARM_CACHE_MB").toULongLong(&ok);
+    if (ok && budgetMB) {
+        m_warmBudget = budgetMB * 1024 * 1024;
+    }
+
     m_loader = new TraceLoader();
 
     connect(this, SIGNAL(loadTrace(QString)),
@@ -120,6 +139,13 @@ void ApiTrace::setFileName(const QString &name)
         m_tempFileName = QString();
 
         m_frames.clear();
+        m_loadedFrames.clear();
+        m_loadedSize = 0;
+        foreach (const WarmFrame &warm, m_warmFrames) {
+            qDeleteAll(warm.calls);
+        }
+        m_warmFrames.clear();
+        m_warmSize = 0;
         m_errors.clear();
         m_editedCalls.clear();
         m_queuedErrors.clear();
@@ -237,6 +263,9 @@ void ApiTrace::loadFrame(ApiTraceFrame *frame)
 {
     if (!isFrameLoading(frame)) {
         Q_ASSERT(!frame->isLoaded());
+        if (rehydrateFrame(frame)) {
+            return;
+        }
         m_loadingFrames.insert(frame);
         emit requestFrame(frame);
     }
@@ -273,6 +302,10 @@ void ApiTrace::loaderFrameLoaded(ApiTraceFrame *frame,
         frame->setCalls(calls, binaryDataSize);
         emit endLoadingFrame(frame);
         m_loadingFrames.remove(frame);
+
+        m_loadedFrames.append(frame);
+        m_loadedSize += frame->loadedSize();
+        trimFrameCache(frame);
     }
 
     if (!m_queuedErrors.isEmpty()) {
@@ -487,10 +520,102 @@ bool ApiTrace::isFrameLoading(ApiTraceFrame *frame) const
     return m_loadingFrames.contains(frame);
 }
 
-void ApiTrace::bindThumbnailsToFrames(const QList<QImage> &thumbnails)
+void ApiTrace::markFrameUsed(ApiTraceFrame *frame)
 {
-    QList<ApiTraceFrame *> frames = m_frames;
+    if (!m_loadedFrames.isEmpty() && m_loadedFrames.last() == frame) {
+        return;
+    }
+    int idx = m_loadedFrames.indexOf(frame);
+    if (idx >= 0) {
+        m_loadedFrames.removeAt(idx);
+        m_loadedFrames.append(frame);
+    }
+}
+
+bool ApiTrace::canUnloadFrame(ApiTraceFrame *frame) const
+{
+    if (m_loadingFrames.contains(frame)) {
+        return false;
+    }
 
+    //edited and errored calls are referenced from outside the frame
+    foreach (ApiTraceCall *call, m_editedCalls) {
+        if (call->parentFrame() == frame) {
+            return false;
+        }
+    }
+    foreach (ApiTraceCall *call, m_errors) {
+        if (call->parentFrame() == frame) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ApiTrace::trimFrameCache(ApiTraceFrame *justLoaded)
+{
+    int idx = 0;
+    while (m_loadedSize > m_memoryBudget &&
+           idx < m_loadedFrames.count()) {
+        ApiTraceFrame *frame = m_loadedFrames[idx];
+        if (frame == justLoaded || !canUnloadFrame(frame)) {
+            ++idx;
+            continue;
+        }
+        m_loadedFrames.removeAt(idx);
+        m_loadedSize -= frame->loadedSize();
+
+        /* Demote rather than destroy: the calls stay parsed in the
+         * warm tier and a revisit rehydrates them without going back
+         * to the loader thread. */
+        WarmFrame warm;
+        warm.frame = frame;
+        warm.binaryDataSize = frame->binaryDataSize();
+        warm.size = frame->loadedSize();
+
+        emit beginUnloadingFrame(frame, frame->numChildren());
+        warm.calls = frame->takeCalls();
+        emit endUnloadingFrame(frame);
+
+        m_warmFrames.append(warm);
+        m_warmSize += warm.size;
+    }
+    trimWarmCache();
+}
+
+bool ApiTrace::rehydrateFrame(ApiTraceFrame *frame)
+{
+    for (int i = 0; i < m_warmFrames.count(); ++i) {
+        if (m_warmFrames[i].frame != frame) {
+            continue;
+        }
+        WarmFrame warm = m_warmFrames.takeAt(i);
+        m_warmSize -= warm.size;
+
+        emit beginLoadingFrame(frame, warm.calls.size());
+        frame->setCalls(warm.calls, warm.binaryDataSize);
+        emit endLoadingFrame(frame);
+
+        m_loadedFrames.append(frame);
+        m_loadedSize += frame->loadedSize();
+        trimFrameCache(frame);
+        return true;
+    }
+    return false;
+}
+
+void ApiTrace::trimWarmCache()
+{
+    while (m_warmSize > m_warmBudget && !m_warmFrames.isEmpty()) {
+        WarmFrame warm = m_warmFrames.takeFirst();
+        m_warmSize -= warm.size;
+        qDeleteAll(warm.calls);
+    }
+}
+
+void ApiTrace::bindThumbnailsToFrames(const QList<ApiTraceFrame *> &frames,
+                                      const QList<QImage> &thumbnails)
+{
     QList<QImage>::const_iterator thumbnail = thumbnails.begin();
 
     foreach (ApiTraceFrame *frame, frames) {
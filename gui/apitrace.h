@@ -77,6 +77,10 @@ public:
 
     trace::API api() const;
 
+    /* Move the frame to the most-recently-used end of the frame cache,
+     * protecting it from eviction for a while. */
+    void markFrameUsed(ApiTraceFrame *frame);
+
 public slots:
     void setFileName(const QString &name);
     void save();
@@ -94,7 +98,8 @@ public slots:
     void findCallIndex(int index);
     void setCallError(const ApiTraceError &error);
 
-    void bindThumbnailsToFrames(const QList<QImage> &thumbnails);
+    void bindThumbnailsToFrames(const QList<ApiTraceFrame *> &frames,
+                                const QList<QImage> &thumbnails);
 
 signals:
     void loadTrace(const QString &name);
@@ -115,6 +120,8 @@ signals:
     void endAddingFrames();
     void beginLoadingFrame(ApiTraceFrame *frame, int numAdded);
     void endLoadingFrame(ApiTraceFrame *frame);
+    void beginUnloadingFrame(ApiTraceFrame *frame, int numRemoved);
+    void endUnloadingFrame(ApiTraceFrame *frame);
     void foundFrameStart(ApiTraceFrame *frame);
     void foundFrameEnd(ApiTraceFrame *frame);
     void foundCallIndex(ApiTraceCall *call);
@@ -140,6 +147,10 @@ private slots:
 private:
     int callInFrame(int callIdx) const;
     bool isFrameLoading(ApiTraceFrame *frame) const;
+    bool canUnloadFrame(ApiTraceFrame *frame) const;
+    void trimFrameCache(ApiTraceFrame *justLoaded);
+    bool rehydrateFrame(ApiTraceFrame *frame);
+    void trimWarmCache();
 private:
     QString m_fileName;
     QString m_tempFileName;
@@ -158,6 +169,27 @@ private:
     QSet<ApiTraceCall*> m_errors;
     QList< QPair<ApiTraceFrame*, ApiTraceError> > m_queuedErrors;
     QSet<ApiTraceFrame*> m_loadingFrames;
+
+    /* Loaded frames in least-recently-used order, and the (approximate)
+     * memory their calls pin.  When the total exceeds the budget the
+     * stalest frames are unloaded and reparsed on demand. */
+    QList<ApiTraceFrame*> m_loadedFrames;
+    quint64 m_loadedSize;
+    quint64 m_memoryBudget;
+
+    /* Calls of evicted frames, retained in parsed form under a second
+     * budget.  Analysts tend to revisit the same few frames; serving
+     * those from here skips the reparse entirely.  Oldest entries are
+     * destroyed once the budget overflows. */
+    struct WarmFrame {
+        ApiTraceFrame *frame;
+        QVector<ApiTraceCall*> calls;
+        quint64 binaryDataSize;
+        quint64 size;
+    };
+    QList<WarmFrame> m_warmFrames;
+    quint64 m_warmSize;
+    quint64 m_warmBudget;
 };
 
 #endif
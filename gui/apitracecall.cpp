@@ -6,6 +6,8 @@
 
 #include <QDebug>
 #include <QLocale>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QObject>
 #define QT_USE_FAST_OPERATOR_PLUS
 #include <QStringBuilder>
@@ -186,16 +188,12 @@ void VariantVisitor::visit(trace::String *node)
 
 void VariantVisitor::visit(trace::Enum *e)
 {
-    ApiTraceEnumSignature *sig = 0;
+    ApiTraceEnumSignature *sig;
 
     if (m_loader) {
-        sig = m_loader->enumSignature(e->sig->id);
-    }
-    if (!sig) {
-        sig = new ApiTraceEnumSignature(e->sig);
-        if (m_loader) {
-            m_loader->addEnumSignature(e->sig->id, sig);
-        }
+        sig = m_loader->enumSignature(e->sig);
+    } else {
+        sig = ApiTraceEnumSignature::get(e->sig);
     }
 
     m_variant = QVariant::fromValue(ApiEnum(sig, e->value));
@@ -233,26 +231,48 @@ void VariantVisitor::visit(trace::Repr *repr)
     repr->humanValue->visit(*this);
 }
 
-ApiTraceEnumSignature::ApiTraceEnumSignature(const trace::EnumSig *sig)
+ApiTraceEnumSignature *ApiTraceEnumSignature::get(const trace::EnumSig *sig)
 {
+    /* Keyed by the table's contents rather than its trace-local id,
+     * so every trace naming the same GL enums shares one signature.
+     * The set of distinct tables is small and stable, so entries are
+     * simply kept for the lifetime of the process. */
+    static QHash<QByteArray, ApiTraceEnumSignature*> cache;
+    static QMutex mutex;
+
+    QByteArray key;
     for (const trace::EnumValue *it = sig->values;
          it != sig->values + sig->num_values; ++it) {
-        QPair<QString, signed long long> pair;
+        key.append(it->name, (int)strlen(it->name) + 1);
+        key.append((const char *)&it->value, sizeof it->value);
+    }
 
-        pair.first = QString::fromStdString(it->name);
-        pair.second = it->value;
+    QMutexLocker locker(&mutex);
+    ApiTraceEnumSignature *&entry = cache[key];
+    if (!entry) {
+        entry = new ApiTraceEnumSignature(sig);
+    }
+    return entry;
+}
 
-        m_names.append(pair);
+ApiTraceEnumSignature::ApiTraceEnumSignature(const trace::EnumSig *sig)
+{
+    for (const trace::EnumValue *it = sig->values;
+         it != sig->values + sig->num_values; ++it) {
+        /* Values with several names keep the first one, matching the
+         * order the old list scan would have found them in. */
+        if (!m_names.contains(it->value)) {
+            m_names.insert(it->value, QString::fromStdString(it->name));
+        }
     }
 }
 
 QString ApiTraceEnumSignature::name(signed long long value) const
 {
-    for (ValueList::const_iterator it = m_names.begin();
-         it != m_names.end(); ++it) {
-        if (value == it->second) {
-            return it->first;
-        }
+    QHash<signed long long, QString>::const_iterator it =
+        m_names.find(value);
+    if (it != m_names.end()) {
+        return it.value();
     }
     return QString::fromLatin1("%1").arg(value);
 }
@@ -466,7 +486,24 @@ ApiTraceState::ApiTraceState()
 {
 }
 
-ApiTraceState::ApiTraceState(const QVariantMap &parsedJson)
+/**
+ * Slice one length-prefixed section out of the binary sidecar emitted
+ * by glretrace --dump-state-binary (see retrace/json.cpp).
+ */
+static QByteArray
+sidecarSection(const QByteArray &sidecar, uint offset)
+{
+    if (offset + 4 > (uint)sidecar.size()) {
+        return QByteArray();
+    }
+
+    const uchar *p = (const uchar *)sidecar.constData() + offset;
+    uint size = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+    return sidecar.mid(offset + 4, size);
+}
+
+ApiTraceState::ApiTraceState(const QVariantMap &parsedJson,
+                             const QByteArray &sidecar)
 {
     m_parameters = parsedJson[QLatin1String("parameters")].toMap();
     QVariantMap attachedShaders =
@@ -495,15 +532,19 @@ ApiTraceState::ApiTraceState(const QVariantMap &parsedJson)
         QString formatName =
             image[QLatin1String("__format__")].toString();
 
-        QByteArray dataArray =
-            image[QLatin1String("__data__")].toByteArray();
-
         ApiTexture tex;
         tex.setSize(size);
         tex.setDepth(depth);
         tex.setFormatName(formatName);
         tex.setLabel(itr.key());
-        tex.contentsFromBase64(dataArray);
+
+        QVariant binary = image[QLatin1String("__binary__")];
+        if (binary.isValid()) {
+            tex.contentsFromRaw(sidecarSection(sidecar, binary.toUInt()));
+        } else {
+            tex.contentsFromBase64(
+                image[QLatin1String("__data__")].toByteArray());
+        }
 
         m_textures.append(tex);
     }
@@ -518,15 +559,20 @@ ApiTraceState::ApiTraceState(const QVariantMap &parsedJson)
         int depth = buffer[QLatin1String("__depth__")].toInt();
         QString formatName = buffer[QLatin1String("__format__")].toString();
 
-        QByteArray dataArray =
-            buffer[QLatin1String("__data__")].toByteArray();
-
         ApiFramebuffer fbo;
         fbo.setSize(size);
         fbo.setDepth(depth);
         fbo.setFormatName(formatName);
         fbo.setType(itr.key());
-        fbo.contentsFromBase64(dataArray);
+
+        QVariant binary = buffer[QLatin1String("__binary__")];
+        if (binary.isValid()) {
+            fbo.contentsFromRaw(sidecarSection(sidecar, binary.toUInt()));
+        } else {
+            fbo.contentsFromBase64(
+                buffer[QLatin1String("__data__")].toByteArray());
+        }
+
         m_framebuffers.append(fbo);
     }
 }
@@ -644,13 +690,42 @@ void ApiTraceEvent::setState(ApiTraceState *state)
     m_state = state;
 }
 
+/* Finds a top-level blob argument without building any QVariants. */
+class BlobFinder : public trace::Visitor
+{
+public:
+    BlobFinder() : blob(0) {}
+    virtual void visit(trace::Null *) {}
+    virtual void visit(trace::Bool *) {}
+    virtual void visit(trace::SInt *) {}
+    virtual void visit(trace::UInt *) {}
+    virtual void visit(trace::Float *) {}
+    virtual void visit(trace::Double *) {}
+    virtual void visit(trace::String *) {}
+    virtual void visit(trace::Enum *) {}
+    virtual void visit(trace::Bitmask *) {}
+    virtual void visit(trace::Struct *) {}
+    virtual void visit(trace::Array *) {}
+    virtual void visit(trace::Blob *b) { blob = b; }
+    virtual void visit(trace::Pointer *) {}
+    virtual void visit(trace::Repr *repr) { repr->humanValue->visit(*this); }
+
+    trace::Blob *blob;
+};
+
 ApiTraceCall::ApiTraceCall(ApiTraceFrame *parentFrame,
                            TraceLoader *loader,
-                           const trace::Call *call)
+                           const trace::Call *call,
+                           bool takeOwnership)
     : ApiTraceEvent(ApiTraceEvent::Call),
+      m_loader(loader),
+      m_traceCall(call),
+      m_ownsTraceCall(takeOwnership),
+      m_binaryDataSize(0),
       m_parentFrame(parentFrame)
 {
     m_index = call->no;
+    m_sigId = call->sig->id;
 
     m_signature = loader->signature(call->sig->id);
 
@@ -664,31 +739,60 @@ ApiTraceCall::ApiTraceCall(ApiTraceFrame *parentFrame,
         m_signature = new ApiTraceCallSignature(name, argNames);
         loader->addSignature(call->sig->id, m_signature);
     }
+
+    /* Only the binary-data facts are needed while the frame loads (for
+     * the frame cache accounting); everything else waits for
+     * materializeValues(). */
+    for (int i = 0; i < call->args.size(); ++i) {
+        if (call->args[i].value) {
+            BlobFinder finder;
+            call->args[i].value->visit(finder);
+            if (finder.blob) {
+                m_hasBinaryData = true;
+                m_binaryDataIndex = i;
+                m_binaryDataSize = finder.blob->size;
+            }
+        }
+    }
+    m_flags = call->flags;
+}
+
+ApiTraceCall::~ApiTraceCall()
+{
+    if (m_ownsTraceCall) {
+        delete m_traceCall;
+    }
+}
+
+void ApiTraceCall::materializeValues() const
+{
+    if (!m_traceCall) {
+        return;
+    }
+
+    const trace::Call *call = m_traceCall;
+    m_traceCall = 0;
+
     if (call->ret) {
-        VariantVisitor retVisitor(loader);
+        VariantVisitor retVisitor(m_loader);
         call->ret->visit(retVisitor);
         m_returnValue = retVisitor.variant();
     }
     m_argValues.reserve(call->args.size());
     for (int i = 0; i < call->args.size(); ++i) {
         if (call->args[i].value) {
-            VariantVisitor argVisitor(loader);
+            VariantVisitor argVisitor(m_loader);
             call->args[i].value->visit(argVisitor);
             m_argValues.append(argVisitor.variant());
-            if (m_argValues[i].type() == QVariant::ByteArray) {
-                m_hasBinaryData = true;
-                m_binaryDataIndex = i;
-            }
         } else {
             m_argValues.append(QVariant());
         }
     }
     m_argValues.squeeze();
-    m_flags = call->flags;
-}
 
-ApiTraceCall::~ApiTraceCall()
-{
+    if (m_ownsTraceCall) {
+        delete call;
+    }
 }
 
 
@@ -719,6 +823,7 @@ ApiTrace * ApiTraceCall::parentTrace() const
 
 QVector<QVariant> ApiTraceCall::originalValues() const
 {
+    materializeValues();
     return m_argValues;
 }
 
@@ -777,18 +882,24 @@ int ApiTraceCall::index() const
     return m_index;
 }
 
-QString ApiTraceCall::name() const
+unsigned ApiTraceCall::sigId() const
+{
+    return m_sigId;
+}
+
+const QString & ApiTraceCall::name() const
 {
     return m_signature->name();
 }
 
-QStringList ApiTraceCall::argNames() const
+const QStringList & ApiTraceCall::argNames() const
 {
     return m_signature->argNames();
 }
 
 QVector<QVariant> ApiTraceCall::arguments() const
 {
+    materializeValues();
     if (m_editedValues.isEmpty())
         return m_argValues;
     else
@@ -797,6 +908,7 @@ QVector<QVariant> ApiTraceCall::arguments() const
 
 QVariant ApiTraceCall::returnValue() const
 {
+    materializeValues();
     return m_returnValue;
 }
 
@@ -820,6 +932,11 @@ int ApiTraceCall::binaryDataIndex() const
     return m_binaryDataIndex;
 }
 
+quint64 ApiTraceCall::binaryDataSize() const
+{
+    return m_binaryDataSize;
+}
+
 QStaticText ApiTraceCall::staticText() const
 {
     if (m_staticText && !m_staticText->text().isEmpty())
@@ -830,7 +947,7 @@ QStaticText ApiTraceCall::staticText() const
     QString richText = QString::fromLatin1(
         "<span style=\"font-weight:bold\">%1</span>(").arg(
             m_signature->name());
-    QStringList argNames = m_signature->argNames();
+    const QStringList &argNames = m_signature->argNames();
     for (int i = 0; i < argNames.count(); ++i) {
         richText += QLatin1String("<span style=\"color:#0000ff\">");
         QString argText = apiVariantToString(argValues[i]);
@@ -873,6 +990,13 @@ QStaticText ApiTraceCall::staticText() const
     return *m_staticText;
 }
 
+QString ApiTraceCall::displayText() const
+{
+    /* the plain search text is equivalent and already cached; don't
+     * force a rich text layout just to hand out a string */
+    return searchText();
+}
+
 QString ApiTraceCall::toHtml() const
 {
     if (!m_richText.isEmpty())
@@ -905,7 +1029,7 @@ QString ApiTraceCall::toHtml() const
     }
 
     QVector<QVariant> argValues = arguments();
-    QStringList argNames = m_signature->argNames();
+    const QStringList &argNames = m_signature->argNames();
     for (int i = 0; i < argNames.count(); ++i) {
         m_richText +=
             QLatin1String("<span class=\"arg-name\">") +
@@ -956,7 +1080,7 @@ QString ApiTraceCall::searchText() const
 
     QVector<QVariant> argValues = arguments();
     m_searchText = m_signature->name() + QLatin1Literal("(");
-    QStringList argNames = m_signature->argNames();
+    const QStringList &argNames = m_signature->argNames();
     for (int i = 0; i < argNames.count(); ++i) {
         m_searchText += argNames[i] +
                         QLatin1Literal(" = ") +
@@ -1037,6 +1161,13 @@ QStaticText ApiTraceFrame::staticText() const
     return *m_staticText;
 }
 
+QString ApiTraceFrame::displayText() const
+{
+    return QObject::tr("Frame %1 (%2 calls)")
+            .arg(number)
+            .arg(m_loaded ? m_calls.count() : m_callsToLoad);
+}
+
 int ApiTraceFrame::numChildren() const
 {
     return m_calls.count();
@@ -1070,12 +1201,20 @@ ApiTraceCall * ApiTraceFrame::call(int idx) const
 
 ApiTraceCall * ApiTraceFrame::callWithIndex(int index) const
 {
-    QVector<ApiTraceCall*>::const_iterator itr;
-    for (itr = m_calls.constBegin(); itr != m_calls.constEnd(); ++itr) {
-        if ((*itr)->index() == index) {
-            return *itr;
+    /* the calls are stored in ascending call-number order */
+    int lo = 0;
+    int hi = m_calls.count();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m_calls[mid]->index() < index) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    if (lo < m_calls.count() && m_calls[lo]->index() == index) {
+        return m_calls[lo];
+    }
     return 0;
 }
 
@@ -1108,6 +1247,36 @@ void ApiTraceFrame::setCalls(const QVector<ApiTraceCall*> &calls,
     m_staticText = 0;
 }
 
+void ApiTraceFrame::unloadCalls()
+{
+    Q_ASSERT(m_callsToLoad || m_calls.isEmpty());
+    qDeleteAll(m_calls);
+    m_calls.clear();
+    m_loaded = false;
+    delete m_staticText;
+    m_staticText = 0;
+}
+
+QVector<ApiTraceCall*> ApiTraceFrame::takeCalls()
+{
+    Q_ASSERT(m_callsToLoad || m_calls.isEmpty());
+    QVector<ApiTraceCall*> calls = m_calls;
+    m_calls.clear();
+    m_loaded = false;
+    delete m_staticText;
+    m_staticText = 0;
+    return calls;
+}
+
+quint64 ApiTraceFrame::loadedSize() const
+{
+    /* rough footprint of a parsed call (signature reference, argument
+     * QVariants, cached text) on top of the blobs it carries */
+    enum { CALL_SIZE_ESTIMATE = 512 };
+    return m_binaryDataSize +
+           (quint64)m_calls.count() * CALL_SIZE_ESTIMATE;
+}
+
 bool ApiTraceFrame::isLoaded() const
 {
     return m_loaded;
@@ -3,6 +3,7 @@
 
 #include "apisurface.h"
 
+#include <QHash>
 #include <QStaticText>
 #include <QStringList>
 #include <QUrl>
@@ -55,13 +56,24 @@ struct ApiTraceError
 class ApiTraceEnumSignature
 {
 public:
-    ApiTraceEnumSignature(const trace::EnumSig *sig);
+    /**
+     * Shared signature for the given enum table.  GL enum tables are
+     * identical from trace to trace, so materialized signatures are
+     * cached by content for the lifetime of the process and reused
+     * across traces and sessions instead of being rebuilt for every
+     * loaded file.  The returned object is owned by the cache and
+     * must not be deleted.
+     */
+    static ApiTraceEnumSignature *get(const trace::EnumSig *sig);
 
     QString name(signed long long value) const;
 
 private:
-    typedef QList<QPair<QString, signed long long> > ValueList;
-    ValueList m_names;
+    ApiTraceEnumSignature(const trace::EnumSig *sig);
+
+    /* Hashed for constant-time reverse lookup; rendering resolves an
+     * enum per argument, so a linear scan is felt on frame loads. */
+    QHash<signed long long, QString> m_names;
 };
 
 class ApiEnum
@@ -159,7 +171,8 @@ class ApiTraceFrame;
 class ApiTraceState {
 public:
     ApiTraceState();
-    explicit ApiTraceState(const QVariantMap &parseJson);
+    explicit ApiTraceState(const QVariantMap &parseJson,
+                           const QByteArray &sidecar = QByteArray());
 
     bool isEmpty() const;
     const QVariantMap & parameters() const;
@@ -185,11 +198,11 @@ public:
                           const QStringList &argNames);
     ~ApiTraceCallSignature();
 
-    QString name() const
+    const QString & name() const
     {
         return m_name;
     }
-    QStringList argNames() const
+    const QStringList & argNames() const
     {
         return m_argNames;
     }
@@ -221,6 +234,10 @@ public:
     virtual QStaticText staticText() const = 0;
     virtual int numChildren() const = 0;
 
+    /* Plain-text representation for model roles which don't paint;
+     * cheaper than laying out the rich text of staticText(). */
+    virtual QString displayText() const = 0;
+
     QVariantMap stateParameters() const;
     ApiTraceState *state() const;
     void setState(ApiTraceState *state);
@@ -242,13 +259,17 @@ Q_DECLARE_METATYPE(ApiTraceEvent*);
 class ApiTraceCall : public ApiTraceEvent
 {
 public:
+    /* When takeOwnership is set the call keeps tcall and deletes it
+     * once the argument QVariants have been materialized (or in the
+     * destructor); otherwise tcall must outlive any value access. */
     ApiTraceCall(ApiTraceFrame *parentFrame, TraceLoader *loader,
-                 const trace::Call *tcall);
+                 const trace::Call *tcall, bool takeOwnership);
     ~ApiTraceCall();
 
     int index() const;
-    QString name() const;
-    QStringList argNames() const;
+    unsigned sigId() const;
+    const QString & name() const;
+    const QStringList & argNames() const;
     QVector<QVariant> arguments() const;
     QVariant returnValue() const;
     trace::CallFlags flags() const;
@@ -276,14 +297,26 @@ public:
     QString toHtml() const;
     QString searchText() const;
     QStaticText staticText() const;
+    QString displayText() const;
     int numChildren() const;
     bool hasBinaryData() const;
     int binaryDataIndex() const;
+    quint64 binaryDataSize() const;
 private:
+    /* Build m_argValues/m_returnValue from the retained raw call on
+     * first use; most calls are never scrolled into view and never
+     * pay for the conversion. */
+    void materializeValues() const;
+
     int m_index;
+    unsigned m_sigId;
     ApiTraceCallSignature *m_signature;
-    QVector<QVariant> m_argValues;
-    QVariant m_returnValue;
+    TraceLoader *m_loader;
+    mutable const trace::Call *m_traceCall;
+    bool m_ownsTraceCall;
+    mutable QVector<QVariant> m_argValues;
+    mutable QVariant m_returnValue;
+    quint64 m_binaryDataSize;
     trace::CallFlags m_flags;
     ApiTraceFrame *m_parentFrame;
 
@@ -312,6 +345,7 @@ public:
     int numChildren() const;
     int numChildrenToLoad() const;
     QStaticText staticText() const;
+    QString displayText() const;
 
     int callIndex(ApiTraceCall *call) const;
     ApiTraceCall *call(int idx) const;
@@ -321,6 +355,16 @@ public:
     void setCalls(const QVector<ApiTraceCall*> &calls,
                   quint64 binaryDataSize);
 
+    /* Drop the parsed calls to reclaim memory; the frame reverts to the
+     * unloaded state and its contents can be fetched again on demand. */
+    void unloadCalls();
+
+    /* Release the calls without destroying them, for demotion to the
+     * warm frame tier (see ApiTrace::trimFrameCache); the frame
+     * reverts to the unloaded state. */
+    QVector<ApiTraceCall*> takeCalls();
+    quint64 loadedSize() const;
+
     ApiTraceCall *findNextCall(ApiTraceCall *from,
                                const QString &str,
                                Qt::CaseSensitivity sensitivity) const;
@@ -15,9 +15,10 @@ ApiTraceFilter::ApiTraceFilter(QObject *parent)
 bool ApiTraceFilter::filterAcceptsRow(int sourceRow,
                                       const QModelIndex &sourceParent) const
 {
-    QModelIndex index0 = sourceModel()->index(sourceRow, 0, sourceParent);
-    QVariant varientData = sourceModel()->data(index0, ApiTraceModel::EventRole);
-    ApiTraceEvent *event = varientData.value<ApiTraceEvent*>();
+    //this runs for every row of a freshly loaded frame; fetch the
+    // event directly instead of boxing it in a QVariant per row
+    ApiTraceModel *model = static_cast<ApiTraceModel *>(sourceModel());
+    ApiTraceEvent *event = model->eventAt(sourceRow, sourceParent);
 
     Q_ASSERT(event);
     if (!event)
@@ -29,8 +30,24 @@ bool ApiTraceFilter::filterAcceptsRow(int sourceRow,
     }
 
     ApiTraceCall *call = static_cast<ApiTraceCall*>(event);
-    QString function = call->name();
 
+    unsigned sigId = call->sigId();
+    if (sigId < (unsigned)m_sigVerdicts.count() && m_sigVerdicts[sigId]) {
+        return m_sigVerdicts[sigId] > 0;
+    }
+
+    bool accept = computeAcceptance(call->name());
+
+    if (sigId >= (unsigned)m_sigVerdicts.count()) {
+        m_sigVerdicts.resize(sigId + 1);
+    }
+    m_sigVerdicts[sigId] = accept ? 1 : -1;
+
+    return accept;
+}
+
+bool ApiTraceFilter::computeAcceptance(const QString &function) const
+{
     if (!m_regexp.isEmpty() && m_regexp.isValid()) {
         return function.contains(m_regexp);
     }
@@ -76,6 +93,7 @@ void ApiTraceFilter::setFilterRegexp(const QRegExp &regexp)
 {
     if (regexp != m_regexp) {
         m_regexp = regexp;
+        m_sigVerdicts.clear();
         invalidate();
     }
 }
@@ -89,6 +107,7 @@ void ApiTraceFilter::setFilterOptions(ApiTraceFilter::FilterOptions opts)
 {
     if (opts != m_filters) {
         m_filters = opts;
+        m_sigVerdicts.clear();
         invalidate();
     }
 }
@@ -109,6 +128,7 @@ QRegExp ApiTraceFilter::filterRegexp() const
 void ApiTraceFilter::setCustomFilterRegexp(const QString &str)
 {
     m_customRegexp = QRegExp(str);
+    m_sigVerdicts.clear();
 }
 
 QString ApiTraceFilter::customFilterRegexp() const
@@ -3,6 +3,7 @@
 
 #include <QRegExp>
 #include <QSortFilterProxyModel>
+#include <QVector>
 
 class ApiTraceCall;
 
@@ -35,10 +36,19 @@ public:
 protected:
     bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const;
 
+private:
+    bool computeAcceptance(const QString &function) const;
+
 private:
     QRegExp m_regexp;
     FilterOptions m_filters;
     QRegExp m_customRegexp;
+
+    /* Verdicts per function signature id.  Every filter depends only
+     * on the function name, so each signature is string-matched once
+     * and the per-row work during scrolling and refiltering is an
+     * array lookup (0 = untested, 1 = accept, -1 = reject). */
+    mutable QVector<qint8> m_sigVerdicts;
 };
 
 #endif
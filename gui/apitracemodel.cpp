@@ -36,7 +36,7 @@ QVariant ApiTraceModel::data(const QModelIndex &index, int role) const
 
     switch (role) {
     case Qt::DisplayRole:
-        return itm->staticText().text();
+        return itm->displayText();
     case Qt::DecorationRole:
         return QImage();
     case Qt::ToolTipRole: {
@@ -148,6 +148,9 @@ QModelIndex ApiTraceModel::index(int row, int column,
             return QModelIndex();
         }
         ApiTraceFrame *frame = static_cast<ApiTraceFrame*>(event);
+        //the views index the frames they paint; use that as the frame
+        // cache's recency signal
+        m_trace->markFrameUsed(frame);
         ApiTraceCall *call = frame->call(row);
         if (call)
             return createIndex(row, column, call);
@@ -254,6 +257,10 @@ void ApiTraceModel::setApiTrace(ApiTrace *trace)
             this, SLOT(beginLoadingFrame(ApiTraceFrame*,int)));
     connect(m_trace, SIGNAL(endLoadingFrame(ApiTraceFrame*)),
             this, SLOT(endLoadingFrame(ApiTraceFrame*)));
+    connect(m_trace, SIGNAL(beginUnloadingFrame(ApiTraceFrame*,int)),
+            this, SLOT(beginUnloadingFrame(ApiTraceFrame*,int)));
+    connect(m_trace, SIGNAL(endUnloadingFrame(ApiTraceFrame*)),
+            this, SLOT(endUnloadingFrame(ApiTraceFrame*)));
 
 }
 
@@ -281,6 +288,18 @@ ApiTraceEvent * ApiTraceModel::item(const QModelIndex &index) const
     return static_cast<ApiTraceEvent*>(index.internalPointer());
 }
 
+ApiTraceEvent * ApiTraceModel::eventAt(int row, const QModelIndex &parent) const
+{
+    ApiTraceEvent *parentEvent = item(parent);
+    if (parentEvent) {
+        if (parentEvent->type() != ApiTraceEvent::Frame) {
+            return 0;
+        }
+        return static_cast<ApiTraceFrame*>(parentEvent)->call(row);
+    }
+    return m_trace->frameAt(row);
+}
+
 void ApiTraceModel::stateSetOnEvent(ApiTraceEvent *event)
 {
     if (!event)
@@ -415,4 +434,18 @@ void ApiTraceModel::endLoadingFrame(ApiTraceFrame *frame)
     m_loadingFrames.remove(frame);
 }
 
+void ApiTraceModel::beginUnloadingFrame(ApiTraceFrame *frame, int numRemoved)
+{
+    QModelIndex index = createIndex(frame->number, 0, frame);
+    beginRemoveRows(index, 0, numRemoved - 1);
+}
+
+void ApiTraceModel::endUnloadingFrame(ApiTraceFrame *frame)
+{
+    QModelIndex index = createIndex(frame->number, 0, frame);
+    endRemoveRows();
+
+    emit dataChanged(index, index);
+}
+
 #include "apitracemodel.moc"
@@ -29,6 +29,10 @@ public:
 
     QModelIndex indexForCall(ApiTraceCall *call) const;
 
+    /* Direct row access for the filter proxy, without boxing the event
+     * pointer in a QVariant for every row. */
+    ApiTraceEvent *eventAt(int row, const QModelIndex &parent) const;
+
 public:
     /* QAbstractItemModel { */
     QVariant data(const QModelIndex &index, int role) const;
@@ -59,6 +63,8 @@ private slots:
     void frameChanged(ApiTraceFrame *frame);
     void beginLoadingFrame(ApiTraceFrame *frame, int numAdded);
     void endLoadingFrame(ApiTraceFrame *frame);
+    void beginUnloadingFrame(ApiTraceFrame *frame, int numRemoved);
+    void endUnloadingFrame(ApiTraceFrame *frame);
 
 private:
     ApiTraceEvent *item(const QModelIndex &index) const;
@@ -0,0 +1,109 @@
+#include "artifactcache.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+ArtifactCache::ArtifactCache(const QString &traceFile)
+    : m_traceFile(traceFile),
+      m_dir(traceFile + QLatin1String(".artifacts")),
+      m_valid(false)
+{
+}
+
+QString ArtifactCache::stampContents() const
+{
+    QFileInfo info(m_traceFile);
+    return QString::fromLatin1("%1 %2")
+            .arg(info.size())
+            .arg(info.lastModified().toTime_t());
+}
+
+QString ArtifactCache::fileName(const QString &operation,
+                                qlonglong callNo) const
+{
+    return QString::fromLatin1("%1/%2.%3").arg(m_dir).arg(operation).arg(callNo);
+}
+
+bool ArtifactCache::open()
+{
+    if (m_valid) {
+        return true;
+    }
+
+    if (!QFileInfo(m_traceFile).exists()) {
+        return false;
+    }
+
+    QFile stamp(m_dir + QLatin1String("/stamp"));
+    if (stamp.open(QIODevice::ReadOnly)) {
+        if (QString::fromLatin1(stamp.readAll()) == stampContents()) {
+            m_valid = true;
+            return true;
+        }
+        stamp.close();
+
+        //the trace was rewritten; the cached artifacts are stale
+        QDir dir(m_dir);
+        foreach (const QString &entry, dir.entryList(QDir::Files)) {
+            dir.remove(entry);
+        }
+    }
+
+    QDir().mkpath(m_dir);
+    if (stamp.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        stamp.write(stampContents().toLatin1());
+        m_valid = true;
+    }
+    return m_valid;
+}
+
+QString ArtifactCache::lookup(const QString &operation, qlonglong callNo) const
+{
+    if (!m_valid) {
+        return QString();
+    }
+    QString path = fileName(operation, callNo);
+    if (!QFile::exists(path)) {
+        return QString();
+    }
+    return path;
+}
+
+QByteArray ArtifactCache::loadData(const QString &operation,
+                                   qlonglong callNo) const
+{
+    QString path = lookup(operation, callNo);
+    if (path.isEmpty()) {
+        return QByteArray();
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+void ArtifactCache::saveData(const QString &operation, qlonglong callNo,
+                             const QByteArray &data)
+{
+    if (!m_valid || data.isEmpty()) {
+        return;
+    }
+    QFile file(fileName(operation, callNo));
+    if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        file.write(data);
+    }
+}
+
+void ArtifactCache::saveFile(const QString &operation, qlonglong callNo,
+                             const QString &sourcePath)
+{
+    if (!m_valid || !QFile::exists(sourcePath)) {
+        return;
+    }
+    QString path = fileName(operation, callNo);
+    QFile::remove(path);
+    QFile::copy(sourcePath, path);
+}
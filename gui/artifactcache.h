@@ -0,0 +1,41 @@
+#ifndef ARTIFACTCACHE_H
+#define ARTIFACTCACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+/* Persistent per-trace store of replay artifacts (<trace>.artifacts/).
+ *
+ * State dumps and trimmed traces are produced by replaying the trace
+ * in a subprocess, and the same call tends to be requested repeatedly
+ * within a session.  Entries are keyed by operation and call number
+ * and validated against the trace's size and modification time, like
+ * the thumbnail cache (see thumbnailcache.h).
+ */
+class ArtifactCache
+{
+public:
+    ArtifactCache(const QString &traceFile);
+
+    bool open();
+
+    /* Path of the cached artifact, or an empty string on miss. */
+    QString lookup(const QString &operation, qlonglong callNo) const;
+
+    QByteArray loadData(const QString &operation, qlonglong callNo) const;
+    void saveData(const QString &operation, qlonglong callNo,
+                  const QByteArray &data);
+    void saveFile(const QString &operation, qlonglong callNo,
+                  const QString &sourcePath);
+
+private:
+    QString stampContents() const;
+    QString fileName(const QString &operation, qlonglong callNo) const;
+
+private:
+    QString m_traceFile;
+    QString m_dir;
+    bool m_valid;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "graphing/graphwidget.h"
 #include "trace_profiler.hpp"
+#include "profilelod.h"
 #include "profiling.h"
 
 /**
@@ -88,6 +89,9 @@ public:
         m_profile(profile),
         m_selectionState(NULL)
     {
+        if (m_profile) {
+            m_lod.build(m_profile, m_gpu);
+        }
     }
 
     virtual qint64 size() const
@@ -124,6 +128,35 @@ public:
         }
     }
 
+    /* Consume the largest aligned buckets the range allows, falling
+     * back to single calls at the unaligned edges. */
+    virtual qint64 rangeMax(qint64 begin, qint64 end) const
+    {
+        qint64 longest = 0;
+        qint64 i = begin;
+
+        while (i < end) {
+            int level;
+
+            for (level = ProfileCallLod::LEVELS - 1; level >= 0; --level) {
+                unsigned size = ProfileCallLod::bucketSize(level);
+
+                if (i % size == 0 && i + size <= end) {
+                    longest = qMax(longest, m_lod.bucket(level, i / size).max);
+                    i += size;
+                    break;
+                }
+            }
+
+            if (level < 0) {
+                longest = qMax(longest, value(i));
+                ++i;
+            }
+        }
+
+        return longest;
+    }
+
     virtual void itemDoubleClicked(qint64 index) const
     {
         if (!m_profile) {
@@ -151,7 +184,7 @@ public:
         const trace::Profile::Call& call = m_profile->calls[index];
 
         QString text;
-        text  = QString::fromStdString(call.name);
+        text  = QString::fromStdString(m_profile->names[call.nameId]);
         text += QString("\nCall: %1").arg(call.no);
         text += QString("\nCPU Duration: %1").arg(Profiling::getTimeString(call.cpuDuration));
 
@@ -168,6 +201,7 @@ private:
     bool m_gpu;
     const trace::Profile* m_profile;
     SelectionState* m_selectionState;
+    ProfileCallLod m_lod;
 };
 
 #endif
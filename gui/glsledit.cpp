@@ -39,6 +39,7 @@ public:
 
 class GLSLHighlighter : public QSyntaxHighlighter
 {
+    Q_OBJECT
 public:
     GLSLHighlighter(QTextDocument *parent = 0);
     void setColor(GLSLEdit::ColorComponent component, const QColor &color);
@@ -621,6 +622,33 @@ GLSLEdit::~GLSLEdit()
     delete d_ptr->layout;
 }
 
+QTextDocument *GLSLEdit::createDocument(const QString &text)
+{
+    QTextDocument *doc = new QTextDocument;
+    doc->setDocumentLayout(new GLSLDocLayout(doc));
+    new GLSLHighlighter(doc);
+    doc->setDefaultFont(font());
+    doc->setPlainText(text);
+    return doc;
+}
+
+void GLSLEdit::setShaderDocument(QTextDocument *doc)
+{
+    Q_D(GLSLEdit);
+
+    if (doc == document())
+        return;
+
+    setDocument(doc);
+
+    d->layout = static_cast<GLSLDocLayout*>(doc->documentLayout());
+    d->highlighter = doc->findChild<GLSLHighlighter*>();
+    d->matchPositions.clear();
+    d->errorPositions.clear();
+
+    updateSidebar();
+}
+
 void GLSLEdit::setColor(ColorComponent component, const QColor &color)
 {
     Q_D(GLSLEdit);
@@ -35,6 +35,7 @@
 #include <QScopedPointer>
 
 class GLSLEditPrivate;
+class QTextDocument;
 
 class GLSLEdit: public QPlainTextEdit
 {
@@ -70,6 +71,13 @@ public:
 
     void setColor(ColorComponent component, const QColor &color);
 
+    /* Documents created here carry their own layout and highlighter,
+     * so a caller can cache them fully highlighted and swap them back
+     * in with setShaderDocument() without re-tokenizing the source
+     * (see ShadersSourceWidget).  The caller owns the document. */
+    QTextDocument *createDocument(const QString &text);
+    void setShaderDocument(QTextDocument *doc);
+
     bool isBracketsMatchingEnabled() const;
     bool isCodeFoldingEnabled() const;
     bool isLineNumbersVisible() const;
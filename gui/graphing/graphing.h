@@ -32,6 +32,19 @@ public:
     /* Returns value for index */
     virtual qint64 value(qint64 index) const = 0;
 
+    /* Largest value in [begin, end); providers with a level-of-detail
+     * index (see profilelod.h) override this with bucket lookups. */
+    virtual qint64 rangeMax(qint64 begin, qint64 end) const
+    {
+        qint64 longest = 0;
+
+        for (qint64 i = begin; i < end; ++i) {
+            longest = qMax(longest, value(i));
+        }
+
+        return longest;
+    }
+
     /* Is the item at index selected */
     virtual bool selected(qint64 index) const = 0;
 
@@ -100,13 +100,7 @@ void HistogramView::update()
     m_graphTop = 0;
 
     if (m_data) {
-        for (qint64 i = m_viewLeft; i < m_viewRight; ++i) {
-            qint64 value = m_data->value(i);
-
-            if (value > m_graphTop) {
-                m_graphTop = value;
-            }
-        }
+        m_graphTop = m_data->rangeMax(m_viewLeft, m_viewRight);
     }
 
     GraphView::update();
@@ -144,18 +138,31 @@ void HistogramView::paintEvent(QPaintEvent *)
     double dxdv = width() / (double)(m_viewRight - m_viewLeft);
     bool selection = m_selectionState && m_selectionState->type != SelectionState::None;
 
-    if (dxdv < 1.0) {
-        /* Less than one pixel per item */
+    if (dxdv < 1.0 && !selection) {
+        /* Less than one pixel per item; take the highest value under
+         * each pixel from the provider, which can aggregate whole
+         * buckets instead of visiting every item. */
+        double dvdx = (m_viewRight - m_viewLeft) / (double)width();
+
+        painter.setPen(selectedPen);
+
+        for (int x = 0; x < width(); ++x) {
+            qint64 left = m_viewLeft + (qint64)(x * dvdx);
+            qint64 right = qMin<qint64>(m_viewLeft + (qint64)((x + 1) * dvdx), m_viewRight);
+            qint64 value = m_data->rangeMax(left, qMax(right, left + 1));
+
+            if (value > m_graphBottom) {
+                painter.drawLine(x, height(), x, height() - (value * dydv));
+            }
+        }
+    } else if (dxdv < 1.0) {
+        /* Less than one pixel per item, with a selection to highlight */
         qint64 longestValue = m_graphBottom;
         qint64 longestSelected = m_graphBottom;
         int lastX = 0;
         double x = 0;
 
-        if (selection) {
-            painter.setPen(unselectedPen);
-        } else {
-            painter.setPen(selectedPen);
-        }
+        painter.setPen(unselectedPen);
 
         for (qint64 i = m_viewLeft; i < m_viewRight; ++i) {
             qint64 value = m_data->value(i);
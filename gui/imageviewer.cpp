@@ -38,7 +38,10 @@ ImageViewer::ImageViewer(QWidget *parent)
 
 void ImageViewer::setImage(const QImage &image)
 {
-    m_image = image;
+    /* Deep copy: the surface image may wrap pixel storage owned by
+     * the current state dump (see ApiSurface::contentsFromRaw), and
+     * this viewer can outlive it. */
+    m_image = image.copy();
     m_temp = m_image;
     QPixmap px = QPixmap::fromImage(m_temp);
     imageLabel->setPixmap(px);
@@ -5,6 +5,7 @@
 
 #include "os_string.hpp"
 #include "os_process.hpp"
+#include "trace_profiler.hpp"
 
 #include <QApplication>
 #include <QMetaType>
@@ -17,6 +18,7 @@ Q_DECLARE_METATYPE(Qt::CaseSensitivity);
 Q_DECLARE_METATYPE(ApiTrace::SearchResult);
 Q_DECLARE_METATYPE(ApiTrace::SearchRequest);
 Q_DECLARE_METATYPE(QList<QImage>);
+Q_DECLARE_METATYPE(trace::Profile*);
 
 static void usage(void)
 {
@@ -35,6 +37,7 @@ int main(int argc, char **argv)
     qRegisterMetaType<ApiTrace::SearchResult>();
     qRegisterMetaType<ApiTrace::SearchRequest>();
     qRegisterMetaType<QList<QImage> >();
+    qRegisterMetaType<trace::Profile*>();
 
 #ifndef Q_OS_WIN
     os::String currentProcess = os::getProcessName();
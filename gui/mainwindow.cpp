@@ -17,6 +17,7 @@
 #include "traceprocess.h"
 #include "trimprocess.h"
 #include "thumbnail.h"
+#include "thumbnailcache.h"
 #include "ui_retracerdialog.h"
 #include "ui_profilereplaydialog.h"
 #include "vertexdatainterpreter.h"
@@ -45,6 +46,7 @@ MainWindow::MainWindow()
       m_initalCallNum(-1),
       m_selectedEvent(0),
       m_stateEvent(0),
+      m_trimEvent(0),
       m_nonDefaultsLookupEvent(0)
 {
     m_ui.setupUi(this);
@@ -395,6 +397,59 @@ void MainWindow::lookupState()
 
 void MainWindow::showThumbnails()
 {
+    if (m_trace->fileName().isEmpty()) {
+        return;
+    }
+
+    ThumbnailCache cache(m_trace->fileName());
+    cache.open();
+
+    /* Satisfy as many frames as possible from the on-disk cache, and
+     * only replay the remainder. */
+    QList<ApiTraceFrame*> cachedFrames;
+    QList<QImage> cachedThumbnails;
+    QList<ApiTraceFrame*> missingFrames;
+    bool knowFrameEnds = true;
+
+    foreach (ApiTraceFrame *frame, m_trace->frames()) {
+        if (!frame->thumbnail().isNull()) {
+            continue;
+        }
+        QImage cached = cache.load(frame->number);
+        if (!cached.isNull()) {
+            cachedFrames.append(frame);
+            cachedThumbnails.append(cached);
+        } else {
+            missingFrames.append(frame);
+            if (frame->lastCallIndex() == 0) {
+                knowFrameEnds = false;
+            }
+        }
+    }
+
+    if (!cachedFrames.isEmpty()) {
+        m_ui.callView->setUniformRowHeights(false);
+        m_trace->bindThumbnailsToFrames(cachedFrames, cachedThumbnails);
+    }
+
+    if (missingFrames.isEmpty()) {
+        return;
+    }
+
+    QList<qlonglong> snapshotCalls;
+    if (knowFrameEnds) {
+        /* Snapshot just the last call of each missing frame. */
+        foreach (ApiTraceFrame *frame, missingFrames) {
+            snapshotCalls.append(frame->lastCallIndex());
+        }
+        m_thumbnailFrames = missingFrames;
+    } else {
+        /* The frame boundaries aren't known (e.g. a trace scanned
+         * without an index), so fall back to snapshotting every frame. */
+        m_thumbnailFrames = m_trace->frames();
+    }
+    m_retracer->setSnapshotCalls(snapshotCalls);
+
     replayTrace(false, true);
 }
 
@@ -727,7 +782,7 @@ void MainWindow::initObjects()
     m_retracer = new Retracer(this);
 
     m_vdataInterpreter = new VertexDataInterpreter(this);
-    m_vdataInterpreter->setListWidget(m_ui.vertexDataListWidget);
+    m_vdataInterpreter->setView(m_ui.vertexDataView);
     m_vdataInterpreter->setStride(
         m_ui.vertexStrideSB->value());
     m_vdataInterpreter->setComponents(
@@ -806,6 +861,8 @@ void MainWindow::initConnections()
             this, SLOT(slotFoundFrameEnd(ApiTraceFrame*)));
     connect(m_trace, SIGNAL(foundCallIndex(ApiTraceCall*)),
             this, SLOT(slotJumpToResult(ApiTraceCall*)));
+    connect(m_trace, SIGNAL(endUnloadingFrame(ApiTraceFrame*)),
+            this, SLOT(slotFrameUnloaded(ApiTraceFrame*)));
 
     connect(m_retracer, SIGNAL(finished(const QString&)),
             this, SLOT(replayFinished(const QString&)));
@@ -815,6 +872,8 @@ void MainWindow::initConnections()
             this, SLOT(replayStateFound(ApiTraceState*)));
     connect(m_retracer, SIGNAL(foundProfile(trace::Profile*)),
             this, SLOT(replayProfileFound(trace::Profile*)));
+    connect(m_retracer, SIGNAL(profileUpdated(trace::Profile*)),
+            this, SLOT(replayProfileUpdated(trace::Profile*)));
     connect(m_retracer, SIGNAL(foundThumbnails(const QList<QImage>&)),
             this, SLOT(replayThumbnailsFound(const QList<QImage>&)));
     connect(m_retracer, SIGNAL(retraceErrors(const QList<ApiTraceError>&)),
@@ -973,6 +1032,15 @@ void MainWindow::replayProfileFound(trace::Profile *profile)
     m_profileDialog->setFocus();
 }
 
+void MainWindow::replayProfileUpdated(trace::Profile *profile)
+{
+    /* Partial results of a replay still in progress; show them without
+     * stealing focus from whatever the user is doing. */
+    m_ui.actionShowProfileDialog->setEnabled(true);
+    m_profileDialog->setProfile(profile);
+    m_profileDialog->show();
+}
+
 void MainWindow::replayStateFound(ApiTraceState *state)
 {
     m_stateEvent->setState(state);
@@ -989,7 +1057,15 @@ void MainWindow::replayStateFound(ApiTraceState *state)
 void MainWindow::replayThumbnailsFound(const QList<QImage> &thumbnails)
 {
     m_ui.callView->setUniformRowHeights(false);
-    m_trace->bindThumbnailsToFrames(thumbnails);
+    m_trace->bindThumbnailsToFrames(m_thumbnailFrames, thumbnails);
+
+    ThumbnailCache cache(m_trace->fileName());
+    if (cache.open()) {
+        int count = qMin(m_thumbnailFrames.count(), thumbnails.count());
+        for (int i = 0; i < count; ++i) {
+            cache.save(m_thumbnailFrames[i]->number, thumbnails[i]);
+        }
+    }
 }
 
 void MainWindow::slotGoTo()
@@ -1440,4 +1516,22 @@ void MainWindow::slotJumpToResult(ApiTraceCall *call)
     }
 }
 
+void MainWindow::slotFrameUnloaded(ApiTraceFrame *frame)
+{
+    //the frame's calls are gone; drop any stale pointers to them
+    ApiTraceEvent **events[] = {
+        &m_selectedEvent,
+        &m_stateEvent,
+        &m_trimEvent,
+        &m_nonDefaultsLookupEvent
+    };
+    for (unsigned i = 0; i < sizeof events / sizeof events[0]; ++i) {
+        ApiTraceEvent *event = *events[i];
+        if (event && event->type() == ApiTraceEvent::Call &&
+            static_cast<ApiTraceCall*>(event)->parentFrame() == frame) {
+            *events[i] = 0;
+        }
+    }
+}
+
 #include "mainwindow.moc"
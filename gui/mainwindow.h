@@ -56,6 +56,7 @@ private slots:
     void replayFinished(const QString &message);
     void replayStateFound(ApiTraceState *state);
     void replayProfileFound(trace::Profile *state);
+    void replayProfileUpdated(trace::Profile *state);
     void replayThumbnailsFound(const QList<QImage> &thumbnails);
     void replayError(const QString &msg);
     void startedLoadingTrace();
@@ -94,6 +95,7 @@ private slots:
     void slotFoundFrameStart(ApiTraceFrame *frame);
     void slotFoundFrameEnd(ApiTraceFrame *frame);
     void slotJumpToResult(ApiTraceCall *call);
+    void slotFrameUnloaded(ApiTraceFrame *frame);
 
 private:
     void initObjects();
@@ -137,6 +139,10 @@ private:
 
     Retracer *m_retracer;
 
+    /* Frames the running thumbnail capture will produce snapshots for,
+     * in the order they will arrive on the retracer's pipe. */
+    QList<ApiTraceFrame*> m_thumbnailFrames;
+
     VertexDataInterpreter *m_vdataInterpreter;
 
     JumpWidget *m_jumpWidget;
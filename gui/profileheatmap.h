@@ -2,6 +2,7 @@
 #define PROFILEHEATMAP_H
 
 #include "graphing/heatmapview.h"
+#include "profilelod.h"
 #include "profiling.h"
 
 /**
@@ -10,8 +11,9 @@
 
 class ProfileHeatmapRowIterator : public HeatmapRowIterator {
 public:
-    ProfileHeatmapRowIterator(const trace::Profile* profile, qint64 start, qint64 end, int steps, bool gpu, int program = -1) :
+    ProfileHeatmapRowIterator(const trace::Profile* profile, qint64 start, qint64 end, int steps, bool gpu, int program = -1, const ProfileCallLod* lod = NULL) :
         m_profile(profile),
+        m_lod(lod),
         m_step(-1),
         m_stepWidth(1),
         m_stepCount(steps),
@@ -48,6 +50,59 @@ public:
         /* Iterator through calls until step != lastStep */
         for (; m_index < maxIndex; ++m_index)
         {
+            /* Consume whole buckets from the level-of-detail index for
+             * as long as they fall entirely within the current step,
+             * coarsest buckets first; calls near the step boundaries
+             * take the per-call path below. */
+            if (m_lod) {
+                bool consumed = true;
+
+                while (consumed && m_index < maxIndex) {
+                    consumed = false;
+
+                    for (int level = ProfileCallLod::LEVELS - 1; level >= 0; --level) {
+                        unsigned size = ProfileCallLod::bucketSize(level);
+
+                        if (m_index % size != 0 || m_index + size > maxIndex) {
+                            continue;
+                        }
+
+                        const ProfileCallLod::Bucket& bucket = m_lod->bucket(level, m_index / size);
+
+                        if (bucket.isEmpty() || bucket.end < m_timeStart) {
+                            m_index += size;
+                            consumed = true;
+                            break;
+                        }
+
+                        if (bucket.start > m_timeEnd) {
+                            m_index = maxIndex;
+                            break;
+                        }
+
+                        if (bucket.start >= m_timeStart &&
+                            (int)timeToStep(bucket.start) == m_step &&
+                            (int)timeToStep(bucket.end) == m_step)
+                        {
+                            heatDuration += bucket.sum;
+
+                            if (m_programSelection && m_program == m_programSel) {
+                                programHeatDuration += bucket.sum;
+                                m_selected = true;
+                            }
+
+                            m_index += size;
+                            consumed = true;
+                            break;
+                        }
+                    }
+                }
+
+                if (m_index >= maxIndex) {
+                    break;
+                }
+            }
+
             const trace::Profile::Call* call;
 
             if (m_program == -1) {
@@ -96,7 +151,7 @@ public:
             }
 
             if (rightStep - leftStep > 1) {
-                m_label = QString::fromStdString(call->name);
+                m_label = QString::fromStdString(m_profile->names[call->nameId]);
                 m_step = left;
                 m_stepWidth = rightStep - leftStep;
                 heatDuration = dtds;
@@ -215,6 +270,7 @@ private:
 
 private:
     const trace::Profile* m_profile;
+    const ProfileCallLod* m_lod;
 
     int m_step;
     int m_stepWidth;
@@ -259,6 +315,17 @@ public:
         m_selectionState(NULL)
     {
         sortRows();
+
+        /* Computed once here; every repaint of every row draws from
+         * these instead of rescanning the calls. */
+        m_cpuLod.build(m_profile, false);
+        m_gpuLod.build(m_profile, true);
+
+        m_programLods.resize(m_profile->programs.size());
+
+        for (unsigned i = 0; i < m_programLods.size(); ++i) {
+            m_programLods[i].build(m_profile, true, i);
+        }
     }
 
     virtual qint64 start() const
@@ -296,7 +363,7 @@ public:
 
     virtual HeatmapRowIterator* dataRowIterator(int row, qint64 start, qint64 end, int steps) const
     {
-        ProfileHeatmapRowIterator* itr = new ProfileHeatmapRowIterator(m_profile, start, end, steps, true, m_rowPrograms[row]);
+        ProfileHeatmapRowIterator* itr = new ProfileHeatmapRowIterator(m_profile, start, end, steps, true, m_rowPrograms[row], &m_programLods[m_rowPrograms[row]]);
 
         if (m_selectionState) {
             if (m_selectionState->type == SelectionState::Horizontal) {
@@ -332,7 +399,15 @@ public:
 
     virtual HeatmapRowIterator* headerRowIterator(int row, qint64 start, qint64 end, int steps) const
     {
-        ProfileHeatmapRowIterator* itr = new ProfileHeatmapRowIterator(m_profile, start, end, steps, row != 0);
+        const ProfileCallLod* lod = row == 0 ? &m_cpuLod : &m_gpuLod;
+
+        if (m_selectionState && m_selectionState->type == SelectionState::Vertical) {
+            /* Highlighting one program's share of the header rows
+             * needs the per-call program, so take the raw path. */
+            lod = NULL;
+        }
+
+        ProfileHeatmapRowIterator* itr = new ProfileHeatmapRowIterator(m_profile, start, end, steps, row != 0, -1, lod);
 
         if (m_selectionState) {
             if (m_selectionState->type == SelectionState::Horizontal) {
@@ -414,7 +489,7 @@ public:
         const trace::Profile::Call& call = m_profile->calls[index];
 
         QString text;
-        text  = QString::fromStdString(call.name);
+        text  = QString::fromStdString(m_profile->names[call.nameId]);
 
         text += QString("\nCall: %1").arg(call.no);
         text += QString("\nCPU Start: %1").arg(Profiling::getTimeString(call.cpuStart));
@@ -465,6 +540,10 @@ protected:
     trace::Profile* m_profile;
     std::vector<int> m_rowPrograms;
     SelectionState* m_selectionState;
+
+    ProfileCallLod m_cpuLod;
+    ProfileCallLod m_gpuLod;
+    std::vector<ProfileCallLod> m_programLods;
 };
 
 #endif
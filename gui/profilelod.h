@@ -0,0 +1,118 @@
+#ifndef PROFILELOD_H
+#define PROFILELOD_H
+
+#include "trace_profiler.hpp"
+
+#include <QtGlobal>
+
+#include <vector>
+
+/**
+ * Level-of-detail index over profile call records.
+ *
+ * The graphing widgets walk the call records on every repaint, so
+ * panning a multi-million call profile spends seconds per frame
+ * re-scanning data that maps to a handful of pixels.  This holds
+ * buckets of 10/100/1000 consecutive calls with their summed and
+ * longest durations and the time span they cover, computed once per
+ * profile, so zoomed-out views aggregate whole buckets instead of
+ * every call.
+ */
+class ProfileCallLod
+{
+public:
+    enum {
+        FACTOR = 10,
+        LEVELS = 3
+    };
+
+    struct Bucket {
+        qint64 start;   /* earliest start time in the bucket */
+        qint64 end;     /* latest end time in the bucket */
+        qint64 sum;     /* summed durations */
+        qint64 max;     /* longest single duration */
+
+        Bucket() : start(0), end(-1), sum(0), max(0)
+        {
+        }
+
+        /* No measured calls, e.g. a GPU bucket of non-draw calls. */
+        bool isEmpty() const
+        {
+            return end < start;
+        }
+    };
+
+    /* Calls per bucket: 10 for level 0, 100 for level 1, ... */
+    static unsigned bucketSize(int level)
+    {
+        unsigned size = FACTOR;
+        while (level--) {
+            size *= FACTOR;
+        }
+        return size;
+    }
+
+    /**
+     * Index the given clock of the profile's calls, or of one
+     * program's call list.  GPU times of calls that did not reach the
+     * GPU (pixels < 0) are left out, matching the iteration rules of
+     * the views.
+     */
+    void build(const trace::Profile* profile, bool gpu, int program = -1)
+    {
+        unsigned count = program == -1
+            ? profile->calls.size()
+            : profile->programs[program].calls.size();
+
+        for (int level = 0; level < LEVELS; ++level) {
+            unsigned size = bucketSize(level);
+            m_levels[level].clear();
+            m_levels[level].resize((count + size - 1) / size);
+        }
+
+        for (unsigned i = 0; i < count; ++i) {
+            const trace::Profile::Call& call = program == -1
+                ? profile->calls[i]
+                : profile->calls[profile->programs[program].calls[i]];
+
+            qint64 start, duration;
+
+            if (gpu) {
+                if (call.pixels < 0) {
+                    continue;
+                }
+                start = call.gpuStart;
+                duration = call.gpuDuration;
+            } else {
+                start = call.cpuStart;
+                duration = call.cpuDuration;
+            }
+
+            for (int level = 0; level < LEVELS; ++level) {
+                Bucket& bucket = m_levels[level][i / bucketSize(level)];
+
+                if (bucket.isEmpty()) {
+                    bucket.start = start;
+                    bucket.end = start + duration;
+                } else {
+                    bucket.start = qMin(bucket.start, start);
+                    bucket.end = qMax(bucket.end, start + duration);
+                }
+
+                bucket.sum += duration;
+                bucket.max = qMax(bucket.max, duration);
+            }
+        }
+    }
+
+    const Bucket& bucket(int level, unsigned index) const
+    {
+        return m_levels[level][index];
+    }
+
+private:
+    std::vector<Bucket> m_levels[LEVELS];
+};
+
+#endif
@@ -105,41 +105,57 @@ void ProfileTableModel::updateModel()
         row.longestPixel = NULL;
     }
 
-    for (std::vector<Program>::const_iterator itr = m_profile->programs.begin(); itr != m_profile->programs.end(); ++itr) {
-        ProfileTableRow* row = NULL;
-        const Program& program = *itr;
+    /* One linear pass over the column arrays instead of chasing Call
+     * rows through each program's index list; on multi-million-call
+     * profiles the difference is what makes a selection click feel
+     * instant.  The columns are parallel to m_profile->calls. */
+    const std::vector<int64_t>& cpuStarts = m_profile->callCpuStarts;
+    const std::vector<int64_t>& cpuDurations = m_profile->callCpuDurations;
+    const std::vector<int64_t>& gpuDurations = m_profile->callGpuDurations;
+    const std::vector<int64_t>& pixels = m_profile->callPixels;
+    const std::vector<unsigned>& programs = m_profile->callPrograms;
+
+    /* Row pointers by program id; the QList is searched linearly, so
+     * don't pay that per call. */
+    std::vector<ProfileTableRow*> rowByProgram(m_profile->programs.size(), (ProfileTableRow*)NULL);
+
+    for (size_t i = 0, n = cpuStarts.size(); i < n; ++i) {
+        if (cpuStarts[i] > m_timeMax) {
+            /* Calls are ordered by start time */
+            break;
+        }
 
-        for (std::vector<unsigned>::const_iterator jtr = program.calls.begin(); jtr != program.calls.end(); ++jtr) {
-            const Call& call = m_profile->calls[*jtr];
+        if (pixels[i] < 0) {
+            /* Not a draw call */
+            continue;
+        }
 
-            if (call.cpuStart > m_timeMax) {
-                break;
-            }
+        if (cpuStarts[i] + cpuDurations[i] < m_timeMin) {
+            continue;
+        }
 
-            if (call.cpuStart + call.cpuDuration < m_timeMin) {
-                continue;
-            }
+        ProfileTableRow* row = rowByProgram[programs[i]];
+        if (!row) {
+            row = rowByProgram[programs[i]] = getRow(programs[i]);
+        }
 
-            if (!row) {
-                row = getRow(itr - m_profile->programs.begin());
-            }
+        const Call& call = m_profile->calls[i];
 
-            row->uses++;
-            row->pixels  += call.pixels;
-            row->gpuTime += call.gpuDuration;
-            row->cpuTime += call.cpuDuration;
+        row->uses++;
+        row->pixels  += pixels[i];
+        row->gpuTime += gpuDurations[i];
+        row->cpuTime += cpuDurations[i];
 
-            if (!row->longestGpu || row->longestGpu->gpuDuration < call.gpuDuration) {
-                row->longestGpu = &call;
-            }
+        if (!row->longestGpu || row->longestGpu->gpuDuration < gpuDurations[i]) {
+            row->longestGpu = &call;
+        }
 
-            if (!row->longestCpu || row->longestCpu->cpuDuration < call.cpuDuration) {
-                row->longestCpu = &call;
-            }
+        if (!row->longestCpu || row->longestCpu->cpuDuration < cpuDurations[i]) {
+            row->longestCpu = &call;
+        }
 
-            if (!row->longestPixel || row->longestPixel->pixels < call.pixels) {
-                row->longestPixel = &call;
-            }
+        if (!row->longestPixel || row->longestPixel->pixels < pixels[i]) {
+            row->longestPixel = &call;
         }
     }
 }
@@ -1,19 +1,37 @@
 #include "retracer.h"
 
 #include "apitracecall.h"
+#include "artifactcache.h"
 #include "thumbnail.h"
 
 #include "image/image.hpp"
 
+#include "os_shmem.hpp"
+#include "snapshot_ring.hpp"
 #include "trace_profiler.hpp"
 
+#include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTime>
 #include <QVariant>
 #include <QList>
 #include <QImage>
+#include <QtConcurrentMap>
 
 #include <qjson/parser.h>
 
+/* How many raw snapshots to accumulate before handing them to the
+ * thread pool for downscaling. */
+enum { SCALE_BATCH = 8 };
+
+static QImage
+scaleThumbnail(const QImage &image)
+{
+    return thumbnail(image);
+}
+
 /**
  * Wrapper around a QProcess which enforces IO to block .
  *
@@ -231,6 +249,11 @@ void Retracer::setCaptureThumbnails(bool enable)
     m_captureThumbnails = enable;
 }
 
+void Retracer::setSnapshotCalls(const QList<qlonglong> &calls)
+{
+    m_snapshotCalls = calls;
+}
+
 /**
  * Starting point for the retracing thread.
  *
@@ -240,12 +263,44 @@ void Retracer::run()
 {
     QString msg = QLatin1String("Replay finished!");
 
+    /*
+     * A state dump for a call the user already looked at is served
+     * from the artifact cache without launching a replay.
+     */
+
+    if (m_captureState) {
+        ArtifactCache cache(m_fileName);
+        if (cache.open()) {
+            QByteArray cachedJson =
+                cache.loadData(QLatin1String("state"), m_captureCall);
+            if (!cachedJson.isEmpty()) {
+                bool ok = false;
+                QJson::Parser jsonParser;
+                jsonParser.allowSpecialNumbers(true);
+                QVariantMap cachedState =
+                    jsonParser.parse(cachedJson, &ok).toMap();
+                if (ok) {
+                    QByteArray stateBinary =
+                        cache.loadData(QLatin1String("state-binary"),
+                                       m_captureCall);
+                    ApiTraceState *state =
+                        new ApiTraceState(cachedState, stateBinary);
+                    emit foundState(state);
+                    emit finished(QLatin1String("State fetched."));
+                    return;
+                }
+            }
+        }
+    }
+
     /*
      * Construct command line
      */
 
     QString prog;
     QStringList arguments;
+    QString shmName;
+    QString stateBinaryPath;
 
     switch (m_api) {
     case trace::API_GL:
@@ -274,9 +329,49 @@ void Retracer::run()
     if (m_captureState) {
         arguments << QLatin1String("-D");
         arguments << QString::number(m_captureCall);
+
+        // Dump the image payloads into a sidecar file, so neither side
+        // pays the base64 round trip (see retrace/json.cpp).  Dumps
+        // whose images still arrive as base64 "__data__" members keep
+        // working below.  Skipped under wine, which cannot be handed a
+        // host path.
+        if (prog != QLatin1String("wine")) {
+            static int stateRunNo = 0;
+            stateBinaryPath = QDir::temp().filePath(
+                QString(QLatin1String("qapitrace-%1-state-%2"))
+                .arg(QCoreApplication::applicationPid())
+                .arg(++stateRunNo));
+            arguments << QString(QLatin1String("--dump-state-binary=%1"))
+                .arg(stateBinaryPath);
+        }
     } else if (m_captureThumbnails) {
+        if (!m_snapshotCalls.isEmpty()) {
+            // only snapshot where a thumbnail is actually missing,
+            // instead of at every frame of the trace
+            QStringList calls;
+            foreach (qlonglong callNo, m_snapshotCalls) {
+                calls.append(QString::number(callNo));
+            }
+            arguments << QLatin1String("-S");
+            arguments << calls.join(QLatin1String(","));
+        }
         arguments << QLatin1String("-s"); // emit snapshots
         arguments << QLatin1String("-"); // emit to stdout
+
+        // The snapshots only feed THUMBNAIL_SIZE thumbnails, so have
+        // the retracer downscale them on the GPU before reading them
+        // back, instead of moving full frames over the bus and pipe.
+        arguments << QLatin1String("--snapshot-downsample=4");
+
+        // Pass the bulk pixels through shared memory; stdout then only
+        // carries the per-frame announcement lines.  glretrace falls
+        // back to in-band PNM if it cannot create the region, so both
+        // forms must stay parseable below.
+        static int shmRunNo = 0;
+        shmName = QString(QLatin1String("qapitrace-%1-%2"))
+            .arg(QCoreApplication::applicationPid())
+            .arg(++shmRunNo);
+        arguments << QString(QLatin1String("--snapshot-shm=%1")).arg(shmName);
     } else if (isProfiling()) {
         if (m_profileGpu) {
             arguments << QLatin1String("--pgpu");
@@ -321,6 +416,8 @@ void Retracer::run()
 
     QList<QImage> thumbnails;
     QVariantMap parsedJson;
+    QByteArray jsonOutput;
+    bool jsonOk = false;
     trace::Profile* profile = NULL;
 
     process.setReadChannel(QProcess::StandardOutput);
@@ -336,87 +433,192 @@ void Retracer::run()
              * lookahead character on its own.
              */
 
-            bool ok = false;
             QJson::Parser jsonParser;
 
             // Allow Nan/Infinity
             jsonParser.allowSpecialNumbers(true);
 #if 0
-            parsedJson = jsonParser.parse(&io, &ok).toMap();
+            parsedJson = jsonParser.parse(&io, &jsonOk).toMap();
 #else
             /*
              * XXX: QJSON expects blocking IO, and it looks like
              * BlockingIODevice does not work reliably in all cases.
+             *
+             * The raw bytes are kept around so a successful dump can
+             * be stored in the artifact cache below.
              */
             process.waitForFinished(-1);
-            parsedJson = jsonParser.parse(&process, &ok).toMap();
+            jsonOutput = process.readAllStandardOutput();
+            parsedJson = jsonParser.parse(jsonOutput, &jsonOk).toMap();
 #endif
-            if (!ok) {
+            if (!jsonOk) {
                 msg = QLatin1String("failed to parse JSON");
             }
         } else if (m_captureThumbnails) {
             /*
-             * Parse concatenated PNM images from output.
+             * Parse the snapshot stream: "### shm-frame" announcement
+             * lines referencing the shared-memory ring, or concatenated
+             * in-band PNM images when the ring is unavailable.
              */
 
+            QList<QImage> rawSnapshots;
+
+            os::shared_memory shm;
+            SnapshotRingHeader *ring = NULL;
+
             while (!io.atEnd()) {
                 unsigned channels = 0;
                 unsigned width = 0;
                 unsigned height = 0;
+                QImage snapshot;
 
-                char header[512];
-                qint64 headerSize = 0;
-                int headerLines = 3; // assume no optional comment line
+                char c = 0;
+                if (io.peek(&c, 1) != 1) {
+                    break;
+                }
 
-                for (int headerLine = 0; headerLine < headerLines; ++headerLine) {
-                    qint64 headerRead = io.readLine(&header[headerSize], sizeof(header) - headerSize);
+                if (c == '#') {
+                    /*
+                     * "### shm-frame <slot> <no> <width> <height> <channels>"
+                     */
+                    QList<QByteArray> fields =
+                        io.readLine().simplified().split(' ');
+                    if (fields.size() < 7 ||
+                        fields[1] != QByteArray("shm-frame")) {
+                        continue;
+                    }
 
-                    // if header actually contains optional comment line, ...
-                    if (headerLine == 1 && header[headerSize] == '#') {
-                        ++headerLines;
+                    unsigned slot = fields[2].toUInt();
+                    width = fields[4].toUInt();
+                    height = fields[5].toUInt();
+                    channels = fields[6].toUInt();
+
+                    if (!ring) {
+                        if (!shm.open(shmName.toLocal8Bit().constData())) {
+                            qDebug() << "error: failed to open snapshot ring" << shmName;
+                            break;
+                        }
+                        ring = (SnapshotRingHeader *)shm.map();
+                        if (ring->magic != SNAPSHOT_RING_MAGIC ||
+                            ring->version != SNAPSHOT_RING_VERSION) {
+                            qDebug() << "error: snapshot ring mismatch";
+                            break;
+                        }
                     }
 
-                    headerSize += headerRead;
-                }
+                    snapshot = QImage(width, height, channels == 1 ? QImage::Format_Mono : QImage::Format_RGB888);
 
-                const char *headerEnd = image::readPNMHeader(header, headerSize, &channels, &width, &height);
+                    const unsigned char *src = (const unsigned char *)ring +
+                        snapshotRingSlotOffset(ring, slot);
+                    int rowBytes = channels * width;
+                    for (unsigned y = 0; y < height; ++y) {
+                        memcpy(snapshot.scanLine(y),
+                               src + (size_t)y * rowBytes, rowBytes);
+                    }
 
-                // if invalid PNM header was encountered, ...
-                if (header == headerEnd) {
-                    qDebug() << "error: invalid snapshot stream encountered";
-                    break;
-                }
+                    // the copy is out; let glretrace reuse the slot
+                    ring->tail = ring->tail + 1;
+                } else {
+                    char header[512];
+                    qint64 headerSize = 0;
+                    int headerLines = 3; // assume no optional comment line
+
+                    for (int headerLine = 0; headerLine < headerLines; ++headerLine) {
+                        qint64 headerRead = io.readLine(&header[headerSize], sizeof(header) - headerSize);
+
+                        // if header actually contains optional comment line, ...
+                        if (headerLine == 1 && header[headerSize] == '#') {
+                            ++headerLines;
+                        }
+
+                        headerSize += headerRead;
+                    }
 
-                // qDebug() << "channels: " << channels << ", width: " << width << ", height: " << height";
+                    const char *headerEnd = image::readPNMHeader(header, headerSize, &channels, &width, &height);
 
-                QImage snapshot = QImage(width, height, channels == 1 ? QImage::Format_Mono : QImage::Format_RGB888);
+                    // if invalid PNM header was encountered, ...
+                    if (header == headerEnd) {
+                        qDebug() << "error: invalid snapshot stream encountered";
+                        break;
+                    }
 
-                int rowBytes = channels * width;
-                for (int y = 0; y < height; ++y) {
-                    unsigned char *scanLine = snapshot.scanLine(y);
-                    qint64 readBytes = io.read((char *) scanLine, rowBytes);
-                    Q_ASSERT(readBytes == rowBytes);
-                    (void)readBytes;
+                    // qDebug() << "channels: " << channels << ", width: " << width << ", height: " << height";
+
+                    snapshot = QImage(width, height, channels == 1 ? QImage::Format_Mono : QImage::Format_RGB888);
+
+                    int rowBytes = channels * width;
+                    if (snapshot.bytesPerLine() == rowBytes) {
+                        /* Rows are tightly packed; pull the whole frame out
+                         * of the pipe in one read instead of one per
+                         * scanline. */
+                        qint64 frameBytes = (qint64)rowBytes * height;
+                        qint64 readBytes = io.read((char *) snapshot.bits(), frameBytes);
+                        Q_ASSERT(readBytes == frameBytes);
+                        (void)readBytes;
+                    } else {
+                        for (int y = 0; y < height; ++y) {
+                            unsigned char *scanLine = snapshot.scanLine(y);
+                            qint64 readBytes = io.read((char *) scanLine, rowBytes);
+                            Q_ASSERT(readBytes == rowBytes);
+                            (void)readBytes;
+                        }
+                    }
                 }
 
-                QImage thumb = thumbnail(snapshot);
-                thumbnails.append(thumb);
+                rawSnapshots.append(snapshot);
+
+                // scale batches on the thread pool while glretrace keeps
+                // rendering the next snapshots into the pipe buffer
+                if (rawSnapshots.count() >= SCALE_BATCH) {
+                    thumbnails += QtConcurrent::blockingMapped(rawSnapshots,
+                                                               scaleThumbnail);
+                    rawSnapshots.clear();
+                }
+            }
+
+            if (!rawSnapshots.isEmpty()) {
+                thumbnails += QtConcurrent::blockingMapped(rawSnapshots,
+                                                           scaleThumbnail);
             }
 
             Q_ASSERT(process.state() != QProcess::Running);
         } else if (isProfiling()) {
             profile = new trace::Profile();
 
-            while (!io.atEnd()) {
-                char line[256];
-                qint64 lineLength;
+            /*
+             * Parse fixed-size binary profile records from output.
+             */
 
-                lineLength = io.readLine(line, 256);
+            trace::ProfileParser parser;
+            char record[sizeof(trace::ProfileRecord)];
+            qint64 got = 0;
 
-                if (lineLength == -1)
+            /* Hand partial copies over as frames accumulate, so a long
+             * profiling replay shows data within seconds instead of at
+             * the end.  The copies keep this thread's live vectors out
+             * of the GUI's hands. */
+            QTime sinceUpdate;
+            sinceUpdate.start();
+            size_t updatedFrames = 0;
+
+            while (!io.atEnd()) {
+                qint64 read = io.read(record + got, sizeof record - got);
+
+                if (read <= 0)
                     break;
 
-                trace::Profiler::parseLine(line, profile);
+                got += read;
+                if (got == (qint64)sizeof record) {
+                    parser.parseRecord(record, profile);
+                    got = 0;
+
+                    if (profile->frames.size() > updatedFrames &&
+                        sinceUpdate.elapsed() >= 1000) {
+                        updatedFrames = profile->frames.size();
+                        sinceUpdate.restart();
+                        emit profileUpdated(new trace::Profile(*profile));
+                    }
+                }
             }
         } else {
             QByteArray output;
@@ -470,7 +672,26 @@ void Retracer::run()
      */
 
     if (m_captureState) {
-        ApiTraceState *state = new ApiTraceState(parsedJson);
+        QByteArray stateBinary;
+        if (!stateBinaryPath.isEmpty()) {
+            QFile sidecar(stateBinaryPath);
+            if (sidecar.open(QIODevice::ReadOnly)) {
+                stateBinary = sidecar.readAll();
+            }
+            sidecar.remove();
+        }
+
+        if (jsonOk && process.exitCode() == 0) {
+            ArtifactCache cache(m_fileName);
+            if (cache.open()) {
+                cache.saveData(QLatin1String("state"), m_captureCall,
+                               jsonOutput);
+                cache.saveData(QLatin1String("state-binary"), m_captureCall,
+                               stateBinary);
+            }
+        }
+
+        ApiTraceState *state = new ApiTraceState(parsedJson, stateBinary);
         emit foundState(state);
         msg = QLatin1String("State fetched.");
     }
@@ -43,10 +43,16 @@ public:
     bool captureThumbnails() const;
     void setCaptureThumbnails(bool enable);
 
+    /* Restrict thumbnail capture to snapshots at the given call
+     * numbers (ascending); an empty list snapshots every frame. */
+    void setSnapshotCalls(const QList<qlonglong> &calls);
+
 signals:
     void finished(const QString &output);
     void foundState(ApiTraceState *state);
     void foundProfile(trace::Profile *profile);
+    /* Partial copy of the profile of a replay still in progress. */
+    void profileUpdated(trace::Profile *profile);
     void foundThumbnails(const QList<QImage> &thumbnails);
     void error(const QString &msg);
     void retraceErrors(const QList<ApiTraceError> &errors);
@@ -61,6 +67,7 @@ private:
     bool m_doubleBuffered;
     bool m_captureState;
     bool m_captureThumbnails;
+    QList<qlonglong> m_snapshotCalls;
     qlonglong m_captureCall;
     bool m_profileGpu;
     bool m_profileCpu;
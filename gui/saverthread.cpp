@@ -2,7 +2,7 @@
 
 #include "trace_writer.hpp"
 #include "trace_model.hpp"
-#include "trace_parser.hpp"
+#include "trace_parser_parallel.hpp"
 
 #include <QFile>
 #include <QHash>
@@ -348,8 +348,13 @@ void SaverThread::run()
 
     trace::Writer writer;
     writer.open(m_writeFileName.toLocal8Bit());
+    /* Keep compression and disk I/O off the serialization loop. */
+    writer.setAsyncWrite(true);
 
-    trace::Parser parser;
+    /* Decode on worker threads; calls still arrive in call-number
+     * order, so the edit splice below is unchanged. */
+    int threadCount = QThread::idealThreadCount();
+    trace::ParallelParser parser(threadCount > 1 ? threadCount : 1);
     parser.open(m_readFileName.toLocal8Bit());
 
     trace::Call *call;
@@ -360,12 +365,12 @@ void SaverThread::run()
                 const QVariant &val = values[i];
                 overwriteValue(call, val, i);
             }
-            writer.writeCall(call);
-        } else {
-            writer.writeCall(call);
         }
+        writer.writeCall(call);
+        delete call;
     }
 
+    parser.close();
     writer.close();
 
     emit traceSaved();
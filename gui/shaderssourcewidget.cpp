@@ -3,7 +3,8 @@
 #include "glsledit.h"
 
 ShadersSourceWidget::ShadersSourceWidget(QWidget *parent)
-    : QWidget(parent)
+    : QWidget(parent),
+      m_placeholder(0)
 {
     m_ui.setupUi(this);
     m_edit = new GLSLEdit(this);
@@ -17,14 +18,22 @@ ShadersSourceWidget::ShadersSourceWidget(QWidget *parent)
 
 void ShadersSourceWidget::setShaders(const QMap<QString, QString> &sources)
 {
+    if (sources == m_sources && !m_sources.isEmpty()) {
+        /* same bound shaders; keep the current selection */
+        return;
+    }
+
     m_sources = sources;
 
     m_ui.shadersCB->clear();
-    m_edit->clear();
 
     if (m_sources.isEmpty()) {
         m_ui.shadersCB->setDisabled(true);
-        m_edit->setPlainText(tr("No bound shaders."));
+        if (!m_placeholder) {
+            m_placeholder = m_edit->createDocument(tr("No bound shaders."));
+            m_placeholder->setParent(this);
+        }
+        m_edit->setShaderDocument(m_placeholder);
         m_edit->setDisabled(true);
         return;
     }
@@ -41,7 +50,16 @@ void ShadersSourceWidget::setShaders(const QMap<QString, QString> &sources)
 
 void ShadersSourceWidget::changeShader(const QString &key)
 {
-    m_edit->setPlainText(m_sources.value(key));
+    const QString source = m_sources.value(key);
+
+    QTextDocument *doc = m_documents.value(source);
+    if (!doc) {
+        doc = m_edit->createDocument(source);
+        doc->setParent(this);
+        m_documents.insert(source, doc);
+    }
+
+    m_edit->setShaderDocument(doc);
 }
 
 #include "shaderssourcewidget.moc"
@@ -2,9 +2,11 @@
 #define SHADERSSOURCEWIDGET_H
 
 #include "ui_shaderssourcewidget.h"
+#include <QHash>
 #include <QWidget>
 
 class GLSLEdit;
+class QTextDocument;
 
 class ShadersSourceWidget : public QWidget
 {
@@ -21,6 +23,12 @@ private:
     Ui::ShadersSourceWidget m_ui;
     QMap<QString, QString> m_sources;
     GLSLEdit *m_edit;
+
+    /* Highlighted documents keyed by source text, kept across state
+     * switches; state dumps rebind the same shaders over and over, so
+     * each distinct source is tokenized exactly once. */
+    QHash<QString, QTextDocument*> m_documents;
+    QTextDocument *m_placeholder;
 };
 
 #endif
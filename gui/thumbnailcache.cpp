@@ -0,0 +1,74 @@
+#include "thumbnailcache.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+ThumbnailCache::ThumbnailCache(const QString &traceFile)
+    : m_traceFile(traceFile),
+      m_dir(traceFile + QLatin1String(".thumbs")),
+      m_valid(false)
+{
+}
+
+QString ThumbnailCache::stampContents() const
+{
+    QFileInfo info(m_traceFile);
+    return QString::fromLatin1("%1 %2")
+            .arg(info.size())
+            .arg(info.lastModified().toTime_t());
+}
+
+QString ThumbnailCache::fileName(int frameNo) const
+{
+    return QString::fromLatin1("%1/%2.png").arg(m_dir).arg(frameNo);
+}
+
+bool ThumbnailCache::open()
+{
+    if (m_valid) {
+        return true;
+    }
+
+    if (!QFileInfo(m_traceFile).exists()) {
+        return false;
+    }
+
+    QFile stamp(m_dir + QLatin1String("/stamp"));
+    if (stamp.open(QIODevice::ReadOnly)) {
+        if (QString::fromLatin1(stamp.readAll()) == stampContents()) {
+            m_valid = true;
+            return true;
+        }
+        stamp.close();
+
+        //the trace was rewritten; the cached thumbnails are stale
+        QDir dir(m_dir);
+        foreach (const QString &entry, dir.entryList(QDir::Files)) {
+            dir.remove(entry);
+        }
+    }
+
+    QDir().mkpath(m_dir);
+    if (stamp.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        stamp.write(stampContents().toLatin1());
+        m_valid = true;
+    }
+    return m_valid;
+}
+
+QImage ThumbnailCache::load(int frameNo)
+{
+    if (!m_valid) {
+        return QImage();
+    }
+    return QImage(fileName(frameNo));
+}
+
+void ThumbnailCache::save(int frameNo, const QImage &thumbnail)
+{
+    if (m_valid && !thumbnail.isNull()) {
+        thumbnail.save(fileName(frameNo), "PNG");
+    }
+}
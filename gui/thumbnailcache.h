@@ -0,0 +1,35 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+
+/* Persistent per-trace store of frame thumbnails (<trace>.thumbs/).
+ *
+ * Capturing thumbnails means replaying the whole trace, which for big
+ * traces takes minutes, while the scaled-down results are tiny.  They
+ * are kept next to the trace, validated against the trace's size and
+ * modification time, so reopening a trace repaints its thumbnails
+ * without a replay.
+ */
+class ThumbnailCache
+{
+public:
+    ThumbnailCache(const QString &traceFile);
+
+    bool open();
+
+    QImage load(int frameNo);
+    void save(int frameNo, const QImage &thumbnail);
+
+private:
+    QString stampContents() const;
+    QString fileName(int frameNo) const;
+
+private:
+    QString m_traceFile;
+    QString m_dir;
+    bool m_valid;
+};
+
+#endif
@@ -1,18 +1,29 @@
 #include "traceloader.h"
 
 #include "apitrace.h"
+#include "trace_index.hpp"
+#include <QCoreApplication>
 #include <QDebug>
 #include <QFile>
 
 #define FRAMES_TO_CACHE 100
 
+/* Spacing of the intra-frame reposition points recorded by
+ * frameCheckpoints().  Smaller values make backward steps cheaper but
+ * the recording scan longer. */
+#define CALLS_PER_CHECKPOINT 1000
+
+/* With takeOwnership the returned ApiTraceCall keeps the raw call and
+ * converts its values to QVariants only when first displayed. */
 static ApiTraceCall *
 apiCallFromTraceCall(const trace::Call *call,
                      const QHash<QString, QUrl> &helpHash,
                      ApiTraceFrame *frame,
-                     TraceLoader *loader)
+                     TraceLoader *loader,
+                     bool takeOwnership)
 {
-    ApiTraceCall *apiCall = new ApiTraceCall(frame, loader, call);
+    ApiTraceCall *apiCall = new ApiTraceCall(frame, loader, call,
+                                             takeOwnership);
 
     apiCall->setHelpUrl(helpHash.value(apiCall->name()));
 
@@ -20,7 +31,9 @@ apiCallFromTraceCall(const trace::Call *call,
 }
 
 TraceLoader::TraceLoader(QObject *parent)
-    : QObject(parent)
+    : QObject(parent),
+      m_scannedFrames(0),
+      m_scanning(false)
 {
 }
 
@@ -28,40 +41,66 @@ TraceLoader::~TraceLoader()
 {
     m_parser.close();
     qDeleteAll(m_signatures);
-    qDeleteAll(m_enumSignatures);
+    /* enum signatures belong to the shared cache */
 }
 
 void TraceLoader::loadTrace(const QString &filename)
 {
+    if (m_scanning) {
+        /* Re-entered through the processEvents() call in scanTrace();
+         * remember the file and let the running scan wind down first. */
+        m_queuedFile = filename;
+        return;
+    }
+
     if (m_helpHash.isEmpty()) {
         loadHelpFile();
     }
 
-    if (!m_frameBookmarks.isEmpty()) {
-        qDeleteAll(m_signatures);
-        qDeleteAll(m_enumSignatures);
-        m_signatures.clear();
-        m_enumSignatures.clear();
-        m_frameBookmarks.clear();
-        m_createdFrames.clear();
-        m_parser.close();
-    }
+    m_queuedFile = filename;
+
+    while (!m_queuedFile.isEmpty()) {
+        QString fileName = m_queuedFile;
+        m_queuedFile.clear();
+
+        if (!m_frameBookmarks.isEmpty()) {
+            qDeleteAll(m_signatures);
+            m_signatures.clear();
+            m_enumSignatures.clear();
+            m_frameBookmarks.clear();
+            m_createdFrames.clear();
+            m_frameFunctions.clear();
+            m_functionNames.clear();
+            m_scannedFrames = 0;
+            m_parser.close();
+        }
 
-    if (!m_parser.open(filename.toLatin1())) {
-        qDebug() << "error: failed to open " << filename;
-        return;
-    }
+        if (!m_parser.open(fileName.toLatin1())) {
+            qDebug() << "error: failed to open " << fileName;
+            return;
+        }
 
-    emit startedParsing();
+        m_fileName = fileName;
 
-    if (m_parser.supportsOffsets()) {
-        scanTrace();
-    } else {
-        //Load the entire file into memory
-        parseTrace();
+        emit startedParsing();
+
+        m_scanning = true;
+        if (m_parser.supportsOffsets()) {
+            scanTrace();
+        } else {
+            //Load the entire file into memory
+            parseTrace();
+        }
+        m_scanning = false;
+
+        if (!m_queuedFile.isEmpty()) {
+            /* The scan was abandoned for a newer open request. */
+            continue;
+        }
+
+        emit guessedApi(static_cast<int>(m_parser.api));
+        emit finishedParsing();
     }
-    emit guessedApi(static_cast<int>(m_parser.api));
-    emit finishedParsing();
 }
 
 void TraceLoader::loadFrame(ApiTraceFrame *currentFrame)
@@ -108,16 +147,90 @@ void TraceLoader::scanTrace()
     QList<ApiTraceFrame*> frames;
     ApiTraceFrame *currentFrame = 0;
 
+    // A frame index recorded in the container at capture time makes
+    // even the first open of a fresh trace instant -- no sidecar and
+    // no full scan needed.
+    trace::File::FrameIndex frameIndex;
+    if (m_parser.getFrameIndex(frameIndex) && frameIndex.size() >= 2) {
+        for (size_t i = 0; i + 1 < frameIndex.size(); ++i) {
+            trace::ParseBookmark start;
+            start.offset = frameIndex[i].start;
+            start.next_call_no = frameIndex[i].firstCallNo;
+
+            FrameBookmark frameBookmark(start);
+            frameBookmark.numberOfCalls = frameIndex[i + 1].firstCallNo -
+                                          frameIndex[i].firstCallNo;
+
+            currentFrame = new ApiTraceFrame();
+            currentFrame->number = i;
+            currentFrame->setNumChildren(frameBookmark.numberOfCalls);
+            currentFrame->setLastCallIndex(frameIndex[i + 1].firstCallNo - 1);
+            frames.append(currentFrame);
+
+            m_createdFrames.append(currentFrame);
+            m_frameBookmarks[(int)i] = frameBookmark;
+        }
+
+        // As with the sidecar path below, signature definitions are
+        // scanned in on demand before the first seek.
+        m_scannedFrames = 0;
+        m_parser.getBookmark(m_scanPos);
+        m_frameFunctions.resize(frames.count());
+
+        emit parsed(100);
+        emit framesLoaded(frames);
+        return;
+    }
+
+    // A sidecar index left behind by an earlier session (by us or by
+    // trace::Loader) makes reopening the trace instant.
+    std::vector<trace::IndexedFrame> indexedFrames;
+    if (trace::readFrameIndex(m_fileName.toLatin1().constData(),
+                              0 /* end-of-frame marker */,
+                              indexedFrames)) {
+        for (size_t i = 0; i < indexedFrames.size(); ++i) {
+            const trace::IndexedFrame &indexed = indexedFrames[i];
+            FrameBookmark frameBookmark(indexed.start);
+            frameBookmark.numberOfCalls = indexed.numberOfCalls;
+
+            currentFrame = new ApiTraceFrame();
+            currentFrame->number = i;
+            currentFrame->setNumChildren(indexed.numberOfCalls);
+            if (indexed.complete) {
+                currentFrame->setLastCallIndex(indexed.lastCallNo);
+            }
+            frames.append(currentFrame);
+
+            m_createdFrames.append(currentFrame);
+            m_frameBookmarks[(int)i] = frameBookmark;
+        }
+
+        // The parser has not seen the signature definitions yet; they
+        // are scanned in on demand before the first seek.  The frames
+        // get their function index filled in the same way.
+        m_scannedFrames = 0;
+        m_parser.getBookmark(m_scanPos);
+        m_frameFunctions.resize(frames.count());
+
+        emit parsed(100);
+        emit framesLoaded(frames);
+        return;
+    }
+
     trace::Call *call;
     trace::ParseBookmark startBookmark;
+    QSet<unsigned> frameFunctions;
     int numOfFrames = 0;
     int numOfCalls = 0;
+    unsigned lastCallNo = 0;
     int lastPercentReport = 0;
 
     m_parser.getBookmark(startBookmark);
 
     while ((call = m_parser.scan_call())) {
         ++numOfCalls;
+        lastCallNo = call->no;
+        recordFunction(frameFunctions, call);
 
         if (call->flags & trace::CALL_FLAG_END_FRAME) {
             FrameBookmark frameBookmark(startBookmark);
@@ -129,8 +242,17 @@ void TraceLoader::scanTrace()
             currentFrame->setLastCallIndex(call->no);
             frames.append(currentFrame);
 
+            trace::IndexedFrame indexedFrame;
+            indexedFrame.start = startBookmark;
+            indexedFrame.numberOfCalls = numOfCalls;
+            indexedFrame.lastCallNo = call->no;
+            indexedFrame.complete = true;
+            indexedFrames.push_back(indexedFrame);
+
             m_createdFrames.append(currentFrame);
             m_frameBookmarks[numOfFrames] = frameBookmark;
+            m_frameFunctions.append(frameFunctions);
+            frameFunctions.clear();
             ++numOfFrames;
 
             if (m_parser.percentRead() - lastPercentReport >= 5) {
@@ -139,6 +261,30 @@ void TraceLoader::scanTrace()
             }
             m_parser.getBookmark(startBookmark);
             numOfCalls = 0;
+
+            if (frames.count() >= FRAMES_TO_CACHE) {
+                /* Everything behind this point has been scanned, so
+                 * these frames can be requested right away. */
+                m_scannedFrames = numOfFrames;
+                m_scanPos = startBookmark;
+
+                emit framesLoaded(frames);
+                frames.clear();
+
+                /* Let queued requests (the viewport's frame contents,
+                 * searches, ...) jump ahead of the rest of the scan.
+                 * They seek the parser, so reposition afterwards. */
+                QCoreApplication::processEvents();
+
+                if (!m_queuedFile.isEmpty()) {
+                    /* Another trace was opened meanwhile; the scan and
+                     * its index are abandoned. */
+                    delete call;
+                    return;
+                }
+
+                m_parser.setBookmark(startBookmark);
+            }
         }
         delete call;
     }
@@ -153,14 +299,138 @@ void TraceLoader::scanTrace()
         currentFrame->setNumChildren(numOfCalls);
         frames.append(currentFrame);
 
+        trace::IndexedFrame indexedFrame;
+        indexedFrame.start = startBookmark;
+        indexedFrame.numberOfCalls = numOfCalls;
+        indexedFrame.lastCallNo = lastCallNo;
+        indexedFrame.complete = false;
+        indexedFrames.push_back(indexedFrame);
+
         m_createdFrames.append(currentFrame);
         m_frameBookmarks[numOfFrames] = frameBookmark;
+        m_frameFunctions.append(frameFunctions);
         ++numOfFrames;
     }
 
+    trace::writeFrameIndex(m_fileName.toLatin1().constData(),
+                           0 /* end-of-frame marker */,
+                           indexedFrames);
+
+    // the full scan has registered every signature definition
+    m_scannedFrames = numOfFrames;
+    m_parser.getBookmark(m_scanPos);
+
     emit parsed(100);
 
-    emit framesLoaded(frames);
+    if (!frames.isEmpty()) {
+        emit framesLoaded(frames);
+    }
+}
+
+
+void TraceLoader::ensureScannedUpTo(int frameIdx)
+{
+    if (m_scannedFrames >= frameIdx) {
+        return;
+    }
+
+    m_parser.setBookmark(m_scanPos);
+    for (int idx = m_scannedFrames; idx < frameIdx; ++idx) {
+        int numOfCalls = m_frameBookmarks[idx].numberOfCalls;
+        QSet<unsigned> frameFunctions;
+        trace::Call *call;
+        while (numOfCalls > 0 && (call = m_parser.scan_call())) {
+            --numOfCalls;
+            recordFunction(frameFunctions, call);
+            delete call;
+        }
+        indexFrameFunctions(idx, frameFunctions);
+    }
+    m_parser.getBookmark(m_scanPos);
+    m_scannedFrames = frameIdx;
+}
+
+/* Reposition points inside a frame, recorded on first use, so a
+ * backward step or search parses at most CALLS_PER_CHECKPOINT calls
+ * instead of the whole frame.  Recording is a signature-only scan,
+ * much cheaper than materializing the calls; the bookmarks themselves
+ * are a couple of words each, so they are kept for the lifetime of the
+ * trace. */
+const QVector<trace::ParseBookmark> &
+TraceLoader::frameCheckpoints(int frameIdx)
+{
+    FrameBookmark &frameBookmark = m_frameBookmarks[frameIdx];
+    if (frameBookmark.checkpoints.isEmpty()) {
+        ensureScannedUpTo(frameIdx);
+        frameBookmark.checkpoints.append(frameBookmark.start);
+        m_parser.setBookmark(frameBookmark.start);
+
+        int numOfCalls = frameBookmark.numberOfCalls;
+        int scanned = 0;
+        trace::Call *call;
+        while (scanned < numOfCalls && (call = m_parser.scan_call())) {
+            ++scanned;
+            delete call;
+            if (scanned % CALLS_PER_CHECKPOINT == 0 && scanned < numOfCalls) {
+                trace::ParseBookmark checkpoint;
+                m_parser.getBookmark(checkpoint);
+                frameBookmark.checkpoints.append(checkpoint);
+            }
+        }
+    }
+    return frameBookmark.checkpoints;
+}
+
+void TraceLoader::recordFunction(QSet<unsigned> &functions,
+                                 const trace::Call *call)
+{
+    unsigned sigId = call->sig->id;
+    functions.insert(sigId);
+    if (!m_functionNames.contains(sigId)) {
+        m_functionNames.insert(sigId, QString::fromLatin1(call->name()));
+    }
+}
+
+void TraceLoader::indexFrameFunctions(int frameIdx,
+                                      const QSet<unsigned> &functions)
+{
+    if (frameIdx >= m_frameFunctions.count()) {
+        m_frameFunctions.resize(frameIdx + 1);
+    }
+    m_frameFunctions[frameIdx] = functions;
+}
+
+QSet<unsigned>
+TraceLoader::functionsMatching(const QString &str,
+                               Qt::CaseSensitivity sensitivity) const
+{
+    QSet<unsigned> matching;
+    QHash<unsigned, QString>::const_iterator itr;
+    for (itr = m_functionNames.constBegin();
+         itr != m_functionNames.constEnd(); ++itr) {
+        if (itr.value().contains(str, sensitivity)) {
+            matching.insert(itr.key());
+        }
+    }
+    return matching;
+}
+
+bool TraceLoader::frameCanMatch(int frameIdx,
+                                const QSet<unsigned> &matchingFunctions) const
+{
+    const QSet<unsigned> frameFunctions = m_frameFunctions.value(frameIdx);
+    if (frameFunctions.isEmpty()) {
+        //not indexed yet; it has to be searched
+        return true;
+    }
+    QSet<unsigned>::const_iterator itr;
+    for (itr = matchingFunctions.constBegin();
+         itr != matchingFunctions.constEnd(); ++itr) {
+        if (frameFunctions.contains(*itr)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void TraceLoader::parseTrace()
@@ -182,13 +452,10 @@ void TraceLoader::parseTrace()
             ++frameCount;
         }
         ApiTraceCall *apiCall =
-                apiCallFromTraceCall(call, m_helpHash, currentFrame, this);
+                apiCallFromTraceCall(call, m_helpHash, currentFrame, this,
+                                     true);
         calls.append(apiCall);
-        if (apiCall->hasBinaryData()) {
-            QByteArray data =
-                    apiCall->arguments()[apiCall->binaryDataIndex()].toByteArray();
-            binaryDataSize += data.size();
-        }
+        binaryDataSize += apiCall->binaryDataSize();
         if (call->flags & trace::CALL_FLAG_END_FRAME) {
             calls.squeeze();
             currentFrame->setCalls(calls, binaryDataSize);
@@ -205,7 +472,7 @@ void TraceLoader::parseTrace()
                 lastPercentReport = m_parser.percentRead();
             }
         }
-        delete call;
+        /* the ApiTraceCall owns the raw call now */
         call = m_parser.parse_call();
     }
 
@@ -239,19 +506,23 @@ void TraceLoader::addSignature(unsigned id, ApiTraceCallSignature *signature)
     m_signatures[id] = signature;
 }
 
-ApiTraceEnumSignature * TraceLoader::enumSignature(unsigned id)
+ApiTraceEnumSignature * TraceLoader::enumSignature(const trace::EnumSig *enumSig)
 {
-    if (id >= m_enumSignatures.count()) {
-        m_enumSignatures.resize(id + 1);
-        return NULL;
-    } else {
-        return m_enumSignatures[id];
+    QMutexLocker locker(&m_enumSignatureMutex);
+
+    if (enumSig->id >= (unsigned)m_enumSignatures.count()) {
+        m_enumSignatures.resize(enumSig->id + 1);
     }
-}
 
-void TraceLoader::addEnumSignature(unsigned id, ApiTraceEnumSignature *signature)
-{
-    m_enumSignatures[id] = signature;
+    /* The id-indexed vector is only a per-trace front for the
+     * process-wide content-keyed cache, which the signatures are
+     * owned by (see ApiTraceEnumSignature::get). */
+    ApiTraceEnumSignature *signature = m_enumSignatures[enumSig->id];
+    if (!signature) {
+        signature = ApiTraceEnumSignature::get(enumSig);
+        m_enumSignatures[enumSig->id] = signature;
+    }
+    return signature;
 }
 
 void TraceLoader::searchNext(const ApiTrace::SearchRequest &request)
@@ -259,28 +530,49 @@ void TraceLoader::searchNext(const ApiTrace::SearchRequest &request)
     Q_ASSERT(m_parser.supportsOffsets());
     if (m_parser.supportsOffsets()) {
         int startFrame = m_createdFrames.indexOf(request.frame);
-        const FrameBookmark &frameBookmark = m_frameBookmarks[startFrame];
-        m_parser.setBookmark(frameBookmark.start);
-        trace::Call *call = 0;
-        while ((call = m_parser.parse_call())) {
-
-            if (callContains(call, request.text, request.cs)) {
-                unsigned frameIdx = callInFrame(call->no);
-                ApiTraceFrame *frame = m_createdFrames[frameIdx];
-                const QVector<ApiTraceCall*> calls =
-                        fetchFrameContents(frame);
-                for (int i = 0; i < calls.count(); ++i) {
-                    if (calls[i]->index() == call->no) {
-                        emit searchResult(request, ApiTrace::SearchResult_Found,
-                                          calls[i]);
-                        break;
+
+        /* A string occurring in a function name is looked up through
+         * the per-frame function index, so frames which cannot contain
+         * a match are skipped without being read at all.  Strings not
+         * matching any function name can only occur in arguments,
+         * which are not indexed, and search every frame. */
+        QSet<unsigned> matchingFunctions =
+                functionsMatching(request.text, request.cs);
+        bool functionQuery = !matchingFunctions.isEmpty();
+
+        for (int frameIdx = startFrame;
+             frameIdx < m_createdFrames.count(); ++frameIdx) {
+            if (functionQuery &&
+                !frameCanMatch(frameIdx, matchingFunctions)) {
+                continue;
+            }
+            ensureScannedUpTo(frameIdx);
+            const FrameBookmark &frameBookmark = m_frameBookmarks[frameIdx];
+            int numCallsToParse = frameBookmark.numberOfCalls;
+            m_parser.setBookmark(frameBookmark.start);
+
+            trace::Call *call = 0;
+            while (numCallsToParse > 0 && (call = m_parser.parse_call())) {
+                --numCallsToParse;
+
+                if (callContains(call, request.text, request.cs)) {
+                    ApiTraceFrame *frame = m_createdFrames[frameIdx];
+                    const QVector<ApiTraceCall*> calls =
+                            fetchFrameContents(frame);
+                    for (int i = 0; i < calls.count(); ++i) {
+                        if (calls[i]->index() == call->no) {
+                            emit searchResult(request,
+                                              ApiTrace::SearchResult_Found,
+                                              calls[i]);
+                            break;
+                        }
                     }
+                    delete call;
+                    return;
                 }
+
                 delete call;
-                return;
             }
-
-            delete call;
         }
     }
     emit searchResult(request, ApiTrace::SearchResult_NotFound, 0);
@@ -291,38 +583,46 @@ void TraceLoader::searchPrev(const ApiTrace::SearchRequest &request)
     Q_ASSERT(m_parser.supportsOffsets());
     if (m_parser.supportsOffsets()) {
         int startFrame = m_createdFrames.indexOf(request.frame);
-        trace::Call *call = 0;
-        QList<trace::Call*> frameCalls;
-        int frameIdx = startFrame;
 
-        const FrameBookmark &frameBookmark = m_frameBookmarks[frameIdx];
-        int numCallsToParse = frameBookmark.numberOfCalls;
-        m_parser.setBookmark(frameBookmark.start);
+        QSet<unsigned> matchingFunctions =
+                functionsMatching(request.text, request.cs);
+        bool functionQuery = !matchingFunctions.isEmpty();
 
-        while ((call = m_parser.parse_call())) {
+        for (int frameIdx = startFrame; frameIdx >= 0; --frameIdx) {
+            if (functionQuery &&
+                !frameCanMatch(frameIdx, matchingFunctions)) {
+                continue;
+            }
+            const QVector<trace::ParseBookmark> &checkpoints =
+                    frameCheckpoints(frameIdx);
+            const FrameBookmark &frameBookmark = m_frameBookmarks[frameIdx];
 
-            frameCalls.append(call);
-            --numCallsToParse;
+            /* Walk the frame in checkpoint-sized windows from the
+             * back, so only a window's worth of calls is ever live. */
+            for (int window = checkpoints.count() - 1; window >= 0;
+                 --window) {
+                int numCallsToParse = frameBookmark.numberOfCalls -
+                                      window * CALLS_PER_CHECKPOINT;
+                if (window + 1 < checkpoints.count()) {
+                    numCallsToParse = CALLS_PER_CHECKPOINT;
+                }
+                m_parser.setBookmark(checkpoints[window]);
+
+                QList<trace::Call*> windowCalls;
+                trace::Call *call = 0;
+                while (numCallsToParse > 0 &&
+                       (call = m_parser.parse_call())) {
+                    windowCalls.append(call);
+                    --numCallsToParse;
+                }
 
-            if (numCallsToParse == 0) {
-                bool foundCall = searchCallsBackwards(frameCalls,
+                bool foundCall = searchCallsBackwards(windowCalls,
                                                       frameIdx,
                                                       request);
-
-                qDeleteAll(frameCalls);
-                frameCalls.clear();
+                qDeleteAll(windowCalls);
                 if (foundCall) {
                     return;
                 }
-
-                --frameIdx;
-
-                if (frameIdx >= 0) {
-                    const FrameBookmark &frameBookmark =
-                            m_frameBookmarks[frameIdx];
-                    m_parser.setBookmark(frameBookmark.start);
-                    numCallsToParse = frameBookmark.numberOfCalls;
-                }
             }
         }
     }
@@ -370,18 +670,124 @@ int TraceLoader::callInFrame(int callIdx) const
     return 0;
 }
 
+/* Matches the search string against the values of a raw call, without
+ * building the Qt wrappers a frame load would create; only the frame
+ * containing a hit ever gets materialized. */
+class SearchVisitor : public trace::Visitor
+{
+public:
+    SearchVisitor(const QString &str, Qt::CaseSensitivity sensitivity)
+        : m_str(str),
+          m_cs(sensitivity),
+          m_found(false)
+    {}
+    virtual void visit(trace::Null *) {}
+    virtual void visit(trace::Bool *node)
+    {
+        match(QLatin1String(node->value ? "true" : "false"));
+    }
+    virtual void visit(trace::SInt *node)
+    {
+        match(QString::number(node->value));
+    }
+    virtual void visit(trace::UInt *node)
+    {
+        match(QString::number(node->value));
+    }
+    virtual void visit(trace::Float *node)
+    {
+        match(QString::number(node->value));
+    }
+    virtual void visit(trace::Double *node)
+    {
+        match(QString::number(node->value));
+    }
+    virtual void visit(trace::String *node)
+    {
+        match(QString::fromLatin1(node->value));
+    }
+    virtual void visit(trace::Enum *e)
+    {
+        const trace::EnumValue *value = e->lookup();
+        if (value) {
+            match(QString::fromLatin1(value->name));
+        } else {
+            match(QString::number(e->value));
+        }
+    }
+    virtual void visit(trace::Bitmask *bitmask)
+    {
+        const trace::BitmaskSig *sig = bitmask->sig;
+        for (unsigned i = 0; i < sig->num_flags && !m_found; ++i) {
+            match(QString::fromLatin1(sig->flags[i].name));
+        }
+    }
+    virtual void visit(trace::Struct *str)
+    {
+        for (size_t i = 0; i < str->members.size() && !m_found; ++i) {
+            _visit(str->members[i]);
+        }
+    }
+    virtual void visit(trace::Array *array)
+    {
+        for (size_t i = 0; i < array->values.size() && !m_found; ++i) {
+            _visit(array->values[i]);
+        }
+    }
+    virtual void visit(trace::Blob *) {}
+    virtual void visit(trace::Pointer *ptr)
+    {
+        match(QLatin1String("0x") + QString::number(ptr->value, 16));
+    }
+    virtual void visit(trace::Repr *repr)
+    {
+        _visit(repr->humanValue);
+    }
+
+    bool found() const
+    {
+        return m_found;
+    }
+
+private:
+    void match(const QString &text)
+    {
+        if (text.contains(m_str, m_cs)) {
+            m_found = true;
+        }
+    }
+
+    QString m_str;
+    Qt::CaseSensitivity m_cs;
+    bool m_found;
+};
+
 bool TraceLoader::callContains(trace::Call *call,
                                const QString &str,
                                Qt::CaseSensitivity sensitivity)
 {
-    /*
-     * FIXME: do string comparison directly on trace::Call
-     */
-    ApiTraceCall *apiCall = apiCallFromTraceCall(call, m_helpHash,
-                                                 0, this);
-    bool result = apiCall->contains(str, sensitivity);
-    delete apiCall;
-    return result;
+    if (QString::fromLatin1(call->name()).contains(str, sensitivity)) {
+        return true;
+    }
+
+    SearchVisitor visitor(str, sensitivity);
+    for (unsigned i = 0; i < call->args.size(); ++i) {
+        if (i < call->sig->num_args &&
+            QString::fromLatin1(call->sig->arg_names[i])
+                .contains(str, sensitivity)) {
+            return true;
+        }
+        if (call->args[i].value) {
+            call->args[i].value->visit(visitor);
+            if (visitor.found()) {
+                return true;
+            }
+        }
+    }
+    if (call->ret) {
+        call->ret->visit(visitor);
+    }
+    return visitor.found();
 }
 
 QVector<ApiTraceCall*>
@@ -402,27 +808,23 @@ TraceLoader::fetchFrameContents(ApiTraceFrame *currentFrame)
             QVector<ApiTraceCall*> calls(numOfCalls);
             const FrameBookmark &frameBookmark = m_frameBookmarks[frameIdx];
 
+            ensureScannedUpTo(frameIdx);
             m_parser.setBookmark(frameBookmark.start);
 
             trace::Call *call;
             int parsedCalls = 0;
+            QSet<unsigned> frameFunctions;
             while ((call = m_parser.parse_call())) {
+                recordFunction(frameFunctions, call);
                 ApiTraceCall *apiCall =
                     apiCallFromTraceCall(call, m_helpHash,
-                                         currentFrame, this);
+                                         currentFrame, this, true);
                 calls[parsedCalls] = apiCall;
                 Q_ASSERT(calls[parsedCalls]);
-                if (apiCall->hasBinaryData()) {
-                    QByteArray data =
-                        apiCall->arguments()[
-                            apiCall->binaryDataIndex()].toByteArray();
-                    binaryDataSize += data.size();
-                }
+                binaryDataSize += apiCall->binaryDataSize();
 
                 ++parsedCalls;
 
-                delete call;
-
                 if (apiCall->flags() & trace::CALL_FLAG_END_FRAME) {
                     break;
                 }
@@ -431,6 +833,7 @@ TraceLoader::fetchFrameContents(ApiTraceFrame *currentFrame)
             assert(parsedCalls == numOfCalls);
             Q_ASSERT(parsedCalls == calls.size());
             calls.squeeze();
+            indexFrameFunctions(frameIdx, frameFunctions);
 
             Q_ASSERT(parsedCalls == currentFrame->numChildrenToLoad());
             emit frameContentsLoaded(currentFrame,
@@ -7,8 +7,12 @@
 #include "trace_parser.hpp"
 
 #include <QObject>
+#include <QHash>
 #include <QList>
 #include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
 
 class TraceLoader : public QObject
 {
@@ -21,8 +25,11 @@ public:
     ApiTraceCallSignature *signature(unsigned id);
     void addSignature(unsigned id, ApiTraceCallSignature *signature);
 
-    ApiTraceEnumSignature *enumSignature(unsigned id);
-    void addEnumSignature(unsigned id, ApiTraceEnumSignature *signature);
+    /* Look the enum signature up, creating it on first sight.  Called
+     * during lazy value materialization, which can happen on the GUI
+     * thread (first paint of a call) concurrently with a search on the
+     * loader thread, hence the locking inside. */
+    ApiTraceEnumSignature *enumSignature(const trace::EnumSig *enumSig);
 
 public slots:
     void loadTrace(const QString &filename);
@@ -61,6 +68,12 @@ private:
 
         trace::ParseBookmark start;
         int numberOfCalls;
+
+        /* Reposition points inside the frame, every
+         * CALLS_PER_CHECKPOINT calls, with the frame start as the
+         * first entry.  Recorded lazily by frameCheckpoints(); empty
+         * until then. */
+        QVector<trace::ParseBookmark> checkpoints;
     };
     int numberOfFrames() const;
     int numberOfCallsInFrame(int frameIdx) const;
@@ -70,6 +83,22 @@ private:
     void scanTrace();
     void parseTrace();
 
+    /* Scan (without materializing calls) up to the start of the given
+     * frame, so every signature definition preceding it is known to the
+     * parser before seeking there.  Only needed when the bookmarks came
+     * from the sidecar index, or while a fresh scan is still running
+     * behind the frames requested so far. */
+    void ensureScannedUpTo(int frameIdx);
+
+    const QVector<trace::ParseBookmark> &frameCheckpoints(int frameIdx);
+
+    void recordFunction(QSet<unsigned> &functions, const trace::Call *call);
+    void indexFrameFunctions(int frameIdx, const QSet<unsigned> &functions);
+    QSet<unsigned> functionsMatching(const QString &str,
+                                     Qt::CaseSensitivity sensitivity) const;
+    bool frameCanMatch(int frameIdx,
+                       const QSet<unsigned> &matchingFunctions) const;
+
     void searchNext(const ApiTrace::SearchRequest &request);
     void searchPrev(const ApiTrace::SearchRequest &request);
 
@@ -89,10 +118,30 @@ private:
     FrameBookmarks m_frameBookmarks;
     QList<ApiTraceFrame*> m_createdFrames;
 
+    QString m_fileName;
+
+    /* Number of frames whose region has been scanned, and where that
+     * scan stopped. */
+    int m_scannedFrames;
+    trace::ParseBookmark m_scanPos;
+
+    /* scanTrace() pumps the event queue between frame batches so the
+     * viewport's requests jump ahead of the scan; a loadTrace() arriving
+     * through that is remembered here and aborts the running scan. */
+    bool m_scanning;
+    QString m_queuedFile;
+
+    /* Per-frame sets of function signature ids, built as a by-product
+     * of scanning, and the id -> name table to interpret them.  An
+     * empty set means the frame has not been indexed. */
+    QVector<QSet<unsigned> > m_frameFunctions;
+    QHash<unsigned, QString> m_functionNames;
+
     QHash<QString, QUrl> m_helpHash;
 
     QVector<ApiTraceCallSignature*> m_signatures;
     QVector<ApiTraceEnumSignature*> m_enumSignatures;
+    QMutex m_enumSignatureMutex;
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include "trimprocess.h"
 #include "apitrace.h"
+#include "artifactcache.h"
 
 #include <QDebug>
 #include <QDir>
@@ -31,6 +32,14 @@ void TrimProcess::trimFinished()
     qDebug()<<"\terr = "<<errorStrings;
     qDebug()<<"\tout = "<<outputStrings;
 #endif
+    if (m_process->exitStatus() == QProcess::NormalExit &&
+        m_process->exitCode() == 0) {
+        ArtifactCache cache(m_tracePath);
+        if (cache.open()) {
+            cache.saveFile(QLatin1String("trim"), m_trimIndex, m_trimPath);
+        }
+    }
+
     emit trimmedFile(m_trimPath);
 }
 
@@ -50,6 +59,20 @@ void TrimProcess::trimError(QProcess::ProcessError err)
 
 void TrimProcess::start()
 {
+    /* Trimming replays the whole prefix of the trace; serve repeated
+     * requests for the same call from the artifact cache instead. */
+    ArtifactCache cache(m_tracePath);
+    if (cache.open()) {
+        QString cached = cache.lookup(QLatin1String("trim"), m_trimIndex);
+        if (!cached.isEmpty()) {
+            QFile::remove(m_trimPath);
+            if (QFile::copy(cached, m_trimPath)) {
+                emit trimmedFile(m_trimPath);
+                return;
+            }
+        }
+    }
+
     QStringList arguments;
 
     QString outputFormat = QLatin1String("--output=%1");
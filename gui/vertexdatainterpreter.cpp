@@ -1,7 +1,6 @@
 #include "vertexdatainterpreter.h"
 
-#include <QListWidget>
-#include <QStringList>
+#include <QTableView>
 
 #include <QDebug>
 
@@ -29,68 +28,122 @@ sizeForType(int type)
     }
 }
 
-template <typename T>
-static QStringList
-convertData(const QByteArray &dataArray,
-            int type,
-            int stride,
-            int numComponents,
-            int startingOffset)
+VertexDataModel::VertexDataModel(QObject *parent)
+    : QAbstractTableModel(parent),
+      m_type(DT_FLOAT),
+      m_stride(0),
+      m_components(0),
+      m_startingOffset(0),
+      m_numElements(0)
+{
+}
+
+void VertexDataModel::setVertexData(const QByteArray &data, int type,
+                                    int stride, int components,
+                                    int startingOffset)
 {
-    QStringList strings;
+    beginResetModel();
+
+    m_data = data;
+    m_type = type;
+    m_components = components;
+    m_startingOffset = startingOffset;
 
-    int dataSize = dataArray.size() - startingOffset;
-    const char *data = dataArray.constData() + startingOffset;
     int typeSize = sizeForType(type);
-    int elementSize = numComponents * typeSize;
+    int elementSize = components * typeSize;
 
-    if (!stride)
-        stride = elementSize;
+    m_stride = stride ? stride : elementSize;
 
-    int numElements = dataSize / stride;
+    int dataSize = data.size() - startingOffset;
+    m_numElements = (dataSize > 0 && components) ? dataSize / m_stride : 0;
 
-    if ((numElements % numComponents) != 0) {
-        int temp = qFloor(dataSize / (float)stride);
-        int fullElemSize = temp * stride;
-        if (fullElemSize + numComponents * typeSize <= dataSize) {
+    if (m_numElements && (m_numElements % components) != 0) {
+        int temp = qFloor(dataSize / (float)m_stride);
+        int fullElemSize = temp * m_stride;
+        if (fullElemSize + elementSize <= dataSize) {
             /* num full elements plus the part of the buffer in which we fit */
-            numElements = temp + 1;
+            m_numElements = temp + 1;
         } else {
-            numElements = temp;
+            m_numElements = temp;
         }
     }
 
-#if 0
-    qDebug() << "numElements = "<<numElements;
-    qDebug() << "elementSize = "<<elementSize;
-    qDebug() << "stride = "<<stride;
-    qDebug() << "numComponents = "<<numComponents;
-    qDebug() << "typeSize = "<<typeSize;
-#endif
-
-
-    for (int i = 0; i < numElements; ++i) {
-        QString vectorString = QString::fromLatin1("%1) [").arg(i);
-        for (int j = 0; j < numComponents; ++j) {
-            int offset = i*stride + j*typeSize;
-            const T *elementPtr =
-                (const T*)(data + offset);
-            T elem = *elementPtr;
-            vectorString += QString::number(elem);
-            if ((j + 1) < numComponents)
-                vectorString += QLatin1String(", ");
-        }
-        vectorString += "]";
-        strings += vectorString;
+    endResetModel();
+}
+
+void VertexDataModel::clear()
+{
+    beginResetModel();
+    m_data = QByteArray();
+    m_numElements = 0;
+    endResetModel();
+}
+
+int VertexDataModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_numElements;
+}
+
+int VertexDataModel::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_numElements ? m_components : 0;
+}
+
+QVariant VertexDataModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || role != Qt::DisplayRole)
+        return QVariant();
+
+    int typeSize = sizeForType(m_type);
+    int offset = m_startingOffset +
+        index.row() * m_stride + index.column() * typeSize;
+
+    if (offset + typeSize > m_data.size())
+        return QVariant();
+
+    const char *elem = m_data.constData() + offset;
+
+    switch (m_type) {
+    case DT_INT8:
+        return QString::number(*(const qint8*)elem);
+    case DT_UINT8:
+        return QString::number(*(const quint8*)elem);
+    case DT_INT16:
+        return QString::number(*(const qint16*)elem);
+    case DT_UINT16:
+        return QString::number(*(const quint16*)elem);
+    case DT_INT32:
+        return QString::number(*(const qint32*)elem);
+    case DT_UINT32:
+        return QString::number(*(const quint32*)elem);
+    case DT_FLOAT:
+        return QString::number(*(const float*)elem);
+    case DT_DOUBLE:
+        return QString::number(*(const double*)elem);
+    default:
+        return QVariant();
     }
+}
+
+QVariant VertexDataModel::headerData(int section, Qt::Orientation orientation,
+                                     int role) const
+{
+    if (role != Qt::DisplayRole)
+        return QVariant();
 
-    return strings;
+    /* element index on the side, component index on top */
+    return QString::number(section);
 }
 
 
 VertexDataInterpreter::VertexDataInterpreter(QObject *parent)
     : QObject(parent),
-      m_listWidget(0),
+      m_view(0),
+      m_model(new VertexDataModel(this)),
       m_type(DT_FLOAT),
       m_stride(16),
       m_components(4),
@@ -101,8 +154,7 @@ VertexDataInterpreter::VertexDataInterpreter(QObject *parent)
 void VertexDataInterpreter::setData(const QByteArray &data)
 {
     m_data = data;
-    if (m_listWidget)
-        m_listWidget->clear();
+    m_model->clear();
 }
 
 QByteArray VertexDataInterpreter::data() const
@@ -140,60 +192,22 @@ int VertexDataInterpreter::components() const
     return m_components;
 }
 
-void VertexDataInterpreter::setListWidget(QListWidget *listWidget)
+void VertexDataInterpreter::setView(QTableView *view)
 {
-    m_listWidget = listWidget;
+    m_view = view;
+    if (m_view)
+        m_view->setModel(m_model);
 }
 
 void VertexDataInterpreter::interpretData()
 {
-    if (!m_listWidget)
+    if (m_data.isEmpty() || !m_components) {
+        m_model->clear();
         return;
-
-    m_listWidget->clear();
-
-    if (m_data.isEmpty() || !m_components)
-        return;
-
-    QStringList lst;
-    switch(m_type) {
-    case DT_INT8:
-        lst = convertData<qint8>(m_data, m_type, m_stride, m_components,
-                                 m_startingOffset);
-        break;
-    case DT_UINT8:
-        lst = convertData<quint8>(m_data, m_type, m_stride, m_components,
-                                  m_startingOffset);
-        break;
-    case DT_INT16:
-        lst = convertData<qint16>(m_data, m_type, m_stride, m_components,
-                                  m_startingOffset);
-        break;
-    case DT_UINT16:
-        lst = convertData<quint16>(m_data, m_type, m_stride, m_components,
-                                   m_startingOffset);
-        break;
-    case DT_INT32:
-        lst = convertData<qint32>(m_data, m_type, m_stride, m_components,
-                                  m_startingOffset);
-        break;
-    case DT_UINT32:
-        lst = convertData<quint32>(m_data, m_type, m_stride, m_components,
-                                   m_startingOffset);
-        break;
-    case DT_FLOAT:
-        lst = convertData<float>(m_data, m_type, m_stride, m_components,
-                                 m_startingOffset);
-        break;
-    case DT_DOUBLE:
-        lst = convertData<double>(m_data, m_type, m_stride, m_components,
-                                  m_startingOffset);
-        break;
-    default:
-        qDebug()<<"unkown gltype = "<<m_type;
     }
-    //qDebug()<<"list is "<<lst;
-    m_listWidget->addItems(lst);
+
+    m_model->setVertexData(m_data, m_type, m_stride, m_components,
+                           m_startingOffset);
 }
 
 
@@ -1,9 +1,10 @@
 #ifndef VERTEXDATAINTERPRETER_H
 #define VERTEXDATAINTERPRETER_H
 
-#include <QObject>
+#include <QAbstractTableModel>
+#include <QByteArray>
 
-class QListWidget;
+class QTableView;
 
 enum DataType {
     DT_INT8,
@@ -16,6 +17,38 @@ enum DataType {
     DT_DOUBLE,
 };
 
+/* Virtualized view of a raw vertex buffer: one row per element, one
+ * column per component.  Values are decoded with a cast when the view
+ * asks for a cell, so reinterpreting a multi-million-vertex buffer
+ * only recomputes the row count. */
+class VertexDataModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    VertexDataModel(QObject *parent = 0);
+
+    void setVertexData(const QByteArray &data, int type, int stride,
+                       int components, int startingOffset);
+    void clear();
+
+public:
+    /* QAbstractTableModel { */
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const;
+    /* } QAbstractTableModel; */
+
+private:
+    QByteArray m_data;
+    int m_type;
+    int m_stride;
+    int m_components;
+    int m_startingOffset;
+    int m_numElements;
+};
+
 class VertexDataInterpreter : public QObject
 {
     Q_OBJECT
@@ -29,7 +62,7 @@ public:
     int components() const;
     int startingOffset() const;
 
-    void setListWidget(QListWidget *listWidget);
+    void setView(QTableView *view);
 
 public slots:
     void interpretData();
@@ -42,7 +75,8 @@ public slots:
     void setStartingOffset(int offset);
 
 private:
-    QListWidget *m_listWidget;
+    QTableView *m_view;
+    VertexDataModel *m_model;
     QByteArray m_data;
     int m_type;
     int m_stride;
@@ -27,8 +27,126 @@
 
 #include <stdio.h>
 
+#include <map>
+#include <string>
+
 #include "d3dshader.hpp"
 #include "os.hpp"
+#include "os_thread.hpp"
+
+
+/**
+ * Refcounted copy of a cached disassembly, handed to callers in place
+ * of the buffer the D3D runtime would return.
+ */
+class CachedDisassemblyBuffer : public IDisassemblyBuffer {
+public:
+    CachedDisassemblyBuffer(const std::string &text) :
+        m_text(text),
+        m_refCount(1)
+    {}
+
+    HRESULT STDMETHODCALLTYPE
+    QueryInterface(REFIID riid, void **ppvObj) {
+        if (!ppvObj) {
+            return E_POINTER;
+        }
+        if (riid == IID_IUnknown) {
+            *ppvObj = this;
+            AddRef();
+            return S_OK;
+        }
+        *ppvObj = NULL;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE
+    AddRef(void) {
+        return InterlockedIncrement(&m_refCount);
+    }
+
+    ULONG STDMETHODCALLTYPE
+    Release(void) {
+        ULONG cRef = InterlockedDecrement(&m_refCount);
+        if (cRef == 0) {
+            delete this;
+        }
+        return cRef;
+    }
+
+    LPVOID STDMETHODCALLTYPE
+    GetBufferPointer(void) {
+        return (LPVOID)m_text.data();
+    }
+
+    DWORD STDMETHODCALLTYPE
+    GetBufferSize(void) {
+        return m_text.size();
+    }
+
+private:
+    ~CachedDisassemblyBuffer() {}
+
+    std::string m_text;
+    LONG m_refCount;
+};
+
+
+/*
+ * Process-wide disassembly results, keyed by the raw bytecode.  State
+ * dumps see the same few shaders bound draw after draw, and the
+ * runtime's disassembler is by far the most expensive part of dumping
+ * them.  Guarded by a mutex as the tracing wrappers may call in from
+ * any application thread.
+ */
+typedef std::map<std::string, std::string> DisassemblyCache;
+static DisassemblyCache disassemblyCache;
+static os::mutex disassemblyCacheMutex;
+
+static bool
+lookupDisassembly(const void *pBytecode, size_t BytecodeLength,
+                  IDisassemblyBuffer **ppDisassembly)
+{
+    std::string key(reinterpret_cast<const char *>(pBytecode), BytecodeLength);
+    os::unique_lock<os::mutex> lock(disassemblyCacheMutex);
+    DisassemblyCache::const_iterator it = disassemblyCache.find(key);
+    if (it == disassemblyCache.end()) {
+        return false;
+    }
+    *ppDisassembly = new CachedDisassemblyBuffer(it->second);
+    return true;
+}
+
+static void
+cacheDisassembly(const void *pBytecode, size_t BytecodeLength,
+                 IDisassemblyBuffer *pDisassembly)
+{
+    std::string key(reinterpret_cast<const char *>(pBytecode), BytecodeLength);
+    std::string text(reinterpret_cast<const char *>(pDisassembly->GetBufferPointer()),
+                     pDisassembly->GetBufferSize());
+    os::unique_lock<os::mutex> lock(disassemblyCacheMutex);
+    disassemblyCache[key] = text;
+}
+
+/*
+ * Byte length of a D3D9-style token stream: DWORD tokens up to the END
+ * marker.  Comment tokens carry their own DWORD count and may contain
+ * anything, including the END pattern, so they must be skipped whole.
+ */
+static size_t
+tokenStreamSize(const DWORD *tokens)
+{
+    const DWORD *token = tokens + 1;    /* version token */
+    while (*token != 0x0000FFFF) {
+        if ((*token & 0xFFFF) == 0xFFFE) {    /* D3DSIO_COMMENT */
+            token += ((*token >> 16) & 0x7FFF) + 1;
+        } else {
+            ++token;
+        }
+    }
+    ++token;    /* END */
+    return (token - tokens) * sizeof *token;
+}
 
 
 struct ID3DXBuffer : public IUnknown {
@@ -50,6 +168,11 @@ DisassembleShader(const DWORD *tokens, IDisassemblyBuffer **ppDisassembly)
 {
     static BOOL firsttime = TRUE;
 
+    size_t size = tokenStreamSize(tokens);
+    if (lookupDisassembly(tokens, size, ppDisassembly)) {
+        return S_OK;
+    }
+
     /*
      * TODO: Consider using d3dcompile_xx.dll per
      * http://msdn.microsoft.com/en-us/library/windows/desktop/ee663275.aspx
@@ -91,6 +214,9 @@ found:
         hr = pfnD3DXDisassembleShader(tokens, FALSE, NULL,
                                       reinterpret_cast<ID3DXBuffer **>(ppDisassembly));
     }
+    if (SUCCEEDED(hr)) {
+        cacheDisassembly(tokens, size, *ppDisassembly);
+    }
     return hr;
 }
 
@@ -138,6 +264,10 @@ DisassembleShader(const void *pShaderBytecode, SIZE_T BytecodeLength, IDisassemb
 {
     static bool firsttime = true;
 
+    if (lookupDisassembly(pShaderBytecode, BytecodeLength, ppDisassembly)) {
+        return S_OK;
+    }
+
     if (firsttime) {
         char szFilename[MAX_PATH];
         HMODULE hModule = NULL;
@@ -180,5 +310,9 @@ DisassembleShader(const void *pShaderBytecode, SIZE_T BytecodeLength, IDisassemb
                                        reinterpret_cast<ID3D10Blob **>(ppDisassembly));
     }
 
+    if (SUCCEEDED(hr)) {
+        cacheDisassembly(pShaderBytecode, BytecodeLength, *ppDisassembly);
+    }
+
     return hr;
 }
@@ -29,47 +29,263 @@
 #include <math.h>
 
 #include <algorithm>
+#include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "os_thread.hpp"
 #include "image.hpp"
 
 
 namespace image {
 
 
-double Image::compare(Image &ref)
+/*
+ * Global image pool.
+ *
+ * Replays that snapshot every frame otherwise allocate and free one full
+ * uncompressed frame per snapshot -- gigabytes per second of allocator
+ * churn at high resolutions.  Since successive snapshots nearly always
+ * share the same dimensions, retired images are kept here and handed back
+ * out instead.  Guarded by a mutex as the snapshot writer threads release
+ * images concurrently with the replay thread acquiring them.
+ */
+
+enum {
+    MAX_POOLED_IMAGES = 32
+};
+
+static os::mutex imagePoolMutex;
+static std::vector<Image *> imagePool;
+
+
+Image *
+getPooledImage(unsigned width, unsigned height, unsigned channels, bool flipped)
 {
-    if (width != ref.width ||
-        height != ref.height ||
-        channels < 3 ||
-        ref.channels < 3) {
-        return 0.0;
+    imagePoolMutex.lock();
+    for (std::vector<Image *>::iterator it = imagePool.begin();
+         it != imagePool.end(); ++it) {
+        Image *image = *it;
+        if (image->width == width &&
+            image->height == height &&
+            image->channels == channels) {
+            imagePool.erase(it);
+            imagePoolMutex.unlock();
+            image->flipped = flipped;
+            return image;
+        }
     }
+    imagePoolMutex.unlock();
 
-    // Ignore missing alpha when comparing RGB w/ RGBA, but enforce an equal
-    // number of channels otherwise.
-    unsigned minChannels = std::min(channels, ref.channels);
-    if (channels != ref.channels && minChannels < 3) {
-        return 0.0;
+    return new Image(width, height, channels, flipped);
+}
+
+
+void
+releasePooledImage(Image *image)
+{
+    if (!image) {
+        return;
     }
 
-    const unsigned char *pSrc = start();
+    imagePoolMutex.lock();
+    if (imagePool.size() < MAX_POOLED_IMAGES) {
+        imagePool.push_back(image);
+        image = NULL;
+    }
+    imagePoolMutex.unlock();
+
+    delete image;
+}
+
+
+void
+swapRedBlue(unsigned char *dst, const unsigned char *src, unsigned count)
+{
+    unsigned i = 0;
+
+#if defined(__SSSE3__)
+    const __m128i shuffle = _mm_setr_epi8(2,  1,  0,  3,
+                                          6,  5,  4,  7,
+                                          10, 9,  8,  11,
+                                          14, 13, 12, 15);
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i*4));
+        _mm_storeu_si128((__m128i *)(dst + i*4), _mm_shuffle_epi8(x, shuffle));
+    }
+#elif defined(__SSE2__)
+    const __m128i agMask = _mm_set1_epi32(0xff00ff00);
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i*4));
+        __m128i ag = _mm_and_si128(x, agMask);
+        __m128i rb = _mm_andnot_si128(agMask, x);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i *)(dst + i*4), _mm_or_si128(ag, rb));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        unsigned char r = src[i*4 + 0];
+        unsigned char g = src[i*4 + 1];
+        unsigned char b = src[i*4 + 2];
+        unsigned char a = src[i*4 + 3];
+        dst[i*4 + 0] = b;
+        dst[i*4 + 1] = g;
+        dst[i*4 + 2] = r;
+        dst[i*4 + 3] = a;
+    }
+}
+
+
+/**
+ * Sum of squared differences over a contiguous run of bytes.
+ */
+static inline unsigned long long
+sumSquaredDiff(const unsigned char *src, const unsigned char *ref, unsigned len)
+{
+    unsigned long long error = 0;
+    unsigned i = 0;
+
+#if defined(__SSE2__)
+    while (i + 16 <= len) {
+        __m128i acc = _mm_setzero_si128();
+
+        /* Each 16-byte step adds at most 2*2*255^2 to a 32-bit lane, so
+         * drain the accumulator well before it can wrap. */
+        unsigned chunk = std::min((len - i) & ~15u, 8192u * 16);
+        unsigned chunkEnd = i + chunk;
+        for (; i < chunkEnd; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(ref + i));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(a, b),
+                                     _mm_subs_epu8(b, a));
+            __m128i lo = _mm_unpacklo_epi8(d, _mm_setzero_si128());
+            __m128i hi = _mm_unpackhi_epi8(d, _mm_setzero_si128());
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+
+        unsigned lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        error += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+
+    for (; i < len; ++i) {
+        int delta = src[i] - ref[i];
+        error += delta*delta;
+    }
+
+    return error;
+}
+
+
+/**
+ * Accumulate the squared error between two images row by row, giving up
+ * early once it exceeds errorLimit (pass ~0 to always scan everything).
+ */
+static unsigned long long
+squaredError(const Image &src, const Image &ref, unsigned minChannels,
+             unsigned long long errorLimit)
+{
+    const unsigned char *pSrc = src.start();
     const unsigned char *pRef = ref.start();
 
     unsigned long long error = 0;
-    for (unsigned y = 0; y < height; ++y) {
-        for (unsigned  x = 0; x < width; ++x) {
-            // FIXME: Ignore alpha channel until we are able to pick a visual
-            // that matches the traces
-            for (unsigned  c = 0; c < minChannels; ++c) {
-                int delta = pSrc[x*channels + c] - pRef[x*ref.channels + c];
-                error += delta*delta;
+    for (unsigned y = 0; y < src.height; ++y) {
+        if (src.channels == ref.channels && minChannels == src.channels) {
+            /* Rows are byte-for-byte comparable. */
+            error += sumSquaredDiff(pSrc, pRef, src.width * src.channels);
+        } else {
+            /* RGB against RGBA -- compare the common channels only. */
+            for (unsigned x = 0; x < src.width; ++x) {
+                for (unsigned c = 0; c < minChannels; ++c) {
+                    int delta = pSrc[x*src.channels + c] - pRef[x*ref.channels + c];
+                    error += delta*delta;
+                }
             }
         }
 
-        pSrc += stride();
+        if (error > errorLimit) {
+            break;
+        }
+
+        pSrc += src.stride();
         pRef += ref.stride();
     }
 
+    return error;
+}
+
+
+/**
+ * Squared error over a 4x4-subsampled grid of pixels.  Every sampled
+ * term also appears in the full sum, so this is a lower bound on
+ * squaredError() at a sixteenth of the memory traffic.
+ */
+static unsigned long long
+subsampledError(const Image &src, const Image &ref, unsigned minChannels)
+{
+    const unsigned char *pSrc = src.start();
+    const unsigned char *pRef = ref.start();
+
+    unsigned long long error = 0;
+    for (unsigned y = 0; y < src.height; y += 4) {
+        for (unsigned x = 0; x < src.width; x += 4) {
+            for (unsigned c = 0; c < minChannels; ++c) {
+                int delta = pSrc[x*src.channels + c] - pRef[x*ref.channels + c];
+                error += delta*delta;
+            }
+        }
+        pSrc += src.stride() * 4;
+        pRef += ref.stride() * 4;
+    }
+
+    return error;
+}
+
+
+/**
+ * Check the comparability of two images, and return the number of common
+ * channels (0 when they cannot be compared at all).
+ */
+static unsigned
+comparableChannels(const Image &src, const Image &ref)
+{
+    if (src.width != ref.width ||
+        src.height != ref.height ||
+        src.channels < 3 ||
+        ref.channels < 3) {
+        return 0;
+    }
+
+    // Ignore missing alpha when comparing RGB w/ RGBA, but enforce an equal
+    // number of channels otherwise.
+    unsigned minChannels = std::min(src.channels, ref.channels);
+    if (src.channels != ref.channels && minChannels < 3) {
+        return 0;
+    }
+
+    return minChannels;
+}
+
+
+double Image::compare(Image &ref)
+{
+    // FIXME: Ignore alpha channel until we are able to pick a visual
+    // that matches the traces
+    unsigned minChannels = comparableChannels(*this, ref);
+    if (!minChannels) {
+        return 0.0;
+    }
+
+    unsigned long long error = squaredError(*this, ref, minChannels, ~0ULL);
+
     double numerator = error*2 + 1;
     double denominator = height*width*minChannels*255ULL*255ULL*2;
     double quotient = numerator/denominator;
@@ -81,4 +297,59 @@ double Image::compare(Image &ref)
 }
 
 
+bool Image::compareThreshold(Image &ref, double thresholdBits)
+{
+    unsigned minChannels = comparableChannels(*this, ref);
+    if (!minChannels) {
+        return false;
+    }
+
+    /* Invert the precision formula of compare() into the largest error
+     * still meeting the threshold, so the scan can stop at the first row
+     * that pushes the error past it. */
+    double denominator = height*width*minChannels*255.0*255.0*2;
+    double maxNumerator = denominator * pow(2.0, -thresholdBits);
+    if (maxNumerator < 1.0) {
+        return false;
+    }
+    unsigned long long errorLimit = (unsigned long long)((maxNumerator - 1)/2);
+
+    /* Coarse pre-pass over a subsampled grid: when even its partial sum
+     * is past the limit, the pair is rejected after touching a sixteenth
+     * of the pixels.  This catches differences the row-by-row scan below
+     * would only reach late, e.g. ones confined to the bottom of the
+     * frame.  A clean coarse pass cannot prove a match, though, so
+     * acceptance still takes the full scan. */
+    if (subsampledError(*this, ref, minChannels) > errorLimit) {
+        return false;
+    }
+
+    return squaredError(*this, ref, minChannels, errorLimit) <= errorLimit;
+}
+
+
+bool Image::xorImage(const Image &other)
+{
+    if (width != other.width ||
+        height != other.height ||
+        channels != other.channels) {
+        return false;
+    }
+
+    /* Walk by rows so images of opposite orientations still line up. */
+    unsigned char *pDst = start();
+    const unsigned char *pSrc = other.start();
+    unsigned rowBytes = width * channels;
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < rowBytes; ++x) {
+            pDst[x] ^= pSrc[x];
+        }
+        pDst += stride();
+        pSrc += other.stride();
+    }
+
+    return true;
+}
+
+
 } /* namespace image */
@@ -106,13 +106,80 @@ public:
         return writePNG(os);
     }
 
+    /**
+     * Write the raw snapshot format: unfiltered, snappy-compressed pixels.
+     * Roughly twice the size of a PNG but an order of magnitude faster to
+     * encode, for snapshots that are compared once and thrown away.
+     */
+    bool
+    writeRAW(std::ostream &os) const;
+
+    inline bool
+    writeRAW(const char *filename) const {
+        std::ofstream os(filename, std::ofstream::binary);
+        if (!os) {
+            return false;
+        }
+        return writeRAW(os);
+    }
+
     double compare(Image &ref);
+
+    /**
+     * Whether the image matches ref to at least the given precision (in
+     * bits, as reported by compare()).  Unlike compare() this can stop as
+     * soon as the accumulated error already rules the threshold out, which
+     * makes rejecting grossly different images much cheaper.
+     */
+    bool compareThreshold(Image &ref, double thresholdBits);
+
+    /**
+     * XOR this image's pixels with other's, byte by byte.  Being its
+     * own inverse, this both produces delta snapshots (frame XOR
+     * previous frame, see glretrace --snapshot-delta) and
+     * reconstructs them (delta XOR previous frame).  The images must
+     * have the same dimensions and channel count; returns false when
+     * they do not.
+     */
+    bool xorImage(const Image &other);
 };
 
 
+/**
+ * Get an image from the global pool, or allocate a new one when no pooled
+ * image has the requested dimensions.
+ *
+ * Snapshotting allocates and frees a full frame per call; recycling the
+ * buffers through this pool keeps steady-state capture free of heap
+ * traffic.  The contents of the returned image are undefined.
+ */
+Image *
+getPooledImage(unsigned width, unsigned height, unsigned channels = 4, bool flipped = false);
+
+/**
+ * Return an image to the pool for reuse.  Safe on any heap-allocated
+ * Image, pooled or not.
+ */
+void
+releasePooledImage(Image *image);
+
+/**
+ * Swap the red and blue channels of a run of 4-channel pixels,
+ * converting between RGBA and BGRA (the swap is its own inverse).
+ * dst and src may be the same buffer.  Vectorized where the compiler
+ * targets SSE, for the multi-megapixel passes the snapshot and BMP
+ * paths do per frame.
+ */
+void
+swapRedBlue(unsigned char *dst, const unsigned char *src, unsigned count);
+
+
 Image *
 readPNG(const char *filename);
 
+Image *
+readRAW(const char *filename);
+
 const char *
 readPNMHeader(const char *buffer, size_t size, unsigned *channels, unsigned *width, unsigned *height);
 
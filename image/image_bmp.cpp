@@ -28,6 +28,8 @@
 #include <assert.h>
 #include <stdint.h>
 
+#include <vector>
+
 #include "image.hpp"
 
 
@@ -72,7 +74,7 @@ Image::writeBMP(const char *filename) const {
 
     struct FileHeader bmfh;
     struct InfoHeader bmih;
-    unsigned x, y;
+    unsigned y;
 
     bmfh.bfType = 0x4d42;
     bmfh.bfSize = 14 + 40 + height*width*4;
@@ -103,30 +105,22 @@ Image::writeBMP(const char *filename) const {
 
     unsigned stride = width*4;
 
+    /* Swizzle a whole row at a time and write it in one go, instead of
+     * doing a 4-byte stream write per pixel. */
+    std::vector<unsigned char> row(stride);
+
     if (flipped) {
         for (y = 0; y < height; ++y) {
             const unsigned char *ptr = pixels + y * stride;
-            for (x = 0; x < width; ++x) {
-                struct Pixel pixel;
-                pixel.rgbRed   = ptr[x*4 + 0];
-                pixel.rgbGreen = ptr[x*4 + 1];
-                pixel.rgbBlue  = ptr[x*4 + 2];
-                pixel.rgbAlpha = ptr[x*4 + 3];
-                stream.write((const char *)&pixel, 4);
-            }
+            swapRedBlue(&row[0], ptr, width);
+            stream.write((const char *)&row[0], stride);
         }
     } else {
         y = height;
         while (y--) {
             const unsigned char *ptr = pixels + y * stride;
-            for (x = 0; x < width; ++x) {
-                struct Pixel pixel;
-                pixel.rgbRed   = ptr[x*4 + 0];
-                pixel.rgbGreen = ptr[x*4 + 1];
-                pixel.rgbBlue  = ptr[x*4 + 2];
-                pixel.rgbAlpha = ptr[x*4 + 3];
-                stream.write((const char *)&pixel, 4);
-            }
+            swapRedBlue(&row[0], ptr, width);
+            stream.write((const char *)&row[0], stride);
         }
     }
 
@@ -31,9 +31,19 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <fstream>
+#include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "os_thread.hpp"
 #include "image.hpp"
 
 
@@ -43,6 +53,222 @@ namespace image {
 static const int png_compression_level = Z_BEST_SPEED;
 
 
+/*
+ * Parallel PNG encoder.
+ *
+ * libpng compresses one scanline at a time on the calling thread, and for
+ * large snapshots the deflate easily outweighs the rendering being
+ * captured.  Instead the scanlines are split into horizontal bands, each
+ * band is filtered and deflated as an independent raw-deflate segment on
+ * its own thread, and the segments are then joined at their Z_FULL_FLUSH
+ * boundaries into a single zlib stream wrapped in an ordinary IDAT chunk,
+ * with adler32_combine supplying the stream checksum.  Decoders see a
+ * perfectly ordinary PNG.
+ */
+
+struct PNGBand {
+    const Image *image;
+
+    /* Rows in file order (top-down, regardless of Image::flipped). */
+    unsigned firstRow;
+    unsigned numRows;
+    bool last;
+
+    /* Raw deflate segment, its uncompressed size and adler32. */
+    std::vector<unsigned char> data;
+    size_t rawSize;
+    uLong adler;
+
+    bool ok;
+};
+
+
+static void *
+pngBandThread(PNGBand *band)
+{
+    const Image &image = *band->image;
+    unsigned bpp = image.channels;
+    unsigned bytesPerRow = image.width * image.channels;
+
+    band->ok = false;
+    band->rawSize = (size_t)band->numRows * (1 + bytesPerRow);
+    band->adler = adler32(0L, Z_NULL, 0);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof strm);
+    if (deflateInit2(&strm, png_compression_level, Z_DEFLATED,
+                     -15 /* raw deflate */, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+
+    std::vector<unsigned char> rowBuf(1 + bytesPerRow);
+    unsigned char out[16384];
+
+    for (unsigned i = 0; i < band->numRows; ++i) {
+        unsigned rowNo = band->firstRow + i;
+        const unsigned char *row = image.start() + (int)rowNo*image.stride();
+
+        /* Sub filter: references only pixels of the same row, so the
+         * bands stay independent of each other. */
+        rowBuf[0] = 1;
+        for (unsigned j = 0; j < bpp && j < bytesPerRow; ++j) {
+            rowBuf[1 + j] = row[j];
+        }
+        for (unsigned j = bpp; j < bytesPerRow; ++j) {
+            rowBuf[1 + j] = row[j] - row[j - bpp];
+        }
+
+        band->adler = adler32(band->adler, &rowBuf[0], 1 + bytesPerRow);
+
+        /* A full flush ends the segment on a byte boundary, so segments
+         * of successive bands concatenate into one valid stream. */
+        int flush = Z_NO_FLUSH;
+        if (i == band->numRows - 1) {
+            flush = band->last ? Z_FINISH : Z_FULL_FLUSH;
+        }
+
+        strm.next_in = &rowBuf[0];
+        strm.avail_in = 1 + bytesPerRow;
+        do {
+            strm.next_out = out;
+            strm.avail_out = sizeof out;
+            if (deflate(&strm, flush) == Z_STREAM_ERROR) {
+                deflateEnd(&strm);
+                return 0;
+            }
+            band->data.insert(band->data.end(),
+                              out, out + (sizeof out - strm.avail_out));
+        } while (strm.avail_out == 0);
+        assert(strm.avail_in == 0);
+    }
+
+    deflateEnd(&strm);
+    band->ok = true;
+    return 0;
+}
+
+
+static inline void
+putU32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+
+static void
+writePNGChunk(std::ostream &os, const char *type,
+              const unsigned char *data, size_t size)
+{
+    unsigned char u32[4];
+
+    putU32(u32, size);
+    os.write((const char *)u32, 4);
+    os.write(type, 4);
+    if (size) {
+        os.write((const char *)data, size);
+    }
+
+    uLong crc = crc32(0L, (const Bytef *)type, 4);
+    if (size) {
+        /* zlib resets the crc when handed a null buffer */
+        crc = crc32(crc, (const Bytef *)data, size);
+    }
+    putU32(u32, crc);
+    os.write((const char *)u32, 4);
+}
+
+
+static bool
+writePNGParallel(const Image &image, int color_type, std::ostream &os)
+{
+    enum {
+        NUM_BANDS = 4,
+        MIN_ROWS_PER_BAND = 64
+    };
+
+    if (image.height < NUM_BANDS * MIN_ROWS_PER_BAND) {
+        return false;
+    }
+
+    PNGBand bands[NUM_BANDS];
+    os::thread threads[NUM_BANDS];
+    unsigned firstRow = 0;
+    for (int i = 0; i < NUM_BANDS; ++i) {
+        bands[i].image = &image;
+        bands[i].firstRow = firstRow;
+        bands[i].numRows = (image.height - firstRow) / (NUM_BANDS - i);
+        bands[i].last = i == NUM_BANDS - 1;
+        firstRow += bands[i].numRows;
+        threads[i] = os::thread(pngBandThread, &bands[i]);
+    }
+    assert(firstRow == image.height);
+
+    bool ok = true;
+    for (int i = 0; i < NUM_BANDS; ++i) {
+        threads[i].join();
+        ok = ok && bands[i].ok;
+    }
+    if (!ok) {
+        /* Nothing was written yet -- the caller can still fall back. */
+        return false;
+    }
+
+    static const unsigned char signature[8] = {
+        137, 80, 78, 71, 13, 10, 26, 10
+    };
+    os.write((const char *)signature, sizeof signature);
+
+    unsigned char ihdr[13];
+    putU32(ihdr, image.width);
+    putU32(ihdr + 4, image.height);
+    ihdr[8] = 8; /* bit depth */
+    ihdr[9] = color_type;
+    ihdr[10] = 0; /* compression */
+    ihdr[11] = 0; /* filter */
+    ihdr[12] = 0; /* interlace */
+    writePNGChunk(os, "IHDR", ihdr, sizeof ihdr);
+
+    /* CMF/FLG pair declaring a 32KB window; (0x78*256 + 0x01) % 31 == 0 */
+    static const unsigned char zlibHeader[2] = { 0x78, 0x01 };
+
+    uLong adler = bands[0].adler;
+    size_t dataSize = sizeof zlibHeader + 4;
+    for (int i = 0; i < NUM_BANDS; ++i) {
+        if (i) {
+            adler = adler32_combine(adler, bands[i].adler, bands[i].rawSize);
+        }
+        dataSize += bands[i].data.size();
+    }
+
+    unsigned char u32[4];
+    putU32(u32, dataSize);
+    os.write((const char *)u32, 4);
+    os.write("IDAT", 4);
+
+    uLong crc = crc32(0L, (const Bytef *)"IDAT", 4);
+    crc = crc32(crc, zlibHeader, sizeof zlibHeader);
+    os.write((const char *)zlibHeader, sizeof zlibHeader);
+    for (int i = 0; i < NUM_BANDS; ++i) {
+        if (!bands[i].data.empty()) {
+            crc = crc32(crc, &bands[i].data[0], bands[i].data.size());
+            os.write((const char *)&bands[i].data[0], bands[i].data.size());
+        }
+    }
+    putU32(u32, adler);
+    crc = crc32(crc, u32, 4);
+    os.write((const char *)u32, 4);
+    putU32(u32, crc);
+    os.write((const char *)u32, 4);
+
+    writePNGChunk(os, "IEND", NULL, 0);
+
+    return os.good();
+}
+
+
 static void
 pngWriteCallback(png_structp png_ptr, png_bytep data, png_size_t length)
 {
@@ -75,6 +301,10 @@ Image::writePNG(std::ostream &os) const
         goto no_png;
     }
 
+    if (writePNGParallel(*this, color_type, os)) {
+        return true;
+    }
+
     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
         goto no_png;
@@ -123,18 +353,97 @@ no_png:
 }
 
 
+/*
+ * Decoding a reference image goes through the whole file anyway, so it
+ * is mapped in one piece and handed to libpng straight from the
+ * mapping: no stdio buffer to fill, and the PNG signature can be
+ * checked before any libpng state is created.  stdio remains as the
+ * fallback when mapping is unavailable.
+ */
+
+struct PNGSource {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+};
+
+
+static void
+pngReadFromSource(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    PNGSource *source = (PNGSource *) png_get_io_ptr(png_ptr);
+    if (length > source->size - source->pos) {
+        png_error(png_ptr, "read past end of file");
+    }
+    memcpy(data, source->data + source->pos, length);
+    source->pos += length;
+}
+
+
+static const unsigned char *
+mapFile(const char *filename, size_t *size)
+{
+#ifndef _WIN32
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return NULL;
+    }
+
+    void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping outlives the file descriptor
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    *size = st.st_size;
+    return (const unsigned char *)map;
+#else
+    return NULL;
+#endif
+}
+
+
+static void
+unmapFile(const unsigned char *data, size_t size)
+{
+#ifndef _WIN32
+    ::munmap((void *)data, size);
+#endif
+}
+
+
 Image *
 readPNG(const char *filename)
 {
-    FILE *fp;
+    FILE *fp = NULL;
+    PNGSource source;
     png_structp png_ptr;
     png_infop info_ptr;
     png_infop end_info;
     Image *image;
 
-    fp = fopen(filename, "rb");
-    if (!fp)
-        goto no_fp;
+    source.data = mapFile(filename, &source.size);
+    source.pos = 0;
+    if (source.data) {
+        /* Sniff the signature before creating any libpng state. */
+        if (source.size < 8 ||
+            png_sig_cmp((png_bytep)source.data, 0, 8) != 0) {
+            goto no_png;
+        }
+    } else {
+        fp = fopen(filename, "rb");
+        if (!fp)
+            goto no_fp;
+    }
 
     png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr)
@@ -157,7 +466,11 @@ readPNG(const char *filename)
         goto no_png;
     }
 
-    png_init_io(png_ptr, fp);
+    if (fp) {
+        png_init_io(png_ptr, fp);
+    } else {
+        png_set_read_fn(png_ptr, &source, pngReadFromSource);
+    }
 
     png_read_info(png_ptr, info_ptr);
 
@@ -190,14 +503,24 @@ readPNG(const char *filename)
 
     png_read_end(png_ptr, info_ptr);
     png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    fclose(fp);
+    if (fp) {
+        fclose(fp);
+    }
+    if (source.data) {
+        unmapFile(source.data, source.size);
+    }
     return image;
 
 no_image:
     png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
 no_png:
-    fclose(fp);
+    if (fp) {
+        fclose(fp);
+    }
 no_fp:
+    if (source.data) {
+        unmapFile(source.data, source.size);
+    }
     return NULL;
 }
 
@@ -0,0 +1,168 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Raw snapshot format.
+ *
+ * Snapshots that only exist to be fed to a comparator once and deleted do
+ * not need PNG's zlib effort; this container stores the pixels unfiltered
+ * behind a snappy block, trading roughly double the file size for an order
+ * of magnitude faster encoding.  The layout is a small little-endian
+ * header followed by one snappy-compressed blob of the scanlines in
+ * top-down order.
+ */
+
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+
+#include <snappy.h>
+
+#include "image.hpp"
+
+
+namespace image {
+
+
+static const char rawMagic[4] = { 'a', 't', 'r', 'i' };
+
+enum {
+    RAW_HEADER_SIZE = 4 + 4*4
+};
+
+
+static inline void
+putU32LE(char *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static inline uint32_t
+getU32LE(const char *p)
+{
+    return (uint32_t)(unsigned char)p[0] |
+           (uint32_t)(unsigned char)p[1] << 8 |
+           (uint32_t)(unsigned char)p[2] << 16 |
+           (uint32_t)(unsigned char)p[3] << 24;
+}
+
+
+bool
+Image::writeRAW(std::ostream &os) const
+{
+    size_t rowBytes = (size_t)width * channels;
+    size_t rawSize = rowBytes * height;
+
+    /* Store scanlines top-down so readers need not care about flipping. */
+    const char *raw = (const char *)pixels;
+    std::string topDown;
+    if (flipped) {
+        topDown.reserve(rawSize);
+        const unsigned char *row = start();
+        for (unsigned y = 0; y < height; ++y) {
+            topDown.append((const char *)row, rowBytes);
+            row += stride();
+        }
+        raw = topDown.data();
+    }
+
+    std::string compressed;
+    snappy::Compress(raw, rawSize, &compressed);
+
+    char header[RAW_HEADER_SIZE];
+    memcpy(header, rawMagic, sizeof rawMagic);
+    putU32LE(header + 4, width);
+    putU32LE(header + 8, height);
+    putU32LE(header + 12, channels);
+    putU32LE(header + 16, compressed.size());
+
+    os.write(header, sizeof header);
+    os.write(compressed.data(), compressed.size());
+
+    return os.good();
+}
+
+
+Image *
+readRAW(const char *filename)
+{
+    std::ifstream is(filename, std::ifstream::binary);
+    if (!is) {
+        return NULL;
+    }
+
+    char header[RAW_HEADER_SIZE];
+    is.read(header, sizeof header);
+    if (!is ||
+        memcmp(header, rawMagic, sizeof rawMagic) != 0) {
+        return NULL;
+    }
+
+    uint32_t width = getU32LE(header + 4);
+    uint32_t height = getU32LE(header + 8);
+    uint32_t channels = getU32LE(header + 12);
+    uint32_t compressedSize = getU32LE(header + 16);
+    if (!width || !height || !channels || channels > 4) {
+        return NULL;
+    }
+
+    std::string compressed;
+    compressed.resize(compressedSize);
+    is.read(&compressed[0], compressedSize);
+    if (!is) {
+        return NULL;
+    }
+
+    size_t rawSize;
+    if (!snappy::GetUncompressedLength(compressed.data(), compressedSize,
+                                       &rawSize) ||
+        rawSize != (size_t)width * height * channels) {
+        return NULL;
+    }
+
+    Image *image = getPooledImage(width, height, channels, false);
+    if (!image) {
+        return NULL;
+    }
+
+    if (!snappy::RawUncompress(compressed.data(), compressedSize,
+                               (char *)image->pixels)) {
+        releasePooledImage(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+
+} /* namespace image */
@@ -38,6 +38,7 @@
 
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -97,10 +98,9 @@ getImportDescriptionName(HMODULE hModule, const PIMAGE_IMPORT_DESCRIPTOR pImport
 }
 
 
-static PIMAGE_IMPORT_DESCRIPTOR
-getImportDescriptor(HMODULE hModule,
-                    const char *szModule,
-                    const char *pszDllName)
+static PIMAGE_NT_HEADERS
+getNtHeaders(HMODULE hModule,
+             const char *szModule)
 {
     MEMORY_BASIC_INFORMATION MemoryInfo;
     if (VirtualQuery(hModule, &MemoryInfo, sizeof MemoryInfo) != sizeof MemoryInfo) {
@@ -113,7 +113,18 @@ getImportDescriptor(HMODULE hModule,
     }
 
     PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)hModule;
-    PIMAGE_NT_HEADERS pNtHeaders = (PIMAGE_NT_HEADERS)((PBYTE)hModule + pDosHeader->e_lfanew);
+    return (PIMAGE_NT_HEADERS)((PBYTE)hModule + pDosHeader->e_lfanew);
+}
+
+
+static PIMAGE_IMPORT_DESCRIPTOR
+getFirstImportDescriptor(HMODULE hModule,
+                         const char *szModule)
+{
+    PIMAGE_NT_HEADERS pNtHeaders = getNtHeaders(hModule, szModule);
+    if (!pNtHeaders) {
+        return NULL;
+    }
 
     PIMAGE_OPTIONAL_HEADER pOptionalHeader = &pNtHeaders->OptionalHeader;
 
@@ -123,7 +134,19 @@ getImportDescriptor(HMODULE hModule,
         return NULL;
     }
 
-    PIMAGE_IMPORT_DESCRIPTOR pImportDescriptor = (PIMAGE_IMPORT_DESCRIPTOR)((PBYTE)hModule + ImportAddress);
+    return (PIMAGE_IMPORT_DESCRIPTOR)((PBYTE)hModule + ImportAddress);
+}
+
+
+static PIMAGE_IMPORT_DESCRIPTOR
+getImportDescriptor(HMODULE hModule,
+                    const char *szModule,
+                    const char *pszDllName)
+{
+    PIMAGE_IMPORT_DESCRIPTOR pImportDescriptor = getFirstImportDescriptor(hModule, szModule);
+    if (!pImportDescriptor) {
+        return NULL;
+    }
 
     while (pImportDescriptor->FirstThunk) {
         const char* szName = getImportDescriptionName(hModule, pImportDescriptor);
@@ -283,6 +306,119 @@ static unsigned numReplacements = 0;
 static Replacement replacements[32];
 
 
+/*
+ * Modules whose import tables were already patched.  hookAllModules
+ * re-walks the whole module snapshot on every LoadLibrary, so without
+ * this every DLL load notification re-parses the import tables of
+ * every module in the process.  Keyed by base address and link
+ * timestamp, so a module unloaded and another mapped at the same base
+ * is not mistaken for it.
+ */
+struct HookedModule {
+    HMODULE hModule;
+    DWORD dwTimeDateStamp;
+};
+
+static unsigned numHookedModules = 0;
+static HookedModule hookedModules[512];
+
+
+static DWORD
+getTimeDateStamp(HMODULE hModule,
+                 const char *szModule)
+{
+    PIMAGE_NT_HEADERS pNtHeaders = getNtHeaders(hModule, szModule);
+    if (!pNtHeaders) {
+        return 0;
+    }
+    return pNtHeaders->FileHeader.TimeDateStamp;
+}
+
+
+static BOOL
+isModuleHooked(HMODULE hModule,
+               DWORD dwTimeDateStamp)
+{
+    BOOL bHooked = FALSE;
+    EnterCriticalSection(&Mutex);
+    for (unsigned i = 0; i < numHookedModules; ++i) {
+        if (hookedModules[i].hModule == hModule &&
+            hookedModules[i].dwTimeDateStamp == dwTimeDateStamp) {
+            bHooked = TRUE;
+            break;
+        }
+    }
+    LeaveCriticalSection(&Mutex);
+    return bHooked;
+}
+
+
+static void
+rememberHookedModule(HMODULE hModule,
+                     DWORD dwTimeDateStamp)
+{
+    EnterCriticalSection(&Mutex);
+    if (numHookedModules < sizeof hookedModules / sizeof hookedModules[0]) {
+        hookedModules[numHookedModules].hModule = hModule;
+        hookedModules[numHookedModules].dwTimeDateStamp = dwTimeDateStamp;
+        ++numHookedModules;
+    }
+    /* On overflow the module is simply re-walked next time; patching
+     * is idempotent. */
+    LeaveCriticalSection(&Mutex);
+}
+
+
+/*
+ * Case-insensitive FNV-1a hash of a DLL name, for the import name
+ * filter below.
+ */
+static DWORD
+hashDllName(const char *szName)
+{
+    DWORD dwHash = 2166136261U;
+    while (*szName) {
+        dwHash = (dwHash ^ (DWORD)tolower((unsigned char)*szName++)) * 16777619U;
+    }
+    return dwHash;
+}
+
+
+/*
+ * One-pass 64-bit bloom filter over the names in a module's import
+ * descriptor list.  Checking a candidate DLL name against it is two
+ * bit tests, where probing the descriptor list directly costs a
+ * stricmp per descriptor; most modules import neither kernel32 nor
+ * any of the APIs of interest under their queried names and are
+ * dismissed without further walks.
+ */
+static ULONGLONG
+getImportNameFilter(HMODULE hModule,
+                    const char *szModule)
+{
+    ULONGLONG qwFilter = 0;
+    PIMAGE_IMPORT_DESCRIPTOR pImportDescriptor = getFirstImportDescriptor(hModule, szModule);
+    if (pImportDescriptor) {
+        while (pImportDescriptor->FirstThunk) {
+            DWORD dwHash = hashDllName(getImportDescriptionName(hModule, pImportDescriptor));
+            qwFilter |= 1ULL << (dwHash & 63);
+            qwFilter |= 1ULL << ((dwHash >> 6) & 63);
+            ++pImportDescriptor;
+        }
+    }
+    return qwFilter;
+}
+
+
+static BOOL
+filterMayImport(ULONGLONG qwFilter,
+                const char *pszDllName)
+{
+    DWORD dwHash = hashDllName(pszDllName);
+    ULONGLONG qwBits = (1ULL << (dwHash & 63)) | (1ULL << ((dwHash >> 6) & 63));
+    return (qwFilter & qwBits) == qwBits;
+}
+
 
 static void
 hookModule(HMODULE hModule,
@@ -298,11 +434,21 @@ hookModule(HMODULE hModule,
         }
     }
 
-    hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryA", (LPVOID)MyLoadLibraryA);
-    hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryW", (LPVOID)MyLoadLibraryW);
-    hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryExA", (LPVOID)MyLoadLibraryExA);
-    hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryExW", (LPVOID)MyLoadLibraryExW);
-    hookFunction(hModule, szModule, "kernel32.dll", "GetProcAddress", (LPVOID)MyGetProcAddress);
+    DWORD dwTimeDateStamp = getTimeDateStamp(hModule, szModule);
+    if (isModuleHooked(hModule, dwTimeDateStamp)) {
+        return;
+    }
+    rememberHookedModule(hModule, dwTimeDateStamp);
+
+    ULONGLONG qwImportFilter = getImportNameFilter(hModule, szModule);
+
+    if (filterMayImport(qwImportFilter, "kernel32.dll")) {
+        hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryA", (LPVOID)MyLoadLibraryA);
+        hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryW", (LPVOID)MyLoadLibraryW);
+        hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryExA", (LPVOID)MyLoadLibraryExA);
+        hookFunction(hModule, szModule, "kernel32.dll", "LoadLibraryExW", (LPVOID)MyLoadLibraryExW);
+        hookFunction(hModule, szModule, "kernel32.dll", "GetProcAddress", (LPVOID)MyGetProcAddress);
+    }
 
     const char *szBaseName = getBaseName(szModule);
     for (unsigned i = 0; i < numReplacements; ++i) {
@@ -322,6 +468,9 @@ hookModule(HMODULE hModule,
     }
 
     for (unsigned i = 0; i < numReplacements; ++i) {
+        if (!filterMayImport(qwImportFilter, replacements[i].szMatchModule)) {
+            continue;
+        }
         replaceImport(hModule, szModule, replacements[i].szMatchModule, replacements[i].hReplaceModule);
         replaceImport(hModule, szModule, replacements[i].szMatchModule, replacements[i].hReplaceModule);
         replaceImport(hModule, szModule, replacements[i].szMatchModule, replacements[i].hReplaceModule);
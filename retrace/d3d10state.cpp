@@ -30,6 +30,7 @@
 
 #include "d3d10imports.hpp"
 #include "d3d10state.hpp"
+#include "retrace.hpp"
 
 
 namespace d3dstate {
@@ -74,6 +75,9 @@ void
 dumpDevice(std::ostream &os, ID3D10Device *pDevice)
 {
     JSONWriter json(os);
+    if (retrace::stateBinarySidecar) {
+        json.setBinarySidecar(*retrace::stateBinarySidecar);
+    }
 
     /* TODO */
     json.beginMember("parameters");
@@ -31,6 +31,7 @@
 
 #include "image.hpp"
 #include "json.hpp"
+#include "imagedumpqueue.hpp"
 #include "d3d10imports.hpp"
 #include "d3dstate.hpp"
 
@@ -278,12 +279,7 @@ getRenderTargetViewImage(ID3D10Device *pDevice,
                 dst[4*x + 3] = ((float *)src)[4*x + 3] * scale;
             }
         } else if (Desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM) {
-            for (unsigned x = 0; x < Width; ++x) {
-                dst[4*x + 0] = src[4*x + 2];
-                dst[4*x + 1] = src[4*x + 1];
-                dst[4*x + 2] = src[4*x + 0];
-                dst[4*x + 3] = src[4*x + 3];
-            }
+            image::swapRedBlue(dst, src, Width);
         } else {
             assert(0);
         }
@@ -329,6 +325,11 @@ dumpFramebuffer(JSONWriter &json, ID3D10Device *pDevice)
     ID3D10RenderTargetView *pRenderTargetViews[D3D10_SIMULTANEOUS_RENDER_TARGET_COUNT];
     pDevice->OMGetRenderTargets(D3D10_SIMULTANEOUS_RENDER_TARGET_COUNT, pRenderTargetViews, NULL);
 
+    /* The staging copies and maps must stay on this thread (the device
+     * is not free-threaded), so only the PNG encode of each render
+     * target runs on the queue's workers. */
+    ImageDumpQueue queue(json.hasBinarySidecar());
+
     for (UINT i = 0; i < D3D10_SIMULTANEOUS_RENDER_TARGET_COUNT; ++i) {
         if (!pRenderTargetViews[i]) {
             continue;
@@ -339,14 +340,14 @@ dumpFramebuffer(JSONWriter &json, ID3D10Device *pDevice)
         if (image) {
             char label[64];
             _snprintf(label, sizeof label, "RENDER_TARGET_%u", i);
-            json.beginMember(label);
-            json.writeImage(image, "UNKNOWN");
-            json.endMember(); // RENDER_TARGET_*
+            queue.push(label, image, "UNKNOWN", 1);
         }
 
         pRenderTargetViews[i]->Release();
     }
 
+    queue.flush(json);
+
     json.endObject();
     json.endMember(); // framebuffer
 }
@@ -30,6 +30,7 @@
 
 #include "d3d11imports.hpp"
 #include "d3d10state.hpp"
+#include "retrace.hpp"
 
 
 namespace d3dstate {
@@ -70,6 +71,9 @@ void
 dumpDevice(std::ostream &os, ID3D11DeviceContext *pDeviceContext)
 {
     JSONWriter json(os);
+    if (retrace::stateBinarySidecar) {
+        json.setBinarySidecar(*retrace::stateBinarySidecar);
+    }
 
     /* TODO */
     json.beginMember("parameters");
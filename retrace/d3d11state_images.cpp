@@ -30,6 +30,7 @@
 #include <algorithm>
 
 #include "image.hpp"
+#include "imagedumpqueue.hpp"
 #include "d3d11imports.hpp"
 #include "d3d10state.hpp"
 
@@ -238,12 +239,7 @@ getRenderTargetViewImage(ID3D11DeviceContext *pDevice,
                 dst[4*x + 3] = ((float *)src)[4*x + 3] * scale;
             }
         } else if (Desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM) {
-            for (unsigned x = 0; x < Width; ++x) {
-                dst[4*x + 0] = src[4*x + 2];
-                dst[4*x + 1] = src[4*x + 1];
-                dst[4*x + 2] = src[4*x + 0];
-                dst[4*x + 3] = src[4*x + 3];
-            }
+            image::swapRedBlue(dst, src, Width);
         } else {
             assert(0);
         }
@@ -291,6 +287,11 @@ dumpFramebuffer(JSONWriter &json, ID3D11DeviceContext *pDevice)
     ID3D11RenderTargetView *pRenderTargetViews[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
     pDevice->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, pRenderTargetViews, NULL);
 
+    /* The staging copies and maps must stay on this thread (immediate
+     * context calls are not free-threaded), so only the PNG encode of
+     * each render target runs on the queue's workers. */
+    ImageDumpQueue queue(json.hasBinarySidecar());
+
     for (UINT i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; ++i) {
         if (!pRenderTargetViews[i]) {
             continue;
@@ -301,14 +302,14 @@ dumpFramebuffer(JSONWriter &json, ID3D11DeviceContext *pDevice)
         if (image) {
             char label[64];
             _snprintf(label, sizeof label, "RENDER_TARGET_%u", i);
-            json.beginMember(label);
-            json.writeImage(image, "UNKNOWN");
-            json.endMember(); // RENDER_TARGET_*
+            queue.push(label, image, "UNKNOWN", 1);
         }
 
         pRenderTargetViews[i]->Release();
     }
 
+    queue.flush(json);
+
     json.endObject();
     json.endMember(); // framebuffer
 }
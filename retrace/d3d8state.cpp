@@ -32,6 +32,7 @@
 #include "d3dshader.hpp"
 #include "d3dstate.hpp"
 #include "json.hpp"
+#include "retrace.hpp"
 
 
 namespace d3dstate {
@@ -113,6 +114,9 @@ void
 dumpDevice(std::ostream &os, IDirect3DDevice8 *pDevice)
 {
     JSONWriter json(os);
+    if (retrace::stateBinarySidecar) {
+        json.setBinarySidecar(*retrace::stateBinarySidecar);
+    }
 
     /* TODO */
     json.beginMember("parameters");
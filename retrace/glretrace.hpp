@@ -26,17 +26,50 @@
 #ifndef _GLRETRACE_HPP_
 #define _GLRETRACE_HPP_
 
+#include <map>
+#include <utility>
+
 #include "glws.hpp"
 #include "retrace.hpp"
 
 
 namespace glretrace {
 
+/**
+ * Shadow of frequently re-set context state, used by the
+ * --skip-redundant-state filter (see glretrace_statefilter.cpp).
+ * Absent map entries and the zero/negative sentinels mean unknown.
+ */
+struct StateShadow {
+    GLenum activeTexture;                       // 0 = unknown
+    GLint program;                              // -1 = unknown
+    unsigned generation;                        // see invalidateStateShadows
+    std::map<GLenum, GLuint> bufferBindings;
+    std::map<std::pair<GLenum, GLenum>, GLuint> textureBindings;  // (unit, target)
+    std::map<std::pair<GLenum, GLenum>, GLboolean> capabilities;  // (unit, cap)
+
+    StateShadow() :
+        activeTexture(0),
+        program(-1),
+        generation(0)
+    {}
+
+    void clear(void) {
+        activeTexture = 0;
+        program = -1;
+        bufferBindings.clear();
+        textureBindings.clear();
+        capabilities.clear();
+    }
+};
+
 struct Context {
     Context(glws::Context* context)
         : wsContext(context),
           drawable(0),
           activeProgram(0),
+          stagingPbo(0),
+          pixelPackBuffer(-1),
           used(false)
     {
     }
@@ -49,6 +82,18 @@ struct Context {
     glws::Drawable *drawable;
 
     GLuint activeProgram;
+
+    // Pixel-unpack buffer used to stage large texture uploads, created
+    // on first use (see stagePixels).
+    GLuint stagingPbo;
+
+    // Shadow of GL_PIXEL_PACK_BUFFER_BINDING, or -1 when it must be
+    // re-queried (see boundPixelPackBuffer).
+    GLint pixelPackBuffer;
+
+    // Shadow used by the --skip-redundant-state filter.
+    StateShadow stateShadow;
+
     bool used;
     
     // Context must be current
@@ -61,6 +106,10 @@ struct Context {
 extern bool insideList;
 extern bool insideGlBeginEnd;
 
+/* Number of live GL contexts; waits can only be elided safely while
+ * there is at most one (see elideSync). */
+extern unsigned contextCount;
+
 
 Context *
 getCurrentContext(void);
@@ -89,6 +138,37 @@ bool
 makeCurrent(trace::Call &call, glws::Drawable *drawable, Context *context);
 
 
+bool
+elideSync(trace::Call &call);
+
+
+/*
+ * --skip-redundant-state filter (glretrace_statefilter.cpp).  The
+ * shadow* helpers return true when the call would set already-current
+ * state and should be dropped; otherwise they record the new state.
+ */
+
+bool
+shadowActiveTexture(GLenum texture);
+
+bool
+shadowBindTexture(GLenum target, GLuint texture);
+
+bool
+shadowBindBuffer(GLenum target, GLuint buffer);
+
+bool
+shadowUseProgram(GLuint program);
+
+bool
+shadowCapability(GLenum cap, GLboolean enable);
+
+void
+dirtyStateShadow(void);
+
+void
+invalidateStateShadows(void);
+
 void
 checkGlError(trace::Call &call);
 
@@ -104,10 +184,40 @@ void initContext();
 
 void updateDrawable(int width, int height);
 
+void applyPendingResize(void);
+
 void flushQueries();
 void beginProfile(trace::Call &call, bool isDraw);
 void endProfile(trace::Call &call, bool isDraw);
 
+/* Program binary cache (see glretrace_shadercache.cpp). */
+bool linkProgramFromCache(GLuint program);
+void saveLinkedProgram(GLuint program);
+
+/* Staging of large texture uploads through a pixel-unpack buffer (see
+ * glretrace_main.cpp). */
+const GLvoid *stagePixels(const GLvoid *pixels, const trace::Value &value);
+void unstagePixels(void);
+
+/* Memoized pack buffer binding, used by the generated pack-function
+ * no-op checks (see glretrace_main.cpp). */
+GLint boundPixelPackBuffer(void);
+void notePixelPackBuffer(GLuint buffer);
+void dirtyPixelPackBuffer(void);
+
+/* Per-frame buffer-update pattern counters for the profile stream,
+ * fed by the generated buffer handlers (see glretrace_main.cpp). */
+void noteBufferData(trace::Call &call);
+void noteBufferSubData(void);
+void noteBufferMap(void);
+void noteBufferMapRange(GLbitfield access);
+void noteBufferFlush(void);
+
+/* Scissor draws down to a single pixel on frames elided by
+ * --fast-replay (see glretrace_main.cpp). */
+void fastDrawBegin(void);
+void fastDrawEnd(void);
+
 } /* namespace glretrace */
 
 
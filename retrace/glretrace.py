@@ -163,6 +163,30 @@ class GlRetracer(Retracer):
         'glMapObjectBufferATI',
     ])
 
+    # Buffer-update pattern metrics (see glretrace::noteBufferData)
+    buffer_data_function_names = set([
+        'glBufferData',
+        'glBufferDataARB',
+        'glNamedBufferDataEXT',
+    ])
+
+    buffer_subdata_function_names = set([
+        'glBufferSubData',
+        'glBufferSubDataARB',
+        'glNamedBufferSubDataEXT',
+    ])
+
+    map_range_function_names = set([
+        'glMapBufferRange',
+        'glMapNamedBufferRangeEXT',
+    ])
+
+    flush_mapped_function_names = set([
+        'glFlushMappedBufferRange',
+        'glFlushMappedBufferRangeAPPLE',
+        'glFlushMappedNamedBufferRangeEXT',
+    ])
+
     unmap_function_names = set([
         'glUnmapBuffer',
         'glUnmapBufferARB',
@@ -171,6 +195,17 @@ class GlRetracer(Retracer):
         'glUnmapObjectBufferATI',
     ])
 
+    # Texture uploads worth staging through the pixel-unpack buffer
+    texture_upload_function_names = set([
+        'glTexImage2D',
+        'glTexImage3D',
+        'glTexImage3DEXT',
+        'glTexSubImage2D',
+        'glTexSubImage2DEXT',
+        'glTexSubImage3D',
+        'glTexSubImage3DEXT',
+    ])
+
     def retraceFunctionBody(self, function):
         is_array_pointer = function.name in self.array_pointer_function_names
         is_draw_array = function.name in self.draw_array_function_names
@@ -196,14 +231,32 @@ class GlRetracer(Retracer):
             
             print '    }'
 
-        # When no pack buffer object is bound, the pack functions are no-ops.
+        # When no pack buffer object is bound, the pack functions are
+        # no-ops.  The binding is memoized per context rather than
+        # queried from the driver on every call.
         if function.name in self.pack_function_names:
-            print '    GLint _pack_buffer = 0;'
-            print '    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &_pack_buffer);'
-            print '    if (!_pack_buffer) {'
+            print '    if (!glretrace::boundPixelPackBuffer()) {'
             print '        return;'
             print '    }'
 
+        # Draws render into the drawable, so any deferred resize must
+        # land first.
+        if is_draw_array or is_draw_elements or is_misc_draw:
+            print '    glretrace::applyPendingResize();'
+
+        # Buffer-update pattern metrics for the profile stream
+        if function.name in self.buffer_data_function_names:
+            print '    glretrace::noteBufferData(call);'
+        if function.name in self.buffer_subdata_function_names:
+            print '    glretrace::noteBufferSubData();'
+        if function.name in self.map_function_names:
+            if function.name in self.map_range_function_names:
+                print '    glretrace::noteBufferMapRange((GLbitfield)(call.arg(3)).toUInt());'
+            else:
+                print '    glretrace::noteBufferMap();'
+        if function.name in self.flush_mapped_function_names:
+            print '    glretrace::noteBufferFlush();'
+
         # Pre-snapshots
         if function.name in self.bind_framebuffer_function_names:
             print '    assert(call.flags & trace::CALL_FLAG_SWAP_RENDERTARGET);'
@@ -223,6 +276,62 @@ class GlRetracer(Retracer):
 
 
     def invokeFunction(self, function):
+        # Waits add nothing within a single self-ordered context; drop
+        # them under --no-syncs unless an outstanding mapping or a
+        # second context could observe the difference.  Fence creation
+        # and deletion stay, so sync object swizzling is unaffected.
+        if function.name in ('glFinish', 'glClientWaitSync', 'glWaitSync'):
+            print '    if (glretrace::elideSync(call)) {'
+            print '        return;'
+            print '    }'
+
+        # --skip-redundant-state: drop calls that set already-current state.
+        # The shadow helpers return false -- and merely record -- when the
+        # filter is disabled or cannot be applied safely.
+        if function.name in ('glActiveTexture', 'glActiveTextureARB'):
+            print '    if (glretrace::shadowActiveTexture(texture)) {'
+            print '        return;'
+            print '    }'
+        if function.name in ('glBindTexture', 'glBindTextureEXT'):
+            print '    if (glretrace::shadowBindTexture(target, texture)) {'
+            print '        return;'
+            print '    }'
+        if function.name in ('glBindBuffer', 'glBindBufferARB'):
+            print '    if (glretrace::shadowBindBuffer(target, buffer)) {'
+            print '        return;'
+            print '    }'
+        if function.name == 'glUseProgram':
+            print '    if (glretrace::shadowUseProgram(program)) {'
+            print '        return;'
+            print '    }'
+        if function.name == 'glEnable':
+            print '    if (glretrace::shadowCapability(cap, GL_TRUE)) {'
+            print '        return;'
+            print '    }'
+        if function.name == 'glDisable':
+            print '    if (glretrace::shadowCapability(cap, GL_FALSE)) {'
+            print '        return;'
+            print '    }'
+        # State changing behind the shadow's back: empty it.  Deletes can
+        # unbind, the attribute stacks and display lists can restore or set
+        # anything, indexed enables alias the non-indexed capability state,
+        # DSA binds touch units other than the active one, and the indexed
+        # buffer binding points also set the generic target binding.
+        if function.name in ('glPopAttrib', 'glPopClientAttrib',
+                             'glCallList', 'glCallLists',
+                             'glDeleteTextures', 'glDeleteTexturesEXT',
+                             'glDeleteBuffers', 'glDeleteBuffersARB',
+                             'glDeleteProgram', 'glDeleteObjectARB',
+                             'glUseProgramObjectARB',
+                             'glEnablei', 'glDisablei',
+                             'glEnableIndexedEXT', 'glDisableIndexedEXT',
+                             'glBindMultiTextureEXT',
+                             'glBindBufferBase', 'glBindBufferBaseEXT',
+                             'glBindBufferBaseNV',
+                             'glBindBufferRange', 'glBindBufferRangeEXT',
+                             'glBindBufferRangeNV'):
+            print '    glretrace::dirtyStateShadow();'
+
         # Infer the drawable size from GL calls
         if function.name == "glViewport":
             print '    glretrace::updateDrawable(x + width, y + height);'
@@ -245,6 +354,9 @@ class GlRetracer(Retracer):
             # Some applications do all their rendering in a framebuffer, and
             # then just blit to the drawable without ever calling glViewport.
             print '    glretrace::updateDrawable(std::max(dstX0, dstX1), std::max(dstY0, dstY1));'
+            # This updateDrawable runs after the pre-draw flush above,
+            # so apply again right before the blit itself.
+            print '    glretrace::applyPendingResize();'
 
         if function.name == "glEnd":
             print '    glretrace::insideGlBeginEnd = false;'
@@ -319,6 +431,10 @@ class GlRetracer(Retracer):
                 print r'        glretrace::beginProfile(call, false);'
             print r'    }'
 
+        # --fast-replay: clamp fill rate on frames outside the selected set
+        if profileDraw:
+            print r'    glretrace::fastDrawBegin();'
+
         if function.name == 'glCreateShaderProgramv':
             # When dumping state, break down glCreateShaderProgramv so that the
             # shader source can be recovered.
@@ -347,12 +463,42 @@ class GlRetracer(Retracer):
             print r'    } else {'
             Retracer.invokeFunction(self, function)
             print r'    }'
+        elif function.name == 'glLinkProgram':
+            # Satisfy the link from the program binary cache when enabled
+            print r'    if (!glretrace::linkProgramFromCache(program)) {'
+            Retracer.invokeFunction(self, function)
+            print r'        glretrace::saveLinkedProgram(program);'
+            print r'    }'
+        elif function.name in self.texture_upload_function_names:
+            # Stream large uploads through the staging unpack buffer.  When
+            # the application sourced the call from its own unpack buffer the
+            # traced argument is an offset rather than a blob, and it passes
+            # through unmodified.
+            print r'    pixels = const_cast<GLvoid *>(glretrace::stagePixels(pixels, call.arg(%u)));' % function.argNames().index('pixels')
+            Retracer.invokeFunction(self, function)
+            print r'    glretrace::unstagePixels();'
         else:
             Retracer.invokeFunction(self, function)
 
+        # Keep the pack buffer binding shadow honest (see
+        # glretrace::boundPixelPackBuffer).  Deleting buffers can unbind
+        # the shadowed buffer, and the client attribute stack can
+        # restore an older binding, so those force a re-query.
+        if function.name in ('glBindBuffer', 'glBindBufferARB'):
+            print '    if (target == GL_PIXEL_PACK_BUFFER) {'
+            print '        glretrace::notePixelPackBuffer(buffer);'
+            print '    }'
+        if function.name in ('glDeleteBuffers', 'glDeleteBuffersARB',
+                             'glPushClientAttrib', 'glPopClientAttrib'):
+            print '    glretrace::dirtyPixelPackBuffer();'
+
         if function.name == "glBegin":
             print '    glretrace::insideGlBeginEnd = true;'
 
+        # The glBegin clamp stays in place until the matching glEnd
+        if profileDraw or function.name == 'glEnd':
+            print r'    glretrace::fastDrawEnd();'
+
         print r'    if (!glretrace::insideList && !glretrace::insideGlBeginEnd && retrace::profiling) {'
         if profileDraw:
             print r'        glretrace::endProfile(call, true);'
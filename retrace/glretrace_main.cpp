@@ -27,6 +27,7 @@
 #include <string.h>
 
 #include "retrace.hpp"
+#include "retrace_swizzle.hpp"
 #include "glproc.hpp"
 #include "glstate.hpp"
 #include "glretrace.hpp"
@@ -65,12 +66,115 @@ static bool supportsElapsed = true;
 static bool supportsTimestamp = true;
 static bool supportsOcclusion = true;
 static bool supportsDebugOutput = true;
+static bool supportsMemInfoNVX = false;
+static bool supportsMemInfoATI = false;
+
+/*
+ * Query results are not collected as soon as a frame ends, because the
+ * GPU is typically still chewing on it; asking right away stalls the
+ * pipeline once per frame.  Finished frames are instead parked here and
+ * only collected once their last query result has landed, or when the
+ * ring grows this deep, whichever comes first.  The profiler is fed in
+ * frame order either way.
+ */
+#define MAX_PENDING_FRAMES 4
 
 static std::list<CallQuery> callQueries;
+static std::list< std::list<CallQuery> > pendingFrameQueries;
+
+/* Free VRAM sampled when each pending frame ended, so the value still
+ * matches the frame once its deferred queries are finally collected. */
+static std::list<int64_t> pendingFrameVram;
+
+/*
+ * Per-frame counters of application buffer-update patterns: orphaning
+ * via glBufferData(NULL), map access flags, explicit flushed ranges.
+ * Replay performance on these patterns is strongly driver-dependent,
+ * so the counters are recorded into the profile stream alongside each
+ * frame's timings (see Profiler::addBufferMetrics); the generated
+ * glBufferData/glMapBufferRange handlers feed them through the
+ * noteBuffer* entry points.
+ */
+struct BufferMetrics {
+    uint32_t orphans;
+    uint32_t respecifications;
+    uint32_t subUploads;
+    uint32_t maps;
+    uint32_t invalidateMaps;
+    uint32_t unsyncMaps;
+    uint32_t flushes;
+
+    bool any(void) const {
+        return (orphans | respecifications | subUploads |
+                maps | invalidateMaps | unsyncMaps | flushes) != 0;
+    }
+
+    void reset(void) {
+        memset(this, 0, sizeof *this);
+    }
+};
+
+static BufferMetrics bufferMetrics = { 0, 0, 0, 0, 0, 0, 0 };
+
+/* Counters parked when each pending frame ended, like pendingFrameVram. */
+static std::list<BufferMetrics> pendingFrameBufferMetrics;
+
+/* Recycled query objects; glGenQueries/glDeleteQueries per call shows
+ * up in drivers' profiles. */
+static std::vector<GLuint> queryPool;
+
+static void
+genCallQueries(GLuint *ids) {
+    if (queryPool.size() < NUM_QUERIES) {
+        GLuint fresh[16 * NUM_QUERIES];
+        glGenQueries(16 * NUM_QUERIES, fresh);
+        queryPool.insert(queryPool.end(), fresh, fresh + 16 * NUM_QUERIES);
+    }
+    for (int i = 0; i < NUM_QUERIES; ++i) {
+        ids[i] = queryPool.back();
+        queryPool.pop_back();
+    }
+}
+
+static void
+recycleCallQueries(const GLuint *ids) {
+    queryPool.insert(queryPool.end(), ids, ids + NUM_QUERIES);
+}
 
 static void APIENTRY
 debugOutputCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, GLvoid* userParam);
 
+/**
+ * Decide whether a recorded wait (glFinish, glClientWaitSync,
+ * glWaitSync) can be dropped under --no-syncs.
+ *
+ * Within a single context the GL command stream is self-ordered:
+ * readbacks, query results and pixel transfers already observe every
+ * prior command, so waits that applications insert for their own CPU
+ * scheduling (fence-heavy VR loops especially) only serialize the
+ * replay.  They do still matter when results can be observed outside
+ * that ordering -- through an outstanding buffer mapping the CPU may
+ * scribble over, or across contexts via sync objects -- so waits are
+ * honored whenever either is the case.  Single-buffered replays also
+ * keep their waits, since glFinish doubles as the frame marker there.
+ */
+bool
+elideSync(trace::Call &call) {
+    if (!retrace::elideSyncs) {
+        return false;
+    }
+    if (!retrace::doubleBuffer) {
+        return false;
+    }
+    if (contextCount > 1) {
+        return false;
+    }
+    if (retrace::hasRegions()) {
+        return false;
+    }
+    return true;
+}
+
 void
 checkGlError(trace::Call &call) {
     GLenum error = glGetError();
@@ -124,7 +228,9 @@ getCurrentTime(void) {
         glGetInteger64v(GL_TIMESTAMP, &timestamp);
         return timestamp;
     } else {
-        return os::getTime();
+        /* rdtsc-class read; two syscalls per call would otherwise
+         * dwarf the short calls being measured */
+        return os::getTimeFast();
     }
 }
 
@@ -133,7 +239,7 @@ getTimeFrequency(void) {
     if (retrace::profilingGpuTimes && supportsTimestamp) {
         return 1000000000;
     } else {
-        return os::timeFrequency;
+        return os::calibrateFastTime();
     }
 }
 
@@ -155,6 +261,7 @@ completeCallQuery(CallQuery& query) {
             glGetQueryObjecti64vEXT(query.ids[OCCLUSION], GL_QUERY_RESULT, &pixels);
         }
 
+        recycleCallQueries(query.ids);
     } else {
         pixels = -1;
     }
@@ -163,19 +270,131 @@ completeCallQuery(CallQuery& query) {
         cpuDuration = query.cpuEnd - query.cpuStart;
     }
 
-    glDeleteQueries(NUM_QUERIES, query.ids);
-
     /* Add call to profile */
     retrace::profiler.addCall(query.call, query.sig->name, query.program, pixels, gpuStart, gpuDuration, query.cpuStart, cpuDuration);
 }
 
+static void
+completeFrameQueries(std::list<CallQuery> &queries) {
+    for (std::list<CallQuery>::iterator itr = queries.begin(); itr != queries.end(); ++itr) {
+        completeCallQuery(*itr);
+    }
+
+    queries.clear();
+}
+
+/**
+ * Whether the last query of the frame's batch has a result; queries
+ * complete in issue order, so the rest of the batch has too.
+ */
+static bool
+frameQueriesReady(std::list<CallQuery> &queries) {
+    for (std::list<CallQuery>::reverse_iterator itr = queries.rbegin(); itr != queries.rend(); ++itr) {
+        if (!itr->isDraw) {
+            continue;
+        }
+
+        GLuint id;
+        if (retrace::profilingPixelsDrawn) {
+            id = itr->ids[OCCLUSION];
+        } else {
+            id = itr->ids[GPU_DURATION];
+        }
+
+        GLint available = 0;
+        glGetQueryObjectiv(id, GL_QUERY_RESULT_AVAILABLE, &available);
+        return available != 0;
+    }
+
+    /* No GPU queries at all -- nothing to wait for */
+    return true;
+}
+
+/**
+ * Free video memory in KB, or -1 when no meminfo extension is
+ * available.  A glGetIntegerv on either extension's token is a cheap
+ * driver-side read, not a pipeline sync.
+ */
+static int64_t
+sampleGpuMemory(void) {
+    if (supportsMemInfoNVX) {
+        GLint kb = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &kb);
+        return kb;
+    }
+    if (supportsMemInfoATI) {
+        GLint params[4] = {0, 0, 0, 0};
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, params);
+        return params[0];
+    }
+    return -1;
+}
+
+/**
+ * Hand one deferred frame's results to the profiler.
+ */
+static void
+popFrameEnd(void) {
+    if (!pendingFrameBufferMetrics.empty()) {
+        const BufferMetrics &metrics = pendingFrameBufferMetrics.front();
+        if (metrics.any()) {
+            retrace::profiler.addBufferMetrics(metrics.orphans,
+                                               metrics.respecifications,
+                                               metrics.subUploads,
+                                               metrics.maps,
+                                               metrics.invalidateMaps,
+                                               metrics.unsyncMaps,
+                                               metrics.flushes);
+        }
+        pendingFrameBufferMetrics.pop_front();
+    }
+
+    int64_t vramFreeKb = -1;
+    if (!pendingFrameVram.empty()) {
+        vramFreeKb = pendingFrameVram.front();
+        pendingFrameVram.pop_front();
+    }
+    retrace::profiler.addFrameEnd(vramFreeKb);
+}
+
+/**
+ * Park the current frame's queries and collect whichever pending
+ * frames have finished, stalling only when the ring is full.
+ */
+static void
+harvestQueries(void) {
+    pendingFrameQueries.push_back(std::list<CallQuery>());
+    pendingFrameQueries.back().swap(callQueries);
+    pendingFrameVram.push_back(sampleGpuMemory());
+    pendingFrameBufferMetrics.push_back(bufferMetrics);
+    bufferMetrics.reset();
+
+    while (!pendingFrameQueries.empty() &&
+           (pendingFrameQueries.size() > MAX_PENDING_FRAMES ||
+            frameQueriesReady(pendingFrameQueries.front()))) {
+        completeFrameQueries(pendingFrameQueries.front());
+        pendingFrameQueries.pop_front();
+
+        /* Indicate end of that frame */
+        popFrameEnd();
+    }
+}
+
 void
 flushQueries() {
-    for (std::list<CallQuery>::iterator itr = callQueries.begin(); itr != callQueries.end(); ++itr) {
-        completeCallQuery(*itr);
+    /* Deferred frames first, so their frame markers stay in order */
+    while (!pendingFrameQueries.empty()) {
+        completeFrameQueries(pendingFrameQueries.front());
+        pendingFrameQueries.pop_front();
+        popFrameEnd();
     }
 
-    callQueries.clear();
+    completeFrameQueries(callQueries);
+
+    if (!queryPool.empty()) {
+        glDeleteQueries(queryPool.size(), &queryPool[0]);
+        queryPool.clear();
+    }
 }
 
 void
@@ -189,10 +408,10 @@ beginProfile(trace::Call &call, bool isDraw) {
     query.sig = call.sig;
     query.program = currentContext ? currentContext->activeProgram : 0;
 
-    glGenQueries(NUM_QUERIES, query.ids);
-
     /* GPU profiling only for draw calls */
     if (isDraw) {
+        genCallQueries(query.ids);
+
         if (retrace::profilingGpuTimes) {
             if (supportsTimestamp) {
                 glQueryCounter(query.ids[GPU_START], GL_TIMESTAMP);
@@ -246,6 +465,8 @@ initContext() {
     supportsElapsed     = currentContext->hasExtension("GL_EXT_timer_query") || supportsTimestamp;
     supportsOcclusion   = currentContext->hasExtension("GL_ARB_occlusion_query");
     supportsDebugOutput = currentContext->hasExtension("GL_ARB_debug_output");
+    supportsMemInfoNVX  = currentContext->hasExtension("GL_NVX_gpu_memory_info");
+    supportsMemInfoATI  = currentContext->hasExtension("GL_ATI_meminfo");
 
     /* Check for timer query support */
     if (retrace::profilingGpuTimes) {
@@ -282,6 +503,10 @@ initContext() {
     /* Sync the gpu and cpu start times */
     if (retrace::profilingCpuTimes || retrace::profilingGpuTimes) {
         if (!retrace::profiler.hasBaseTimes()) {
+            /* calibrates the fast clock, so must precede the base
+             * time measurement */
+            retrace::profiler.setCpuTimeFrequency(getTimeFrequency());
+
             GLint64 currentTime = getCurrentTime();
             retrace::profiler.setBaseCpuTime(currentTime);
             retrace::profiler.setBaseGpuTime(currentTime);
@@ -291,12 +516,14 @@ initContext() {
 
 void
 frame_complete(trace::Call &call) {
-    if (retrace::profiling) {
-        /* Complete any remaining queries */
-        flushQueries();
+    /* A resize deferred past the frame's last draw still belongs to
+     * this frame (snapshots compare against the final geometry) */
+    applyPendingResize();
 
-        /* Indicate end of current frame */
-        retrace::profiler.addFrameEnd();
+    if (retrace::profiling) {
+        /* Batch the frame's queries; only frames whose results have
+         * already landed are collected now */
+        harvestQueries();
     }
 
     retrace::frameComplete(call);
@@ -375,6 +602,223 @@ debugOutputCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsi
     std::cerr << std::endl;
 }
 
+/*
+ * Large texture uploads otherwise hand the driver a pointer into
+ * parser-owned memory, which it must synchronously copy out of before
+ * the call can return.  Staging such uploads through a pixel-unpack
+ * buffer lets the driver transfer from memory it allocated (and can
+ * pin) itself, and the buffer is orphaned on every upload so
+ * back-to-back uploads do not serialize against each other.
+ *
+ * Staging only kicks in when the traced argument really is a blob: if
+ * the application had an unpack buffer bound, the argument is an
+ * offset into that buffer and must be passed through untouched.
+ */
+
+enum {
+    STAGE_PIXELS_THRESHOLD = 128 * 1024
+};
+
+static bool pixelsStaged = false;
+
+const GLvoid *
+stagePixels(const GLvoid *pixels, const trace::Value &value) {
+    const trace::Blob *blob = dynamic_cast<const trace::Blob *>(&value);
+    if (!blob || blob->size < STAGE_PIXELS_THRESHOLD) {
+        return pixels;
+    }
+
+    if (insideList || insideGlBeginEnd) {
+        return pixels;
+    }
+
+    Context *currentContext = getCurrentContext();
+    if (!currentContext ||
+        !currentContext->hasExtension("GL_ARB_pixel_buffer_object")) {
+        return pixels;
+    }
+
+    if (!currentContext->stagingPbo) {
+        glGenBuffers(1, &currentContext->stagingPbo);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, currentContext->stagingPbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, blob->size, NULL, GL_STREAM_DRAW);
+
+    GLvoid *map = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (!map) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return pixels;
+    }
+
+    memcpy(map, pixels, blob->size);
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        /* The mapping was lost; fall back to the unstaged path. */
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return pixels;
+    }
+
+    pixelsStaged = true;
+
+    /* The upload now sources from offset 0 of the staging buffer. */
+    return NULL;
+}
+
+void
+unstagePixels(void) {
+    if (pixelsStaged) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixelsStaged = false;
+    }
+}
+
+
+/*
+ * The generated handlers probe GL_PIXEL_PACK_BUFFER_BINDING before
+ * every pack function to decide whether the readback lands in a buffer
+ * object (and must execute) or in discarded client memory (and can be
+ * skipped).  The probe is a synchronous driver round-trip per readback
+ * call -- painful over indirect GLX -- so the binding is shadowed here
+ * per context, tracked through glBindBuffer and re-queried only after
+ * the few calls that can change it behind our back (buffer deletion
+ * and the client attribute stack).
+ */
+
+GLint
+boundPixelPackBuffer(void) {
+    Context *currentContext = getCurrentContext();
+    if (!currentContext) {
+        return 0;
+    }
+    if (currentContext->pixelPackBuffer < 0) {
+        GLint _pack_buffer = 0;
+        glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &_pack_buffer);
+        currentContext->pixelPackBuffer = _pack_buffer;
+    }
+    return currentContext->pixelPackBuffer;
+}
+
+void
+notePixelPackBuffer(GLuint buffer) {
+    Context *currentContext = getCurrentContext();
+    if (currentContext) {
+        currentContext->pixelPackBuffer = buffer;
+    }
+}
+
+void
+dirtyPixelPackBuffer(void) {
+    Context *currentContext = getCurrentContext();
+    if (currentContext) {
+        currentContext->pixelPackBuffer = -1;
+    }
+}
+
+
+/*
+ * Buffer-update pattern entry points, called by the generated
+ * glBufferData/glMapBuffer/glFlushMappedBufferRange handlers.  Only
+ * counted while profiling; otherwise the handlers stay free of
+ * per-call overhead.
+ */
+
+void
+noteBufferData(trace::Call &call) {
+    if (!retrace::profiling) {
+        return;
+    }
+    // glBufferData and glNamedBufferDataEXT both carry the data
+    // pointer as their third argument; a NULL pointer respecifies the
+    // store without contents, i.e. the classic orphaning idiom.
+    if (call.arg(2).toBool()) {
+        ++bufferMetrics.respecifications;
+    } else {
+        ++bufferMetrics.orphans;
+    }
+}
+
+void
+noteBufferSubData(void) {
+    if (retrace::profiling) {
+        ++bufferMetrics.subUploads;
+    }
+}
+
+void
+noteBufferMap(void) {
+    if (retrace::profiling) {
+        ++bufferMetrics.maps;
+    }
+}
+
+void
+noteBufferMapRange(GLbitfield access) {
+    if (!retrace::profiling) {
+        return;
+    }
+    ++bufferMetrics.maps;
+    if (access & (GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT)) {
+        ++bufferMetrics.invalidateMaps;
+    }
+    if (access & GL_MAP_UNSYNCHRONIZED_BIT) {
+        ++bufferMetrics.unsyncMaps;
+    }
+}
+
+void
+noteBufferFlush(void) {
+    if (retrace::profiling) {
+        ++bufferMetrics.flushes;
+    }
+}
+
+
+/*
+ * --fast-replay support.  Draws on frames outside the selected set
+ * still execute -- state changes, query results and feedback paths
+ * stay correct -- but with the scissor clamped to a single pixel so
+ * they cost no fill rate.  The traced scissor state is saved around
+ * each draw and restored afterwards, as the application is free to
+ * change it between draws.
+ *
+ * glBegin/glEnd pairs are clamped as a whole: the scissor cannot be
+ * changed inside the pair, so the clamp goes in at glBegin and comes
+ * out at glEnd.
+ */
+
+static bool fastDrawActive = false;
+static GLboolean fastDrawScissorEnabled = GL_FALSE;
+static GLint fastDrawScissorBox[4];
+
+void
+fastDrawBegin(void) {
+    if (!retrace::fastFrame ||
+        fastDrawActive || insideList || insideGlBeginEnd) {
+        return;
+    }
+
+    fastDrawScissorEnabled = glIsEnabled(GL_SCISSOR_TEST);
+    glGetIntegerv(GL_SCISSOR_BOX, fastDrawScissorBox);
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, 1, 1);
+    fastDrawActive = true;
+}
+
+void
+fastDrawEnd(void) {
+    if (!fastDrawActive || insideGlBeginEnd) {
+        return;
+    }
+
+    glScissor(fastDrawScissorBox[0], fastDrawScissorBox[1],
+              fastDrawScissorBox[2], fastDrawScissorBox[3]);
+    if (!fastDrawScissorEnabled) {
+        glDisable(GL_SCISSOR_TEST);
+    }
+    fastDrawActive = false;
+}
+
 } /* namespace glretrace */
 
 
@@ -385,7 +829,33 @@ public:
         if (!glretrace::getCurrentContext()) {
             return NULL;
         }
-        return glstate::getDrawBufferImage();
+        glretrace::applyPendingResize();
+        return glstate::getDrawBufferImage(retrace::snapshotX,
+                                           retrace::snapshotY,
+                                           retrace::snapshotWidth,
+                                           retrace::snapshotHeight,
+                                           retrace::snapshotDownsample);
+    }
+
+    bool
+    startSnapshot(void) {
+        if (!glretrace::getCurrentContext()) {
+            return false;
+        }
+        glretrace::applyPendingResize();
+        return glstate::startDrawBufferReadback(retrace::snapshotX,
+                                                retrace::snapshotY,
+                                                retrace::snapshotWidth,
+                                                retrace::snapshotHeight,
+                                                retrace::snapshotDownsample);
+    }
+
+    image::Image *
+    finishSnapshot(void) {
+        if (!glretrace::getCurrentContext()) {
+            return NULL;
+        }
+        return glstate::finishDrawBufferReadback();
     }
 
     bool
@@ -405,6 +875,7 @@ static GLDumper glDumper;
 
 void
 retrace::setUp(void) {
+    glws::headless = retrace::headless;
     glws::init();
     dumper = &glDumper;
 }
@@ -0,0 +1,294 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Persistent program binary cache (--program-cache).
+ *
+ * Shader compilation dominates the first minute of replaying
+ * content-heavy traces, and repeats identically on every nightly run
+ * against the same driver.  When a cache directory is given, linked
+ * programs are stored via GL_ARB_get_program_binary, keyed by a hash
+ * of the driver identity strings and the attached shader sources, and
+ * glLinkProgram is satisfied from the cache on subsequent replays.
+ *
+ * The key covers what can be queried from an unlinked program; state
+ * set through separate calls before linking (attribute bindings,
+ * transform feedback varyings) is not part of it.  That state is
+ * captured inside the cached binary, and is deterministic when the
+ * same trace is replayed again -- the intended use.  Traces that link
+ * identical sources under different pre-link state within one replay
+ * could alias; hence the cache is opt-in.
+ */
+
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "os.hpp"
+#include "retrace.hpp"
+#include "glproc.hpp"
+#include "glretrace.hpp"
+
+
+namespace glretrace {
+
+
+/* -1 not probed yet, else boolean; the driver cannot change
+ * mid-replay. */
+static int binarySupport = -1;
+
+static bool dirCreated = false;
+
+
+static bool
+checkBinarySupport(void)
+{
+    if (binarySupport < 0) {
+        GLint numFormats = 0;
+        Context *currentContext = getCurrentContext();
+        if (currentContext &&
+            currentContext->hasExtension("GL_ARB_get_program_binary")) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        }
+        binarySupport = numFormats > 0;
+        if (!binarySupport) {
+            std::cerr << "warning: program cache disabled: "
+                         "GL_ARB_get_program_binary not usable\n";
+        }
+    }
+    return binarySupport != 0;
+}
+
+
+/* FNV-1a */
+static inline uint64_t
+hashBytes(const void *data, size_t size, uint64_t hash)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/*
+ * Key the program by driver identity and the attached shader sources.
+ * Returns false when the program has nothing hashable attached.
+ */
+static bool
+hashProgram(GLuint program, uint64_t &hash)
+{
+    hash = 14695981039346656037ULL;
+
+    static const GLenum driverStrings[3] = {
+        GL_VENDOR,
+        GL_RENDERER,
+        GL_VERSION
+    };
+    for (int i = 0; i < 3; ++i) {
+        const char *s = (const char *)glGetString(driverStrings[i]);
+        if (s) {
+            hash = hashBytes(s, strlen(s) + 1, hash);
+        }
+    }
+
+    GLint numShaders = 0;
+    glGetProgramiv(program, GL_ATTACHED_SHADERS, &numShaders);
+    if (numShaders <= 0) {
+        return false;
+    }
+
+    std::vector<GLuint> shaders(numShaders);
+    glGetAttachedShaders(program, numShaders, NULL, &shaders[0]);
+
+    for (GLint i = 0; i < numShaders; ++i) {
+        GLint type = 0;
+        GLint sourceLength = 0;
+        glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+        glGetShaderiv(shaders[i], GL_SHADER_SOURCE_LENGTH, &sourceLength);
+        if (sourceLength <= 0) {
+            return false;
+        }
+        std::vector<GLchar> source(sourceLength);
+        glGetShaderSource(shaders[i], sourceLength, NULL, &source[0]);
+        hash = hashBytes(&type, sizeof type, hash);
+        hash = hashBytes(&source[0], sourceLength, hash);
+    }
+
+    return true;
+}
+
+
+static std::string
+cachePath(uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof name, "%016llx.bin", (unsigned long long)hash);
+    return std::string(retrace::programCacheDir) + "/" + name;
+}
+
+
+/*
+ * Try to satisfy the upcoming glLinkProgram from the cache.  Returns
+ * true when the program was restored and the link must be skipped; on
+ * a miss the program is marked retrievable so saveLinkedProgram can
+ * populate the cache after the real link.
+ */
+bool
+linkProgramFromCache(GLuint program)
+{
+    if (!retrace::programCacheDir || !checkBinarySupport()) {
+        return false;
+    }
+
+    uint64_t hash;
+    if (!hashProgram(program, hash)) {
+        return false;
+    }
+
+    std::string path = cachePath(hash);
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                            GL_TRUE);
+        return false;
+    }
+
+    GLenum format = 0;
+    std::vector<char> binary;
+    if (fread(&format, sizeof format, 1, fp) == 1) {
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp) - sizeof format;
+        if (size > 0) {
+            binary.resize(size);
+            fseek(fp, sizeof format, SEEK_SET);
+            if (fread(&binary[0], 1, size, fp) != (size_t)size) {
+                binary.clear();
+            }
+        }
+    }
+    fclose(fp);
+
+    if (!binary.empty()) {
+        glProgramBinary(program, format, &binary[0], binary.size());
+        GLint status = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status) {
+            return true;
+        }
+    }
+
+    /* Truncated entry, or a driver build change the identity strings
+     * did not reflect: drop it and relink from source. */
+    remove(path.c_str());
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    return false;
+}
+
+
+/*
+ * Called after a real glLinkProgram on a cache miss; stores the
+ * program binary for the next replay.
+ */
+void
+saveLinkedProgram(GLuint program)
+{
+    if (!retrace::programCacheDir || binarySupport != 1) {
+        return;
+    }
+
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        return;
+    }
+
+    uint64_t hash;
+    if (!hashProgram(program, hash)) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &written, &format, &binary[0]);
+    if (written <= 0) {
+        return;
+    }
+
+    if (!dirCreated) {
+#ifdef _WIN32
+        _mkdir(retrace::programCacheDir);
+#else
+        mkdir(retrace::programCacheDir, 0755);
+#endif
+        dirCreated = true;
+    }
+
+    /* Write through a per-process temporary name and rename, so
+     * concurrent replays sharing the cache never observe a partial
+     * entry. */
+    std::string path = cachePath(hash);
+    char tmpSuffix[32];
+    snprintf(tmpSuffix, sizeof tmpSuffix, ".tmp%u", (unsigned)getpid());
+    std::string tmpPath = path + tmpSuffix;
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        return;
+    }
+    if (fwrite(&format, sizeof format, 1, fp) != 1 ||
+        fwrite(&binary[0], 1, written, fp) != (size_t)written) {
+        fclose(fp);
+        remove(tmpPath.c_str());
+        return;
+    }
+    fclose(fp);
+    rename(tmpPath.c_str(), path.c_str());
+}
+
+
+} /* namespace glretrace */
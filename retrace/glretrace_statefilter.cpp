@@ -0,0 +1,200 @@
+/**************************************************************************
+ *
+ * Copyright 2012 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Elision of redundant state-setting calls (--skip-redundant-state).
+ *
+ * Applications commonly re-set state that is already current.  The
+ * driver absorbs the redundancy, but on replay every such call still
+ * pays for parsing and dispatch, which dominates CPU-bound replays.  A
+ * small per-context shadow of the most frequently re-set state --
+ * bindings, enables and the active program -- lets the generated
+ * callbacks drop those calls before dispatch.
+ *
+ * Only state the filter can track exactly is shadowed.  Anything that
+ * can change state behind its back (display list execution, the
+ * attribute stack, object deletion) empties the shadow, and the filter
+ * stands down inside display list compilation, inside glBegin/glEnd,
+ * and whenever more than one context exists, since objects shared with
+ * another context can be deleted -- and hence unbound -- there.
+ */
+
+
+#include "glproc.hpp"
+#include "glretrace.hpp"
+
+
+namespace glretrace {
+
+
+/* Bumped by invalidateStateShadows; a shadow from an older generation
+ * is emptied before use. */
+static unsigned shadowGeneration = 0;
+
+static StateShadow *
+activeShadow(void) {
+    if (!retrace::skipRedundantState ||
+        insideList ||
+        insideGlBeginEnd ||
+        contextCount > 1) {
+        return NULL;
+    }
+
+    Context *currentContext = getCurrentContext();
+    if (!currentContext) {
+        return NULL;
+    }
+
+    StateShadow *shadow = &currentContext->stateShadow;
+    if (shadow->generation != shadowGeneration) {
+        /* State recorded before the filter last stood down (e.g.
+         * while a second context existed) cannot be trusted. */
+        shadow->clear();
+        shadow->generation = shadowGeneration;
+    }
+    return shadow;
+}
+
+/* GL_TEXTURE0 on a fresh context; re-queried after the shadow has been
+ * emptied, since the attribute stack may have restored another unit. */
+static GLenum
+activeTextureUnit(StateShadow *shadow) {
+    if (!shadow->activeTexture) {
+        GLint unit = GL_TEXTURE0;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+        shadow->activeTexture = unit;
+    }
+    return shadow->activeTexture;
+}
+
+bool
+shadowActiveTexture(GLenum texture) {
+    StateShadow *shadow = activeShadow();
+    if (!shadow) {
+        return false;
+    }
+
+    if (shadow->activeTexture && shadow->activeTexture == texture) {
+        return true;
+    }
+    shadow->activeTexture = texture;
+    return false;
+}
+
+bool
+shadowBindTexture(GLenum target, GLuint texture) {
+    StateShadow *shadow = activeShadow();
+    if (!shadow) {
+        return false;
+    }
+
+    std::pair<GLenum, GLenum> key(activeTextureUnit(shadow), target);
+    std::map<std::pair<GLenum, GLenum>, GLuint>::iterator it =
+        shadow->textureBindings.find(key);
+    if (it != shadow->textureBindings.end() && it->second == texture) {
+        return true;
+    }
+    shadow->textureBindings[key] = texture;
+    return false;
+}
+
+bool
+shadowBindBuffer(GLenum target, GLuint buffer) {
+    StateShadow *shadow = activeShadow();
+    if (!shadow) {
+        return false;
+    }
+
+    /* The element array binding is vertex array object state: every
+     * glBindVertexArray swaps it behind the shadow's back, so it
+     * cannot be tracked here. */
+    if (target == GL_ELEMENT_ARRAY_BUFFER) {
+        return false;
+    }
+
+    std::map<GLenum, GLuint>::iterator it = shadow->bufferBindings.find(target);
+    if (it != shadow->bufferBindings.end() && it->second == buffer) {
+        return true;
+    }
+    shadow->bufferBindings[target] = buffer;
+    return false;
+}
+
+bool
+shadowUseProgram(GLuint program) {
+    StateShadow *shadow = activeShadow();
+    if (!shadow) {
+        return false;
+    }
+
+    if (shadow->program >= 0 && (GLuint)shadow->program == program) {
+        return true;
+    }
+    shadow->program = program;
+    return false;
+}
+
+bool
+shadowCapability(GLenum cap, GLboolean enable) {
+    StateShadow *shadow = activeShadow();
+    if (!shadow) {
+        return false;
+    }
+
+    /* Texture enables are per texture unit in the compatibility
+     * profile, so every capability is keyed by the active unit; for
+     * the global ones this merely costs a few extra dispatches. */
+    std::pair<GLenum, GLenum> key(activeTextureUnit(shadow), cap);
+    std::map<std::pair<GLenum, GLenum>, GLboolean>::iterator it =
+        shadow->capabilities.find(key);
+    if (it != shadow->capabilities.end() && it->second == enable) {
+        return true;
+    }
+    shadow->capabilities[key] = enable;
+    return false;
+}
+
+void
+dirtyStateShadow(void) {
+    Context *currentContext = getCurrentContext();
+    if (currentContext) {
+        currentContext->stateShadow.clear();
+    }
+}
+
+/*
+ * Empty every context's shadow, lazily.  Called when a context is
+ * destroyed: while several contexts existed the filter stood down and
+ * recorded nothing, so state changed in that window would otherwise be
+ * elided against stale values once the filter re-engages.
+ */
+void
+invalidateStateShadows(void) {
+    ++shadowGeneration;
+}
+
+
+} /* namespace glretrace */
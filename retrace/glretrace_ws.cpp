@@ -41,6 +41,9 @@
 namespace glretrace {
 
 
+unsigned contextCount = 0;
+
+
 static glws::Visual *
 visuals[glws::PROFILE_MAX];
 
@@ -105,13 +108,15 @@ Context *
 createContext(Context *shareContext, glws::Profile profile) {
     glws::Visual *visual = getVisual(profile);
     glws::Context *shareWsContext = shareContext ? shareContext->wsContext : NULL;
-    glws::Context *ctx = glws::createContext(visual, shareWsContext, profile, retrace::debug);
+    glws::Context *ctx = glws::acquireContext(visual, shareWsContext, profile, retrace::debug);
     if (!ctx) {
         std::cerr << "error: failed to create OpenGL context\n";
         exit(1);
         return NULL;
     }
 
+    ++contextCount;
+
     return new Context(ctx);
 }
 
@@ -126,8 +131,12 @@ Context::~Context()
 {
     //assert(this != getCurrentContext());
     if (this != getCurrentContext()) {
-        delete wsContext;
+        glws::releaseContext(wsContext);
     }
+    --contextCount;
+    /* Surviving contexts' shadows predate the multi-context
+     * stand-down of the state filter. */
+    invalidateStateShadows();
 }
 
 
@@ -145,6 +154,9 @@ makeCurrent(trace::Call &call, glws::Drawable *drawable, Context *context)
         return true;
     }
 
+    /* Settle any deferred resize while its context is still current */
+    applyPendingResize();
+
     if (currentContext) {
         glFlush();
         if (!retrace::doubleBuffer) {
@@ -183,6 +195,17 @@ getCurrentContext(void) {
 }
 
 
+/*
+ * Deferred drawable resize.  Window system resizes are synchronous
+ * round trips on X11, so consecutive size changes within a frame are
+ * coalesced here and only the final geometry is applied before the
+ * next draw.
+ */
+static glws::Drawable *pendingDrawable = NULL;
+static int pendingWidth = 0;
+static int pendingHeight = 0;
+
+
 /**
  * Grow the current drawble.
  *
@@ -203,9 +226,20 @@ updateDrawable(int width, int height) {
         return;
     }
 
-    if (currentDrawable->visible &&
-        width  <= currentDrawable->width &&
-        height <= currentDrawable->height) {
+    /* Judge against the size the drawable will have once the pending
+     * resize is applied, as if resizes were still immediate. */
+    int effectiveWidth = currentDrawable->width;
+    int effectiveHeight = currentDrawable->height;
+    bool effectiveVisible = currentDrawable->visible;
+    if (pendingDrawable == currentDrawable) {
+        effectiveWidth = pendingWidth;
+        effectiveHeight = pendingHeight;
+        effectiveVisible = true;
+    }
+
+    if (effectiveVisible &&
+        width  <= effectiveWidth &&
+        height <= effectiveHeight) {
         return;
     }
 
@@ -221,10 +255,28 @@ updateDrawable(int width, int height) {
         return;
     }
 
-    currentDrawable->resize(width, height);
-    currentDrawable->show();
+    pendingDrawable = currentDrawable;
+    pendingWidth = width;
+    pendingHeight = height;
+}
+
+
+/**
+ * Apply a deferred resize; called before draws, at frame boundaries,
+ * and before context switches.  No-op when nothing is pending.
+ */
+void
+applyPendingResize(void) {
+    glws::Drawable *drawable = pendingDrawable;
+    if (!drawable) {
+        return;
+    }
+    pendingDrawable = NULL;
+
+    drawable->resize(pendingWidth, pendingHeight);
+    drawable->show();
 
-    glScissor(0, 0, width, height);
+    glScissor(0, 0, pendingWidth, pendingHeight);
 }
 
 
@@ -28,13 +28,16 @@
 
 #include <algorithm>
 #include <iostream>
+#include <sstream>
 
 #include "image.hpp"
+#include "imagedumpqueue.hpp"
 #include "json.hpp"
 #include "glproc.hpp"
 #include "glsize.hpp"
 #include "glstate.hpp"
 #include "glstate_internal.hpp"
+#include "retrace.hpp"
 
 
 namespace glstate {
@@ -149,7 +152,31 @@ static const GLenum bindings[] = {
 
 void dumpCurrentContext(std::ostream &os)
 {
-    JSONWriter json(os);
+    /*
+     * Each section is serialized into its own buffer by a fragment
+     * writer; the buffers are concatenated into the final document at
+     * the end.  GL queries must stay on this thread, but sectioning
+     * lets the image readbacks of both image sections be enqueued
+     * before any encode result is waited on, so the encode workers
+     * run concurrently with the remaining readbacks instead of the
+     * texture encodes draining before the framebuffer section even
+     * starts.
+     */
+    std::ostringstream parametersBody;
+    std::ostringstream shadersBody;
+    std::ostringstream texturesBody;
+    std::ostringstream framebufferBody;
+
+    JSONWriter parametersJson(parametersBody, false);
+    JSONWriter shadersJson(shadersBody, true);
+    JSONWriter texturesJson(texturesBody, true);
+    JSONWriter framebufferJson(framebufferBody, true);
+    if (retrace::stateBinarySidecar) {
+        parametersJson.setBinarySidecar(*retrace::stateBinarySidecar);
+        shadersJson.shareBinarySidecar(parametersJson);
+        texturesJson.shareBinarySidecar(parametersJson);
+        framebufferJson.shareBinarySidecar(parametersJson);
+    }
 
 #ifndef NDEBUG
     GLint old_bindings[NUM_BINDINGS];
@@ -161,10 +188,26 @@ void dumpCurrentContext(std::ostream &os)
 
     Context context;
 
-    dumpParameters(json, context);
-    dumpShadersUniforms(json, context);
-    dumpTextures(json, context);
-    dumpFramebuffer(json, context);
+    ImageDumpQueue queue(parametersJson.hasBinarySidecar());
+
+    dumpParameters(parametersJson, context);
+    dumpShadersUniforms(shadersJson, context);
+
+    texturesJson.beginMember("textures");
+    texturesJson.beginObject();
+    dumpTextures(texturesJson, context, queue);
+
+    framebufferJson.beginMember("framebuffer");
+    framebufferJson.beginObject();
+    dumpFramebuffer(framebufferJson, context, queue);
+
+    queue.flush();
+
+    texturesJson.endObject();
+    texturesJson.endMember(); // textures
+
+    framebufferJson.endObject();
+    framebufferJson.endMember(); // framebuffer
 
 #ifndef NDEBUG
     for (unsigned i = 0; i < NUM_BINDINGS; ++i) {
@@ -176,6 +219,19 @@ void dumpCurrentContext(std::ostream &os)
     }
 #endif
 
+    // The writers buffer internally; push everything into the
+    // stringstreams before concatenating.
+    parametersJson.flush();
+    shadersJson.flush();
+    texturesJson.flush();
+    framebufferJson.flush();
+
+    os << "{";
+    os << parametersBody.str();
+    os << shadersBody.str();
+    os << texturesBody.str();
+    os << framebufferBody.str();
+    os << "\n}\n";
 }
 
 
@@ -44,8 +44,32 @@ const char *enumToString(GLenum pname);
 
 void dumpCurrentContext(std::ostream &os);
 
+/**
+ * Read back the current draw buffer, optionally restricted to a region of
+ * interest and/or decimated by a point-sampling factor (negative size means
+ * up to the draw buffer edge).
+ */
 image::Image *
-getDrawBufferImage(void);
+getDrawBufferImage(int x = 0, int y = 0, int width = -1, int height = -1,
+                   unsigned downsample = 1);
+
+/**
+ * Kick off an asynchronous readback of the current draw buffer into a pixel
+ * buffer object, to be collected later with finishDrawBufferReadback().
+ *
+ * Returns false when no asynchronous path is available (missing extensions,
+ * ES, or no draw buffer), in which case getDrawBufferImage() must be used.
+ */
+bool
+startDrawBufferReadback(int x = 0, int y = 0, int width = -1, int height = -1,
+                        unsigned downsample = 1);
+
+/**
+ * Complete the oldest readback started with startDrawBufferReadback(),
+ * waiting for the transfer if necessary.
+ */
+image::Image *
+finishDrawBufferReadback(void);
 
 
 } /* namespace glstate */
@@ -29,9 +29,12 @@
 
 #include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "image.hpp"
 #include "json.hpp"
+#include "os_thread.hpp"
+#include "imagedumpqueue.hpp"
 #include "glproc.hpp"
 #include "glsize.hpp"
 #include "glstate.hpp"
@@ -379,7 +382,8 @@ isDepthFormat(GLenum internalFormat)
 
 
 static inline void
-dumpActiveTextureLevel(JSONWriter &json, Context &context, GLenum target, GLint level)
+dumpActiveTextureLevel(JSONWriter &json, Context &context,
+                       ImageDumpQueue &queue, GLenum target, GLint level)
 {
     ImageDesc desc;
     if (!getActiveTextureLevelDesc(context, target, level, desc)) {
@@ -392,8 +396,6 @@ dumpActiveTextureLevel(JSONWriter &json, Context &context, GLenum target, GLint
     snprintf(label, sizeof label, "%s, %s, level = %d",
              enumToString(active_texture), enumToString(target), level);
 
-    json.beginMember(label);
-
     GLuint channels;
     GLenum format;
     if (!context.ES && isDepthFormat(desc.internalFormat)) {
@@ -416,16 +418,15 @@ dumpActiveTextureLevel(JSONWriter &json, Context &context, GLenum target, GLint
 
     context.restorePixelPackState();
 
-    json.writeImage(image, formatToString(desc.internalFormat), desc.depth);
-
-    delete image;
-
-    json.endMember(); // label
+    /* The workers encode it; the member is written at flush(). */
+    queue.push(&json, label, image, formatToString(desc.internalFormat),
+               desc.depth);
 }
 
 
 static inline void
-dumpTexture(JSONWriter &json, Context &context, GLenum target, GLenum binding)
+dumpTexture(JSONWriter &json, Context &context, ImageDumpQueue &queue,
+            GLenum target, GLenum binding)
 {
     GLint texture_binding = 0;
     glGetIntegerv(binding, &texture_binding);
@@ -442,13 +443,13 @@ dumpTexture(JSONWriter &json, Context &context, GLenum target, GLenum binding)
                 if (!getActiveTextureLevelDesc(context, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, desc)) {
                     return;
                 }
-                dumpActiveTextureLevel(json, context, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level);
+                dumpActiveTextureLevel(json, context, queue, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level);
             }
         } else {
             if (!getActiveTextureLevelDesc(context, target, level, desc)) {
                 return;
             }
-            dumpActiveTextureLevel(json, context, target, level);
+            dumpActiveTextureLevel(json, context, queue, target, level);
         }
 
         ++level;
@@ -457,10 +458,8 @@ dumpTexture(JSONWriter &json, Context &context, GLenum target, GLenum binding)
 
 
 void
-dumpTextures(JSONWriter &json, Context &context)
+dumpTextures(JSONWriter &json, Context &context, ImageDumpQueue &queue)
 {
-    json.beginMember("textures");
-    json.beginObject();
     GLint active_texture = GL_TEXTURE0;
     glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
 
@@ -480,15 +479,13 @@ dumpTextures(JSONWriter &json, Context &context)
     for (GLint unit = 0; unit < max_units; ++unit) {
         GLenum texture = GL_TEXTURE0 + unit;
         glActiveTexture(texture);
-        dumpTexture(json, context, GL_TEXTURE_1D, GL_TEXTURE_BINDING_1D);
-        dumpTexture(json, context, GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D);
-        dumpTexture(json, context, GL_TEXTURE_3D, GL_TEXTURE_BINDING_3D);
-        dumpTexture(json, context, GL_TEXTURE_RECTANGLE, GL_TEXTURE_BINDING_RECTANGLE);
-        dumpTexture(json, context, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP);
+        dumpTexture(json, context, queue, GL_TEXTURE_1D, GL_TEXTURE_BINDING_1D);
+        dumpTexture(json, context, queue, GL_TEXTURE_2D, GL_TEXTURE_BINDING_2D);
+        dumpTexture(json, context, queue, GL_TEXTURE_3D, GL_TEXTURE_BINDING_3D);
+        dumpTexture(json, context, queue, GL_TEXTURE_RECTANGLE, GL_TEXTURE_BINDING_RECTANGLE);
+        dumpTexture(json, context, queue, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BINDING_CUBE_MAP);
     }
     glActiveTexture(active_texture);
-    json.endObject();
-    json.endMember(); // textures
 }
 
 
@@ -714,16 +711,17 @@ getFramebufferAttachmentDesc(Context &context, GLenum target, GLenum attachment,
 
 
 
-image::Image *
-getDrawBufferImage() {
-    GLenum format = GL_RGB;
-    GLint channels = _gl_format_channels(format);
-    if (channels > 4) {
-        return NULL;
-    }
-
-    Context context;
-
+/**
+ * Locate the current draw buffer and its dimensions, as needed to read it
+ * back with glReadPixels.
+ *
+ * Returns false when there is nothing to read (no draw buffer selected, or
+ * the bounds could not be determined).
+ */
+static bool
+getDrawBufferDesc(Context &context, ImageDesc &desc,
+                  GLint &draw_framebuffer, GLint &draw_buffer)
+{
     GLenum framebuffer_binding;
     GLenum framebuffer_target;
     if (context.ES) {
@@ -734,37 +732,194 @@ getDrawBufferImage() {
         framebuffer_target = GL_DRAW_FRAMEBUFFER;
     }
 
-    GLint draw_framebuffer = 0;
+    draw_framebuffer = 0;
     glGetIntegerv(framebuffer_binding, &draw_framebuffer);
 
-    GLint draw_buffer = GL_NONE;
-    ImageDesc desc;
+    draw_buffer = GL_NONE;
     if (draw_framebuffer) {
         if (context.ARB_draw_buffers) {
             glGetIntegerv(GL_DRAW_BUFFER0, &draw_buffer);
             if (draw_buffer == GL_NONE) {
-                return NULL;
+                return false;
             }
         }
 
         if (!getFramebufferAttachmentDesc(context, framebuffer_target, draw_buffer, desc)) {
-            return NULL;
+            return false;
         }
     } else {
         if (!context.ES) {
             glGetIntegerv(GL_DRAW_BUFFER, &draw_buffer);
             if (draw_buffer == GL_NONE) {
-                return NULL;
+                return false;
             }
         }
 
         if (!getDrawableBounds(&desc.width, &desc.height)) {
-            return NULL;
+            return false;
         }
 
         desc.depth = 1;
     }
 
+    return true;
+}
+
+
+/**
+ * Clip a requested region of interest against the draw buffer bounds
+ * (negative size meaning up to the edge).  Returns false when nothing
+ * remains.
+ */
+static bool
+clipReadbackRect(const ImageDesc &desc, int &x, int &y, int &width, int &height)
+{
+    if (x < 0) {
+        x = 0;
+    }
+    if (y < 0) {
+        y = 0;
+    }
+    if (x >= desc.width || y >= desc.height) {
+        return false;
+    }
+    if (width < 0 || x + width > desc.width) {
+        width = desc.width - x;
+    }
+    if (height < 0 || y + height > desc.height) {
+        height = desc.height - y;
+    }
+    return width > 0 && height > 0;
+}
+
+
+/**
+ * Point-sample every factor-th pixel.  Consumes src.
+ */
+static image::Image *
+decimateImage(image::Image *src, unsigned factor)
+{
+    unsigned width = (src->width + factor - 1) / factor;
+    unsigned height = (src->height + factor - 1) / factor;
+
+    image::Image *dst = image::getPooledImage(width, height, src->channels,
+                                              src->flipped);
+    if (dst) {
+        unsigned channels = src->channels;
+        for (unsigned y = 0; y < height; ++y) {
+            const unsigned char *srcRow =
+                src->pixels + (size_t)y*factor*src->width*channels;
+            unsigned char *dstRow = dst->pixels + (size_t)y*width*channels;
+            for (unsigned x = 0; x < width; ++x) {
+                for (unsigned c = 0; c < channels; ++c) {
+                    dstRow[x*channels + c] = srcRow[x*factor*channels + c];
+                }
+            }
+        }
+    }
+
+    image::releasePooledImage(src);
+    return dst;
+}
+
+
+static bool
+supportsFramebufferBlit(void)
+{
+    static int supported = -1;
+    if (supported < 0) {
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        supported = extensions &&
+                    (strstr(extensions, "GL_ARB_framebuffer_object") ||
+                     strstr(extensions, "GL_EXT_framebuffer_blit"))
+                    ? 1 : 0;
+    }
+    return supported != 0;
+}
+
+
+/**
+ * Downscale the requested region on the GPU before reading it back:
+ * blit it with linear filtering into a small renderbuffer, and leave
+ * that bound as the read framebuffer, so only the target size crosses
+ * the bus.  Assumes the caller has already selected the source read
+ * framebuffer and read buffer.
+ *
+ * On success x/y/width/height are rewritten to the downscaled rect,
+ * and the caller must delete fbo/rb once its readback has been issued
+ * and the previous read binding restored.
+ */
+static bool
+blitDownscaledRect(int &x, int &y, int &width, int &height,
+                   unsigned downsample, GLuint &fbo, GLuint &rb)
+{
+    int scaledWidth = (width + downsample - 1) / downsample;
+    int scaledHeight = (height + downsample - 1) / downsample;
+
+    GLint draw_framebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_framebuffer);
+    GLint renderbuffer = 0;
+    glGetIntegerv(GL_RENDERBUFFER_BINDING, &renderbuffer);
+
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &rb);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGB8, scaledWidth, scaledHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, rb);
+
+    if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &rb);
+        fbo = 0;
+        rb = 0;
+        return false;
+    }
+
+    glBlitFramebuffer(x, y, x + width, y + height,
+                      0, 0, scaledWidth, scaledHeight,
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_framebuffer);
+
+    /* Read back the downscaled copy instead. */
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+    x = 0;
+    y = 0;
+    width = scaledWidth;
+    height = scaledHeight;
+    return true;
+}
+
+
+image::Image *
+getDrawBufferImage(int x, int y, int width, int height, unsigned downsample) {
+    GLenum format = GL_RGB;
+    GLint channels = _gl_format_channels(format);
+    if (channels > 4) {
+        return NULL;
+    }
+
+    Context context;
+
+    GLint draw_framebuffer = 0;
+    GLint draw_buffer = GL_NONE;
+    ImageDesc desc;
+    if (!getDrawBufferDesc(context, desc, draw_framebuffer, draw_buffer)) {
+        return NULL;
+    }
+
+    if (!clipReadbackRect(desc, x, y, width, height)) {
+        return NULL;
+    }
+
     GLenum type = GL_UNSIGNED_BYTE;
 
 #if DEPTH_AS_RGBA
@@ -774,27 +929,43 @@ getDrawBufferImage() {
     }
 #endif
 
-    image::Image *image = new image::Image(desc.width, desc.height, channels, true);
-    if (!image) {
-        return NULL;
-    }
-
     while (glGetError() != GL_NO_ERROR) {}
 
     GLint read_framebuffer = 0;
     GLint read_buffer = GL_NONE;
+    GLuint scaleFbo = 0;
+    GLuint scaleRb = 0;
     if (!context.ES) {
         glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
         glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_framebuffer);
 
         glGetIntegerv(GL_READ_BUFFER, &read_buffer);
         glReadBuffer(draw_buffer);
+
+        if (downsample > 1 && supportsFramebufferBlit() &&
+            blitDownscaledRect(x, y, width, height, downsample,
+                               scaleFbo, scaleRb)) {
+            downsample = 1;
+        }
+    }
+
+    image::Image *image = image::getPooledImage(width, height, channels, true);
+    if (!image) {
+        if (!context.ES) {
+            glReadBuffer(read_buffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+        }
+        if (scaleFbo) {
+            glDeleteFramebuffers(1, &scaleFbo);
+            glDeleteRenderbuffers(1, &scaleRb);
+        }
+        return NULL;
     }
 
     // TODO: reset imaging state too
     context.resetPixelPackState();
 
-    glReadPixels(0, 0, desc.width, desc.height, format, type, image->pixels);
+    glReadPixels(x, y, width, height, format, type, image->pixels);
 
     context.restorePixelPackState();
 
@@ -803,25 +974,226 @@ getDrawBufferImage() {
         glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
     }
 
+    if (scaleFbo) {
+        glDeleteFramebuffers(1, &scaleFbo);
+        glDeleteRenderbuffers(1, &scaleRb);
+    }
+
     GLenum error = glGetError();
     if (error != GL_NO_ERROR) {
         do {
             std::cerr << "warning: " << enumToString(error) << " while getting snapshot\n";
             error = glGetError();
         } while(error != GL_NO_ERROR);
-        delete image;
+        image::releasePooledImage(image);
         return NULL;
     }
-     
+
+    if (downsample > 1) {
+        image = decimateImage(image, downsample);
+    }
+
+    return image;
+}
+
+
+/*
+ * Asynchronous draw buffer readback.
+ *
+ * glReadPixels into client memory drains the pipeline before returning, so
+ * snapshotting every frame roughly doubles replay time.  Reading into a
+ * pixel buffer object instead returns immediately; a fence tells us when the
+ * transfer is done, and the caller maps the buffer out only at the next
+ * snapshot point, overlapping the readback of one frame with the replay of
+ * the next.  Two buffers are kept so a transfer can still be in flight while
+ * the previous one is being drained.
+ */
+
+struct DrawBufferReadback {
+    GLuint pbo;
+    GLsync fence;
+    GLint width;
+    GLint height;
+    GLint channels;
+    GLenum format;
+    unsigned downsample;
+};
+
+static DrawBufferReadback readbacks[2];
+
+/* Readbacks in flight, oldest first. */
+static unsigned pendingReadbacks[2];
+static unsigned numPendingReadbacks = 0;
+
+
+static bool
+supportsAsyncReadback(void)
+{
+    static int supported = -1;
+    if (supported < 0) {
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        supported = extensions &&
+                    strstr(extensions, "GL_ARB_pixel_buffer_object") &&
+                    strstr(extensions, "GL_ARB_sync")
+                    ? 1 : 0;
+    }
+    return supported != 0;
+}
+
+
+bool
+startDrawBufferReadback(int x, int y, int width, int height,
+                        unsigned downsample)
+{
+    GLenum format = GL_RGB;
+    GLint channels = _gl_format_channels(format);
+
+    Context context;
+
+    if (context.ES || !supportsAsyncReadback()) {
+        return false;
+    }
+
+    if (numPendingReadbacks >= 2) {
+        /* Both buffers in flight -- the caller must drain one first. */
+        return false;
+    }
+
+    GLint draw_framebuffer = 0;
+    GLint draw_buffer = GL_NONE;
+    ImageDesc desc;
+    if (!getDrawBufferDesc(context, desc, draw_framebuffer, draw_buffer)) {
+        return false;
+    }
+
+    if (!clipReadbackRect(desc, x, y, width, height)) {
+        return false;
+    }
+
+    unsigned slot = numPendingReadbacks ? pendingReadbacks[0] ^ 1 : 0;
+    DrawBufferReadback &rb = readbacks[slot];
+    if (!rb.pbo) {
+        glGenBuffers(1, &rb.pbo);
+    }
+
+    while (glGetError() != GL_NO_ERROR) {}
+
+    GLint read_framebuffer = 0;
+    GLint read_buffer = GL_NONE;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, draw_framebuffer);
+
+    glGetIntegerv(GL_READ_BUFFER, &read_buffer);
+    glReadBuffer(draw_buffer);
+
+    GLuint scaleFbo = 0;
+    GLuint scaleRb = 0;
+    if (downsample > 1 && supportsFramebufferBlit() &&
+        blitDownscaledRect(x, y, width, height, downsample,
+                           scaleFbo, scaleRb)) {
+        downsample = 1;
+    }
+
+    // TODO: reset imaging state too
+    context.resetPixelPackState();
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER,
+                 width * height * channels,
+                 NULL, GL_STREAM_READ);
+    glReadPixels(x, y, width, height, format, GL_UNSIGNED_BYTE, NULL);
+
+    /* Rebinds the previous GL_PIXEL_PACK_BUFFER too. */
+    context.restorePixelPackState();
+
+    glReadBuffer(read_buffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+
+    if (scaleFbo) {
+        /* The issued readback still references them; deletion is
+         * deferred by the driver until it has executed. */
+        glDeleteFramebuffers(1, &scaleFbo);
+        glDeleteRenderbuffers(1, &scaleRb);
+    }
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        do {
+            std::cerr << "warning: " << enumToString(error) << " while starting snapshot readback\n";
+            error = glGetError();
+        } while (error != GL_NO_ERROR);
+        return false;
+    }
+
+    rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    if (!rb.fence) {
+        return false;
+    }
+
+    rb.width = width;
+    rb.height = height;
+    rb.channels = channels;
+    rb.format = format;
+    rb.downsample = downsample;
+
+    pendingReadbacks[numPendingReadbacks++] = slot;
+    return true;
+}
+
+
+image::Image *
+finishDrawBufferReadback(void)
+{
+    if (!numPendingReadbacks) {
+        return NULL;
+    }
+
+    unsigned slot = pendingReadbacks[0];
+    pendingReadbacks[0] = pendingReadbacks[1];
+    --numPendingReadbacks;
+
+    DrawBufferReadback &rb = readbacks[slot];
+
+    /* The transfer has normally long completed; if the fence still times
+     * out then mapping the buffer below will block until it has. */
+    glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(rb.fence);
+    rb.fence = NULL;
+
+    GLint pixel_pack_buffer = 0;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+
+    image::Image *image = NULL;
+    const void *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (data) {
+        image = image::getPooledImage(rb.width, rb.height, rb.channels, true);
+        if (image) {
+            memcpy(image->pixels, data, rb.width * rb.height * rb.channels);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        std::cerr << "warning: failed to map snapshot readback buffer\n";
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer);
+
+    if (image && rb.downsample > 1) {
+        image = decimateImage(image, rb.downsample);
+    }
+
     return image;
 }
 
 
 /**
- * Dump the image of the currently bound read buffer.
+ * Read back the image of the currently bound read buffer and defer it
+ * to the encode queue under the given member label.
  */
 static inline void
-dumpReadBufferImage(JSONWriter &json, GLint width, GLint height, GLenum format,
+dumpReadBufferImage(JSONWriter &json, ImageDumpQueue &queue,
+                    const char *label,
+                    GLint width, GLint height, GLenum format,
                     GLint internalFormat = GL_NONE)
 {
     GLint channels = _gl_format_channels(format);
@@ -850,9 +1222,7 @@ dumpReadBufferImage(JSONWriter &json, GLint width, GLint height, GLenum format,
 
     context.restorePixelPackState();
 
-    json.writeImage(image, formatToString(internalFormat));
-
-    delete image;
+    queue.push(&json, label, image, formatToString(internalFormat), 1);
 }
 
 
@@ -958,7 +1328,7 @@ downsampledFramebuffer(Context &context,
  * Dump images of current draw drawable/window.
  */
 static void
-dumpDrawableImages(JSONWriter &json, Context &context)
+dumpDrawableImages(JSONWriter &json, Context &context, ImageDumpQueue &queue)
 {
     GLint width, height;
 
@@ -986,9 +1356,8 @@ dumpDrawableImages(JSONWriter &json, Context &context)
         glGetIntegerv(GL_ALPHA_BITS, &alpha_bits);
 #endif
         GLenum format = alpha_bits ? GL_RGBA : GL_RGB;
-        json.beginMember(enumToString(draw_buffer));
-        dumpReadBufferImage(json, width, height, format);
-        json.endMember();
+        dumpReadBufferImage(json, queue, enumToString(draw_buffer),
+                            width, height, format);
 
         if (!context.ES) {
             glReadBuffer(read_buffer);
@@ -999,17 +1368,15 @@ dumpDrawableImages(JSONWriter &json, Context &context)
         GLint depth_bits = 0;
         glGetIntegerv(GL_DEPTH_BITS, &depth_bits);
         if (depth_bits) {
-            json.beginMember("GL_DEPTH_COMPONENT");
-            dumpReadBufferImage(json, width, height, GL_DEPTH_COMPONENT);
-            json.endMember();
+            dumpReadBufferImage(json, queue, "GL_DEPTH_COMPONENT",
+                                width, height, GL_DEPTH_COMPONENT);
         }
 
         GLint stencil_bits = 0;
         glGetIntegerv(GL_STENCIL_BITS, &stencil_bits);
         if (stencil_bits) {
-            json.beginMember("GL_STENCIL_INDEX");
-            dumpReadBufferImage(json, width, height, GL_STENCIL_INDEX);
-            json.endMember();
+            dumpReadBufferImage(json, queue, "GL_STENCIL_INDEX",
+                                width, height, GL_STENCIL_INDEX);
         }
     }
 }
@@ -1021,21 +1388,20 @@ dumpDrawableImages(JSONWriter &json, Context &context)
  * In the case of a color attachment, it assumes it is already bound for read.
  */
 static void
-dumpFramebufferAttachment(JSONWriter &json, Context &context, GLenum target, GLenum attachment, GLenum format)
+dumpFramebufferAttachment(JSONWriter &json, Context &context, ImageDumpQueue &queue, GLenum target, GLenum attachment, GLenum format)
 {
     ImageDesc desc;
     if (!getFramebufferAttachmentDesc(context, target, attachment, desc)) {
         return;
     }
 
-    json.beginMember(enumToString(attachment));
-    dumpReadBufferImage(json, desc.width, desc.height, format, desc.internalFormat);
-    json.endMember();
+    dumpReadBufferImage(json, queue, enumToString(attachment),
+                        desc.width, desc.height, format, desc.internalFormat);
 }
 
 
 static void
-dumpFramebufferAttachments(JSONWriter &json, Context &context, GLenum target)
+dumpFramebufferAttachments(JSONWriter &json, Context &context, ImageDumpQueue &queue, GLenum target)
 {
     GLint read_framebuffer = 0;
     glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
@@ -1065,15 +1431,15 @@ dumpFramebufferAttachments(JSONWriter &json, Context &context, GLenum target)
                                                   GL_FRAMEBUFFER_ATTACHMENT_ALPHA_SIZE,
                                                   &alpha_size);
             GLenum format = alpha_size ? GL_RGBA : GL_RGB;
-            dumpFramebufferAttachment(json, context, target, attachment, format);
+            dumpFramebufferAttachment(json, context, queue, target, attachment, format);
         }
     }
 
     glReadBuffer(read_buffer);
 
     if (!context.ES) {
-        dumpFramebufferAttachment(json, context, target, GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT);
-        dumpFramebufferAttachment(json, context, target, GL_STENCIL_ATTACHMENT, GL_STENCIL_INDEX);
+        dumpFramebufferAttachment(json, context, queue, target, GL_DEPTH_ATTACHMENT, GL_DEPTH_COMPONENT);
+        dumpFramebufferAttachment(json, context, queue, target, GL_STENCIL_ATTACHMENT, GL_STENCIL_INDEX);
     }
 
     glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
@@ -1081,18 +1447,15 @@ dumpFramebufferAttachments(JSONWriter &json, Context &context, GLenum target)
 
 
 void
-dumpFramebuffer(JSONWriter &json, Context &context)
+dumpFramebuffer(JSONWriter &json, Context &context, ImageDumpQueue &queue)
 {
-    json.beginMember("framebuffer");
-    json.beginObject();
-
     GLint boundDrawFbo = 0, boundReadFbo = 0;
     glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &boundDrawFbo);
     glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &boundReadFbo);
     if (!boundDrawFbo) {
-        dumpDrawableImages(json, context);
+        dumpDrawableImages(json, context, queue);
     } else if (context.ES) {
-        dumpFramebufferAttachments(json, context, GL_FRAMEBUFFER);
+        dumpFramebufferAttachments(json, context, queue, GL_FRAMEBUFFER);
     } else {
         GLint colorRb = 0, stencilRb = 0, depthRb = 0;
         GLint draw_buffer0 = GL_NONE;
@@ -1151,7 +1514,7 @@ dumpFramebuffer(JSONWriter &json, Context &context)
                                              rbs, &numRbs);
         }
 
-        dumpFramebufferAttachments(json, context, GL_DRAW_FRAMEBUFFER);
+        dumpFramebufferAttachments(json, context, queue, GL_DRAW_FRAMEBUFFER);
 
         if (multisample) {
             glBindRenderbuffer(GL_RENDERBUFFER_BINDING, boundRb);
@@ -1162,9 +1525,6 @@ dumpFramebuffer(JSONWriter &json, Context &context)
         glBindFramebuffer(GL_READ_FRAMEBUFFER, boundReadFbo);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, boundDrawFbo);
     }
-
-    json.endObject();
-    json.endMember(); // framebuffer
 }
 
 
@@ -30,6 +30,7 @@
 #include "glimports.hpp"
 
 
+class ImageDumpQueue;
 class JSONWriter;
 
 
@@ -72,9 +73,16 @@ void dumpParameters(JSONWriter &json, Context &context);
 
 void dumpShadersUniforms(JSONWriter &json, Context &context);
 
-void dumpTextures(JSONWriter &json, Context &context);
+/*
+ * The two image sections only read the images back and defer them to
+ * the encode queue; their members appear on `json` when the queue is
+ * flushed.  The caller owns the enclosing "textures"/"framebuffer"
+ * object and must flush before closing it (see dumpCurrentContext).
+ */
 
-void dumpFramebuffer(JSONWriter &json, Context &context);
+void dumpTextures(JSONWriter &json, Context &context, ImageDumpQueue &queue);
+
+void dumpFramebuffer(JSONWriter &json, Context &context, ImageDumpQueue &queue);
 
 
 } /* namespace glstate */
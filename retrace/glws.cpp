@@ -33,6 +33,9 @@
 namespace glws {
 
 
+bool headless = false;
+
+
 bool
 checkExtension(const char *extName, const char *extString)
 {
@@ -101,4 +104,57 @@ Context::hasExtension(const char *string) {
 }
 
 
+/**
+ * Contexts the retraced application destroyed, awaiting reuse.
+ *
+ * Pooled contexts are never freed; replays are one process per trace,
+ * so anything left at exit goes away with the process.
+ */
+static std::vector<Context *> contextPool;
+
+
+Context *
+acquireContext(const Visual *visual, Context *shareContext, Profile profile, bool debug)
+{
+    Context *shareGroup = 0;
+    if (shareContext) {
+        /* The share source anchors its group from now on, so a pooled
+         * member can never masquerade as an unshared context while
+         * other members are alive. */
+        if (!shareContext->shareGroup) {
+            shareContext->shareGroup = shareContext;
+        }
+        shareGroup = shareContext->shareGroup;
+    }
+
+    std::vector<Context *>::iterator it;
+    for (it = contextPool.begin(); it != contextPool.end(); ++it) {
+        Context *context = *it;
+        if (context->visual == visual &&
+            context->profile == profile &&
+            context->shareGroup == shareGroup &&
+            context->debug == debug) {
+            contextPool.erase(it);
+            return context;
+        }
+    }
+
+    Context *context = createContext(visual, shareContext, profile, debug);
+    if (context) {
+        context->shareGroup = shareGroup;
+        context->debug = debug;
+    }
+    return context;
+}
+
+
+void
+releaseContext(Context *context)
+{
+    if (context) {
+        contextPool.push_back(context);
+    }
+}
+
+
 } /* namespace glws */
@@ -136,12 +136,19 @@ class Context
 public:
     const Visual *visual;
     Profile profile;
-    
+
+    /* Root context of the share group, NULL while unshared; maintained
+     * by acquireContext for matching recycled contexts. */
+    Context *shareGroup;
+    bool debug;
+
     std::set<std::string> extensions;
 
     Context(const Visual *vis, Profile prof) :
         visual(vis),
-        profile(prof)
+        profile(prof),
+        shareGroup(0),
+        debug(false)
     {}
 
     virtual ~Context() {}
@@ -152,6 +159,14 @@ public:
 };
 
 
+/*
+ * Skip the native window system entirely and render into pbuffers.
+ * Must be set before init().  Only the EGL backend implements this;
+ * the others refuse to start.
+ */
+extern bool headless;
+
+
 void
 init(void);
 
@@ -167,6 +182,24 @@ createDrawable(const Visual *visual, int width, int height, bool pbuffer = false
 Context *
 createContext(const Visual *visual, Context *shareContext = 0, Profile profile = PROFILE_COMPAT, bool debug = false);
 
+/*
+ * Variants of createContext/delete which pool destroyed contexts and
+ * recycle them on a matching request (same visual, profile, debug flag
+ * and share group).  Traces which churn through short-lived contexts
+ * otherwise pay a full window system context creation every time.
+ *
+ * A recycled context keeps whatever objects and state its previous
+ * incarnation left behind; the trace cannot reference objects it did
+ * not create, but it must set up the state it relies on rather than
+ * assume defaults, as well-behaved applications do.
+ */
+
+Context *
+acquireContext(const Visual *visual, Context *shareContext = 0, Profile profile = PROFILE_COMPAT, bool debug = false);
+
+void
+releaseContext(Context *context);
+
 bool
 makeCurrent(Drawable *drawable, Context *context);
 
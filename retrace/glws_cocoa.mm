@@ -98,12 +98,23 @@ class CocoaDrawable : public Drawable
 public:
     NSWindow *window;
     NSOpenGLView *view;
+    NSOpenGLPixelBuffer *pixelBuffer;
     NSOpenGLContext *currentContext;
 
     CocoaDrawable(const Visual *vis, int w, int h, bool pbuffer) :
         Drawable(vis, w, h, pbuffer),
+        window(nil),
+        view(nil),
+        pixelBuffer(nil),
         currentContext(nil)
     {
+        if (headless) {
+            /* Render offscreen, with no AppKit window machinery and
+             * hence no display-link throttled flushes. */
+            pixelBuffer = createPixelBuffer(w, h);
+            return;
+        }
+
         NSOpenGLPixelFormat *pixelFormat = static_cast<const CocoaVisual *>(visual)->pixelFormat;
 
         NSRect winRect = NSMakeRect(0, 0, w, h);
@@ -128,21 +139,62 @@ public:
     }
 
     ~CocoaDrawable() {
+        [pixelBuffer release];
         [window release];
     }
 
+    static NSOpenGLPixelBuffer *
+    createPixelBuffer(int w, int h) {
+        NSOpenGLPixelBuffer *pb = [[NSOpenGLPixelBuffer alloc]
+                initWithTextureTarget:GL_TEXTURE_RECTANGLE_ARB
+                textureInternalFormat:GL_RGBA
+                textureMaxMipMapLevel:0
+                           pixelsWide:w
+                           pixelsHigh:h];
+        assert(pb != nil);
+        return pb;
+    }
+
+    /**
+     * Point the context at this drawable's backing store: the pixel
+     * buffer when headless, the window's view otherwise.
+     */
+    void
+    attachToContext(NSOpenGLContext *context) {
+        if (headless) {
+            [context setPixelBuffer:pixelBuffer
+                        cubeMapFace:0
+                        mipMapLevel:0
+               currentVirtualScreen:[context currentVirtualScreen]];
+        } else {
+            [window makeKeyAndOrderFront:nil];
+            [context setView:view];
+        }
+    }
+
     void
     resize(int w, int h) {
         if (w == width && h == height) {
             return;
         }
 
+        if (headless) {
+            /* Pixel buffers are fixed size; swap in a new one */
+            [pixelBuffer release];
+            pixelBuffer = createPixelBuffer(w, h);
+            if (currentContext != nil) {
+                attachToContext(currentContext);
+                [currentContext makeCurrentContext];
+            }
+            Drawable::resize(w, h);
+            return;
+        }
+
         [window setContentSize:NSMakeSize(w, h)];
 
         if (currentContext != nil) {
             [currentContext update];
-            [window makeKeyAndOrderFront:nil];
-            [currentContext setView:view];
+            attachToContext(currentContext);
             [currentContext makeCurrentContext];
         }
 
@@ -160,6 +212,12 @@ public:
     }
 
     void swapBuffers(void) {
+        if (headless) {
+            /* Single-buffered offscreen surface; nothing to present,
+             * and nothing for the display link to throttle */
+            glFlush();
+            return;
+        }
         if (currentContext != nil) {
             [currentContext flushBuffer];
         }
@@ -205,6 +263,12 @@ init(void) {
 	exit(1);
     }
 
+    if (headless) {
+        /* Offscreen pixel buffers only; connecting to the window
+         * server would fail on display-less farm nodes. */
+        return;
+    }
+
     [NSApplication sharedApplication];
 
     [NSApp finishLaunching];
@@ -231,7 +295,10 @@ createVisual(bool doubleBuffer, Profile profile) {
 
     attribs.add(NSOpenGLPFAAlphaSize, (NSOpenGLPixelFormatAttribute)1);
     attribs.add(NSOpenGLPFAColorSize, (NSOpenGLPixelFormatAttribute)24);
-    if (doubleBuffer) {
+    if (headless) {
+        /* Pixel buffers are single buffered */
+        attribs.add(NSOpenGLPFAPixelBuffer);
+    } else if (doubleBuffer) {
         attribs.add(NSOpenGLPFADoubleBuffer);
     }
     attribs.add(NSOpenGLPFADepthSize, (NSOpenGLPixelFormatAttribute)1);
@@ -302,8 +369,7 @@ makeCurrent(Drawable *drawable, Context *context)
         CocoaDrawable *cocoaDrawable = static_cast<CocoaDrawable *>(drawable);
         CocoaContext *cocoaContext = static_cast<CocoaContext *>(context);
 
-        [cocoaDrawable->window makeKeyAndOrderFront:nil];
-        [cocoaContext->context setView:[cocoaDrawable->window contentView]];
+        cocoaDrawable->attachToContext(cocoaContext->context);
         [cocoaContext->context makeCurrentContext];
 
         cocoaDrawable->currentContext = cocoaContext->context;
@@ -316,6 +382,11 @@ bool
 processEvents(void) {
     initThread();
 
+    if (headless) {
+        /* No application object to pump */
+        return true;
+    }
+
     NSEvent* event;
     do {
         event = [NSApp nextEventMatchingMask:NSAnyEventMask
@@ -55,7 +55,9 @@ public:
     {}
 
     ~EglVisual() {
-        XFree(visinfo);
+        if (visinfo) {
+            XFree(visinfo);
+        }
     }
 };
 
@@ -94,8 +96,17 @@ public:
 
     EglDrawable(const Visual *vis, int w, int h, bool pbuffer) :
         Drawable(vis, w, h, pbuffer),
+        window(None),
         api(EGL_OPENGL_ES_API)
     {
+        EGLConfig config = static_cast<const EglVisual *>(visual)->config;
+
+        if (headless) {
+            /* No window system; render into a pbuffer of the right size */
+            surface = createPbufferSurface(config, width, height);
+            return;
+        }
+
         XVisualInfo *visinfo = static_cast<const EglVisual *>(visual)->visinfo;
 
         Window root = RootWindow(display, screen);
@@ -137,10 +148,18 @@ public:
 
         eglWaitNative(EGL_CORE_NATIVE_ENGINE);
 
-        EGLConfig config = static_cast<const EglVisual *>(visual)->config;
         surface = eglCreateWindowSurface(eglDisplay, config, (EGLNativeWindowType)window, NULL);
     }
 
+    static EGLSurface
+    createPbufferSurface(EGLConfig config, int w, int h) {
+        Attributes<EGLint> attribs;
+        attribs.add(EGL_WIDTH, w);
+        attribs.add(EGL_HEIGHT, h);
+        attribs.end(EGL_NONE);
+        return eglCreatePbufferSurface(eglDisplay, config, attribs);
+    }
+
     void waitForEvent(int type) {
         XEvent event;
         do {
@@ -152,8 +171,10 @@ public:
     ~EglDrawable() {
         eglDestroySurface(eglDisplay, surface);
         eglWaitClient();
-        XDestroyWindow(display, window);
-        eglWaitNative(EGL_CORE_NATIVE_ENGINE);
+        if (!headless) {
+            XDestroyWindow(display, window);
+            eglWaitNative(EGL_CORE_NATIVE_ENGINE);
+        }
     }
 
     void
@@ -171,7 +192,11 @@ public:
         eglDestroySurface(eglDisplay, surface);
 
         EGLConfig config = static_cast<const EglVisual *>(visual)->config;
-        surface = eglCreateWindowSurface(eglDisplay, config, (EGLNativeWindowType)window, NULL);
+        if (headless) {
+            surface = createPbufferSurface(config, width, height);
+        } else {
+            surface = eglCreateWindowSurface(eglDisplay, config, (EGLNativeWindowType)window, NULL);
+        }
 
         if (rebindDrawSurface || rebindReadSurface) {
             eglMakeCurrent(eglDisplay, surface, surface, currentContext);
@@ -186,6 +211,14 @@ public:
 
         eglWaitClient();
 
+        if (headless) {
+            /* Pbuffers are fixed size; swap in a new one.  No window
+             * system round trips involved. */
+            Drawable::resize(w, h);
+            recreate();
+            return;
+        }
+
         // We need to ensure that pending events are processed here, and XSync
         // with discard = True guarantees that, but it appears the limited
         // event processing we do so far is sufficient
@@ -233,6 +266,12 @@ public:
             return;
         }
 
+        if (headless) {
+            /* Nothing to map */
+            Drawable::show();
+            return;
+        }
+
         eglWaitClient();
 
         XMapWindow(display, window);
@@ -283,6 +322,25 @@ void
 init(void) {
     load("libEGL.so.1");
 
+    if (headless) {
+        /* No display server.  The headers predate
+         * eglGetPlatformDisplay, but the default display resolves to a
+         * surfaceless/GBM platform on implementations that have one
+         * (Mesa honors the EGL_PLATFORM environment variable). */
+        eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (eglDisplay == EGL_NO_DISPLAY) {
+            std::cerr << "error: unable to get EGL display\n";
+            exit(1);
+        }
+
+        EGLint major, minor;
+        if (!eglInitialize(eglDisplay, &major, &minor)) {
+            std::cerr << "error: unable to initialize EGL display\n";
+            exit(1);
+        }
+        return;
+    }
+
     display = XOpenDisplay(NULL);
     if (!display) {
         std::cerr << "error: unable to open display " << XDisplayName(NULL) << "\n";
@@ -308,8 +366,11 @@ init(void) {
 
 void
 cleanup(void) {
-    if (display) {
+    if (eglDisplay != EGL_NO_DISPLAY) {
         eglTerminate(eglDisplay);
+        eglDisplay = EGL_NO_DISPLAY;
+    }
+    if (display) {
         XCloseDisplay(display);
         display = NULL;
     }
@@ -365,7 +426,8 @@ createVisual(bool doubleBuffer, Profile profile) {
     for (int i = 0; i < 7; i++) {
         Attributes<EGLint> attribs;
 
-        attribs.add(EGL_SURFACE_TYPE, EGL_WINDOW_BIT);
+        attribs.add(EGL_SURFACE_TYPE,
+                    headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT);
         attribs.add(EGL_RED_SIZE, 1);
         attribs.add(EGL_GREEN_SIZE, 1);
         attribs.add(EGL_BLUE_SIZE, 1);
@@ -376,7 +438,13 @@ createVisual(bool doubleBuffer, Profile profile) {
         attribs.end(EGL_NONE);
 
         EGLint num_configs, vid;
-        if (eglChooseConfig(eglDisplay, attribs, &visual->config, 1, &num_configs) &&
+        if (headless) {
+            /* Pbuffer-only config; no native visual involved */
+            if (eglChooseConfig(eglDisplay, attribs, &visual->config, 1, &num_configs) &&
+                num_configs == 1) {
+                break;
+            }
+        } else if (eglChooseConfig(eglDisplay, attribs, &visual->config, 1, &num_configs) &&
             num_configs == 1 &&
             eglGetConfigAttrib(eglDisplay, visual->config, EGL_NATIVE_VISUAL_ID, &vid)) {
             XVisualInfo templ;
@@ -388,7 +456,7 @@ createVisual(bool doubleBuffer, Profile profile) {
         }
     }
 
-    assert(visual->visinfo);
+    assert(headless || visual->visinfo);
 
     return visual;
 }
@@ -473,6 +541,9 @@ makeCurrent(Drawable *drawable, Context *context)
 
 bool
 processEvents(void) {
+    if (headless) {
+        return true;
+    }
     while (XPending(display) > 0) {
         XEvent event;
         XNextEvent(display, &event);
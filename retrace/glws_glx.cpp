@@ -238,6 +238,11 @@ public:
 
 void
 init(void) {
+    if (headless) {
+        std::cerr << "error: headless replay requires the EGL backend (eglretrace)\n";
+        exit(1);
+    }
+
     XInitThreads();
 
     display = XOpenDisplay(NULL);
@@ -276,6 +276,11 @@ public:
 
 void
 init(void) {
+    if (headless) {
+        std::cerr << "error: headless replay requires the EGL backend (eglretrace)\n";
+        exit(1);
+    }
+
     /*
      * OpenGL library must be loaded by the time we call GDI.
      */
@@ -0,0 +1,206 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#ifndef _IMAGEDUMPQUEUE_HPP_
+#define _IMAGEDUMPQUEUE_HPP_
+
+
+#include <string>
+#include <vector>
+
+#include "image.hpp"
+#include "json.hpp"
+#include "os_thread.hpp"
+
+
+/**
+ * Encode dumped images on a pool of worker threads.
+ *
+ * PNG-encoding every image inline into the JSON writer serializes the
+ * state dump behind the encoder, which dwarfs the actual readbacks
+ * once enough images are bound.  Readbacks must stay on the thread
+ * owning the API context, so they only enqueue the raw image here;
+ * the workers run the PNG+base64 encode concurrently with the
+ * remaining readbacks, and flush() then writes the members out in
+ * the original order.
+ */
+class ImageDumpQueue
+{
+private:
+    enum {
+        NUM_THREADS = 4
+    };
+
+    struct Item {
+        JSONWriter *json;       /* target writer, or NULL for the one
+                                   given to flush() */
+        std::string label;
+        image::Image *image;
+        const char *format;     /* static enum name */
+        unsigned depth;
+        std::string data;
+        bool ready;
+    };
+
+    os::mutex mutex;
+    os::condition_variable todo;
+    os::condition_variable done;
+
+    /* Whether the writer has a binary sidecar, in which case the
+     * workers skip the base64 pass (see JSONWriter::encodeImage). */
+    bool sidecar;
+
+    /* These are protected by the mutex. */
+    std::vector<Item *> items;
+    size_t next;
+    bool finishing;
+
+    os::thread threads[NUM_THREADS];
+
+    static void *
+    workerThread(ImageDumpQueue *_this) {
+        _this->work();
+        return 0;
+    }
+
+    void
+    work(void) {
+        while (1) {
+            Item *item;
+            {
+                os::unique_lock<os::mutex> lock(mutex);
+                while (next >= items.size() && !finishing) {
+                    todo.wait(lock);
+                }
+                if (next >= items.size()) {
+                    /* Pass the wake-up on to the next idle worker. */
+                    todo.signal();
+                    return;
+                }
+                item = items[next++];
+            }
+
+            std::string data = JSONWriter::encodeImage(item->image, sidecar);
+
+            {
+                os::unique_lock<os::mutex> lock(mutex);
+                item->data = data;
+                item->ready = true;
+            }
+            done.signal();
+        }
+    }
+
+public:
+    ImageDumpQueue(bool _sidecar) :
+        sidecar(_sidecar),
+        next(0),
+        finishing(false)
+    {
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i] = os::thread(workerThread, this);
+        }
+    }
+
+    void
+    push(const char *label, image::Image *image, const char *format,
+         unsigned depth) {
+        push(NULL, label, image, format, depth);
+    }
+
+    /**
+     * As above, with the member written to the given writer at flush
+     * time; one queue can then span several sections serialized by
+     * separate writers.
+     */
+    void
+    push(JSONWriter *json, const char *label, image::Image *image,
+         const char *format, unsigned depth) {
+        Item *item = new Item;
+        item->json = json;
+        item->label = label;
+        item->image = image;
+        item->format = format;
+        item->depth = depth;
+        item->ready = false;
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+            items.push_back(item);
+        }
+        todo.signal();
+    }
+
+    /**
+     * Write all queued images out in submission order, and join the
+     * workers.  Items pushed without a target writer go to `json`.
+     */
+    void
+    flush(JSONWriter &json) {
+        flushTo(&json);
+    }
+
+    /**
+     * Flush a queue whose items all carry their target writer.
+     */
+    void
+    flush(void) {
+        flushTo(NULL);
+    }
+
+private:
+    void
+    flushTo(JSONWriter *fallback) {
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+            finishing = true;
+        }
+        todo.signal();
+
+        for (size_t i = 0; i < items.size(); ++i) {
+            Item *item = items[i];
+            {
+                os::unique_lock<os::mutex> lock(mutex);
+                while (!item->ready) {
+                    done.wait(lock);
+                }
+            }
+            JSONWriter *json = item->json ? item->json : fallback;
+            json->beginMember(item->label);
+            json->writeEncodedImage(item->image, item->format, item->depth,
+                                    item->data);
+            json->endMember();
+            delete item->image;
+            delete item;
+        }
+        items.clear();
+
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i].join();
+        }
+    }
+};
+
+
+#endif /* _IMAGEDUMPQUEUE_HPP_ */
@@ -35,19 +35,102 @@
 
 #include "image.hpp"
 #include "json.hpp"
+#include "os_thread.hpp"
+
+
+/*
+ * Process-wide chunk pool.  Bounded, so one oversized dump does not pin
+ * its high-water mark for the rest of the process.
+ */
+
+static os::mutex chunkPoolMutex;
+static std::vector<char *> chunkPool;
+
+static const size_t MAX_POOLED_CHUNKS = 64;
+
+
+JSONBuffer::JSONBuffer(std::ostream &_os) :
+    os(_os),
+    tail(CHUNK_SIZE)
+{
+}
+
+JSONBuffer::~JSONBuffer()
+{
+    flush();
+}
+
+void
+JSONBuffer::grow(void)
+{
+    char *chunk = NULL;
+
+    chunkPoolMutex.lock();
+    if (!chunkPool.empty()) {
+        chunk = chunkPool.back();
+        chunkPool.pop_back();
+    }
+    chunkPoolMutex.unlock();
+
+    if (!chunk) {
+        chunk = new char[CHUNK_SIZE];
+    }
+    chunks.push_back(chunk);
+    tail = 0;
+}
+
+void
+JSONBuffer::write(const char *bytes, size_t size)
+{
+    while (size) {
+        if (tail == CHUNK_SIZE) {
+            grow();
+        }
+        size_t n = CHUNK_SIZE - tail;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(chunks.back() + tail, bytes, n);
+        tail += n;
+        bytes += n;
+        size -= n;
+    }
+}
+
+void
+JSONBuffer::flush(void)
+{
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        size_t used = (i + 1 == chunks.size()) ? tail : CHUNK_SIZE;
+        os.write(chunks[i], used);
+    }
+
+    chunkPoolMutex.lock();
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (chunkPool.size() < MAX_POOLED_CHUNKS) {
+            chunkPool.push_back(chunks[i]);
+        } else {
+            delete [] chunks[i];
+        }
+    }
+    chunkPoolMutex.unlock();
+
+    chunks.clear();
+    tail = CHUNK_SIZE;
+}
 
 
 void
 JSONWriter::newline(void) {
-    os << "\n";
+    buf.put('\n');
     for (int i = 0; i < level; ++i)
-        os << "  ";
+        buf.write("  ", 2);
 }
 
 void
 JSONWriter::separator(void) {
     if (value) {
-        os << ",";
+        buf.put(',');
         switch (space) {
         case '\0':
             break;
@@ -55,7 +138,7 @@ JSONWriter::separator(void) {
             newline();
             break;
         default:
-            os << space;
+            buf.put(space);
             break;
         }
     } else {
@@ -65,35 +148,52 @@ JSONWriter::separator(void) {
     }
 }
 
+/* A character copied to the output verbatim. */
+static inline bool
+isPassThrough(unsigned char c) {
+    return (c >= 0x20 && c <= 0x7e && c != '\"' && c != '\\') ||
+           c == '\t' ||
+           c == '\r' ||
+           c == '\n';
+}
+
 static void
-escapeAsciiString(std::ostream &os, const char *str) {
-    os << "\"";
+escapeAsciiString(JSONBuffer &buf, const char *str) {
+    buf.put('\"');
+
+    const char *src = str;
+    for (;;) {
+        // bulk-copy the span up to the next escape
+        const char *run = src;
+        unsigned char c;
+        while ((c = *(const unsigned char *)src) != 0 && isPassThrough(c)) {
+            ++src;
+        }
+        if (src != run) {
+            buf.write(run, src - run);
+        }
+        if (!c) {
+            break;
+        }
 
-    const unsigned char *src = (const unsigned char *)str;
-    unsigned char c;
-    while ((c = *src++)) {
         if ((c == '\"') ||
             (c == '\\')) {
             // escape character
-            os << '\\' << (unsigned char)c;
-        } else if ((c >= 0x20 && c <= 0x7e) ||
-                    c == '\t' ||
-                    c == '\r' ||
-                    c == '\n') {
-            // pass-through character
-            os << (unsigned char)c;
+            buf.put('\\');
+            buf.put(c);
         } else {
             assert(0);
-            os << "?";
+            buf.put('?');
         }
+        ++src;
     }
 
-    os << "\"";
+    buf.put('\"');
 }
 
 static void
-escapeUnicodeString(std::ostream &os, const char *str) {
-    os << "\"";
+escapeUnicodeString(JSONBuffer &buf, const char *str) {
+    buf.put('\"');
 
     const char *locale = setlocale(LC_CTYPE, "");
     const char *src = str;
@@ -102,6 +202,22 @@ escapeUnicodeString(std::ostream &os, const char *str) {
     memset(&state, 0, sizeof state);
 
     do {
+        // Bulk-copy the plain ASCII span -- the overwhelmingly common
+        // case -- before paying for a conversion.  The conversion
+        // state is initial here, and stays so across single-byte
+        // characters.
+        const char *run = src;
+        unsigned char a;
+        while ((a = *(const unsigned char *)src) != 0 && isPassThrough(a)) {
+            ++src;
+        }
+        if (src != run) {
+            buf.write(run, src - run);
+        }
+        if (!a) {
+            break;
+        }
+
         // Convert characters one at a time in order to recover from
         // conversion errors
         wchar_t c;
@@ -111,40 +227,42 @@ escapeUnicodeString(std::ostream &os, const char *str) {
             break;
         } if (written == (size_t)-1) {
             // conversion error -- skip
-            os << "?";
+            buf.put('?');
             do {
                 ++src;
             } while (*src & 0x80);
         } else if ((c == '\"') ||
                    (c == '\\')) {
             // escape character
-            os << '\\' << (unsigned char)c;
+            buf.put('\\');
+            buf.put((char)c);
         } else if ((c >= 0x20 && c <= 0x7e) ||
                     c == '\t' ||
                     c == '\r' ||
                     c == '\n') {
             // pass-through character
-            os << (unsigned char)c;
+            buf.put((char)c);
         } else {
             // unicode
-            os << "\\u" << std::setfill('0') << std::hex << std::setw(4) << (unsigned)c;
-            os << std::dec;
+            char escaped[8];
+            snprintf(escaped, sizeof escaped, "\\u%04x", (unsigned)c);
+            buf.puts(escaped);
         }
     } while (src);
 
     setlocale(LC_CTYPE, locale);
 
-    os << "\"";
+    buf.put('\"');
 }
 
 static void
-encodeBase64String(std::ostream &os, const unsigned char *bytes, size_t size) {
+encodeBase64String(JSONBuffer &buf, const unsigned char *bytes, size_t size) {
     const char *table64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
     unsigned char c0, c1, c2, c3;
-    char buf[4];
+    char quad[4];
     unsigned written;
 
-    os << "\"";
+    buf.put('"');
 
     written = 0;
     while (size >= 3) {
@@ -153,19 +271,19 @@ encodeBase64String(std::ostream &os, const unsigned char *bytes, size_t size) {
         c2 = ((bytes[1] & 0x0f) << 2) | ((bytes[2] & 0xc0) >> 6);
         c3 = bytes[2] & 0x3f;
 
-        buf[0] = table64[c0];
-        buf[1] = table64[c1];
-        buf[2] = table64[c2];
-        buf[3] = table64[c3];
+        quad[0] = table64[c0];
+        quad[1] = table64[c1];
+        quad[2] = table64[c2];
+        quad[3] = table64[c3];
 
-        os.write(buf, 4);
+        buf.write(quad, 4);
 
         bytes += 3;
         size -= 3;
         ++written;
 
         if (written >= 76/4 && size) {
-            os << "\n";
+            buf.put('\n');
             written = 0;
         }
     }
@@ -173,8 +291,8 @@ encodeBase64String(std::ostream &os, const unsigned char *bytes, size_t size) {
     if (size > 0) {
         c0 = bytes[0] >> 2;
         c1 = ((bytes[0] & 0x03) << 4);
-        buf[2] = '=';
-        buf[3] = '=';
+        quad[2] = '=';
+        quad[3] = '=';
 
         if (size > 1) {
             c1 |= ((bytes[1] & 0xf0) >> 4);
@@ -182,21 +300,25 @@ encodeBase64String(std::ostream &os, const unsigned char *bytes, size_t size) {
             if (size > 2) {
                 c2 |= ((bytes[2] & 0xc0) >> 6);
                 c3 = bytes[2] & 0x3f;
-                buf[3] = table64[c3];
+                quad[3] = table64[c3];
             }
-            buf[2] = table64[c2];
+            quad[2] = table64[c2];
         }
-        buf[1] = table64[c1];
-        buf[0] = table64[c0];
+        quad[1] = table64[c1];
+        quad[0] = table64[c0];
 
-        os.write(buf, 4);
+        buf.write(quad, 4);
     }
 
-    os << "\"";
+    buf.put('"');
 }
 
 JSONWriter::JSONWriter(std::ostream &_os) :
-    os(_os),
+    buf(_os),
+    bin(NULL),
+    binOffset(0),
+    binCursor(&binOffset),
+    fragment(false),
     level(0),
     value(false),
     space(0)
@@ -204,7 +326,22 @@ JSONWriter::JSONWriter(std::ostream &_os) :
     beginObject();
 }
 
+JSONWriter::JSONWriter(std::ostream &_os, bool continued) :
+    buf(_os),
+    bin(NULL),
+    binOffset(0),
+    binCursor(&binOffset),
+    fragment(true),
+    level(1),
+    value(continued),
+    space(0)
+{
+}
+
 JSONWriter::~JSONWriter() {
+    if (fragment) {
+        return;
+    }
     endObject();
     newline();
 }
@@ -212,7 +349,7 @@ JSONWriter::~JSONWriter() {
 void
 JSONWriter::beginObject() {
     separator();
-    os << "{";
+    buf.put('{');
     ++level;
     value = false;
 }
@@ -222,7 +359,7 @@ JSONWriter::endObject() {
     --level;
     if (value)
         newline();
-    os << "}";
+    buf.put('}');
     value = true;
     space = '\n';
 }
@@ -232,8 +369,8 @@ JSONWriter::beginMember(const char * name) {
     space = 0;
     separator();
     newline();
-    escapeAsciiString(os, name);
-    os << ": ";
+    escapeAsciiString(buf, name);
+    buf.write(": ", 2);
     value = false;
 }
 
@@ -247,7 +384,7 @@ JSONWriter::endMember(void) {
 void
 JSONWriter::beginArray() {
     separator();
-    os << "[";
+    buf.put('[');
     ++level;
     value = false;
     space = 0;
@@ -259,7 +396,7 @@ JSONWriter::endArray(void) {
     if (space == '\n') {
         newline();
     }
-    os << "]";
+    buf.put(']');
     value = true;
     space = '\n';
 }
@@ -272,7 +409,7 @@ JSONWriter::writeString(const char *s) {
     }
 
     separator();
-    escapeUnicodeString(os, s);
+    escapeUnicodeString(buf, s);
     value = true;
     space = ' ';
 }
@@ -280,7 +417,7 @@ JSONWriter::writeString(const char *s) {
 void
 JSONWriter::writeBase64(const void *bytes, size_t size) {
     separator();
-    encodeBase64String(os, (const unsigned char *)bytes, size);
+    encodeBase64String(buf, (const unsigned char *)bytes, size);
     value = true;
     space = ' ';
 }
@@ -288,7 +425,7 @@ JSONWriter::writeBase64(const void *bytes, size_t size) {
 void
 JSONWriter::writeNull(void) {
     separator();
-    os << "null";
+    buf.puts("null");
     value = true;
     space = ' ';
 }
@@ -296,11 +433,82 @@ JSONWriter::writeNull(void) {
 void
 JSONWriter::writeBool(bool b) {
     separator();
-    os << (b ? "true" : "false");
+    buf.puts(b ? "true" : "false");
     value = true;
     space = ' ';
 }
 
+/**
+ * Append a length-prefixed section to the binary sidecar and return
+ * its offset.
+ */
+size_t
+JSONWriter::writeBinarySection(const void *bytes, size_t size)
+{
+    size_t offset = *binCursor;
+
+    unsigned char prefix[4];
+    prefix[0] = (unsigned char)(size      );
+    prefix[1] = (unsigned char)(size >>  8);
+    prefix[2] = (unsigned char)(size >> 16);
+    prefix[3] = (unsigned char)(size >> 24);
+
+    bin->write((const char *)prefix, sizeof prefix);
+    bin->write((const char *)bytes, size);
+    *binCursor += sizeof prefix + size;
+
+    return offset;
+}
+
+/**
+ * Append an image to the binary sidecar as raw pixels -- a "RAW1"
+ * header followed by tightly packed rows, top-down -- and return its
+ * offset.  Spares both ends the PNG codec: the GUI recognizes the
+ * header and adopts the pixel buffer as-is (see
+ * ApiSurface::contentsFromRaw).
+ */
+size_t
+JSONWriter::writeBinaryRawImage(const image::Image *image)
+{
+    size_t offset = *binCursor;
+
+    size_t rowBytes = (size_t)image->width * image->channels;
+    size_t size = 16 + rowBytes * image->height;
+
+    unsigned char header[20];
+    header[ 0] = (unsigned char)(size      );
+    header[ 1] = (unsigned char)(size >>  8);
+    header[ 2] = (unsigned char)(size >> 16);
+    header[ 3] = (unsigned char)(size >> 24);
+    header[ 4] = 'R';
+    header[ 5] = 'A';
+    header[ 6] = 'W';
+    header[ 7] = '1';
+    header[ 8] = (unsigned char)(image->width      );
+    header[ 9] = (unsigned char)(image->width >>  8);
+    header[10] = (unsigned char)(image->width >> 16);
+    header[11] = (unsigned char)(image->width >> 24);
+    header[12] = (unsigned char)(image->height      );
+    header[13] = (unsigned char)(image->height >>  8);
+    header[14] = (unsigned char)(image->height >> 16);
+    header[15] = (unsigned char)(image->height >> 24);
+    header[16] = (unsigned char)(image->channels      );
+    header[17] = (unsigned char)(image->channels >>  8);
+    header[18] = (unsigned char)(image->channels >> 16);
+    header[19] = (unsigned char)(image->channels >> 24);
+    bin->write((const char *)header, sizeof header);
+
+    const unsigned char *row = image->start();
+    for (unsigned y = 0; y < image->height; ++y) {
+        bin->write((const char *)row, rowBytes);
+        row += image->stride();
+    }
+
+    *binCursor += 4 + size;
+
+    return offset;
+}
+
 void
 JSONWriter::writeImage(image::Image *image, const char *format, unsigned depth)
 {
@@ -320,12 +528,86 @@ JSONWriter::writeImage(image::Image *image, const char *format, unsigned depth)
 
     writeStringMember("__format__", format);
 
-    beginMember("__data__");
-    std::stringstream ss;
-    image->writePNG(ss);
-    const std::string & s = ss.str();
-    writeBase64(s.data(), s.size());
-    endMember(); // __data__
+    if (bin && image->channels != 2) {
+        // raw pixels, adopted by the GUI without a decode pass; the
+        // GUI has no direct layout for two-channel images, so those
+        // keep going through PNG
+        writeIntMember("__binary__", writeBinaryRawImage(image));
+    } else {
+        std::stringstream ss;
+        image->writePNG(ss);
+        const std::string & s = ss.str();
+
+        if (bin) {
+            writeIntMember("__binary__", writeBinarySection(s.data(), s.size()));
+        } else {
+            beginMember("__data__");
+            writeBase64(s.data(), s.size());
+            endMember(); // __data__
+        }
+    }
+
+    endObject();
+}
+
+std::string
+JSONWriter::encodeImage(image::Image *image, bool sidecar)
+{
+    if (sidecar && image->channels != 2) {
+        // raw pixels go straight from the image to the sidecar at
+        // write time (see writeEncodedImage); nothing to precompute
+        return std::string();
+    }
+
+    std::stringstream png;
+    image->writePNG(png);
+    if (sidecar) {
+        return png.str();
+    }
+    const std::string &s = png.str();
+
+    std::stringstream out;
+    {
+        JSONBuffer outBuf(out);
+        encodeBase64String(outBuf, (const unsigned char *)s.data(), s.size());
+    }
+    return out.str();
+}
+
+void
+JSONWriter::writeEncodedImage(image::Image *image, const char *format,
+                              unsigned depth, const std::string &data)
+{
+    if (!image) {
+        writeNull();
+        return;
+    }
+
+    beginObject();
+
+    // Tell the GUI this is no ordinary object, but an image
+    writeStringMember("__class__", "image");
+
+    writeIntMember("__width__", image->width);
+    writeIntMember("__height__", image->height / depth);
+    writeIntMember("__depth__", depth);
+
+    writeStringMember("__format__", format);
+
+    if (bin && image->channels != 2) {
+        // raw pixels, adopted by the GUI without a decode pass, same
+        // as writeImage
+        writeIntMember("__binary__", writeBinaryRawImage(image));
+    } else if (bin) {
+        writeIntMember("__binary__", writeBinarySection(data.data(), data.size()));
+    } else {
+        beginMember("__data__");
+        separator();
+        buf.write(data.data(), data.size());
+        value = true;
+        space = ' ';
+        endMember(); // __data__
+    }
 
     endObject();
 }
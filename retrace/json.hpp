@@ -31,20 +31,23 @@
 #define _JSON_HPP_
 
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 #include <wchar.h>
 
 #ifdef _MSC_VER
 #  include <float.h>
 #  define isfinite _finite
 #  define isnan _isnan
-#else
-#  include <math.h> // isfinite, isnan
 #endif
+#include <math.h> // isfinite, isnan
 
-#include <iomanip>
 #include <limits>
 #include <ostream>
 #include <string>
+#include <vector>
+
+#include "os.hpp" // snprintf
 
 
 namespace image {
@@ -52,10 +55,67 @@ namespace image {
 }
 
 
-class JSONWriter
+/**
+ * Pooled chunk buffer JSONWriter renders into.
+ *
+ * Tokens are appended with memcpy into fixed-size chunks drawn from a
+ * process-wide pool and returned to it on flush, so sequential state
+ * dumps -- rebuilt many times a minute while stepping in the GUI --
+ * reuse the same memory instead of growing and tearing down megabytes
+ * of stringstream state every time.
+ */
+class JSONBuffer
 {
+public:
+    JSONBuffer(std::ostream &_os);
+    ~JSONBuffer();
+
+    inline void
+    put(char c) {
+        if (tail == CHUNK_SIZE) {
+            grow();
+        }
+        chunks.back()[tail++] = c;
+    }
+
+    void
+    write(const char *bytes, size_t size);
+
+    inline void
+    puts(const char *str) {
+        write(str, strlen(str));
+    }
+
+    /** Write the buffered chunks out and recycle them into the pool. */
+    void
+    flush(void);
+
 private:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
     std::ostream &os;
+    std::vector<char *> chunks;
+    size_t tail;
+
+    void
+    grow(void);
+};
+
+
+class JSONWriter
+{
+private:
+    JSONBuffer buf;
+
+    std::ostream *bin;
+    size_t binOffset;
+
+    /* Position of the next sidecar section; normally &binOffset, but
+     * fragment writers of the same document share the owner's cursor
+     * (see shareBinarySidecar). */
+    size_t *binCursor;
+
+    bool fragment;
 
     int level;
     bool value;
@@ -67,11 +127,83 @@ private:
     void
     separator(void);
 
+    size_t
+    writeBinarySection(const void *bytes, size_t size);
+
+    size_t
+    writeBinaryRawImage(const image::Image *image);
+
+    inline void
+    writeSInt(long long n) {
+        char s[32];
+        snprintf(s, sizeof s, "%lld", n);
+        buf.puts(s);
+    }
+
+    inline void
+    writeUInt(unsigned long long n) {
+        char s[32];
+        snprintf(s, sizeof s, "%llu", n);
+        buf.puts(s);
+    }
+
 public:
     JSONWriter(std::ostream &_os);
 
+    /**
+     * Write a fragment of an enclosing object rather than a complete
+     * document: no braces are emitted and members are indented as if
+     * at depth one, so the buffers of consecutive fragments can be
+     * concatenated between a "{"/"}" pair into a document
+     * byte-identical to a single writer's output.  `continued` marks
+     * whether a previous fragment already wrote a member, and hence
+     * whether the first member here needs a separating comma.
+     */
+    JSONWriter(std::ostream &_os, bool continued);
+
     ~JSONWriter();
 
+    /**
+     * Write the buffered output to the stream.  Destruction flushes
+     * too; fragment writers whose buffers are concatenated while the
+     * writers are still alive must flush explicitly first.
+     */
+    void
+    flush(void) {
+        buf.flush();
+    }
+
+    /**
+     * Divert image payloads into a sidecar binary stream.
+     *
+     * Each image is then written to the sidecar as a 32-bit
+     * little-endian length followed by the payload -- raw pixels
+     * behind a "RAW1" header for the common channel layouts, PNG
+     * bytes otherwise -- and the JSON document references it through
+     * a "__binary__" offset member instead of carrying a base64
+     * "__data__" member.
+     */
+    void
+    setBinarySidecar(std::ostream &_bin) {
+        bin = &_bin;
+    }
+
+    bool
+    hasBinarySidecar(void) const {
+        return bin != NULL;
+    }
+
+    /**
+     * Write image payloads into the same sidecar as another writer,
+     * continuing its running offset, for fragment writers serializing
+     * sections of the owner's document.
+     */
+    void
+    shareBinarySidecar(JSONWriter &owner) {
+        bin = owner.bin;
+        binCursor = owner.binCursor;
+    }
+
     void
     beginObject();
 
@@ -119,7 +251,7 @@ public:
     inline void
     writeInt(signed char n) {
         separator();
-        os << std::dec << static_cast<int>(n);
+        writeSInt(n);
         value = true;
         space = ' ';
     }
@@ -127,7 +259,7 @@ public:
     inline void
     writeInt(unsigned char n) {
         separator();
-        os << std::dec << static_cast<unsigned>(n);
+        writeUInt(n);
         value = true;
         space = ' ';
     }
@@ -136,7 +268,11 @@ public:
     inline void
     writeInt(T n) {
         separator();
-        os << std::dec << n;
+        if (std::numeric_limits<T>::is_signed) {
+            writeSInt((long long)n);
+        } else {
+            writeUInt((unsigned long long)n);
+        }
         value = true;
         space = ' ';
     }
@@ -147,15 +283,18 @@ public:
         separator();
         if (isnan(n)) {
             // NaN is non-standard but widely supported
-            os << "NaN";
+            buf.puts("NaN");
         } else if (!isfinite(n)) {
             // Infinite is non-standard but widely supported
             if (n < 0) {
-                os << '-';
+                buf.put('-');
             }
-            os << "Infinity";
+            buf.puts("Infinity");
         } else {
-            os << std::dec << std::setprecision(std::numeric_limits<T>::digits10 + 1) << n;
+            char s[64];
+            snprintf(s, sizeof s, "%.*g",
+                     std::numeric_limits<T>::digits10 + 1, (double)n);
+            buf.puts(s);
         }
         value = true;
         space = ' ';
@@ -185,6 +324,23 @@ public:
 
     void
     writeImage(image::Image *image, const char *format, unsigned depth = 1);
+
+    /**
+     * The payload of writeImage -- PNG encode, plus base64 unless the
+     * writer has a binary sidecar -- computed without touching the
+     * writer, so callers can produce it on worker threads ahead of
+     * time.  Empty when a sidecar takes the raw pixels directly, in
+     * which case writeEncodedImage reads them off the image itself.
+     */
+    static std::string
+    encodeImage(image::Image *image, bool sidecar = false);
+
+    /**
+     * Like writeImage, with the payload precomputed by encodeImage().
+     */
+    void
+    writeEncodedImage(image::Image *image, const char *format, unsigned depth,
+                      const std::string &data);
 };
 
 #endif /* _JSON_HPP_ */
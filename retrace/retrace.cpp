@@ -25,6 +25,8 @@
 
 
 #include <string.h>
+
+#include <algorithm>
 #include <iostream>
 
 #include "os_time.hpp"
@@ -32,6 +34,9 @@
 #include "retrace.hpp"
 
 
+thread_specific ScopedAllocator::Arena *ScopedAllocator::arena = NULL;
+
+
 namespace retrace {
 
 
@@ -66,17 +71,55 @@ void unsupported(trace::Call &call) {
     warning(call) << "unsupported " << call.name() << " call\n";
 }
 
-inline void Retracer::addCallback(const Entry *entry) {
-    assert(entry->name);
-    assert(entry->callback);
-    map[entry->name] = entry->callback;
+void Retracer::addCallbacks(const Entry *_entries) {
+    // Just record the table; it is walked when the flat index is
+    // (re)built, keeping registration free of per-entry startup work.
+    tables.push_back(_entries);
+    sorted = false;
 }
 
 
-void Retracer::addCallbacks(const Entry *entries) {
-    while (entries->name && entries->callback) {
-        addCallback(entries++);
+static bool
+entryNameLess(const Entry *a, const Entry *b) {
+    return strcmp(a->name, b->name) < 0;
+}
+
+
+Callback Retracer::resolve(const char *name) {
+    if (!sorted) {
+        entries.clear();
+        for (std::vector<const Entry *>::const_iterator it = tables.begin();
+             it != tables.end(); ++it) {
+            for (const Entry *entry = *it;
+                 entry->name && entry->callback; ++entry) {
+                entries.push_back(entry);
+            }
+        }
+        // Stable, so that among duplicate names the last registered
+        // entry wins, as it did with map overwrites.
+        std::stable_sort(entries.begin(), entries.end(), entryNameLess);
+        sorted = true;
     }
+
+    size_t lo = 0;
+    size_t hi = entries.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(entries[mid]->name, name);
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else if (cmp > 0) {
+            hi = mid;
+        } else {
+            while (mid + 1 < entries.size() &&
+                   strcmp(entries[mid + 1]->name, name) == 0) {
+                ++mid;
+            }
+            return entries[mid]->callback;
+        }
+    }
+
+    return NULL;
 }
 
 
@@ -94,11 +137,9 @@ void Retracer::retrace(trace::Call &call) {
     }
 
     if (!callback) {
-        Map::const_iterator it = map.find(call.name());
-        if (it == map.end()) {
+        callback = resolve(call.name());
+        if (!callback) {
             callback = &unsupported;
-        } else {
-            callback = it->second;
         }
         callbacks[id] = callback;
     }
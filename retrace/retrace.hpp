@@ -45,6 +45,20 @@ namespace image {
 }
 
 
+/**
+ * Compile-time switch for the debugging checks on the replay hot path
+ * (see the RETRACE_FAST build option).  Replay farms feeding it
+ * known-good traces can build with the checks compiled out; guarding
+ * with a constant `if` rather than `#ifdef` at the use sites keeps the
+ * disabled code compiled and warning-free.
+ */
+#ifdef RETRACE_FAST
+#  define RETRACE_DEBUG_CHECKS 0
+#else
+#  define RETRACE_DEBUG_CHECKS 1
+#endif
+
+
 namespace retrace {
 
 
@@ -60,15 +74,13 @@ public:
      */
     inline void *
     alloc(const trace::Value *value, size_t size) {
-        const trace::Array *array = dynamic_cast<const trace::Array *>(value);
+        const trace::Array *array = value->toArray();
         if (array) {
             return ::ScopedAllocator::alloc(array->size() * size);
         }
-        const trace::Null *null = dynamic_cast<const trace::Null *>(value);
-        if (null) {
-            return NULL;
+        if (RETRACE_DEBUG_CHECKS) {
+            assert(dynamic_cast<const trace::Null *>(value));
         }
-        assert(0);
         return NULL;
     }
 
@@ -98,6 +110,53 @@ extern bool profilingPixelsDrawn;
  */
 extern bool dumpingState;
 
+/**
+ * --dump-state-binary: stream receiving the image payloads of state
+ * dumps as raw length-prefixed PNG sections referenced by offset from
+ * the JSON, or NULL to base64-encode them inline (see json.cpp).
+ */
+extern std::ostream *stateBinarySidecar;
+
+/**
+ * Reduce a state dump to the delta against the previous dump of the
+ * same replay (see retrace_statediff.cpp).  The result is valid JSON
+ * to be merged recursively onto the previous document.
+ */
+std::string diffStateDump(const std::string &previous, const std::string &current);
+
+/**
+ * --fast-replay: frames outside the selected set still execute every
+ * call, so API state stays correct, but the API retracer clamps their
+ * draws to a single pixel to avoid the fill-rate cost.  fastFrame is
+ * true while replaying such a frame.
+ */
+extern bool fastReplay;
+extern bool fastFrame;
+
+/**
+ * --no-syncs: drop recorded waits (glFinish, client sync waits) when
+ * nothing can observe the difference (see glretrace::elideSync).
+ */
+extern bool elideSyncs;
+
+/**
+ * --skip-redundant-state: drop state-setting calls that set
+ * already-current state (see glretrace_statefilter.cpp).
+ */
+extern bool skipRedundantState;
+
+
+/**
+ * Snapshot region of interest (negative size means the full draw buffer)
+ * and decimation factor, so coarse visual diffing does not pay for a
+ * full-resolution readback and encode.
+ */
+extern int snapshotX;
+extern int snapshotY;
+extern int snapshotWidth;
+extern int snapshotHeight;
+extern unsigned snapshotDownsample;
+
 
 enum Driver {
     DRIVER_DEFAULT,
@@ -113,6 +172,11 @@ extern const char *driverModule;
 
 extern bool doubleBuffer;
 extern bool coreProfile;
+extern bool headless;
+
+/* Directory for the replay-side program binary cache, or NULL when
+ * disabled (see glretrace_shadercache.cpp). */
+extern const char *programCacheDir;
 
 extern unsigned frameNo;
 extern unsigned callNo;
@@ -133,11 +197,6 @@ struct Entry {
 };
 
 
-struct stringComparer {
-  bool operator() (const char *a, const  char *b) const {
-    return strcmp(a, b) < 0;
-  }
-};
 
 
 extern const Entry stdc_callbacks[];
@@ -145,19 +204,29 @@ extern const Entry stdc_callbacks[];
 
 class Retracer
 {
-    typedef std::map<const char *, Callback, stringComparer> Map;
-    Map map;
-
+    // Registered callback tables.  Registration just records each
+    // table pointer; the flat index -- sorted by name for binary
+    // search -- is only built on the first unresolved call (see
+    // resolve()), and each function's handler is then cached by
+    // signature id in callbacks, so the name lookup happens at most
+    // once per function.  The generated tables are emitted already
+    // sorted by name, which makes the one-off sort of the flat index
+    // near-linear.
+    std::vector<const Entry *> tables;
+    bool sorted;
+
+    std::vector<const Entry *> entries;
     std::vector<Callback> callbacks;
 
+    Callback resolve(const char *name);
+
 public:
-    Retracer() {
+    Retracer() : sorted(false) {
         addCallbacks(stdc_callbacks);
     }
 
     virtual ~Retracer() {}
 
-    void addCallback(const Entry *entry);
     void addCallbacks(const Entry *entries);
 
     void retrace(trace::Call &call);
@@ -172,6 +241,24 @@ public:
         return NULL;
     }
 
+    /**
+     * Start an asynchronous snapshot readback, so the transfer overlaps
+     * with subsequent replay.  Returns false when the API has no
+     * asynchronous path, in which case getSnapshot() must be used instead.
+     */
+    virtual bool
+    startSnapshot(void) {
+        return false;
+    }
+
+    /**
+     * Complete the oldest readback started with startSnapshot().
+     */
+    virtual image::Image *
+    finishSnapshot(void) {
+        return NULL;
+    }
+
     virtual bool
     dumpState(std::ostream &os) {
         return false;
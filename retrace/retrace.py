@@ -125,8 +125,19 @@ class ValueDeserializer(stdapi.Visitor, stdapi.ExpanderMixin):
         tmp = '_a_' + array.tag + '_' + str(self.seq)
         self.seq += 1
 
+        # Arrays of scalars (index/vertex data, above all) usually
+        # carry a packed copy of their elements; hand it off in bulk
+        # instead of extracting element-wise.
+        elemType = array.type
+        while isinstance(elemType, (stdapi.Const, stdapi.Alias)):
+            elemType = elemType.type
+        packed = isinstance(elemType, stdapi.Literal) \
+            and elemType.kind in ('SInt', 'UInt', 'Float', 'Double')
+
         print '    if (%s) {' % (lvalue,)
-        print '        const trace::Array *%s = dynamic_cast<const trace::Array *>(&%s);' % (tmp, rvalue)
+        print '        const trace::Array *%s = (%s).toArray();' % (tmp, rvalue)
+        if packed:
+            print '        if (!%s->toScalarArray(%s)) {' % (tmp, lvalue)
         length = '%s->values.size()' % (tmp,)
         index = '_j' + array.tag
         print '        for (size_t {i} = 0; {i} < {length}; ++{i}) {{'.format(i = index, length = length)
@@ -134,6 +145,8 @@ class ValueDeserializer(stdapi.Visitor, stdapi.ExpanderMixin):
             self.visit(array.type, '%s[%s]' % (lvalue, index), '*%s->values[%s]' % (tmp, index))
         finally:
             print '        }'
+            if packed:
+                print '        }'
             print '    }'
     
     def visitPointer(self, pointer, lvalue, rvalue):
@@ -141,7 +154,7 @@ class ValueDeserializer(stdapi.Visitor, stdapi.ExpanderMixin):
         self.seq += 1
 
         print '    if (%s) {' % (lvalue,)
-        print '        const trace::Array *%s = dynamic_cast<const trace::Array *>(&%s);' % (tmp, rvalue)
+        print '        const trace::Array *%s = (%s).toArray();' % (tmp, rvalue)
         try:
             self.visit(pointer.type, '%s[0]' % (lvalue,), '*%s->values[0]' % (tmp,))
         finally:
@@ -241,7 +254,7 @@ class SwizzledValueRegistrator(stdapi.Visitor, stdapi.ExpanderMixin):
         pass
 
     def visitArray(self, array, lvalue, rvalue):
-        print '    const trace::Array *_a%s = dynamic_cast<const trace::Array *>(&%s);' % (array.tag, rvalue)
+        print '    const trace::Array *_a%s = (%s).toArray();' % (array.tag, rvalue)
         print '    if (_a%s) {' % (array.tag)
         length = '_a%s->values.size()' % array.tag
         index = '_j' + array.tag
@@ -253,7 +266,7 @@ class SwizzledValueRegistrator(stdapi.Visitor, stdapi.ExpanderMixin):
             print '    }'
     
     def visitPointer(self, pointer, lvalue, rvalue):
-        print '    const trace::Array *_a%s = dynamic_cast<const trace::Array *>(&%s);' % (pointer.tag, rvalue)
+        print '    const trace::Array *_a%s = (%s).toArray();' % (pointer.tag, rvalue)
         print '    if (_a%s) {' % (pointer.tag)
         try:
             self.visit(pointer.type, '%s[0]' % (lvalue,), '*_a%s->values[0]' % (pointer.tag,))
@@ -519,19 +532,28 @@ class Retracer:
                 if method.sideeffects and not method.internal:
                     self.retraceInterfaceMethod(interface, method)
 
-        print 'const retrace::Entry %s[] = {' % self.table_name
+        entries = []
         for function in functions:
             if not function.internal:
                 if function.sideeffects:
-                    print '    {"%s", &retrace_%s},' % (function.name, function.name)
+                    entries.append((function.name, '&retrace_%s' % function.name))
                 else:
-                    print '    {"%s", &retrace::ignore},' % (function.name,)
+                    entries.append((function.name, '&retrace::ignore'))
         for interface in interfaces:
-            for method in interface.iterMethods():                
+            for method in interface.iterMethods():
+                name = '%s::%s' % (interface.name, method.name)
                 if method.sideeffects:
-                    print '    {"%s::%s", &retrace_%s__%s},' % (interface.name, method.name, interface.name, method.name)
+                    entries.append((name, '&retrace_%s__%s' % (interface.name, method.name)))
                 else:
-                    print '    {"%s::%s", &retrace::ignore},' % (interface.name, method.name)
+                    entries.append((name, '&retrace::ignore'))
+        # Emitted sorted (matching strcmp order) so the resolver's flat
+        # index builds without reordering; the sort is stable, keeping
+        # the last duplicate last, which is the one the resolver picks.
+        entries.sort(key=lambda entry: entry[0])
+        print '// Sorted by name.'
+        print 'const retrace::Entry %s[] = {' % self.table_name
+        for name, callback in entries:
+            print '    {"%s", %s},' % (name, callback)
         print '    {NULL, NULL}'
         print '};'
         print
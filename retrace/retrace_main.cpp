@@ -26,12 +26,22 @@
 
 #include <string.h>
 #include <limits.h> // for CHAR_MAX
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <getopt.h>
 
+#include "os_async_file.hpp"
 #include "os_binary.hpp"
+#include "os_shmem.hpp"
 #include "os_time.hpp"
 #include "os_thread.hpp"
+#include "snapshot_ring.hpp"
 #include "image.hpp"
 #include "trace_callset.hpp"
 #include "trace_dump.hpp"
@@ -43,11 +53,104 @@ static bool waitOnFinish = false;
 
 static const char *comparePrefix = NULL;
 static const char *snapshotPrefix = NULL;
+
+/* Store snapshots as raw snappy-compressed images instead of PNGs; much
+ * cheaper to encode for intermediate artifacts that are compared once and
+ * deleted.  Also selects the format the comparison references are read in. */
+static bool snapshotRaw = false;
+
+/* --snapshot-delta: store file snapshots as an XOR against the previous
+ * frame, with a keyframe every N frames.  Consecutive frames are mostly
+ * identical, so the deltas are almost all zeros and encode to a small
+ * fraction of a full frame -- every-frame dumps of long traces are
+ * I/O-bound, and this is where the bytes go.  Delta frames get a `d`
+ * extension (.dpng/.draw) and are reconstructed transparently by
+ * `apitrace diff-images`. */
+static unsigned snapshotDeltaInterval = 0;
+static image::Image *snapshotDeltaPrev = NULL;
+static unsigned snapshotDeltaOrdinal = 0;
+
 static trace::CallSet snapshotFrequency;
 static trace::CallSet compareFrequency;
 
+/* Frames replayed at full cost under --fast-replay (frame numbers). */
+static trace::CallSet fastReplayFrequency;
+
+/* --snapshot-shm: hand streamed snapshots over in shared memory instead
+ * of encoding them into the stdout pipe (see common/snapshot_ring.hpp). */
+static const char *snapshotShmName = NULL;
+static os::shared_memory snapshotShm;
+
+/* --fingerprint: emit a digest per snapshot instead of an image. */
+static bool snapshotFingerprint = false;
+
+/* --bisect: compare per-snapshot fingerprints against a reference
+ * manifest in-process and report the first divergent snapshot, so one
+ * O(n) replay localizes a bad frame instead of O(n log n) repeated
+ * prefix replays. */
+static const char *bisectFile = NULL;
+static std::map<unsigned, unsigned long long> bisectRefs;
+static unsigned firstDivergence = ~0u;
+static bool bisectStopped = false;
+
+/* --snapshot-adaptive: two-pass capture.  The first pass fingerprints
+ * every snapshot point against a --fingerprint manifest from a golden
+ * run; the trace is then rewound and replayed for real with the
+ * snapshot set narrowed to the calls that diverged, so readback and
+ * encoding are only paid for the regressed frames. */
+static const char *adaptiveFile = NULL;
+static std::map<unsigned, unsigned long long> adaptiveRefs;
+static bool adaptivePass = false;
+static std::vector<unsigned> adaptiveDivergent;
+
+/* --snapshot-manifest: content-addressed upload manifest.  Every file
+ * snapshot is fingerprinted and listed as `<no> <digest> <filename>`;
+ * a snapshot whose digest was already seen -- in this run, or in a
+ * previous manifest found at the same path -- is not encoded or
+ * written again, its line referencing the file that already carries
+ * those bytes.  Farm uploaders then only transfer files named by new
+ * digests. */
+static const char *snapshotManifestFile = NULL;
+static os::mutex snapshotManifestMutex;
+static std::map<unsigned long long, std::string> snapshotManifestByDigest;
+static std::map<unsigned, std::pair<unsigned long long, std::string> > snapshotManifestEntries;
+
+/* State dump targets, and the call number of the currently pending
+ * dump (~0 when none is pending).  A dump can fail before a context is
+ * made current, so the pending target sticks until a dump succeeds. */
+static trace::CallSet dumpStateFrequency;
 static unsigned dumpStateCallNo = ~0;
 
+/* --dump-state-diff: emit only the delta against the previous dump,
+ * which is kept here (see retrace_statediff.cpp). */
+static bool dumpStateDiff = false;
+static std::string previousStateDump;
+
+/* --dump-state-binary: sidecar stream receiving the image payloads of
+ * state dumps as raw length-prefixed PNG sections (see json.cpp). */
+static std::ofstream stateBinaryStream;
+
+/* --estimate: no replay; predict replay time and memory from one
+ * decode-only pass, for farm job scheduling. */
+static bool estimateOnly = false;
+
+static bool usePipeline = false;
+static bool fastForward = false;
+static bool warmupPass = false;
+static bool timingReport = false;
+static bool serverMode = false;
+
+/* --psample: sampling profiler.  A timer thread reads the call number
+ * the replay loop publishes and logs it; samples are attributed to
+ * functions and frames in a post-pass over the trace.  Unlike --pcpu,
+ * which brackets every call with clock reads and so distorts small
+ * calls badly, sampling leaves the replay loop untouched. */
+static bool profilingSamples = false;
+static unsigned samplingRate = 1000;            // samples per second
+static std::vector<unsigned> sampleLog;
+static volatile bool samplerStop = false;
+static os::thread samplerThread;
+
 retrace::Retracer retracer;
 
 
@@ -59,14 +162,23 @@ trace::Profiler profiler;
 
 
 int verbosity = 0;
-bool debug = true;
+bool debug = RETRACE_DEBUG_CHECKS;
 bool dumpingState = false;
+std::ostream *stateBinarySidecar = NULL;
+
+int snapshotX = 0;
+int snapshotY = 0;
+int snapshotWidth = -1;
+int snapshotHeight = -1;
+unsigned snapshotDownsample = 1;
 
 Driver driver = DRIVER_DEFAULT;
 const char *driverModule = NULL;
 
 bool doubleBuffer = true;
 bool coreProfile = false;
+bool headless = false;
+const char *programCacheDir = NULL;
 
 bool profiling = false;
 bool profilingGpuTimes = false;
@@ -77,10 +189,18 @@ bool useCallNos = true;
 unsigned frameNo = 0;
 unsigned callNo = 0;
 
+bool fastReplay = false;
+bool fastFrame = false;
+bool elideSyncs = false;
+bool skipRedundantState = false;
+
 
 void
 frameComplete(trace::Call &call) {
     ++frameNo;
+    if (fastReplay) {
+        fastFrame = !fastReplayFrequency.contains(frameNo);
+    }
 }
 
 
@@ -89,60 +209,604 @@ static Dumper defaultDumper;
 Dumper *dumper = &defaultDumper;
 
 
+/* Serializes snapshot progress messages, which may come from the snapshot
+ * writer threads as well as the replay thread. */
+static os::mutex snapshotOutputMutex;
+
+/* I/O pool performing the open/write/close of encoded snapshot files,
+ * so the encoder threads are not stalled by per-file filesystem
+ * latency (see os_async_file.hpp).  Only set while snapshots go to
+ * files. */
+static os::async_file_writer *snapshotFileWriter = NULL;
+
+static void
+snapshotWriteDone(const char *filename, bool ok, void *)
+{
+    if (ok && retrace::verbosity >= 0) {
+        os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+        std::cout << "Wrote " << filename << "\n";
+    }
+}
+
+
 /**
- * Take/compare snapshots.
+ * Hand a streamed snapshot over through the shared-memory ring.  The
+ * region is created lazily on the first frame, sized for what we are
+ * seeing, and every frame is announced with a "### shm-frame" line on
+ * stdout (see common/snapshot_ring.hpp for the protocol).  Returns
+ * false -- letting the caller fall back to in-band PNM -- when the
+ * region cannot be created or the frame does not fit a slot.
+ */
+static bool
+writeSnapshotShm(image::Image *src, unsigned no) {
+    size_t rowBytes = (size_t)src->width * src->channels;
+    size_t frameSize = rowBytes * src->height;
+
+    SnapshotRingHeader *header = (SnapshotRingHeader *)snapshotShm.map();
+    if (!header) {
+        enum {
+            SLOTS = 4,
+            MIN_SLOT_SIZE = 16 * 1024 * 1024
+        };
+        /* Round up generously so a moderate window resize does not
+         * overflow the slots. */
+        size_t slotSize = (2 * frameSize + 0xfffff) & ~(size_t)0xfffff;
+        if (slotSize < MIN_SLOT_SIZE) {
+            slotSize = MIN_SLOT_SIZE;
+        }
+        SnapshotRingHeader proto;
+        proto.slotSize = slotSize;
+        if (!snapshotShm.create(snapshotShmName,
+                                snapshotRingSlotOffset(&proto, SLOTS))) {
+            std::cerr << "warning: failed to create shared memory region "
+                      << snapshotShmName << "\n";
+            snapshotShmName = NULL;
+            return false;
+        }
+        header = (SnapshotRingHeader *)snapshotShm.map();
+        header->version = SNAPSHOT_RING_VERSION;
+        header->slots = SLOTS;
+        header->slotSize = slotSize;
+        header->head = 0;
+        header->tail = 0;
+        header->magic = SNAPSHOT_RING_MAGIC;
+    }
+
+    if (frameSize > header->slotSize) {
+        return false;
+    }
+
+    /* Stall while the consumer is a full ring behind. */
+    while (header->head - header->tail >= header->slots) {
+        os::sleep(100);
+    }
+
+    unsigned slot = header->head % header->slots;
+    unsigned char *dst = (unsigned char *)header +
+        snapshotRingSlotOffset(header, slot);
+    const unsigned char *row = src->start();
+    for (unsigned y = 0; y < src->height; ++y) {
+        memcpy(dst, row, rowBytes);
+        dst += rowBytes;
+        row += src->stride();
+    }
+
+    header->head = header->head + 1;
+
+    {
+        os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+        std::cout << "### shm-frame " << slot
+                  << " " << no
+                  << " " << src->width
+                  << " " << src->height
+                  << " " << src->channels
+                  << "\n";
+        std::cout.flush();
+    }
+
+    return true;
+}
+
+
+/**
+ * 64-bit FNV-1a over the pixel rows, top row first, so the digest does
+ * not depend on the bottom-up orientation of GL readbacks.
+ */
+static unsigned long long
+fingerprintImage(image::Image *src)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char *row = src->start();
+    size_t rowBytes = (size_t)src->width * src->channels;
+    for (unsigned y = 0; y < src->height; ++y) {
+        for (size_t i = 0; i < rowBytes; ++i) {
+            hash ^= row[i];
+            hash *= 1099511628211ULL;
+        }
+        row += src->stride();
+    }
+    return hash;
+}
+
+
+/**
+ * Read a `<no> <digest> ...` manifest as written by --fingerprint.
+ */
+static bool
+loadFingerprintManifest(const char *filename,
+                        std::map<unsigned, unsigned long long> &refs)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        std::cerr << "error: failed to open " << filename << "\n";
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof line, fp)) {
+        unsigned no;
+        unsigned long long digest;
+        if (sscanf(line, "%u %llx", &no, &digest) == 2) {
+            refs[no] = digest;
+        }
+    }
+    fclose(fp);
+    if (refs.empty()) {
+        std::cerr << "error: no fingerprints in " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Seed the digest index from a previous run's manifest, so snapshots
+ * unchanged since then are skipped entirely.  A missing file is not an
+ * error: the first nightly run starts from nothing.
  */
 static void
-takeSnapshot(unsigned call_no) {
-    static unsigned snapshot_no = 0;
+loadSnapshotManifest(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        return;
+    }
+    char line[1024];
+    while (fgets(line, sizeof line, fp)) {
+        unsigned no;
+        unsigned long long digest;
+        char name[896];
+        if (sscanf(line, "%u %llx %895s", &no, &digest, name) == 3) {
+            if (snapshotManifestByDigest.find(digest) ==
+                snapshotManifestByDigest.end()) {
+                snapshotManifestByDigest[digest] = name;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/**
+ * Write the manifest collected by this run and reset it.
+ */
+static void
+writeSnapshotManifest(void)
+{
+    FILE *fp = fopen(snapshotManifestFile, "w");
+    if (!fp) {
+        std::cerr << "error: failed to write " << snapshotManifestFile << "\n";
+        return;
+    }
+    std::map<unsigned, std::pair<unsigned long long, std::string> >::const_iterator it;
+    for (it = snapshotManifestEntries.begin();
+         it != snapshotManifestEntries.end(); ++it) {
+        fprintf(fp, "%u %016llx %s\n",
+                it->first, it->second.first, it->second.second.c_str());
+    }
+    fclose(fp);
+    if (retrace::verbosity >= 0) {
+        std::cout << "Wrote " << snapshotManifestFile
+                  << " (" << snapshotManifestEntries.size() << " snapshots, "
+                  << snapshotManifestByDigest.size() << " unique)\n";
+    }
+}
 
-    assert(snapshotPrefix || comparePrefix);
 
+/**
+ * Write out (and/or compare) a snapshot image.  Consumes src.  When
+ * delta is set, src holds an XOR against the previous frame rather
+ * than the frame itself (see --snapshot-delta).
+ */
+static void
+writeSnapshot(image::Image *src, unsigned call_no, unsigned snapshot_no,
+              bool delta) {
     image::Image *ref = NULL;
 
+    if (adaptivePass) {
+        /* Fingerprint pass of --snapshot-adaptive; runs inline on the
+         * replay thread, so no locking is needed. */
+        unsigned no = useCallNos ? call_no : snapshot_no;
+        unsigned long long digest = fingerprintImage(src);
+        image::releasePooledImage(src);
+
+        std::map<unsigned, unsigned long long>::const_iterator it =
+            adaptiveRefs.find(no);
+        if (it == adaptiveRefs.end() || it->second != digest) {
+            /* Snapshots the golden run never saw count as divergent:
+             * better to capture them than to silently drop them. */
+            adaptiveDivergent.push_back(call_no);
+        }
+        return;
+    }
+
+    if (bisectFile) {
+        unsigned no = useCallNos ? call_no : snapshot_no;
+        unsigned long long digest = fingerprintImage(src);
+        image::releasePooledImage(src);
+
+        std::map<unsigned, unsigned long long>::const_iterator it =
+            bisectRefs.find(no);
+        os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+        if (it == bisectRefs.end()) {
+            std::cout << "Bisect: snapshot " << no << " has no reference\n";
+        } else if (it->second != digest) {
+            if (no < firstDivergence) {
+                firstDivergence = no;
+            }
+            std::cout << "Bisect: snapshot " << no << " diverges\n";
+            /* The first divergence is the answer; stop fingerprinting. */
+            bisectStopped = true;
+        }
+        return;
+    }
+
+    if (snapshotFingerprint) {
+        unsigned long long digest = fingerprintImage(src);
+        unsigned no = useCallNos ? call_no : snapshot_no;
+        char line[64];
+        snprintf(line, sizeof line, "%u %016llx %dx%d\n",
+                 no, digest, src->width, src->height);
+        image::releasePooledImage(src);
+        os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+        std::cout << line;
+        return;
+    }
+
     if (comparePrefix) {
-        os::String filename = os::String::format("%s%010u.png", comparePrefix, call_no);
-        ref = image::readPNG(filename);
+        os::String filename = os::String::format("%s%010u.%s", comparePrefix, call_no,
+                                                 snapshotRaw ? "raw" : "png");
+        ref = snapshotRaw ? image::readRAW(filename) : image::readPNG(filename);
         if (!ref) {
+            image::releasePooledImage(src);
             return;
         }
         if (retrace::verbosity >= 0) {
+            os::unique_lock<os::mutex> lock(snapshotOutputMutex);
             std::cout << "Read " << filename << "\n";
         }
     }
 
-    image::Image *src = dumper->getSnapshot();
-    if (!src) {
-        std::cout << "Failed to get snapshot\n";
-        return;
-    }
-
     if (snapshotPrefix) {
         if (snapshotPrefix[0] == '-' && snapshotPrefix[1] == 0) {
-            char comment[21];
-            snprintf(comment, sizeof comment, "%u",
-                     useCallNos ? call_no : snapshot_no);
-            src->writePNM(std::cout, comment);
+            unsigned no = useCallNos ? call_no : snapshot_no;
+            if (!snapshotShmName || !writeSnapshotShm(src, no)) {
+                char comment[21];
+                snprintf(comment, sizeof comment, "%u", no);
+                src->writePNM(std::cout, comment);
+            }
         } else {
-            os::String filename = os::String::format("%s%010u.png",
+            const char *ext = snapshotRaw ? (delta ? "draw" : "raw")
+                                          : (delta ? "dpng" : "png");
+            os::String filename = os::String::format("%s%010u.%s",
                                                      snapshotPrefix,
-                                                     useCallNos ? call_no : snapshot_no);
-            if (src->writePNG(filename) && retrace::verbosity >= 0) {
-                std::cout << "Wrote " << filename << "\n";
+                                                     useCallNos ? call_no : snapshot_no,
+                                                     ext);
+            bool duplicate = false;
+            if (snapshotManifestFile) {
+                unsigned no = useCallNos ? call_no : snapshot_no;
+                unsigned long long digest = fingerprintImage(src);
+                os::unique_lock<os::mutex> lock(snapshotManifestMutex);
+                std::map<unsigned long long, std::string>::const_iterator it =
+                    snapshotManifestByDigest.find(digest);
+                if (it != snapshotManifestByDigest.end()) {
+                    /* Identical content was already written under
+                     * another name (or in a previous run); list that
+                     * file and skip the encode. */
+                    snapshotManifestEntries[no] =
+                        std::make_pair(digest, it->second);
+                    duplicate = true;
+                } else {
+                    snapshotManifestByDigest[digest] = filename.str();
+                    snapshotManifestEntries[no] =
+                        std::make_pair(digest, std::string(filename.str()));
+                }
+            }
+            if (duplicate) {
+                /* nothing to write */
+            } else if (snapshotFileWriter) {
+                /* Encode into memory and let the I/O pool write the
+                 * file; the "Wrote" message comes from its completion
+                 * callback. */
+                std::stringstream ss;
+                bool encoded = snapshotRaw ? src->writeRAW(ss)
+                                           : src->writePNG(ss);
+                if (encoded) {
+                    std::string data = ss.str();
+                    snapshotFileWriter->push(filename, data,
+                                             snapshotWriteDone, NULL);
+                }
+            } else {
+                bool written = snapshotRaw ? src->writeRAW(filename)
+                                           : src->writePNG(filename);
+                if (written && retrace::verbosity >= 0) {
+                    os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+                    std::cout << "Wrote " << filename << "\n";
+                }
             }
         }
     }
 
     if (ref) {
-        std::cout << "Snapshot " << call_no << " average precision of " << src->compare(*ref) << " bits\n";
-        delete ref;
+        double precision = src->compare(*ref);
+        /* References have the same dimensions as the snapshots, so pool
+         * them too and the comparison reads stop allocating as well. */
+        image::releasePooledImage(ref);
+        os::unique_lock<os::mutex> lock(snapshotOutputMutex);
+        std::cout << "Snapshot " << call_no << " average precision of " << precision << " bits\n";
+    }
+
+    image::releasePooledImage(src);
+
+    return;
+}
+
+
+/**
+ * Compress and write snapshots on a pool of worker threads.
+ *
+ * zlib-compressing a large frame easily outweighs rendering it, so doing
+ * writePNG on the replay thread makes the PNG encoder the bottleneck of a
+ * per-frame snapshot run.  The replay thread only enqueues the raw image
+ * here; the workers do the comparison read, the compression and the disk
+ * write.  The queue is bounded since every queued entry pins a full
+ * uncompressed frame in memory.
+ */
+class SnapshotWriter
+{
+private:
+    enum {
+        NUM_THREADS = 4,
+        MAX_PENDING = 16
+    };
+
+    struct Job {
+        image::Image *src;
+        unsigned call_no;
+        unsigned snapshot_no;
+        bool delta;
+    };
+
+    os::mutex mutex;
+    os::condition_variable notEmpty;
+    os::condition_variable notFull;
+
+    /* These are protected by the mutex. */
+    std::deque<Job> queue;
+    bool done;
+
+    os::thread threads[NUM_THREADS];
+
+    static void *
+    workerThread(SnapshotWriter *_this) {
+        _this->work();
+        return 0;
+    }
+
+    void
+    work(void) {
+        while (1) {
+            Job job;
+            {
+                os::unique_lock<os::mutex> lock(mutex);
+                while (queue.empty() && !done) {
+                    notEmpty.wait(lock);
+                }
+                if (queue.empty()) {
+                    /* The condition variable has no broadcast, so pass
+                     * the wake-up on to the next idle worker. */
+                    notEmpty.signal();
+                    return;
+                }
+                job = queue.front();
+                queue.pop_front();
+            }
+            notFull.signal();
+
+            writeSnapshot(job.src, job.call_no, job.snapshot_no, job.delta);
+        }
+    }
+
+public:
+    SnapshotWriter() :
+        done(false)
+    {
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i] = os::thread(workerThread, this);
+        }
+    }
+
+    /**
+     * Waits for all queued snapshots to reach disk.
+     */
+    ~SnapshotWriter() {
+        mutex.lock();
+        done = true;
+        mutex.unlock();
+        notEmpty.signal();
+
+        for (int i = 0; i < NUM_THREADS; ++i) {
+            threads[i].join();
+        }
+    }
+
+    void
+    push(image::Image *src, unsigned call_no, unsigned snapshot_no,
+         bool delta) {
+        {
+            os::unique_lock<os::mutex> lock(mutex);
+            while (queue.size() >= MAX_PENDING) {
+                notFull.wait(lock);
+            }
+            Job job;
+            job.src = src;
+            job.call_no = call_no;
+            job.snapshot_no = snapshot_no;
+            job.delta = delta;
+            queue.push_back(job);
+        }
+        notEmpty.signal();
+    }
+};
+
+
+static SnapshotWriter *snapshotWriter = NULL;
+
+
+/**
+ * Turn src into a delta against the previous frame, keeping a private
+ * copy of the frame for the next call, or leave it whole as a
+ * keyframe.  Runs on the replay thread, where snapshots still arrive
+ * in trace order.  Returns whether src is now a delta.
+ */
+static bool
+applySnapshotDelta(image::Image *src) {
+    image::Image *prev = snapshotDeltaPrev;
+
+    bool keyframe = snapshotDeltaOrdinal == 0 ||
+                    !prev ||
+                    prev->width != src->width ||
+                    prev->height != src->height ||
+                    prev->channels != src->channels ||
+                    prev->flipped != src->flipped;
+    if (keyframe) {
+        if (prev) {
+            image::releasePooledImage(prev);
+        }
+        prev = image::getPooledImage(src->width, src->height,
+                                     src->channels, src->flipped);
+        memcpy(prev->pixels, src->pixels,
+               (size_t)src->height * src->width * src->channels);
+        snapshotDeltaPrev = prev;
+        snapshotDeltaOrdinal = 1;
+        return false;
+    }
+
+    /* XOR is its own inverse: the first pass turns src into the delta,
+     * the second turns the stored previous frame into this frame. */
+    src->xorImage(*prev);
+    prev->xorImage(*src);
+
+    if (++snapshotDeltaOrdinal >= snapshotDeltaInterval) {
+        snapshotDeltaOrdinal = 0;
+    }
+    return true;
+}
+
+
+/**
+ * Queue a snapshot for writing, falling back to the replay thread when the
+ * writer pool is not running (PNM output on stdout must stay in call order,
+ * so it never uses the pool).  Consumes src.
+ */
+static void
+dispatchSnapshot(image::Image *src, unsigned call_no) {
+    static unsigned snapshot_no = 0;
+
+    bool delta = false;
+    if (snapshotDeltaInterval &&
+        snapshotPrefix &&
+        !(snapshotPrefix[0] == '-' && snapshotPrefix[1] == 0) &&
+        !comparePrefix && !bisectFile && !snapshotFingerprint) {
+        delta = applySnapshotDelta(src);
     }
 
-    delete src;
+    if (snapshotWriter) {
+        snapshotWriter->push(src, call_no, snapshot_no, delta);
+    } else {
+        writeSnapshot(src, call_no, snapshot_no, delta);
+    }
 
     snapshot_no++;
+}
 
-    return;
+
+/* Call number of the snapshot readback still in flight, if any. */
+static bool snapshotPending = false;
+static unsigned pendingSnapshotNo = 0;
+
+
+/**
+ * Collect and write out the pending asynchronous snapshot, if any.
+ */
+static void
+finishPendingSnapshot(void) {
+    if (!snapshotPending) {
+        return;
+    }
+    snapshotPending = false;
+
+    image::Image *src = dumper->finishSnapshot();
+    if (!src) {
+        std::cout << "Failed to get snapshot\n";
+        return;
+    }
+
+    dispatchSnapshot(src, pendingSnapshotNo);
+}
+
+
+/**
+ * Take/compare snapshots.
+ *
+ * When the dumper supports it, the readback is merely started here and only
+ * collected at the next snapshot point, so the GPU transfer overlaps with
+ * the replay in between.
+ */
+static void
+takeSnapshot(unsigned call_no) {
+    assert(snapshotPrefix || comparePrefix);
+
+    /* Snapshots are written in trace order, so the previous readback must
+     * be drained before a new one is started. */
+    finishPendingSnapshot();
+
+    if (dumper->startSnapshot()) {
+        snapshotPending = true;
+        pendingSnapshotNo = call_no;
+        return;
+    }
+
+    image::Image *src = dumper->getSnapshot();
+    if (!src) {
+        std::cout << "Failed to get snapshot\n";
+        return;
+    }
+
+    dispatchSnapshot(src, call_no);
+}
+
+
+/**
+ * Whether a call can be skipped while fast-forwarding to the state
+ * dump target.  Draws, clears and buffer swaps only change pixels (and
+ * counters such as queries), not the context state the dump reports;
+ * everything else must still execute so the state is faithful at the
+ * target call.
+ */
+static inline bool
+skipWhileFastForwarding(trace::Call *call) {
+    return (call->flags & (trace::CALL_FLAG_RENDER |
+                           trace::CALL_FLAG_END_FRAME |
+                           trace::CALL_FLAG_NO_SIDE_EFFECTS)) != 0;
 }
 
 
@@ -154,10 +818,19 @@ takeSnapshot(unsigned call_no) {
  */
 static void
 retraceCall(trace::Call *call) {
+    if (fastForward && dumpingState &&
+        dumpStateCallNo == (unsigned)~0 &&
+        call->no < dumpStateFrequency.getLast() &&
+        !dumpStateFrequency.contains(*call) &&
+        skipWhileFastForwarding(call)) {
+        return;
+    }
+
     bool swapRenderTarget = call->flags &
         trace::CALL_FLAG_SWAP_RENDERTARGET;
-    bool doSnapshot = snapshotFrequency.contains(*call) ||
-        compareFrequency.contains(*call);
+    bool doSnapshot = !bisectStopped &&
+        (snapshotFrequency.contains(*call) ||
+         compareFrequency.contains(*call));
 
     // For calls which cause rendertargets to be swaped, we take the
     // snapshot _before_ swapping the rendertargets.
@@ -179,10 +852,206 @@ retraceCall(trace::Call *call) {
     if (doSnapshot && !swapRenderTarget)
         takeSnapshot(call->no);
 
-    if (call->no >= dumpStateCallNo &&
-        dumper->dumpState(std::cout)) {
-        exit(0);
+    if (dumpingState && dumpStateCallNo == (unsigned)~0 &&
+        dumpStateFrequency.contains(*call)) {
+        dumpStateCallNo = call->no;
+    }
+    if (call->no >= dumpStateCallNo) {
+        bool dumped;
+        if (dumpStateDiff) {
+            /* The first dump of the run goes out in full; later ones
+             * are reduced against their predecessor. */
+            std::stringstream ss;
+            dumped = dumper->dumpState(ss);
+            if (dumped) {
+                if (previousStateDump.empty()) {
+                    std::cout << ss.str();
+                } else {
+                    std::cout << retrace::diffStateDump(previousStateDump,
+                                                        ss.str());
+                }
+                previousStateDump = ss.str();
+            }
+        } else {
+            dumped = dumper->dumpState(std::cout);
+        }
+        if (dumped) {
+            if (call->no >= dumpStateFrequency.getLast()) {
+                exit(0);
+            }
+            /* more targets ahead -- disarm until the next one */
+            dumpStateCallNo = ~0;
+        }
+    }
+}
+
+
+/*
+ * --timing-report bookkeeping.  The counters are only touched by
+ * whichever runner holds the baton, so like frameNo they need no
+ * locking.  All times are os::getTimeFast() ticks until they reach the
+ * profiler, which scales them to nanoseconds.
+ */
+static unsigned timingFrameNo = 0;      /* frames reported so far */
+static long long timingBaseTime = 0;    /* replay start */
+static long long frameStartTime = 0;    /* first dispatch of the frame */
+static long long lastSwapTime = 0;      /* previous end-of-frame completion */
+static long long frameParseTicks = 0;
+static long long frameDispatchTicks = 0;
+static unsigned frameFirstCall = 0;
+
+
+/**
+ * Emit the timing record for the frame that just completed and reset
+ * the per-frame counters.
+ */
+static void
+reportFrameTiming(unsigned lastCallNo) {
+    long long now = os::getTimeFast();
+
+    profiler.addFrameTiming(timingFrameNo,
+                            frameStartTime - timingBaseTime,
+                            now - frameStartTime,
+                            frameParseTicks,
+                            frameDispatchTicks,
+                            now - lastSwapTime,
+                            frameFirstCall, lastCallNo);
+
+    ++timingFrameNo;
+    lastSwapTime = now;
+    frameStartTime = 0;
+    frameParseTicks = 0;
+    frameDispatchTicks = 0;
+    frameFirstCall = lastCallNo + 1;
+}
+
+
+/**
+ * Decode the trace on a producer thread, feeding the thread(s) doing
+ * the actual API dispatch through a bounded queue.
+ *
+ * Parsing and dispatch each take a sizable share of a replay, and the
+ * main loop otherwise alternates between them on one thread.  The
+ * producer appends calls in batches so the queue lock is only taken
+ * once per batch.  Consumers are already serialized by the relay race
+ * baton, so a single queue suffices.
+ */
+class CallPrefetcher
+{
+private:
+    enum {
+        BATCH_SIZE = 64,
+        MAX_PENDING = 1024
+    };
+
+    trace::Parser &parser;
+
+    os::mutex mutex;
+    os::condition_variable notEmpty;
+    os::condition_variable notFull;
+
+    /* These are protected by the mutex. */
+    std::deque<trace::Call *> queue;
+    bool done;
+
+    os::thread thread;
+
+    static void *
+    producerThread(CallPrefetcher *_this) {
+        _this->produce();
+        return 0;
+    }
+
+    void
+    produce(void) {
+        std::deque<trace::Call *> batch;
+
+        while (1) {
+            trace::Call *call = parser.parse_call();
+            if (call) {
+                batch.push_back(call);
+                if (batch.size() < BATCH_SIZE) {
+                    continue;
+                }
+            }
+
+            os::unique_lock<os::mutex> lock(mutex);
+            while (queue.size() >= MAX_PENDING) {
+                notFull.wait(lock);
+            }
+            queue.insert(queue.end(), batch.begin(), batch.end());
+            batch.clear();
+            if (!call) {
+                done = true;
+            }
+            notEmpty.signal();
+
+            if (!call) {
+                return;
+            }
+        }
+    }
+
+public:
+    CallPrefetcher(trace::Parser &_parser) :
+        parser(_parser),
+        done(false)
+    {
+        thread = os::thread(producerThread, this);
+    }
+
+    ~CallPrefetcher() {
+        /* Drain whatever is left so the producer can reach the end. */
+        trace::Call *call;
+        while ((call = pull())) {
+            delete call;
+        }
+        thread.join();
+    }
+
+    /**
+     * Next call in trace order, or NULL at the end of the trace.
+     */
+    trace::Call *
+    pull(void) {
+        os::unique_lock<os::mutex> lock(mutex);
+        while (queue.empty() && !done) {
+            notEmpty.wait(lock);
+        }
+        if (queue.empty()) {
+            return NULL;
+        }
+        trace::Call *call = queue.front();
+        queue.pop_front();
+        notFull.signal();
+        return call;
+    }
+};
+
+
+static CallPrefetcher *prefetcher = NULL;
+
+
+/**
+ * Next call to replay, from the prefetch pipeline when enabled.
+ *
+ * For --timing-report this is the parse share of a frame; with
+ * --pipeline it measures the time the replay thread stalls waiting for
+ * decoded calls rather than the decoding itself.
+ */
+static trace::Call *
+nextCall(void) {
+    long long start = 0;
+    if (timingReport) {
+        start = os::getTimeFast();
     }
+
+    trace::Call *call = prefetcher ? prefetcher->pull() : parser.parse_call();
+
+    if (timingReport) {
+        frameParseTicks += os::getTimeFast() - start;
+    }
+    return call;
 }
 
 
@@ -191,13 +1060,20 @@ class RelayRunner;
 
 /**
  * Implement multi-threading by mimicking a relay race.
+ *
+ * Calls are dispatched to one runner (thread) per thread id recorded in
+ * the trace, so contexts end up current on the same thread structure
+ * the application used.  The baton preserves the recorded total call
+ * order, and flushRendering() before each handoff acts as the fence at
+ * the synchronization points the capture implies.
  */
 class RelayRace
 {
 private:
     /**
-     * Runners indexed by the leg they run (i.e, the thread_ids from the
-     * trace).
+     * Runners indexed by the leg they run (the parser's dense
+     * Call::thread_index, so the vector stays small even when the
+     * trace records wide or sparse thread ids).
      */
     std::vector<RelayRunner*> runners;
 
@@ -242,15 +1118,27 @@ private:
     RelayRace *race;
 
     unsigned leg;
-    
+
     os::mutex mutex;
     os::condition_variable wake_cond;
 
     /**
-     * There are protected by the mutex.
+     * There are protected by the mutex; volatile so the unlocked spin
+     * in runRace sees updates.  A stale read there merely falls
+     * through to the locked wait.
      */
-    bool finished;
-    trace::Call *baton;
+    volatile bool finished;
+    trace::Call * volatile baton;
+
+    /**
+     * How long to poll for the baton before sleeping on the condition
+     * variable.  Traces from multithreaded applications often switch
+     * threads every few calls, and a futex sleep/wake per switch costs
+     * more than the calls themselves.
+     */
+    enum {
+        SPIN_COUNT = 10000
+    };
 
     os::thread thread;
 
@@ -278,6 +1166,16 @@ public:
         os::unique_lock<os::mutex> lock(mutex);
 
         while (1) {
+            if (!finished && !baton) {
+                lock.unlock();
+                for (unsigned i = 0; i < SPIN_COUNT; ++i) {
+                    if (finished || baton) {
+                        break;
+                    }
+                }
+                lock.lock();
+            }
+
             while (!finished && !baton) {
                 wake_cond.wait(lock);
             }
@@ -308,15 +1206,32 @@ public:
         /* Consume successive calls for this thread. */
         do {
             assert(call);
-            assert(call->thread_id == leg);
-            retraceCall(call);
-            delete call;
-            call = parser.parse_call();
-        } while (call && call->thread_id == leg);
+            assert(call->thread_index == leg);
+            if (timingReport) {
+                long long start = os::getTimeFast();
+                if (!frameStartTime) {
+                    frameStartTime = start;
+                }
+                retraceCall(call);
+                frameDispatchTicks += os::getTimeFast() - start;
+                if (frameNo != timingFrameNo) {
+                    reportFrameTiming(call->no);
+                }
+            } else {
+                retraceCall(call);
+            }
+            if (prefetcher) {
+                // the decode thread owns the parser
+                delete call;
+            } else {
+                parser.recycle(call);
+            }
+            call = nextCall();
+        } while (call && call->thread_index == leg);
 
         if (call) {
             /* Pass the baton */
-            assert(call->thread_id != leg);
+            assert(call->thread_index != leg);
             flushRendering();
             race->passBaton(call);
         } else {
@@ -337,7 +1252,7 @@ public:
      */
     void
     receiveBaton(trace::Call *call) {
-        assert (call->thread_id == leg);
+        assert (call->thread_index == leg);
 
         mutex.lock();
         baton = call;
@@ -413,14 +1328,14 @@ RelayRace::getRunner(unsigned leg) {
 void
 RelayRace::run(void) {
     trace::Call *call;
-    call = parser.parse_call();
+    call = nextCall();
     if (!call) {
         /* Nothing to do */
         return;
     }
 
     RelayRunner *foreRunner = getForeRunner();
-    if (call->thread_id == 0) {
+    if (call->thread_index == 0) {
         /* We are the forerunner thread, so no need to pass baton */
         foreRunner->baton = call;
     } else {
@@ -437,8 +1352,8 @@ RelayRace::run(void) {
  */
 void
 RelayRace::passBaton(trace::Call *call) {
-    if (0) std::cerr << "switching to thread " << call->thread_id << "\n";
-    RelayRunner *runner = getRunner(call->thread_id);
+    if (0) std::cerr << "switching to thread " << call->thread_index << "\n";
+    RelayRunner *runner = getRunner(call->thread_index);
     runner->receiveBaton(call);
 }
 
@@ -471,21 +1386,297 @@ RelayRace::stopRunners(void) {
 }
 
 
+static void *
+samplerLoop(void *)
+{
+    unsigned period = 1000000 / samplingRate;
+    while (!samplerStop) {
+        os::sleep(period);
+        /* Unsynchronized word-sized read of callNo: a stale or torn
+         * value merely misattributes a single sample. */
+        sampleLog.push_back(callNo);
+    }
+    return NULL;
+}
+
+
+/**
+ * Attribute the sample log to functions and frames with one pass over
+ * the trace, and print the tallies, hottest function first.  Rewinds
+ * the parser to the given bookmark, so must only run once the replay
+ * is complete.
+ */
+static void
+reportSamples(trace::ParseBookmark &beginning)
+{
+    samplerStop = true;
+    samplerThread.join();
+
+    size_t total = sampleLog.size();
+    std::cout << "Sampled " << total << " call numbers at "
+              << samplingRate << " Hz\n";
+    if (!total) {
+        return;
+    }
+
+    std::sort(sampleLog.begin(), sampleLog.end());
+
+    std::map<std::string, unsigned> functionSamples;
+    std::map<unsigned, unsigned> frameSamples;
+
+    parser.setBookmark(beginning);
+
+    unsigned frame = 0;
+    size_t j = 0;
+    trace::Call *call;
+    while (j < total && (call = parser.parse_call())) {
+        /* Samples on call numbers the post-pass never sees (e.g.
+         * taken before the first call was published). */
+        while (j < total && sampleLog[j] < call->no) {
+            ++j;
+        }
+        while (j < total && sampleLog[j] == call->no) {
+            ++functionSamples[call->name()];
+            ++frameSamples[frame];
+            ++j;
+        }
+        if (call->flags & trace::CALL_FLAG_END_FRAME) {
+            ++frame;
+        }
+        delete call;
+    }
+
+    std::vector<std::pair<unsigned, std::string> > ranked;
+    for (std::map<std::string, unsigned>::iterator it = functionSamples.begin();
+         it != functionSamples.end(); ++it) {
+        ranked.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(ranked.begin(), ranked.end());
+    for (size_t i = ranked.size(); i-- > 0; ) {
+        std::cout << ranked[i].first << " samples ("
+                  << (100.0 * ranked[i].first / total) << "%) "
+                  << ranked[i].second << "\n";
+    }
+
+    for (std::map<unsigned, unsigned>::iterator it = frameSamples.begin();
+         it != frameSamples.end(); ++it) {
+        std::cout << "frame " << it->first << ": " << it->second
+                  << " samples\n";
+    }
+}
+
+
+/**
+ * --warmup: preliminary stripped replay pass before the measured one.
+ *
+ * Profiling protocols replay every trace twice, once to populate the
+ * driver's shader and resource caches and once to measure; paying
+ * full replay cost for the first pass doubles every job.  This pass
+ * dispatches every call except draws, clears, swaps and calls without
+ * side effects -- the same CallFlags classification --fast-forward
+ * uses -- so shaders still compile and resources still upload, in a
+ * fraction of full replay time.  The parser is then rewound and the
+ * measured replay starts over from the beginning of the trace.
+ * Objects created here are not destroyed: the measured pass recreates
+ * its own from the same calls, and the warmed caches persisting in
+ * the driver is precisely the point.
+ */
+static void
+warmupLoop() {
+    trace::ParseBookmark beginning;
+    parser.getBookmark(beginning);
+
+    /* Keep the warmup's calls out of the profile; only the measured
+     * pass should be reported. */
+    bool wasProfiling = profiling;
+    profiling = false;
+
+    long long startTime = os::getTime();
+
+    trace::Call *call;
+    while ((call = parser.parse_call())) {
+        if (!skipWhileFastForwarding(call)) {
+            callNo = call->no;
+            retracer.retrace(*call);
+        }
+        parser.recycle(call);
+    }
+
+    /* Let outstanding compiles and uploads drain before the measured
+     * clock starts. */
+    flushRendering();
+
+    parser.setBookmark(beginning);
+
+    profiling = wasProfiling;
+
+    long long endTime = os::getTime();
+
+    if (retrace::verbosity >= -1) {
+        std::cout << "Warmed up in "
+                  << (endTime - startTime) * (1.0 / os::timeFrequency)
+                  << " secs\n";
+    }
+}
+
+
+/**
+ * --snapshot-adaptive: fingerprint pass.
+ *
+ * Replays the whole trace once on this thread (like the warmup pass),
+ * going through retraceCall so the regular snapshot points fire;
+ * writeSnapshot only hashes each snapshot and records the call numbers
+ * whose digest differs from the golden manifest.  The parser is then
+ * rewound and snapshotFrequency narrowed to those calls, so the real
+ * replay pays readback and encoding only for the regressed frames.
+ * The replay itself cannot be shortened the same way: GL state cannot
+ * be restored mid-stream, so the second pass still dispatches every
+ * call.
+ */
+static void
+adaptiveFingerprintPass() {
+    trace::ParseBookmark beginning;
+    parser.getBookmark(beginning);
+
+    adaptivePass = true;
+    frameNo = 0;
+    if (fastReplay) {
+        fastFrame = !fastReplayFrequency.contains(frameNo);
+    }
+
+    long long startTime = os::getTime();
+
+    trace::Call *call;
+    while ((call = parser.parse_call())) {
+        retraceCall(call);
+        parser.recycle(call);
+    }
+    finishPendingSnapshot();
+    flushRendering();
+
+    parser.setBookmark(beginning);
+    adaptivePass = false;
+
+    snapshotFrequency = trace::CallSet();
+    for (size_t i = 0; i < adaptiveDivergent.size(); ++i) {
+        snapshotFrequency.addRange(trace::CallRange(adaptiveDivergent[i]));
+    }
+
+    long long endTime = os::getTime();
+
+    if (retrace::verbosity >= -1) {
+        std::cout << "Adaptive: " << adaptiveDivergent.size()
+                  << " divergent snapshots, fingerprinted in "
+                  << (endTime - startTime) * (1.0 / os::timeFrequency)
+                  << " secs\n";
+    }
+}
+
+
 static void
 mainLoop() {
     addCallbacks(retracer);
 
-    long long startTime = 0; 
+    if (warmupPass) {
+        warmupLoop();
+    }
+
+    if (adaptiveFile) {
+        adaptiveFingerprintPass();
+    }
+
+    long long startTime = 0;
     frameNo = 0;
+    if (fastReplay) {
+        fastFrame = !fastReplayFrequency.contains(frameNo);
+    }
+
+    trace::ParseBookmark sampleBeginning;
+    if (profilingSamples) {
+        parser.getBookmark(sampleBeginning);
+        sampleLog.clear();
+        sampleLog.reserve(samplingRate * 60);
+        samplerStop = false;
+        samplerThread = os::thread(samplerLoop, (void *)0);
+    }
 
     startTime = os::getTime();
 
+    if (timingReport) {
+        /* One ~10ms calibration before the clock starts */
+        profiler.setCpuTimeFrequency(os::calibrateFastTime());
+        timingFrameNo = 0;
+        timingBaseTime = lastSwapTime = os::getTimeFast();
+        frameStartTime = 0;
+        frameParseTicks = 0;
+        frameDispatchTicks = 0;
+        frameFirstCall = 0;
+    }
+
+    if (usePipeline) {
+        prefetcher = new CallPrefetcher(parser);
+    }
+
+    /* PNM output on stdout must stay in call order, and fingerprint
+     * hashing is cheap enough to do inline; only encoded image writes
+     * go through the worker pool. */
+    bool inlineSnapshots = (snapshotPrefix &&
+        snapshotPrefix[0] == '-' && snapshotPrefix[1] == 0) ||
+        snapshotFingerprint ||
+        bisectFile != NULL;
+    if ((snapshotPrefix || comparePrefix) && !inlineSnapshots) {
+        snapshotWriter = new SnapshotWriter;
+        if (snapshotPrefix) {
+            snapshotFileWriter = new os::async_file_writer;
+        }
+    }
+
     RelayRace race;
     race.run();
 
+    finishPendingSnapshot();
+
+    if (snapshotWriter) {
+        /* Blocks until all queued snapshots have been encoded. */
+        delete snapshotWriter;
+        snapshotWriter = NULL;
+    }
+    if (snapshotFileWriter) {
+        /* ... and until the encoded files have reached the filesystem. */
+        delete snapshotFileWriter;
+        snapshotFileWriter = NULL;
+    }
+    if (snapshotDeltaPrev) {
+        image::releasePooledImage(snapshotDeltaPrev);
+        snapshotDeltaPrev = NULL;
+    }
+
+    if (prefetcher) {
+        delete prefetcher;
+        prefetcher = NULL;
+    }
+
+    if (snapshotManifestFile) {
+        writeSnapshotManifest();
+    }
+
+    if (bisectFile) {
+        if (firstDivergence != ~0u) {
+            std::cout << "Bisect: first divergence at "
+                      << (useCallNos ? "call " : "snapshot ")
+                      << firstDivergence << "\n";
+        } else {
+            std::cout << "Bisect: no divergence from " << bisectFile << "\n";
+        }
+    }
+
     long long endTime = os::getTime();
     float timeInterval = (endTime - startTime) * (1.0 / os::timeFrequency);
 
+    if (profilingSamples) {
+        reportSamples(sampleBeginning);
+    }
+
     if ((retrace::verbosity >= -1) || (retrace::profiling)) {
         std::cout << 
             "Rendered " << frameNo << " frames"
@@ -493,6 +1684,11 @@ mainLoop() {
             " average of " << (frameNo/timeInterval) << " fps\n";
     }
 
+    if (retrace::verbosity >= 1) {
+        std::cout << "Scratch arena high-water mark: "
+                  << (ScopedAllocator::highWater() + 1023) / 1024 << " KiB\n";
+    }
+
     if (waitOnFinish) {
         waitForInput();
     } else {
@@ -501,6 +1697,115 @@ mainLoop() {
 }
 
 
+/**
+ * Per-class call tallies for --estimate, collected with the SKIP
+ * machinery so no Call or Value objects are ever materialized.
+ */
+class EstimateVisitor : public trace::CallStatsVisitor
+{
+public:
+    uint64_t calls;
+    uint64_t draws;
+    uint64_t frames;
+    uint64_t blobBytes;
+    uint64_t frameBlobBytes;
+    uint64_t maxFrameBlobBytes;
+
+    EstimateVisitor() :
+        calls(0),
+        draws(0),
+        frames(0),
+        blobBytes(0),
+        frameBlobBytes(0),
+        maxFrameBlobBytes(0)
+    {}
+
+    virtual void visit(const trace::FunctionSig *sig,
+                       unsigned call_no,
+                       unsigned thread_id,
+                       trace::CallFlags flags,
+                       size_t bytes,
+                       unsigned num_args,
+                       size_t blob_bytes)
+    {
+        ++calls;
+        if (flags & trace::CALL_FLAG_RENDER) {
+            ++draws;
+        }
+        blobBytes += blob_bytes;
+        frameBlobBytes += blob_bytes;
+        if (flags & trace::CALL_FLAG_END_FRAME) {
+            ++frames;
+            if (frameBlobBytes > maxFrameBlobBytes) {
+                maxFrameBlobBytes = frameBlobBytes;
+            }
+            frameBlobBytes = 0;
+        }
+    }
+};
+
+
+/**
+ * --estimate: predict replay time and memory from one SKIP pass over
+ * the trace, without ever touching a GPU (setUp() is skipped, so this
+ * also runs on hosts with no driver or display).  The per-class
+ * weights are fitted against the benchmark suite on the reference
+ * replay hosts; they are coarse, but unlike file size they track the
+ * decompressed workload, which is what replay cost actually follows.
+ */
+static int
+estimateFile(const char *filename)
+{
+    trace::Parser p;
+    if (!p.open(filename)) {
+        return 1;
+    }
+
+    EstimateVisitor visitor;
+    bool complete = p.scan(visitor);
+    if (visitor.frameBlobBytes > visitor.maxFrameBlobBytes) {
+        // trailing calls without a frame marker
+        visitor.maxFrameBlobBytes = visitor.frameBlobBytes;
+    }
+    uint64_t sigBytes = p.memoryUsage();
+    p.close();
+
+    // Fitted weights: microseconds per dispatched call, per draw, per
+    // frame (swap and per-frame bookkeeping), and per KiB of blob
+    // payload (uploads dominate everything else byte for byte).
+    const double usPerCall = 0.5;
+    const double usPerDraw = 4.0;
+    const double usPerFrame = 400.0;
+    const double usPerBlobKiB = 1.5;
+
+    double predictedSecs =
+        (visitor.calls * usPerCall +
+         visitor.draws * usPerDraw +
+         visitor.frames * usPerFrame +
+         (visitor.blobBytes / 1024.0) * usPerBlobKiB) * 1e-6;
+
+    // Steady-state commit: parser signature state, the biggest
+    // frame's upload payloads in flight, and a fixed driver/context
+    // overhead.
+    uint64_t predictedBytes = sigBytes + visitor.maxFrameBlobBytes +
+        (64ULL << 20);
+
+    std::cout << filename << ":\n";
+    std::cout << "  calls:            " << visitor.calls << "\n";
+    std::cout << "  draws:            " << visitor.draws << "\n";
+    std::cout << "  frames:           " << visitor.frames << "\n";
+    std::cout << "  blob bytes:       " << visitor.blobBytes << "\n";
+    std::cout << "  predicted replay: " << predictedSecs << " secs\n";
+    std::cout << "  predicted memory: " << ((predictedBytes + (1 << 20) - 1) >> 20)
+              << " MiB\n";
+    if (!complete) {
+        std::cerr << "warning: " << filename << " ends mid-call\n";
+    }
+
+    return 0;
+}
+
+
 } /* namespace retrace */
 
 
@@ -511,32 +1816,143 @@ usage(const char *argv0) {
         "Replay TRACE.\n"
         "\n"
         "  -b, --benchmark         benchmark mode (no error checking or warning messages)\n"
+        "      --pipeline          decode the trace on a separate thread\n"
         "      --pcpu              cpu profiling (cpu times per call)\n"
         "      --pgpu              gpu profiling (gpu times per draw call)\n"
         "      --ppd               pixels drawn profiling (pixels drawn per draw call)\n"
+        "      --psample[=HZ]      sampling profiling (sample the executing call\n"
+        "                          number from a timer thread, default 1000 Hz;\n"
+        "                          no per-call instrumentation overhead)\n"
+        "      --timing-report     per-frame replay timing (wall time, parse vs\n"
+        "                          dispatch breakdown, swap interval) as binary\n"
+        "                          profile records on stdout\n"
         "  -c, --compare=PREFIX    compare against snapshots with given PREFIX\n"
         "  -C, --calls=CALLSET     calls to compare (default is every frame)\n"
         "      --call-nos[=BOOL]   use call numbers in snapshot filenames\n"
         "      --core              use core profile\n"
         "      --db                use a double buffer visual (default)\n"
         "      --driver=DRIVER     force driver type (`hw`, `sw`, `ref`, `null`, or driver module name)\n"
+        "      --estimate          do not replay; predict replay time and\n"
+        "                          memory from one decode-only pass (cost\n"
+        "                          model fitted on the benchmark suite), for\n"
+        "                          farm job scheduling; needs no GPU or\n"
+        "                          display\n"
         "      --sb                use a single buffer visual\n"
         "  -s, --snapshot-prefix=PREFIX    take snapshots; `-` for PNM stdout output\n"
         "  -S, --snapshot=CALLSET  calls to snapshot (default is every frame)\n"
+        "      --fingerprint       hash the snapshots (FNV-1a over the pixels)\n"
+        "                          instead of encoding images, writing\n"
+        "                          `<call> <digest> <WxH>` manifest lines to\n"
+        "                          stdout; compare two manifests with\n"
+        "                          `apitrace diff-images`\n"
+        "      --bisect=FILE       compare fingerprints against a --fingerprint\n"
+        "                          manifest from a good run, in-process, and\n"
+        "                          report the first divergent snapshot; one\n"
+        "                          replay localizes a bad frame\n"
+        "      --snapshot-adaptive=FILE   two-pass capture: fingerprint every\n"
+        "                          snapshot point against a --fingerprint\n"
+        "                          manifest from a golden run, then rewind\n"
+        "                          and snapshot at full cost only the calls\n"
+        "                          that diverged\n"
+        "      --snapshot-format=FORMAT    snapshot and compare format (`png` or\n"
+        "                          `raw`, a fast snappy-compressed container)\n"
+        "      --snapshot-manifest=FILE   with `-s PREFIX`, fingerprint every\n"
+        "                          file snapshot and list `<no> <digest>\n"
+        "                          <filename>` in FILE; snapshots whose\n"
+        "                          content was already written -- in this\n"
+        "                          run, or per a previous manifest at FILE --\n"
+        "                          reference the existing file and are not\n"
+        "                          encoded again, so uploaders only transfer\n"
+        "                          files named by new digests\n"
+        "      --snapshot-rect=WxH+X+Y    only snapshot the given draw buffer\n"
+        "                          rectangle\n"
+        "      --snapshot-shm=NAME with `-s -`, pass the snapshots through the\n"
+        "                          named shared-memory ring instead of encoding\n"
+        "                          them into the stdout pipe\n"
+        "      --snapshot-downsample=N    downscale the snapshots by N before\n"
+        "                          reading them back; blitted on the GPU with\n"
+        "                          linear filtering when the driver supports\n"
+        "                          it, else every Nth pixel is kept\n"
+        "      --snapshot-delta=N  store file snapshots as XOR deltas against\n"
+        "                          the previous frame (.dpng/.draw), with a\n"
+        "                          keyframe every N frames; `apitrace\n"
+        "                          diff-images` reconstructs them transparently\n"
         "  -v, --verbose           increase output verbosity\n"
-        "  -D, --dump-state=CALL   dump state at specific call no\n"
-        "  -w, --wait              waitOnFinish on final frame\n";
+        "  -D, --dump-state=CALLSET   dump state at the given call numbers;\n"
+        "                          one replay serves all of them, so repeated\n"
+        "                          seeks share the common prefix\n"
+        "      --fast-forward      with --dump-state, skip draws, clears and swaps\n"
+        "                          while seeking the target call\n"
+        "      --dump-state-diff   with --dump-state, emit the second and later\n"
+        "                          dumps as deltas against their predecessor\n"
+        "                          (JSON to be merged onto the previous document)\n"
+        "      --dump-state-binary=FILE   with --dump-state, write the image\n"
+        "                          payloads into FILE as raw length-prefixed PNG\n"
+        "                          sections referenced by offset from the JSON,\n"
+        "                          instead of base64-encoding them inline\n"
+        "      --fast-replay=FRAMESET    replay at full cost only the frames in\n"
+        "                          FRAMESET (frame numbers, e.g. `*/100`); draws\n"
+        "                          in the other frames still execute, scissored\n"
+        "                          down to a single pixel, so state stays correct\n"
+        "                          without the fill-rate cost\n"
+        "      --headless          render into pbuffers without a display server\n"
+        "                          (EGL and CGL backends)\n"
+        "      --no-syncs          drop recorded waits (glFinish, client sync\n"
+        "                          waits) where nothing can observe the\n"
+        "                          difference; waits are still honored while a\n"
+        "                          buffer mapping is outstanding or with more\n"
+        "                          than one context\n"
+        "      --program-cache=DIR cache linked GL program binaries under DIR,\n"
+        "                          skipping shader recompilation on later replays\n"
+        "      --server            read successive replay jobs from stdin, one\n"
+        "                          command line per line, reusing the process\n"
+        "                          (and hence driver setup, dispatch resolution\n"
+        "                          and GL contexts) across jobs; after each job\n"
+        "                          a `### <exit-code>` line is written to stdout\n"
+        "      --skip-redundant-state    drop state calls that set already-\n"
+        "                          current state (bindings, enables, active\n"
+        "                          program); the filter stands down inside\n"
+        "                          display lists, inside glBegin/glEnd, and\n"
+        "                          with more than one context\n"
+        "  -w, --wait              waitOnFinish on final frame\n"
+        "      --warmup            run a stripped first pass that skips draws,\n"
+        "                          clears and swaps but still compiles shaders\n"
+        "                          and uploads resources, populating the driver\n"
+        "                          caches, then rewind and replay for real\n";
 }
 
 enum {
-    CALL_NOS_OPT = CHAR_MAX + 1,
+    BISECT_OPT = CHAR_MAX + 1,
+    CALL_NOS_OPT,
     CORE_OPT,
     DB_OPT,
     DRIVER_OPT,
+    DUMP_STATE_BINARY_OPT,
+    DUMP_STATE_DIFF_OPT,
+    ESTIMATE_OPT,
+    FAST_FORWARD_OPT,
+    FAST_REPLAY_OPT,
+    FINGERPRINT_OPT,
+    HEADLESS_OPT,
+    NO_SYNCS_OPT,
     PCPU_OPT,
     PGPU_OPT,
+    PIPELINE_OPT,
     PPD_OPT,
+    PROGRAM_CACHE_OPT,
+    PSAMPLE_OPT,
     SB_OPT,
+    SERVER_OPT,
+    SKIP_REDUNDANT_STATE_OPT,
+    SNAPSHOT_ADAPTIVE_OPT,
+    SNAPSHOT_DELTA_OPT,
+    SNAPSHOT_FORMAT_OPT,
+    SNAPSHOT_MANIFEST_OPT,
+    SNAPSHOT_RECT_OPT,
+    SNAPSHOT_SHM_OPT,
+    SNAPSHOT_DOWNSAMPLE_OPT,
+    TIMING_REPORT_OPT,
+    WARMUP_OPT,
 };
 
 const static char *
@@ -545,6 +1961,7 @@ shortOptions = "bc:C:D:hs:S:vw";
 const static struct option
 longOptions[] = {
     {"benchmark", no_argument, 0, 'b'},
+    {"bisect", required_argument, 0, BISECT_OPT},
     {"call-nos", optional_argument, 0, CALL_NOS_OPT },
     {"calls", required_argument, 0, 'C'},
     {"compare", required_argument, 0, 'c'},
@@ -552,15 +1969,37 @@ longOptions[] = {
     {"db", no_argument, 0, DB_OPT},
     {"driver", required_argument, 0, DRIVER_OPT},
     {"dump-state", required_argument, 0, 'D'},
+    {"dump-state-binary", required_argument, 0, DUMP_STATE_BINARY_OPT},
+    {"dump-state-diff", no_argument, 0, DUMP_STATE_DIFF_OPT},
+    {"estimate", no_argument, 0, ESTIMATE_OPT},
+    {"fast-forward", no_argument, 0, FAST_FORWARD_OPT},
+    {"fast-replay", required_argument, 0, FAST_REPLAY_OPT},
+    {"fingerprint", no_argument, 0, FINGERPRINT_OPT},
+    {"headless", no_argument, 0, HEADLESS_OPT},
     {"help", no_argument, 0, 'h'},
+    {"no-syncs", no_argument, 0, NO_SYNCS_OPT},
     {"pcpu", no_argument, 0, PCPU_OPT},
     {"pgpu", no_argument, 0, PGPU_OPT},
+    {"pipeline", no_argument, 0, PIPELINE_OPT},
     {"ppd", no_argument, 0, PPD_OPT},
+    {"program-cache", required_argument, 0, PROGRAM_CACHE_OPT},
+    {"psample", optional_argument, 0, PSAMPLE_OPT},
     {"sb", no_argument, 0, SB_OPT},
+    {"server", no_argument, 0, SERVER_OPT},
+    {"skip-redundant-state", no_argument, 0, SKIP_REDUNDANT_STATE_OPT},
+    {"snapshot-adaptive", required_argument, 0, SNAPSHOT_ADAPTIVE_OPT},
+    {"snapshot-delta", required_argument, 0, SNAPSHOT_DELTA_OPT},
+    {"snapshot-downsample", required_argument, 0, SNAPSHOT_DOWNSAMPLE_OPT},
+    {"snapshot-format", required_argument, 0, SNAPSHOT_FORMAT_OPT},
+    {"snapshot-manifest", required_argument, 0, SNAPSHOT_MANIFEST_OPT},
+    {"snapshot-rect", required_argument, 0, SNAPSHOT_RECT_OPT},
+    {"snapshot-shm", required_argument, 0, SNAPSHOT_SHM_OPT},
     {"snapshot-prefix", required_argument, 0, 's'},
     {"snapshot", required_argument, 0, 'S'},
+    {"timing-report", no_argument, 0, TIMING_REPORT_OPT},
     {"verbose", no_argument, 0, 'v'},
     {"wait", no_argument, 0, 'w'},
+    {"warmup", no_argument, 0, WARMUP_OPT},
     {0, 0, 0, 0}
 };
 
@@ -571,21 +2010,25 @@ static void exceptionCallback(void)
 }
 
 
-extern "C"
-int main(int argc, char **argv)
+/**
+ * Parse a command line into the option globals.  Also used for each
+ * --server job line.  Returns 0 on success, a positive exit code on
+ * error, and -1 when the command was fully handled (--help).
+ */
+static int
+parseOptions(int argc, char **argv)
 {
     using namespace retrace;
-    int i;
 
-    assert(compareFrequency.empty());
-    assert(snapshotFrequency.empty());
+    /* Start over when called for successive --server jobs. */
+    optind = 1;
 
     int opt;
     while  ((opt = getopt_long_only(argc, argv, shortOptions, longOptions, NULL)) != -1) {
         switch (opt) {
         case 'h':
             usage(argv[0]);
-            return 0;
+            return -1;
         case 'b':
             retrace::debug = false;
             retrace::verbosity = -1;
@@ -606,13 +2049,68 @@ int main(int argc, char **argv)
             }
             break;
         case 'D':
-            dumpStateCallNo = atoi(optarg);
+            dumpStateFrequency = trace::CallSet(optarg);
             dumpingState = true;
             retrace::verbosity = -2;
             break;
         case CORE_OPT:
             retrace::coreProfile = true;
             break;
+        case DUMP_STATE_BINARY_OPT:
+            stateBinaryStream.open(optarg, std::ofstream::binary | std::ofstream::trunc);
+            if (!stateBinaryStream.is_open()) {
+                std::cerr << "error: failed to create " << optarg << "\n";
+                return 1;
+            }
+            retrace::stateBinarySidecar = &stateBinaryStream;
+            break;
+        case DUMP_STATE_DIFF_OPT:
+            dumpStateDiff = true;
+            break;
+        case ESTIMATE_OPT:
+            estimateOnly = true;
+            break;
+        case FAST_FORWARD_OPT:
+            fastForward = true;
+            break;
+        case FAST_REPLAY_OPT:
+            fastReplayFrequency = trace::CallSet(optarg);
+            retrace::fastReplay = true;
+            break;
+        case NO_SYNCS_OPT:
+            retrace::elideSyncs = true;
+            break;
+        case SKIP_REDUNDANT_STATE_OPT:
+            retrace::skipRedundantState = true;
+            break;
+        case BISECT_OPT: {
+            if (!loadFingerprintManifest(optarg, bisectRefs)) {
+                return 1;
+            }
+            bisectFile = optarg;
+            if (snapshotFrequency.empty()) {
+                snapshotFrequency = trace::CallSet(trace::FREQUENCY_FRAME);
+            }
+            if (snapshotPrefix == NULL) {
+                snapshotPrefix = "";
+            }
+            break;
+        }
+        case FINGERPRINT_OPT:
+            snapshotFingerprint = true;
+            if (snapshotFrequency.empty()) {
+                snapshotFrequency = trace::CallSet(trace::FREQUENCY_FRAME);
+            }
+            if (snapshotPrefix == NULL) {
+                snapshotPrefix = "";
+            }
+            break;
+        case HEADLESS_OPT:
+            retrace::headless = true;
+            break;
+        case PROGRAM_CACHE_OPT:
+            retrace::programCacheDir = optarg;
+            break;
         case DB_OPT:
             retrace::doubleBuffer = true;
             break;
@@ -630,9 +2128,15 @@ int main(int argc, char **argv)
                 driverModule = optarg;
             }
             break;
+        case PIPELINE_OPT:
+            usePipeline = true;
+            break;
         case SB_OPT:
             retrace::doubleBuffer = false;
             break;
+        case SERVER_OPT:
+            serverMode = true;
+            break;
         case 's':
             snapshotPrefix = optarg;
             if (snapshotFrequency.empty()) {
@@ -643,6 +2147,64 @@ int main(int argc, char **argv)
                 retrace::verbosity = -2;
             }
             break;
+        case SNAPSHOT_FORMAT_OPT:
+            if (strcasecmp(optarg, "png") == 0) {
+                snapshotRaw = false;
+            } else if (strcasecmp(optarg, "raw") == 0) {
+                snapshotRaw = true;
+            } else {
+                std::cerr << "error: unknown snapshot format " << optarg << "\n";
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case SNAPSHOT_RECT_OPT:
+            if (sscanf(optarg, "%dx%d+%d+%d",
+                       &snapshotWidth, &snapshotHeight,
+                       &snapshotX, &snapshotY) != 4 ||
+                snapshotWidth <= 0 || snapshotHeight <= 0 ||
+                snapshotX < 0 || snapshotY < 0) {
+                std::cerr << "error: invalid snapshot rectangle " << optarg << "\n";
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case SNAPSHOT_SHM_OPT:
+            snapshotShmName = optarg;
+            break;
+        case SNAPSHOT_MANIFEST_OPT:
+            snapshotManifestFile = optarg;
+            loadSnapshotManifest(optarg);
+            break;
+        case SNAPSHOT_ADAPTIVE_OPT:
+            if (!loadFingerprintManifest(optarg, adaptiveRefs)) {
+                return 1;
+            }
+            adaptiveFile = optarg;
+            if (snapshotFrequency.empty()) {
+                snapshotFrequency = trace::CallSet(trace::FREQUENCY_FRAME);
+            }
+            break;
+        case SNAPSHOT_DELTA_OPT: {
+            int interval = atoi(optarg);
+            if (interval < 1) {
+                std::cerr << "error: invalid keyframe interval " << optarg << "\n";
+                usage(argv[0]);
+                return 1;
+            }
+            snapshotDeltaInterval = interval;
+            break;
+        }
+        case SNAPSHOT_DOWNSAMPLE_OPT: {
+            int factor = atoi(optarg);
+            if (factor < 1) {
+                std::cerr << "error: invalid downsample factor " << optarg << "\n";
+                usage(argv[0]);
+                return 1;
+            }
+            snapshotDownsample = factor;
+            break;
+        }
         case 'S':
             snapshotFrequency = trace::CallSet(optarg);
             if (snapshotPrefix == NULL) {
@@ -676,6 +2238,28 @@ int main(int argc, char **argv)
 
             retrace::profilingPixelsDrawn = true;
             break;
+        case PSAMPLE_OPT:
+            retrace::debug = false;
+            retrace::verbosity = -1;
+
+            profilingSamples = true;
+            if (optarg) {
+                samplingRate = atoi(optarg);
+                if (samplingRate < 1 || samplingRate > 100000) {
+                    std::cerr << "error: invalid sampling rate " << optarg << "\n";
+                    return 1;
+                }
+            }
+            break;
+        case TIMING_REPORT_OPT:
+            retrace::debug = false;
+            retrace::verbosity = -1;
+
+            timingReport = true;
+            break;
+        case WARMUP_OPT:
+            warmupPass = true;
+            break;
         default:
             std::cerr << "error: unknown option " << opt << "\n";
             usage(argv[0]);
@@ -683,14 +2267,63 @@ int main(int argc, char **argv)
         }
     }
 
-    retrace::setUp();
-    if (retrace::profiling) {
-        retrace::profiler.setup(retrace::profilingCpuTimes, retrace::profilingGpuTimes, retrace::profilingPixelsDrawn);
+    if (adaptiveFile && !snapshotPrefix && !comparePrefix) {
+        std::cerr << "error: --snapshot-adaptive requires --snapshot-prefix or --compare\n";
+        return 1;
     }
 
-    os::setExceptionCallback(exceptionCallback);
+    if (snapshotManifestFile &&
+        (!snapshotPrefix ||
+         (snapshotPrefix[0] == '-' && snapshotPrefix[1] == 0))) {
+        std::cerr << "error: --snapshot-manifest requires file snapshots (-s PREFIX)\n";
+        return 1;
+    }
+
+    if (fastForward && !retrace::dumpingState) {
+        std::cerr << "warning: --fast-forward has no effect without --dump-state\n";
+    }
+    if (dumpStateDiff && !retrace::dumpingState) {
+        std::cerr << "warning: --dump-state-diff has no effect without --dump-state\n";
+    }
+    if (retrace::stateBinarySidecar && !retrace::dumpingState) {
+        std::cerr << "warning: --dump-state-binary has no effect without --dump-state\n";
+    }
+
+    // Debug builds of applications interleave glGetError after every
+    // call, doubling the call count of their traces.  Replaying them
+    // is a no-op, so filter them out in the parser, unless the user
+    // is inspecting individual calls and expects to see them.
+    if (retrace::verbosity < 1 &&
+        !retrace::profiling &&
+        !retrace::dumpingState &&
+        snapshotFrequency.empty() &&
+        compareFrequency.empty()) {
+        retrace::parser.suppress("glGetError");
+    }
+
+    if (retrace::profiling || timingReport) {
+        retrace::profiler.setup(retrace::profilingCpuTimes, retrace::profilingGpuTimes, retrace::profilingPixelsDrawn, timingReport);
+    }
+
+    return 0;
+}
+
+
+/**
+ * Replay the trace files left on the command line after option parsing.
+ */
+static int
+replayFiles(int argc, char **argv)
+{
+    for (int i = optind; i < argc; ++i) {
+        if (estimateOnly) {
+            int ret = retrace::estimateFile(argv[i]);
+            if (ret) {
+                return ret;
+            }
+            continue;
+        }
 
-    for (i = optind; i < argc; ++i) {
         if (!retrace::parser.open(argv[i])) {
             return 1;
         }
@@ -699,7 +2332,151 @@ int main(int argc, char **argv)
 
         retrace::parser.close();
     }
-    
+
+    return 0;
+}
+
+
+/**
+ * Restore every per-job option to its default, so --server jobs do not
+ * inherit settings from the previous job.  Window-system options
+ * (--driver, --core, --sb, --headless, --program-cache) are
+ * deliberately left alone: they were applied by setUp() when the
+ * server started and cannot change within one process.
+ */
+static void
+resetJobOptions(void)
+{
+    waitOnFinish = false;
+    comparePrefix = NULL;
+    snapshotPrefix = NULL;
+    snapshotRaw = false;
+    snapshotShmName = NULL;
+    snapshotShm.close();
+    snapshotFingerprint = false;
+    bisectFile = NULL;
+    bisectRefs.clear();
+    firstDivergence = ~0u;
+    bisectStopped = false;
+    adaptiveFile = NULL;
+    adaptiveRefs.clear();
+    adaptivePass = false;
+    adaptiveDivergent.clear();
+    snapshotManifestFile = NULL;
+    snapshotManifestByDigest.clear();
+    snapshotManifestEntries.clear();
+    snapshotFrequency = trace::CallSet();
+    compareFrequency = trace::CallSet();
+    fastReplayFrequency = trace::CallSet();
+    dumpStateFrequency = trace::CallSet();
+    dumpStateCallNo = ~0;
+    dumpStateDiff = false;
+    previousStateDump.clear();
+    if (stateBinaryStream.is_open()) {
+        stateBinaryStream.close();
+    }
+    stateBinaryStream.clear();
+    retrace::stateBinarySidecar = NULL;
+    estimateOnly = false;
+    usePipeline = false;
+    fastForward = false;
+    warmupPass = false;
+    timingReport = false;
+    retrace::elideSyncs = false;
+    retrace::skipRedundantState = false;
+
+    retrace::verbosity = 0;
+    retrace::debug = RETRACE_DEBUG_CHECKS;
+    retrace::dumpingState = false;
+    retrace::snapshotX = 0;
+    retrace::snapshotY = 0;
+    retrace::snapshotWidth = -1;
+    retrace::snapshotHeight = -1;
+    retrace::snapshotDownsample = 1;
+    retrace::profiling = false;
+    retrace::profilingGpuTimes = false;
+    retrace::profilingCpuTimes = false;
+    retrace::profilingPixelsDrawn = false;
+    profilingSamples = false;
+    samplingRate = 1000;
+    retrace::useCallNos = true;
+    retrace::fastReplay = false;
+    retrace::fastFrame = false;
+
+    retrace::parser.unsuppress();
+}
+
+
+/**
+ * --server: accept successive replay jobs on one long-lived process,
+ * so interactive clients do not pay process startup, driver
+ * initialization and dispatch-table resolution for every operation.
+ *
+ * Each stdin line is one job, using the regular command-line syntax
+ * (whitespace-separated, no quoting).  After each job a
+ * "### <exit-code>" line is written to stdout and flushed, so the
+ * client can detect completion; EOF ends the server.
+ */
+static void
+serverLoop(void)
+{
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::vector<char> buf(line.begin(), line.end());
+        buf.push_back(0);
+
+        std::vector<char *> args;
+        args.push_back((char *)"glretrace");
+        for (char *tok = strtok(&buf[0], " \t");
+             tok;
+             tok = strtok(NULL, " \t")) {
+            args.push_back(tok);
+        }
+
+        int exitCode = 0;
+        if (args.size() > 1) {
+            resetJobOptions();
+            exitCode = parseOptions((int)args.size(), &args[0]);
+            if (exitCode <= 0) {
+                exitCode = replayFiles((int)args.size(), &args[0]);
+            }
+        }
+
+        std::cout << "### " << exitCode << "\n";
+        std::cout.flush();
+    }
+}
+
+
+extern "C"
+int main(int argc, char **argv)
+{
+    assert(compareFrequency.empty());
+    assert(snapshotFrequency.empty());
+
+    int ret = parseOptions(argc, argv);
+    if (ret) {
+        return ret < 0 ? 0 : ret;
+    }
+
+    if (estimateOnly && !serverMode) {
+        // no GPU involved; skip driver and window system setup
+        return replayFiles(argc, argv);
+    }
+
+    retrace::setUp();
+
+    os::setExceptionCallback(exceptionCallback);
+
+    if (serverMode) {
+        serverLoop();
+    } else {
+        ret = replayFiles(argc, argv);
+        if (ret) {
+            return ret;
+        }
+    }
+
     os::resetExceptionCallback();
 
     // XXX: X often hangs on XCloseDisplay
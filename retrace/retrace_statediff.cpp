@@ -0,0 +1,350 @@
+/**************************************************************************
+ *
+ * Copyright 2012 Jose Fonseca
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Reduction of state dumps to deltas (--dump-state-diff).
+ *
+ * Consecutive state dumps of one replay are nearly identical, so when
+ * several -D targets are requested the later documents repeat
+ * megabytes of unchanged parameters, shaders and textures.  This
+ * reduces a dump against the previous one: both JSON documents are
+ * parsed into trees whose leaves are kept as raw text slices, the
+ * trees are compared member-wise, and only members that changed are
+ * re-emitted (in document order, nested objects reduced recursively).
+ * A member present before but gone now is emitted as null.  Arrays
+ * and any other non-object values are compared and re-emitted whole.
+ *
+ * The output is itself valid JSON; consumers apply it as a recursive
+ * merge onto the previous document.
+ */
+
+#include <assert.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "retrace.hpp"
+
+
+namespace retrace {
+
+
+struct StateNode {
+    bool isObject;
+    std::string raw;                             /* non-object values */
+    std::vector<std::string> order;              /* member keys, quoted */
+    std::map<std::string, StateNode *> members;
+
+    StateNode() : isObject(false) {}
+
+    ~StateNode() {
+        std::map<std::string, StateNode *>::iterator it;
+        for (it = members.begin(); it != members.end(); ++it) {
+            delete it->second;
+        }
+    }
+};
+
+
+static void
+skipSpace(const char *&p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        ++p;
+    }
+}
+
+/**
+ * Scan a string literal, including the quotes, appending it to out.
+ * Returns false on malformed input.
+ */
+static bool
+scanString(const char *&p, std::string &out) {
+    assert(*p == '"');
+    const char *start = p;
+    ++p;
+    while (*p && *p != '"') {
+        if (*p == '\\' && p[1]) {
+            ++p;
+        }
+        ++p;
+    }
+    if (*p != '"') {
+        return false;
+    }
+    ++p;
+    out.append(start, p - start);
+    return true;
+}
+
+/**
+ * Scan one non-object value -- string, number, keyword, or a whole
+ * array, brackets balanced -- as raw text.
+ */
+static bool
+scanRawValue(const char *&p, std::string &out) {
+    if (*p == '"') {
+        return scanString(p, out);
+    }
+    if (*p == '[') {
+        out += *p++;
+        skipSpace(p);
+        while (*p && *p != ']') {
+            if (!out.empty() && out[out.size() - 1] != '[') {
+                out += ", ";
+            }
+            std::string element;
+            if (*p == '{') {
+                /* Objects inside arrays stay raw text too. */
+                int depth = 0;
+                const char *start = p;
+                do {
+                    if (*p == '"') {
+                        std::string s;
+                        if (!scanString(p, s)) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    if (*p == '{') {
+                        ++depth;
+                    } else if (*p == '}') {
+                        --depth;
+                    }
+                    ++p;
+                } while (*p && depth);
+                element.append(start, p - start);
+            } else if (!scanRawValue(p, element)) {
+                return false;
+            }
+            out += element;
+            skipSpace(p);
+            if (*p == ',') {
+                ++p;
+                skipSpace(p);
+            }
+        }
+        if (*p != ']') {
+            return false;
+        }
+        out += *p++;
+        return true;
+    }
+    /* Number or keyword. */
+    const char *start = p;
+    while (*p && *p != ',' && *p != '}' && *p != ']' &&
+           *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        ++p;
+    }
+    if (p == start) {
+        return false;
+    }
+    out.append(start, p - start);
+    return true;
+}
+
+static StateNode *
+parseValue(const char *&p) {
+    skipSpace(p);
+
+    if (*p == '{') {
+        StateNode *node = new StateNode;
+        node->isObject = true;
+        ++p;
+        skipSpace(p);
+        while (*p && *p != '}') {
+            std::string key;
+            if (*p != '"' || !scanString(p, key)) {
+                delete node;
+                return NULL;
+            }
+            skipSpace(p);
+            if (*p != ':') {
+                delete node;
+                return NULL;
+            }
+            ++p;
+            StateNode *child = parseValue(p);
+            if (!child) {
+                delete node;
+                return NULL;
+            }
+            if (node->members.insert(std::make_pair(key, child)).second) {
+                node->order.push_back(key);
+            } else {
+                delete child;
+            }
+            skipSpace(p);
+            if (*p == ',') {
+                ++p;
+                skipSpace(p);
+            }
+        }
+        if (*p != '}') {
+            delete node;
+            return NULL;
+        }
+        ++p;
+        return node;
+    }
+
+    StateNode *node = new StateNode;
+    if (!scanRawValue(p, node->raw)) {
+        delete node;
+        return NULL;
+    }
+    return node;
+}
+
+static void
+indent(std::string &out, int level) {
+    for (int i = 0; i < level; ++i) {
+        out += "  ";
+    }
+}
+
+/**
+ * Serialize a subtree in full.
+ */
+static std::string
+serializeValue(const StateNode *node, int level) {
+    if (!node->isObject) {
+        return node->raw;
+    }
+
+    std::string out = "{";
+    for (size_t i = 0; i < node->order.size(); ++i) {
+        const std::string &key = node->order[i];
+        if (i) {
+            out += ",";
+        }
+        out += "\n";
+        indent(out, level + 1);
+        out += key;
+        out += ": ";
+        out += serializeValue(node->members.find(key)->second, level + 1);
+    }
+    if (!node->order.empty()) {
+        out += "\n";
+        indent(out, level);
+    }
+    out += "}";
+    return out;
+}
+
+/**
+ * Serialize what changed between prev and cur, or return the empty
+ * string when nothing did.
+ */
+static std::string
+diffValue(const StateNode *prev, const StateNode *cur, int level) {
+    if (!prev || prev->isObject != cur->isObject) {
+        return serializeValue(cur, level);
+    }
+
+    if (!cur->isObject) {
+        if (cur->raw == prev->raw) {
+            return "";
+        }
+        return cur->raw;
+    }
+
+    std::string body;
+    for (size_t i = 0; i < cur->order.size(); ++i) {
+        const std::string &key = cur->order[i];
+        std::map<std::string, StateNode *>::const_iterator old =
+            prev->members.find(key);
+        std::string diff = diffValue(old == prev->members.end() ? NULL
+                                                                : old->second,
+                                     cur->members.find(key)->second,
+                                     level + 1);
+        if (diff.empty()) {
+            continue;
+        }
+        if (!body.empty()) {
+            body += ",";
+        }
+        body += "\n";
+        indent(body, level + 1);
+        body += key;
+        body += ": ";
+        body += diff;
+    }
+
+    /* Members gone since the previous dump merge away as null. */
+    for (size_t i = 0; i < prev->order.size(); ++i) {
+        const std::string &key = prev->order[i];
+        if (cur->members.count(key)) {
+            continue;
+        }
+        if (!body.empty()) {
+            body += ",";
+        }
+        body += "\n";
+        indent(body, level + 1);
+        body += key;
+        body += ": null";
+    }
+
+    if (body.empty()) {
+        return "";
+    }
+
+    std::string out = "{";
+    out += body;
+    out += "\n";
+    indent(out, level);
+    out += "}";
+    return out;
+}
+
+
+std::string
+diffStateDump(const std::string &previous, const std::string &current) {
+    const char *p = previous.c_str();
+    StateNode *prevRoot = parseValue(p);
+
+    p = current.c_str();
+    StateNode *curRoot = parseValue(p);
+
+    std::string out;
+    if (!prevRoot || !curRoot) {
+        /* Malformed input; pass the full dump through untouched. */
+        out = current;
+    } else {
+        out = diffValue(prevRoot, curRoot, 0);
+        if (out.empty()) {
+            out = "{}";
+        }
+        out += "\n";
+    }
+
+    delete prevRoot;
+    delete curRoot;
+    return out;
+}
+
+
+} /* namespace retrace */
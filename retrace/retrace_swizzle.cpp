@@ -182,6 +182,11 @@ delRegionByPointer(void *ptr) {
     assert(0);
 }
 
+bool
+hasRegions(void) {
+    return !regionMap.empty();
+}
+
 void *
 lookupAddress(unsigned long long address) {
     RegionMap::iterator it = lookupRegion(address);
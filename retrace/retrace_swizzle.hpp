@@ -27,7 +27,10 @@
 #define _RETRACE_SWIZZLE_HPP_
 
 
+#include <string.h>
+
 #include <map>
+#include <vector>
 
 #include "trace_model.hpp"
 
@@ -47,32 +50,104 @@ namespace retrace {
  *
  * XXX: In some cases, instead of returning the key, it would make more sense
  * to return an unused data value (e.g., container count).
+ *
+ * Lookups happen several times per retraced call, so the storage is
+ * tuned for how GL implementations actually hand out names: small
+ * dense integers go through a direct-mapped array, and only sparse
+ * application-chosen names fall through to an open-addressing hash
+ * table.  Neither path pays the pointer chasing of a tree lookup.
  */
 template <class T>
 class map
 {
 private:
-    typedef std::map<T, T> base_type;
-    base_type base;
+    enum {
+        DENSE_SIZE = 1024
+    };
+
+    /* Direct-mapped slots for names below DENSE_SIZE. */
+    T dense[DENSE_SIZE];
+    unsigned char densePresent[DENSE_SIZE];
+
+    /* Linear-probing table, power-of-two sized, grown at 2/3 load so
+     * probe sequences stay short. */
+    struct Entry {
+        T value;
+        T key;
+        bool used;
+
+        Entry() : value(), key(), used(false) {}
+    };
+
+    std::vector<Entry> buckets;
+    size_t population;
+
+    static size_t
+    hash(const T &key) {
+        /* Fibonacci hashing, to scramble the low bits that the
+         * power-of-two mask keeps. */
+        return size_t(key) * size_t(2654435761u);
+    }
+
+    void
+    grow(void) {
+        std::vector<Entry> old;
+        old.swap(buckets);
+        buckets.resize(old.empty() ? 64 : 2 * old.size());
+        size_t mask = buckets.size() - 1;
+        for (size_t j = 0; j < old.size(); ++j) {
+            if (old[j].used) {
+                size_t i = hash(old[j].key) & mask;
+                while (buckets[i].used) {
+                    i = (i + 1) & mask;
+                }
+                buckets[i] = old[j];
+            }
+        }
+    }
+
+    T &
+    probe(const T &key) {
+        if (3 * (population + 1) > 2 * buckets.size()) {
+            grow();
+        }
+        size_t mask = buckets.size() - 1;
+        size_t i = hash(key) & mask;
+        while (buckets[i].used) {
+            if (buckets[i].key == key) {
+                return buckets[i].value;
+            }
+            i = (i + 1) & mask;
+        }
+        buckets[i].key = key;
+        buckets[i].value = key;
+        buckets[i].used = true;
+        ++population;
+        return buckets[i].value;
+    }
 
 public:
 
+    map() : population(0) {
+        memset(densePresent, 0, sizeof densePresent);
+    }
+
     T & operator[] (const T &key) {
-        typename base_type::iterator it;
-        it = base.find(key);
-        if (it == base.end()) {
-            return (base[key] = key);
+        size_t n = size_t(key);
+        if (n < DENSE_SIZE) {
+            if (!densePresent[n]) {
+                dense[n] = key;
+                densePresent[n] = 1;
+            }
+            return dense[n];
         }
-        return it->second;
+        return probe(key);
     }
-    
+
     const T & operator[] (const T &key) const {
-        typename base_type::const_iterator it;
-        it = base.find(key);
-        if (it == base.end()) {
-            return (base[key] = key);
-        }
-        return it->second;
+        /* Missing keys are materialized with their identity value,
+         * exactly as in the mutable overload. */
+        return (*const_cast<map *>(this))[key];
     }
 };
 
@@ -83,6 +158,10 @@ addRegion(unsigned long long address, void *buffer, unsigned long long size);
 void
 delRegionByPointer(void *ptr);
 
+/** Whether any mapped-memory region is currently outstanding. */
+bool
+hasRegions(void);
+
 void *
 toPointer(trace::Value &value, bool bind = false);
 
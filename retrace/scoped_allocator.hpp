@@ -31,38 +31,161 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <algorithm>
+
+#include "os_thread.hpp"
+
 
 /**
- * Similar to alloca(), but implemented with malloc.
+ * Similar to alloca(), but backed by a per-thread slab arena.
+ *
+ * Every retraced call creates one of these for its array-argument
+ * scratch, so the allocations come in strict scope order and a whole
+ * scope is discarded at once; the arena just rewinds its bump position
+ * on scope exit instead of handing each block back to malloc.  Slabs
+ * are kept for reuse, so a steady-state replay does no heap traffic
+ * here at all.  The deepest position ever reached is tracked and can
+ * be reported via highWater().
+ *
+ * bind() raises a permanence floor: everything allocated on the thread
+ * up to that point is never rewound.  It is only used for the few
+ * outputs that must outlive their call (glFeedbackBuffer and
+ * glSelectBuffer arrays), which were intentionally never freed before
+ * either.
  */
 class ScopedAllocator
 {
 private:
-    uintptr_t next;
+    enum {
+        SLAB_SIZE = 64 * 1024,
+        ALIGNMENT = 16
+    };
+
+    struct Slab {
+        Slab *next;
+        size_t size;
+        size_t used;
+
+        char *data(void) {
+            return reinterpret_cast<char *>(this + 1);
+        }
+    };
+
+    struct Arena {
+        /* Chain in allocation-position order; current is the slab
+         * being bumped, slabs beyond it are rewound and reusable. */
+        Slab *first;
+        Slab *current;
+
+        /* bind() floor -- never rewound past. */
+        Slab *floorSlab;
+        size_t floorUsed;
+
+        size_t liveBytes;
+        size_t highWaterBytes;
+    };
+
+    static thread_specific Arena *arena;
+
+    /* Rewind position captured at scope entry. */
+    Slab *markSlab;
+    size_t markUsed;
+
+    static Arena *
+    getArena(void) {
+        if (!arena) {
+            arena = static_cast<Arena *>(calloc(1, sizeof(Arena)));
+        }
+        return arena;
+    }
+
+    /* Advance to a slab with room for size bytes, reusing a rewound
+     * slab when the next one in the chain fits. */
+    static Slab *
+    grabSlab(Arena *a, size_t size) {
+        Slab *next = a->current ? a->current->next : a->first;
+        if (next && next->size >= size) {
+            assert(next->used == 0);
+            a->current = next;
+            return next;
+        }
+
+        size_t slabSize = std::max<size_t>(SLAB_SIZE, size);
+        Slab *slab = static_cast<Slab *>(malloc(sizeof(Slab) + slabSize));
+        if (!slab) {
+            return NULL;
+        }
+        slab->size = slabSize;
+        slab->used = 0;
+
+        /* Insert in chain-position order, pushing a too-small rewound
+         * slab further down for later reuse. */
+        slab->next = next;
+        if (a->current) {
+            a->current->next = slab;
+        } else {
+            a->first = slab;
+        }
+        a->current = slab;
+        return slab;
+    }
+
+    /* Whether the bind() floor lies beyond the given position. */
+    static bool
+    floorIsBeyond(const Arena *a, const Slab *slab, size_t used) {
+        if (!a->floorSlab) {
+            return false;
+        }
+        if (a->floorSlab == slab) {
+            return a->floorUsed > used;
+        }
+        if (!slab) {
+            return true;
+        }
+        for (const Slab *s = slab->next; s; s = s->next) {
+            if (s == a->floorSlab) {
+                return true;
+            }
+        }
+        return false;
+    }
 
 public:
     inline
-    ScopedAllocator() :
-        next(0) {
+    ScopedAllocator() {
+        Arena *a = getArena();
+        markSlab = a ? a->current : NULL;
+        markUsed = markSlab ? markSlab->used : 0;
     }
 
     inline void *
     alloc(size_t size) {
-        /* Always return valid address, even when size is zero */
-        size = std::max(size, sizeof(uintptr_t));
+        /* Always return a valid, aligned address, even when size is
+         * zero */
+        size = (std::max(size, sizeof(uintptr_t)) + (ALIGNMENT - 1)) &
+               ~(size_t)(ALIGNMENT - 1);
 
-        uintptr_t * buf = static_cast<uintptr_t *>(malloc(sizeof(uintptr_t) + size));
-        if (!buf) {
+        Arena *a = getArena();
+        if (!a) {
             return NULL;
         }
+        Slab *slab = a->current;
+        if (!slab || slab->size - slab->used < size) {
+            slab = grabSlab(a, size);
+            if (!slab) {
+                return NULL;
+            }
+        }
 
-        *buf = next;
-        next = reinterpret_cast<uintptr_t>(buf);
-        assert((next & 1) == 0);
-
-        return static_cast<void *>(&buf[1]);
+        void *ptr = slab->data() + slab->used;
+        slab->used += size;
+        a->liveBytes += size;
+        if (a->liveBytes > a->highWaterBytes) {
+            a->highWaterBytes = a->liveBytes;
+        }
+        return ptr;
     }
-    
+
     template< class T >
     inline T *
     alloc(size_t size = 1) {
@@ -76,24 +199,53 @@ public:
     inline void
     bind(T *ptr) {
         if (ptr) {
-            reinterpret_cast<uintptr_t *>(ptr)[-1] |= 1;
+            Arena *a = getArena();
+            a->floorSlab = a->current;
+            a->floorUsed = a->current ? a->current->used : 0;
         }
     }
 
     inline
     ~ScopedAllocator() {
-        while (next) {
-            uintptr_t temp = *reinterpret_cast<uintptr_t *>(next);
+        Arena *a = arena;
+        if (!a) {
+            return;
+        }
 
-            bool bind = temp & 1;
-            temp &= ~1;
+        Slab *slab = markSlab;
+        size_t used = markUsed;
+        if (floorIsBeyond(a, slab, used)) {
+            slab = a->floorSlab;
+            used = a->floorUsed;
+        }
 
-            if (!bind) {
-                free(reinterpret_cast<void *>(next));
+        if (slab) {
+            slab->used = used;
+        }
+        a->current = slab;
+
+        /* Rewind everything past the mark and recount what stays
+         * live; the chain is a handful of slabs at most. */
+        size_t live = 0;
+        bool past = (slab == NULL);
+        for (Slab *s = a->first; s; s = s->next) {
+            if (past) {
+                s->used = 0;
+            }
+            live += s->used;
+            if (s == slab) {
+                past = true;
             }
-
-            next = temp;
         }
+        a->liveBytes = live;
+    }
+
+    /**
+     * Deepest scratch usage this thread has reached, in bytes.
+     */
+    static size_t
+    highWater(void) {
+        return arena ? arena->highWaterBytes : 0;
     }
 };
 
@@ -25,26 +25,31 @@
 ##########################################################################/
 
 
+import struct
 import sys
 
 
-def process(stream):
-    times = {}
+# Fixed-size binary records emitted by trace::Profiler; see
+# common/trace_profiler.hpp
+RECORD_SIZE = 64
+RECORD_CALL = 1
+
+# type, no, gpu_start, gpu_dura, cpu_start, cpu_dura, pixels, program, name_id
+CALL_FORMAT = '=II5qII'
 
-    # call no gpu_start gpu_dura cpu_start cpu_dura pixels program name
 
-    for line in stream:
-        words = line.split(' ')
+def process(stream):
+    times = {}
 
-        if line.startswith('#'):
-            continue
+    while True:
+        record = stream.read(RECORD_SIZE)
+        if len(record) < RECORD_SIZE:
+            break
 
-        if words[0] == 'call':
-            id = long(words[1])
-            duration = long(words[3])
-            shader = long(words[7])
-            func = words[8]
+        type, id, gpu_start, duration, cpu_start, cpu_dura, pixels, shader, name_id = \
+            struct.unpack_from(CALL_FORMAT, record)
 
+        if type == RECORD_CALL:
             if times.has_key(shader):
                 times[shader]['draws'] += 1
                 times[shader]['duration'] += duration
@@ -75,7 +80,7 @@ def process(stream):
 def main():
     if len(sys.argv) > 1:
         for arg in sys.argv[1:]:
-            process(open(arg, 'rt'))
+            process(open(arg, 'rb'))
     else:
         process(sys.stdin)
 
@@ -46,17 +46,38 @@ thumb_size = 320, 320
 
 gaussian_kernel = ImageFilter.Kernel((3, 3), [1, 2, 1, 2, 4, 2, 1, 2, 1], 16)
 
+
+def open_image(path):
+    '''Open an image, including apitrace's raw snapshot format
+    (glretrace --snapshot-format=raw).'''
+    if path.endswith('.raw'):
+        import struct
+        import snappy
+        data = open(path, 'rb').read()
+        magic, width, height, channels, compressed_size = \
+            struct.unpack_from('<4sIII I', data)
+        assert magic == 'atri'
+        pixels = snappy.uncompress(data[20 : 20 + compressed_size])
+        mode = [None, 'L', 'LA', 'RGB', 'RGBA'][channels]
+        try:
+            factory = Image.frombytes
+        except AttributeError:
+            factory = Image.fromstring
+        return factory(mode, (width, height), pixels)
+    return Image.open(path)
+
+
 class Comparer:
     '''Image comparer.'''
 
     def __init__(self, ref_image, src_image, alpha = False):
         if isinstance(ref_image, basestring):
-            self.ref_im = Image.open(ref_image)
+            self.ref_im = open_image(ref_image)
         else:
             self.ref_im = ref_image
 
         if isinstance(src_image, basestring):
-            self.src_im = Image.open(src_image)
+            self.src_im = open_image(src_image)
         else:
             self.src_im = src_image
 
@@ -114,11 +135,14 @@ class Comparer:
 def surface(html, image):
     if True:
         name, ext = os.path.splitext(image)
+        if ext == '.raw':
+            # browsers cannot show the raw snapshots anyway
+            ext = '.png'
         thumb = name + '.thumb' + ext
         if os.path.exists(image) \
            and (not os.path.exists(thumb) \
                 or os.path.getmtime(thumb) < os.path.getmtime(image)):
-            im = Image.open(image)
+            im = open_image(image)
             im.thumbnail(thumb_size)
             im.save(thumb)
     else:
@@ -130,7 +154,7 @@ def is_image(path):
     name = os.path.basename(path)
     name, ext1 = os.path.splitext(name)
     name, ext2 = os.path.splitext(name)
-    return ext1 in ('.png', '.bmp') and ext2 not in ('.diff', '.thumb')
+    return ext1 in ('.png', '.bmp', '.raw') and ext2 not in ('.diff', '.thumb')
 
 
 def find_images(prefix):
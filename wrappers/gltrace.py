@@ -111,9 +111,11 @@ class GlTracer(Tracer):
     def header(self, api):
         Tracer.header(self, api)
 
+        print '#include <algorithm>'
+        print
         print '#include "gltrace.hpp"'
         print
-        
+
         # Which glVertexAttrib* variant to use
         print 'enum vertex_attrib {'
         print '    VERTEX_ATTRIB,'
@@ -267,21 +269,75 @@ class GlTracer(Tracer):
         print '}'
         print
 
+        # Generate a table of the glGet* parameters, with the element count
+        # and whether the value is a symbolic enum.  The specs only know the
+        # pnames by name -- the values live in the GL headers -- so the table
+        # cannot be sorted at generation time; it is sorted once at load
+        # instead, letting the helpers below binary search rather than grind
+        # through a switch with several thousand cases.
+        print 'struct _gl_param_info {'
+        print '    GLenum pname;'
+        print '    unsigned short size; // 0 = only known at runtime'
+        print '    bool symbolic;'
+        print '};'
+        print
+        print 'static _gl_param_info _gl_param_table[] = {'
+        special_sizes = []
+        for function, type, count, name in glparams.parameters:
+            if type is not None:
+                if isinstance(count, int):
+                    size = count
+                else:
+                    special_sizes.append((name, count))
+                    size = 0
+                symbolic = type is glapi.GLenum and 'true' or 'false'
+                print '    { %s, %u, %s },' % (name, size, symbolic)
+        print '};'
+        print
+        print 'static const size_t _gl_param_table_size ='
+        print '    sizeof _gl_param_table / sizeof _gl_param_table[0];'
+        print
+        print 'static inline bool'
+        print '_gl_param_info_cmp(const _gl_param_info & a, const _gl_param_info & b) {'
+        print '    return a.pname < b.pname;'
+        print '}'
+        print
+        print 'static struct _gl_param_table_sorter {'
+        print '    _gl_param_table_sorter() {'
+        print '        std::sort(_gl_param_table,'
+        print '                  _gl_param_table + _gl_param_table_size,'
+        print '                  _gl_param_info_cmp);'
+        print '    }'
+        print '} _gl_param_table_sorter_instance;'
+        print
+        print 'static const _gl_param_info *'
+        print '_gl_param_lookup(GLenum pname) {'
+        print '    size_t lo = 0;'
+        print '    size_t hi = _gl_param_table_size;'
+        print '    while (lo < hi) {'
+        print '        size_t mid = lo + (hi - lo) / 2;'
+        print '        if (_gl_param_table[mid].pname < pname) {'
+        print '            lo = mid + 1;'
+        print '        } else {'
+        print '            hi = mid;'
+        print '        }'
+        print '    }'
+        print '    if (lo != _gl_param_table_size && _gl_param_table[lo].pname == pname) {'
+        print '        return &_gl_param_table[lo];'
+        print '    }'
+        print '    return NULL;'
+        print '}'
+        print
+
         # Generate a helper function to determine whether a parameter name
         # refers to a symbolic value or not
-        print 'static bool'
+        print 'static inline bool'
         print 'is_symbolic_pname(GLenum pname) {'
-        print '    switch (pname) {'
-        for function, type, count, name in glparams.parameters:
-            if type is glapi.GLenum:
-                print '    case %s:' % name
-        print '        return true;'
-        print '    default:'
-        print '        return false;'
-        print '    }'
+        print '    const _gl_param_info *info = _gl_param_lookup(pname);'
+        print '    return info != NULL && info->symbolic;'
         print '}'
         print
-        
+
         # Generate a helper function to determine whether a parameter value is
         # potentially symbolic or not; i.e., if the value can be represented in
         # an enum or not
@@ -295,14 +351,20 @@ class GlTracer(Tracer):
         # Generate a helper function to know how many elements a parameter has
         print 'static size_t'
         print '_gl_param_size(GLenum pname) {'
-        print '    switch (pname) {'
-        for function, type, count, name in glparams.parameters:
-            if type is not None:
+        if special_sizes:
+            print '    switch (pname) {'
+            print '    // these can only be sized with a runtime query'
+            for name, count in special_sizes:
                 print '    case %s: return %s;' % (name, count)
-        print '    default:'
+            print '    default:'
+            print '        break;'
+            print '    }'
+        print '    const _gl_param_info *info = _gl_param_lookup(pname);'
+        print '    if (info == NULL) {'
         print r'        os::log("apitrace: warning: %s: unknown GLenum 0x%04X\n", __FUNCTION__, pname);'
         print '        return 1;'
         print '    }'
+        print '    return info->size;'
         print '}'
         print
 
@@ -588,6 +650,7 @@ class GlTracer(Tracer):
             print '            if (flush && length > 0) {'
             self.emit_memcpy('map', 'map', 'length')
             print '            }'
+            print '            trace::shadowRelease(map);'
             print '        }'
             print '    }'
         if function.name == 'glUnmapBufferOES':
@@ -751,6 +814,11 @@ class GlTracer(Tracer):
             print '        _glGetBufferParameteriv(target, GL_BUFFER_SIZE, &mapping->length);'
             print '        mapping->write = (access != GL_READ_ONLY);'
             print '        mapping->explicit_flush = false;'
+            print '        if (mapping->map && mapping->length > 0 && mapping->write) {'
+            print '            // glMapBuffer preserves the old contents, so snapshot'
+            print '            // them for delta compression on unmap'
+            print '            trace::shadowCover(mapping->map, mapping->length);'
+            print '        }'
             print '    }'
         if function.name == 'glMapBufferRange':
             print '    if (access & GL_MAP_WRITE_BIT) {'
@@ -763,6 +831,12 @@ class GlTracer(Tracer):
             print '        mapping->write = access & GL_MAP_WRITE_BIT;'
             print '        mapping->explicit_flush = access & GL_MAP_FLUSH_EXPLICIT_BIT;'
             print '    }'
+            print '    if (%s && length > 0 && (access & GL_MAP_WRITE_BIT) &&' % (instance,)
+            print '        !(access & (GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT))) {'
+            print '        // invalidated contents are undefined and must stay on the'
+            print '        // full-copy path; anything else can be delta-compressed'
+            print '        trace::shadowCover(%s, length);' % (instance,)
+            print '    }'
 
     boolean_names = [
         'GL_FALSE',
@@ -818,6 +892,13 @@ class GlTracer(Tracer):
         'glTextureSubImage3DEXT',
     ])
 
+    def scalarArgKind(self, function, arg):
+        # serializeArgValue below dumps symbolic names for some
+        # integer/float params, so those must keep the generic path.
+        if function.name.startswith('gl') and arg.name == 'param':
+            return None
+        return Tracer.scalarArgKind(self, function, arg)
+
     def serializeArgValue(self, function, arg):
         # Recognize offsets instead of blobs when a PBO is bound
         if function.name in self.unpack_function_names \
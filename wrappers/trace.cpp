@@ -28,6 +28,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
 
 #ifdef ANDROID
 #include <sys/types.h>
@@ -111,5 +115,152 @@ isTracingEnabled(void)
 #endif /* ANDROID */
 
 
+void
+fakeMemcpy(void *dest, const void *src, size_t size)
+{
+    unsigned _call = localWriter.beginEnter(&memcpy_sig);
+    localWriter.beginArg(0);
+    localWriter.writePointer((uintptr_t)dest);
+    localWriter.endArg();
+    localWriter.beginArg(1);
+    localWriter.writeBlob(src, size);
+    localWriter.endArg();
+    localWriter.beginArg(2);
+    localWriter.writeUInt(size);
+    localWriter.endArg();
+    localWriter.endEnter();
+    localWriter.beginLeave(_call);
+    localWriter.endLeave();
+}
+
+
+/*
+ * Shadow copies of mapped buffer ranges.
+ *
+ * Mapped vertex/index buffers used to be recorded wholesale on unmap,
+ * which for streaming buffers means gigabytes of near-identical data
+ * per trace.  A snapshot is taken when a range is mapped; on unmap (or
+ * explicit flush) the range is compared against it page by page and
+ * only the runs of pages that changed are emitted.  Pages that compare
+ * equal hold the same bytes the replayed buffer already has, so
+ * skipping them is safe -- except for maps that invalidate the
+ * contents, which the tracers must keep on the full-copy path by not
+ * covering them.
+ */
+
+#define SHADOW_PAGE_SIZE 4096
+
+struct MemoryShadow {
+    size_t size;
+    char *copy;
+};
+
+typedef std::map<const char *, MemoryShadow> ShadowMap;
+static ShadowMap g_memoryShadows;
+static os::mutex g_shadowMutex;
+
+void
+shadowCover(const void *ptr, size_t size)
+{
+    if (!ptr || !size) {
+        return;
+    }
+
+    char *copy = (char *)malloc(size);
+    if (!copy) {
+        return;
+    }
+    memcpy(copy, ptr, size);
+
+    g_shadowMutex.lock();
+    ShadowMap::iterator it = g_memoryShadows.find((const char *)ptr);
+    if (it != g_memoryShadows.end()) {
+        free(it->second.copy);
+        g_memoryShadows.erase(it);
+    }
+    MemoryShadow shadow;
+    shadow.size = size;
+    shadow.copy = copy;
+    g_memoryShadows[(const char *)ptr] = shadow;
+    g_shadowMutex.unlock();
+}
+
+void
+shadowRelease(const void *ptr)
+{
+    g_shadowMutex.lock();
+    for (ShadowMap::iterator it = g_memoryShadows.begin();
+         it != g_memoryShadows.end(); ++it) {
+        if (it->first <= (const char *)ptr &&
+            (const char *)ptr < it->first + it->second.size) {
+            free(it->second.copy);
+            g_memoryShadows.erase(it);
+            break;
+        }
+    }
+    g_shadowMutex.unlock();
+}
+
+void
+fakeMemcpyDelta(void *dest, const void *src, size_t size)
+{
+    const char *bytes = (const char *)src;
+
+    g_shadowMutex.lock();
+
+    MemoryShadow *shadow = NULL;
+    const char *shadowStart = NULL;
+    for (ShadowMap::iterator it = g_memoryShadows.begin();
+         it != g_memoryShadows.end(); ++it) {
+        if (it->first <= bytes &&
+            bytes + size <= it->first + it->second.size) {
+            shadow = &it->second;
+            shadowStart = it->first;
+            break;
+        }
+    }
+
+    if (!shadow) {
+        g_shadowMutex.unlock();
+        fakeMemcpy(dest, src, size);
+        return;
+    }
+
+    char *copy = shadow->copy + (bytes - shadowStart);
+    size_t offset = 0;
+    while (offset < size) {
+        size_t page;
+
+        // skip unchanged pages
+        while (offset < size) {
+            page = std::min((size_t)SHADOW_PAGE_SIZE, size - offset);
+            if (memcmp(copy + offset, bytes + offset, page) != 0) {
+                break;
+            }
+            offset += page;
+        }
+        if (offset >= size) {
+            break;
+        }
+
+        // gather the run of changed pages
+        size_t runStart = offset;
+        while (offset < size) {
+            page = std::min((size_t)SHADOW_PAGE_SIZE, size - offset);
+            if (memcmp(copy + offset, bytes + offset, page) == 0) {
+                break;
+            }
+            offset += page;
+        }
+
+        memcpy(copy + runStart, bytes + runStart, offset - runStart);
+        fakeMemcpy((char *)dest + runStart, bytes + runStart,
+                   offset - runStart);
+    }
+
+    g_shadowMutex.unlock();
+}
+
+
 } /* namespace trace */
 
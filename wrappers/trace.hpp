@@ -33,6 +33,13 @@
 #define _TRACE_HPP_
 
 
+#include <stddef.h>
+#include <string.h>
+
+#include "trace_format.hpp"
+#include "trace_writer_local.hpp"
+
+
 namespace trace {
 
 
@@ -50,6 +57,114 @@ isTracingEnabled(void) {
 #endif /* !ANDROID */
 
 
+/**
+ * Emit a fake memcpy call into the trace, recording size bytes read
+ * from src as a write to dest (both are the same address for mapped
+ * buffer updates, but the expressions may differ in constness).
+ */
+void fakeMemcpy(void *dest, const void *src, size_t size);
+
+/**
+ * Like fakeMemcpy, but when a shadow snapshot of the range exists
+ * (taken with shadowCover when the buffer was mapped), only the pages
+ * that actually changed are emitted, each as an ordinary memcpy record
+ * that replays without any reader-side support.  Falls back to a full
+ * copy when no shadow covers the range.
+ */
+void fakeMemcpyDelta(void *dest, const void *src, size_t size);
+
+/**
+ * Snapshot a mapped range so later fakeMemcpyDelta calls against it
+ * can emit only the modified pages.  Replaces any previous snapshot
+ * starting at the same address.
+ */
+void shadowCover(const void *ptr, size_t size);
+
+/**
+ * Drop the snapshot whose range contains ptr, if any.  Call on unmap.
+ */
+void shadowRelease(const void *ptr);
+
+
+/**
+ * Stack encoder for calls whose arguments are all fixed-size scalars
+ * (the glUniform/glVertexAttrib family, which dominates captured call
+ * volume).
+ *
+ * The code generator computes MAX_SIZE from the call signature, so the
+ * buffer needs no bounds checks at runtime: each argument is composed
+ * with plain stores and the whole run reaches the writer through a
+ * single LocalWriter::writeEncoded() call, instead of one virtual
+ * write per tag, index and value.
+ */
+template <size_t MAX_SIZE>
+class ScalarEncoder {
+protected:
+    char m_buf[MAX_SIZE];
+    size_t m_len;
+
+    void putByte(char c) {
+        m_buf[m_len++] = c;
+    }
+
+    void putUInt(unsigned long long value) {
+        do {
+            m_buf[m_len] = 0x80 | (value & 0x7f);
+            value >>= 7;
+            ++m_len;
+        } while (value);
+        m_buf[m_len - 1] &= 0x7f;
+    }
+
+public:
+    ScalarEncoder() : m_len(0) {}
+
+    const char *buffer(void) const {
+        return m_buf;
+    }
+
+    size_t size(void) const {
+        return m_len;
+    }
+
+    void beginArg(unsigned index) {
+        putByte(trace::CALL_ARG);
+        putUInt(index);
+    }
+
+    void writeBool(bool value) {
+        putByte(value ? trace::TYPE_TRUE : trace::TYPE_FALSE);
+    }
+
+    void writeSInt(signed long long value) {
+        if (value < 0) {
+            putByte(trace::TYPE_SINT);
+            putUInt(-value);
+        } else {
+            putByte(trace::TYPE_UINT);
+            putUInt(value);
+        }
+    }
+
+    void writeUInt(unsigned long long value) {
+        putByte(trace::TYPE_UINT);
+        putUInt(value);
+    }
+
+    void writeFloat(float value) {
+        putByte(trace::TYPE_FLOAT);
+        memcpy(&m_buf[m_len], &value, sizeof value);
+        m_len += sizeof value;
+    }
+
+    void writeDouble(double value) {
+        putByte(trace::TYPE_DOUBLE);
+        memcpy(&m_buf[m_len], &value, sizeof value);
+        m_len += sizeof value;
+    }
+};
+
+
 } /* namespace trace */
 
 
@@ -442,7 +442,18 @@ class Tracer:
         print 'static std::map<void *, void *> g_WrappedObjects;'
 
     def footer(self, api):
-        pass
+        # Table of the per-function signatures above, registered so the
+        # writer can emit every definition right after the trace header,
+        # keeping the per-call path free of first-use definition stalls.
+        functions = [function for function in api.getAllFunctions() if not function.internal]
+        if functions:
+            print 'static const trace::FunctionSig * const _allSigs[%u] = {' % len(functions)
+            for function in functions:
+                print '    &_%s_sig,' % (function.name,)
+            print '};'
+            print
+            print 'static trace::SignatureRegistrar _sigRegistrar(_allSigs, %u);' % len(functions)
+            print
 
     def traceFunctionDecl(self, function):
         # Per-function declarations
@@ -487,13 +498,56 @@ class Tracer:
         print '}'
         print
 
+    # Literal kinds trace::ScalarEncoder can compose on the stack, with
+    # their worst-case encoded sizes (type tag plus value bytes).
+    scalarKindSizes = {
+        'Bool': 1,
+        'SInt': 11,
+        'UInt': 11,
+        'Float': 5,
+        'Double': 9,
+    }
+
+    def scalarArgKind(self, function, arg):
+        '''Return the Literal kind of an argument that can take the
+        precomputed-layout fast path, or None to use the generic
+        serializer.  Derived tracers which customize serializeArgValue
+        must override this to veto the affected arguments.'''
+
+        type = arg.type
+        while isinstance(type, (stdapi.Const, stdapi.Alias)):
+            type = type.type
+        if isinstance(type, stdapi.Literal) and type.kind in self.scalarKindSizes:
+            return type.kind
+        return None
+
+    def serializeEnterArgs(self, function):
+        inputArgs = [arg for arg in function.args if not arg.output]
+        kinds = [self.scalarArgKind(function, arg) for arg in inputArgs]
+        if inputArgs and not [kind for kind in kinds if kind is None]:
+            # All arguments are fixed-size scalars: compose them on the
+            # stack and hand them to the writer in a single append.
+            size = 0
+            for arg, kind in zip(inputArgs, kinds):
+                assert arg.index < 0x80
+                size += 2 + self.scalarKindSizes[kind]
+            print '    {'
+            print '        trace::ScalarEncoder<%u> _enc;' % size
+            for arg, kind in zip(inputArgs, kinds):
+                print '        _enc.beginArg(%u);' % arg.index
+                print '        _enc.write%s(%s);' % (kind, arg.name)
+            print '        trace::localWriter.writeEncoded(_enc.buffer(), _enc.size());'
+            print '    }'
+            return
+        for arg in function.args:
+            if not arg.output:
+                self.unwrapArg(function, arg)
+                self.serializeArg(function, arg)
+
     def traceFunctionImplBody(self, function):
         if not function.internal:
             print '    unsigned _call = trace::localWriter.beginEnter(&_%s_sig);' % (function.name,)
-            for arg in function.args:
-                if not arg.output:
-                    self.unwrapArg(function, arg)
-                    self.serializeArg(function, arg)
+            self.serializeEnterArgs(function)
             print '    trace::localWriter.endEnter();'
         self.invokeFunction(function)
         if not function.internal:
@@ -781,19 +835,7 @@ class Tracer:
         print '    %s_this->%s(%s);' % (result, method.name, ', '.join([str(arg.name) for arg in method.args]))
     
     def emit_memcpy(self, dest, src, length):
-        print '        unsigned _call = trace::localWriter.beginEnter(&trace::memcpy_sig);'
-        print '        trace::localWriter.beginArg(0);'
-        print '        trace::localWriter.writePointer((uintptr_t)%s);' % dest
-        print '        trace::localWriter.endArg();'
-        print '        trace::localWriter.beginArg(1);'
-        print '        trace::localWriter.writeBlob(%s, %s);' % (src, length)
-        print '        trace::localWriter.endArg();'
-        print '        trace::localWriter.beginArg(2);'
-        print '        trace::localWriter.writeUInt(%s);' % length
-        print '        trace::localWriter.endArg();'
-        print '        trace::localWriter.endEnter();'
-        print '        trace::localWriter.beginLeave(_call);'
-        print '        trace::localWriter.endLeave();'
+        print '        trace::fakeMemcpyDelta(%s, %s, %s);' % (dest, src, length)
     
     def fake_call(self, function, args):
         print '            unsigned _fake_call = trace::localWriter.beginEnter(&_%s_sig);' % (function.name,)